@@ -0,0 +1,96 @@
+#pragma once
+import std;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Shared by the engine benchmarks. A case processes a batch of packets
+// several times over and reports the median per packet, so one preempted
+// round does not skew it. Cycles are read from the TSC, which counts at a
+// fixed reference rate, not the core clock; they are 0 on other CPUs.
+// "--quick" makes one short round, enough for ctest to check the benchmark
+// still runs.
+namespace benchSupport {
+
+struct Result {
+    double nanoseconds = 0;  // per item, median over the rounds
+    double cycles = 0;
+};
+
+inline bool quick = false;
+
+inline void init(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        quick = quick || std::string_view(argv[i]) == "--quick";
+    }
+}
+
+inline std::size_t rounds() {
+    return quick ? 1 : 9;
+}
+
+// Items per round for a full run of count
+inline std::size_t batch(std::size_t count) {
+    return quick ? std::min<std::size_t>(count, 16) : count;
+}
+
+inline std::uint64_t cycleCounter() {
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #else
+    return 0;
+    #endif
+}
+
+// Keeps the compiler from dropping work whose result is never read
+template <typename T>
+inline void keep(const T& value) {
+    #if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+    #else
+    static volatile const void* sink;
+    sink = &value;
+    #endif
+}
+
+// body() processes items items once; it runs once to warm up, then rounds() times
+template <typename Body>
+Result measure(std::size_t items, Body&& body) {
+    body();
+    std::vector<double> nanoseconds;
+    std::vector<double> cycles;
+    for (std::size_t round = 0; round < rounds(); ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto startCycles = cycleCounter();
+        body();
+        const auto endCycles = cycleCounter();
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        nanoseconds.push_back(elapsed.count() / static_cast<double>(items));
+        cycles.push_back(static_cast<double>(endCycles - startCycles) / static_cast<double>(items));
+    }
+    const auto median = [](std::vector<double>& values) {
+        std::ranges::nth_element(values, values.begin() + static_cast<std::ptrdiff_t>(values.size() / 2));
+        return values[values.size() / 2];
+    };
+    return {median(nanoseconds), median(cycles)};
+}
+
+// "  812 ns  2436 cyc"
+inline std::string describe(const Result& result) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(0) << std::setw(6) << result.nanoseconds << " ns " << std::setw(7)
+         << result.cycles << " cyc";
+    return text.str();
+}
+
+// Millions of items per second
+inline double mega(const Result& result) {
+    return result.nanoseconds > 0 ? 1000.0 / result.nanoseconds : 0;
+}
+
+inline void title(std::string_view text) {
+    std::cout << "\n" << text << "\n" << std::string(text.size(), '-') << std::endl;
+}
+
+} // namespace benchSupport
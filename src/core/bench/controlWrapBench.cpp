@@ -0,0 +1,132 @@
+import std;
+#include "benchSupport.h"
+#include "controlChannel.h"
+#include "controlWrap.h"
+
+// How fast ControlWrap::unwrap drops spoofed control packets, in millions
+// of packets per second on one core, by how far a spoofed packet gets:
+// random bytes are mostly stopped by the length and opcode checks, a guessed
+// opcode by the session id once the server's reset is in, and a packet with
+// the right session id only by the HMAC. Genuine packets, and
+// ControlChannel without a wrap parsing the same junk, are the reference
+// points.
+
+namespace {
+
+constexpr std::size_t packetSize = 100;
+constexpr std::size_t distinctPackets = 1024;
+constexpr std::size_t packetsPerRound = 1 << 15;
+constexpr std::uint64_t serverSession = 0x5356'5356'0000'0066;
+
+using Packets = std::vector<std::vector<std::uint8_t>>;
+
+ControlWrap::Key keyFor(ControlWrap::Mode mode, std::string digest) {
+    ControlWrap::Key key;
+    key.mode = mode;
+    key.digest = std::move(digest);
+    for (std::size_t i = 0; i < ControlWrap::staticKeySize; ++i) {
+        key.staticKey.push_back(static_cast<std::uint8_t>(i * 13 + 5));
+    }
+    return key;
+}
+
+void writeSession(std::vector<std::uint8_t>& packet, std::uint64_t session) {
+    for (std::size_t i = 0; i < 8; ++i) {
+        packet[1 + i] = static_cast<std::uint8_t>(session >> (56 - 8 * i));
+    }
+}
+
+// Random packets; opcode and session fixed where given
+Packets spoofed(std::optional<ControlChannel::Opcode> opcode, std::optional<std::uint64_t> session) {
+    std::mt19937_64 random(66);
+    Packets packets(distinctPackets, std::vector<std::uint8_t>(packetSize));
+    for (auto& packet : packets) {
+        std::ranges::generate(packet, [&]() { return static_cast<std::uint8_t>(random()); });
+        if (opcode) {
+            packet[0] = static_cast<std::uint8_t>(static_cast<std::uint8_t>(*opcode) << 3);
+        }
+        if (session) {
+            writeSession(packet, *session);
+        }
+    }
+    return packets;
+}
+
+// Millions of packets dropped (or accepted) per second
+double rate(const std::function<bool(std::span<const std::uint8_t>)>& unwrap, const Packets& packets) {
+    const std::size_t count = benchSupport::batch(packetsPerRound);
+    std::size_t next = 0;
+    const auto result = benchSupport::measure(count, [&]() {
+        for (std::size_t i = 0; i < count; ++i) {
+            benchSupport::keep(unwrap(packets[next++ % packets.size()]));
+        }
+    });
+    return benchSupport::mega(result);
+}
+
+void row(std::string_view name, double mpps) {
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(2) << std::setw(9)
+              << mpps << " Mpps" << std::endl;
+}
+
+void runMode(std::string_view name, ControlWrap::Mode mode, const std::string& digest) {
+    benchSupport::title(std::string(name) + ", " + std::to_string(packetSize) + "-byte packets");
+    ControlWrap wrap(keyFor(mode, digest));
+    std::vector<std::uint8_t> out;
+    const auto unwrapWith = [&](std::optional<std::uint64_t> session) {
+        return [&, session](std::span<const std::uint8_t> packet) { return wrap.unwrap(packet, session, out); };
+    };
+
+    const auto junk = spoofed(std::nullopt, std::nullopt);
+    const auto guessedOpcode = spoofed(ControlChannel::Opcode::ControlV1, std::nullopt);
+    const auto rightSession = spoofed(ControlChannel::Opcode::ControlV1, serverSession);
+    row("random bytes, session known", rate(unwrapWith(serverSession), junk));
+    row("random bytes, before the server reset", rate(unwrapWith(std::nullopt), junk));
+    row("control opcode, wrong session", rate(unwrapWith(serverSession), guessedOpcode));
+    row("control opcode, before the server reset", rate(unwrapWith(std::nullopt), guessedOpcode));
+    row("right session, forged HMAC", rate(unwrapWith(serverSession), rightSession));
+    const auto stats = wrap.stats();
+    if (stats.accepted != 0) {
+        throw std::runtime_error(std::string(name) + ": a spoofed packet was accepted");
+    }
+
+    // Without a key direction both ends of tls-auth use the same keys, so a
+    // second client can stand in for the server. Fresh packet ids every
+    // round, or the replay window would drop them.
+    if (mode == ControlWrap::Mode::TlsAuth) {
+        ControlWrap server(keyFor(mode, digest));
+        const std::size_t count = benchSupport::batch(packetsPerRound) * (benchSupport::rounds() + 1);
+        Packets genuine(count);
+        const std::size_t macSize = digest == "SHA1" ? 20 : 32;
+        std::vector<std::uint8_t> plain(packetSize - 8 - macSize, 0);
+        plain[0] = static_cast<std::uint8_t>(static_cast<std::uint8_t>(ControlChannel::Opcode::ControlV1) << 3);
+        writeSession(plain, serverSession);
+        for (auto& packet : genuine) {
+            server.wrap(plain, packet);
+        }
+        std::size_t next = 0;
+        row("genuine, accepted", rate([&](std::span<const std::uint8_t>) {
+            return wrap.unwrap(genuine[next++], serverSession, out);
+        }, genuine));
+        if (wrap.stats().accepted != count) {
+            throw std::runtime_error(std::string(name) + ": genuine packets were dropped");
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchSupport::init(argc, argv);
+
+    benchSupport::title("No wrap: ControlChannel::processIncoming, " + std::to_string(packetSize) + "-byte packets");
+    ControlChannel channel([](std::span<const std::uint8_t>) { return true; });
+    const auto junk = spoofed(std::nullopt, std::nullopt);
+    row("random bytes, before the server reset",
+        rate([&](std::span<const std::uint8_t> packet) { return channel.processIncoming(packet); }, junk));
+
+    runMode("tls-auth (HMAC-SHA1)", ControlWrap::Mode::TlsAuth, "SHA1");
+    runMode("tls-auth (HMAC-SHA256)", ControlWrap::Mode::TlsAuth, "SHA256");
+    runMode("tls-crypt (HMAC-SHA256, AES-256-CTR)", ControlWrap::Mode::TlsCrypt, "SHA256");
+    return 0;
+}
@@ -0,0 +1,233 @@
+import std;
+#include "benchSupport.h"
+#include "controlChannel.h"
+#include "dataChannel.h"
+
+// Per-packet cost of the data channel. DataChannel seals with a kernel
+// specialized for the session's cipher, compression and framing; the
+// reference here builds the same packets but branches on those parameters
+// for every packet. The benchmark checks that both produce the same bytes
+// before timing them. Also: sealInPlace() against seal(), whose two copies
+// it avoids, and open().
+
+namespace {
+
+using Cipher = DataChannel::Cipher;
+using Compression = DataChannel::Compression;
+using Protocol = VpnTransport::Protocol;
+
+constexpr std::size_t packetIdSize = 4;
+constexpr std::size_t tagSize = 16;
+constexpr std::size_t keySlotSize = 64;
+constexpr std::size_t packetsPerRound = 2048;
+
+struct Session {
+    std::string_view name;
+    DataChannel::Config config;
+};
+
+// DataChannel's seal kernel with the session parameters as runtime values
+class BranchingSealer {
+public:
+    BranchingSealer(const DataChannel::Config& config, std::span<const std::uint8_t> keyBlock)
+        : config(config)
+        , ctx(EVP_CIPHER_CTX_new()) {
+        const EVP_CIPHER* cipher = config.cipher == Cipher::Aes128Gcm   ? EVP_aes_128_gcm()
+                                   : config.cipher == Cipher::Aes256Gcm ? EVP_aes_256_gcm()
+                                                                        : EVP_chacha20_poly1305();
+        EVP_EncryptInit_ex(ctx, cipher, nullptr, keyBlock.data(), nullptr);
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, static_cast<int>(iv.size()), nullptr);
+        std::copy_n(keyBlock.data() + keySlotSize, iv.size() - packetIdSize, iv.begin() + packetIdSize);
+        if (config.peerId) {
+            header = {static_cast<std::uint8_t>((static_cast<std::uint8_t>(ControlChannel::Opcode::DataV2) << 3) | config.keyId),
+                      static_cast<std::uint8_t>(*config.peerId >> 16), static_cast<std::uint8_t>(*config.peerId >> 8),
+                      static_cast<std::uint8_t>(*config.peerId)};
+            headerLength = 4;
+        } else {
+            header[0] = static_cast<std::uint8_t>((static_cast<std::uint8_t>(ControlChannel::Opcode::DataV1) << 3) | config.keyId);
+        }
+    }
+
+    ~BranchingSealer() { EVP_CIPHER_CTX_free(ctx); }
+
+    std::span<std::uint8_t> seal(std::span<std::uint8_t> buffer, std::size_t length) {
+        const std::size_t prefix = config.framing == Protocol::Tcp ? 2 : 0;
+        if (buffer.size() < DataChannel::headroom + length + DataChannel::tailroom || nextPacketId == 0) {
+            return {};
+        }
+        std::uint8_t* const payload = buffer.data() + DataChannel::headroom;
+        std::uint8_t* body = payload;
+        std::size_t bodyLength = length;
+        switch (config.compression) {
+            case Compression::Lzo:
+                *--body = 0xFA;
+                ++bodyLength;
+                break;
+            case Compression::Swap:
+                payload[length] = length > 0 ? payload[0] : 0;
+                payload[0] = 0xFB;
+                ++bodyLength;
+                break;
+            case Compression::StubV2:
+                if (length > 0 && payload[0] == 0x50) {
+                    body -= 2;
+                    body[0] = 0x50;
+                    body[1] = 0x00;
+                    bodyLength += 2;
+                }
+                break;
+            case Compression::None:
+                break;
+        }
+
+        std::uint8_t* const tag = body - tagSize;
+        std::uint8_t* const packetId = tag - packetIdSize;
+        std::uint8_t* const start = packetId - headerLength - prefix;
+        const std::size_t total = prefix + headerLength + packetIdSize + tagSize + bodyLength;
+        std::copy_n(header.begin(), headerLength, start + prefix);
+        const std::uint32_t id = nextPacketId++;
+        packetId[0] = static_cast<std::uint8_t>(id >> 24);
+        packetId[1] = static_cast<std::uint8_t>(id >> 16);
+        packetId[2] = static_cast<std::uint8_t>(id >> 8);
+        packetId[3] = static_cast<std::uint8_t>(id);
+        std::copy_n(packetId, packetIdSize, iv.begin());
+
+        int written = 0;
+        const std::uint8_t* aad = headerLength == 1 ? packetId : start + prefix;
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, iv.data()) != 1 ||
+            EVP_EncryptUpdate(ctx, nullptr, &written, aad, static_cast<int>(packetId + packetIdSize - aad)) != 1 ||
+            EVP_EncryptUpdate(ctx, body, &written, body, static_cast<int>(bodyLength)) != 1 ||
+            EVP_EncryptFinal_ex(ctx, nullptr, &written) != 1 ||
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(tagSize), tag) != 1) {
+            return {};
+        }
+        if (prefix != 0) {
+            start[0] = static_cast<std::uint8_t>((total - prefix) >> 8);
+            start[1] = static_cast<std::uint8_t>(total - prefix);
+        }
+        return {start, total};
+    }
+
+private:
+    DataChannel::Config config;
+    EVP_CIPHER_CTX* ctx;
+    std::array<std::uint8_t, 12> iv{};
+    std::array<std::uint8_t, 4> header{};
+    std::size_t headerLength = 1;
+    std::uint32_t nextPacketId = 1;
+};
+
+std::vector<std::uint8_t> keyBlock() {
+    std::vector<std::uint8_t> block(DataChannel::keyBlockSize);
+    for (std::size_t i = 0; i < block.size(); ++i) {
+        block[i] = static_cast<std::uint8_t>(i * 7 + 1);
+    }
+    return block;
+}
+
+// The server's view: its sending half is the client's receiving half
+std::vector<std::uint8_t> mirrored(const std::vector<std::uint8_t>& block) {
+    std::vector<std::uint8_t> swapped(block.begin() + 2 * keySlotSize, block.end());
+    swapped.insert(swapped.end(), block.begin(), block.begin() + 2 * keySlotSize);
+    return swapped;
+}
+
+std::vector<std::uint8_t> payloadOf(std::size_t size) {
+    std::vector<std::uint8_t> payload(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        payload[i] = static_cast<std::uint8_t>(i);
+    }
+    return payload;
+}
+
+// One packet through each: the comparison is only fair if they build the same thing
+bool sameWire(const Session& session, std::size_t size) {
+    const auto keys = keyBlock();
+    DataChannel channel(session.config, keys);
+    BranchingSealer reference(session.config, keys);
+    const auto payload = payloadOf(size);
+    std::vector<std::uint8_t> first(DataChannel::headroom + size + DataChannel::tailroom);
+    std::vector<std::uint8_t> second(first.size());
+    std::ranges::copy(payload, first.begin() + DataChannel::headroom);
+    std::ranges::copy(payload, second.begin() + DataChannel::headroom);
+    const auto specialized = channel.sealInPlace(first, size);
+    const auto branching = reference.seal(second, size);
+    return !specialized.empty() && std::ranges::equal(specialized, branching);
+}
+
+void run(const Session& session, std::size_t size) {
+    if (!sameWire(session, size)) {
+        throw std::runtime_error(std::string(session.name) + ": the reference builds different packets");
+    }
+    const auto keys = keyBlock();
+    const auto payload = payloadOf(size);
+    const std::size_t packets = benchSupport::batch(packetsPerRound);
+    std::vector<std::uint8_t> buffer(DataChannel::headroom + size + DataChannel::tailroom);
+    std::vector<std::uint8_t> wire(buffer.size());
+
+    // In place, the payload is re-sealed where the last round left it: the cost is the same
+    DataChannel channel(session.config, keys);
+    const auto specialized = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(channel.sealInPlace(buffer, size).size());
+        }
+    });
+    BranchingSealer reference(session.config, keys);
+    const auto branching = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(reference.seal(buffer, size).size());
+        }
+    });
+    DataChannel copying(session.config, keys);
+    const auto sealed = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(copying.seal(payload, wire));
+        }
+    });
+
+    // Each round opens packets it has not seen, or the replay window would drop them
+    DataChannel sender(session.config, keys);
+    DataChannel receiver(session.config, mirrored(keys));
+    std::vector<std::vector<std::uint8_t>> inbound;
+    for (std::size_t i = 0; i < packets * (benchSupport::rounds() + 1); ++i) {
+        std::vector<std::uint8_t> packet(buffer.size());
+        packet.resize(sender.seal(payload, packet));
+        // TCP framing is the transport's to strip
+        if (session.config.framing == Protocol::Tcp) {
+            packet.erase(packet.begin(), packet.begin() + 2);
+        }
+        inbound.push_back(std::move(packet));
+    }
+    std::size_t next = 0;
+    const auto opened = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(receiver.open(inbound[next++], wire));
+        }
+    });
+    if (receiver.stats().opened != inbound.size()) {
+        throw std::runtime_error(std::string(session.name) + ": packets failed to open");
+    }
+
+    std::cout << std::left << std::setw(30) << session.name << std::right << std::setw(5) << size << " B"
+              << "  specialized" << benchSupport::describe(specialized) << "  branching" << benchSupport::describe(branching)
+              << "  seal+copy" << benchSupport::describe(sealed) << "  open" << benchSupport::describe(opened) << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchSupport::init(argc, argv);
+    benchSupport::title("Data channel, per packet (median of rounds)");
+    const std::array<Session, 4> sessions{{
+        {"AES-256-GCM udp v2", {Cipher::Aes256Gcm, Compression::None, Protocol::Udp, 7, 0}},
+        {"AES-256-GCM tcp v1 comp-lzo", {Cipher::Aes256Gcm, Compression::Lzo, Protocol::Tcp, std::nullopt, 0}},
+        {"AES-128-GCM udp v2 stub-v2", {Cipher::Aes128Gcm, Compression::StubV2, Protocol::Udp, 7, 0}},
+        {"CHACHA20-POLY1305 udp v2", {Cipher::ChaCha20Poly1305, Compression::None, Protocol::Udp, 7, 0}},
+    }};
+    for (const auto& session : sessions) {
+        for (const std::size_t size : {64, 512, 1400}) {
+            run(session, size);
+        }
+    }
+    return 0;
+}
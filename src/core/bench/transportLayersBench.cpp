@@ -0,0 +1,74 @@
+import std;
+#include "benchSupport.h"
+#include "transportLayers.h"
+
+// Cost of each obfuscation layer per packet and direction, as the compiled
+// chain (layers inlined, one indirect call) and as the runtime chain (a
+// dispatch per layer) the same spec gets from parse(spec, false). The empty
+// chain is the floor: what wrap() and unwrap() cost with nothing to do.
+
+namespace {
+
+constexpr std::size_t packetsPerRound = 1 << 14;
+
+struct Costs {
+    benchSupport::Result wrap;
+    benchSupport::Result unwrap;
+};
+
+Costs measure(const TransportChain& chain, std::size_t size) {
+    const std::size_t offset = chain.headroom();
+    std::vector<std::uint8_t> buffer(TransportChain::maxHeadroom + size);
+    for (std::size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = static_cast<std::uint8_t>(i * 31);
+    }
+    const std::size_t packets = benchSupport::batch(packetsPerRound);
+
+    // Wrapping again what the last pass left is as much work as the first time
+    Costs costs;
+    costs.wrap = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(chain.wrap(buffer, offset, size).size());
+        }
+    });
+
+    // Unwrapping leaves a record header alone and the XOR layers accept
+    // anything, so one wrapped packet can be unwrapped over and over
+    const auto wire = chain.wrap(buffer, offset, size);
+    if (!chain.unwrap(wire)) {
+        throw std::runtime_error(chain.describe() + ": cannot unwrap its own packet");
+    }
+    costs.unwrap = benchSupport::measure(packets, [&]() {
+        for (std::size_t i = 0; i < packets; ++i) {
+            benchSupport::keep(chain.unwrap(wire).has_value());
+        }
+    });
+    return costs;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchSupport::init(argc, argv);
+    const std::vector<std::pair<std::string_view, std::string_view>> specs{
+        {"none", ""},
+        {"xormask (4-byte mask)", "xormask=s1av"},
+        {"xormask (13-byte mask)", "xormask=0123456789abc"},
+        {"xorptrpos", "xorptrpos"},
+        {"reverse", "reverse"},
+        {"tls-record", "tls-record"},
+        {"obfuscate (4 layers)", "xorptrpos,reverse,xorptrpos,xormask=s1av"},
+        {"obfuscate + tls-record", "xorptrpos,reverse,xorptrpos,xormask=s1av,tls-record"},
+    };
+    for (const std::size_t size : {64, 512, 1400}) {
+        benchSupport::title("Transport layers, " + std::to_string(size) + "-byte packets, per pass (compiled / runtime)");
+        for (const auto& [name, spec] : specs) {
+            const auto compiled = measure(TransportChain::parse(spec), size);
+            const auto runtime = measure(TransportChain::parse(spec, false), size);
+            std::cout << std::left << std::setw(24) << name << std::right << "  wrap"
+                      << benchSupport::describe(compiled.wrap) << " /" << benchSupport::describe(runtime.wrap) << "  unwrap"
+                      << benchSupport::describe(compiled.unwrap) << " /" << benchSupport::describe(runtime.unwrap) << std::endl;
+        }
+    }
+    return 0;
+}
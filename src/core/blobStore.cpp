@@ -0,0 +1,264 @@
+import std;
+#include "blobStore.h"
+#include "fileSync.h"
+
+#include <openssl/evp.h>
+
+#ifdef SIAVPN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// "SVB1" + codec + payload
+constexpr std::string_view blobMagic = "SVB1";
+constexpr char rawCodec = 'r';
+constexpr char zstdCodec = 'z';
+constexpr int zstdLevel = 3;
+
+std::string readWholeFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Missing blob: " + path.filename().string());
+    }
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+} // namespace
+
+BlobStore::BlobStore(std::filesystem::path directory, bool compress)
+    : directory(std::move(directory))
+    , compress(compress) {
+    std::error_code ignored;
+    std::filesystem::create_directories(this->directory, ignored);
+}
+
+BlobStore::~BlobStore() {
+    dropRetained();
+}
+
+void BlobStore::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    std::lock_guard<std::mutex> lock(storeMutex);
+    dropRetained();
+    memoryBudget = std::move(budget);
+}
+
+std::string BlobStore::hashOf(std::string_view content) {
+    std::array<unsigned char, EVP_MAX_MD_SIZE> digest{};
+    unsigned int length = 0;
+    if (EVP_Digest(content.data(), content.size(), digest.data(), &length, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("SHA-256 failed");
+    }
+
+    constexpr std::string_view hexDigits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (unsigned int i = 0; i < length; ++i) {
+        hex.push_back(hexDigits[digest[i] >> 4]);
+        hex.push_back(hexDigits[digest[i] & 0x0f]);
+    }
+    return hex;
+}
+
+bool BlobStore::compressionAvailable() {
+    #ifdef SIAVPN_HAVE_ZSTD
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+std::filesystem::path BlobStore::blobPath(const std::string& hash) const {
+    return directory / hash;
+}
+
+std::string BlobStore::put(std::string_view content) {
+    std::string hash = hashOf(content);
+    const auto path = blobPath(hash);
+
+    // Blobs are renamed into place before they are flushed, so one left by a
+    // crash may be empty or truncated. An existing blob is trusted only once
+    // its content checks out (once per run); a bad one is written again.
+    std::lock_guard<std::mutex> lock(storeMutex);
+    if (verified.contains(hash)) {
+        return hash;
+    }
+    if (std::filesystem::exists(path)) {
+        try {
+            if (hashOf(decode(readWholeFile(path))) == hash) {
+                verified.insert(hash);
+                return hash;
+            }
+        } catch (const std::exception& e) {
+            // Unreadable or undecodable: replaced below like a missing one
+        }
+        loaded.erase(hash);
+    }
+
+    std::string error;
+    const auto staging = directory / ("." + hash + ".tmp");
+    if (!fileSync::writeFile(staging, encode(content), false, error) ||
+        !fileSync::replaceFile(staging, path, error)) {
+        std::error_code ignored;
+        std::filesystem::remove(staging, ignored);
+        throw std::runtime_error("Failed to store blob: " + error);
+    }
+    unsynced.push_back(path);
+    verified.insert(hash);
+    return hash;
+}
+
+BlobStore::Blob BlobStore::get(const std::string& hash) {
+    {
+        std::lock_guard<std::mutex> lock(storeMutex);
+        if (auto it = loaded.find(hash); it != loaded.end()) {
+            if (auto blob = it->second.lock()) {
+                retain(blob);
+                return blob;
+            }
+        }
+    }
+
+    // Read and verify outside the lock; a racing loader just produces an equal buffer
+    auto blob = std::make_shared<const std::string>(decode(readWholeFile(blobPath(hash))));
+    if (hashOf(*blob) != hash) {
+        throw std::runtime_error("Corrupt blob: " + hash);
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    auto& slot = loaded[hash];
+    if (auto existing = slot.lock()) {
+        retain(existing);
+        return existing;
+    }
+    slot = blob;
+    retain(blob);
+    return blob;
+}
+
+// Called with storeMutex held
+void BlobStore::retain(const Blob& blob) {
+    if (auto it = std::find(retained.begin(), retained.end(), blob); it != retained.end()) {
+        retained.splice(retained.begin(), retained, it);
+        return;
+    }
+    if (blob->size() > retainedBlobBytes) {
+        return;
+    }
+    auto evictOldest = [this]() {
+        retainedBytes -= retained.back()->size();
+        if (memoryBudget) {
+            memoryBudget->release(MemoryBudget::Subsystem::ProfileCache, retained.back()->size());
+        }
+        retained.pop_back();
+    };
+    while (!retained.empty() && retainedBytes + blob->size() > retainedBlobBytes) {
+        evictOldest();
+    }
+    while (memoryBudget && !memoryBudget->tryReserve(MemoryBudget::Subsystem::ProfileCache, blob->size())) {
+        if (retained.empty()) {
+            return;
+        }
+        evictOldest();
+    }
+    retained.push_front(blob);
+    retainedBytes += blob->size();
+}
+
+void BlobStore::dropRetained() {
+    if (memoryBudget) {
+        memoryBudget->release(MemoryBudget::Subsystem::ProfileCache, retainedBytes);
+    }
+    retained.clear();
+    retainedBytes = 0;
+}
+
+bool BlobStore::contains(const std::string& hash) const {
+    return std::filesystem::exists(blobPath(hash));
+}
+
+bool BlobStore::sync() {
+    std::vector<std::filesystem::path> pending;
+    {
+        std::lock_guard<std::mutex> lock(storeMutex);
+        pending.swap(unsynced);
+    }
+    if (pending.empty()) {
+        return true;
+    }
+
+    bool ok = true;
+    for (const auto& path : pending) {
+        ok = fileSync::syncFile(path) && ok;
+    }
+    return fileSync::syncDirectory(directory) && ok;
+}
+
+std::size_t BlobStore::collectGarbage(const std::set<std::string>& referenced) {
+    std::lock_guard<std::mutex> lock(storeMutex);
+    std::size_t removed = 0;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        const std::string name = entry.path().filename().string();
+        if (!referenced.contains(name) && std::filesystem::remove(entry.path(), error)) {
+            loaded.erase(name);
+            verified.erase(name);
+            ++removed;
+        }
+    }
+    if (removed > 0) {
+        fileSync::syncDirectory(directory);
+    }
+    return removed;
+}
+
+std::string BlobStore::encode(std::string_view content) const {
+    std::string stored(blobMagic);
+
+    #ifdef SIAVPN_HAVE_ZSTD
+    if (compress) {
+        std::string compressed(ZSTD_compressBound(content.size()), '\0');
+        const std::size_t length = ZSTD_compress(compressed.data(), compressed.size(),
+                                                 content.data(), content.size(), zstdLevel);
+        // PEM compresses well; random key material doesn't, so keep whichever is smaller
+        if (!ZSTD_isError(length) && length < content.size()) {
+            stored.push_back(zstdCodec);
+            stored.append(compressed.data(), length);
+            return stored;
+        }
+    }
+    #endif
+
+    stored.push_back(rawCodec);
+    stored.append(content);
+    return stored;
+}
+
+std::string BlobStore::decode(std::string_view stored) {
+    if (stored.size() < blobMagic.size() + 1 || !stored.starts_with(blobMagic)) {
+        throw std::runtime_error("Unrecognized blob format");
+    }
+    const char codec = stored[blobMagic.size()];
+    std::string_view payload = stored.substr(blobMagic.size() + 1);
+
+    if (codec == rawCodec) {
+        return std::string(payload);
+    }
+
+    #ifdef SIAVPN_HAVE_ZSTD
+    if (codec == zstdCodec) {
+        const auto size = ZSTD_getFrameContentSize(payload.data(), payload.size());
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            throw std::runtime_error("Corrupt compressed blob");
+        }
+        std::string content(static_cast<std::size_t>(size), '\0');
+        const std::size_t length = ZSTD_decompress(content.data(), content.size(), payload.data(), payload.size());
+        if (ZSTD_isError(length) || length != content.size()) {
+            throw std::runtime_error("Corrupt compressed blob");
+        }
+        return content;
+    }
+    #endif
+
+    throw std::runtime_error("Blob uses an unsupported codec");
+}
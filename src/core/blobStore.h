@@ -0,0 +1,56 @@
+#pragma once
+import std;
+#include "memoryBudget.h"
+
+// Content-addressed storage for inline profile blocks (<ca>, <tls-crypt>, ...).
+// Blobs are named by the SHA-256 of their content and written once, so
+// profiles from one provider share a single copy on disk. Loaded blobs are
+// shared in memory too: every profile borrowing the same block gets the
+// same buffer. The most recently used blobs stay loaded after their last
+// user lets go, within retainedBlobBytes and the ProfileCache share of the
+// memory budget, so reopening a profile doesn't read and decompress again.
+class BlobStore {
+public:
+    using Blob = std::shared_ptr<const std::string>;
+
+    static constexpr std::size_t retainedBlobBytes = 256 * 1024;
+
+    // compress takes effect only when built with zstd (SIAVPN_HAVE_ZSTD)
+    explicit BlobStore(std::filesystem::path directory, bool compress = true);
+    ~BlobStore();
+
+    // Charges retained blobs to budget; drops the ones retained so far
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+
+    // Stores content if it is not already present intact and returns its hash.
+    // New blobs are not flushed until sync().
+    std::string put(std::string_view content);
+    // Loads (or borrows from memory) the blob; throws if missing or corrupt
+    Blob get(const std::string& hash);
+    bool contains(const std::string& hash) const;
+
+    // Flushes blobs written since the last sync to stable storage
+    bool sync();
+    // Deletes blobs no profile references; returns how many were removed
+    std::size_t collectGarbage(const std::set<std::string>& referenced);
+
+    static std::string hashOf(std::string_view content);
+    static bool compressionAvailable();
+
+private:
+    std::filesystem::path blobPath(const std::string& hash) const;
+    std::string encode(std::string_view content) const;
+    static std::string decode(std::string_view stored);
+    void retain(const Blob& blob);
+    void dropRetained();
+
+    std::filesystem::path directory;
+    bool compress;
+    std::unordered_map<std::string, std::weak_ptr<const std::string>> loaded;
+    std::vector<std::filesystem::path> unsynced;
+    std::unordered_set<std::string> verified;  // hashes put() wrote or checked this run
+    std::list<Blob> retained;  // most recently used first
+    std::size_t retainedBytes = 0;
+    std::shared_ptr<MemoryBudget> memoryBudget;
+    mutable std::mutex storeMutex;
+};
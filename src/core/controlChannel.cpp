@@ -0,0 +1,291 @@
+import std;
+#include "controlChannel.h"
+
+namespace {
+
+constexpr std::uint8_t opcodeShift = 3;
+constexpr std::uint8_t keyIdMask = 0x07;
+
+void writeU32(std::vector<std::uint8_t>& out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<std::uint8_t>(value >> shift));
+    }
+}
+
+void writeU64(std::vector<std::uint8_t>& out, std::uint64_t value) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<std::uint8_t>(value >> shift));
+    }
+}
+
+// Bounds-checked big-endian reader over a received packet
+class PacketReader {
+public:
+    explicit PacketReader(std::span<const std::uint8_t> data) : data(data) {}
+
+    bool readU8(std::uint8_t& value) {
+        if (offset + 1 > data.size()) return false;
+        value = data[offset++];
+        return true;
+    }
+
+    bool readU32(std::uint32_t& value) {
+        if (offset + 4 > data.size()) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value = (value << 8) | data[offset++];
+        }
+        return true;
+    }
+
+    bool readU64(std::uint64_t& value) {
+        if (offset + 8 > data.size()) return false;
+        value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value = (value << 8) | data[offset++];
+        }
+        return true;
+    }
+
+    std::span<const std::uint8_t> remaining() const {
+        return data.subspan(offset);
+    }
+
+private:
+    std::span<const std::uint8_t> data;
+    std::size_t offset = 0;
+};
+
+std::uint64_t randomSessionId() {
+    std::random_device device;
+    std::uint64_t id = 0;
+    while (id == 0) {
+        id = (static_cast<std::uint64_t>(device()) << 32) | device();
+    }
+    return id;
+}
+
+} // namespace
+
+ControlChannel::ControlChannel(PacketSender sender)
+    : sender(std::move(sender))
+    , localSession(randomSessionId()) {
+}
+
+bool ControlChannel::isControlPacket(std::span<const std::uint8_t> packet) {
+    if (packet.empty()) {
+        return false;
+    }
+    const auto opcode = static_cast<Opcode>(packet[0] >> opcodeShift);
+    return opcode != Opcode::DataV1 && opcode != Opcode::DataV2;
+}
+
+void ControlChannel::setWrap(std::unique_ptr<ControlWrap> wrap) {
+    this->wrap = std::move(wrap);
+}
+
+const ControlWrap* ControlChannel::controlWrap() const {
+    return wrap.get();
+}
+
+void ControlChannel::startHardReset() {
+    // The reset is the first reliable message and occupies packet-id 0
+    const bool v3 = wrap && wrap->mode() == ControlWrap::Mode::TlsCryptV2;
+    sendWindow.enqueue(static_cast<std::uint8_t>(v3 ? Opcode::HardResetClientV3 : Opcode::HardResetClientV2), {});
+    service(Clock::now());
+}
+
+void ControlChannel::queueMessage(std::span<const std::uint8_t> payload) {
+    while (!payload.empty()) {
+        const auto chunk = payload.first(std::min(payload.size(), maxPayloadSize));
+        sendWindow.enqueue(static_cast<std::uint8_t>(Opcode::ControlV1), {chunk.begin(), chunk.end()});
+        payload = payload.subspan(chunk.size());
+    }
+}
+
+bool ControlChannel::processIncoming(std::span<const std::uint8_t> packet) {
+    if (wrap) {
+        if (!wrap->unwrap(packet, remoteSession, unwrapBuffer)) {
+            lastError = "Control packet failed authentication";
+            return false;
+        }
+        packet = unwrapBuffer;
+    }
+    PacketReader reader(packet);
+
+    std::uint8_t header = 0;
+    std::uint64_t peerSession = 0;
+    std::uint8_t ackCount = 0;
+    if (!reader.readU8(header) || !reader.readU64(peerSession) || !reader.readU8(ackCount)) {
+        lastError = "Truncated control packet";
+        return false;
+    }
+
+    const auto opcode = static_cast<Opcode>(header >> opcodeShift);
+    if (opcode == Opcode::DataV1 || opcode == Opcode::DataV2) {
+        return false;
+    }
+
+    // Only the server's reset may introduce its session id
+    if (remoteSession && *remoteSession != peerSession) {
+        lastError = "Control packet from unknown session";
+        return false;
+    }
+    if (!remoteSession && opcode != Opcode::HardResetServerV2) {
+        lastError = "Control packet before server reset";
+        return false;
+    }
+
+    std::vector<std::uint32_t> acks(ackCount);
+    for (auto& ack : acks) {
+        if (!reader.readU32(ack)) {
+            lastError = "Truncated ACK array";
+            return false;
+        }
+    }
+    if (ackCount > 0) {
+        std::uint64_t ackedSession = 0;
+        if (!reader.readU64(ackedSession) || ackedSession != localSession) {
+            lastError = "ACK for foreign session";
+            return false;
+        }
+    }
+
+    if (opcode == Opcode::HardResetServerV2) {
+        remoteSession = peerSession;
+        keyId = header & keyIdMask;
+    }
+
+    sendWindow.acknowledge(acks, Clock::now());
+
+    if (opcode == Opcode::AckV1) {
+        return true;
+    }
+
+    std::uint32_t packetId = 0;
+    if (!reader.readU32(packetId)) {
+        lastError = "Missing control packet-id";
+        return false;
+    }
+
+    if (receiveWindow.accept(packetId, reader.remaining())) {
+        receiveWindow.deliver(receivedBytes);
+    }
+    return true;
+}
+
+std::vector<std::uint8_t> ControlChannel::takeReceived() {
+    return std::exchange(receivedBytes, {});
+}
+
+void ControlChannel::service(Clock::time_point now) {
+    // ACKs ride on whatever goes out; only leftovers need their own packet
+    sendWindow.transmitDue(now, [this](const ReliableSendWindow::Entry& entry) {
+        transmit(entry);
+    });
+
+    if (receiveWindow.hasPendingAcks()) {
+        sendStandaloneAcks();
+    }
+}
+
+ControlChannel::Clock::time_point ControlChannel::nextWakeup() const {
+    return sendWindow.nextTimeout();
+}
+
+bool ControlChannel::isEstablished() const {
+    // The server only answers with its own reset after accepting ours
+    return remoteSession.has_value();
+}
+
+bool ControlChannel::hasUnacknowledged() const {
+    return sendWindow.hasUnacknowledged();
+}
+
+std::uint64_t ControlChannel::localSessionId() const {
+    return localSession;
+}
+
+std::uint64_t ControlChannel::remoteSessionId() const {
+    return remoteSession.value_or(0);
+}
+
+std::uint64_t ControlChannel::retransmissionCount() const {
+    return sendWindow.retransmissionCount();
+}
+
+std::chrono::microseconds ControlChannel::smoothedRtt() const {
+    return sendWindow.rtt().smoothedRtt();
+}
+
+std::chrono::microseconds ControlChannel::retransmitTimeout() const {
+    return sendWindow.rtt().rto();
+}
+
+const RttEstimator& ControlChannel::rttEstimator() const {
+    return sendWindow.rtt();
+}
+
+void ControlChannel::seedRtt(const RttEstimator& previous) {
+    if (previous.hasSample()) {
+        sendWindow.rtt().seed(previous.smoothedRtt(), previous.rttVariance());
+    }
+}
+
+std::string ControlChannel::getLastError() const {
+    return lastError;
+}
+
+void ControlChannel::transmit(const ReliableSendWindow::Entry& entry) {
+    // The client reset is sent before the server session id is known, so it carries no ACKs
+    std::vector<std::uint32_t> acks;
+    if (remoteSession) {
+        acks = receiveWindow.takeAcks(maxAcksPerPacket);
+    }
+    auto wire = buildPacket(static_cast<Opcode>(entry.opcode), acks, entry.packetId, entry.payload);
+    sendPacket(wire);
+}
+
+void ControlChannel::sendStandaloneAcks() {
+    while (receiveWindow.hasPendingAcks()) {
+        auto acks = receiveWindow.takeAcks(maxAcksPerPacket);
+        auto wire = buildPacket(Opcode::AckV1, acks, std::nullopt, {});
+        sendPacket(wire);
+    }
+}
+
+void ControlChannel::sendPacket(std::span<const std::uint8_t> wire) {
+    // Retransmissions are wrapped afresh, each with its own wrap packet id
+    if (!wrap) {
+        sender(wire);
+    } else if (wrap->wrap(wire, wrapBuffer)) {
+        sender(wrapBuffer);
+    } else {
+        lastError = "Control channel packet ids exhausted";
+    }
+}
+
+std::vector<std::uint8_t> ControlChannel::buildPacket(Opcode opcode,
+                                                      std::span<const std::uint32_t> acks,
+                                                      std::optional<std::uint32_t> packetId,
+                                                      std::span<const std::uint8_t> payload) const {
+    std::vector<std::uint8_t> wire;
+    wire.reserve(1 + 8 + 1 + acks.size() * 4 + 8 + 4 + payload.size());
+
+    wire.push_back(static_cast<std::uint8_t>((static_cast<std::uint8_t>(opcode) << opcodeShift) | keyId));
+    writeU64(wire, localSession);
+
+    wire.push_back(static_cast<std::uint8_t>(acks.size()));
+    for (auto ack : acks) {
+        writeU32(wire, ack);
+    }
+    if (!acks.empty()) {
+        writeU64(wire, remoteSession.value_or(0));
+    }
+
+    if (packetId) {
+        writeU32(wire, *packetId);
+    }
+    wire.insert(wire.end(), payload.begin(), payload.end());
+    return wire;
+}
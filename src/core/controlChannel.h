@@ -0,0 +1,90 @@
+#pragma once
+import std;
+#include "controlWrap.h"
+#include "reliableLayer.h"
+
+// OpenVPN control-channel packet layer: session ids, packet-id sequencing,
+// selective ACKs and adaptive retransmission. TLS records ride on top as an
+// ordered byte stream. With tls-auth / tls-crypt every packet is wrapped
+// on the way out and must pass the ControlWrap checks on the way in.
+class ControlChannel {
+public:
+    enum class Opcode : std::uint8_t {
+        ControlSoftResetV1 = 3,
+        ControlV1 = 4,
+        AckV1 = 5,
+        DataV1 = 6,
+        HardResetClientV2 = 7,
+        HardResetServerV2 = 8,
+        DataV2 = 9,
+        HardResetClientV3 = 10  // tls-crypt-v2: the reset carries the wrapped client key
+    };
+
+    using Clock = std::chrono::steady_clock;
+    using PacketSender = std::function<bool(std::span<const std::uint8_t>)>;
+
+    static constexpr std::size_t maxPayloadSize = 1100;
+    static constexpr std::size_t sendWindowSize = 8;
+    static constexpr std::size_t receiveWindowSize = 8;
+    static constexpr std::size_t maxAcksPerPacket = 8;
+
+    explicit ControlChannel(PacketSender sender);
+
+    static bool isControlPacket(std::span<const std::uint8_t> packet);
+
+    // Set before startHardReset()
+    void setWrap(std::unique_ptr<ControlWrap> wrap);
+    const ControlWrap* controlWrap() const;
+
+    // Starts the session with P_CONTROL_HARD_RESET_CLIENT_V2
+    void startHardReset();
+
+    // Queues TLS bytes; they are split into P_CONTROL_V1 packets
+    void queueMessage(std::span<const std::uint8_t> payload);
+
+    // Returns false if the packet is malformed or belongs to another session
+    bool processIncoming(std::span<const std::uint8_t> packet);
+
+    // In-order payload bytes received since the last call
+    std::vector<std::uint8_t> takeReceived();
+
+    // Fills the send window, retransmits holes and expired packets and
+    // sends any ACKs that could not be piggybacked
+    void service(Clock::time_point now);
+    Clock::time_point nextWakeup() const;
+
+    bool isEstablished() const;
+    bool hasUnacknowledged() const;
+    std::uint64_t localSessionId() const;
+    std::uint64_t remoteSessionId() const;
+    std::uint64_t retransmissionCount() const;
+    std::chrono::microseconds smoothedRtt() const;
+    std::chrono::microseconds retransmitTimeout() const;
+    const RttEstimator& rttEstimator() const;
+
+    // Reuses the RTT measured by a previous session to the same server
+    void seedRtt(const RttEstimator& previous);
+    std::string getLastError() const;
+
+private:
+    void transmit(const ReliableSendWindow::Entry& entry);
+    void sendPacket(std::span<const std::uint8_t> wire);
+    void sendStandaloneAcks();
+    std::vector<std::uint8_t> buildPacket(Opcode opcode,
+                                          std::span<const std::uint32_t> acks,
+                                          std::optional<std::uint32_t> packetId,
+                                          std::span<const std::uint8_t> payload) const;
+
+    PacketSender sender;
+    std::unique_ptr<ControlWrap> wrap;
+    std::vector<std::uint8_t> wrapBuffer;
+    std::vector<std::uint8_t> unwrapBuffer;
+    std::uint8_t keyId = 0;
+    std::uint64_t localSession = 0;
+    std::optional<std::uint64_t> remoteSession;
+
+    ReliableSendWindow sendWindow{sendWindowSize};
+    ReliableReceiveWindow receiveWindow{receiveWindowSize};
+    std::vector<std::uint8_t> receivedBytes;
+    std::string lastError;
+};
@@ -0,0 +1,375 @@
+import std;
+#include "controlWrap.h"
+#include "controlChannel.h"
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+
+namespace {
+
+constexpr std::size_t sessionIdSize = 8;
+constexpr std::size_t packetIdSize = 8;  // packet id and timestamp
+constexpr std::size_t cryptTagSize = 32;  // HMAC-SHA256
+constexpr std::size_t cryptIvSize = 16;
+constexpr std::size_t keySlotSize = 64;   // cipher and HMAC halves of each direction
+constexpr std::uint8_t opcodeShift = 3;
+constexpr std::uint32_t replayWindow = 64;
+
+// Inline block or file, read straight into the arena
+SecureString keyMaterial(const OvpnProfile& profile, const std::string& name) {
+    if (profile.hasInlineBlock(name)) {
+        return profile.secretBlock(name);
+    }
+    auto args = profile.directiveArgs(name);
+    if (!args.empty() && args[0] != "[inline]") {
+        return readSecretFile(args[0]).value_or(SecureString());
+    }
+    return {};
+}
+
+// Text between the PEM-style markers of an OpenVPN key file, whitespace removed
+SecureString keyBody(std::string_view text, std::string_view label) {
+    const std::string begin = "-----BEGIN " + std::string(label) + "-----";
+    const std::string end = "-----END " + std::string(label) + "-----";
+    const auto first = text.find(begin);
+    const auto last = text.find(end);
+    if (first == std::string_view::npos || last == std::string_view::npos || last < first) {
+        return {};
+    }
+
+    std::string body;
+    body.reserve(last - first);
+    for (char c : text.substr(first + begin.size(), last - first - begin.size())) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            body.push_back(c);
+        }
+    }
+    SecureString result(body);
+    secureWipe(body.data(), body.size());
+    return result;
+}
+
+SecureBytes decodeHex(std::string_view hex) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    SecureBytes bytes;
+    if (hex.size() % 2 != 0) {
+        return bytes;
+    }
+    bytes.reserve(hex.size() / 2);
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+        const int high = nibble(hex[i]);
+        const int low = nibble(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return {};
+        }
+        bytes.push_back(static_cast<std::uint8_t>((high << 4) | low));
+    }
+    return bytes;
+}
+
+SecureBytes decodeBase64(std::string_view encoded) {
+    if (encoded.empty() || encoded.size() % 4 != 0) {
+        return {};
+    }
+    SecureBytes decoded(encoded.size() / 4 * 3);
+    int length = EVP_DecodeBlock(decoded.data(), reinterpret_cast<const unsigned char*>(encoded.data()),
+                                 static_cast<int>(encoded.size()));
+    if (length < 0) {
+        return {};
+    }
+    // EVP_DecodeBlock counts padding as output bytes
+    for (auto it = encoded.rbegin(); it != encoded.rend() && *it == '='; ++it) {
+        --length;
+    }
+    decoded.resize(static_cast<std::size_t>(length));
+    return decoded;
+}
+
+void writeU32(std::uint8_t* out, std::uint32_t value) {
+    out[0] = static_cast<std::uint8_t>(value >> 24);
+    out[1] = static_cast<std::uint8_t>(value >> 16);
+    out[2] = static_cast<std::uint8_t>(value >> 8);
+    out[3] = static_cast<std::uint8_t>(value);
+}
+
+std::uint32_t readU32(const std::uint8_t* in) {
+    return (static_cast<std::uint32_t>(in[0]) << 24) | (static_cast<std::uint32_t>(in[1]) << 16) |
+           (static_cast<std::uint32_t>(in[2]) << 8) | in[3];
+}
+
+std::uint64_t readU64(const std::uint8_t* in) {
+    return (static_cast<std::uint64_t>(readU32(in)) << 32) | readU32(in + 4);
+}
+
+// Only what a server sends may arrive; data packets never get here
+bool isServerControlOpcode(std::uint8_t header) {
+    using Opcode = ControlChannel::Opcode;
+    const auto opcode = static_cast<Opcode>(header >> opcodeShift);
+    return opcode == Opcode::HardResetServerV2 || opcode == Opcode::ControlV1 || opcode == Opcode::AckV1 ||
+           opcode == Opcode::ControlSoftResetV1;
+}
+
+} // namespace
+
+std::optional<ControlWrap::Key> ControlWrap::keyFromProfile(const OvpnProfile& profile) {
+    // A profile carries at most one of them; tls-crypt-v2 wins as OpenVPN does
+    Key key;
+    std::string name;
+    if (profile.hasDirective("tls-crypt-v2") || profile.hasInlineBlock("tls-crypt-v2")) {
+        key.mode = Mode::TlsCryptV2;
+        name = "tls-crypt-v2";
+    } else if (profile.hasDirective("tls-crypt") || profile.hasInlineBlock("tls-crypt")) {
+        key.mode = Mode::TlsCrypt;
+        name = "tls-crypt";
+    } else if (profile.hasDirective("tls-auth") || profile.hasInlineBlock("tls-auth")) {
+        key.mode = Mode::TlsAuth;
+        name = "tls-auth";
+    } else {
+        return std::nullopt;
+    }
+
+    const SecureString material = keyMaterial(profile, name);
+    if (material.empty()) {
+        throw std::runtime_error("Cannot read the " + name + " key");
+    }
+
+    if (key.mode == Mode::TlsCryptV2) {
+        // Kc followed by WKc, whose last two bytes are its own length
+        SecureBytes decoded = decodeBase64(keyBody(material.view(), "OpenVPN tls-crypt-v2 client key").view());
+        if (decoded.size() < staticKeySize + 2) {
+            throw std::runtime_error("Malformed tls-crypt-v2 client key");
+        }
+        key.staticKey.assign(decoded.begin(), decoded.begin() + staticKeySize);
+        key.wrappedKey.assign(decoded.begin() + staticKeySize, decoded.end());
+        const std::size_t declared = (static_cast<std::size_t>(decoded[decoded.size() - 2]) << 8) | decoded.back();
+        if (declared != key.wrappedKey.size()) {
+            throw std::runtime_error("Malformed tls-crypt-v2 client key");
+        }
+        return key;
+    }
+
+    key.staticKey = decodeHex(keyBody(material.view(), "OpenVPN Static key V1").view());
+    if (key.staticKey.size() != staticKeySize) {
+        throw std::runtime_error("Malformed " + name + " key");
+    }
+
+    if (key.mode == Mode::TlsAuth) {
+        auto args = profile.directiveArgs("tls-auth");
+        std::string direction = args.size() > 1 ? args[1] : "";
+        if (auto keyDirection = profile.directiveArgs("key-direction"); direction.empty() && !keyDirection.empty()) {
+            direction = keyDirection[0];
+        }
+        if (direction == "0" || direction == "1") {
+            key.direction = direction == "1" ? 1 : 0;
+        }
+        if (auto auth = profile.directiveArgs("auth"); !auth.empty()) {
+            key.digest = auth[0];
+        }
+    }
+    return key;
+}
+
+ControlWrap::ControlWrap(const Key& key)
+    : wrapMode(key.mode)
+    , wrappedKey(key.wrappedKey)
+    , sendTime(static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count())) {
+    if (key.staticKey.size() != staticKeySize) {
+        throw std::runtime_error("Control channel key has the wrong size");
+    }
+
+    // Each direction is a 64-byte cipher key and a 64-byte HMAC key. A
+    // client sends with the second direction of a tls-crypt key; tls-auth
+    // follows key-direction, and without one both ends use the first.
+    const bool crypt = key.mode != Mode::TlsAuth;
+    std::size_t sendSlot = 1;
+    std::size_t receiveSlot = 0;
+    if (!crypt) {
+        sendSlot = key.direction.value_or(0) == 1 ? 1 : 0;
+        receiveSlot = key.direction ? 1 - sendSlot : 0;
+    }
+
+    const std::string digest = crypt ? "SHA256" : key.digest;
+    const EVP_MD* md = EVP_get_digestbyname(digest.c_str());
+    EVP_MAC* hmac = EVP_MAC_fetch(nullptr, OSSL_MAC_NAME_HMAC, nullptr);
+    macSize = md ? static_cast<std::size_t>(EVP_MD_get_size(md)) : 0;
+
+    auto setUp = [&](Direction& direction, std::size_t slot) {
+        const std::uint8_t* keys = key.staticKey.data() + slot * 2 * keySlotSize;
+        std::string digestName = digest;
+        const std::array<OSSL_PARAM, 2> params{
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digestName.data(), 0), OSSL_PARAM_construct_end()};
+        direction.mac = EVP_MAC_CTX_new(hmac);
+        if (!direction.mac || EVP_MAC_init(direction.mac, keys + keySlotSize, macSize, params.data()) != 1) {
+            return false;
+        }
+        if (crypt) {
+            direction.cipher = EVP_CIPHER_CTX_new();
+            return direction.cipher &&
+                   EVP_EncryptInit_ex(direction.cipher, EVP_aes_256_ctr(), nullptr, keys, nullptr) == 1;
+        }
+        return true;
+    };
+    const bool ok = hmac && md && macSize <= keySlotSize && setUp(send, sendSlot) && setUp(receive, receiveSlot);
+    EVP_MAC_free(hmac);
+    if (!ok) {
+        EVP_MAC_CTX_free(send.mac);
+        EVP_MAC_CTX_free(receive.mac);
+        EVP_CIPHER_CTX_free(send.cipher);
+        EVP_CIPHER_CTX_free(receive.cipher);
+        throw std::runtime_error("Cannot set up control channel authentication with " + digest);
+    }
+}
+
+ControlWrap::~ControlWrap() {
+    EVP_MAC_CTX_free(send.mac);
+    EVP_MAC_CTX_free(receive.mac);
+    EVP_CIPHER_CTX_free(send.cipher);
+    EVP_CIPHER_CTX_free(receive.cipher);
+    OPENSSL_cleanse(wrappedKey.data(), wrappedKey.size());
+}
+
+ControlWrap::Mode ControlWrap::mode() const {
+    return wrapMode;
+}
+
+ControlWrap::Stats ControlWrap::stats() const {
+    return counters;
+}
+
+bool ControlWrap::computeMac(EVP_MAC_CTX* mac, std::initializer_list<std::span<const std::uint8_t>> parts,
+                             std::uint8_t* out) {
+    // A NULL key restarts the context from its stored key schedule
+    if (EVP_MAC_init(mac, nullptr, 0, nullptr) != 1) {
+        return false;
+    }
+    for (const auto& part : parts) {
+        if (EVP_MAC_update(mac, part.data(), part.size()) != 1) {
+            return false;
+        }
+    }
+    std::size_t written = 0;
+    return EVP_MAC_final(mac, out, &written, macSize) == 1 && written == macSize;
+}
+
+bool ControlWrap::wrap(std::span<const std::uint8_t> packet, std::vector<std::uint8_t>& out) {
+    constexpr std::size_t header = 1 + sessionIdSize;
+    if (packet.size() < header || nextPacketId == 0) {
+        return false;
+    }
+    std::array<std::uint8_t, packetIdSize> packetId{};
+    writeU32(packetId.data(), nextPacketId++);
+    writeU32(packetId.data() + 4, sendTime);
+    const auto opcodeAndSession = packet.first(header);
+    const auto rest = packet.subspan(header);
+
+    if (wrapMode == Mode::TlsAuth) {
+        // op, session, HMAC, packet id, then the rest; the HMAC covers the packet id first
+        out.resize(header + macSize + packetIdSize + rest.size());
+        std::copy(opcodeAndSession.begin(), opcodeAndSession.end(), out.begin());
+        std::copy(packetId.begin(), packetId.end(), out.begin() + static_cast<std::ptrdiff_t>(header + macSize));
+        std::copy(rest.begin(), rest.end(), out.begin() + static_cast<std::ptrdiff_t>(header + macSize + packetIdSize));
+        return computeMac(send.mac, {packetId, opcodeAndSession, rest}, out.data() + header);
+    }
+
+    // op, session, packet id, tag, then the rest encrypted with the tag as IV
+    const bool v3Reset = wrapMode == Mode::TlsCryptV2 &&
+        static_cast<ControlChannel::Opcode>(packet[0] >> opcodeShift) == ControlChannel::Opcode::HardResetClientV3;
+    const std::size_t body = header + packetIdSize + cryptTagSize;
+    out.resize(body + rest.size() + (v3Reset ? wrappedKey.size() : 0));
+    std::copy(opcodeAndSession.begin(), opcodeAndSession.end(), out.begin());
+    std::copy(packetId.begin(), packetId.end(), out.begin() + static_cast<std::ptrdiff_t>(header));
+    std::uint8_t* tag = out.data() + header + packetIdSize;
+    if (!computeMac(send.mac, {std::span<const std::uint8_t>(out.data(), header + packetIdSize), rest}, tag)) {
+        return false;
+    }
+    int written = 0;
+    if (EVP_EncryptInit_ex(send.cipher, nullptr, nullptr, nullptr, tag) != 1 ||
+        EVP_EncryptUpdate(send.cipher, out.data() + body, &written, rest.data(), static_cast<int>(rest.size())) != 1) {
+        return false;
+    }
+    // The server unwraps its own client key from WKc before it can check anything
+    if (v3Reset) {
+        std::copy(wrappedKey.begin(), wrappedKey.end(), out.begin() + static_cast<std::ptrdiff_t>(body + rest.size()));
+    }
+    return true;
+}
+
+bool ControlWrap::unwrap(std::span<const std::uint8_t> packet, std::optional<std::uint64_t> remoteSession,
+                         std::vector<std::uint8_t>& out) {
+    constexpr std::size_t header = 1 + sessionIdSize;
+    const std::size_t overhead = packetIdSize + (wrapMode == Mode::TlsAuth ? macSize : cryptTagSize);
+    // Cheap checks first: most of a flood never reaches the HMAC
+    if (packet.size() < header + overhead + 1 || !isServerControlOpcode(packet[0])) {
+        ++counters.malformed;
+        return false;
+    }
+    if (remoteSession && readU64(packet.data() + 1) != *remoteSession) {
+        ++counters.foreignSession;
+        return false;
+    }
+
+    std::array<std::uint8_t, EVP_MAX_MD_SIZE> expected{};
+    const std::uint8_t* packetId = nullptr;
+    const std::uint8_t* received = nullptr;
+    const auto opcodeAndSession = packet.first(header);
+    const auto rest = packet.subspan(header + overhead);
+    out.resize(header + rest.size());
+    std::copy(opcodeAndSession.begin(), opcodeAndSession.end(), out.begin());
+
+    bool computed = false;
+    if (wrapMode == Mode::TlsAuth) {
+        received = packet.data() + header;
+        packetId = received + macSize;
+        std::copy(rest.begin(), rest.end(), out.begin() + static_cast<std::ptrdiff_t>(header));
+        computed = computeMac(receive.mac, {std::span(packetId, packetIdSize), opcodeAndSession, rest}, expected.data());
+    } else {
+        packetId = packet.data() + header;
+        received = packetId + packetIdSize;
+        int written = 0;
+        computed = EVP_EncryptInit_ex(receive.cipher, nullptr, nullptr, nullptr, received) == 1 &&
+                   EVP_EncryptUpdate(receive.cipher, out.data() + header, &written, rest.data(), static_cast<int>(rest.size())) == 1 &&
+                   computeMac(receive.mac, {packet.first(header + packetIdSize), std::span<const std::uint8_t>(out).subspan(header)},
+                              expected.data());
+    }
+    if (!computed || CRYPTO_memcmp(expected.data(), received, wrapMode == Mode::TlsAuth ? macSize : cryptTagSize) != 0) {
+        ++counters.authFailures;
+        return false;
+    }
+    if (!acceptPacketId(readU32(packetId), readU32(packetId + 4))) {
+        ++counters.replays;
+        return false;
+    }
+    ++counters.accepted;
+    return true;
+}
+
+bool ControlWrap::acceptPacketId(std::uint32_t packetId, std::uint32_t time) {
+    if (packetId == 0 || time < receiveTime) {
+        return false;
+    }
+    // A new timestamp means the server restarted its packet ids
+    if (time > receiveTime) {
+        receiveTime = time;
+        highestReceived = 0;
+        receivedBitmap = 0;
+    }
+    if (packetId > highestReceived) {
+        const std::uint32_t shift = packetId - highestReceived;
+        receivedBitmap = shift >= replayWindow ? 0 : receivedBitmap << shift;
+        receivedBitmap |= 1;
+        highestReceived = packetId;
+        return true;
+    }
+    const std::uint32_t behind = highestReceived - packetId;
+    if (behind >= replayWindow || (receivedBitmap >> behind) & 1) {
+        return false;
+    }
+    receivedBitmap |= std::uint64_t{1} << behind;
+    return true;
+}
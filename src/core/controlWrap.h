@@ -0,0 +1,77 @@
+#pragma once
+import std;
+#include <openssl/evp.h>
+#include "ovpnProfile.h"
+#include "secureMemory.h"
+
+// tls-auth, tls-crypt and tls-crypt-v2 protection of control packets.
+// Every packet from the server passes through unwrap() before the
+// reliability layer or TLS sees it, and the checks are ordered by cost so
+// a flood of spoofed datagrams is dropped cheaply: length and opcode first,
+// then the server's session id once its reset is in, and only then one
+// HMAC from a context keyed once per session, compared in constant time.
+// The replay window runs last, on authenticated packets only.
+class ControlWrap {
+public:
+    enum class Mode { TlsAuth, TlsCrypt, TlsCryptV2 };
+
+    struct Key {
+        Mode mode = Mode::TlsAuth;
+        SecureBytes staticKey;                 // 2048-bit OpenVPN static key (Kc for tls-crypt-v2)
+        std::vector<std::uint8_t> wrappedKey;  // tls-crypt-v2 WKc, sent along with the first reset
+        std::optional<int> direction;          // tls-auth key-direction
+        std::string digest = "SHA1";           // tls-auth HMAC, from "auth"
+    };
+
+    struct Stats {
+        std::uint64_t accepted = 0;
+        std::uint64_t malformed = 0;       // dropped before any cryptography
+        std::uint64_t foreignSession = 0;  // likewise: not the server session we talk to
+        std::uint64_t authFailures = 0;
+        std::uint64_t replays = 0;
+    };
+
+    static constexpr std::size_t staticKeySize = 256;
+
+    // nullopt if the profile uses none of them; throws std::runtime_error on a malformed key
+    static std::optional<Key> keyFromProfile(const OvpnProfile& profile);
+
+    // Throws std::runtime_error if the digest or ciphers cannot be set up
+    explicit ControlWrap(const Key& key);
+    ~ControlWrap();
+
+    ControlWrap(const ControlWrap&) = delete;
+    ControlWrap& operator=(const ControlWrap&) = delete;
+
+    Mode mode() const;
+    // Wire form of a packet as ControlChannel builds it; false once packet ids run out
+    bool wrap(std::span<const std::uint8_t> packet, std::vector<std::uint8_t>& out);
+    // The packet as ControlChannel parses it, or false if it must be dropped.
+    // remoteSession is the server's session id once its reset arrived.
+    bool unwrap(std::span<const std::uint8_t> packet, std::optional<std::uint64_t> remoteSession,
+                std::vector<std::uint8_t>& out);
+
+    Stats stats() const;
+
+private:
+    struct Direction {
+        EVP_MAC_CTX* mac = nullptr;
+        EVP_CIPHER_CTX* cipher = nullptr;  // tls-crypt only
+    };
+
+    bool computeMac(EVP_MAC_CTX* mac, std::initializer_list<std::span<const std::uint8_t>> parts, std::uint8_t* out);
+    bool acceptPacketId(std::uint32_t packetId, std::uint32_t time);
+
+    Mode wrapMode;
+    std::vector<std::uint8_t> wrappedKey;
+    std::size_t macSize = 0;
+    Direction send;
+    Direction receive;
+
+    std::uint32_t nextPacketId = 1;
+    std::uint32_t sendTime = 0;
+    std::uint32_t receiveTime = 0;        // replay window: the server's epoch,
+    std::uint32_t highestReceived = 0;    // its newest packet id and a bitmap behind it
+    std::uint64_t receivedBitmap = 0;
+    Stats counters;
+};
@@ -0,0 +1,116 @@
+import std;
+#include "credentialCache.h"
+
+#include <openssl/evp.h>
+
+namespace {
+
+SecureString decodeBase64(std::string_view encoded) {
+    if (encoded.empty() || encoded.size() % 4 != 0) {
+        return {};
+    }
+
+    SecureBytes decoded(encoded.size() / 4 * 3);
+    int length = EVP_DecodeBlock(decoded.data(), reinterpret_cast<const unsigned char*>(encoded.data()),
+                                 static_cast<int>(encoded.size()));
+    if (length < 0) {
+        return {};
+    }
+    // EVP_DecodeBlock counts padding as output bytes
+    for (auto it = encoded.rbegin(); it != encoded.rend() && *it == '='; ++it) {
+        --length;
+    }
+    return SecureString(std::string_view(reinterpret_cast<const char*>(decoded.data()),
+                                         static_cast<std::size_t>(length)));
+}
+
+} // namespace
+
+CredentialCache::CredentialCache(std::chrono::seconds lifetime)
+    : lifetime(lifetime) {
+}
+
+CredentialCache::~CredentialCache() {
+    clear();
+}
+
+void CredentialCache::setLifetime(std::chrono::seconds lifetime) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    this->lifetime = lifetime;
+}
+
+void CredentialCache::storeCredentials(const std::string& profileKey, const SecureString& username,
+                                       const SecureString& password) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& entry = entries[profileKey];
+    entry.username = username;
+    entry.password = password;
+    entry.credentialsExpiry = Clock::now() + lifetime;
+}
+
+void CredentialCache::storeAuthToken(const std::string& profileKey, std::string_view token,
+                                     std::string_view encodedUser) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& entry = entries[profileKey];
+    entry.token.assign(token);
+    if (!encodedUser.empty()) {
+        entry.tokenUser = decodeBase64(encodedUser);
+    }
+    entry.tokenExpiry = Clock::now() + lifetime;
+}
+
+std::optional<CredentialCache::Credentials> CredentialCache::lookup(const std::string& profileKey) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(profileKey);
+    if (it == entries.end()) {
+        return std::nullopt;
+    }
+
+    auto& entry = it->second;
+    const auto now = Clock::now();
+    if (!entry.token.empty() && now >= entry.tokenExpiry) {
+        wipeToken(entry);
+    }
+    if (!entry.password.empty() && now >= entry.credentialsExpiry) {
+        entry.username.clear();
+        entry.password.clear();
+    }
+
+    if (!entry.token.empty()) {
+        // The token replaces the password; the username stays unless the server renamed us
+        Credentials credentials;
+        credentials.username = entry.tokenUser.empty() ? entry.username : entry.tokenUser;
+        credentials.password = entry.token;
+        credentials.usingToken = true;
+        return credentials;
+    }
+    if (!entry.password.empty()) {
+        return Credentials{entry.username, entry.password, false};
+    }
+
+    entries.erase(it);
+    return std::nullopt;
+}
+
+void CredentialCache::forgetToken(const std::string& profileKey) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto it = entries.find(profileKey); it != entries.end()) {
+        wipeToken(it->second);
+    }
+}
+
+void CredentialCache::erase(const std::string& profileKey) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    entries.erase(profileKey);
+}
+
+void CredentialCache::clear() {
+    // SecureString wipes its buffer when released
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    entries.clear();
+}
+
+void CredentialCache::wipeToken(Entry& entry) {
+    entry.token.clear();
+    entry.tokenUser.clear();
+}
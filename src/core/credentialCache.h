@@ -0,0 +1,47 @@
+#pragma once
+import std;
+#include "secureMemory.h"
+
+// Credentials and server-pushed auth tokens per profile, held in the secure
+// arena. Reconnects authenticate with the token (or the saved password)
+// instead of prompting or re-reading auth-user-pass files.
+class CredentialCache {
+public:
+    struct Credentials {
+        SecureString username;
+        SecureString password;  // the auth token when usingToken is set
+        bool usingToken = false;
+    };
+
+    explicit CredentialCache(std::chrono::seconds lifetime = std::chrono::hours(8));
+    ~CredentialCache();
+
+    void setLifetime(std::chrono::seconds lifetime);
+
+    void storeCredentials(const std::string& profileKey, const SecureString& username, const SecureString& password);
+    // From "auth-token" / "auth-token-user" in PUSH_REPLY; the user is base64 encoded
+    void storeAuthToken(const std::string& profileKey, std::string_view token, std::string_view encodedUser = {});
+    // Token first, then saved credentials; expired entries are wiped on the way
+    std::optional<Credentials> lookup(const std::string& profileKey);
+    void forgetToken(const std::string& profileKey);
+    void erase(const std::string& profileKey);
+    void clear();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        SecureString username;
+        SecureString password;
+        Clock::time_point credentialsExpiry{};
+        SecureString tokenUser;
+        SecureString token;
+        Clock::time_point tokenExpiry{};
+    };
+
+    static void wipeToken(Entry& entry);
+
+    std::map<std::string, Entry> entries;
+    std::chrono::seconds lifetime;
+    mutable std::mutex cacheMutex;
+};
@@ -0,0 +1,333 @@
+import std;
+#include "dataChannel.h"
+#include "controlChannel.h"
+
+namespace {
+
+constexpr std::size_t packetIdSize = 4;
+constexpr std::size_t tagSize = 16;
+constexpr std::size_t keySlotSize = 64;  // each cipher and HMAC key in the key block
+
+constexpr std::uint8_t lzoNoCompress = 0xFA;
+constexpr std::uint8_t swapNoCompress = 0xFB;
+constexpr std::uint8_t stubV2Indicator = 0x50;
+constexpr std::uint8_t stubV2NoCompress = 0x00;
+
+constexpr std::array<std::uint8_t, 16> pingMagic{
+    0x2a, 0x18, 0x7b, 0xf3, 0x64, 0x1e, 0xb4, 0xcb, 0x07, 0xed, 0x2d, 0x0a, 0x98, 0x1f, 0xc7, 0x48};
+
+// Replay window behind the newest packet id
+constexpr std::uint32_t replayWindow = 64;
+
+const EVP_CIPHER* evpCipher(DataChannel::Cipher cipher) {
+    switch (cipher) {
+        case DataChannel::Cipher::Aes128Gcm:
+            return EVP_aes_128_gcm();
+        case DataChannel::Cipher::Aes256Gcm:
+            return EVP_aes_256_gcm();
+        case DataChannel::Cipher::ChaCha20Poly1305:
+            return EVP_chacha20_poly1305();
+    }
+    return nullptr;
+}
+
+void write32(std::uint8_t* out, std::uint32_t value) {
+    out[0] = static_cast<std::uint8_t>(value >> 24);
+    out[1] = static_cast<std::uint8_t>(value >> 16);
+    out[2] = static_cast<std::uint8_t>(value >> 8);
+    out[3] = static_cast<std::uint8_t>(value);
+}
+
+std::uint32_t read32(const std::uint8_t* in) {
+    return (static_cast<std::uint32_t>(in[0]) << 24) | (static_cast<std::uint32_t>(in[1]) << 16) |
+           (static_cast<std::uint32_t>(in[2]) << 8) | in[3];
+}
+
+bool update(EVP_CIPHER_CTX* ctx, bool encrypt, std::uint8_t* out, const std::uint8_t* in, std::size_t length) {
+    int written = 0;
+    const int ok = encrypt ? EVP_EncryptUpdate(ctx, out, &written, in, static_cast<int>(length))
+                           : EVP_DecryptUpdate(ctx, out, &written, in, static_cast<int>(length));
+    return ok == 1;
+}
+
+} // namespace
+
+template <std::size_t... index>
+constexpr auto DataChannel::makeSealTable(std::index_sequence<index...>) {
+    return std::array<SealKernel, sizeof...(index)>{
+        &sealPacket<static_cast<Cipher>(index / (compressionCount * 2)),
+                    static_cast<Compression>(index / 2 % compressionCount),
+                    static_cast<VpnTransport::Protocol>(index % 2)>...};
+}
+
+template <std::size_t... index>
+constexpr auto DataChannel::makeOpenTable(std::index_sequence<index...>) {
+    return std::array<OpenKernel, sizeof...(index)>{
+        &openPacket<static_cast<Cipher>(index / compressionCount), static_cast<Compression>(index % compressionCount)>...};
+}
+
+std::optional<DataChannel::Cipher> DataChannel::cipherFromName(std::string_view name) {
+    std::string upper(name);
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    if (upper == "AES-128-GCM") {
+        return Cipher::Aes128Gcm;
+    }
+    if (upper == "AES-256-GCM") {
+        return Cipher::Aes256Gcm;
+    }
+    if (upper == "CHACHA20-POLY1305") {
+        return Cipher::ChaCha20Poly1305;
+    }
+    return std::nullopt;
+}
+
+DataChannel::Compression DataChannel::compressionFromOption(std::string_view option, std::string_view value) {
+    // "comp-lzo no" still frames every packet with the "not compressed" byte
+    if (option == "comp-lzo" || (option == "compress" && value == "lzo")) {
+        return Compression::Lzo;
+    }
+    if (option == "compress") {
+        if (value == "stub-v2" || value == "lz4-v2") {
+            return Compression::StubV2;
+        }
+        if (value.empty() || value == "stub" || value == "lz4") {
+            return Compression::Swap;
+        }
+    }
+    return Compression::None;
+}
+
+std::span<const std::uint8_t> DataChannel::pingPayload() {
+    return pingMagic;
+}
+
+bool DataChannel::isPing(std::span<const std::uint8_t> payload) {
+    return std::ranges::equal(payload, pingMagic);
+}
+
+DataChannel::DataChannel(const Config& config, std::span<const std::uint8_t> keyBlock)
+    : activeConfig(config) {
+    if (keyBlock.size() < keyBlockSize) {
+        throw std::runtime_error("Data channel key block too short");
+    }
+
+    // Client to server is the first half of the block, server to client the second
+    const EVP_CIPHER* cipher = evpCipher(config.cipher);
+    auto setUp = [cipher](Direction& direction, std::span<const std::uint8_t> keys, bool encrypt) {
+        direction.cipher = EVP_CIPHER_CTX_new();
+        const std::uint8_t* key = keys.data();
+        const std::uint8_t* implicitIv = keys.data() + keySlotSize;
+        const bool ok = direction.cipher &&
+            (encrypt ? EVP_EncryptInit_ex(direction.cipher, cipher, nullptr, key, nullptr)
+                     : EVP_DecryptInit_ex(direction.cipher, cipher, nullptr, key, nullptr)) == 1 &&
+            EVP_CIPHER_CTX_ctrl(direction.cipher, EVP_CTRL_AEAD_SET_IVLEN, static_cast<int>(direction.iv.size()), nullptr) == 1;
+        std::copy_n(implicitIv, direction.iv.size() - packetIdSize, direction.iv.begin() + packetIdSize);
+        return ok;
+    };
+    if (!cipher || !setUp(state.out, keyBlock.first(2 * keySlotSize), true) ||
+        !setUp(state.in, keyBlock.subspan(2 * keySlotSize, 2 * keySlotSize), false)) {
+        EVP_CIPHER_CTX_free(state.out.cipher);
+        EVP_CIPHER_CTX_free(state.in.cipher);
+        throw std::runtime_error("Cannot set up data channel cipher");
+    }
+
+    if (config.peerId) {
+        state.header[0] = static_cast<std::uint8_t>((static_cast<std::uint8_t>(ControlChannel::Opcode::DataV2) << 3) | config.keyId);
+        state.header[1] = static_cast<std::uint8_t>(*config.peerId >> 16);
+        state.header[2] = static_cast<std::uint8_t>(*config.peerId >> 8);
+        state.header[3] = static_cast<std::uint8_t>(*config.peerId);
+        state.headerLength = 4;
+    } else {
+        state.header[0] = static_cast<std::uint8_t>((static_cast<std::uint8_t>(ControlChannel::Opcode::DataV1) << 3) | config.keyId);
+        state.headerLength = 1;
+    }
+
+    // One kernel per (cipher, compression, framing); chosen here, once
+    static constexpr auto sealTable = makeSealTable(std::make_index_sequence<cipherCount * compressionCount * 2>{});
+    static constexpr auto openTable = makeOpenTable(std::make_index_sequence<cipherCount * compressionCount>{});
+    const std::size_t index = static_cast<std::size_t>(config.cipher) * compressionCount + static_cast<std::size_t>(config.compression);
+    sealKernel = sealTable[index * 2 + static_cast<std::size_t>(config.framing)];
+    openKernel = openTable[index];
+}
+
+DataChannel::~DataChannel() {
+    EVP_CIPHER_CTX_free(state.out.cipher);
+    EVP_CIPHER_CTX_free(state.in.cipher);
+}
+
+std::size_t DataChannel::seal(std::span<const std::uint8_t> payload, std::span<std::uint8_t> out) {
+    if (out.size() < headroom + payload.size() + tailroom) {
+        return 0;
+    }
+    std::copy(payload.begin(), payload.end(), out.begin() + headroom);
+    const auto wire = sealKernel(state, out, payload.size());
+    // The packet starts somewhere in the headroom; move it to the front
+    std::copy(wire.begin(), wire.end(), out.begin());
+    return wire.size();
+}
+
+std::span<std::uint8_t> DataChannel::sealInPlace(std::span<std::uint8_t> buffer, std::size_t length) {
+    return sealKernel(state, buffer, length);
+}
+
+std::optional<std::size_t> DataChannel::open(std::span<const std::uint8_t> packet, std::span<std::uint8_t> out) {
+    return openKernel(state, packet, out);
+}
+
+const DataChannel::Config& DataChannel::config() const {
+    return activeConfig;
+}
+
+DataChannel::Stats DataChannel::stats() const {
+    return state.stats;
+}
+
+template <DataChannel::Cipher cipher, DataChannel::Compression compression, VpnTransport::Protocol framing>
+std::span<std::uint8_t> DataChannel::sealPacket(State& state, std::span<std::uint8_t> buffer, std::size_t length) {
+    constexpr std::size_t prefix = framing == VpnTransport::Protocol::Tcp ? 2 : 0;
+    if (buffer.size() < headroom + length + tailroom || state.nextPacketId == 0) {
+        return {};  // the id wrapped: the key must be renegotiated first
+    }
+
+    // Compression framing goes in front of the payload; Swap instead moves
+    // the first byte to the end and puts its marker in its place
+    std::uint8_t* const payload = buffer.data() + headroom;
+    std::uint8_t* body = payload;
+    std::size_t bodyLength = length;
+    if constexpr (compression == Compression::Lzo) {
+        *--body = lzoNoCompress;
+        ++bodyLength;
+    } else if constexpr (compression == Compression::Swap) {
+        payload[length] = length > 0 ? payload[0] : 0;
+        payload[0] = swapNoCompress;
+        ++bodyLength;
+    } else if constexpr (compression == Compression::StubV2) {
+        if (length > 0 && payload[0] == stubV2Indicator) {
+            body -= 2;
+            body[0] = stubV2Indicator;
+            body[1] = stubV2NoCompress;
+            bodyLength += 2;
+        }
+    }
+
+    std::uint8_t* const tag = body - tagSize;
+    std::uint8_t* const packetId = tag - packetIdSize;
+    std::uint8_t* const header = packetId - state.headerLength;
+    std::uint8_t* const start = header - prefix;
+    const std::size_t total = prefix + state.headerLength + packetIdSize + tagSize + bodyLength;
+    if (total - prefix > 0xFFFF) {
+        return {};
+    }
+    std::copy_n(state.header.begin(), state.headerLength, header);
+    write32(packetId, state.nextPacketId++);
+    std::copy_n(packetId, packetIdSize, state.out.iv.begin());
+
+    EVP_CIPHER_CTX* ctx = state.out.cipher;
+    int ignored = 0;
+    // V2 authenticates the opcode and peer id along with the packet id
+    const std::uint8_t* aad = state.headerLength == 1 ? packetId : header;
+    if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, state.out.iv.data()) != 1 ||
+        EVP_EncryptUpdate(ctx, nullptr, &ignored, aad, static_cast<int>(packetId + packetIdSize - aad)) != 1 ||
+        !update(ctx, true, body, body, bodyLength) || EVP_EncryptFinal_ex(ctx, nullptr, &ignored) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(tagSize), tag) != 1) {
+        return {};
+    }
+
+    if constexpr (prefix != 0) {
+        start[0] = static_cast<std::uint8_t>((total - prefix) >> 8);
+        start[1] = static_cast<std::uint8_t>((total - prefix) & 0xFF);
+    }
+    ++state.stats.sealed;
+    return {start, total};
+}
+
+template <DataChannel::Cipher cipher, DataChannel::Compression compression>
+std::optional<std::size_t> DataChannel::openPacket(State& state, std::span<const std::uint8_t> packet,
+                                                   std::span<std::uint8_t> out) {
+    const std::size_t fixed = state.headerLength + packetIdSize + tagSize;
+    if (packet.size() < fixed || packet[0] != state.header[0]) {
+        return std::nullopt;
+    }
+    const std::uint8_t* const packetId = packet.data() + state.headerLength;
+    const std::uint8_t* const tag = packetId + packetIdSize;
+    const std::uint8_t* body = tag + tagSize;
+    std::size_t remaining = packet.size() - fixed;
+    if (out.size() < remaining) {
+        return std::nullopt;
+    }
+    std::copy_n(packetId, packetIdSize, state.in.iv.begin());
+
+    EVP_CIPHER_CTX* ctx = state.in.cipher;
+    int ignored = 0;
+    const std::uint8_t* aad = state.headerLength == 1 ? packetId : packet.data();
+    if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, state.in.iv.data()) != 1 ||
+        EVP_DecryptUpdate(ctx, nullptr, &ignored, aad, static_cast<int>(packetId + packetIdSize - aad)) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(tagSize), const_cast<std::uint8_t*>(tag)) != 1) {
+        return std::nullopt;
+    }
+
+    // Framing bytes are decrypted aside so the payload lands in place
+    std::size_t length = remaining;
+    bool ok = true;
+    bool framed = true;
+    if constexpr (compression == Compression::Lzo || compression == Compression::Swap) {
+        std::uint8_t marker = 0;
+        ok = remaining >= 1 && update(ctx, false, &marker, body, 1) &&
+             update(ctx, false, out.data(), body + 1, remaining - 1);
+        framed = marker == (compression == Compression::Lzo ? lzoNoCompress : swapNoCompress);
+        length = remaining - 1;
+        if constexpr (compression == Compression::Swap) {
+            if (ok && length > 0) {
+                std::rotate(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(length - 1),
+                            out.begin() + static_cast<std::ptrdiff_t>(length));
+            }
+        }
+    } else if constexpr (compression == Compression::StubV2) {
+        std::array<std::uint8_t, 2> marker{};
+        ok = remaining == 0 || update(ctx, false, marker.data(), body, 1);
+        if (ok && remaining > 0 && marker[0] == stubV2Indicator) {
+            ok = remaining >= 2 && update(ctx, false, marker.data() + 1, body + 1, 1) &&
+                 update(ctx, false, out.data(), body + 2, remaining - 2);
+            framed = marker[1] == stubV2NoCompress;
+            length = remaining - 2;
+        } else if (ok && remaining > 0) {
+            out[0] = marker[0];
+            ok = update(ctx, false, out.data() + 1, body + 1, remaining - 1);
+        }
+    } else {
+        ok = update(ctx, false, out.data(), body, remaining);
+    }
+
+    if (!ok || EVP_DecryptFinal_ex(ctx, nullptr, &ignored) != 1) {
+        ++state.stats.authFailures;
+        return std::nullopt;
+    }
+    if (!acceptPacketId(state, read32(packetId))) {
+        ++state.stats.replays;
+        return std::nullopt;
+    }
+    if (!framed) {
+        return std::nullopt;  // actually compressed: never negotiated, so dropped
+    }
+    ++state.stats.opened;
+    return length;
+}
+
+bool DataChannel::acceptPacketId(State& state, std::uint32_t packetId) {
+    if (packetId == 0) {
+        return false;
+    }
+    if (packetId > state.highestReceived) {
+        const std::uint32_t shift = packetId - state.highestReceived;
+        state.receivedBitmap = shift >= replayWindow ? 0 : state.receivedBitmap << shift;
+        state.receivedBitmap |= 1;
+        state.highestReceived = packetId;
+        return true;
+    }
+    const std::uint32_t behind = state.highestReceived - packetId;
+    if (behind >= replayWindow || (state.receivedBitmap >> behind) & 1) {
+        return false;
+    }
+    state.receivedBitmap |= std::uint64_t{1} << behind;
+    return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+import std;
+#include <openssl/evp.h>
+#include "vpnTransport.h"
+
+// OpenVPN data channel: P_DATA_V1/V2 packets sealed with an AEAD cipher
+// (AES-GCM or ChaCha20-Poly1305), the "no compression" framings servers may
+// insist on, and a replay window. Cipher, compression and transport framing
+// are fixed for the whole session once the push reply is in, so every
+// combination is its own template-instantiated kernel with all three
+// compiled in; the channel picks one from a table when it is created and
+// packets never branch on the session parameters again.
+class DataChannel {
+public:
+    enum class Cipher : std::uint8_t { Aes128Gcm, Aes256Gcm, ChaCha20Poly1305 };
+    static constexpr std::size_t cipherCount = 3;
+
+    enum class Compression : std::uint8_t {
+        None,    // nothing negotiated
+        Lzo,     // comp-lzo: a 0xFA "not compressed" byte in front
+        Swap,    // compress / compress lz4 (v1 stub): 0xFB in front, first byte moved to the end
+        StubV2   // compress stub-v2: only payloads starting with 0x50 get escaped
+    };
+    static constexpr std::size_t compressionCount = 4;
+
+    struct Config {
+        Cipher cipher = Cipher::Aes256Gcm;
+        Compression compression = Compression::None;
+        VpnTransport::Protocol framing = VpnTransport::Protocol::Udp;
+        std::optional<std::uint32_t> peerId;  // P_DATA_V2 when the server pushed one, else P_DATA_V1
+        std::uint8_t keyId = 0;
+    };
+
+    struct Stats {
+        std::uint64_t sealed = 0;
+        std::uint64_t opened = 0;
+        std::uint64_t authFailures = 0;  // forged, corrupted or for another key
+        std::uint64_t replays = 0;
+    };
+
+    static constexpr std::size_t keyBlockSize = 256;
+    // Transport framing, opcode and peer id, packet id, tag, compression framing
+    static constexpr std::size_t maxOverhead = 2 + 4 + 4 + 16 + 2;
+    // Room sealInPlace() needs around the payload
+    static constexpr std::size_t headroom = maxOverhead;
+    static constexpr std::size_t tailroom = 1;
+
+    // "AES-256-GCM", "CHACHA20-POLY1305", ... ; nullopt for ciphers without a kernel
+    static std::optional<Cipher> cipherFromName(std::string_view name);
+    // Value of a compress / comp-lzo option ("compress stub-v2" -> "stub-v2")
+    static Compression compressionFromOption(std::string_view option, std::string_view value);
+
+    // The OpenVPN keepalive payload, answered by nothing and dropped by both ends
+    static std::span<const std::uint8_t> pingPayload();
+    static bool isPing(std::span<const std::uint8_t> payload);
+
+    // keyBlock: TlsHandshake::dataChannelKeys of the session; throws
+    // std::runtime_error if the cipher cannot be set up
+    DataChannel(const Config& config, std::span<const std::uint8_t> keyBlock);
+    ~DataChannel();
+
+    DataChannel(const DataChannel&) = delete;
+    DataChannel& operator=(const DataChannel&) = delete;
+
+    // Writes the wire packet for payload, transport framing included, to out;
+    // its length, or 0 if out (headroom + payload + tailroom) is too small or
+    // the packet ids are used up
+    std::size_t seal(std::span<const std::uint8_t> payload, std::span<std::uint8_t> out);
+    // Encrypts the payload at buffer[headroom, headroom + length) where it
+    // lies and writes the header and framing in front of it; the wire packet
+    // is the returned part of buffer, empty on the same failures as seal()
+    std::span<std::uint8_t> sealInPlace(std::span<std::uint8_t> buffer, std::size_t length);
+    // Payload of a received P_DATA packet in out; nullopt if forged, replayed or malformed
+    std::optional<std::size_t> open(std::span<const std::uint8_t> packet, std::span<std::uint8_t> out);
+
+    const Config& config() const;
+    Stats stats() const;
+
+private:
+    struct Direction {
+        EVP_CIPHER_CTX* cipher = nullptr;
+        std::array<std::uint8_t, 12> iv{};  // packet id in the first four bytes, implicit IV after
+    };
+
+    // Everything a kernel touches per packet
+    struct State {
+        Direction out;
+        Direction in;
+        std::array<std::uint8_t, 4> header{};  // opcode/key id and, for V2, the peer id
+        std::size_t headerLength = 1;
+        std::uint32_t nextPacketId = 1;
+        std::uint32_t highestReceived = 0;     // replay window: newest id and a bitmap behind it
+        std::uint64_t receivedBitmap = 0;
+        Stats stats;
+    };
+
+    using SealKernel = std::span<std::uint8_t> (*)(State&, std::span<std::uint8_t>, std::size_t);
+    using OpenKernel = std::optional<std::size_t> (*)(State&, std::span<const std::uint8_t>, std::span<std::uint8_t>);
+
+    template <Cipher cipher, Compression compression, VpnTransport::Protocol framing>
+    static std::span<std::uint8_t> sealPacket(State& state, std::span<std::uint8_t> buffer, std::size_t length);
+    template <Cipher cipher, Compression compression>
+    static std::optional<std::size_t> openPacket(State& state, std::span<const std::uint8_t> packet, std::span<std::uint8_t> out);
+    static bool acceptPacketId(State& state, std::uint32_t packetId);
+
+    template <std::size_t... index>
+    static constexpr auto makeSealTable(std::index_sequence<index...>);
+    template <std::size_t... index>
+    static constexpr auto makeOpenTable(std::index_sequence<index...>);
+
+    Config activeConfig;
+    State state;
+    SealKernel sealKernel = nullptr;
+    OpenKernel openKernel = nullptr;
+};
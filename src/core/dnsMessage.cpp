@@ -0,0 +1,285 @@
+import std;
+#include "dnsMessage.h"
+
+namespace dnsMessage {
+
+namespace {
+
+constexpr std::uint16_t classIn = 1;
+constexpr int maxPointerJumps = 16;
+
+enum class Section { Answer, Authority, Additional };
+
+struct Record {
+    Section section = Section::Answer;
+    std::uint16_t type = 0;
+    std::uint16_t rclass = 0;
+    std::size_t ttlOffset = 0;
+    std::uint32_t ttl = 0;
+    std::size_t data = 0;
+    std::uint16_t length = 0;
+};
+
+std::uint16_t read16(std::span<const std::uint8_t> message, std::size_t offset) {
+    return static_cast<std::uint16_t>((message[offset] << 8) | message[offset + 1]);
+}
+
+std::uint32_t read32(std::span<const std::uint8_t> message, std::size_t offset) {
+    return (static_cast<std::uint32_t>(read16(message, offset)) << 16) | read16(message, offset + 2);
+}
+
+void write32(std::span<std::uint8_t> message, std::size_t offset, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        message[offset + static_cast<std::size_t>(i)] = static_cast<std::uint8_t>(value >> (24 - 8 * i));
+    }
+}
+
+// Walks a possibly compressed name starting at offset. Returns the offset just
+// past it in the record, or nullopt if malformed. With out set, the dotted
+// lowercase name is written there.
+std::optional<std::size_t> readName(std::span<const std::uint8_t> message, std::size_t offset, Question* out) {
+    std::optional<std::size_t> resumeAt;
+    std::size_t written = 0;
+    int jumps = 0;
+
+    while (true) {
+        if (offset >= message.size()) {
+            return std::nullopt;
+        }
+        const std::uint8_t length = message[offset];
+        if ((length & 0xC0) == 0xC0) {
+            if (offset + 1 >= message.size() || ++jumps > maxPointerJumps) {
+                return std::nullopt;
+            }
+            if (!resumeAt) {
+                resumeAt = offset + 2;
+            }
+            offset = static_cast<std::size_t>(((length & 0x3F) << 8) | message[offset + 1]);
+            continue;
+        }
+        if ((length & 0xC0) != 0) {
+            return std::nullopt;  // obsolete label types
+        }
+        if (length == 0) {
+            if (out) {
+                out->nameLength = written;
+                out->name[written] = '\0';
+            }
+            return resumeAt ? *resumeAt : offset + 1;
+        }
+        if (offset + 1 + length > message.size()) {
+            return std::nullopt;
+        }
+        if (out) {
+            if (written + length + (written ? 1 : 0) > maxNameLength) {
+                return std::nullopt;
+            }
+            if (written) {
+                out->name[written++] = '.';
+            }
+            for (std::size_t i = 0; i < length; ++i) {
+                const char c = static_cast<char>(message[offset + 1 + i]);
+                out->name[written++] = c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+            }
+        }
+        offset += 1 + length;
+    }
+}
+
+// Calls visit for every resource record after the question section; false if
+// the message is malformed. visit returns false to stop early.
+template <typename Visit>
+bool walkRecords(std::span<const std::uint8_t> message, Visit&& visit) {
+    if (message.size() < headerSize) {
+        return false;
+    }
+    std::size_t offset = headerSize;
+    for (std::uint16_t i = 0, questions = read16(message, 4); i < questions; ++i) {
+        auto end = readName(message, offset, nullptr);
+        if (!end || *end + 4 > message.size()) {
+            return false;
+        }
+        offset = *end + 4;
+    }
+
+    const std::array<std::pair<Section, std::uint16_t>, 3> sections{{
+        {Section::Answer, read16(message, 6)},
+        {Section::Authority, read16(message, 8)},
+        {Section::Additional, read16(message, 10)},
+    }};
+    for (const auto& [section, count] : sections) {
+        for (std::uint16_t i = 0; i < count; ++i) {
+            auto end = readName(message, offset, nullptr);
+            if (!end || *end + 10 > message.size()) {
+                return false;
+            }
+            Record record;
+            record.section = section;
+            record.type = read16(message, *end);
+            record.rclass = read16(message, *end + 2);
+            record.ttlOffset = *end + 4;
+            record.ttl = read32(message, *end + 4);
+            record.length = read16(message, *end + 8);
+            record.data = *end + 10;
+            if (record.data + record.length > message.size()) {
+                return false;
+            }
+            if (!visit(record)) {
+                return true;
+            }
+            offset = record.data + record.length;
+        }
+    }
+    return true;
+}
+
+// RFC 2181: a TTL with the top bit set is treated as zero
+std::uint32_t effectiveTtl(std::uint32_t ttl) {
+    return ttl > 0x7FFFFFFF ? 0 : ttl;
+}
+
+} // namespace
+
+std::uint16_t messageId(std::span<const std::uint8_t> message) {
+    return message.size() >= 2 ? read16(message, 0) : 0;
+}
+
+void setMessageId(std::span<std::uint8_t> message, std::uint16_t id) {
+    if (message.size() >= 2) {
+        message[0] = static_cast<std::uint8_t>(id >> 8);
+        message[1] = static_cast<std::uint8_t>(id & 0xFF);
+    }
+}
+
+bool isTruncated(std::span<const std::uint8_t> message) {
+    return message.size() >= headerSize && (message[2] & 0x02) != 0;
+}
+
+std::uint8_t responseCode(std::span<const std::uint8_t> message) {
+    return message.size() >= headerSize ? static_cast<std::uint8_t>(message[3] & 0x0F) : rcodeServFail;
+}
+
+bool parseQuestion(std::span<const std::uint8_t> message, Question& question) {
+    if (message.size() < headerSize || read16(message, 4) == 0) {
+        return false;
+    }
+    question.id = read16(message, 0);
+    auto end = readName(message, headerSize, &question);
+    if (!end || *end + 4 > message.size()) {
+        return false;
+    }
+    question.type = read16(message, *end);
+    question.qclass = read16(message, *end + 2);
+    question.end = *end + 4;
+
+    question.udpPayload = classicUdpSize;
+    if (read16(message, 10) > 0) {
+        walkRecords(message, [&question](const Record& record) {
+            if (record.section == Section::Additional && record.type == typeOpt) {
+                // The OPT record's class carries the sender's UDP payload size
+                question.udpPayload = std::max<std::size_t>(classicUdpSize, record.rclass);
+                return false;
+            }
+            return true;
+        });
+    }
+    return true;
+}
+
+bool parseAnswers(std::span<const std::uint8_t> message, Answers& answers) {
+    answers.count = 0;
+    if (message.size() < headerSize) {
+        return false;
+    }
+    answers.id = read16(message, 0);
+    answers.truncated = isTruncated(message);
+    answers.rcode = responseCode(message);
+
+    return walkRecords(message, [&](const Record& record) {
+        if (record.section != Section::Answer) {
+            return false;
+        }
+        const bool v4 = record.type == typeA && record.length == 4;
+        const bool v6 = record.type == typeAaaa && record.length == 16;
+        if (record.rclass == classIn && (v4 || v6) && answers.count < maxAddresses) {
+            Address& address = answers.addresses[answers.count++];
+            address.v6 = v6;
+            address.bytes = {};
+            std::copy_n(message.begin() + static_cast<std::ptrdiff_t>(record.data), record.length, address.bytes.begin());
+            address.ttl = effectiveTtl(record.ttl);
+        }
+        return true;
+    });
+}
+
+std::optional<std::uint32_t> cacheTtl(std::span<const std::uint8_t> message, std::uint32_t negativeTtl) {
+    std::optional<std::uint32_t> smallest;
+    std::optional<std::uint32_t> soaTtl;
+    bool answered = false;
+    const bool valid = walkRecords(message, [&](const Record& record) {
+        if (record.section == Section::Additional) {
+            return false;
+        }
+        answered = answered || record.section == Section::Answer;
+        const std::uint32_t ttl = effectiveTtl(record.ttl);
+        smallest = std::min(smallest.value_or(ttl), ttl);
+        // Negative answers live for min(SOA TTL, SOA MINIMUM); MINIMUM is the last field
+        if (record.section == Section::Authority && record.type == typeSoa && record.length >= 4) {
+            soaTtl = std::min(ttl, read32(message, record.data + record.length - 4));
+        }
+        return true;
+    });
+    if (!valid) {
+        return std::nullopt;
+    }
+    if (!answered || responseCode(message) == rcodeNxDomain) {
+        return std::min(soaTtl.value_or(negativeTtl), negativeTtl);
+    }
+    return smallest.value_or(0);
+}
+
+void ageTtls(std::span<std::uint8_t> message, std::uint32_t elapsed) {
+    walkRecords(message, [&](const Record& record) {
+        if (record.type != typeOpt) {
+            const std::uint32_t ttl = effectiveTtl(record.ttl);
+            write32(message, record.ttlOffset, ttl > elapsed ? ttl - elapsed : 0);
+        }
+        return true;
+    });
+}
+
+std::size_t buildQuery(std::span<std::uint8_t> out, std::uint16_t id, std::string_view name,
+                       std::uint16_t type, std::uint16_t qclass) {
+    // Header, one length byte per label plus the root label, type and class
+    const std::size_t needed = headerSize + name.size() + 2 + 4;
+    if (out.size() < needed || name.size() > maxNameLength) {
+        return 0;
+    }
+    std::fill_n(out.begin(), headerSize, std::uint8_t{0});
+    setMessageId(out, id);
+    out[2] = 0x01;  // RD
+    out[5] = 1;     // QDCOUNT
+
+    std::size_t offset = headerSize;
+    std::size_t start = 0;
+    while (start < name.size()) {
+        const std::size_t dot = std::min(name.find('.', start), name.size());
+        const std::size_t length = dot - start;
+        if (length == 0 || length > 63) {
+            return 0;
+        }
+        out[offset++] = static_cast<std::uint8_t>(length);
+        for (std::size_t i = start; i < dot; ++i) {
+            out[offset++] = static_cast<std::uint8_t>(name[i]);
+        }
+        start = dot + 1;
+    }
+    out[offset++] = 0;
+    out[offset++] = static_cast<std::uint8_t>(type >> 8);
+    out[offset++] = static_cast<std::uint8_t>(type & 0xFF);
+    out[offset++] = static_cast<std::uint8_t>(qclass >> 8);
+    out[offset++] = static_cast<std::uint8_t>(qclass & 0xFF);
+    return offset;
+}
+
+} // namespace dnsMessage
@@ -0,0 +1,74 @@
+#pragma once
+import std;
+
+// Just enough of the DNS wire format (RFC 1035) for the local resolver:
+// the header, the first question, the records' TTLs and the addresses in
+// the answer section. Parsing works on the caller's buffer and fixed-size
+// results, so nothing here allocates.
+namespace dnsMessage {
+
+inline constexpr std::size_t headerSize = 12;
+inline constexpr std::size_t maxNameLength = 253;
+inline constexpr std::size_t maxAddresses = 32;
+inline constexpr std::size_t classicUdpSize = 512;  // without EDNS0
+
+inline constexpr std::uint16_t typeA = 1;
+inline constexpr std::uint16_t typeSoa = 6;
+inline constexpr std::uint16_t typeAaaa = 28;
+inline constexpr std::uint16_t typeOpt = 41;
+
+inline constexpr std::uint8_t rcodeNoError = 0;
+inline constexpr std::uint8_t rcodeServFail = 2;
+inline constexpr std::uint8_t rcodeNxDomain = 3;
+
+struct Question {
+    std::uint16_t id = 0;
+    std::uint16_t type = 0;
+    std::uint16_t qclass = 0;
+    std::array<char, maxNameLength + 1> name{};  // dotted, lowercase, no trailing dot
+    std::size_t nameLength = 0;
+    std::size_t end = 0;                          // offset just past the question
+    std::size_t udpPayload = classicUdpSize;      // what the sender accepts over UDP (EDNS0)
+
+    std::string_view nameView() const { return std::string_view(name.data(), nameLength); }
+};
+
+struct Address {
+    bool v6 = false;
+    std::array<std::uint8_t, 16> bytes{};  // IPv4 uses the first four
+    std::uint32_t ttl = 0;
+};
+
+struct Answers {
+    std::uint16_t id = 0;
+    std::uint8_t rcode = 0;
+    bool truncated = false;
+    std::array<Address, maxAddresses> addresses{};
+    std::size_t count = 0;  // addresses beyond maxAddresses are dropped
+};
+
+std::uint16_t messageId(std::span<const std::uint8_t> message);
+void setMessageId(std::span<std::uint8_t> message, std::uint16_t id);
+bool isTruncated(std::span<const std::uint8_t> message);
+std::uint8_t responseCode(std::span<const std::uint8_t> message);
+
+// False unless the message holds a header and a well-formed first question
+bool parseQuestion(std::span<const std::uint8_t> message, Question& question);
+
+// A and AAAA records of a response's answer section, whatever their owner
+// name (CNAME chains end in them); false if the response is malformed
+bool parseAnswers(std::span<const std::uint8_t> message, Answers& answers);
+
+// How long a response may be cached: the smallest answer/authority TTL, or
+// for negative answers the SOA's (RFC 2308), capped by negativeTtl.
+// nullopt if malformed.
+std::optional<std::uint32_t> cacheTtl(std::span<const std::uint8_t> message, std::uint32_t negativeTtl);
+
+// Counts every record TTL (except EDNS0's) down by elapsed seconds
+void ageTtls(std::span<std::uint8_t> message, std::uint32_t elapsed);
+
+// Writes a recursive query into out; returns its length, or 0 if out is too small
+std::size_t buildQuery(std::span<std::uint8_t> out, std::uint16_t id, std::string_view name,
+                       std::uint16_t type, std::uint16_t qclass);
+
+} // namespace dnsMessage
@@ -0,0 +1,971 @@
+import std;
+#include "dnsProxy.h"
+#include "dnsMessage.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+constexpr std::size_t maxDatagram = 4096;  // EDNS0 payloads stay below this
+constexpr std::size_t maxTcpClients = 128;
+constexpr std::size_t latencyWindow = 1024;
+constexpr auto pollSlice = std::chrono::milliseconds(100);
+constexpr auto tcpIdleTimeout = std::chrono::seconds(30);
+
+#ifdef _WIN32
+using PollEntry = WSAPOLLFD;
+constexpr short readEvents = POLLRDNORM;
+constexpr short writeEvents = POLLWRNORM;
+constexpr int sendFlags = 0;
+
+int pollSockets(std::vector<PollEntry>& entries, int timeoutMs) {
+    return WSAPoll(entries.data(), static_cast<ULONG>(entries.size()), timeoutMs);
+}
+
+bool wouldBlock() {
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+using PollEntry = pollfd;
+constexpr short readEvents = POLLIN;
+constexpr short writeEvents = POLLOUT;
+constexpr int sendFlags = MSG_NOSIGNAL;  // a vanished TCP peer must not raise SIGPIPE
+
+int pollSockets(std::vector<PollEntry>& entries, int timeoutMs) {
+    return ::poll(entries.data(), entries.size(), timeoutMs);
+}
+
+bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+#endif
+
+bool sameEndpoint(const sockaddr_storage& a, const sockaddr_storage& b) {
+    if (a.ss_family != b.ss_family) {
+        return false;
+    }
+    if (a.ss_family == AF_INET6) {
+        const auto* x = reinterpret_cast<const sockaddr_in6*>(&a);
+        const auto* y = reinterpret_cast<const sockaddr_in6*>(&b);
+        return x->sin6_port == y->sin6_port && std::memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+    const auto* x = reinterpret_cast<const sockaddr_in*>(&a);
+    const auto* y = reinterpret_cast<const sockaddr_in*>(&b);
+    return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+}
+
+std::uint16_t portOf(const sockaddr_storage& address) {
+    return ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port
+                                               : reinterpret_cast<const sockaddr_in*>(&address)->sin_port);
+}
+
+bool isLoopback(const std::string& address) {
+    return address.starts_with("127.") || address == "::1";
+}
+
+void appendFramed(std::vector<std::uint8_t>& out, std::span<const std::uint8_t> message) {
+    out.push_back(static_cast<std::uint8_t>(message.size() >> 8));
+    out.push_back(static_cast<std::uint8_t>(message.size() & 0xFF));
+    out.insert(out.end(), message.begin(), message.end());
+}
+
+} // namespace
+
+double DnsProxy::Stats::hitRate() const {
+    const auto lookups = cacheHits + cacheMisses;
+    return lookups == 0 ? 0.0 : static_cast<double>(cacheHits) / static_cast<double>(lookups);
+}
+
+DnsProxy::DnsProxy()
+    : DnsProxy(Settings{}) {
+}
+
+DnsProxy::DnsProxy(Settings settings)
+    : settings(std::move(settings)) {
+}
+
+DnsProxy::~DnsProxy() {
+    stop();
+    clearCached();
+}
+
+void DnsProxy::configure(Settings newSettings) {
+    if (running) {
+        return;
+    }
+    clearCached();
+    settings = std::move(newSettings);
+}
+
+const DnsProxy::Settings& DnsProxy::currentSettings() const {
+    return settings;
+}
+
+void DnsProxy::setRules(std::shared_ptr<const DomainMatcher> newRules) {
+    std::lock_guard<std::mutex> lock(rulesMutex);
+    rules = std::move(newRules);
+}
+
+void DnsProxy::setAddressSink(AddressSink sink) {
+    addressSink = std::move(sink);
+}
+
+void DnsProxy::clearCache() {
+    if (running) {
+        cacheFlushRequested = true;
+    } else {
+        clearCached();
+    }
+}
+
+bool DnsProxy::start() {
+    if (running) {
+        return true;
+    }
+    socketUtil::ensureInitialized();
+
+    upstreams.clear();
+    for (const auto& address : settings.upstreams) {
+        try {
+            for (const auto& resolved : socketUtil::resolve(address, "53", SOCK_DGRAM)) {
+                upstreams.push_back(resolved);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "[VPN] Ignoring DNS upstream: " << e.what() << '\n';
+        }
+    }
+    if (upstreams.empty()) {
+        upstreams = systemResolvers();
+    }
+    if (upstreams.empty()) {
+        lastError = "No upstream DNS resolver configured";
+        return false;
+    }
+    upstreamTcp.assign(upstreams.size(), std::nullopt);
+    if (!openSockets()) {
+        closeSockets();
+        return false;
+    }
+
+    running = true;
+    eventThread = std::thread(&DnsProxy::eventLoop, this);
+    publishThread = std::thread(&DnsProxy::publishLoop, this);
+    std::cout << "[VPN] DNS forwarder listening on " << settings.listenAddress << ":" << boundPort
+              << " (" << upstreams.size() << " upstream resolvers"
+              << (settings.upstreamInterface.empty() ? "" : " via " + settings.upstreamInterface) << ")\n";
+    return true;
+}
+
+void DnsProxy::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    heldCv.notify_all();
+    if (eventThread.joinable()) {
+        eventThread.join();
+    }
+    if (publishThread.joinable()) {
+        publishThread.join();
+    }
+    for (auto& [id, connection] : tcpConnections) {
+        socketUtil::closeSocket(connection.socket);
+    }
+    tcpConnections.clear();
+    closeSockets();
+    for (const auto& [id, lookup] : lookups) {
+        releaseLookup(lookup);
+    }
+    lookups.clear();
+    lookupsByKey.clear();
+    held.clear();
+    released.clear();
+}
+
+bool DnsProxy::isRunning() const {
+    return running;
+}
+
+std::uint16_t DnsProxy::port() const {
+    return boundPort;
+}
+
+DnsProxy::Stats DnsProxy::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Stats result = counters;
+    if (!latencySamples.empty()) {
+        auto samples = latencySamples;
+        auto middle = samples.begin() + static_cast<std::ptrdiff_t>(samples.size() / 2);
+        std::nth_element(samples.begin(), middle, samples.end());
+        result.medianLatency = std::chrono::microseconds(*middle);
+    }
+    return result;
+}
+
+std::string DnsProxy::getLastError() const {
+    return lastError;
+}
+
+std::vector<sockaddr_storage> DnsProxy::systemResolvers() {
+    // systemd-resolved keeps the real upstreams out of /etc/resolv.conf
+    for (const char* path : {"/run/systemd/resolve/resolv.conf", "/etc/resolv.conf"}) {
+        std::ifstream file(path);
+        std::vector<sockaddr_storage> resolvers;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string keyword, address;
+            if (!(fields >> keyword >> address) || keyword != "nameserver" || isLoopback(address)) {
+                continue;
+            }
+            try {
+                for (const auto& resolved : socketUtil::resolve(address, "53", SOCK_DGRAM)) {
+                    resolvers.push_back(resolved);
+                }
+            } catch (const std::exception& e) {
+                // Unparsable entries are skipped
+            }
+        }
+        if (!resolvers.empty()) {
+            return resolvers;
+        }
+    }
+    return {};
+}
+
+bool DnsProxy::openSockets() {
+    std::vector<sockaddr_storage> listenAddresses;
+    try {
+        listenAddresses = socketUtil::resolve(settings.listenAddress, std::to_string(settings.listenPort), SOCK_DGRAM);
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return false;
+    }
+    auto local = listenAddresses.front();
+
+    listenSocket = ::socket(local.ss_family, SOCK_DGRAM, 0);
+    if (listenSocket == socketUtil::invalidSocket ||
+        ::bind(listenSocket, reinterpret_cast<const sockaddr*>(&local), socketUtil::addressLength(local)) != 0 ||
+        !socketUtil::setNonBlocking(listenSocket)) {
+        lastError = "Cannot listen on " + socketUtil::addressToString(local) + ": " + socketUtil::lastErrorText();
+        return false;
+    }
+    sockaddr_storage bound{};
+    socklen_t boundLength = sizeof(bound);
+    ::getsockname(listenSocket, reinterpret_cast<sockaddr*>(&bound), &boundLength);
+    boundPort = portOf(bound);
+
+    // TCP on the same port, for clients retrying truncated answers
+    listenTcpSocket = ::socket(bound.ss_family, SOCK_STREAM, 0);
+    const int reuse = 1;
+    ::setsockopt(listenTcpSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    if (listenTcpSocket == socketUtil::invalidSocket ||
+        ::bind(listenTcpSocket, reinterpret_cast<const sockaddr*>(&bound), boundLength) != 0 ||
+        ::listen(listenTcpSocket, 64) != 0 || !socketUtil::setNonBlocking(listenTcpSocket)) {
+        std::cerr << "[VPN] DNS forwarder serves UDP only: " << socketUtil::lastErrorText() << '\n';
+        socketUtil::closeSocket(listenTcpSocket);
+        listenTcpSocket = socketUtil::invalidSocket;
+    }
+
+    auto openUpstream = [this](int family) {
+        const bool needed = std::any_of(upstreams.begin(), upstreams.end(),
+                                        [family](const sockaddr_storage& address) { return address.ss_family == family; });
+        if (!needed) {
+            return socketUtil::invalidSocket;
+        }
+        auto handle = ::socket(family, SOCK_DGRAM, 0);
+        if (handle != socketUtil::invalidSocket && !prepareUpstreamSocket(handle)) {
+            socketUtil::closeSocket(handle);
+            handle = socketUtil::invalidSocket;
+            upstreamUnpinned = true;
+        }
+        return handle;
+    };
+    upstreamUnpinned = false;
+    upstreamSocket4 = openUpstream(AF_INET);
+    upstreamSocket6 = openUpstream(AF_INET6);
+    // An upstream socket without its mark or device would loop through our own
+    // redirect or leave outside the tunnel, so that is never good enough
+    if (upstreamUnpinned) {
+        return false;
+    }
+    if (upstreamSocket4 == socketUtil::invalidSocket && upstreamSocket6 == socketUtil::invalidSocket) {
+        lastError = "Cannot open DNS upstream socket: " + socketUtil::lastErrorText();
+        return false;
+    }
+
+    sockaddr_in loopback{};
+    loopback.sin_family = AF_INET;
+    loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr_storage wakeAddress{};
+    socklen_t wakeLength = sizeof(wakeAddress);
+    wakeReceiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+    wakeSender = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (wakeReceiver == socketUtil::invalidSocket || wakeSender == socketUtil::invalidSocket ||
+        ::bind(wakeReceiver, reinterpret_cast<const sockaddr*>(&loopback), sizeof(loopback)) != 0 ||
+        ::getsockname(wakeReceiver, reinterpret_cast<sockaddr*>(&wakeAddress), &wakeLength) != 0 ||
+        ::connect(wakeSender, reinterpret_cast<const sockaddr*>(&wakeAddress), wakeLength) != 0 ||
+        !socketUtil::setNonBlocking(wakeReceiver)) {
+        lastError = "Cannot create DNS forwarder wakeup socket: " + socketUtil::lastErrorText();
+        return false;
+    }
+    return true;
+}
+
+void DnsProxy::closeSockets() {
+    for (auto* handle : {&listenSocket, &listenTcpSocket, &upstreamSocket4, &upstreamSocket6, &wakeReceiver, &wakeSender}) {
+        socketUtil::closeSocket(*handle);
+        *handle = socketUtil::invalidSocket;
+    }
+}
+
+bool DnsProxy::prepareUpstreamSocket(socketUtil::SocketHandle handle) {
+    if (!socketUtil::setNonBlocking(handle)) {
+        lastError = "Cannot set up DNS upstream socket: " + socketUtil::lastErrorText();
+        return false;
+    }
+    #ifdef __linux__
+    // Keeps the forwarder's own queries out of the port 53 redirect
+    const int mark = static_cast<int>(SplitTunnel::dnsMark);
+    if (::setsockopt(handle, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) != 0) {
+        lastError = "Cannot mark DNS upstream socket: " + socketUtil::lastErrorText();
+        return false;
+    }
+    // Pins queries to the tunnel whatever the routing table says
+    if (!settings.upstreamInterface.empty() &&
+        ::setsockopt(handle, SOL_SOCKET, SO_BINDTODEVICE, settings.upstreamInterface.c_str(),
+                     static_cast<socklen_t>(settings.upstreamInterface.size())) != 0) {
+        lastError = "Cannot bind DNS upstream socket to " + settings.upstreamInterface + ": " +
+                    socketUtil::lastErrorText();
+        return false;
+    }
+    #endif
+    return true;
+}
+
+void DnsProxy::eventLoop() {
+    std::array<std::uint8_t, maxDatagram> buffer{};
+    std::vector<PollEntry> entries;
+    std::vector<std::uint64_t> entryConnections;  // parallel to entries; 0 for the fixed sockets
+    auto lastExpiry = Clock::now();
+
+    while (running) {
+        if (cacheFlushRequested.exchange(false)) {
+            clearCached();
+        }
+
+        entries.clear();
+        entryConnections.clear();
+        for (auto handle : {listenSocket, listenTcpSocket, upstreamSocket4, upstreamSocket6, wakeReceiver}) {
+            if (handle != socketUtil::invalidSocket) {
+                entries.push_back({handle, readEvents, 0});
+                entryConnections.push_back(0);
+            }
+        }
+        for (const auto& [id, connection] : tcpConnections) {
+            const bool writing = connection.connecting || !connection.out.empty();
+            entries.push_back({connection.socket, static_cast<short>(readEvents | (writing ? writeEvents : 0)), 0});
+            entryConnections.push_back(id);
+        }
+
+        if (pollSockets(entries, static_cast<int>(pollSlice.count())) > 0) {
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].revents == 0) {
+                    continue;
+                }
+                if (entryConnections[i] != 0) {
+                    serviceTcp(entryConnections[i], entries[i].revents);
+                    continue;
+                }
+
+                const auto handle = entries[i].fd;
+                if (handle == listenTcpSocket) {
+                    while (true) {
+                        auto accepted = ::accept(listenTcpSocket, nullptr, nullptr);
+                        if (accepted == socketUtil::invalidSocket) {
+                            break;
+                        }
+                        if (tcpConnections.size() >= maxTcpClients || !socketUtil::setNonBlocking(accepted)) {
+                            socketUtil::closeSocket(accepted);
+                            continue;
+                        }
+                        TcpConnection connection;
+                        connection.socket = accepted;
+                        connection.client = true;
+                        connection.lastActive = Clock::now();
+                        tcpConnections.emplace(nextConnection++, std::move(connection));
+                    }
+                    continue;
+                }
+
+                // Drain the datagram socket
+                while (true) {
+                    sockaddr_storage from{};
+                    socklen_t fromLength = sizeof(from);
+                    const auto length = ::recvfrom(handle, reinterpret_cast<char*>(buffer.data()), static_cast<int>(buffer.size()), 0,
+                                                   reinterpret_cast<sockaddr*>(&from), &fromLength);
+                    if (length < 0) {
+                        break;
+                    }
+                    auto message = std::span(buffer.data(), static_cast<std::size_t>(length));
+                    if (handle == wakeReceiver) {
+                        continue;
+                    }
+                    if (handle == listenSocket) {
+                        Waiter waiter;
+                        waiter.client = from;
+                        handleQuery(message, std::move(waiter));
+                    } else {
+                        handleUpstreamReply(message, from, 0);
+                    }
+                }
+                if (handle == wakeReceiver) {
+                    releaseHeld();
+                }
+            }
+        }
+
+        const auto now = Clock::now();
+        if (now - lastExpiry >= pollSlice) {
+            expireLookups();
+            lastExpiry = now;
+        }
+    }
+}
+
+void DnsProxy::serviceTcp(std::uint64_t id, short revents) {
+    auto it = tcpConnections.find(id);
+    if (it == tcpConnections.end()) {
+        return;
+    }
+    bool closing = false;
+    {
+        TcpConnection& connection = it->second;
+        if (connection.connecting) {
+            if (!socketUtil::connectSucceeded(connection.socket)) {
+                closing = true;
+            } else if (revents & writeEvents) {
+                connection.connecting = false;
+            }
+        }
+
+        if (!closing && !connection.connecting && (revents & writeEvents) && !connection.out.empty()) {
+            const auto sent = ::send(connection.socket, reinterpret_cast<const char*>(connection.out.data()),
+                                     static_cast<int>(connection.out.size()), sendFlags);
+            if (sent > 0) {
+                connection.out.erase(connection.out.begin(), connection.out.begin() + sent);
+                connection.lastActive = Clock::now();
+            } else if (!wouldBlock()) {
+                closing = true;
+            }
+        }
+
+        if (!closing && !connection.connecting && (revents & ~writeEvents)) {
+            std::array<std::uint8_t, maxDatagram> chunk{};
+            while (true) {
+                const auto length = ::recv(connection.socket, reinterpret_cast<char*>(chunk.data()), static_cast<int>(chunk.size()), 0);
+                if (length > 0) {
+                    connection.in.insert(connection.in.end(), chunk.begin(), chunk.begin() + length);
+                    connection.lastActive = Clock::now();
+                    continue;
+                }
+                closing = length == 0 || !wouldBlock();
+                break;
+            }
+        }
+    }
+
+    // Frames are handled from a copy: handling may add connections, and a
+    // client may have queued several queries at once (pipelining)
+    while (true) {
+        it = tcpConnections.find(id);
+        if (it == tcpConnections.end() || it->second.in.size() < 2) {
+            break;
+        }
+        auto& in = it->second.in;
+        const std::size_t length = (static_cast<std::size_t>(in[0]) << 8) | in[1];
+        if (in.size() < 2 + length) {
+            break;
+        }
+        std::vector<std::uint8_t> frame(in.begin() + 2, in.begin() + 2 + static_cast<std::ptrdiff_t>(length));
+        in.erase(in.begin(), in.begin() + 2 + static_cast<std::ptrdiff_t>(length));
+        if (it->second.client) {
+            Waiter waiter;
+            waiter.tcp = true;
+            waiter.connection = id;
+            handleQuery(frame, std::move(waiter));
+        } else {
+            handleUpstreamReply(frame, std::nullopt, it->second.upstream);
+        }
+    }
+
+    it = tcpConnections.find(id);
+    if (closing && it != tcpConnections.end()) {
+        if (!it->second.client && upstreamTcp[it->second.upstream] == id) {
+            upstreamTcp[it->second.upstream].reset();
+        }
+        socketUtil::closeSocket(it->second.socket);
+        tcpConnections.erase(it);
+    }
+}
+
+void DnsProxy::handleQuery(std::span<const std::uint8_t> query, Waiter waiter) {
+    dnsMessage::Question question;
+    if (!dnsMessage::parseQuestion(query, question)) {
+        return;
+    }
+    const auto now = Clock::now();
+    waiter.clientId = question.id;
+    waiter.udpLimit = question.udpPayload;
+    waiter.question.assign(query.begin() + dnsMessage::headerSize, query.begin() + static_cast<std::ptrdiff_t>(question.end));
+    waiter.receivedAt = now;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.queries;
+    }
+
+    std::string key = std::format("{}|{}|{}", question.nameView(), question.type, question.qclass);
+    auto cached = cache.find(key);
+    if (cached != cache.end()) {
+        CacheEntry& entry = cached->second;
+        const auto age = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(now - entry.storedAt).count());
+        if (age < entry.ttl) {
+            ++entry.hits;
+            lru.splice(lru.begin(), lru, entry.lruPosition);
+            std::vector<std::uint8_t> response = entry.response;
+            dnsMessage::ageTtls(response, age);
+            {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                ++counters.cacheHits;
+            }
+            deliver(waiter, response);
+
+            // Hot entries are refreshed in the background before they expire
+            const bool hot = entry.hits >= settings.prefetchMinHits;
+            const bool expiring = entry.ttl - age <= static_cast<std::uint32_t>(entry.ttl * settings.prefetchAt);
+            if (hot && expiring && !lookupsByKey.contains(key)) {
+                Lookup refresh;
+                refresh.key = key;
+                refresh.name = entry.name;
+                refresh.type = entry.type;
+                refresh.qclass = entry.qclass;
+                refresh.query.resize(dnsMessage::headerSize + dnsMessage::maxNameLength + 6);
+                refresh.query.resize(dnsMessage::buildQuery(refresh.query, 0, entry.name, entry.type, entry.qclass));
+                entry.hits = 0;
+                if (!refresh.query.empty()) {
+                    {
+                        std::lock_guard<std::mutex> lock(rulesMutex);
+                        refresh.ruleTag = rules ? rules->match(refresh.name) : DomainMatcher::noMatch;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(statsMutex);
+                        ++counters.prefetches;
+                    }
+                    startLookup(std::move(refresh));
+                }
+            }
+            return;
+        }
+        eraseCached(cached);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.cacheMisses;
+    }
+    if (auto inFlight = lookupsByKey.find(key); inFlight != lookupsByKey.end()) {
+        lookups[inFlight->second].waiters.push_back(std::move(waiter));
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.coalesced;
+        return;
+    }
+
+    Lookup lookup;
+    lookup.key = std::move(key);
+    lookup.name = std::string(question.nameView());
+    lookup.type = question.type;
+    lookup.qclass = question.qclass;
+    {
+        std::lock_guard<std::mutex> lock(rulesMutex);
+        lookup.ruleTag = rules ? rules->match(question.nameView()) : DomainMatcher::noMatch;
+    }
+    lookup.query.assign(query.begin(), query.end());
+    lookup.waiters.push_back(std::move(waiter));
+    startLookup(std::move(lookup));
+}
+
+void DnsProxy::startLookup(Lookup lookup) {
+    if (lookups.size() >= std::numeric_limits<std::uint16_t>::max()) {
+        for (const auto& waiter : lookup.waiters) {
+            deliverFailure(waiter);
+        }
+        return;
+    }
+    // Over budget the queue stops growing: clients get SERVFAIL and retry, prefetches are skipped
+    if (settings.memoryBudget) {
+        const std::size_t charge = sizeof(Lookup) + lookup.key.size() + lookup.name.size() + lookup.query.size() +
+                                   lookup.waiters.size() * sizeof(Waiter);
+        if (!settings.memoryBudget->tryReserve(MemoryBudget::Subsystem::DnsQueries, charge)) {
+            {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                ++counters.shed;
+            }
+            for (const auto& waiter : lookup.waiters) {
+                deliverFailure(waiter);
+            }
+            return;
+        }
+        lookup.charged = charge;
+    }
+    // Upstream sees our own ids, so concurrent clients reusing an id cannot collide
+    while (lookups.contains(nextId)) {
+        ++nextId;
+    }
+    const std::uint16_t id = nextId++;
+    dnsMessage::setMessageId(lookup.query, id);
+    if (!sendUpstream(lookup)) {
+        for (const auto& waiter : lookup.waiters) {
+            deliverFailure(waiter);
+        }
+        releaseLookup(lookup);
+        return;
+    }
+    lookupsByKey[lookup.key] = id;
+    lookups.emplace(id, std::move(lookup));
+}
+
+bool DnsProxy::sendUpstream(Lookup& lookup) {
+    lookup.sentAt = Clock::now();
+    if (lookup.overTcp) {
+        return sendUpstreamTcp(lookup);
+    }
+    const auto& upstream = upstreams[lookup.upstream % upstreams.size()];
+    const auto handle = upstream.ss_family == AF_INET6 ? upstreamSocket6 : upstreamSocket4;
+    return handle != socketUtil::invalidSocket &&
+           ::sendto(handle, reinterpret_cast<const char*>(lookup.query.data()), static_cast<int>(lookup.query.size()), 0,
+                    reinterpret_cast<const sockaddr*>(&upstream), socketUtil::addressLength(upstream)) >= 0;
+}
+
+bool DnsProxy::sendUpstreamTcp(Lookup& lookup) {
+    const std::size_t index = lookup.upstream % upstreams.size();
+    auto& slot = upstreamTcp[index];
+    if (!slot || !tcpConnections.contains(*slot)) {
+        const auto& upstream = upstreams[index];
+        TcpConnection connection;
+        connection.socket = ::socket(upstream.ss_family, SOCK_STREAM, 0);
+        if (connection.socket == socketUtil::invalidSocket || !prepareUpstreamSocket(connection.socket)) {
+            socketUtil::closeSocket(connection.socket);
+            return false;
+        }
+        const bool connected = ::connect(connection.socket, reinterpret_cast<const sockaddr*>(&upstream),
+                                         socketUtil::addressLength(upstream)) == 0;
+        if (!connected && !wouldBlock()) {
+            socketUtil::closeSocket(connection.socket);
+            return false;
+        }
+        connection.upstream = index;
+        connection.connecting = !connected;
+        connection.lastActive = Clock::now();
+        slot = nextConnection;
+        tcpConnections.emplace(nextConnection++, std::move(connection));
+    }
+    // Queries are pipelined on the one connection; answers come back matched by id
+    appendFramed(tcpConnections[*slot].out, lookup.query);
+    return true;
+}
+
+void DnsProxy::handleUpstreamReply(std::span<std::uint8_t> reply, std::optional<sockaddr_storage> from, std::size_t tcpUpstream) {
+    auto it = lookups.find(dnsMessage::messageId(reply));
+    if (it == lookups.end()) {
+        return;
+    }
+    Lookup& lookup = it->second;
+    // Only the resolver we asked, on the transport we asked it on, may answer
+    const std::size_t index = lookup.upstream % upstreams.size();
+    if (from ? (lookup.overTcp || !sameEndpoint(*from, upstreams[index])) : (!lookup.overTcp || tcpUpstream != index)) {
+        return;
+    }
+
+    if (from && dnsMessage::isTruncated(reply)) {
+        lookup.overTcp = true;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            ++counters.tcpFallbacks;
+        }
+        if (sendUpstream(lookup)) {
+            return;
+        }
+        // No TCP: pass the truncated answer on, clients know what to do with it
+    }
+
+    Lookup done = std::move(lookup);
+    releaseLookup(done);
+    lookups.erase(it);
+    lookupsByKey.erase(done.key);
+    finishLookup(std::move(done), reply);
+}
+
+void DnsProxy::finishLookup(Lookup lookup, std::span<std::uint8_t> reply) {
+    dnsMessage::Answers answers;
+    const bool matched = lookup.ruleTag != DomainMatcher::noMatch && addressSink &&
+                         dnsMessage::parseAnswers(reply, answers) && answers.count > 0;
+    if (!matched) {
+        storeInCache(lookup, reply);
+        for (const auto& waiter : lookup.waiters) {
+            deliver(waiter, reply);
+        }
+        return;
+    }
+
+    // Prefetches go through here too, which keeps the set entries of hot names alive.
+    // Not cached yet: a hit must never overtake the set update.
+    HeldReply heldReply;
+    heldReply.response.assign(reply.begin(), reply.end());
+    for (std::size_t i = 0; i < answers.count; ++i) {
+        const auto& address = answers.addresses[i];
+        SplitTunnel::ResolvedAddress resolved;
+        resolved.route = static_cast<SplitTunnel::DomainRoute>(lookup.ruleTag);
+        resolved.v6 = address.v6;
+        resolved.bytes = address.bytes;
+        resolved.timeout = std::max<std::chrono::seconds>(std::chrono::seconds(address.ttl), settings.minAddressTtl);
+        heldReply.addresses.push_back(resolved);
+    }
+    heldReply.lookup = std::move(lookup);
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.matched;
+    }
+    {
+        std::lock_guard<std::mutex> lock(heldMutex);
+        held.push_back(std::move(heldReply));
+    }
+    heldCv.notify_one();
+}
+
+void DnsProxy::storeInCache(const Lookup& lookup, std::span<const std::uint8_t> reply) {
+    const auto rcode = dnsMessage::responseCode(reply);
+    if (settings.cacheEntries == 0 || dnsMessage::isTruncated(reply) ||
+        (rcode != dnsMessage::rcodeNoError && rcode != dnsMessage::rcodeNxDomain)) {
+        return;
+    }
+    auto ttl = dnsMessage::cacheTtl(reply, static_cast<std::uint32_t>(settings.negativeTtl.count()));
+    if (!ttl || *ttl == 0) {
+        return;
+    }
+
+    auto it = cache.find(lookup.key);
+    std::size_t charge = 0;
+    if (settings.memoryBudget) {
+        // A refreshed entry is charged anew; older entries make room first
+        if (it != cache.end()) {
+            eraseCached(it);
+            it = cache.end();
+        }
+        charge = sizeof(CacheEntry) + 2 * lookup.key.size() + lookup.name.size() + reply.size();
+        while (!settings.memoryBudget->tryReserve(MemoryBudget::Subsystem::DnsCache, charge)) {
+            if (lru.empty()) {
+                return;
+            }
+            eraseCached(cache.find(lru.back()));
+        }
+    }
+    if (it == cache.end()) {
+        while (cache.size() >= settings.cacheEntries && !lru.empty()) {
+            eraseCached(cache.find(lru.back()));
+        }
+        lru.push_front(lookup.key);
+        it = cache.emplace(lookup.key, CacheEntry{}).first;
+        it->second.lruPosition = lru.begin();
+        it->second.name = lookup.name;
+        it->second.type = lookup.type;
+        it->second.qclass = lookup.qclass;
+    } else {
+        lru.splice(lru.begin(), lru, it->second.lruPosition);
+    }
+    CacheEntry& entry = it->second;
+    entry.charged = charge;
+    entry.response.assign(reply.begin(), reply.end());
+    entry.storedAt = Clock::now();
+    entry.ttl = std::min<std::uint32_t>(*ttl, static_cast<std::uint32_t>(settings.maxCacheTtl.count()));
+}
+
+void DnsProxy::eraseCached(std::unordered_map<std::string, CacheEntry>::iterator entry) {
+    if (settings.memoryBudget) {
+        settings.memoryBudget->release(MemoryBudget::Subsystem::DnsCache, entry->second.charged);
+    }
+    lru.erase(entry->second.lruPosition);
+    cache.erase(entry);
+}
+
+void DnsProxy::clearCached() {
+    if (settings.memoryBudget) {
+        for (const auto& [key, entry] : cache) {
+            settings.memoryBudget->release(MemoryBudget::Subsystem::DnsCache, entry.charged);
+        }
+    }
+    cache.clear();
+    lru.clear();
+}
+
+void DnsProxy::releaseLookup(const Lookup& lookup) {
+    if (settings.memoryBudget) {
+        settings.memoryBudget->release(MemoryBudget::Subsystem::DnsQueries, lookup.charged);
+    }
+}
+
+void DnsProxy::deliver(const Waiter& waiter, std::span<const std::uint8_t> response) {
+    std::vector<std::uint8_t> message(response.begin(), response.end());
+    dnsMessage::setMessageId(message, waiter.clientId);
+
+    // Echo the client's spelling of the name (0x20 randomisation) and its question
+    const std::size_t questionEnd = dnsMessage::headerSize + waiter.question.size();
+    dnsMessage::Question echoed;
+    if (dnsMessage::parseQuestion(message, echoed) && echoed.end == questionEnd) {
+        std::copy(waiter.question.begin(), waiter.question.end(), message.begin() + dnsMessage::headerSize);
+    }
+
+    if (!waiter.tcp && message.size() > waiter.udpLimit) {
+        // Too big for the client over UDP: header and question with TC set, it retries over TCP
+        message.resize(questionEnd);
+        message[2] |= 0x02;
+        std::fill(message.begin() + 6, message.begin() + dnsMessage::headerSize, std::uint8_t{0});
+    }
+
+    if (waiter.tcp) {
+        auto it = tcpConnections.find(waiter.connection);
+        if (it == tcpConnections.end()) {
+            return;
+        }
+        appendFramed(it->second.out, message);
+    } else {
+        ::sendto(listenSocket, reinterpret_cast<const char*>(message.data()), static_cast<int>(message.size()), 0,
+                 reinterpret_cast<const sockaddr*>(&waiter.client), socketUtil::addressLength(waiter.client));
+    }
+    recordLatency(Clock::now() - waiter.receivedAt);
+}
+
+void DnsProxy::deliverFailure(const Waiter& waiter) {
+    // SERVFAIL echoing the question, so clients fail fast instead of timing out
+    std::vector<std::uint8_t> message(dnsMessage::headerSize);
+    message[2] = 0x81;  // QR, RD
+    message[3] = 0x80 | dnsMessage::rcodeServFail;  // RA
+    message[5] = 1;
+    message.insert(message.end(), waiter.question.begin(), waiter.question.end());
+    deliver(waiter, message);
+}
+
+void DnsProxy::recordLatency(Clock::duration latency) {
+    const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    const auto sample = static_cast<std::uint32_t>(std::clamp<std::int64_t>(micros, 0, std::numeric_limits<std::uint32_t>::max()));
+    if (latencySamples.size() < latencyWindow) {
+        latencySamples.push_back(sample);
+    } else {
+        latencySamples[latencyNext] = sample;
+    }
+    latencyNext = (latencyNext + 1) % latencyWindow;
+}
+
+void DnsProxy::expireLookups() {
+    const auto now = Clock::now();
+    for (auto it = lookups.begin(); it != lookups.end();) {
+        Lookup& lookup = it->second;
+        if (now - lookup.sentAt < settings.queryTimeout) {
+            ++it;
+            continue;
+        }
+        if (lookup.attempts < upstreams.size()) {
+            ++lookup.upstream;
+            ++lookup.attempts;
+            lookup.overTcp = false;
+            {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                ++counters.failovers;
+            }
+            if (sendUpstream(lookup)) {
+                ++it;
+                continue;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            ++counters.timeouts;
+        }
+        for (const auto& waiter : lookup.waiters) {
+            deliverFailure(waiter);
+        }
+        lookupsByKey.erase(lookup.key);
+        releaseLookup(lookup);
+        it = lookups.erase(it);
+    }
+
+    for (auto it = tcpConnections.begin(); it != tcpConnections.end();) {
+        if (now - it->second.lastActive < tcpIdleTimeout) {
+            ++it;
+            continue;
+        }
+        if (!it->second.client && upstreamTcp[it->second.upstream] == it->first) {
+            upstreamTcp[it->second.upstream].reset();
+        }
+        socketUtil::closeSocket(it->second.socket);
+        it = tcpConnections.erase(it);
+    }
+}
+
+void DnsProxy::releaseHeld() {
+    std::deque<HeldReply> ready;
+    {
+        std::lock_guard<std::mutex> lock(heldMutex);
+        ready.swap(released);
+    }
+    for (const auto& reply : ready) {
+        storeInCache(reply.lookup, reply.response);
+        for (const auto& waiter : reply.lookup.waiters) {
+            deliver(waiter, reply.response);
+        }
+    }
+}
+
+void DnsProxy::publishLoop() {
+    std::vector<SplitTunnel::ResolvedAddress> batch;
+    while (true) {
+        std::deque<HeldReply> ready;
+        {
+            std::unique_lock<std::mutex> lock(heldMutex);
+            heldCv.wait(lock, [this]() { return !held.empty() || !running; });
+            if (held.empty()) {
+                return;
+            }
+            ready.swap(held);
+        }
+
+        // One set update for everything that queued up meanwhile
+        batch.clear();
+        for (const auto& reply : ready) {
+            batch.insert(batch.end(), reply.addresses.begin(), reply.addresses.end());
+        }
+        if (!addressSink(batch)) {
+            std::cerr << "[VPN] Failed to install split tunnel addresses\n";
+        }
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            ++counters.sinkBatches;
+        }
+
+        // Sockets belong to the event thread; hand the replies back to it
+        {
+            std::lock_guard<std::mutex> lock(heldMutex);
+            for (auto& reply : ready) {
+                released.push_back(std::move(reply));
+            }
+        }
+        const char wake = 0;
+        ::send(wakeSender, &wake, 1, 0);
+    }
+}
@@ -0,0 +1,208 @@
+#pragma once
+import std;
+#include "domainMatcher.h"
+#include "memoryBudget.h"
+#include "socketUtil.h"
+#include "splitTunnel.h"
+
+// Local caching DNS forwarder. Clients talk to it over UDP or TCP; it
+// answers from its cache or forwards to the upstream resolvers (the VPN's
+// pushed ones, reached through the tunnel). Many queries are pipelined on
+// one UDP socket and, after a truncated answer, on one TCP connection per
+// resolver; identical questions in flight share one upstream query. Hot
+// entries are refreshed shortly before they expire so they never miss.
+//
+// Hostname split tunneling hooks in here too: when the question matches a
+// rule, the A/AAAA answers are handed to the address sink (the split
+// tunnel's nft sets) before the reply is released, so the first connection
+// to a freshly resolved address is already routed by the rule. Set updates
+// are batched: one covers every answer that arrived while the previous one
+// was running.
+class DnsProxy {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Returns false if the addresses could not be installed; replies are released anyway
+    using AddressSink = std::function<bool(std::span<const SplitTunnel::ResolvedAddress>)>;
+
+    struct Settings {
+        std::string listenAddress = "127.0.0.1";
+        std::uint16_t listenPort = 0;                     // 0 picks a free port, see port()
+        std::vector<std::string> upstreams;               // resolver addresses; empty uses the system's
+        std::string upstreamInterface;                    // binds upstream sockets to this device (Linux)
+        std::chrono::milliseconds queryTimeout{2000};     // per upstream before failing over
+        std::size_t cacheEntries = 4096;
+        std::chrono::seconds maxCacheTtl{24 * 60 * 60};
+        std::chrono::seconds negativeTtl{60};             // cap for NXDOMAIN / no-data answers
+        double prefetchAt = 0.1;                          // refresh when this fraction of the TTL is left...
+        std::uint32_t prefetchMinHits = 2;                // ...for entries asked this often
+        std::chrono::seconds minAddressTtl{30};           // floor for split tunnel set entries
+        // Caps lookups in flight (DnsQueries; past it clients get SERVFAIL)
+        // and cached answers (DnsCache; past it the oldest are evicted)
+        std::shared_ptr<MemoryBudget> memoryBudget;
+    };
+
+    struct Stats {
+        std::uint64_t queries = 0;
+        std::uint64_t cacheHits = 0;
+        std::uint64_t cacheMisses = 0;
+        std::uint64_t coalesced = 0;      // misses that joined an identical query in flight
+        std::uint64_t prefetches = 0;
+        std::uint64_t tcpFallbacks = 0;   // truncated UDP answers retried over TCP
+        std::uint64_t failovers = 0;      // queries retried on another upstream
+        std::uint64_t timeouts = 0;       // queries no upstream answered
+        std::uint64_t shed = 0;           // refused for lack of memory budget
+        std::uint64_t matched = 0;        // answers that went through the address sink
+        std::uint64_t sinkBatches = 0;
+        std::chrono::microseconds medianLatency{0};  // over the most recent lookups
+
+        double hitRate() const;
+    };
+
+    DnsProxy();
+    explicit DnsProxy(Settings settings);
+    ~DnsProxy();
+
+    DnsProxy(const DnsProxy&) = delete;
+    DnsProxy& operator=(const DnsProxy&) = delete;
+
+    // Takes effect on the next start(); drops the cache
+    void configure(Settings settings);
+    const Settings& currentSettings() const;
+
+    // Rules may be swapped while running; tags are SplitTunnel::DomainRoute values
+    void setRules(std::shared_ptr<const DomainMatcher> rules);
+    void setAddressSink(AddressSink sink);
+    // Forgets cached answers, e.g. after the split tunnel sets were rebuilt
+    void clearCache();
+
+    // Fails if the upstream sockets cannot be marked (SO_MARK) or bound to
+    // upstreamInterface, which takes CAP_NET_ADMIN and an existing device
+    bool start();
+    void stop();
+    bool isRunning() const;
+    std::uint16_t port() const;
+
+    Stats stats() const;
+    std::string getLastError() const;
+
+private:
+    struct Waiter {
+        bool tcp = false;
+        sockaddr_storage client{};          // UDP clients
+        std::uint64_t connection = 0;       // TCP clients
+        std::uint16_t clientId = 0;
+        std::size_t udpLimit = 0;
+        std::vector<std::uint8_t> question; // the client's question as sent, case included
+        Clock::time_point receivedAt{};
+    };
+
+    struct Lookup {
+        std::string key;
+        std::string name;
+        std::uint16_t type = 0;
+        std::uint16_t qclass = 0;
+        std::uint32_t ruleTag = DomainMatcher::noMatch;
+        std::vector<Waiter> waiters;        // empty for prefetches
+        std::vector<std::uint8_t> query;    // kept for failover and TCP retry
+        std::size_t upstream = 0;
+        std::size_t attempts = 1;
+        bool overTcp = false;
+        Clock::time_point sentAt{};
+        std::size_t charged = 0;            // DnsQueries bytes reserved for it
+    };
+
+    struct CacheEntry {
+        std::vector<std::uint8_t> response;
+        std::string name;
+        std::uint16_t type = 0;
+        std::uint16_t qclass = 0;
+        Clock::time_point storedAt{};
+        std::uint32_t ttl = 0;
+        std::uint32_t hits = 0;
+        std::size_t charged = 0;            // DnsCache bytes reserved for it
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    struct TcpConnection {
+        socketUtil::SocketHandle socket = socketUtil::invalidSocket;
+        bool client = false;                // accepted client, else upstream
+        std::size_t upstream = 0;
+        bool connecting = false;
+        std::vector<std::uint8_t> in;
+        std::vector<std::uint8_t> out;
+        Clock::time_point lastActive{};
+    };
+
+    // A reply held for the address sink, then cached and released by the event thread
+    struct HeldReply {
+        Lookup lookup;
+        std::vector<std::uint8_t> response;
+        std::vector<SplitTunnel::ResolvedAddress> addresses;
+    };
+
+    static std::vector<sockaddr_storage> systemResolvers();
+    bool openSockets();
+    void closeSockets();
+    bool prepareUpstreamSocket(socketUtil::SocketHandle handle);
+    void eventLoop();
+    void publishLoop();
+
+    void handleQuery(std::span<const std::uint8_t> query, Waiter waiter);
+    void handleUpstreamReply(std::span<std::uint8_t> reply, std::optional<sockaddr_storage> from, std::size_t tcpUpstream);
+    void finishLookup(Lookup lookup, std::span<std::uint8_t> reply);
+    void startLookup(Lookup lookup);
+    bool sendUpstream(Lookup& lookup);
+    bool sendUpstreamTcp(Lookup& lookup);
+    void deliver(const Waiter& waiter, std::span<const std::uint8_t> response);
+    void deliverFailure(const Waiter& waiter);
+    void storeInCache(const Lookup& lookup, std::span<const std::uint8_t> reply);
+    void eraseCached(std::unordered_map<std::string, CacheEntry>::iterator entry);
+    void clearCached();
+    void releaseLookup(const Lookup& lookup);
+    void recordLatency(Clock::duration latency);
+    void expireLookups();
+    void serviceTcp(std::uint64_t id, short revents);
+    void releaseHeld();
+
+    Settings settings;
+    std::vector<sockaddr_storage> upstreams;
+    socketUtil::SocketHandle listenSocket = socketUtil::invalidSocket;
+    socketUtil::SocketHandle listenTcpSocket = socketUtil::invalidSocket;
+    socketUtil::SocketHandle upstreamSocket4 = socketUtil::invalidSocket;
+    socketUtil::SocketHandle upstreamSocket6 = socketUtil::invalidSocket;
+    bool upstreamUnpinned = false;  // an upstream socket could not get its mark or device
+    // The publish thread pokes the event loop through this loopback pair
+    socketUtil::SocketHandle wakeReceiver = socketUtil::invalidSocket;
+    socketUtil::SocketHandle wakeSender = socketUtil::invalidSocket;
+    std::uint16_t boundPort = 0;
+
+    std::shared_ptr<const DomainMatcher> rules;
+    mutable std::mutex rulesMutex;
+    AddressSink addressSink;
+
+    // Owned by the event thread
+    std::unordered_map<std::uint16_t, Lookup> lookups;
+    std::unordered_map<std::string, std::uint16_t> lookupsByKey;
+    std::uint16_t nextId = 0;
+    std::unordered_map<std::string, CacheEntry> cache;
+    std::list<std::string> lru;  // most recently used first
+    std::map<std::uint64_t, TcpConnection> tcpConnections;
+    std::vector<std::optional<std::uint64_t>> upstreamTcp;  // per upstream
+    std::uint64_t nextConnection = 1;
+    std::atomic<bool> cacheFlushRequested{false};
+
+    std::deque<HeldReply> held;      // waiting for the sink
+    std::deque<HeldReply> released;  // sink done, waiting for the event thread
+    std::mutex heldMutex;
+    std::condition_variable heldCv;
+
+    std::atomic<bool> running{false};
+    std::thread eventThread;
+    std::thread publishThread;
+
+    Stats counters;
+    std::vector<std::uint32_t> latencySamples;  // microseconds, ring buffer
+    std::size_t latencyNext = 0;
+    mutable std::mutex statsMutex;
+    std::string lastError;
+};
@@ -0,0 +1,170 @@
+import std;
+#include "domainMatcher.h"
+
+namespace {
+
+constexpr std::size_t maxLabelLength = 63;
+
+char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Orders stored (already lowercase) labels against query labels of any case
+int compareLabel(std::string_view stored, std::string_view query) {
+    const std::size_t common = std::min(stored.size(), query.size());
+    for (std::size_t i = 0; i < common; ++i) {
+        const auto a = static_cast<unsigned char>(stored[i]);
+        const auto b = static_cast<unsigned char>(lower(query[i]));
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    return stored.size() == query.size() ? 0 : (stored.size() < query.size() ? -1 : 1);
+}
+
+std::string_view withoutTrailingDot(std::string_view name) {
+    return !name.empty() && name.back() == '.' ? name.substr(0, name.size() - 1) : name;
+}
+
+} // namespace
+
+DomainMatcher::DomainMatcher()
+    : nodes(1) {
+}
+
+bool DomainMatcher::add(std::string_view pattern, std::uint32_t tag) {
+    if (tag == noMatch) {
+        return false;
+    }
+
+    bool matchSelf = true;
+    bool matchBelow = false;
+    if (pattern == "*") {
+        nodes[0].belowTag = tag;
+        ++patternCount;
+        return true;
+    }
+    if (pattern.starts_with("*.")) {
+        pattern.remove_prefix(2);
+        matchSelf = false;
+        matchBelow = true;
+    } else if (pattern.starts_with(".")) {
+        pattern.remove_prefix(1);
+        matchBelow = true;
+    }
+    pattern = withoutTrailingDot(pattern);
+    if (pattern.empty()) {
+        return false;
+    }
+
+    // Validate everything before touching the trie
+    for (std::size_t start = 0; start <= pattern.size();) {
+        const std::size_t dot = std::min(pattern.find('.', start), pattern.size());
+        const std::size_t length = dot - start;
+        if (length == 0 || length > maxLabelLength) {
+            return false;
+        }
+        start = dot + 1;
+    }
+
+    // Walk labels right to left, creating nodes as needed
+    std::uint32_t current = 0;
+    std::size_t end = pattern.size();
+    while (true) {
+        const std::size_t dot = pattern.rfind('.', end - 1);
+        const std::size_t start = dot == std::string_view::npos ? 0 : dot + 1;
+        const std::string_view label = pattern.substr(start, end - start);
+
+        auto& edges = nodes[current].edges;
+        auto it = std::lower_bound(edges.begin(), edges.end(), label, [this](const Edge& edge, std::string_view query) {
+            return compareLabel(labelOf(edge), query) < 0;
+        });
+        if (it != edges.end() && compareLabel(labelOf(*it), label) == 0) {
+            current = it->child;
+        } else {
+            Edge edge;
+            edge.labelOffset = static_cast<std::uint32_t>(labelPool.size());
+            edge.labelLength = static_cast<std::uint32_t>(label.size());
+            edge.child = static_cast<std::uint32_t>(nodes.size());
+            for (char c : label) {
+                labelPool.push_back(lower(c));
+            }
+            nodes[current].edges.insert(it, edge);
+            current = edge.child;
+            nodes.emplace_back();  // may reallocate: edges is not used past this point
+        }
+
+        if (start == 0) {
+            break;
+        }
+        end = start - 1;
+    }
+
+    if (matchSelf) {
+        nodes[current].exactTag = tag;
+    }
+    if (matchBelow) {
+        nodes[current].belowTag = tag;
+    }
+    ++patternCount;
+    return true;
+}
+
+void DomainMatcher::clear() {
+    nodes.assign(1, Node{});
+    labelPool.clear();
+    patternCount = 0;
+}
+
+std::size_t DomainMatcher::size() const {
+    return patternCount;
+}
+
+bool DomainMatcher::empty() const {
+    return patternCount == 0;
+}
+
+std::uint32_t DomainMatcher::match(std::string_view name) const {
+    name = withoutTrailingDot(name);
+    if (name.empty()) {
+        return noMatch;
+    }
+
+    std::uint32_t best = nodes[0].belowTag;
+    const Node* node = &nodes[0];
+    std::size_t end = name.size();
+    while (true) {
+        const std::size_t dot = name.rfind('.', end - 1);
+        const std::size_t start = dot == std::string_view::npos ? 0 : dot + 1;
+        const Edge* edge = findEdge(*node, name.substr(start, end - start));
+        if (!edge) {
+            return best;
+        }
+        node = &nodes[edge->child];
+
+        if (start == 0) {
+            return node->exactTag != noMatch ? node->exactTag : best;
+        }
+        if (node->belowTag != noMatch) {
+            best = node->belowTag;
+        }
+        end = start - 1;
+        if (end == 0) {
+            return best;  // leading dot: malformed, keep what matched so far
+        }
+    }
+}
+
+std::string_view DomainMatcher::labelOf(const Edge& edge) const {
+    return std::string_view(labelPool).substr(edge.labelOffset, edge.labelLength);
+}
+
+const DomainMatcher::Edge* DomainMatcher::findEdge(const Node& node, std::string_view label) const {
+    auto it = std::lower_bound(node.edges.begin(), node.edges.end(), label, [this](const Edge& edge, std::string_view query) {
+        return compareLabel(labelOf(edge), query) < 0;
+    });
+    if (it == node.edges.end() || compareLabel(labelOf(*it), label) != 0) {
+        return nullptr;
+    }
+    return &*it;
+}
@@ -0,0 +1,47 @@
+#pragma once
+import std;
+
+// Matches DNS names against hostname patterns:
+//   "corp.example"    the name itself
+//   "*.corp.example"  names below it, not the name itself
+//   ".corp.example"   both
+//   "*"               every name
+// Patterns compile into a trie of labels walked from the TLD down, so a
+// lookup costs one binary search per label of the queried name, whatever the
+// number of patterns, and never allocates. The most specific pattern wins.
+class DomainMatcher {
+public:
+    static constexpr std::uint32_t noMatch = std::numeric_limits<std::uint32_t>::max();
+
+    DomainMatcher();
+
+    // False for malformed patterns (empty labels, labels over 63 bytes, ...)
+    bool add(std::string_view pattern, std::uint32_t tag);
+    void clear();
+    std::size_t size() const;
+    bool empty() const;
+
+    // Tag of the best matching pattern, or noMatch. Case-insensitive; a
+    // trailing dot (fully qualified form) is ignored.
+    std::uint32_t match(std::string_view name) const;
+
+private:
+    struct Edge {
+        std::uint32_t labelOffset = 0;  // lowercase label in labelPool
+        std::uint32_t labelLength = 0;
+        std::uint32_t child = 0;
+    };
+
+    struct Node {
+        std::vector<Edge> edges;              // sorted by label
+        std::uint32_t exactTag = noMatch;     // pattern ends here
+        std::uint32_t belowTag = noMatch;     // pattern covers names under here
+    };
+
+    std::string_view labelOf(const Edge& edge) const;
+    const Edge* findEdge(const Node& node, std::string_view label) const;
+
+    std::vector<Node> nodes;  // nodes[0] is the root
+    std::string labelPool;
+    std::size_t patternCount = 0;
+};
@@ -0,0 +1,149 @@
+import std;
+#include "fileSync.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fileSync {
+
+namespace {
+
+std::string systemErrorText() {
+    #ifdef _WIN32
+    return std::system_category().message(static_cast<int>(GetLastError()));
+    #else
+    return std::generic_category().message(errno);
+    #endif
+}
+
+} // namespace
+
+bool writeFile(const std::filesystem::path& path, std::string_view content, bool sync, std::string& error) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "Cannot create " + path.string() + ": " + systemErrorText();
+        return false;
+    }
+    bool ok = true;
+    while (ok && !content.empty()) {
+        DWORD written = 0;
+        const auto chunk = static_cast<DWORD>(std::min<std::size_t>(content.size(), 1 << 30));
+        ok = WriteFile(file, content.data(), chunk, &written, nullptr) != 0;
+        content.remove_prefix(written);
+    }
+    if (ok && sync) {
+        ok = FlushFileBuffers(file) != 0;
+    }
+    if (!ok) {
+        error = "Cannot write " + path.string() + ": " + systemErrorText();
+    }
+    CloseHandle(file);
+    return ok;
+    #else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error = "Cannot create " + path.string() + ": " + systemErrorText();
+        return false;
+    }
+    bool ok = true;
+    while (ok && !content.empty()) {
+        ssize_t written = ::write(fd, content.data(), content.size());
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = written > 0;
+        if (ok) {
+            content.remove_prefix(static_cast<std::size_t>(written));
+        }
+    }
+    if (ok && sync) {
+        ok = ::fsync(fd) == 0;
+    }
+    if (!ok) {
+        error = "Cannot write " + path.string() + ": " + systemErrorText();
+    }
+    if (::close(fd) != 0 && ok) {
+        error = "Cannot close " + path.string() + ": " + systemErrorText();
+        ok = false;
+    }
+    return ok;
+    #endif
+}
+
+bool syncFile(const std::filesystem::path& path) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return ok;
+    #else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+    #endif
+}
+
+bool syncDirectory(const std::filesystem::path& directory) {
+    #ifdef _WIN32
+    // NTFS journals renames itself; directories cannot be flushed like files
+    (void)directory;
+    return true;
+    #else
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+    #endif
+}
+
+bool syncFilesystem(const std::filesystem::path& directory) {
+    #if defined(__linux__)
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::syncfs(fd) == 0;
+    ::close(fd);
+    return ok;
+    #else
+    (void)directory;
+    return false;
+    #endif
+}
+
+bool replaceFile(const std::filesystem::path& source, const std::filesystem::path& target, std::string& error) {
+    #ifdef _WIN32
+    if (!MoveFileExW(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        error = "Cannot replace " + target.string() + ": " + systemErrorText();
+        return false;
+    }
+    #else
+    if (::rename(source.c_str(), target.c_str()) != 0) {
+        error = "Cannot replace " + target.string() + ": " + systemErrorText();
+        return false;
+    }
+    #endif
+    return true;
+}
+
+} // namespace fileSync
@@ -0,0 +1,23 @@
+#pragma once
+import std;
+
+// Durability helpers for writing files that must survive a crash
+namespace fileSync {
+
+// Writes content to path and closes it; optionally flushes it to stable storage
+bool writeFile(const std::filesystem::path& path, std::string_view content, bool sync, std::string& error);
+
+// Flushes a file's data to stable storage
+bool syncFile(const std::filesystem::path& path);
+
+// Makes renames and unlinks in a directory durable (no-op where unsupported)
+bool syncDirectory(const std::filesystem::path& directory);
+
+// One flush for every dirty file on the filesystem holding directory.
+// Returns false where the platform has no such call; fall back to syncFile.
+bool syncFilesystem(const std::filesystem::path& directory);
+
+// Atomically replaces target with source (same directory)
+bool replaceFile(const std::filesystem::path& source, const std::filesystem::path& target, std::string& error);
+
+} // namespace fileSync
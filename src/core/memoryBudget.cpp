@@ -0,0 +1,102 @@
+import std;
+#include "memoryBudget.h"
+
+namespace {
+
+// Share of the total per subsystem, in percent. Send buffers get the most:
+// running short there costs a copy per packet, elsewhere only cache misses
+// or older log lines.
+constexpr std::array<std::size_t, MemoryBudget::subsystemCount> sharePercent = {
+    40,  // PacketPool
+    20,  // ReceiveBuffers
+    5,   // DnsQueries
+    15,  // DnsCache
+    10,  // Log
+    10   // ProfileCache
+};
+
+constexpr std::array<std::string_view, MemoryBudget::subsystemCount> subsystemNames = {
+    "packet pool", "receive buffers", "DNS queries", "DNS cache", "log", "profile cache"
+};
+
+} // namespace
+
+MemoryBudget::MemoryBudget(std::size_t totalBytes) {
+    setTotal(totalBytes);
+}
+
+void MemoryBudget::setTotal(std::size_t totalBytes) {
+    this->totalBytes = totalBytes;
+    for (std::size_t i = 0; i < subsystemCount; ++i) {
+        accounts[i].limit = totalBytes == 0 ? unbounded() : totalBytes / 100 * sharePercent[i];
+    }
+}
+
+std::size_t MemoryBudget::total() const {
+    return totalBytes;
+}
+
+std::size_t MemoryBudget::limit(Subsystem subsystem) const {
+    return account(subsystem).limit;
+}
+
+bool MemoryBudget::tryReserve(Subsystem subsystem, std::size_t bytes) {
+    Account& entry = account(subsystem);
+    const std::size_t cap = entry.limit;
+    std::size_t current = entry.used.load(std::memory_order_relaxed);
+    do {
+        if (bytes > cap || current > cap - bytes) {
+            entry.refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!entry.used.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+    return true;
+}
+
+std::size_t MemoryBudget::reserveUpTo(Subsystem subsystem, std::size_t wanted, std::size_t unitBytes,
+                                      std::size_t minimum) {
+    Account& entry = account(subsystem);
+    minimum = std::min(minimum, wanted);
+    const std::size_t cap = entry.limit;
+    std::size_t current = entry.used.load(std::memory_order_relaxed);
+    std::size_t granted = 0;
+    do {
+        const std::size_t room = current < cap ? cap - current : 0;
+        granted = std::max(minimum, std::min(wanted, unitBytes == 0 ? wanted : room / unitBytes));
+    } while (!entry.used.compare_exchange_weak(current, current + granted * unitBytes, std::memory_order_relaxed));
+    if (granted < wanted) {
+        entry.refused.fetch_add(1, std::memory_order_relaxed);
+    }
+    return granted;
+}
+
+void MemoryBudget::release(Subsystem subsystem, std::size_t bytes) {
+    account(subsystem).used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+std::size_t MemoryBudget::used(Subsystem subsystem) const {
+    return account(subsystem).used.load(std::memory_order_relaxed);
+}
+
+std::vector<MemoryBudget::Usage> MemoryBudget::usage() const {
+    std::vector<Usage> result;
+    result.reserve(subsystemCount);
+    for (std::size_t i = 0; i < subsystemCount; ++i) {
+        const auto subsystem = static_cast<Subsystem>(i);
+        result.push_back({subsystem, name(subsystem), accounts[i].used.load(std::memory_order_relaxed),
+                          accounts[i].limit.load(), accounts[i].refused.load(std::memory_order_relaxed)});
+    }
+    return result;
+}
+
+std::string_view MemoryBudget::name(Subsystem subsystem) {
+    return subsystemNames[static_cast<std::size_t>(subsystem)];
+}
+
+MemoryBudget::Account& MemoryBudget::account(Subsystem subsystem) {
+    return accounts[static_cast<std::size_t>(subsystem)];
+}
+
+const MemoryBudget::Account& MemoryBudget::account(Subsystem subsystem) const {
+    return accounts[static_cast<std::size_t>(subsystem)];
+}
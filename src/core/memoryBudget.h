@@ -0,0 +1,65 @@
+#pragma once
+import std;
+
+// One memory budget for the client's buffers, queues, log and caches, meant
+// for low-RAM and mobile builds. The total is split into a cap per
+// subsystem; a subsystem reserves before it allocates and, when a
+// reservation is refused, makes do with less (smaller receive batches,
+// copying sends, fewer cached answers, older log lines dropped) instead of
+// growing. Usage is accounted without a total as well. Thread-safe.
+class MemoryBudget {
+public:
+    enum class Subsystem : std::uint8_t {
+        PacketPool,      // data channel send buffers
+        ReceiveBuffers,  // transport receive batches
+        DnsQueries,      // DNS lookups waiting for an upstream answer
+        DnsCache,
+        Log,             // recent log lines kept for the UI
+        ProfileCache     // profile blocks kept loaded between uses
+    };
+    static constexpr std::size_t subsystemCount = 6;
+
+    struct Usage {
+        Subsystem subsystem = Subsystem::PacketPool;
+        std::string_view name;
+        std::size_t used = 0;
+        std::size_t limit = 0;      // unbounded() without a total
+        std::uint64_t refused = 0;  // reservations turned down
+    };
+
+    static constexpr std::size_t unbounded() { return std::numeric_limits<std::size_t>::max(); }
+
+    // 0 leaves every subsystem unbounded
+    explicit MemoryBudget(std::size_t totalBytes = 0);
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // Re-splits the caps; memory held above a lowered cap stays until released
+    void setTotal(std::size_t totalBytes);
+    std::size_t total() const;
+    std::size_t limit(Subsystem subsystem) const;
+
+    bool tryReserve(Subsystem subsystem, std::size_t bytes);
+    // As many units as fit, up to wanted; the first minimum are granted even over the cap
+    std::size_t reserveUpTo(Subsystem subsystem, std::size_t wanted, std::size_t unitBytes, std::size_t minimum = 1);
+    void release(Subsystem subsystem, std::size_t bytes);
+
+    std::size_t used(Subsystem subsystem) const;
+    std::vector<Usage> usage() const;
+
+    static std::string_view name(Subsystem subsystem);
+
+private:
+    struct Account {
+        std::atomic<std::size_t> used{0};
+        std::atomic<std::size_t> limit{unbounded()};
+        std::atomic<std::uint64_t> refused{0};
+    };
+
+    Account& account(Subsystem subsystem);
+    const Account& account(Subsystem subsystem) const;
+
+    std::atomic<std::size_t> totalBytes{0};
+    std::array<Account, subsystemCount> accounts;
+};
@@ -0,0 +1,533 @@
+import std;
+#include "multipathBond.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <net/if.h>
+#endif
+
+namespace {
+
+using Clock = MultipathBond::Clock;
+
+constexpr std::size_t maxPacketSize = 65535;
+constexpr std::uint8_t opcodeShift = 3;
+constexpr std::uint8_t keyIdMask = 0x07;
+constexpr std::uint8_t dataV1 = 6;
+constexpr std::uint8_t dataV2 = 9;
+// Reordering is bounded by the RTT spread; this much again covers jitter
+constexpr std::chrono::milliseconds reorderMargin{5};
+// Unanswered for four RTTs, a probe is missed, but not sooner than this
+constexpr std::chrono::milliseconds minProbeTimeout{250};
+// A packet id this far ahead is a jump (the server restarted its counter), not a gap
+constexpr std::uint32_t maxGap = 4096;
+
+// Send errors that mean the interface or its route is gone rather than a lost packet
+bool pathLost() {
+    #ifdef _WIN32
+    const int error = WSAGetLastError();
+    return error == WSAENETUNREACH || error == WSAEHOSTUNREACH || error == WSAEADDRNOTAVAIL || error == WSAENETDOWN;
+    #else
+    return errno == ENETUNREACH || errno == EHOSTUNREACH || errno == EADDRNOTAVAIL || errno == ENETDOWN ||
+           errno == ENODEV || errno == ENXIO;
+    #endif
+}
+
+// Key id and packet id of a data channel packet; the AEAD packet id is in clear
+std::optional<std::pair<std::uint8_t, std::uint32_t>> dataPacketId(std::span<const std::uint8_t> packet) {
+    if (packet.empty()) {
+        return std::nullopt;
+    }
+    const std::uint8_t opcode = packet[0] >> opcodeShift;
+    const std::size_t offset = opcode == dataV2 ? 4 : opcode == dataV1 ? 1 : 0;
+    if (offset == 0 || packet.size() < offset + 4) {
+        return std::nullopt;
+    }
+    std::uint32_t id = 0;
+    for (std::size_t i = offset; i < offset + 4; ++i) {
+        id = (id << 8) | packet[i];
+    }
+    return std::pair(static_cast<std::uint8_t>(packet[0] & keyIdMask), id);
+}
+
+// A datagram socket that only leaves through interface
+socketUtil::SocketHandle openBound(const std::string& interface, const sockaddr_storage& server, std::string& error) {
+    const auto handle = ::socket(server.ss_family, SOCK_DGRAM, 0);
+    if (handle == socketUtil::invalidSocket) {
+        error = "Cannot create socket: " + socketUtil::lastErrorText();
+        return handle;
+    }
+    #if defined(__linux__)
+    // Unprivileged since Linux 5.7 for a socket not bound to a device yet
+    const bool bound = ::setsockopt(handle, SOL_SOCKET, SO_BINDTODEVICE, interface.c_str(),
+                                    static_cast<socklen_t>(interface.size())) == 0;
+    #elif defined(__APPLE__)
+    const unsigned int index = ::if_nametoindex(interface.c_str());
+    const bool bound = index != 0 &&
+                       (server.ss_family == AF_INET6
+                            ? ::setsockopt(handle, IPPROTO_IPV6, IPV6_BOUND_IF, &index, sizeof(index))
+                            : ::setsockopt(handle, IPPROTO_IP, IP_BOUND_IF, &index, sizeof(index))) == 0;
+    #else
+    const bool bound = false;
+    errno = ENOTSUP;
+    #endif
+    if (!bound) {
+        error = "Cannot bind to " + interface + ": " + socketUtil::lastErrorText();
+        socketUtil::closeSocket(handle);
+        return socketUtil::invalidSocket;
+    }
+    if (!socketUtil::setNonBlocking(handle) ||
+        ::connect(handle, reinterpret_cast<const sockaddr*>(&server), socketUtil::addressLength(server)) != 0) {
+        error = interface + ": " + socketUtil::lastErrorText();
+        socketUtil::closeSocket(handle);
+        return socketUtil::invalidSocket;
+    }
+    return handle;
+}
+
+} // namespace
+
+std::optional<MultipathBond::Uplink> MultipathBond::parseUplink(std::string_view text) {
+    Uplink uplink;
+    const auto separator = text.find('=');
+    uplink.interface = std::string(text.substr(0, separator));
+    if (uplink.interface.empty() || uplink.interface.find_first_of(" \t/") != std::string::npos) {
+        return std::nullopt;
+    }
+    if (separator != std::string_view::npos) {
+        const auto capacity = text.substr(separator + 1);
+        const auto [end, error] = std::from_chars(capacity.data(), capacity.data() + capacity.size(), uplink.capacityMbps);
+        if (error != std::errc{} || end != capacity.data() + capacity.size() || capacity.empty()) {
+            return std::nullopt;
+        }
+    }
+    return uplink;
+}
+
+std::optional<MultipathBond::Scheduler> MultipathBond::schedulerFromString(std::string_view name) {
+    if (name == "min-rtt") {
+        return Scheduler::MinRtt;
+    }
+    if (name == "weighted") {
+        return Scheduler::Weighted;
+    }
+    return std::nullopt;
+}
+
+MultipathBond::~MultipathBond() {
+    close();
+}
+
+bool MultipathBond::open(const sockaddr_storage& server, const Settings& settings, TransportChain layers,
+                         std::optional<ControlWrap::Key> wrapKey) {
+    close();
+    this->settings = settings;
+    this->layers = std::move(layers);
+    this->wrapKey = std::move(wrapKey);
+
+    std::string failures;
+    const auto now = Clock::now();
+    for (const auto& uplink : settings.uplinks) {
+        Path path;
+        path.stats.interface = uplink.interface;
+        path.capacityMbps = uplink.capacityMbps;
+        std::string error;
+        path.socket = openBound(uplink.interface, server, error);
+        if (path.socket != socketUtil::invalidSocket) {
+            path.probeSocket = openBound(uplink.interface, server, error);
+        }
+        if (path.probeSocket == socketUtil::invalidSocket) {
+            socketUtil::closeSocket(path.socket);
+            failures += (failures.empty() ? "" : "; ") + error;
+            continue;
+        }
+        // Up until the probes say otherwise, so traffic need not wait for them
+        path.stats.up = true;
+        path.lastUp = now;
+        path.backlogAt = now;
+        paths.push_back(std::move(path));
+    }
+    if (paths.empty()) {
+        lastError = "No usable uplink: " + (failures.empty() ? std::string("none configured") : failures);
+        return false;
+    }
+    lastError = failures;
+    for (auto& path : paths) {
+        sendProbe(path, now);
+    }
+    return true;
+}
+
+void MultipathBond::close() {
+    for (auto& path : paths) {
+        socketUtil::closeSocket(path.socket);
+        socketUtil::closeSocket(path.probeSocket);
+    }
+    paths.clear();
+    dataPath = 0;
+    reorderKey.reset();
+    held.clear();
+    ready.clear();
+}
+
+bool MultipathBond::isOpen() const {
+    return !paths.empty();
+}
+
+bool MultipathBond::send(std::span<const std::uint8_t> wire, bool control) {
+    if (paths.empty()) {
+        lastError = "Multipath transport is not open";
+        return false;
+    }
+    const auto now = Clock::now();
+    std::size_t index = control ? dataPath : choosePath(wire.size(), now);
+    if (!paths[index].stats.up) {
+        index = choosePath(wire.size(), now);
+    }
+
+    // On a failed path, the others in turn
+    for (std::size_t attempt = 0; attempt < paths.size(); ++attempt) {
+        auto& path = paths[(index + attempt) % paths.size()];
+        if (attempt > 0 && !path.stats.up) {
+            continue;
+        }
+        if (sendOn(path, wire, now)) {
+            dataPath = (index + attempt) % paths.size();
+            return true;
+        }
+    }
+    return false;
+}
+
+std::size_t MultipathBond::choosePath(std::size_t bytes, Clock::time_point now) {
+    std::vector<std::size_t> up;
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        if (paths[i].stats.up) {
+            up.push_back(i);
+        }
+    }
+    if (up.empty()) {
+        // Nothing answers; the path that did most recently is the best guess
+        return static_cast<std::size_t>(std::ranges::max_element(paths, {}, &Path::lastUp) - paths.begin());
+    }
+
+    if (settings.scheduler == Scheduler::Weighted) {
+        // Smooth weighted round-robin: each path's share in proportion to its capacity, interleaved
+        std::int64_t total = 0;
+        for (const auto i : up) {
+            const std::int64_t weight = std::max<std::uint32_t>(paths[i].capacityMbps, 1);
+            paths[i].currentWeight += weight;
+            total += weight;
+        }
+        const auto best = *std::ranges::max_element(up, {}, [this](std::size_t i) { return paths[i].currentWeight; });
+        paths[best].currentWeight -= total;
+        return best;
+    }
+
+    // MinRtt: earliest arrival, counting what is still queued on paths of known capacity
+    const bool capacities = std::ranges::all_of(up, [this](std::size_t i) { return paths[i].capacityMbps > 0; });
+    std::size_t best = up.front();
+    double bestArrival = std::numeric_limits<double>::max();
+    for (const auto i : up) {
+        auto& path = paths[i];
+        const double rtt = path.stats.rtt.count() > 0 ? static_cast<double>(path.stats.rtt.count())
+                                                      : std::chrono::microseconds(settings.probeInterval).count();
+        double arrival = rtt / 2;
+        if (capacities) {
+            const double bitsPerMicrosecond = path.capacityMbps;
+            const double drained = std::chrono::duration<double, std::micro>(now - path.backlogAt).count() * bitsPerMicrosecond;
+            path.backlogBits = std::max(0.0, path.backlogBits - drained);
+            path.backlogAt = now;
+            arrival += (path.backlogBits + static_cast<double>(bytes) * 8) / bitsPerMicrosecond;
+        }
+        if (arrival < bestArrival) {
+            bestArrival = arrival;
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool MultipathBond::sendOn(Path& path, std::span<const std::uint8_t> wire, Clock::time_point now) {
+    const auto sent = ::send(path.socket, reinterpret_cast<const char*>(wire.data()), static_cast<int>(wire.size()), 0);
+    if (sent == static_cast<int>(wire.size())) {
+        ++path.stats.packetsSent;
+        path.stats.bytesSent += wire.size();
+        if (!path.unansweredSince) {
+            path.unansweredSince = now;
+        }
+        path.backlogBits += static_cast<double>(wire.size()) * 8;
+        return true;
+    }
+    ++path.stats.sendErrors;
+    const bool lost = pathLost();
+    path.stats.lastError = socketUtil::lastErrorText();
+    lastError = "Send on " + path.stats.interface + " failed: " + path.stats.lastError;
+    if (lost) {
+        markDown(path, now);
+    }
+    return false;
+}
+
+void MultipathBond::markDown(Path& path, Clock::time_point now) {
+    if (path.stats.up) {
+        path.stats.up = false;
+        ++path.stats.timesDown;
+        path.currentWeight = 0;
+    }
+    // Asked again right away: a route that went away may already be back
+    path.nextProbeAt = now;
+}
+
+void MultipathBond::sendProbe(Path& path, Clock::time_point now) {
+    const auto handle = path.probeSocket;
+    path.probe = std::make_unique<ControlChannel>([handle, this](std::span<const std::uint8_t> packet) {
+        const auto wire = layers.wrap(packet);
+        return ::send(handle, reinterpret_cast<const char*>(wire.data()), static_cast<int>(wire.size()), 0) ==
+               static_cast<int>(wire.size());
+    });
+    if (wrapKey) {
+        path.probe->setWrap(std::make_unique<ControlWrap>(*wrapKey));
+    }
+    // One reset, never retransmitted: an unanswered probe counts as missed
+    path.probe->startHardReset();
+    path.probeSentAt = now;
+    path.nextProbeAt = now + settings.probeInterval;
+    ++path.stats.probesSent;
+}
+
+Clock::duration MultipathBond::probeTimeout(const Path& path) const {
+    if (path.stats.rtt.count() == 0) {
+        return settings.probeInterval;
+    }
+    return std::clamp<Clock::duration>(path.stats.rtt * 4, minProbeTimeout, settings.probeInterval);
+}
+
+bool MultipathBond::silentSince(const Path& path) const {
+    return path.stats.up && path.unansweredSince && !path.probe && path.probeSentAt < *path.unansweredSince;
+}
+
+void MultipathBond::serviceProbes(Clock::time_point now) {
+    for (auto& path : paths) {
+        // Sent on and silent since, without a probe in between: one now rather than at the interval
+        if (silentSince(path) && now - *path.unansweredSince >= probeTimeout(path)) {
+            path.nextProbeAt = now;
+        }
+        if (path.probe && now - path.probeSentAt >= probeTimeout(path)) {
+            path.probe.reset();
+            if (++path.missedProbes >= settings.probesUntilDown && path.stats.up) {
+                markDown(path, now);
+            } else if (path.stats.up) {
+                path.nextProbeAt = now;  // in doubt: ask again without waiting out the interval
+            }
+        }
+        if (now >= path.nextProbeAt) {
+            sendProbe(path, now);
+        }
+    }
+}
+
+void MultipathBond::readPaths(Clock::time_point now) {
+    std::vector<std::uint8_t> buffer(maxPacketSize);
+    for (auto& path : paths) {
+        // The server's reset to a probe
+        while (true) {
+            const auto length = ::recv(path.probeSocket, reinterpret_cast<char*>(buffer.data()), static_cast<int>(buffer.size()), 0);
+            if (length < 0) {
+                break;
+            }
+            const auto inner = layers.unwrap(std::span(buffer.data(), static_cast<std::size_t>(length)));
+            if (!inner || !path.probe || !path.probe->processIncoming(*inner) || !path.probe->isEstablished()) {
+                continue;  // a reply to an earlier probe, or not one at all
+            }
+            path.probe->service(now);  // acknowledges the reset so the server stops resending it
+            const auto sample = std::chrono::duration_cast<std::chrono::microseconds>(now - path.probeSentAt);
+            path.stats.rtt = path.stats.rtt.count() == 0 ? sample : (path.stats.rtt * 7 + sample) / 8;
+            ++path.stats.probesAnswered;
+            path.probe.reset();
+            path.missedProbes = 0;
+            path.stats.up = true;
+            path.lastUp = now;
+        }
+
+        while (true) {
+            const auto length = ::recv(path.socket, reinterpret_cast<char*>(buffer.data()), static_cast<int>(buffer.size()), 0);
+            if (length < 0) {
+                break;
+            }
+            ++path.stats.packetsReceived;
+            path.stats.bytesReceived += static_cast<std::size_t>(length);
+            // Keeps an up path from looking silent; a down one waits for a probe
+            // answer, as this may have been queued before it went down
+            if (path.stats.up) {
+                path.lastUp = now;
+            }
+            path.lastReceived = now;
+            path.missedProbes = 0;
+            path.unansweredSince.reset();
+            const auto inner = layers.unwrap(std::span(buffer.data(), static_cast<std::size_t>(length)));
+            if (inner) {
+                reorder({inner->begin(), inner->end()}, path, now);
+            }
+        }
+    }
+}
+
+void MultipathBond::reorder(std::vector<std::uint8_t> packet, Path& from, Clock::time_point now) {
+    const auto id = dataPacketId(packet);
+    if (!id) {
+        ready.push_back(std::move(packet));  // control packets keep their own order
+        return;
+    }
+    const auto [key, packetId] = *id;
+    if (reorderKey != key) {
+        // A new key starts its own packet ids
+        releaseHeld(now, true);
+        reorderKey = key;
+        expectedId = packetId;
+        for (auto& path : paths) {
+            path.highestId.reset();
+        }
+    }
+    if (!from.highestId || static_cast<std::int32_t>(packetId - *from.highestId) > 0) {
+        from.highestId = packetId;
+    }
+
+    const std::uint32_t ahead = packetId - expectedId;
+    if (static_cast<std::int32_t>(ahead) < 0) {
+        ++reorderCounters.late;
+        ready.push_back(std::move(packet));  // the replay window decides
+        return;
+    }
+    if (ahead >= maxGap) {
+        releaseHeld(now, true);
+        expectedId = packetId;
+    }
+    if (packetId != expectedId) {
+        ++reorderCounters.held;
+        held.try_emplace(packetId, std::move(packet), now);
+        if (held.size() > settings.reorderLimit) {
+            releaseHeld(now, false);
+        }
+        return;
+    }
+    ready.push_back(std::move(packet));
+    ++expectedId;
+    releaseHeld(now, false);
+}
+
+void MultipathBond::releaseHeld(Clock::time_point now, bool all) {
+    while (!held.empty()) {
+        auto first = held.begin();
+        if (first->first != expectedId) {
+            // Skip the gap if everything must go, the buffer is full or the oldest has waited long enough
+            const auto oldest = std::ranges::min_element(held, {}, [](const auto& entry) { return entry.second.second; });
+            const bool expired = now - oldest->second.second >= reorderDelay(now);
+            if (!all && !expired && held.size() <= settings.reorderLimit) {
+                return;
+            }
+            reorderCounters.skipped += first->first - expectedId;
+            expectedId = first->first;
+        }
+        ready.push_back(std::move(first->second.first));
+        held.erase(first);
+        ++expectedId;
+    }
+}
+
+std::chrono::microseconds MultipathBond::reorderDelay(Clock::time_point now) const {
+    // Each path delivers mostly in order, so once every path the server sends
+    // on has delivered past the gap, the packet is lost and only jitter is
+    // waited for. Otherwise it may still be on a slower path: packets sent
+    // together arrive at most the RTT spread apart.
+    bool passed = true;
+    std::chrono::microseconds fastest = std::chrono::microseconds::max();
+    std::chrono::microseconds slowest{0};
+    for (const auto& path : paths) {
+        if (now - path.lastReceived > settings.probeInterval) {
+            continue;
+        }
+        passed = passed && path.highestId && static_cast<std::int32_t>(*path.highestId - expectedId) > 0;
+        if (path.stats.rtt.count() > 0) {
+            fastest = std::min(fastest, path.stats.rtt);
+            slowest = std::max(slowest, path.stats.rtt);
+        }
+    }
+    if (passed) {
+        return reorderMargin;
+    }
+    const auto spread = slowest > fastest ? slowest - fastest : std::chrono::microseconds(0);
+    return std::min<std::chrono::microseconds>(spread + reorderMargin, settings.maxReorderDelay);
+}
+
+Clock::time_point MultipathBond::nextWakeup(Clock::time_point now) const {
+    auto wakeup = Clock::time_point::max();
+    for (const auto& path : paths) {
+        wakeup = std::min(wakeup, path.nextProbeAt);
+        if (path.probe) {
+            wakeup = std::min(wakeup, path.probeSentAt + probeTimeout(path));
+        } else if (silentSince(path)) {
+            wakeup = std::min(wakeup, *path.unansweredSince + probeTimeout(path));
+        }
+    }
+    if (!held.empty()) {
+        const auto oldest = std::ranges::min(held | std::views::values | std::views::elements<1>);
+        wakeup = std::min(wakeup, oldest + reorderDelay(now));
+    }
+    return wakeup;
+}
+
+std::optional<std::vector<std::uint8_t>> MultipathBond::receive(std::chrono::milliseconds timeout,
+                                                                 std::span<const SocketHandle> wakeHandles) {
+    if (paths.empty()) {
+        lastError = "Multipath transport is not open";
+        return std::nullopt;
+    }
+
+    std::vector<SocketHandle> handles;
+    for (const auto& path : paths) {
+        handles.push_back(path.socket);
+        handles.push_back(path.probeSocket);
+    }
+    handles.insert(handles.end(), wakeHandles.begin(), wakeHandles.end());
+
+    const auto deadline = Clock::now() + timeout;
+    while (true) {
+        const auto now = Clock::now();
+        serviceProbes(now);
+        releaseHeld(now, false);
+        if (!ready.empty()) {
+            auto packet = std::move(ready.front());
+            ready.pop_front();
+            return packet;
+        }
+
+        // The sockets are read even when the time is up already
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(std::min(deadline, nextWakeup(now)) - now);
+        const int readable = socketUtil::waitAnyReadable(handles, std::max(wait, std::chrono::milliseconds(0)));
+        if (readable >= static_cast<int>(paths.size() * 2)) {
+            return std::nullopt;
+        }
+        if (readable >= 0) {
+            readPaths(Clock::now());
+        } else if (Clock::now() >= deadline) {
+            return std::nullopt;
+        }
+    }
+}
+
+std::vector<MultipathBond::PathStats> MultipathBond::pathStats() const {
+    std::vector<PathStats> stats;
+    for (const auto& path : paths) {
+        stats.push_back(path.stats);
+    }
+    return stats;
+}
+
+MultipathBond::ReorderStats MultipathBond::reorderStats() const {
+    return reorderCounters;
+}
+
+std::string MultipathBond::getLastError() const {
+    return lastError;
+}
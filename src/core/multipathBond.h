@@ -0,0 +1,149 @@
+#pragma once
+import std;
+#include "controlChannel.h"
+#include "controlWrap.h"
+#include "socketUtil.h"
+#include "transportLayers.h"
+
+// UDP to one server over several uplinks at once, e.g. Wi-Fi and a tethered
+// phone: a socket per network interface, bound to it (SO_BINDTODEVICE on
+// Linux, IP_BOUND_IF on macOS), all connected to the address the race
+// picked. Each data packet goes out on the path the scheduler chooses:
+// MinRtt takes the path it would arrive on first, given the path's RTT and,
+// where its capacity is configured, what is still queued on it; Weighted
+// spreads packets over the paths in proportion to their capacities.
+//
+// Every path is probed once per probeInterval with a one-off hard reset from
+// a second socket on the same interface, so the live session is left alone;
+// the server's reset measures the RTT. A probe unanswered for a few RTTs is
+// followed by the next one right away. A path is down as soon as a send on it
+// fails, or after probesUntilDown unanswered probes in a row, and the packet
+// goes out on the next path. Down paths keep being probed once per interval
+// and come back when they answer.
+//
+// Control packets stay on the path data last went out on: servers float a
+// session to the address of its latest authenticated data packet (peer-id)
+// and only take control packets from that address. Received data packets are
+// put back in packet-id order; one ahead of a gap waits until the gap fills,
+// every path the server sends on has delivered past it, the reorder buffer is
+// full or the RTT spread between those paths has passed.
+class MultipathBond {
+public:
+    using SocketHandle = socketUtil::SocketHandle;
+    using Clock = std::chrono::steady_clock;
+
+    enum class Scheduler { MinRtt, Weighted };
+
+    struct Uplink {
+        std::string interface;
+        std::uint32_t capacityMbps = 0;  // 0 if unknown; Weighted counts it as 1
+    };
+
+    struct Settings {
+        std::vector<Uplink> uplinks;
+        Scheduler scheduler = Scheduler::MinRtt;
+        std::chrono::milliseconds probeInterval{1000};
+        int probesUntilDown = 3;
+        std::chrono::milliseconds maxReorderDelay{50};
+        std::size_t reorderLimit = 256;  // packets held back at most
+    };
+
+    struct PathStats {
+        std::string interface;
+        bool up = false;
+        std::chrono::microseconds rtt{0};  // smoothed, from probes; 0 until one is answered
+        std::uint64_t packetsSent = 0;
+        std::uint64_t bytesSent = 0;
+        std::uint64_t packetsReceived = 0;
+        std::uint64_t bytesReceived = 0;
+        std::uint64_t probesSent = 0;
+        std::uint64_t probesAnswered = 0;
+        std::uint64_t sendErrors = 0;
+        std::uint64_t timesDown = 0;
+        std::string lastError;
+    };
+
+    struct ReorderStats {
+        std::uint64_t held = 0;     // arrived ahead of a gap
+        std::uint64_t skipped = 0;  // packet ids given up on, after the delay or with the buffer full
+        std::uint64_t late = 0;     // arrived after their gap was skipped or filled, delivered as they came
+    };
+
+    // "wlan0", or "wwan0=20" for an uplink of 20 Mbit/s
+    static std::optional<Uplink> parseUplink(std::string_view text);
+    // "min-rtt" or "weighted"
+    static std::optional<Scheduler> schedulerFromString(std::string_view name);
+
+    MultipathBond() = default;
+    ~MultipathBond();
+
+    MultipathBond(const MultipathBond&) = delete;
+    MultipathBond& operator=(const MultipathBond&) = delete;
+
+    // Opens a path per uplink to server; false if none could be opened.
+    // Packets are wrapped with layers, probes also with wrapKey.
+    bool open(const sockaddr_storage& server, const Settings& settings, TransportChain layers,
+              std::optional<ControlWrap::Key> wrapKey);
+    void close();
+    bool isOpen() const;
+
+    // wire is a UDP packet, already wrapped by the layers
+    bool send(std::span<const std::uint8_t> wire, bool control);
+    // The next packet, unwrapped and in order. Probes and the reorder delay
+    // are served while waiting; the wait ends early, without a packet, once
+    // one of wakeHandles is readable.
+    std::optional<std::vector<std::uint8_t>> receive(std::chrono::milliseconds timeout,
+                                                     std::span<const SocketHandle> wakeHandles = {});
+
+    std::vector<PathStats> pathStats() const;
+    ReorderStats reorderStats() const;
+    std::string getLastError() const;
+
+private:
+    struct Path {
+        PathStats stats;
+        std::uint32_t capacityMbps = 0;
+        SocketHandle socket = socketUtil::invalidSocket;
+        SocketHandle probeSocket = socketUtil::invalidSocket;
+        std::unique_ptr<ControlChannel> probe;  // the outstanding one
+        Clock::time_point probeSentAt;
+        Clock::time_point nextProbeAt;
+        int missedProbes = 0;
+        Clock::time_point lastUp;
+        Clock::time_point lastReceived;
+        std::optional<Clock::time_point> unansweredSince;  // first send since a packet last came in on the path
+        std::optional<std::uint32_t> highestId;  // of the current data channel key
+        // Bits still queued at capacity, as of backlogAt
+        double backlogBits = 0;
+        Clock::time_point backlogAt;
+        std::int64_t currentWeight = 0;  // smooth weighted round-robin
+    };
+
+    std::size_t choosePath(std::size_t bytes, Clock::time_point now);
+    bool sendOn(Path& path, std::span<const std::uint8_t> wire, Clock::time_point now);
+    void markDown(Path& path, Clock::time_point now);
+    void sendProbe(Path& path, Clock::time_point now);
+    Clock::duration probeTimeout(const Path& path) const;
+    bool silentSince(const Path& path) const;
+    void serviceProbes(Clock::time_point now);
+    void readPaths(Clock::time_point now);
+    void reorder(std::vector<std::uint8_t> packet, Path& from, Clock::time_point now);
+    void releaseHeld(Clock::time_point now, bool all);
+    std::chrono::microseconds reorderDelay(Clock::time_point now) const;
+    Clock::time_point nextWakeup(Clock::time_point now) const;
+
+    Settings settings;
+    TransportChain layers;
+    std::optional<ControlWrap::Key> wrapKey;
+    std::vector<Path> paths;
+    std::size_t dataPath = 0;  // where data went last, and control goes
+
+    // Reorder buffer, per data channel key
+    std::optional<std::uint8_t> reorderKey;
+    std::uint32_t expectedId = 0;
+    std::map<std::uint32_t, std::pair<std::vector<std::uint8_t>, Clock::time_point>> held;
+    std::deque<std::vector<std::uint8_t>> ready;
+    ReorderStats reorderCounters;
+
+    std::string lastError;
+};
@@ -0,0 +1,537 @@
+import std;
+#include "networkImpairment.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+namespace {
+
+constexpr std::size_t maxDatagramSize = 65535;
+constexpr std::size_t streamChunkSize = 16384;
+constexpr std::chrono::milliseconds idlePollInterval{100};
+
+std::vector<std::string> splitWords(std::string_view line) {
+    std::vector<std::string> words;
+    std::size_t pos = 0;
+    while (pos < line.size()) {
+        pos = line.find_first_not_of(" \t\r", pos);
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        const auto end = line.find_first_of(" \t\r", pos);
+        words.emplace_back(line.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+        pos = end;
+    }
+    return words;
+}
+
+double parseNumber(const std::string& text, std::size_t& consumed) {
+    try {
+        return std::stod(text, &consumed);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid number: " + text);
+    }
+}
+
+std::chrono::microseconds parseDuration(const std::string& text) {
+    if (text == "forever") {
+        return std::chrono::microseconds::zero();
+    }
+
+    std::size_t consumed = 0;
+    const double value = parseNumber(text, consumed);
+    const std::string unit = text.substr(consumed);
+
+    double micros = 0;
+    if (unit == "us") {
+        micros = value;
+    } else if (unit == "ms" || unit.empty()) {
+        micros = value * 1e3;
+    } else if (unit == "s") {
+        micros = value * 1e6;
+    } else if (unit == "min") {
+        micros = value * 60e6;
+    } else {
+        throw std::runtime_error("Invalid duration unit: " + text);
+    }
+    return std::chrono::microseconds(static_cast<std::int64_t>(micros));
+}
+
+double parseRatio(const std::string& text) {
+    std::size_t consumed = 0;
+    double value = parseNumber(text, consumed);
+    if (text.substr(consumed) == "%") {
+        value /= 100.0;
+    }
+    if (value < 0.0 || value > 1.0) {
+        throw std::runtime_error("Ratio out of range: " + text);
+    }
+    return value;
+}
+
+std::uint64_t parseBandwidth(const std::string& text) {
+    std::size_t consumed = 0;
+    const double value = parseNumber(text, consumed);
+    const std::string unit = text.substr(consumed);
+
+    double multiplier = 1;
+    if (unit == "kbit") {
+        multiplier = 1e3;
+    } else if (unit == "mbit") {
+        multiplier = 1e6;
+    } else if (unit == "gbit") {
+        multiplier = 1e9;
+    } else if (!unit.empty() && unit != "bit") {
+        throw std::runtime_error("Invalid bandwidth unit: " + text);
+    }
+    return static_cast<std::uint64_t>(value * multiplier);
+}
+
+void applySetting(ImpairmentProfile& profile, const std::string& key, const std::string& value) {
+    if (key == "latency") {
+        profile.latency = parseDuration(value);
+    } else if (key == "jitter") {
+        profile.jitter = parseDuration(value);
+    } else if (key == "loss") {
+        profile.loss = parseRatio(value);
+    } else if (key == "loss-burst") {
+        profile.lossBurst = std::max(1.0, std::stod(value));
+    } else if (key == "reorder") {
+        profile.reorder = parseRatio(value);
+    } else if (key == "reorder-delay") {
+        profile.reorderDelay = parseDuration(value);
+    } else if (key == "duplicate") {
+        profile.duplicate = parseRatio(value);
+    } else if (key == "bandwidth") {
+        profile.bandwidthBitsPerSecond = parseBandwidth(value);
+    } else if (key == "queue") {
+        profile.queueLimit = static_cast<std::size_t>(std::stoul(value));
+    } else {
+        throw std::runtime_error("Unknown impairment setting: " + key);
+    }
+}
+
+} // namespace
+
+ImpairmentScenario ImpairmentScenario::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open impairment scenario: " + path);
+    }
+
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto scenario = parse(content);
+    if (scenario.name.empty()) {
+        scenario.name = std::filesystem::path(path).stem().string();
+    }
+    return scenario;
+}
+
+ImpairmentScenario ImpairmentScenario::parse(std::string_view text) {
+    ImpairmentScenario scenario;
+    ImpairmentProfile defaults;
+    int lineNumber = 0;
+
+    std::size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        auto lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) {
+            lineEnd = text.size();
+        }
+        auto line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        ++lineNumber;
+
+        if (auto comment = line.find('#'); comment != std::string_view::npos) {
+            line = line.substr(0, comment);
+        }
+        const auto words = splitWords(line);
+        if (words.empty()) {
+            continue;
+        }
+
+        try {
+            const auto& key = words[0];
+            if (words.size() < 2) {
+                throw std::runtime_error("Missing value for " + key);
+            }
+
+            if (key == "name") {
+                scenario.name = words[1];
+            } else if (key == "seed") {
+                scenario.seed = std::stoull(words[1]);
+            } else if (key == "repeat") {
+                scenario.repeat = words[1] == "yes" || words[1] == "true";
+            } else if (key == "phase") {
+                // Each phase starts from the settings given before the first phase
+                Phase phase;
+                phase.name = words[1];
+                phase.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    parseDuration(words.size() > 2 ? words[2] : "forever"));
+                phase.profile = defaults;
+                scenario.phases.push_back(std::move(phase));
+            } else if (scenario.phases.empty()) {
+                applySetting(defaults, key, words[1]);
+            } else {
+                applySetting(scenario.phases.back().profile, key, words[1]);
+            }
+        } catch (const std::exception& e) {
+            throw std::runtime_error("Impairment scenario line " + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+
+    if (scenario.phases.empty()) {
+        scenario.phases.push_back({"default", std::chrono::milliseconds::zero(), defaults});
+    }
+    return scenario;
+}
+
+const ImpairmentScenario::Phase& ImpairmentScenario::phaseAt(std::chrono::steady_clock::duration elapsed) const {
+    auto offset = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+
+    std::chrono::milliseconds cycle{0};
+    for (const auto& phase : phases) {
+        if (phase.duration == std::chrono::milliseconds::zero()) {
+            cycle = std::chrono::milliseconds::zero();
+            break;
+        }
+        cycle += phase.duration;
+    }
+    if (repeat && cycle > std::chrono::milliseconds::zero()) {
+        offset %= cycle;
+    }
+
+    for (const auto& phase : phases) {
+        if (phase.duration == std::chrono::milliseconds::zero() || offset < phase.duration) {
+            return phase;
+        }
+        offset -= phase.duration;
+    }
+    return phases.back();
+}
+
+ImpairmentEngine::ImpairmentEngine(const ImpairmentScenario& scenario, std::uint64_t directionSalt,
+                                   Clock::time_point start)
+    : scenario(scenario)
+    , start(start)
+    , random(scenario.seed ^ (directionSalt * 0x9E3779B97F4A7C15ULL)) {
+}
+
+std::vector<ImpairmentEngine::Clock::time_point> ImpairmentEngine::schedule(std::size_t packetSize,
+                                                                            Clock::time_point now,
+                                                                            bool preserveStream) {
+    ++counters.packets;
+    const auto& profile = scenario.phaseAt(now - start).profile;
+
+    // Always draw the same number of values so fate depends only on the packet index
+    const double lossDraw = uniform();
+    const double burstDraw = uniform();
+    const double jitterDraw = uniform();
+    const double reorderDraw = uniform();
+    const double duplicateDraw = uniform();
+
+    if (!preserveStream) {
+        bool drop = false;
+        if (profile.lossBurst <= 1.0 || profile.loss >= 1.0) {
+            drop = lossDraw < profile.loss;
+        } else {
+            // Gilbert-Elliott: long-run loss rate stays at profile.loss
+            if (inLossBurst) {
+                inLossBurst = burstDraw >= 1.0 / profile.lossBurst;
+            } else {
+                inLossBurst = lossDraw < profile.loss / (profile.lossBurst * (1.0 - profile.loss));
+            }
+            drop = inLossBurst;
+        }
+        if (drop) {
+            ++counters.dropped;
+            return {};
+        }
+    }
+
+    // Bandwidth cap: serialize behind earlier packets, tail-drop when the queue is full
+    auto departure = now;
+    if (profile.bandwidthBitsPerSecond > 0) {
+        while (!queuedDepartures.empty() && queuedDepartures.front() <= now) {
+            queuedDepartures.pop_front();
+        }
+        if (!preserveStream && queuedDepartures.size() >= profile.queueLimit) {
+            ++counters.queueDrops;
+            return {};
+        }
+
+        const auto transmitTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+            static_cast<double>(packetSize) * 8.0 / static_cast<double>(profile.bandwidthBitsPerSecond)));
+        departure = std::max(now, linkFreeAt) + transmitTime;
+        linkFreeAt = departure;
+        queuedDepartures.push_back(departure);
+    }
+
+    const auto jitterOffset = std::chrono::duration_cast<Clock::duration>(
+        profile.jitter * (2.0 * jitterDraw - 1.0));
+    auto delivery = departure + std::max(Clock::duration::zero(),
+                                         std::chrono::duration_cast<Clock::duration>(profile.latency) + jitterOffset);
+
+    // Jitter alone never reorders; only the reorder setting lets packets overtake
+    if (!preserveStream && reorderDraw < profile.reorder) {
+        delivery += profile.reorderDelay;
+        ++counters.reordered;
+    } else {
+        delivery = std::max(delivery, lastDelivery);
+        lastDelivery = delivery;
+    }
+
+    std::vector<Clock::time_point> deliveries{delivery};
+    if (!preserveStream && duplicateDraw < profile.duplicate) {
+        deliveries.push_back(delivery + std::chrono::microseconds(100));
+        ++counters.duplicated;
+    }
+    return deliveries;
+}
+
+ImpairmentEngine::Stats ImpairmentEngine::stats() const {
+    return counters;
+}
+
+double ImpairmentEngine::uniform() {
+    // Portable [0, 1): std distributions differ between standard libraries
+    return static_cast<double>(random() >> 11) * 0x1.0p-53;
+}
+
+ImpairmentProxy::ImpairmentProxy(ImpairmentScenario scenario)
+    : scenario(std::move(scenario)) {
+    socketUtil::ensureInitialized();
+}
+
+ImpairmentProxy::~ImpairmentProxy() {
+    stop();
+}
+
+std::optional<std::uint16_t> ImpairmentProxy::start(const std::string& upstreamHost, const std::string& upstreamPort,
+                                                     VpnTransport::Protocol protocol) {
+    stop();
+    this->protocol = protocol;
+    const int socketType = protocol == VpnTransport::Protocol::Tcp ? SOCK_STREAM : SOCK_DGRAM;
+
+    try {
+        auto addresses = socketUtil::resolve(upstreamHost, upstreamPort, socketType);
+        if (addresses.empty()) {
+            throw std::runtime_error("No address for " + upstreamHost);
+        }
+        upstreamAddress = addresses.front();
+
+        listenSocket = ::socket(AF_INET, socketType, 0);
+        if (listenSocket == socketUtil::invalidSocket) {
+            throw std::runtime_error("Cannot create proxy socket: " + socketUtil::lastErrorText());
+        }
+
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        local.sin_port = 0;
+        if (::bind(listenSocket, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+            throw std::runtime_error("Cannot bind proxy socket: " + socketUtil::lastErrorText());
+        }
+        if (protocol == VpnTransport::Protocol::Tcp && ::listen(listenSocket, 1) != 0) {
+            throw std::runtime_error("Cannot listen on proxy socket: " + socketUtil::lastErrorText());
+        }
+
+        socklen_t length = sizeof(local);
+        ::getsockname(listenSocket, reinterpret_cast<sockaddr*>(&local), &length);
+
+        if (protocol == VpnTransport::Protocol::Udp) {
+            upstreamSocket = ::socket(upstreamAddress.ss_family, SOCK_DGRAM, 0);
+            if (upstreamSocket == socketUtil::invalidSocket ||
+                ::connect(upstreamSocket, reinterpret_cast<const sockaddr*>(&upstreamAddress),
+                          socketUtil::addressLength(upstreamAddress)) != 0) {
+                throw std::runtime_error("Cannot reach upstream " + upstreamHost + ": " + socketUtil::lastErrorText());
+            }
+        }
+
+        const auto now = ImpairmentEngine::Clock::now();
+        upstreamEngine = std::make_unique<ImpairmentEngine>(scenario, 1, now);
+        downstreamEngine = std::make_unique<ImpairmentEngine>(scenario, 2, now);
+
+        shouldStop = false;
+        proxyThread = std::thread([this]() {
+            if (this->protocol == VpnTransport::Protocol::Tcp) {
+                runTcp();
+            } else {
+                runUdp();
+            }
+        });
+
+        return ntohs(local.sin_port);
+
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        stop();
+        return std::nullopt;
+    }
+}
+
+void ImpairmentProxy::stop() {
+    shouldStop = true;
+    if (proxyThread.joinable()) {
+        proxyThread.join();
+    }
+
+    socketUtil::closeSocket(listenSocket);
+    socketUtil::closeSocket(upstreamSocket);
+    listenSocket = socketUtil::invalidSocket;
+    upstreamSocket = socketUtil::invalidSocket;
+    pending = {};
+}
+
+ImpairmentProxy::Stats ImpairmentProxy::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Stats result;
+    if (upstreamEngine) {
+        result.upstream = upstreamEngine->stats();
+    }
+    if (downstreamEngine) {
+        result.downstream = downstreamEngine->stats();
+    }
+    return result;
+}
+
+std::string ImpairmentProxy::getLastError() const {
+    return lastError;
+}
+
+void ImpairmentProxy::runUdp() {
+    sockaddr_storage clientAddress{};
+    bool haveClient = false;
+    std::vector<std::uint8_t> buffer(maxDatagramSize);
+    const std::array<socketUtil::SocketHandle, 2> sockets{listenSocket, upstreamSocket};
+
+    while (!shouldStop) {
+        const int ready = socketUtil::waitAnyReadable(sockets, timeUntilNextDelivery());
+
+        if (ready == 0) {
+            socklen_t length = sizeof(clientAddress);
+            auto received = ::recvfrom(listenSocket, reinterpret_cast<char*>(buffer.data()),
+                                       static_cast<int>(buffer.size()), 0,
+                                       reinterpret_cast<sockaddr*>(&clientAddress), &length);
+            if (received > 0) {
+                haveClient = true;
+                enqueue(true, {buffer.begin(), buffer.begin() + received});
+            }
+        } else if (ready == 1) {
+            auto received = ::recv(upstreamSocket, reinterpret_cast<char*>(buffer.data()),
+                                   static_cast<int>(buffer.size()), 0);
+            if (received > 0) {
+                enqueue(false, {buffer.begin(), buffer.begin() + received});
+            }
+        }
+
+        deliverDue([&](const Pending& packet) {
+            if (packet.toServer) {
+                ::send(upstreamSocket, reinterpret_cast<const char*>(packet.data.data()),
+                       static_cast<int>(packet.data.size()), 0);
+            } else if (haveClient) {
+                ::sendto(listenSocket, reinterpret_cast<const char*>(packet.data.data()),
+                         static_cast<int>(packet.data.size()), 0,
+                         reinterpret_cast<const sockaddr*>(&clientAddress), socketUtil::addressLength(clientAddress));
+            }
+        });
+    }
+}
+
+void ImpairmentProxy::runTcp() {
+    socketUtil::SocketHandle client = socketUtil::invalidSocket;
+    while (!shouldStop && client == socketUtil::invalidSocket) {
+        if (socketUtil::waitReadable(listenSocket, idlePollInterval)) {
+            client = ::accept(listenSocket, nullptr, nullptr);
+        }
+    }
+    if (client == socketUtil::invalidSocket) {
+        return;
+    }
+
+    upstreamSocket = ::socket(upstreamAddress.ss_family, SOCK_STREAM, 0);
+    if (upstreamSocket == socketUtil::invalidSocket ||
+        ::connect(upstreamSocket, reinterpret_cast<const sockaddr*>(&upstreamAddress),
+                  socketUtil::addressLength(upstreamAddress)) != 0) {
+        lastError = "Cannot connect upstream: " + socketUtil::lastErrorText();
+        socketUtil::closeSocket(client);
+        return;
+    }
+
+    auto sendAll = [](socketUtil::SocketHandle handle, const std::vector<std::uint8_t>& data) {
+        std::size_t offset = 0;
+        while (offset < data.size()) {
+            auto sent = ::send(handle, reinterpret_cast<const char*>(data.data() + offset),
+                               static_cast<int>(data.size() - offset), 0);
+            if (sent <= 0) {
+                return false;
+            }
+            offset += static_cast<std::size_t>(sent);
+        }
+        return true;
+    };
+
+    std::vector<std::uint8_t> buffer(streamChunkSize);
+    const std::array<socketUtil::SocketHandle, 2> sockets{client, upstreamSocket};
+    bool open = true;
+
+    while (!shouldStop && (open || !pending.empty())) {
+        const int ready = open ? socketUtil::waitAnyReadable(sockets, timeUntilNextDelivery()) : -1;
+        if (!open) {
+            std::this_thread::sleep_for(timeUntilNextDelivery());
+        }
+
+        if (ready >= 0) {
+            auto received = ::recv(sockets[ready], reinterpret_cast<char*>(buffer.data()),
+                                   static_cast<int>(buffer.size()), 0);
+            if (received <= 0) {
+                open = false;  // flush what is still in flight, then close both sides
+            } else {
+                enqueue(ready == 0, {buffer.begin(), buffer.begin() + received});
+            }
+        }
+
+        deliverDue([&](const Pending& chunk) {
+            sendAll(chunk.toServer ? upstreamSocket : client, chunk.data);
+        });
+    }
+
+    socketUtil::closeSocket(client);
+    socketUtil::closeSocket(upstreamSocket);
+    upstreamSocket = socketUtil::invalidSocket;
+}
+
+void ImpairmentProxy::enqueue(bool toServer, std::vector<std::uint8_t> data) {
+    std::vector<ImpairmentEngine::Clock::time_point> deliveries;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        auto& engine = toServer ? *upstreamEngine : *downstreamEngine;
+        deliveries = engine.schedule(data.size(), ImpairmentEngine::Clock::now(),
+                                     protocol == VpnTransport::Protocol::Tcp);
+    }
+
+    for (std::size_t i = 0; i + 1 < deliveries.size(); ++i) {
+        pending.push({deliveries[i], nextSequence++, toServer, data});
+    }
+    if (!deliveries.empty()) {
+        pending.push({deliveries.back(), nextSequence++, toServer, std::move(data)});
+    }
+}
+
+std::chrono::milliseconds ImpairmentProxy::timeUntilNextDelivery() const {
+    if (pending.empty()) {
+        return idlePollInterval;
+    }
+    auto wait = std::chrono::ceil<std::chrono::milliseconds>(pending.top().due - ImpairmentEngine::Clock::now());
+    return std::clamp(wait, std::chrono::milliseconds::zero(), idlePollInterval);
+}
+
+template <typename Deliver>
+void ImpairmentProxy::deliverDue(Deliver&& deliver) {
+    const auto now = ImpairmentEngine::Clock::now();
+    while (!pending.empty() && pending.top().due <= now) {
+        deliver(pending.top());
+        pending.pop();
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+import std;
+#include "socketUtil.h"
+#include "vpnTransport.h"
+
+// Link characteristics for one phase of an impairment scenario
+struct ImpairmentProfile {
+    std::chrono::microseconds latency{0};        // one-way, applied per direction
+    std::chrono::microseconds jitter{0};         // uniform +/- around latency
+    double loss = 0.0;                           // 0..1
+    double lossBurst = 1.0;                      // mean burst length (Gilbert-Elliott)
+    double reorder = 0.0;                        // chance a packet is held back
+    std::chrono::microseconds reorderDelay{0};
+    double duplicate = 0.0;
+    std::uint64_t bandwidthBitsPerSecond = 0;    // 0 = unlimited
+    std::size_t queueLimit = 1000;               // packets queued behind the bandwidth cap
+};
+
+// Seeded schedule of link phases loaded from a .impair scenario file
+class ImpairmentScenario {
+public:
+    struct Phase {
+        std::string name;
+        std::chrono::milliseconds duration{0};   // 0 = lasts forever
+        ImpairmentProfile profile;
+    };
+
+    static ImpairmentScenario load(const std::string& path);
+    static ImpairmentScenario parse(std::string_view text);
+
+    const Phase& phaseAt(std::chrono::steady_clock::duration elapsed) const;
+
+    std::string name;
+    std::uint64_t seed = 1;
+    bool repeat = true;
+    std::vector<Phase> phases;
+};
+
+// Decides the fate of each packet in one direction. Decisions depend only on
+// the seed and the packet sequence, so a run can be replayed exactly.
+class ImpairmentEngine {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        std::uint64_t packets = 0;
+        std::uint64_t dropped = 0;
+        std::uint64_t duplicated = 0;
+        std::uint64_t reordered = 0;
+        std::uint64_t queueDrops = 0;
+    };
+
+    ImpairmentEngine(const ImpairmentScenario& scenario, std::uint64_t directionSalt, Clock::time_point start);
+
+    // Delivery times for this packet: empty when dropped, two entries when duplicated.
+    // Stream mode (TCP) never drops, duplicates or reorders.
+    std::vector<Clock::time_point> schedule(std::size_t packetSize, Clock::time_point now, bool preserveStream = false);
+
+    Stats stats() const;
+
+private:
+    double uniform();
+
+    const ImpairmentScenario& scenario;
+    Clock::time_point start;
+    std::mt19937_64 random;
+    bool inLossBurst = false;
+    Clock::time_point linkFreeAt{};
+    Clock::time_point lastDelivery{};
+    std::deque<Clock::time_point> queuedDepartures;
+    Stats counters;
+};
+
+// Loopback proxy that applies a scenario between the client and a server.
+// UDP gets the full set of impairments; TCP keeps byte order, so it only
+// sees latency, jitter and the bandwidth cap.
+class ImpairmentProxy {
+public:
+    struct Stats {
+        ImpairmentEngine::Stats upstream;
+        ImpairmentEngine::Stats downstream;
+    };
+
+    explicit ImpairmentProxy(ImpairmentScenario scenario);
+    ~ImpairmentProxy();
+
+    ImpairmentProxy(const ImpairmentProxy&) = delete;
+    ImpairmentProxy& operator=(const ImpairmentProxy&) = delete;
+
+    // Listens on 127.0.0.1 and returns the local port to connect to
+    std::optional<std::uint16_t> start(const std::string& upstreamHost, const std::string& upstreamPort,
+                                       VpnTransport::Protocol protocol);
+    void stop();
+
+    Stats stats() const;
+    std::string getLastError() const;
+
+private:
+    struct Pending {
+        ImpairmentEngine::Clock::time_point due;
+        std::uint64_t sequence;
+        bool toServer;
+        std::vector<std::uint8_t> data;
+
+        bool operator>(const Pending& other) const {
+            return due != other.due ? due > other.due : sequence > other.sequence;
+        }
+    };
+
+    void runUdp();
+    void runTcp();
+    void enqueue(bool toServer, std::vector<std::uint8_t> data);
+    std::chrono::milliseconds timeUntilNextDelivery() const;
+    template <typename Deliver>
+    void deliverDue(Deliver&& deliver);
+
+    ImpairmentScenario scenario;
+    VpnTransport::Protocol protocol = VpnTransport::Protocol::Udp;
+    sockaddr_storage upstreamAddress{};
+    socketUtil::SocketHandle listenSocket = socketUtil::invalidSocket;
+    socketUtil::SocketHandle upstreamSocket = socketUtil::invalidSocket;
+
+    std::unique_ptr<ImpairmentEngine> upstreamEngine;
+    std::unique_ptr<ImpairmentEngine> downstreamEngine;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<>> pending;
+    std::uint64_t nextSequence = 0;
+
+    std::atomic<bool> shouldStop{false};
+    std::thread proxyThread;
+    mutable std::mutex statsMutex;
+    std::string lastError;
+};
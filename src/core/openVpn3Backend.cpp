@@ -0,0 +1,239 @@
+import std;
+#include "openVpn3Backend.h"
+#include "secureMemory.h"
+
+// The library is header-only apart from its client API, which is compiled here
+#include <client/ovpncli.cpp>
+#include <openvpn/init/initprocess.hpp>
+
+namespace ClientAPI = openvpn::ClientAPI;
+
+namespace {
+
+// Library events that only mark progress towards CONNECTED
+const std::map<std::string, std::string> connectionSteps{
+    {"RESOLVE", "Resolving server address..."},
+    {"WAIT", "Waiting for server response..."},
+    {"WAIT_PROXY", "Waiting for proxy..."},
+    {"CONNECTING", "Connecting to server..."},
+    {"GET_CONFIG", "Receiving configuration..."},
+    {"ASSIGN_IP", "Assigning tunnel address..."},
+    {"ADD_ROUTES", "Adding routes..."},
+};
+
+// Fatal library events VpnConnectionManager knows by name; others are reported as CONNECTION_FAILED
+const std::set<std::string> knownFailures{"AUTH_FAILED", "CERT_VERIFY_FAIL", "TLS_ERROR", "CONNECTION_TIMEOUT"};
+
+} // namespace
+
+class OpenVpn3Backend::Client : public ClientAPI::OpenVPNClient {
+public:
+    explicit Client(OpenVpn3Backend& owner) : owner(owner) {}
+
+    bool reportedFailure = false;
+
+    bool pause_on_connection_timeout() override {
+        return false;
+    }
+
+    void event(const ClientAPI::Event& ev) override {
+        if (ev.name == "PAUSE") {
+            owner.emitEvent("PAUSED", "Connection paused");
+        } else if (ev.name == "RESUME") {
+            owner.emitEvent("RESUMED", "Connection resumed");
+        } else if (ev.name == "CONNECTED" || ev.name == "RECONNECTING" || ev.name == "DISCONNECTED" ||
+                   ev.name == "CLIENT_RESTART") {
+            owner.emitEvent(ev.name, ev.info);
+        } else if (auto step = connectionSteps.find(ev.name); step != connectionSteps.end()) {
+            owner.emitEvent("CONNECTING", step->second);
+        } else if (ev.fatal) {
+            const std::string info = ev.info.empty() ? ev.name : ev.name + ": " + ev.info;
+            reportedFailure = true;
+            owner.setLastError(info);
+            owner.emitEvent(knownFailures.contains(ev.name) ? ev.name : "CONNECTION_FAILED", info);
+        } else {
+            owner.emitLog(ev.error ? 2 : 4, "Event: " + ev.name + (ev.info.empty() ? "" : " - " + ev.info));
+        }
+    }
+
+    void acc_event(const ClientAPI::AppCustomControlMessageEvent&) override {
+    }
+
+    void log(const ClientAPI::LogInfo& info) override {
+        std::string_view text = info.text;
+        while (text.ends_with('\n')) {
+            text.remove_suffix(1);
+        }
+        owner.emitLog(3, std::string(text));
+    }
+
+    // Keys come from the profile; there is no external PKI to ask
+    void external_pki_cert_request(ClientAPI::ExternalPKICertRequest& request) override {
+        request.error = true;
+        request.errorText = "External PKI is not supported";
+    }
+
+    void external_pki_sign_request(ClientAPI::ExternalPKISignRequest& request) override {
+        request.error = true;
+        request.errorText = "External PKI is not supported";
+    }
+
+private:
+    OpenVpn3Backend& owner;
+};
+
+OpenVpn3Backend::OpenVpn3Backend(bool kernelOffload)
+    : kernelOffload(kernelOffload) {
+    // Process-wide library state (crypto, time base), set up once
+    static openvpn::InitProcess::Init libraryInit;
+}
+
+OpenVpn3Backend::~OpenVpn3Backend() {
+    stop();
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+}
+
+bool OpenVpn3Backend::start(const VpnConfigManager::ClientConfig& config) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running) {
+        lastError = "Connection already in progress";
+        return false;
+    }
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+    lastError.clear();
+
+    // A library client connects once; every session gets a fresh one
+    client = std::make_unique<Client>(*this);
+
+    ClientAPI::Config apiConfig;
+    apiConfig.content = std::string(config.content.view());
+    apiConfig.compressionMode = config.compressionMode;
+    apiConfig.tcpQueueLimit = config.tcpQueueLimit;
+    apiConfig.serverOverride = config.server_override;
+    apiConfig.portOverride = config.port_override;
+    apiConfig.protoOverride = config.proto_override;
+    apiConfig.allowLocalLanAccess = config.allowLocalLan;
+    apiConfig.tunPersist = config.tunPersist;
+    apiConfig.autologinSessions = config.autologinSessions;
+    apiConfig.disableClientCert = config.disableClientCert;
+    apiConfig.sslDebugLevel = config.sslDebugLevel;
+    apiConfig.privateKeyPassword = std::string(config.privateKeyPassword.view());
+    apiConfig.dco = kernelOffload;
+
+    const ClientAPI::EvalConfig eval = client->eval_config(apiConfig);
+    secureWipe(apiConfig.privateKeyPassword.data(), apiConfig.privateKeyPassword.size());
+    secureWipe(apiConfig.content.data(), apiConfig.content.size());
+    if (eval.error) {
+        lastError = "Configuration evaluation failed: " + eval.message;
+        return false;
+    }
+
+    if (!config.username.empty() || !config.password.empty()) {
+        ClientAPI::ProvideCreds creds;
+        creds.username = std::string(config.username.view());
+        creds.password = std::string(config.password.view());
+        creds.cachePassword = config.autologinSessions;
+        const ClientAPI::Status status = client->provide_creds(creds);
+        secureWipe(creds.password.data(), creds.password.size());
+        if (status.error) {
+            lastError = "Credentials rejected: " + status.message;
+            return false;
+        }
+    }
+
+    running = true;
+    sessionThread = std::thread([this]() {
+        // Blocks for the whole session, until stop() or a fatal error
+        const ClientAPI::Status status = client->connect();
+        if (status.error && !client->reportedFailure) {
+            setLastError(status.message);
+            emitEvent("CONNECTION_FAILED", status.message);
+        }
+        running = false;
+    });
+    emitLog(3, kernelOffload ? "openvpn3 client started with ovpn-dco offload" : "openvpn3 client started");
+    return true;
+}
+
+void OpenVpn3Backend::stop() {
+    if (!running) {
+        return;
+    }
+    client->stop();
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+}
+
+void OpenVpn3Backend::pause() {
+    if (running) {
+        client->pause("User requested pause");
+    }
+}
+
+void OpenVpn3Backend::resume() {
+    if (running) {
+        client->resume();
+    }
+}
+
+void OpenVpn3Backend::reconnect() {
+    if (running) {
+        client->reconnect(1);
+    }
+}
+
+std::string OpenVpn3Backend::getLastError() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return lastError;
+}
+
+std::optional<sockaddr_storage> OpenVpn3Backend::getServerAddress() const {
+    if (!running) {
+        return std::nullopt;
+    }
+    const ClientAPI::ConnectionInfo info = client->connection_info();
+    if (!info.defined || info.serverIp.empty()) {
+        return std::nullopt;
+    }
+    try {
+        const int socketType = info.serverProto.starts_with("TCP") ? SOCK_STREAM : SOCK_DGRAM;
+        auto addresses = socketUtil::resolve(info.serverIp, info.serverPort, socketType);
+        return addresses.empty() ? std::nullopt : std::optional(addresses.front());
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+bool OpenVpn3Backend::tunnelCarriesIpv6() const {
+    return running && !client->connection_info().vpnIp6.empty();
+}
+
+void OpenVpn3Backend::setImpairmentScenario(std::optional<ImpairmentScenario> scenario) {
+    if (scenario) {
+        emitLog(2, "The openvpn3 library opens its own sockets; impairment scenario '" + scenario->name + "' ignored");
+    }
+}
+
+std::string OpenVpn3Backend::kernelOffloadUnavailableReason() {
+    #if defined(ENABLE_OVPNDCO) && defined(__linux__)
+        // ovpn-dco-v2 out of tree, "ovpn" once merged upstream
+        std::error_code ignored;
+        if (std::filesystem::exists("/sys/module/ovpn_dco_v2", ignored) ||
+            std::filesystem::exists("/sys/module/ovpn", ignored)) {
+            return {};
+        }
+        return "the ovpn-dco kernel module is not loaded";
+    #else
+        return "this build has no ovpn-dco support";
+    #endif
+}
+
+void OpenVpn3Backend::setLastError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    lastError = error;
+}
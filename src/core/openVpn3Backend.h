@@ -0,0 +1,39 @@
+#pragma once
+import std;
+#include "vpnBackend.h"
+
+// Connects through the openvpn3 client library instead of the built-in
+// engine. With kernelOffload the library moves the data channel into the
+// ovpn-dco kernel module after the handshake. Only built when CMake finds the
+// library (SIAVPN_HAVE_OPENVPN3).
+class OpenVpn3Backend : public VpnBackend {
+public:
+    explicit OpenVpn3Backend(bool kernelOffload);
+    ~OpenVpn3Backend() override;
+
+    bool start(const VpnConfigManager::ClientConfig& config) override;
+    void stop() override;
+    void pause() override;
+    void resume() override;
+    void reconnect() override;
+    std::string getLastError() const override;
+
+    std::optional<sockaddr_storage> getServerAddress() const override;
+    bool tunnelCarriesIpv6() const override;
+    void setImpairmentScenario(std::optional<ImpairmentScenario> scenario) override;
+
+    // Why kernel offload cannot be used on this system, or empty
+    static std::string kernelOffloadUnavailableReason();
+
+private:
+    class Client;  // the library's ClientAPI::OpenVPNClient, kept out of this header
+
+    void setLastError(const std::string& error);
+
+    bool kernelOffload;
+    std::unique_ptr<Client> client;
+    std::thread sessionThread;
+    std::atomic<bool> running{false};
+    std::string lastError;
+    mutable std::mutex stateMutex;
+};
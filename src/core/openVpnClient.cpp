@@ -1,5 +1,289 @@
 import std;
 #include "openVpnClient.h"
+#include "controlChannel.h"
+#include "dataChannel.h"
+#include "ovpnProfile.h"
+#include "transportLayers.h"
+#include "tunDevice.h"
+#include "vpnTransport.h"
+
+#ifdef __linux__
+#include <malloc.h>
+#endif
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+namespace {
+
+// Value of "<name> <value>" in a comma separated push reply
+std::string_view pushOption(std::string_view reply, std::string_view name) {
+    std::size_t pos = 0;
+    while (pos < reply.size()) {
+        auto end = reply.find(',', pos);
+        auto option = reply.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+        if (option.size() > name.size() && option.starts_with(name) && option[name.size()] == ' ') {
+            return option.substr(name.size() + 1);
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return {};
+}
+
+// Every value of "<name> <value>" in a comma separated push reply
+std::vector<std::string_view> pushOptions(std::string_view reply, std::string_view name) {
+    std::vector<std::string_view> values;
+    std::size_t pos = 0;
+    while (pos < reply.size()) {
+        auto end = reply.find(',', pos);
+        auto option = reply.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+        if (option.size() > name.size() && option.starts_with(name) && option[name.size()] == ' ') {
+            values.push_back(option.substr(name.size() + 1));
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+// Arguments of an option that may also come bare ("redirect-gateway"); nullopt if not pushed
+std::optional<std::string_view> pushFlag(std::string_view reply, std::string_view name) {
+    if (auto values = pushOptions(reply, name); !values.empty()) {
+        return values.front();
+    }
+    std::size_t pos = 0;
+    while (pos <= reply.size()) {
+        const auto end = std::min(reply.find(',', pos), reply.size());
+        if (reply.substr(pos, end - pos) == name) {
+            return std::string_view{};
+        }
+        pos = end + 1;
+    }
+    return std::nullopt;
+}
+
+// Timer windows of the connected loop, see WakeupScheduler
+constexpr std::chrono::seconds statsSampleInterval{60};
+constexpr std::chrono::seconds statsSampleSlack{30};
+constexpr std::chrono::milliseconds controlTimerSlack{20};
+constexpr std::chrono::seconds idleAfter{30};  // without payload or control traffic
+constexpr std::chrono::seconds pathStatsRefresh{1};
+constexpr std::size_t tunReadBatch = VpnTransport::receiveBatchSize;  // packets per wakeup
+
+// "ping 10" style intervals; zero when absent
+std::chrono::seconds pushSeconds(std::string_view reply, std::string_view name) {
+    auto value = pushOption(reply, name);
+    int seconds = 0;
+    std::from_chars(value.data(), value.data() + value.size(), seconds);
+    return std::chrono::seconds(std::max(seconds, 0));
+}
+
+// Cipher, peer id and compression framing as negotiated; the server's push
+// wins over the profile. nullopt if the cipher has no data channel kernel.
+std::optional<DataChannel::Config> dataChannelConfig(const OvpnProfile& profile, std::string_view pushReply,
+                                                     VpnTransport::Protocol framing) {
+    DataChannel::Config config;
+    config.framing = framing;
+
+    std::string cipher = std::string(pushOption(pushReply, "cipher"));
+    if (auto args = profile.directiveArgs("cipher"); cipher.empty() && !args.empty()) {
+        cipher = args[0];
+    }
+    if (!cipher.empty()) {
+        auto known = DataChannel::cipherFromName(cipher);
+        if (!known) {
+            return std::nullopt;
+        }
+        config.cipher = *known;
+    }
+
+    if (auto peerId = pushOption(pushReply, "peer-id"); !peerId.empty()) {
+        std::uint32_t value = 0;
+        if (std::from_chars(peerId.data(), peerId.data() + peerId.size(), value).ec == std::errc{}) {
+            config.peerId = value;
+        }
+    }
+
+    // Compression options may be bare ("comp-lzo", "compress")
+    bool pushedCompression = false;
+    std::size_t pos = 0;
+    while (pos <= pushReply.size()) {
+        const auto end = std::min(pushReply.find(',', pos), pushReply.size());
+        const auto option = pushReply.substr(pos, end - pos);
+        const auto space = option.find(' ');
+        const auto name = option.substr(0, space);
+        if (name == "compress" || name == "comp-lzo") {
+            config.compression = DataChannel::compressionFromOption(
+                name, space == std::string_view::npos ? std::string_view{} : option.substr(space + 1));
+            pushedCompression = true;
+        }
+        pos = end + 1;
+    }
+    if (!pushedCompression) {
+        for (const std::string name : {"compress", "comp-lzo"}) {
+            if (profile.hasDirective(name)) {
+                auto args = profile.directiveArgs(name);
+                config.compression = DataChannel::compressionFromOption(name, args.empty() ? "" : args[0]);
+                break;
+            }
+        }
+    }
+    return config;
+}
+
+// Prefix length of a dotted netmask ("255.255.255.0" -> 24); nullopt if it is none
+std::optional<int> prefixLength(const std::string& netmask) {
+    in_addr mask{};
+    if (::inet_pton(AF_INET, netmask.c_str(), &mask) != 1) {
+        return std::nullopt;
+    }
+    const std::uint32_t bits = ntohl(mask.s_addr);
+    const int length = std::popcount(bits);
+    if (length != 0 && bits != ~std::uint32_t{0} << (32 - length)) {
+        return std::nullopt;
+    }
+    return length;
+}
+
+bool isIpv4Address(const std::string& text) {
+    in_addr address{};
+    return ::inet_pton(AF_INET, text.c_str(), &address) == 1;
+}
+
+// Addresses, routes and MTU of the tunnel device, from the push reply and the
+// profile's own options. Throws std::runtime_error without a usable tunnel
+// address; route options it cannot apply go to ignored.
+TunDevice::Settings tunnelSettings(const OvpnProfile& profile, std::string_view pushReply,
+                                   std::vector<std::string>& ignored) {
+    // The push wins; a profile may set these itself (static p2p setups)
+    auto option = [&](std::string_view name) {
+        std::string value(pushOption(pushReply, name));
+        if (value.empty()) {
+            for (const auto& arg : profile.directiveArgs(std::string(name))) {
+                value += (value.empty() ? "" : " ") + arg;
+            }
+        }
+        return value;
+    };
+
+    TunDevice::Settings settings;
+    std::istringstream ifconfig{option("ifconfig")};
+    std::string local, second;
+    if (ifconfig >> local >> second) {
+        if (option("topology") == "subnet") {
+            const auto length = prefixLength(second);
+            if (!isIpv4Address(local) || !length) {
+                throw std::runtime_error("Unusable ifconfig " + local + " " + second);
+            }
+            settings.addresses.push_back({local + "/" + std::to_string(*length), {}});
+        } else {
+            // net30 and p2p: a point-to-point link to the server's end
+            if (!isIpv4Address(local) || !isIpv4Address(second)) {
+                throw std::runtime_error("Unusable ifconfig " + local + " " + second);
+            }
+            settings.addresses.push_back({local + "/32", second});
+        }
+    }
+    std::istringstream ifconfig6{option("ifconfig-ipv6")};
+    if (ifconfig6 >> local) {
+        settings.addresses.push_back({local.find('/') == std::string::npos ? local + "/64" : local, {}});
+    }
+    if (settings.addresses.empty()) {
+        throw std::runtime_error("The server assigned no tunnel address (ifconfig)");
+    }
+
+    // "route <network> [<netmask> [<gateway> [<metric>]]]"; the gateway is
+    // the server's end of the tunnel, which a TUN device reaches anyway
+    auto addRoute = [&](const std::vector<std::string>& args) {
+        const std::string netmask = args.size() > 1 ? args[1] : "255.255.255.255";
+        const auto length = prefixLength(netmask);
+        if (args.empty() || !isIpv4Address(args[0]) || !length) {
+            std::string text;
+            for (const auto& arg : args) {
+                text += " " + arg;
+            }
+            ignored.push_back("route" + text);
+            return;
+        }
+        settings.routes.push_back(args[0] + "/" + std::to_string(*length));
+    };
+    auto words = [](std::string_view value) {
+        std::istringstream stream{std::string(value)};
+        std::vector<std::string> result;
+        for (std::string word; stream >> word;) {
+            result.push_back(std::move(word));
+        }
+        return result;
+    };
+    // route-nopull keeps the routes to the profile's own
+    const bool pulled = !profile.hasDirective("route-nopull");
+    for (const auto& args : profile.directiveOccurrences("route")) {
+        addRoute(args);
+    }
+    for (const auto& args : profile.directiveOccurrences("route-ipv6")) {
+        if (!args.empty()) {
+            settings.routes.push_back(args[0]);
+        }
+    }
+    std::vector<std::string> redirect = profile.directiveArgs("redirect-gateway");
+    bool redirected = profile.hasDirective("redirect-gateway");
+    if (pulled) {
+        for (auto value : pushOptions(pushReply, "route")) {
+            addRoute(words(value));
+        }
+        for (auto value : pushOptions(pushReply, "route-ipv6")) {
+            if (auto args = words(value); !args.empty()) {
+                settings.routes.push_back(args[0]);
+            }
+        }
+        if (auto value = pushFlag(pushReply, "redirect-gateway")) {
+            redirect = words(*value);
+            redirected = true;
+        }
+    }
+    if (redirected) {
+        // "def1" or not, the device takes the default route as its two halves
+        if (std::ranges::find(redirect, "!ipv4") == redirect.end()) {
+            settings.routes.emplace_back("0.0.0.0/0");
+        }
+        if (std::ranges::find(redirect, "ipv6") != redirect.end()) {
+            settings.routes.emplace_back("::/0");
+        }
+    }
+
+    int mtu = 1500;  // what the handshake announces (tun-mtu 1500)
+    const std::string mtuText = option("tun-mtu");
+    std::from_chars(mtuText.data(), mtuText.data() + mtuText.size(), mtu);
+    settings.mtu = std::clamp(mtu, 576, 65535);
+    return settings;
+}
+
+// Push replies are logged, but auth tokens must not end up in logs
+std::string redactPushReply(std::string_view reply) {
+    std::string redacted;
+    std::size_t pos = 0;
+    while (true) {
+        auto end = reply.find(',', pos);
+        auto option = reply.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+        if (option.starts_with("auth-token ") || option.starts_with("auth-token-user ")) {
+            redacted.append(option.substr(0, option.find(' ') + 1)).append("[redacted]");
+        } else {
+            redacted.append(option);
+        }
+        if (end == std::string_view::npos) {
+            return redacted;
+        }
+        redacted += ',';
+        pos = end + 1;
+    }
+}
+
+} // namespace
 
 OpenVpnClient::OpenVpnClient() {
     lastError.clear();
@@ -13,7 +297,7 @@ OpenVpnClient::~OpenVpnClient() {
     }
 }
 
-bool OpenVpnClient::startConnection(const std::string& configContent) {
+bool OpenVpnClient::startConnection(std::string_view configContent) {
     std::lock_guard<std::mutex> lock(stateMutex);
     
     if (isRunning) {
@@ -26,13 +310,22 @@ bool OpenVpnClient::startConnection(const std::string& configContent) {
         return false;
     }
     
-    currentConfig = configContent;
+    // A previous attempt may have ended on its own; reap its thread first
+    if (connectionThread.joinable()) {
+        connectionThread.join();
+    }
+    
+    currentConfig.assign(configContent);
+    lastError.clear();
+    tunnelName.clear();
     shouldStop = false;
+    pauseRequested = false;
     isRunning = true;
     
-    // Start connection simulation in background thread
+    // Run the connection in a background thread
     connectionThread = std::thread([this]() {
-        simulateConnectionProcess();
+        while (runConnectionProcess() && !shouldStop) {
+        }
     });
     
     handleInternalLog(3, "OpenVPN client connection initiated");
@@ -48,7 +341,10 @@ void OpenVpnClient::stopConnection() {
         
         shouldStop = true;
         isRunning = false;
+        pauseRequested = false;
     }
+    pauseCv.notify_all();
+    wakeups.interrupt();
     
     if (connectionThread.joinable()) {
         connectionThread.join();
@@ -58,20 +354,25 @@ void OpenVpnClient::stopConnection() {
     handleInternalLog(3, "OpenVPN client disconnected");
 }
 
+// The connection thread parks itself once it is connected and reports PAUSED;
+// a pause requested during the handshake takes effect when it completes
 void OpenVpnClient::pauseConnection() {
     std::lock_guard<std::mutex> lock(stateMutex);
     if (isRunning) {
-        handleInternalEvent("PAUSED", "Connection paused");
-        handleInternalLog(3, "OpenVPN client paused");
+        pauseRequested = true;
+        wakeups.interrupt();
     }
 }
 
 void OpenVpnClient::resumeConnection() {
-    std::lock_guard<std::mutex> lock(stateMutex);
-    if (isRunning) {
-        handleInternalEvent("RESUMED", "Connection resumed");
-        handleInternalLog(3, "OpenVPN client resumed");
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!pauseRequested) {
+            return;
+        }
+        pauseRequested = false;
     }
+    pauseCv.notify_all();
 }
 
 void OpenVpnClient::reconnectConnection() {
@@ -84,7 +385,8 @@ void OpenVpnClient::reconnectConnection() {
     // Restart with current config
     if (!currentConfig.empty()) {
         std::this_thread::sleep_for(std::chrono::seconds(1)); // Brief delay
-        startConnection(currentConfig);
+        const SecureString config = currentConfig;  // startConnection replaces currentConfig
+        startConnection(config.view());
     }
 }
 
@@ -93,11 +395,113 @@ bool OpenVpnClient::isConnected() const {
     return isRunning && !shouldStop;
 }
 
+bool OpenVpnClient::isPaused() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return paused;
+}
+
 std::string OpenVpnClient::getLastError() const {
     std::lock_guard<std::mutex> lock(stateMutex);
     return lastError;
 }
 
+HandshakeTimings OpenVpnClient::getHandshakeTimings() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return lastHandshakeTimings;
+}
+
+std::vector<std::string> OpenVpnClient::getPushedDnsServers() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return pushedDnsServers;
+}
+
+std::optional<sockaddr_storage> OpenVpnClient::getServerAddress() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return serverAddress;
+}
+
+std::string OpenVpnClient::getTunnelInterface() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return tunnelName;
+}
+
+bool OpenVpnClient::tunnelCarriesIpv6() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return pushedIpv6;
+}
+
+void OpenVpnClient::setCredentials(const SecureString& username, const SecureString& password,
+                                   const SecureString& privateKeyPassword) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->username = username;
+    this->password = password;
+    this->privateKeyPassword = privateKeyPassword;
+}
+
+void OpenVpnClient::clearSensitiveData() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        username.clear();
+        password.clear();
+        privateKeyPassword.clear();
+        if (!isRunning) {
+            currentConfig.clear();
+        }
+    }
+    credentialCache.clear();
+    sessionCache.clear();
+}
+
+void OpenVpnClient::setAuthCachePolicy(bool autologinSessions, std::chrono::seconds lifetime) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    this->autologinSessions = autologinSessions;
+    credentialCache.setLifetime(lifetime);
+}
+
+void OpenVpnClient::setZeroCopySend(bool enabled) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    zeroCopySend = enabled;
+}
+
+void OpenVpnClient::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    memoryBudget = std::move(budget);
+}
+
+void OpenVpnClient::setIdleCoalescing(bool enabled) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    idleCoalescing = enabled;
+}
+
+double OpenVpnClient::getWakeupsPerMinute() const {
+    return wakeups.wakeupsPerMinute(std::chrono::steady_clock::now());
+}
+
+std::vector<MultipathBond::PathStats> OpenVpnClient::getPathStats() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return pathStats;
+}
+
+void OpenVpnClient::setImpairmentScenario(std::optional<ImpairmentScenario> scenario) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    impairmentScenario = std::move(scenario);
+}
+
+void OpenVpnClient::setPreferredRemote(std::optional<OvpnProfile::Remote> remote) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    preferredRemote = std::move(remote);
+}
+
+void OpenVpnClient::setProtoOverride(std::string proto) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    protoOverride = std::move(proto);
+}
+
+void OpenVpnClient::setMultipath(std::optional<MultipathBond::Settings> settings) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    multipath = std::move(settings);
+}
+
 void OpenVpnClient::setEventHandler(std::function<void(const std::string&, const std::string&)> handler) {
     eventHandler = std::move(handler);
 }
@@ -106,36 +510,650 @@ void OpenVpnClient::setLogHandler(std::function<void(int, const std::string&)> h
     logHandler = std::move(handler);
 }
 
-void OpenVpnClient::simulateConnectionProcess() {
-    const std::vector<std::pair<std::string, std::string>> connectionSteps = {
-        {"CONNECTING", "Resolving server address..."},
-        {"CONNECTING", "Establishing TCP/UDP connection..."},
-        {"CONNECTING", "Performing TLS handshake..."},
-        {"CONNECTING", "Authenticating with server..."},
-        {"CONNECTING", "Configuring tunnel interface..."}
+bool OpenVpnClient::runConnectionProcess() {
+    // The previous session may have ended idle; handshakes want precise timers
+    WakeupScheduler::setThreadIdle(false);
+    auto connectionStep = [this](const std::string& info) {
+        handleInternalEvent("CONNECTING", info);
+        handleInternalLog(3, "Connection step: " + info);
     };
-    
-    for (const auto& [event, info] : connectionSteps) {
+
+    connectionStep("Resolving server address...");
+    const OvpnProfile profile = OvpnProfile::parse(currentConfig.view());
+    const std::string profileKey = std::to_string(std::hash<std::string_view>{}(currentConfig.view()));
+    if (profile.remotes().empty()) {
+        failConnection("CONNECTION_FAILED", "Configuration has no remote server");
+        return false;
+    }
+
+    connectionStep("Establishing TCP/UDP connection...");
+    std::optional<ImpairmentScenario> scenario;
+    std::vector<OvpnProfile::Remote> remotes = profile.remotes();
+    bool zeroCopy = false;
+    std::shared_ptr<MemoryBudget> budget;
+    std::optional<MultipathBond::Settings> multipathSettings;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        scenario = impairmentScenario;
+        zeroCopy = zeroCopySend;
+        budget = memoryBudget;
+        multipathSettings = multipath;
+        pathStats.clear();
+
+        if (!protoOverride.empty()) {
+            for (auto& remote : remotes) {
+                remote.proto = protoOverride;
+            }
+        }
+        // The override goes first; the profile's other remotes remain fallbacks
+        if (preferredRemote) {
+            std::erase_if(remotes, [this](const OvpnProfile::Remote& remote) {
+                return remote.host == preferredRemote->host && remote.port == preferredRemote->port &&
+                       remote.proto == preferredRemote->proto;
+            });
+            remotes.insert(remotes.begin(), *preferredRemote);
+        }
+    }
+
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    // Declared before the transport so the proxy outlives it
+    std::unique_ptr<ImpairmentProxy> impairmentProxy;
+    #endif
+    VpnTransport transport;
+    transport.setMemoryBudget(std::move(budget));
+
+    // A broken tls-auth / tls-crypt key or scramble line fails here instead
+    // of as a handshake timeout
+    std::unique_ptr<ControlWrap> controlWrap;
+    TransportChain layers;
+    try {
+        auto wrapKey = ControlWrap::keyFromProfile(profile);
+        if (wrapKey) {
+            controlWrap = std::make_unique<ControlWrap>(*wrapKey);
+        }
+        transport.setControlWrap(std::move(wrapKey));
+        layers = TransportChain::fromProfile(profile);
+    } catch (const std::exception& e) {
+        failConnection("CONNECTION_FAILED", e.what());
+        return false;
+    }
+    if (!layers.empty()) {
+        handleInternalLog(3, "Transport layers: " + layers.describe());
+    }
+    transport.setLayers(layers);
+
+    std::optional<OvpnProfile::Remote> activeRemote;
+    for (const auto& remote : remotes) {
         if (shouldStop) {
-            return;
+            return false;
         }
-        
-        handleInternalEvent(event, info);
-        handleInternalLog(3, "Connection step: " + info);
-        
-        // Simulate work
-        std::this_thread::sleep_for(std::chrono::milliseconds(800));
+
+        const auto protocol = VpnTransport::protocolFromString(remote.proto);
+        int family = VpnTransport::familyFromString(remote.proto);
+        std::string host = remote.host;
+        std::string port = remote.port;
+        if (protocol == VpnTransport::Protocol::Quic) {
+            // The remote is what the proxy forwards to; the proxy is connected to
+            auto quicSettings = QuicTunnel::settingsFromProfile(profile, remote);
+            host = quicSettings.proxyHost;
+            port = quicSettings.proxyPort;
+            transport.setQuicSettings(std::move(quicSettings));
+        }
+        // The uplinks' routes lead to the server, not to a loopback impairment proxy
+        const bool bonded = multipathSettings && protocol == VpnTransport::Protocol::Udp && !scenario;
+        if (multipathSettings && !bonded) {
+            handleInternalLog(2, scenario ? "Multipath uplinks are not used through an impairment scenario"
+                                          : "Multipath uplinks only apply to UDP; " + remote.proto + " uses the default route");
+        }
+        transport.setMultipath(bonded ? multipathSettings : std::nullopt);
+        #ifdef SIAVPN_HAVE_IMPAIRMENT
+        if (scenario) {
+            impairmentProxy = std::make_unique<ImpairmentProxy>(*scenario);
+            const auto proxied = protocol == VpnTransport::Protocol::Tcp ? protocol : VpnTransport::Protocol::Udp;
+            auto localPort = impairmentProxy->start(host, port, proxied);
+            if (!localPort) {
+                handleInternalLog(2, "Impairment proxy failed: " + impairmentProxy->getLastError());
+                continue;
+            }
+            handleInternalLog(2, "Routing " + host + ":" + port + " through impairment scenario '" +
+                                 scenario->name + "' on port " + std::to_string(*localPort));
+            host = "127.0.0.1";
+            port = std::to_string(*localPort);
+            family = AF_UNSPEC;
+        }
+        #endif
+
+        if (transport.open(host, port, protocol, family)) {
+            activeRemote = remote;
+            if (auto address = transport.remoteAddress()) {
+                handleInternalLog(3, "Connected to " + socketUtil::addressToString(*address));
+            }
+            if (protocol == VpnTransport::Protocol::Quic) {
+                handleInternalLog(3, "QUIC proxy tunnel to " + remote.host + ":" + remote.port + " established");
+            }
+            if (bonded) {
+                const auto paths = transport.pathStats();
+                std::string names;
+                for (const auto& path : paths) {
+                    names += (names.empty() ? "" : ", ") + path.interface;
+                }
+                handleInternalLog(3, "Bonding uplinks " + names);
+                if (paths.size() < multipathSettings->uplinks.size()) {
+                    handleInternalLog(2, "Uplinks left out: " + transport.getLastError());
+                }
+            }
+            std::lock_guard<std::mutex> lock(stateMutex);
+            serverAddress = transport.remoteAddress();
+            break;
+        }
+        handleInternalLog(2, "Remote " + remote.host + ":" + remote.port + " unavailable: " + transport.getLastError());
     }
-    
-    if (!shouldStop) {
-        handleInternalEvent("CONNECTED", "VPN tunnel established successfully");
-        handleInternalLog(3, "OpenVPN connection established");
-        
-        // Keep connection alive
-        while (!shouldStop) {
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (!activeRemote) {
+        failConnection("CONNECTION_FAILED", "No remote server reachable: " + transport.getLastError());
+        return false;
+    }
+    if (zeroCopy && !transport.enableZeroCopy()) {
+        handleInternalLog(2, "Zero-copy sends unavailable: " + transport.getLastError());
+    }
+
+    ControlChannel channel([&transport](std::span<const std::uint8_t> packet) {
+        return transport.send(packet);
+    });
+    channel.setWrap(std::move(controlWrap));
+    TlsHandshake handshake(verifyPool, sessionCache);
+    const auto connected = transport.remoteAddress();
+    auto settings = TlsHandshake::settingsFromProfile(profile, *activeRemote,
+                                                      connected ? connected->ss_family : AF_INET);
+
+    bool usingToken = false;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        settings.privateKeyPassword = privateKeyPassword;
+        if (autologinSessions) {
+            settings.peerInfo += "IV_AUTO_SESS=1\n";
+        }
+
+        // A live auth token wins; cached credentials cover reconnects without a fresh copy
+        auto cached = credentialCache.lookup(profileKey);
+        if (cached && (cached->usingToken || password.empty())) {
+            // With auth-nocache only the token is cached, so the name comes from the config
+            settings.username = cached->username.empty() ? username : std::move(cached->username);
+            settings.password = std::move(cached->password);
+            usingToken = cached->usingToken;
+        } else {
+            settings.username = username;
+            settings.password = password;
+        }
+
+        // A known RTT lets the first lost packet be retransmitted well before the 1s default
+        if (auto it = controlRtt.find(settings.serverKey); it != controlRtt.end()) {
+            channel.seedRtt(it->second);
+        }
+    }
+
+    const bool handshakeOk = handshake.run(transport, channel, settings, shouldStop, connectionStep);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        lastHandshakeTimings = handshake.timings();
+        if (channel.rttEstimator().hasSample()) {
+            controlRtt[settings.serverKey] = channel.rttEstimator();
+        }
+    }
+    handleInternalLog(3, "Handshake timings: " + handshake.timings().summary());
+
+    if (shouldStop) {
+        return false;
+    }
+    if (!handshakeOk) {
+        if (usingToken && handshake.failureEvent() == "AUTH_FAILED") {
+            // Expired or revoked token: drop it and authenticate with the password
+            credentialCache.forgetToken(profileKey);
+            handleInternalLog(2, "Auth token rejected, retrying with saved credentials");
+            return true;
+        }
+        failConnection(handshake.failureEvent(), handshake.getLastError());
+        return false;
+    }
+
+    if (!usingToken && !settings.password.empty() && !profile.hasDirective("auth-nocache")) {
+        credentialCache.storeCredentials(profileKey, settings.username, settings.password);
+    }
+    std::string pushReply = handshake.pushReply();
+    storePushedAuthToken(profileKey, pushReply);
+    storePushedDnsServers(pushReply);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        pushedIpv6 = !pushOption(pushReply, "ifconfig-ipv6").empty();
+    }
+
+    // The data channel carries the keepalive pings the server expects
+    std::unique_ptr<DataChannel> dataChannel;
+    // With layers the transport frames wrapped packets, so they are sealed
+    // unframed; QUIC datagrams are UDP packets to the server
+    const auto framing = layers.empty() && transport.protocol() == VpnTransport::Protocol::Tcp
+                             ? VpnTransport::Protocol::Tcp
+                             : VpnTransport::Protocol::Udp;
+    if (auto config = dataChannelConfig(profile, pushReply, framing)) {
+        try {
+            dataChannel = std::make_unique<DataChannel>(
+                *config, handshake.dataChannelKeys(channel.localSessionId(), channel.remoteSessionId()));
+        } catch (const std::exception& e) {
+            handleInternalLog(2, std::string("Data channel unavailable: ") + e.what());
+        }
+    } else {
+        handleInternalLog(2, "Data channel unavailable: server negotiated an unsupported cipher");
+    }
+    const auto pingInterval = pushSeconds(pushReply, "ping");
+    // How long the server keeps a silent session, as far as the client can tell
+    const auto restartInterval = pushSeconds(pushReply, "ping-restart");
+
+    // The device is up with the pushed addresses and routes before the
+    // session is reported connected
+    connectionStep("Configuring tunnel interface...");
+    handleInternalLog(4, "Push reply: " + redactPushReply(pushReply));
+    TunDevice tun;
+    {
+        const auto devArgs = profile.directiveArgs("dev");
+        const std::string dev = devArgs.empty() ? "tun" : devArgs[0];
+        std::vector<std::string> ignoredRoutes;
+        TunDevice::Settings tunSettings;
+        std::string tunError;
+        if (dev.starts_with("tap")) {
+            tunError = "dev " + dev + ": the built-in engine carries IP packets only (dev tun)";
+        } else {
+            try {
+                tunSettings = tunnelSettings(profile, pushReply, ignoredRoutes);
+                tunSettings.server = transport.remoteAddress();
+            } catch (const std::exception& e) {
+                tunError = e.what();
+            }
+        }
+        secureWipe(pushReply.data(), pushReply.size());
+        if (tunError.empty() && (!tun.open(dev) || !tun.configure(tunSettings))) {
+            tunError = tun.getLastError();
+        }
+        if (!tunError.empty()) {
+            failConnection("CONNECTION_FAILED", "Tunnel device: " + tunError);
+            return false;
+        }
+        for (const auto& route : ignoredRoutes) {
+            handleInternalLog(2, "Ignoring " + route + ": only numeric IPv4 networks are routed");
+        }
+        std::string summary;
+        for (const auto& address : tunSettings.addresses) {
+            summary += (summary.empty() ? "" : ", ") + address.local + (address.peer.empty() ? "" : " peer " + address.peer);
+        }
+        for (const auto& route : tunSettings.routes) {
+            summary += ", route " + route;
+        }
+        handleInternalLog(3, "Tunnel device " + tun.name() + " (mtu " + std::to_string(tun.mtu()) + "): " + summary);
+        std::lock_guard<std::mutex> lock(stateMutex);
+        tunnelName = tun.name();
+    }
+
+    handleInternalEvent("CONNECTED", "VPN tunnel established successfully");
+    handleInternalLog(3, "OpenVPN connection established");
+
+    // Keep the control channel serviced (ACKs, retransmits, server messages)
+    // and the data channel alive
+    std::vector<std::vector<std::uint8_t>> packets;
+    std::vector<std::uint8_t> dataBuffer(65535 + DataChannel::maxOverhead);
+
+    // The thread only wakes for packets and timer windows. Once idle, a
+    // keepalive may go out up to a quarter interval early to share a wakeup,
+    // and stats are sampled whenever the thread is up anyway.
+    bool coalesce = true;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        coalesce = idleCoalescing;
+    }
+    bool idle = false;
+    auto lastActivity = std::chrono::steady_clock::now();
+    auto pathStatsAt = lastActivity;
+    auto armKeepalive = [&](std::chrono::steady_clock::time_point lastSent) {
+        if (dataChannel && pingInterval.count() > 0) {
+            wakeups.arm(WakeupScheduler::Timer::Keepalive, lastSent + pingInterval,
+                        idle ? std::chrono::steady_clock::duration(pingInterval / 4) : std::chrono::steady_clock::duration{});
+        }
+    };
+    auto armStatsSample = [&](std::chrono::steady_clock::time_point now) {
+        wakeups.arm(WakeupScheduler::Timer::StatsSample, now + statsSampleInterval, {},
+                    coalesce ? statsSampleSlack : std::chrono::steady_clock::duration{});
+    };
+    armKeepalive(lastActivity);
+    armStatsSample(lastActivity);
+    wakeups.restartMeasurement(lastActivity);
+
+    // produce writes the payload (a packet read from the TUN device, or a
+    // ping) straight into the send buffer at DataChannel::headroom and
+    // returns its length; it is sealed where it lies and sent from there. The
+    // buffer is a pooled one, or dataBuffer when none is free or a pooled one
+    // has less than needed bytes of room, so no payload is ever copied on the
+    // way out.
+    auto sendData = [&](const auto& produce, std::size_t needed) {
+        auto index = transport.acquireBuffer();
+        std::span<std::uint8_t> buffer(dataBuffer);
+        if (index) {
+            // Room for the transport layers or QUIC around what DataChannel needs
+            auto pooled = transport.pooledBuffer(*index);
+            pooled = pooled.subspan(transport.sendHeadroom(), pooled.size() - transport.sendHeadroom() - transport.sendTailroom());
+            if (pooled.size() >= DataChannel::headroom + needed + DataChannel::tailroom) {
+                buffer = pooled;
+            } else {
+                transport.releaseBuffer(*index);
+                index.reset();
+            }
+        }
+        std::span<std::uint8_t> wire;
+        if (buffer.size() > DataChannel::headroom + DataChannel::tailroom) {
+            const std::size_t length = produce(
+                buffer.subspan(DataChannel::headroom, buffer.size() - DataChannel::headroom - DataChannel::tailroom));
+            if (length > 0) {
+                wire = dataChannel->sealInPlace(buffer, length);
+            }
+        }
+        if (index) {
+            if (!wire.empty()) {
+                return transport.sendPooled(*index, wire);
+            }
+            transport.releaseBuffer(*index);
+            return false;
+        }
+        if (wire.empty()) {
+            return false;
+        }
+        return layers.empty() ? transport.sendWire(wire) : transport.send(wire);
+    };
+    auto producePing = [](std::span<std::uint8_t> room) -> std::size_t {
+        const auto ping = DataChannel::pingPayload();
+        if (room.size() < ping.size()) {
+            return 0;
+        }
+        std::ranges::copy(ping, room.begin());
+        return ping.size();
+    };
+    // The wait also ends when the system routes a packet into the tunnel
+    std::vector<socketUtil::SocketHandle> waitHandles(wakeups.wakeHandles().begin(), wakeups.wakeHandles().end());
+    waitHandles.push_back(tun.handle());
+
+    while (!shouldStop) {
+        if (pauseRequested) {
+            // Nothing is sent or read while paused and no timer runs: the
+            // thread sleeps without a timeout and the buffers go back down to
+            // their floor. The TLS session, data channel keys and replay state
+            // stay here, so resuming skips the handshake.
+            const auto pausedAt = std::chrono::steady_clock::now();
+            wakeups.restartMeasurement(pausedAt);
+            packets.clear();
+            packets.shrink_to_fit();
+            dataBuffer.clear();
+            dataBuffer.shrink_to_fit();
+            transport.trimBuffers();
+            handshake.releaseBuffers();
+            #ifdef __GLIBC__
+            // glibc keeps freed heap pages mapped until asked
+            malloc_trim(0);
+            #endif
+            handleInternalEvent("PAUSED", "Connection paused");
+            handleInternalLog(3, std::format("OpenVPN client paused, {} bytes of transport buffers kept",
+                                             transport.bufferedBytes()));
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                paused = true;
+                pauseCv.wait(lock, [this] { return !pauseRequested || shouldStop; });
+                paused = false;
+            }
+            if (shouldStop) {
+                break;
+            }
+
+            dataBuffer.resize(65535 + DataChannel::maxOverhead);
+            const auto pausedFor = std::chrono::steady_clock::now() - pausedAt;
+            if (restartInterval.count() > 0 && pausedFor >= restartInterval) {
+                // The server has dropped the session by now; a reconnect still
+                // resumes the TLS session and uses the auth token
+                handleInternalLog(3, std::format("Paused for {}s, longer than the server's ping-restart; reconnecting",
+                                                 std::chrono::duration_cast<std::chrono::seconds>(pausedFor).count()));
+                return true;
+            }
+            // Ping right away so the server sees the client again before anything else
+            const auto resumedAt = std::chrono::steady_clock::now();
+            armKeepalive(resumedAt - pingInterval);
+            armStatsSample(resumedAt);
+            wakeups.restartMeasurement(resumedAt);
+            handleInternalEvent("RESUMED", "Connection resumed");
+            handleInternalLog(3, "OpenVPN client resumed");
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (wakeups.fire(WakeupScheduler::Timer::Keepalive, now)) {
+            sendData(producePing, DataChannel::pingPayload().size());
+            armKeepalive(now);
+        }
+        if (wakeups.fire(WakeupScheduler::Timer::StatsSample, now)) {
+            if (dataChannel) {
+                const auto stats = dataChannel->stats();
+                handleInternalLog(4, std::format("{}: {:.1f} wakeups/min, data channel {} sent, {} received",
+                                                 idle ? "Idle" : "Active", wakeups.wakeupsPerMinute(now),
+                                                 stats.sealed, stats.opened));
+            }
+            armStatsSample(now);
+        }
+        if (const auto controlDue = channel.nextWakeup(); controlDue != std::chrono::steady_clock::time_point::max()) {
+            wakeups.arm(WakeupScheduler::Timer::Control, controlDue, {},
+                        coalesce ? controlTimerSlack : std::chrono::steady_clock::duration{});
+        } else {
+            wakeups.disarm(WakeupScheduler::Timer::Control);
+        }
+
+        const std::size_t received = transport.receiveBatch(packets, wakeups.waitTime(now), waitHandles);
+        now = std::chrono::steady_clock::now();
+        wakeups.recordWakeup(now);
+        if (wakeups.consumeWakeEvents()) {
+            // Mostly a resume from suspend: NAT bindings may be gone, so the server hears from us now
+            handleInternalLog(3, "System clock changed; sending a keepalive");
+            armKeepalive(now - pingInterval);
+        }
+        for (std::size_t i = 0; i < received; ++i) {
+            if (ControlChannel::isControlPacket(packets[i])) {
+                channel.processIncoming(packets[i]);
+                lastActivity = now;
+            } else if (dataChannel) {
+                // Opened payloads go to the system through the device; pings end here
+                auto length = dataChannel->open(packets[i], dataBuffer);
+                if (length && *length > 0 && !DataChannel::isPing(std::span(dataBuffer.data(), *length))) {
+                    tun.write(std::span(dataBuffer.data(), *length));
+                    lastActivity = now;
+                }
+            }
+        }
+        // Outbound packets, each read from the device into a send buffer and
+        // sealed there. A batch per wakeup keeps a busy device from starving
+        // the server's side; the next wait returns at once for the rest.
+        bool tunFailed = false;
+        for (std::size_t i = 0; i < tunReadBatch; ++i) {
+            std::size_t length = 0;
+            auto readTun = [&](std::span<std::uint8_t> room) -> std::size_t {
+                const auto read = tun.read(room);
+                tunFailed = !read;
+                length = read.value_or(0);
+                return length;
+            };
+            if (dataChannel) {
+                sendData(readTun, static_cast<std::size_t>(tun.mtu()));
+            } else {
+                readTun(dataBuffer);  // nothing to seal with; dropped
+            }
+            if (length == 0) {
+                break;
+            }
+            lastActivity = now;
+        }
+        if (tunFailed) {
+            failConnection("CONNECTION_FAILED", tun.getLastError());
+            return false;
+        }
+        if (now - pathStatsAt >= pathStatsRefresh && transport.reorderStats()) {
+            pathStatsAt = now;
+            std::lock_guard<std::mutex> lock(stateMutex);
+            pathStats = transport.pathStats();
+        }
+        if (const bool quiet = coalesce && now - lastActivity >= idleAfter; quiet != idle) {
+            idle = quiet;
+            WakeupScheduler::setThreadIdle(idle);
+            handleInternalLog(4, idle ? "Tunnel idle: coalescing timers" : "Tunnel active");
+        }
+        if (received == 0 && !transport.isOpen()) {
+            failConnection("CONNECTION_FAILED", "Transport closed: " + transport.getLastError());
+            return false;
+        }
+
+        try {
+            for (auto& message : handshake.pollMessages(channel)) {
+                // Servers renew auth tokens with a fresh PUSH_REPLY
+                if (message.starts_with("PUSH_REPLY")) {
+                    storePushedAuthToken(profileKey, message);
+                    secureWipe(message.data(), message.size());
+                    continue;
+                }
+                handleControlMessage(message);
+            }
+        } catch (const std::exception& e) {
+            failConnection("TLS_ERROR", e.what());
+            return false;
+        }
+        channel.service(now);
+    }
+
+    if (const ControlWrap* wrap = channel.controlWrap()) {
+        const auto stats = wrap->stats();
+        handleInternalLog(3, std::format("Control channel filter: {} accepted, {} malformed, {} for other sessions, "
+                                         "{} failed authentication, {} replayed",
+                                         stats.accepted, stats.malformed, stats.foreignSession, stats.authFailures,
+                                         stats.replays));
+    }
+    if (dataChannel) {
+        const auto stats = dataChannel->stats();
+        handleInternalLog(3, std::format("Data channel: {} sent, {} received, {} failed authentication, {} replayed",
+                                         stats.sealed, stats.opened, stats.authFailures, stats.replays));
+    }
+    if (const auto stats = tun.stats(); stats.packetsRead > 0 || stats.packetsWritten > 0) {
+        handleInternalLog(3, std::format("Tunnel device {}: {} packets read, {} written, {} refused by the system",
+                                         tun.name(), stats.packetsRead, stats.packetsWritten, stats.writeErrors));
+    }
+    if (const auto stats = transport.dataPathStats(); stats.pooledSends > 0) {
+        handleInternalLog(3, std::format("Data path: {} sent in place ({} zero-copy, {} copied by the kernel), "
+                                         "{} copied for lack of a free buffer",
+                                         stats.pooledSends, stats.zeroCopySends, stats.kernelCopied, stats.poolExhausted));
+    }
+    if (const auto stats = transport.quicStats()) {
+        handleInternalLog(3, std::format("QUIC: {} packets sent, {} received, {} lost; {} datagrams sent, {} received, "
+                                         "{} dropped; {} key updates, {} migrations, smoothed RTT {} us",
+                                         stats->packetsSent, stats->packetsReceived, stats->packetsLost,
+                                         stats->datagramsSent, stats->datagramsReceived, stats->datagramsDropped,
+                                         stats->keyUpdates, stats->migrations, stats->smoothedRtt.count()));
+    }
+    for (const auto& path : transport.pathStats()) {
+        handleInternalLog(3, std::format("Path {}: {}, RTT {} us; {} packets ({} bytes) sent, {} ({} bytes) received; "
+                                         "{} of {} probes answered, {} send errors, down {} times",
+                                         path.interface, path.up ? "up" : "down", path.rtt.count(),
+                                         path.packetsSent, path.bytesSent, path.packetsReceived, path.bytesReceived,
+                                         path.probesAnswered, path.probesSent, path.sendErrors, path.timesDown));
+    }
+    if (const auto stats = transport.reorderStats()) {
+        handleInternalLog(3, std::format("Multipath reordering: {} held back, {} packet ids skipped, {} late",
+                                         stats->held, stats->skipped, stats->late));
+        std::lock_guard<std::mutex> lock(stateMutex);
+        pathStats = transport.pathStats();
+    }
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    if (impairmentProxy) {
+        const auto stats = impairmentProxy->stats();
+        handleInternalLog(3, std::format("Impairment up: {} packets, {} dropped, {} duplicated, {} reordered; "
+                                         "down: {} packets, {} dropped, {} duplicated, {} reordered",
+                                         stats.upstream.packets, stats.upstream.dropped + stats.upstream.queueDrops,
+                                         stats.upstream.duplicated, stats.upstream.reordered,
+                                         stats.downstream.packets, stats.downstream.dropped + stats.downstream.queueDrops,
+                                         stats.downstream.duplicated, stats.downstream.reordered));
+    }
+    #endif
+    return false;
+}
+
+void OpenVpnClient::failConnection(const std::string& eventName, const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        lastError = error;
+        isRunning = false;
+    }
+    handleInternalEvent(eventName, error);
+    handleInternalLog(1, "OpenVPN connection failed: " + error);
+}
+
+void OpenVpnClient::handleControlMessage(const std::string& message) {
+    if (message.starts_with("AUTH_FAILED")) {
+        failConnection("AUTH_FAILED", message);
+        shouldStop = true;
+    } else if (message.starts_with("RESTART") || message.starts_with("HALT")) {
+        handleInternalEvent("CLIENT_RESTART", message);
+        handleInternalLog(2, "Server requested " + message);
+    } else {
+        handleInternalLog(4, "Control message: " + message);
+    }
+}
+
+void OpenVpnClient::storePushedAuthToken(const std::string& profileKey, const std::string& pushReply) {
+    bool enabled = false;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        enabled = autologinSessions;
+    }
+    if (!enabled) {
+        return;
+    }
+
+    auto token = pushOption(pushReply, "auth-token");
+    if (!token.empty()) {
+        credentialCache.storeAuthToken(profileKey, token, pushOption(pushReply, "auth-token-user"));
+        handleInternalLog(3, "Server issued an auth token for reconnects");
+    }
+}
+
+void OpenVpnClient::storePushedDnsServers(const std::string& pushReply) {
+    std::vector<std::string> servers;
+    auto addServer = [&servers](std::string_view address) {
+        // "[2001:db8::1]:53" and "10.8.0.1:53" carry ports; resolvers are always asked on 53
+        if (address.starts_with('[')) {
+            address = address.substr(1, address.find(']') - 1);
+        } else if (address.find(':') == address.rfind(':') && address.find(':') != std::string_view::npos) {
+            address = address.substr(0, address.find(':'));
+        }
+        if (!address.empty() && std::find(servers.begin(), servers.end(), address) == servers.end()) {
+            servers.emplace_back(address);
+        }
+    };
+
+    for (auto value : pushOptions(pushReply, "dhcp-option")) {
+        std::istringstream fields{std::string(value)};
+        std::string kind, address;
+        if (fields >> kind >> address && (kind == "DNS" || kind == "DNS6")) {
+            addServer(address);
         }
     }
+    // OpenVPN 2.6 style: "dns server <priority> address <addr> [<addr> ...]"
+    for (auto value : pushOptions(pushReply, "dns")) {
+        std::istringstream fields{std::string(value)};
+        std::string server, priority, keyword, address;
+        if (fields >> server >> priority >> keyword && server == "server" && keyword == "address") {
+            while (fields >> address) {
+                addServer(address);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    pushedDnsServers = std::move(servers);
 }
 
 void OpenVpnClient::handleInternalEvent(const std::string& eventName, const std::string& info) {
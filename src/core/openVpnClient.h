@@ -1,5 +1,15 @@
 #pragma once
 import std;
+#include "credentialCache.h"
+#include "memoryBudget.h"
+#include "multipathBond.h"
+#include "networkImpairment.h"
+#include "ovpnProfile.h"
+#include "secureMemory.h"
+#include "socketUtil.h"
+#include "tlsHandshake.h"
+#include "wakeupScheduler.h"
+#include "workerPool.h"
 
 class OpenVpnClient {
 public:
@@ -7,7 +17,7 @@ public:
     ~OpenVpnClient();
 
     // Core OpenVPN operations
-    bool startConnection(const std::string& configContent);
+    bool startConnection(std::string_view configContent);
     void stopConnection();
     void pauseConnection();
     void resumeConnection();
@@ -15,15 +25,63 @@ public:
     
     // Status
     bool isConnected() const;
+    // Parked by pauseConnection(): no traffic, no timers, session keys kept
+    bool isPaused() const;
     std::string getLastError() const;
+    HandshakeTimings getHandshakeTimings() const;
+    // Resolvers pushed by the server (dhcp-option DNS/DNS6, dns server ... address)
+    std::vector<std::string> getPushedDnsServers() const;
+    // Address the transport reached the server on, and whether the server pushed
+    // an IPv6 tunnel address (ifconfig-ipv6); IPv6 must not bypass a v4-only tunnel
+    std::optional<sockaddr_storage> getServerAddress() const;
+    bool tunnelCarriesIpv6() const;
+    // TUN device of the current session ("tun0"); empty until it is configured
+    std::string getTunnelInterface() const;
+    // Wakeups of the connection thread over the last minute; 0 while paused
+    double getWakeupsPerMinute() const;
+    // Per-uplink counters of a multipath connection, refreshed about once a second; empty otherwise
+    std::vector<MultipathBond::PathStats> getPathStats() const;
+
+    // Credentials for auth-user-pass and encrypted keys; kept in the secure arena
+    void setCredentials(const SecureString& username, const SecureString& password,
+                        const SecureString& privateKeyPassword);
+    // Autologin sessions advertise IV_AUTO_SESS and reconnect with server-pushed auth tokens
+    void setAuthCachePolicy(bool autologinSessions, std::chrono::seconds lifetime);
+    // Wipes credentials, auth tokens, the stored profile and cached TLS sessions
+    void clearSensitiveData();
+
+    // Tries this remote of the profile first (server/port/proto override); nullopt restores profile order
+    void setPreferredRemote(std::optional<OvpnProfile::Remote> remote);
+    // Connects every remote with this proto ("udp", "tcp", "quic", ...); empty keeps the profile's
+    void setProtoOverride(std::string proto);
+
+    // Bonds the uplinks for UDP remotes (see MultipathBond); nullopt uses the default route
+    void setMultipath(std::optional<MultipathBond::Settings> settings);
+
+    // Sends data channel packets with MSG_ZEROCOPY from the buffers they were sealed in
+    void setZeroCopySend(bool enabled);
+
+    // Once the tunnel has been idle for a while, lets keepalives and stats
+    // sampling share wakeups and raises the thread's timer slack
+    void setIdleCoalescing(bool enabled);
+
+    // Caps transport buffers of the next connections; see MemoryBudget
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+
+    // Routes the next connections through a loopback impairment proxy (testing aid)
+    void setImpairmentScenario(std::optional<ImpairmentScenario> scenario);
 
     // Event subscription
     void setEventHandler(std::function<void(const std::string&, const std::string&)> handler);
     void setLogHandler(std::function<void(int, const std::string&)> handler);
 
 private:
-    // Internal OpenVPN client implementation
-    void simulateConnectionProcess();
+    // Internal OpenVPN client implementation; true asks for an immediate retry
+    bool runConnectionProcess();
+    void failConnection(const std::string& eventName, const std::string& error);
+    void handleControlMessage(const std::string& message);
+    void storePushedAuthToken(const std::string& profileKey, const std::string& pushReply);
+    void storePushedDnsServers(const std::string& pushReply);
     void handleInternalEvent(const std::string& eventName, const std::string& info);
     void handleInternalLog(int level, const std::string& message);
 
@@ -32,9 +90,36 @@ private:
     
     std::atomic<bool> isRunning{false};
     std::atomic<bool> shouldStop{false};
+    std::atomic<bool> pauseRequested{false};
+    bool paused = false;
+    std::condition_variable pauseCv;  // the paused connection thread waits here
+    WakeupScheduler wakeups;          // timers of the connected loop; interrupted by pause and stop
     std::thread connectionThread;
     std::string lastError;
-    std::string currentConfig;
+    SecureString currentConfig;  // profile text, may inline the private key
+    SecureString username;
+    SecureString password;
+    SecureString privateKeyPassword;
+    bool autologinSessions = true;
+    bool zeroCopySend = false;
+    bool idleCoalescing = true;
+    std::shared_ptr<MemoryBudget> memoryBudget;
+    HandshakeTimings lastHandshakeTimings;
+    std::vector<std::string> pushedDnsServers;
+    std::optional<sockaddr_storage> serverAddress;
+    bool pushedIpv6 = false;
+    std::string tunnelName;
+    std::optional<ImpairmentScenario> impairmentScenario;
+    std::optional<OvpnProfile::Remote> preferredRemote;
+    std::string protoOverride;
+    std::optional<MultipathBond::Settings> multipath;
+    std::vector<MultipathBond::PathStats> pathStats;
+
+    // Shared across reconnects so resumption, RTT estimates and warm workers survive
+    WorkerPool verifyPool{2};
+    TlsSessionCache sessionCache;
+    CredentialCache credentialCache;
+    std::map<std::string, RttEstimator> controlRtt;
     
     mutable std::mutex stateMutex;
-};
\ No newline at end of file
+};
@@ -19,6 +19,17 @@ public:
     void resume();
     void reconnect();
     void allowCommunicationWithoutVpn();
+    // Engine carrying the connection ("userspace", "openvpn3", ...), chosen per profile
+    std::string activeBackend() const;
+    // Stored profiles, for search and import
+    VpnConfigManager& profileStore();
+
+    // Per-application split tunneling, applied whenever the tunnel comes up
+    void setSplitTunnelMode(SplitTunnel::Mode mode);
+    bool addSplitTunnelApp(int pid);
+    bool removeSplitTunnelApp(int pid);
+    bool addSplitTunnelDomain(const std::string& pattern, SplitTunnel::DomainRoute route);
+    void removeSplitTunnelDomain(const std::string& pattern);
 
 private:
     std::unique_ptr<VpnConnectionManager> connectionManager;
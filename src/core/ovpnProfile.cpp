@@ -0,0 +1,190 @@
+import std;
+#include "ovpnProfile.h"
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+    const auto first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    const auto last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+std::vector<std::string> splitWords(std::string_view line) {
+    std::vector<std::string> words;
+    std::size_t pos = 0;
+    while (pos < line.size()) {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        const auto end = line.find_first_of(" \t", pos);
+        words.emplace_back(line.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+        pos = end;
+    }
+    return words;
+}
+
+// Inline blocks with private keys, static keys or credentials
+constexpr std::array<std::string_view, 8> secretTags{
+    "key", "pkcs12", "secret", "tls-auth", "tls-crypt", "tls-crypt-v2", "auth-user-pass", "http-proxy-user-pass"};
+
+} // namespace
+
+OvpnProfile OvpnProfile::parse(std::string_view content) {
+    return parse(content, true);
+}
+
+OvpnProfile OvpnProfile::parseDirectives(std::string_view content) {
+    return parse(content, false);
+}
+
+bool OvpnProfile::isSecretBlock(std::string_view tag) {
+    return std::find(secretTags.begin(), secretTags.end(), tag) != secretTags.end();
+}
+
+OvpnProfile OvpnProfile::parse(std::string_view content, bool keepBlocks) {
+    OvpnProfile profile;
+    std::string currentBlock;
+    std::size_t blockStart = 0;
+    std::string globalProto = "udp";
+    std::string globalPort = "1194";
+
+    std::size_t lineStart = 0;
+    while (lineStart <= content.size()) {
+        auto lineEnd = content.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) {
+            lineEnd = content.size();
+        }
+        const auto rawLine = content.substr(lineStart, lineEnd - lineStart);
+        const auto line = trim(rawLine);
+        lineStart = lineEnd + 1;
+
+        // Inside an inline block everything up to the closing tag is payload,
+        // taken straight from content so secrets are never copied to the heap
+        if (!currentBlock.empty()) {
+            if (line == "</" + currentBlock + ">") {
+                const auto payload = content.substr(blockStart, rawLine.data() - content.data() - blockStart);
+                if (keepBlocks && isSecretBlock(currentBlock)) {
+                    profile.secretBlocks.insert_or_assign(currentBlock, SecureString(payload));
+                } else if (keepBlocks) {
+                    profile.inlineBlocks[currentBlock] = std::string(payload);
+                }
+                currentBlock.clear();
+            }
+            continue;
+        }
+
+        if (line.empty() || line.front() == '#' || line.front() == ';') {
+            continue;
+        }
+
+        // <ca sha256="..."/> in a stored manifest references a block kept
+        // elsewhere; the block's original closing tag line follows it
+        if (line.ends_with("/>") || line.starts_with("</")) {
+            continue;
+        }
+
+        if (line.size() > 2 && line.front() == '<' && line.back() == '>' && line[1] != '/') {
+            currentBlock = std::string(line.substr(1, line.size() - 2));
+            blockStart = std::min(lineStart, content.size());
+            continue;
+        }
+
+        auto words = splitWords(line);
+        if (words.empty()) {
+            continue;
+        }
+
+        const std::string name = words.front();
+        words.erase(words.begin());
+
+        if (name == "remote" && !words.empty()) {
+            Remote remote{words[0], {}, {}};
+            if (words.size() > 1) {
+                remote.port = words[1];
+            }
+            if (words.size() > 2) {
+                remote.proto = words[2];
+            }
+            profile.remoteList.push_back(std::move(remote));
+        } else if (name == "proto" && !words.empty()) {
+            globalProto = words[0];
+        } else if (name == "port" && !words.empty()) {
+            globalPort = words[0];
+        } else if (name == "setenv" && words.size() > 1) {
+            profile.environmentValues.try_emplace(words[0], words[1]);
+        }
+
+        // First occurrence wins, matching OpenVPN for single-valued options;
+        // repeatable ones (route, ...) are read from every occurrence
+        profile.occurrences[name].push_back(words);
+        profile.directives.try_emplace(name, std::move(words));
+    }
+
+    // Remotes without an explicit port/proto inherit the global settings
+    for (auto& remote : profile.remoteList) {
+        if (remote.port.empty()) {
+            remote.port = globalPort;
+        }
+        if (remote.proto.empty()) {
+            remote.proto = globalProto;
+        }
+    }
+
+    return profile;
+}
+
+const std::vector<OvpnProfile::Remote>& OvpnProfile::remotes() const {
+    return remoteList;
+}
+
+bool OvpnProfile::hasDirective(const std::string& name) const {
+    return directives.contains(name);
+}
+
+std::vector<std::string> OvpnProfile::directiveArgs(const std::string& name) const {
+    auto it = directives.find(name);
+    if (it == directives.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+std::vector<std::vector<std::string>> OvpnProfile::directiveOccurrences(const std::string& name) const {
+    auto it = occurrences.find(name);
+    if (it == occurrences.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+bool OvpnProfile::hasInlineBlock(const std::string& tag) const {
+    return inlineBlocks.contains(tag) || secretBlocks.contains(tag);
+}
+
+std::string OvpnProfile::inlineBlock(const std::string& tag) const {
+    auto it = inlineBlocks.find(tag);
+    if (it == inlineBlocks.end()) {
+        return {};
+    }
+    return it->second;
+}
+
+SecureString OvpnProfile::secretBlock(const std::string& tag) const {
+    if (auto it = secretBlocks.find(tag); it != secretBlocks.end()) {
+        return it->second;
+    }
+    auto it = inlineBlocks.find(tag);
+    return it == inlineBlocks.end() ? SecureString() : SecureString(it->second);
+}
+
+std::string OvpnProfile::environment(const std::string& name) const {
+    auto it = environmentValues.find(name);
+    if (it == environmentValues.end()) {
+        return {};
+    }
+    return it->second;
+}
@@ -0,0 +1,44 @@
+#pragma once
+import std;
+#include "secureMemory.h"
+
+// Minimal .ovpn parser: directives, remotes and inline <tag> blocks.
+// It does not interpret options beyond what the client needs to connect.
+// Blocks holding keys or credentials (<key>, <tls-crypt>, <auth-user-pass>,
+// ...) are kept in the secure arena and only handed out as SecureString.
+class OvpnProfile {
+public:
+    struct Remote {
+        std::string host;
+        std::string port = "1194";
+        std::string proto = "udp";
+    };
+
+    static OvpnProfile parse(std::string_view content);
+    // Directives and remotes only; inline blocks are skipped without a copy.
+    // For callers that never look at keys or certificates.
+    static OvpnProfile parseDirectives(std::string_view content);
+    static bool isSecretBlock(std::string_view tag);
+
+    const std::vector<Remote>& remotes() const;
+    bool hasDirective(const std::string& name) const;
+    std::vector<std::string> directiveArgs(const std::string& name) const;
+    // Arguments of every occurrence, in profile order, for options that repeat (route, route-ipv6)
+    std::vector<std::vector<std::string>> directiveOccurrences(const std::string& name) const;
+    bool hasInlineBlock(const std::string& tag) const;
+    // Empty for secret blocks; those come from secretBlock
+    std::string inlineBlock(const std::string& tag) const;
+    SecureString secretBlock(const std::string& tag) const;
+    // Value of "setenv <name> <value>"; empty when the profile does not set it
+    std::string environment(const std::string& name) const;
+
+private:
+    static OvpnProfile parse(std::string_view content, bool keepBlocks);
+
+    std::vector<Remote> remoteList;
+    std::map<std::string, std::vector<std::string>> directives;
+    std::map<std::string, std::vector<std::vector<std::string>>> occurrences;
+    std::map<std::string, std::string> inlineBlocks;
+    std::map<std::string, SecureString> secretBlocks;
+    std::map<std::string, std::string> environmentValues;
+};
@@ -0,0 +1,95 @@
+import std;
+#include "packetPool.h"
+
+namespace {
+
+constexpr std::size_t buffersPerChunk = 16;
+
+} // namespace
+
+PacketPool::PacketPool(std::size_t bufferCount, std::size_t bufferSize)
+    : count(bufferCount)
+    , size(bufferSize) {
+}
+
+PacketPool::~PacketPool() {
+    setBudget(nullptr);
+}
+
+void PacketPool::setBudget(std::shared_ptr<MemoryBudget> newBudget) {
+    const std::size_t held = allocatedBytes();
+    if (budget) {
+        budget->release(MemoryBudget::Subsystem::PacketPool, held);
+    }
+    budget = std::move(newBudget);
+    if (budget && held > 0) {
+        budget->reserveUpTo(MemoryBudget::Subsystem::PacketPool, 1, held);
+    }
+}
+
+std::optional<std::uint32_t> PacketPool::acquire() {
+    if (freeList.empty() && chunks.size() * buffersPerChunk < count) {
+        // Not zero-filled: pages only become resident once a packet lands in them
+        const std::size_t first = chunks.size() * buffersPerChunk;
+        const std::size_t buffers = std::min(buffersPerChunk, count - first);
+        if (budget && !budget->tryReserve(MemoryBudget::Subsystem::PacketPool, buffers * size)) {
+            return std::nullopt;
+        }
+        chunks.push_back(std::make_unique_for_overwrite<std::uint8_t[]>(buffers * size));
+        chunkInUse.push_back(0);
+        // Lowest index on top, so a lightly used pool keeps touching the same pages
+        for (std::size_t i = first + buffers; i > first; --i) {
+            freeList.push_back(static_cast<std::uint32_t>(i - 1));
+        }
+    }
+    if (freeList.empty()) {
+        return std::nullopt;
+    }
+    const std::uint32_t index = freeList.back();
+    freeList.pop_back();
+    ++chunkInUse[index / buffersPerChunk];
+    return index;
+}
+
+void PacketPool::release(std::uint32_t index) {
+    freeList.push_back(index);
+    --chunkInUse[index / buffersPerChunk];
+}
+
+void PacketPool::reset() {
+    freeList.clear();
+    std::fill(chunkInUse.begin(), chunkInUse.end(), std::size_t{0});
+    for (std::size_t i = std::min(chunks.size() * buffersPerChunk, count); i > 0; --i) {
+        freeList.push_back(static_cast<std::uint32_t>(i - 1));
+    }
+}
+
+void PacketPool::trim(std::size_t floorBuffers) {
+    const std::size_t floorChunks = (floorBuffers + buffersPerChunk - 1) / buffersPerChunk;
+    while (chunks.size() > floorChunks && chunkInUse.back() == 0) {
+        const std::size_t first = (chunks.size() - 1) * buffersPerChunk;
+        std::erase_if(freeList, [first](std::uint32_t index) { return index >= first; });
+        if (budget) {
+            budget->release(MemoryBudget::Subsystem::PacketPool, (std::min(count, first + buffersPerChunk) - first) * size);
+        }
+        chunks.pop_back();
+        chunkInUse.pop_back();
+    }
+}
+
+std::span<std::uint8_t> PacketPool::buffer(std::uint32_t index) {
+    return {chunks[index / buffersPerChunk].get() + (index % buffersPerChunk) * size, size};
+}
+
+std::size_t PacketPool::bufferSize() const {
+    return size;
+}
+
+std::size_t PacketPool::available() const {
+    const std::size_t allocated = std::min(chunks.size() * buffersPerChunk, count);
+    return freeList.size() + (count - allocated);
+}
+
+std::size_t PacketPool::allocatedBytes() const {
+    return std::min(chunks.size() * buffersPerChunk, count) * size;
+}
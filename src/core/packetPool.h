@@ -0,0 +1,44 @@
+#pragma once
+import std;
+#include "memoryBudget.h"
+
+// Fixed-size buffers for the data path. A packet is built inside one (read
+// from the tunnel device at the data channel's headroom, sealed in place)
+// and sent straight from it, so the payload is never copied in user space.
+// Memory is taken in chunks as traffic needs it, up to bufferCount buffers,
+// and trim() hands idle chunks back. With a memory budget a chunk is only
+// taken if its PacketPool share allows, and acquire() runs dry earlier.
+// Owned by one connection thread; not synchronized.
+class PacketPool {
+public:
+    PacketPool(std::size_t bufferCount, std::size_t bufferSize);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Charges chunks held now and later to budget; nullptr stops accounting
+    void setBudget(std::shared_ptr<MemoryBudget> budget);
+
+    // nullopt while every buffer is in use (e.g. waiting for zero-copy completions)
+    std::optional<std::uint32_t> acquire();
+    void release(std::uint32_t index);
+    // Marks every buffer free again, e.g. after the socket using them closed
+    void reset();
+    // Frees trailing chunks without a buffer in use, keeping at least floorBuffers
+    void trim(std::size_t floorBuffers);
+
+    std::span<std::uint8_t> buffer(std::uint32_t index);
+
+    std::size_t bufferSize() const;
+    std::size_t available() const;
+    std::size_t allocatedBytes() const;
+
+private:
+    std::size_t count;
+    std::size_t size;
+    std::vector<std::unique_ptr<std::uint8_t[]>> chunks;
+    std::vector<std::size_t> chunkInUse;
+    std::vector<std::uint32_t> freeList;
+    std::shared_ptr<MemoryBudget> budget;
+};
@@ -0,0 +1,133 @@
+import std;
+#include "processUtil.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace processUtil {
+
+namespace {
+
+std::string commandLine(const std::vector<std::string>& argv) {
+    std::string line;
+    for (const auto& arg : argv) {
+        line += (line.empty() ? "" : " ") + arg;
+    }
+    return line;
+}
+
+bool runProcess(const std::vector<std::string>& argv, std::string_view input, std::string* output, std::string& error) {
+    if (argv.empty()) {
+        error = "Cannot run an empty command";
+        return false;
+    }
+    #ifdef _WIN32
+    (void)input;
+    (void)output;
+    error = "Cannot run: " + commandLine(argv);
+    return false;
+    #else
+    // Everything the child needs is prepared before fork; it only calls
+    // async-signal-safe functions afterwards
+    std::vector<char*> args;
+    for (const auto& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    // A socket pair rather than a pipe: MSG_NOSIGNAL keeps a tool that exits
+    // without reading its input from killing us with SIGPIPE
+    int stdinSocket[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, stdinSocket) != 0) {
+        error = "Cannot run: " + commandLine(argv);
+        return false;
+    }
+    int stdoutPipe[2] = {-1, -1};
+    if (output && ::pipe2(stdoutPipe, O_CLOEXEC) != 0) {
+        ::close(stdinSocket[0]);
+        ::close(stdinSocket[1]);
+        error = "Cannot run: " + commandLine(argv);
+        return false;
+    }
+    const int devNull = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    const pid_t pid = devNull < 0 ? -1 : ::fork();
+    if (pid == 0) {
+        ::dup2(stdinSocket[0], STDIN_FILENO);
+        ::dup2(output ? stdoutPipe[1] : devNull, STDOUT_FILENO);
+        ::dup2(devNull, STDERR_FILENO);
+        ::execvp(args[0], args.data());
+        ::_exit(127);
+    }
+    ::close(stdinSocket[0]);
+    if (output) {
+        ::close(stdoutPipe[1]);
+    }
+    if (devNull >= 0) {
+        ::close(devNull);
+    }
+    if (pid < 0) {
+        ::close(stdinSocket[1]);
+        if (output) {
+            ::close(stdoutPipe[0]);
+        }
+        error = "Cannot run: " + commandLine(argv);
+        return false;
+    }
+
+    for (std::size_t written = 0; written < input.size();) {
+        const ssize_t sent = ::send(stdinSocket[1], input.data() + written, input.size() - written, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            break;
+        }
+        written += static_cast<std::size_t>(sent);
+    }
+    ::close(stdinSocket[1]);
+
+    // The tools used this way print a line or two; read until they exit
+    if (output) {
+        output->clear();
+        char chunk[4096];
+        while (true) {
+            const ssize_t got = ::read(stdoutPipe[0], chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                break;
+            }
+            output->append(chunk, static_cast<std::size_t>(got));
+        }
+        ::close(stdoutPipe[0]);
+    }
+
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error = "Command failed (" + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : status) + "): " +
+                commandLine(argv);
+        return false;
+    }
+    return true;
+    #endif
+}
+
+} // namespace
+
+bool run(const std::vector<std::string>& argv, std::string_view input, std::string& error) {
+    return runProcess(argv, input, nullptr, error);
+}
+
+bool run(const std::vector<std::string>& argv, std::string_view input, std::string& output, std::string& error) {
+    return runProcess(argv, input, &output, error);
+}
+
+} // namespace processUtil
@@ -0,0 +1,13 @@
+#pragma once
+import std;
+
+// Runs the system tools (nft, ip) the network setup is built on
+namespace processUtil {
+
+// Runs argv[0] (looked up in PATH) directly, without a shell, with input fed
+// to its stdin and output discarded. False on failure, with a description in error.
+bool run(const std::vector<std::string>& argv, std::string_view input, std::string& error);
+// Like run(), with the tool's standard output collected in output
+bool run(const std::vector<std::string>& argv, std::string_view input, std::string& output, std::string& error);
+
+} // namespace processUtil
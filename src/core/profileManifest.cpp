@@ -0,0 +1,181 @@
+import std;
+#include "profileManifest.h"
+
+namespace {
+
+constexpr std::string_view manifestHeader = "# siavpn-manifest 1\n";
+constexpr std::string_view hashAttribute = " sha256=\"";
+
+// Small blocks cost more as separate files than they save
+constexpr std::size_t minSharedBlockSize = 128;
+
+// Per-user secrets never leave the profile
+bool isShareableTag(std::string_view tag) {
+    return tag != "key" && tag != "pkcs12" && tag != "auth-user-pass" && tag != "tls-crypt-v2" && tag != "secret";
+}
+
+std::string_view trim(std::string_view text) {
+    const auto first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    const auto last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+} // namespace
+
+std::vector<ProfileManifest::Block> ProfileManifest::scanBlocks(std::string_view text) {
+    std::vector<Block> found;
+    auto nextLine = [&text](std::size_t pos) {
+        const auto newline = text.find('\n', pos);
+        return newline == std::string_view::npos ? text.size() : newline + 1;
+    };
+
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t next = nextLine(pos);
+        const std::string_view line = trim(text.substr(pos, next - pos));
+
+        if (line.size() > 2 && line.front() == '<' && line[1] != '/' && line.back() == '>') {
+            // Reference: <tag sha256="..."/>
+            if (auto attribute = line.find(hashAttribute); attribute != std::string_view::npos && line.ends_with("\"/>")) {
+                Block block;
+                block.tag = std::string(line.substr(1, attribute - 1));
+                const auto hashStart = attribute + hashAttribute.size();
+                block.hash = std::string(line.substr(hashStart, line.size() - 3 - hashStart));
+                block.start = pos;
+                block.bodyStart = next;
+                block.bodyEnd = next;
+                block.end = next;
+                if (next < text.size()) {
+                    const auto closingNext = nextLine(next);
+                    if (trim(text.substr(next, closingNext - next)) == "</" + block.tag + ">") {
+                        block.end = closingNext;
+                    }
+                }
+                pos = block.end;
+                found.push_back(std::move(block));
+                continue;
+            }
+
+            // Inline: <tag> ... </tag>
+            const std::string_view tag = line.substr(1, line.size() - 2);
+            if (tag.find_first_of(" \t") == std::string_view::npos) {
+                const std::string closing = "</" + std::string(tag) + ">";
+                for (std::size_t bodyLine = next; bodyLine < text.size(); bodyLine = nextLine(bodyLine)) {
+                    const auto bodyNext = nextLine(bodyLine);
+                    if (trim(text.substr(bodyLine, bodyNext - bodyLine)) == closing) {
+                        found.push_back({std::string(tag), {}, pos, bodyNext, next, bodyLine});
+                        next = bodyNext;
+                        break;
+                    }
+                }
+            }
+        }
+        pos = next;
+    }
+    return found;
+}
+
+SecureString ProfileManifest::build(std::string_view content, BlobStore& store) {
+    SecureString manifest;
+    manifest.reserve(content.size());
+    manifest.append(manifestHeader);
+
+    std::size_t copied = 0;
+    for (const auto& block : scanBlocks(content)) {
+        if (!block.hash.empty() || !isShareableTag(block.tag) ||
+            block.bodyEnd - block.bodyStart < minSharedBlockSize) {
+            continue;
+        }
+        const std::string hash = store.put(content.substr(block.bodyStart, block.bodyEnd - block.bodyStart));
+        // "  <ca>\r\n" becomes "  <ca sha256="..."/>\r\n"; the closing line stays as it is
+        const auto opening = content.substr(block.start, block.bodyStart - block.start);
+        const auto bracket = opening.rfind('>');
+        manifest.append(content.substr(copied, block.start - copied));
+        manifest.append(opening.substr(0, bracket));
+        manifest.append(hashAttribute);
+        manifest.append(hash);
+        manifest.append("\"/");
+        manifest.append(opening.substr(bracket));
+        manifest.append(content.substr(block.bodyEnd, block.end - block.bodyEnd));
+        copied = block.end;
+    }
+    manifest.append(content.substr(copied));
+    return manifest;
+}
+
+bool ProfileManifest::isManifest(std::string_view text) {
+    return text.starts_with(manifestHeader);
+}
+
+ProfileManifest::ProfileManifest(std::string text, BlobStore& store)
+    : manifestText(std::move(text))
+    , store(store)
+    , blocks(scanBlocks(manifestText)) {
+}
+
+const std::string& ProfileManifest::text() const {
+    return manifestText;
+}
+
+std::vector<std::string> ProfileManifest::blockTags() const {
+    std::vector<std::string> tags;
+    for (const auto& block : blocks) {
+        tags.push_back(block.tag);
+    }
+    return tags;
+}
+
+std::set<std::string> ProfileManifest::referencedBlobs() const {
+    std::set<std::string> hashes;
+    for (const auto& block : blocks) {
+        if (!block.hash.empty()) {
+            hashes.insert(block.hash);
+        }
+    }
+    return hashes;
+}
+
+BlobStore::Blob ProfileManifest::block(const std::string& tag) const {
+    for (const auto& block : blocks) {
+        if (block.tag != tag) {
+            continue;
+        }
+        if (!block.hash.empty()) {
+            return store.get(block.hash);
+        }
+        return std::make_shared<const std::string>(manifestText, block.bodyStart, block.bodyEnd - block.bodyStart);
+    }
+    return nullptr;
+}
+
+std::string ProfileManifest::assemble() const {
+    std::string_view text = manifestText;
+    std::size_t copied = isManifest(text) ? manifestHeader.size() : 0;
+
+    std::string content;
+    content.reserve(manifestText.size());
+    for (const auto& block : blocks) {
+        if (block.hash.empty()) {
+            continue;
+        }
+        content.append(text.substr(copied, block.start - copied));
+        // The reference line without its attribute is the original opening line
+        const auto reference = text.substr(block.start, block.bodyStart - block.start);
+        const auto attribute = reference.find(hashAttribute);
+        const auto slash = reference.find("\"/>", attribute) + 1;
+        content.append(reference.substr(0, attribute));
+        content.append(reference.substr(slash + 1));
+        content.append(*store.get(block.hash));
+        if (block.end > block.bodyEnd) {
+            content.append(text.substr(block.bodyEnd, block.end - block.bodyEnd));
+        } else {
+            content.append("</" + block.tag + ">\n");
+        }
+        copied = block.end;
+    }
+    content.append(text.substr(copied));
+    return content;
+}
@@ -0,0 +1,53 @@
+#pragma once
+import std;
+#include "blobStore.h"
+#include "secureMemory.h"
+
+// A stored profile: the .ovpn text with shareable inline blocks replaced by
+// references (<ca sha256="..."/>) into a BlobStore. Blocks are loaded only
+// when asked for, and borrowed blocks are shared buffers, not copies.
+// Secrets (<key>, <auth-user-pass>, ...) always stay inline.
+//
+// A reference is the block's opening tag line with the attribute added,
+// followed by its closing tag line as it was, so indentation and CRLF line
+// endings survive and assemble() gives back the profile byte for byte.
+class ProfileManifest {
+public:
+    // Moves shareable inline blocks of an .ovpn text into the store. The
+    // result keeps the secret blocks inline, so it stays in the secure arena.
+    static SecureString build(std::string_view content, BlobStore& store);
+    static bool isManifest(std::string_view text);
+
+    // Accepts manifest text or a plain .ovpn profile
+    ProfileManifest(std::string text, BlobStore& store);
+
+    const std::string& text() const;
+    std::vector<std::string> blockTags() const;
+    std::set<std::string> referencedBlobs() const;
+
+    // The block's content, or null if the profile has no such block. Shared
+    // blocks are borrowed from the store; inline ones are copied out.
+    BlobStore::Blob block(const std::string& tag) const;
+    // Full .ovpn text
+    std::string assemble() const;
+
+private:
+    // Offsets into the text: [start, end) spans the whole block including its
+    // tag lines, [bodyStart, bodyEnd) the inline body. For a reference,
+    // [start, bodyStart) is its line and [bodyEnd, end) the closing tag line
+    // (empty in manifests written before those were kept).
+    struct Block {
+        std::string tag;
+        std::string hash;  // empty for inline blocks
+        std::size_t start = 0;
+        std::size_t end = 0;
+        std::size_t bodyStart = 0;
+        std::size_t bodyEnd = 0;
+    };
+
+    static std::vector<Block> scanBlocks(std::string_view text);
+
+    std::string manifestText;
+    BlobStore& store;
+    std::vector<Block> blocks;
+};
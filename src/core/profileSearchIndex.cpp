@@ -0,0 +1,479 @@
+import std;
+#include "profileSearchIndex.h"
+#include "ovpnProfile.h"
+#include "wireGuardProfile.h"
+
+namespace {
+
+std::string toLower(std::string_view text) {
+    std::string lower(text);
+    for (char& c : lower) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return lower;
+}
+
+bool isWordChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) != 0;
+}
+
+// "de", "de12", "us-nyc" -> the two leading letters; "vpn1" -> nothing
+std::string countryPrefix(std::string_view word) {
+    if (word.size() < 2 || !std::isalpha(static_cast<unsigned char>(word[0])) ||
+        !std::isalpha(static_cast<unsigned char>(word[1]))) {
+        return {};
+    }
+    if (word.size() > 2 && std::isalpha(static_cast<unsigned char>(word[2]))) {
+        return {};
+    }
+    return toLower(word.substr(0, 2));
+}
+
+void insertSorted(std::vector<std::uint32_t>& postings, std::uint32_t id) {
+    auto it = std::lower_bound(postings.begin(), postings.end(), id);
+    if (it == postings.end() || *it != id) {
+        postings.insert(it, id);
+    }
+}
+
+void eraseSorted(std::vector<std::uint32_t>& postings, std::uint32_t id) {
+    auto it = std::lower_bound(postings.begin(), postings.end(), id);
+    if (it != postings.end() && *it == id) {
+        postings.erase(it);
+    }
+}
+
+} // namespace
+
+ProfileSearchIndex::Entry ProfileSearchIndex::describe(const std::string& name, std::string_view content) {
+    Entry entry;
+    entry.name = name;
+    auto addUnique = [](std::vector<std::string>& values, const std::string& value) {
+        if (std::find(values.begin(), values.end(), value) == values.end()) {
+            values.push_back(value);
+        }
+    };
+    if (WireGuardProfile::isWireGuard(content)) {
+        // Index what parses; a broken profile still shows up by name
+        try {
+            for (const auto& peer : WireGuardProfile::parse(content).peers) {
+                if (!peer.host.empty()) {
+                    addUnique(entry.hosts, peer.host);
+                    addUnique(entry.ports, peer.port);
+                    addUnique(entry.protocols, "wireguard");
+                }
+            }
+        } catch (const std::exception&) {
+        }
+    } else {
+        // Named: a temporary profile would be gone before the loop reads its remotes
+        const auto profile = OvpnProfile::parseDirectives(content);
+        for (const auto& remote : profile.remotes()) {
+            addUnique(entry.hosts, remote.host);
+            addUnique(entry.ports, remote.port);
+            addUnique(entry.protocols, remote.proto);
+        }
+    }
+
+    // Providers name servers "de123.example.net" or "us-nyc.example.net"
+    for (const auto& host : entry.hosts) {
+        entry.country = countryPrefix(std::string_view(host).substr(0, host.find('.')));
+        if (!entry.country.empty()) {
+            return entry;
+        }
+    }
+    const auto firstWord = std::find_if_not(name.begin(), name.end(), isWordChar);
+    entry.country = countryPrefix(std::string_view(name.begin(), firstWord));
+    return entry;
+}
+
+void ProfileSearchIndex::update(Entry entry) {
+    std::unique_lock lock(indexMutex);
+
+    Id id;
+    if (auto it = idsByName.find(entry.name); it != idsByName.end()) {
+        id = it->second;
+        erasePostings(id);
+    } else {
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        } else {
+            id = static_cast<Id>(slots.size());
+            slots.emplace_back();
+            namePrefixes.emplace_back();
+        }
+        idsByName.emplace(entry.name, id);
+        auto position = std::lower_bound(nameOrder.begin(), nameOrder.end(), entry.name,
+                                         [this](Id other, const std::string& name) {
+                                             return slots[other].entry.name < name;
+                                         });
+        nameOrder.insert(position, id);
+    }
+
+    Slot& slot = slots[id];
+    slot.haystack = haystackOf(entry);
+    namePrefixes[id].fill('\0');
+    std::copy_n(slot.haystack.begin(), std::min(slot.haystack.find('\n'), namePrefixes[id].size()),
+                namePrefixes[id].begin());
+    slot.entry = std::move(entry);
+    insertPostings(id);
+}
+
+void ProfileSearchIndex::remove(const std::string& name) {
+    std::unique_lock lock(indexMutex);
+
+    auto it = idsByName.find(name);
+    if (it == idsByName.end()) {
+        return;
+    }
+    const Id id = it->second;
+    idsByName.erase(it);
+    erasePostings(id);
+
+    auto position = std::lower_bound(nameOrder.begin(), nameOrder.end(), name,
+                                     [this](Id other, const std::string& target) {
+                                         return slots[other].entry.name < target;
+                                     });
+    if (position != nameOrder.end() && *position == id) {
+        nameOrder.erase(position);
+    }
+    slots[id] = Slot{};
+    freeIds.push_back(id);
+}
+
+void ProfileSearchIndex::clear() {
+    std::unique_lock lock(indexMutex);
+    slots.clear();
+    freeIds.clear();
+    idsByName.clear();
+    nameOrder.clear();
+    namePrefixes.clear();
+    tokens.clear();
+    freeTokens.clear();
+    tokenIds.clear();
+    tokensByPrefix.clear();
+    tokensByTrigram.clear();
+}
+
+std::size_t ProfileSearchIndex::size() const {
+    std::shared_lock lock(indexMutex);
+    return idsByName.size();
+}
+
+std::optional<ProfileSearchIndex::Entry> ProfileSearchIndex::find(const std::string& name) const {
+    std::shared_lock lock(indexMutex);
+    auto it = idsByName.find(name);
+    if (it == idsByName.end()) {
+        return std::nullopt;
+    }
+    return slots[it->second].entry;
+}
+
+std::vector<std::string> ProfileSearchIndex::search(std::string_view query, std::size_t limit) const {
+    const auto terms = termsOf(query);
+    std::shared_lock lock(indexMutex);
+    std::vector<std::string> names;
+    for (Id id : rankedMatches(terms, limit)) {
+        names.push_back(slots[id].entry.name);
+    }
+    return names;
+}
+
+std::vector<ProfileSearchIndex::Entry> ProfileSearchIndex::searchEntries(std::string_view query,
+                                                                         std::size_t limit) const {
+    const auto terms = termsOf(query);
+    std::shared_lock lock(indexMutex);
+    std::vector<Entry> entries;
+    for (Id id : rankedMatches(terms, limit)) {
+        entries.push_back(slots[id].entry);
+    }
+    return entries;
+}
+
+std::vector<std::string> ProfileSearchIndex::termsOf(std::string_view query) {
+    const std::string lowered = toLower(query);
+    std::vector<std::string> terms;
+    for (std::size_t pos = 0; pos < lowered.size();) {
+        pos = lowered.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos) {
+            break;
+        }
+        const auto end = lowered.find_first_of(" \t", pos);
+        terms.push_back(lowered.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+        pos = end;
+    }
+    return terms;
+}
+
+std::vector<ProfileSearchIndex::Id> ProfileSearchIndex::rankedMatches(const std::vector<std::string>& terms,
+                                                                      std::size_t limit) const {
+    if (limit == 0) {
+        limit = nameOrder.size();
+    }
+
+    std::vector<Id> ids;
+    if (terms.empty()) {
+        for (std::size_t i = 0; i < nameOrder.size() && ids.size() < limit; ++i) {
+            ids.push_back(nameOrder[i]);
+        }
+        return ids;
+    }
+
+    // Every term must match; intersect the narrowest lists first
+    std::vector<Postings> perTerm;
+    for (const auto& term : terms) {
+        perTerm.push_back(matchTerm(term));
+        if (perTerm.back().empty()) {
+            return ids;
+        }
+    }
+    std::sort(perTerm.begin(), perTerm.end(),
+              [](const Postings& a, const Postings& b) { return a.size() < b.size(); });
+    Postings matched = std::move(perTerm.front());
+    for (std::size_t i = 1; i < perTerm.size() && !matched.empty(); ++i) {
+        Postings narrowed;
+        std::set_intersection(matched.begin(), matched.end(), perTerm[i].begin(), perTerm[i].end(),
+                              std::back_inserter(narrowed));
+        matched = std::move(narrowed);
+    }
+
+    // Rank 2: name starts with the first term, rank 1: any other match. Walking
+    // the name order keeps results sorted without sorting strings per query.
+    std::vector<std::uint8_t> rank(slots.size(), 0);
+    for (Id id : matched) {
+        rank[id] = nameStartsWith(id, terms.front()) ? 2 : 1;
+    }
+    for (std::uint8_t wanted = 2; wanted >= 1; --wanted) {
+        for (std::size_t i = 0; i < nameOrder.size() && ids.size() < limit; ++i) {
+            if (rank[nameOrder[i]] == wanted) {
+                ids.push_back(nameOrder[i]);
+            }
+        }
+    }
+    return ids;
+}
+
+bool ProfileSearchIndex::nameStartsWith(Id id, std::string_view prefix) const {
+    const auto& leading = namePrefixes[id];
+    const std::size_t compared = std::min(prefix.size(), leading.size());
+    if (!std::equal(prefix.begin(), prefix.begin() + compared, leading.begin())) {
+        return false;
+    }
+    return prefix.size() <= leading.size() || slots[id].haystack.starts_with(prefix);
+}
+
+std::string ProfileSearchIndex::haystackOf(const Entry& entry) {
+    std::string haystack = toLower(entry.name);
+    for (const auto* values : {&entry.hosts, &entry.ports, &entry.protocols}) {
+        for (const auto& value : *values) {
+            haystack.push_back('\n');
+            haystack.append(toLower(value));
+        }
+    }
+    if (!entry.country.empty()) {
+        haystack.push_back('\n');
+        haystack.append(entry.country);
+    }
+    return haystack;
+}
+
+std::vector<std::uint32_t> ProfileSearchIndex::trigramsOf(std::string_view text) {
+    std::vector<std::uint32_t> trigrams;
+    for (std::size_t i = 0; i + 3 <= text.size(); ++i) {
+        trigrams.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(text[i])) << 16 |
+                           static_cast<std::uint32_t>(static_cast<unsigned char>(text[i + 1])) << 8 |
+                           static_cast<std::uint32_t>(static_cast<unsigned char>(text[i + 2])));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+std::vector<std::string> ProfileSearchIndex::wordsOf(std::string_view text) {
+    std::vector<std::string> words;
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        while (pos < text.size() && !isWordChar(text[pos])) {
+            ++pos;
+        }
+        const std::size_t start = pos;
+        while (pos < text.size() && isWordChar(text[pos])) {
+            ++pos;
+        }
+        if (pos > start) {
+            words.emplace_back(text.substr(start, pos - start));
+        }
+    }
+    return words;
+}
+
+void ProfileSearchIndex::insertPostings(Id id) {
+    Slot& slot = slots[id];
+    auto words = wordsOf(slot.haystack);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    for (const auto& word : words) {
+        const TokenId token = acquireToken(word);
+        insertSorted(tokens[token].profiles, id);
+        slot.tokens.push_back(token);
+    }
+}
+
+void ProfileSearchIndex::erasePostings(Id id) {
+    Slot& slot = slots[id];
+    for (TokenId token : slot.tokens) {
+        eraseSorted(tokens[token].profiles, id);
+        if (tokens[token].profiles.empty()) {
+            releaseToken(token);
+        }
+    }
+    slot.tokens.clear();
+}
+
+ProfileSearchIndex::TokenId ProfileSearchIndex::acquireToken(const std::string& text) {
+    if (auto it = tokenIds.find(text); it != tokenIds.end()) {
+        return it->second;
+    }
+
+    TokenId token;
+    if (!freeTokens.empty()) {
+        token = freeTokens.back();
+        freeTokens.pop_back();
+    } else {
+        token = static_cast<TokenId>(tokens.size());
+        tokens.emplace_back();
+    }
+    tokens[token].text = text;
+    tokenIds.emplace(text, token);
+    for (std::size_t length = 1; length <= std::min<std::size_t>(2, text.size()); ++length) {
+        insertSorted(tokensByPrefix[text.substr(0, length)], token);
+    }
+    for (auto trigram : trigramsOf(text)) {
+        insertSorted(tokensByTrigram[trigram], token);
+    }
+    return token;
+}
+
+void ProfileSearchIndex::releaseToken(TokenId token) {
+    const std::string text = std::move(tokens[token].text);
+    tokens[token] = Token{};
+    tokenIds.erase(text);
+    for (std::size_t length = 1; length <= std::min<std::size_t>(2, text.size()); ++length) {
+        auto it = tokensByPrefix.find(text.substr(0, length));
+        eraseSorted(it->second, token);
+        if (it->second.empty()) {
+            tokensByPrefix.erase(it);
+        }
+    }
+    for (auto trigram : trigramsOf(text)) {
+        auto it = tokensByTrigram.find(trigram);
+        eraseSorted(it->second, token);
+        if (it->second.empty()) {
+            tokensByTrigram.erase(it);
+        }
+    }
+    freeTokens.push_back(token);
+}
+
+ProfileSearchIndex::Postings ProfileSearchIndex::matchTerm(const std::string& term) const {
+    const auto words = wordsOf(term);
+    if (words.empty()) {
+        return {};
+    }
+
+    Postings matched = matchWord(words.front());
+    for (std::size_t i = 1; i < words.size() && !matched.empty(); ++i) {
+        const Postings next = matchWord(words[i]);
+        Postings narrowed;
+        std::set_intersection(matched.begin(), matched.end(), next.begin(), next.end(), std::back_inserter(narrowed));
+        matched = std::move(narrowed);
+    }
+
+    // "us-nyc" or "de1.example" must match as written, not just word by word
+    if (words.size() > 1) {
+        std::erase_if(matched, [&](Id id) { return slots[id].haystack.find(term) == std::string::npos; });
+    }
+    return matched;
+}
+
+ProfileSearchIndex::Postings ProfileSearchIndex::matchWord(const std::string& word) const {
+    if (word.size() < 3) {
+        auto it = tokensByPrefix.find(word);
+        return it == tokensByPrefix.end() ? Postings{} : profilesOf(it->second);
+    }
+    auto matchedTokens = tokensContaining(word);
+    if (matchedTokens.empty() && word.size() >= 4) {
+        matchedTokens = tokensSimilarTo(word);
+    }
+    return profilesOf(matchedTokens);
+}
+
+std::vector<ProfileSearchIndex::TokenId> ProfileSearchIndex::tokensContaining(const std::string& word) const {
+    std::vector<const std::vector<TokenId>*> lists;
+    for (auto trigram : trigramsOf(word)) {
+        auto it = tokensByTrigram.find(trigram);
+        if (it == tokensByTrigram.end()) {
+            return {};
+        }
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+
+    std::vector<TokenId> candidates = *lists.front();
+    for (std::size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+        std::vector<TokenId> narrowed;
+        std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(narrowed));
+        candidates = std::move(narrowed);
+    }
+
+    // Having every trigram does not mean having them in order ("abcd" vs "abc bcd")
+    if (word.size() > 3) {
+        std::erase_if(candidates, [&](TokenId token) { return tokens[token].text.find(word) == std::string::npos; });
+    }
+    return candidates;
+}
+
+std::vector<ProfileSearchIndex::TokenId> ProfileSearchIndex::tokensSimilarTo(const std::string& word) const {
+    // A typo disturbs at most three trigrams; half of them matching is close enough
+    const auto trigrams = trigramsOf(word);
+    std::unordered_map<TokenId, std::size_t> hits;
+    for (auto trigram : trigrams) {
+        if (auto it = tokensByTrigram.find(trigram); it != tokensByTrigram.end()) {
+            for (TokenId token : it->second) {
+                ++hits[token];
+            }
+        }
+    }
+
+    const std::size_t needed = std::max<std::size_t>(2, (trigrams.size() + 1) / 2);
+    std::vector<TokenId> similar;
+    for (const auto& [token, count] : hits) {
+        if (count >= needed) {
+            similar.push_back(token);
+        }
+    }
+    return similar;
+}
+
+ProfileSearchIndex::Postings ProfileSearchIndex::profilesOf(const std::vector<TokenId>& matchedTokens) const {
+    if (matchedTokens.size() == 1) {
+        return tokens[matchedTokens.front()].profiles;
+    }
+
+    std::vector<char> seen(slots.size(), 0);
+    for (TokenId token : matchedTokens) {
+        for (Id id : tokens[token].profiles) {
+            seen[id] = 1;
+        }
+    }
+    Postings profiles;
+    for (Id id = 0; id < seen.size(); ++id) {
+        if (seen[id]) {
+            profiles.push_back(id);
+        }
+    }
+    return profiles;
+}
@@ -0,0 +1,88 @@
+#pragma once
+import std;
+
+// In-memory search over profile metadata: name, remote hosts, ports,
+// protocols and country. Terms of three or more characters match anywhere
+// (trigram index); shorter terms match word prefixes; a term with no exact
+// hit falls back to trigram similarity, so small typos still find profiles.
+// Updates are incremental and searches may run concurrently with them.
+class ProfileSearchIndex {
+public:
+    struct Entry {
+        std::string name;
+        std::vector<std::string> hosts;
+        std::vector<std::string> ports;
+        std::vector<std::string> protocols;
+        std::string country;  // ISO-like two letter code guessed from host or name, may be empty
+    };
+
+    // Extracts the searchable metadata from profile (or manifest) text
+    static Entry describe(const std::string& name, std::string_view content);
+
+    // Adds the entry or replaces the one with the same name
+    void update(Entry entry);
+    void remove(const std::string& name);
+    void clear();
+
+    std::size_t size() const;
+    std::optional<Entry> find(const std::string& name) const;
+
+    // Names matching every whitespace-separated term of the query: names
+    // starting with the first term come first, then alphabetical order.
+    // An empty query lists everything; limit 0 means no limit.
+    std::vector<std::string> search(std::string_view query, std::size_t limit = 0) const;
+    // The same matches with their metadata, taken in one pass: a snapshot a
+    // list view can show while the index keeps changing
+    std::vector<Entry> searchEntries(std::string_view query, std::size_t limit = 0) const;
+
+private:
+    using Id = std::uint32_t;
+    using TokenId = std::uint32_t;
+    using Postings = std::vector<Id>;  // sorted profile ids
+
+    struct Slot {
+        Entry entry;
+        std::string haystack;  // lower-cased fields joined by '\n'
+        std::vector<TokenId> tokens;
+    };
+
+    // Distinct words across all profiles; substring matching runs over these,
+    // not over every profile, since providers repeat the same hosts and names
+    struct Token {
+        std::string text;
+        Postings profiles;
+    };
+
+    static std::string haystackOf(const Entry& entry);
+    static std::vector<std::uint32_t> trigramsOf(std::string_view text);
+    static std::vector<std::string> wordsOf(std::string_view text);
+    static std::vector<std::string> termsOf(std::string_view query);
+    // Ids for search(), best first; the caller holds indexMutex
+    std::vector<Id> rankedMatches(const std::vector<std::string>& terms, std::size_t limit) const;
+    bool nameStartsWith(Id id, std::string_view prefix) const;
+
+    void insertPostings(Id id);
+    void erasePostings(Id id);
+    TokenId acquireToken(const std::string& text);
+    void releaseToken(TokenId token);
+
+    Postings matchTerm(const std::string& term) const;
+    Postings matchWord(const std::string& word) const;
+    std::vector<TokenId> tokensContaining(const std::string& word) const;
+    std::vector<TokenId> tokensSimilarTo(const std::string& word) const;
+    Postings profilesOf(const std::vector<TokenId>& matchedTokens) const;
+
+    std::vector<Slot> slots;
+    std::vector<Id> freeIds;
+    std::unordered_map<std::string, Id> idsByName;
+    std::vector<Id> nameOrder;  // live ids sorted by name
+    std::vector<std::array<char, 8>> namePrefixes;  // lower-cased, by id; keeps ranking off the slots
+
+    std::vector<Token> tokens;
+    std::vector<TokenId> freeTokens;
+    std::unordered_map<std::string, TokenId> tokenIds;
+    std::unordered_map<std::string, std::vector<TokenId>> tokensByPrefix;  // one and two character prefixes
+    std::unordered_map<std::uint32_t, std::vector<TokenId>> tokensByTrigram;
+
+    mutable std::shared_mutex indexMutex;
+};
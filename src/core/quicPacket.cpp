@@ -0,0 +1,307 @@
+import std;
+#include "quicPacket.h"
+#include "secureMemory.h"
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/kdf.h>
+
+namespace quic {
+
+namespace {
+
+// RFC 9001 section 5.2
+constexpr std::array<std::uint8_t, 20> initialSalt{0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+                                                   0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a};
+// RFC 9001 section 5.8
+constexpr std::array<std::uint8_t, 16> retryKey{0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+                                                0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e};
+constexpr std::array<std::uint8_t, 12> retryNonce{0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63,
+                                                  0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb};
+
+constexpr std::size_t keySize = 16;
+constexpr std::size_t ivSize = 12;
+constexpr std::size_t sampleSize = 16;
+
+Secret hkdf(int mode, std::span<const std::uint8_t> key, std::span<const std::uint8_t> salt,
+            std::span<const std::uint8_t> info, std::size_t length) {
+    EVP_KDF* kdf = EVP_KDF_fetch(nullptr, OSSL_KDF_NAME_HKDF, nullptr);
+    EVP_KDF_CTX* ctx = kdf ? EVP_KDF_CTX_new(kdf) : nullptr;
+    char digest[] = "SHA256";
+    std::array<OSSL_PARAM, 6> params{};
+    std::size_t count = 0;
+    params[count++] = OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode);
+    params[count++] = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, digest, 0);
+    params[count++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, const_cast<std::uint8_t*>(key.data()), key.size());
+    if (!salt.empty()) {
+        params[count++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, const_cast<std::uint8_t*>(salt.data()),
+                                                            salt.size());
+    }
+    if (!info.empty()) {
+        params[count++] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, const_cast<std::uint8_t*>(info.data()),
+                                                            info.size());
+    }
+    params[count] = OSSL_PARAM_construct_end();
+
+    Secret out(length);
+    const bool ok = ctx && EVP_KDF_derive(ctx, out.data(), out.size(), params.data()) == 1;
+    EVP_KDF_CTX_free(ctx);
+    EVP_KDF_free(kdf);
+    if (!ok) {
+        throw std::runtime_error("HKDF-SHA256 is not available");
+    }
+    return out;
+}
+
+} // namespace
+
+std::size_t varintSize(std::uint64_t value) {
+    return value < (1u << 6) ? 1 : value < (1u << 14) ? 2 : value < (1u << 30) ? 4 : 8;
+}
+
+std::uint8_t* writeVarint(std::uint8_t* out, std::uint64_t value, std::size_t size) {
+    if (size == 0) {
+        size = varintSize(value);
+    }
+    const std::uint8_t prefix = size == 1 ? 0x00 : size == 2 ? 0x40 : size == 4 ? 0x80 : 0xc0;
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = static_cast<std::uint8_t>(value >> (8 * (size - 1 - i)));
+    }
+    out[0] |= prefix;
+    return out + size;
+}
+
+void appendVarint(std::vector<std::uint8_t>& out, std::uint64_t value) {
+    std::array<std::uint8_t, 8> encoded{};
+    auto* end = writeVarint(encoded.data(), value);
+    out.insert(out.end(), encoded.data(), end);
+}
+
+void appendBytes(std::vector<std::uint8_t>& out, std::span<const std::uint8_t> bytes) {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+std::uint64_t Reader::varint() {
+    if (!good || position >= data.size()) {
+        good = false;
+        return 0;
+    }
+    const std::size_t size = std::size_t{1} << (data[position] >> 6);
+    if (data.size() - position < size) {
+        good = false;
+        return 0;
+    }
+    std::uint64_t value = data[position] & 0x3f;
+    for (std::size_t i = 1; i < size; ++i) {
+        value = (value << 8) | data[position + i];
+    }
+    position += size;
+    return value;
+}
+
+std::uint8_t Reader::byte() {
+    return static_cast<std::uint8_t>(fixed(1));
+}
+
+std::uint64_t Reader::fixed(std::size_t size) {
+    std::uint64_t value = 0;
+    for (auto b : bytes(size)) {
+        value = (value << 8) | b;
+    }
+    return value;
+}
+
+std::span<const std::uint8_t> Reader::bytes(std::size_t size) {
+    if (!good || data.size() - position < size) {
+        good = false;
+        return {};
+    }
+    auto out = data.subspan(position, size);
+    position += size;
+    return out;
+}
+
+std::span<const std::uint8_t> Reader::rest() {
+    return bytes(good ? data.size() - position : 0);
+}
+
+Secret hkdfExtract(std::span<const std::uint8_t> salt, std::span<const std::uint8_t> key) {
+    return hkdf(EVP_KDF_HKDF_MODE_EXTRACT_ONLY, key, salt, {}, 32);
+}
+
+Secret expandLabel(std::span<const std::uint8_t> secret, std::string_view label, std::size_t length) {
+    // struct { uint16 length; opaque label<7..255>; opaque context<0..255>; } with an empty context
+    std::vector<std::uint8_t> info{static_cast<std::uint8_t>(length >> 8), static_cast<std::uint8_t>(length),
+                                   static_cast<std::uint8_t>(6 + label.size())};
+    for (char c : std::string_view("tls13 ")) {
+        info.push_back(static_cast<std::uint8_t>(c));
+    }
+    info.insert(info.end(), label.begin(), label.end());
+    info.push_back(0);
+    return hkdf(EVP_KDF_HKDF_MODE_EXPAND_ONLY, secret, {}, info, length);
+}
+
+std::pair<Secret, Secret> initialSecrets(std::span<const std::uint8_t> connectionId) {
+    Secret initial = hkdfExtract(initialSalt, connectionId);
+    auto secrets = std::make_pair(expandLabel(initial, "client in", 32), expandLabel(initial, "server in", 32));
+    secureWipe(initial.data(), initial.size());
+    return secrets;
+}
+
+bool retryTagValid(std::span<const std::uint8_t> retryPacket, std::span<const std::uint8_t> originalConnectionId) {
+    if (retryPacket.size() < tagSize || originalConnectionId.size() > maxConnectionIdSize) {
+        return false;
+    }
+    // The pseudo-packet: the original connection ID, then the Retry packet without its tag
+    std::vector<std::uint8_t> pseudo{static_cast<std::uint8_t>(originalConnectionId.size())};
+    appendBytes(pseudo, originalConnectionId);
+    appendBytes(pseudo, retryPacket.first(retryPacket.size() - tagSize));
+
+    Aead aead(retryKey, retryNonce);
+    std::array<std::uint8_t, tagSize> tag{};
+    if (!aead.seal(0, pseudo, tag.data(), 0)) {
+        return false;
+    }
+    return CRYPTO_memcmp(tag.data(), retryPacket.data() + retryPacket.size() - tagSize, tagSize) == 0;
+}
+
+std::uint64_t decodePacketNumber(std::optional<std::uint64_t> largestReceived, std::uint64_t truncated, std::size_t size) {
+    const std::uint64_t expected = largestReceived ? *largestReceived + 1 : 0;
+    const std::uint64_t window = std::uint64_t{1} << (size * 8);
+    const std::uint64_t halfWindow = window / 2;
+    const std::uint64_t candidate = (expected & ~(window - 1)) | truncated;
+    if (candidate + halfWindow <= expected && candidate < (std::uint64_t{1} << 62) - window) {
+        return candidate + window;
+    }
+    if (candidate > expected + halfWindow && candidate >= window) {
+        return candidate - window;
+    }
+    return candidate;
+}
+
+Aead::Aead(std::span<const std::uint8_t> key, std::span<const std::uint8_t> iv) {
+    if (key.size() != keySize || iv.size() != this->iv.size()) {
+        throw std::runtime_error("Wrong AES-128-GCM key size");
+    }
+    std::copy(iv.begin(), iv.end(), this->iv.begin());
+    encryptor = EVP_CIPHER_CTX_new();
+    decryptor = EVP_CIPHER_CTX_new();
+    if (!encryptor || !decryptor ||
+        EVP_EncryptInit_ex(encryptor, EVP_aes_128_gcm(), nullptr, key.data(), nullptr) != 1 ||
+        EVP_DecryptInit_ex(decryptor, EVP_aes_128_gcm(), nullptr, key.data(), nullptr) != 1) {
+        EVP_CIPHER_CTX_free(encryptor);
+        EVP_CIPHER_CTX_free(decryptor);
+        throw std::runtime_error("AES-128-GCM is not available");
+    }
+}
+
+Aead::~Aead() {
+    EVP_CIPHER_CTX_free(encryptor);
+    EVP_CIPHER_CTX_free(decryptor);
+}
+
+std::array<std::uint8_t, 12> Aead::nonce(std::uint64_t counter) const {
+    auto out = iv;
+    for (std::size_t i = 0; i < 8; ++i) {
+        out[out.size() - 1 - i] ^= static_cast<std::uint8_t>(counter >> (8 * i));
+    }
+    return out;
+}
+
+bool Aead::seal(std::uint64_t counter, std::span<const std::uint8_t> aad, std::uint8_t* data, std::size_t length) {
+    const auto iv = nonce(counter);
+    int written = 0;
+    return EVP_EncryptInit_ex(encryptor, nullptr, nullptr, nullptr, iv.data()) == 1 &&
+           EVP_EncryptUpdate(encryptor, nullptr, &written, aad.data(), static_cast<int>(aad.size())) == 1 &&
+           (length == 0 || EVP_EncryptUpdate(encryptor, data, &written, data, static_cast<int>(length)) == 1) &&
+           EVP_EncryptFinal_ex(encryptor, nullptr, &written) == 1 &&
+           EVP_CIPHER_CTX_ctrl(encryptor, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(tagSize), data + length) == 1;
+}
+
+bool Aead::open(std::uint64_t counter, std::span<const std::uint8_t> aad, std::uint8_t* data, std::size_t length) {
+    if (length < tagSize) {
+        return false;
+    }
+    const std::size_t plain = length - tagSize;
+    const auto iv = nonce(counter);
+    int written = 0;
+    return EVP_DecryptInit_ex(decryptor, nullptr, nullptr, nullptr, iv.data()) == 1 &&
+           EVP_CIPHER_CTX_ctrl(decryptor, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(tagSize), data + plain) == 1 &&
+           EVP_DecryptUpdate(decryptor, nullptr, &written, aad.data(), static_cast<int>(aad.size())) == 1 &&
+           (plain == 0 || EVP_DecryptUpdate(decryptor, data, &written, data, static_cast<int>(plain)) == 1) &&
+           EVP_DecryptFinal_ex(decryptor, nullptr, &written) == 1;
+}
+
+PacketKeys::PacketKeys(std::span<const std::uint8_t> secret)
+    : PacketKeys(secret, expandLabel(secret, "quic hp", keySize)) {}
+
+PacketKeys::PacketKeys(std::span<const std::uint8_t> secret, std::span<const std::uint8_t> headerKey)
+    : secret(secret.begin(), secret.end()), headerKey(headerKey.begin(), headerKey.end()) {
+    Secret key = expandLabel(secret, "quic key", keySize);
+    Secret iv = expandLabel(secret, "quic iv", ivSize);
+    aead = std::make_unique<Aead>(key, iv);
+    secureWipe(key.data(), key.size());
+    secureWipe(iv.data(), iv.size());
+
+    headerCipher = EVP_CIPHER_CTX_new();
+    if (!headerCipher || EVP_EncryptInit_ex(headerCipher, EVP_aes_128_ecb(), nullptr, this->headerKey.data(), nullptr) != 1) {
+        EVP_CIPHER_CTX_free(headerCipher);
+        throw std::runtime_error("AES-128-ECB is not available");
+    }
+    EVP_CIPHER_CTX_set_padding(headerCipher, 0);
+}
+
+PacketKeys::~PacketKeys() {
+    EVP_CIPHER_CTX_free(headerCipher);
+    secureWipe(secret.data(), secret.size());
+    secureWipe(headerKey.data(), headerKey.size());
+}
+
+std::array<std::uint8_t, 5> PacketKeys::mask(const std::uint8_t* sample) const {
+    std::array<std::uint8_t, sampleSize> block{};
+    int written = 0;
+    EVP_EncryptUpdate(headerCipher, block.data(), &written, sample, static_cast<int>(sampleSize));
+    std::array<std::uint8_t, 5> out{};
+    std::copy_n(block.begin(), out.size(), out.begin());
+    return out;
+}
+
+bool PacketKeys::protect(std::uint8_t* packet, std::size_t headerLength, std::size_t payloadLength,
+                         std::uint64_t packetNumber) {
+    if (!aead->seal(packetNumber, std::span<const std::uint8_t>(packet, headerLength), packet + headerLength,
+                    payloadLength)) {
+        return false;
+    }
+    const std::size_t numberOffset = headerLength - packetNumberSize;
+    const auto bits = mask(packet + numberOffset + 4);
+    packet[0] ^= bits[0] & ((packet[0] & 0x80) ? 0x0f : 0x1f);
+    for (std::size_t i = 0; i < packetNumberSize; ++i) {
+        packet[numberOffset + i] ^= bits[1 + i];
+    }
+    return true;
+}
+
+void PacketKeys::unmaskHeader(std::uint8_t* packet, std::size_t numberOffset) const {
+    const auto bits = mask(packet + numberOffset + 4);
+    packet[0] ^= bits[0] & ((packet[0] & 0x80) ? 0x0f : 0x1f);
+    const std::size_t size = (packet[0] & 0x03) + 1;
+    for (std::size_t i = 0; i < size; ++i) {
+        packet[numberOffset + i] ^= bits[1 + i];
+    }
+}
+
+bool PacketKeys::open(std::uint8_t* packet, std::size_t headerLength, std::size_t packetLength,
+                      std::uint64_t packetNumber) {
+    return packetLength >= headerLength + tagSize &&
+           aead->open(packetNumber, std::span<const std::uint8_t>(packet, headerLength), packet + headerLength,
+                      packetLength - headerLength);
+}
+
+std::unique_ptr<PacketKeys> PacketKeys::next() const {
+    Secret nextSecret = expandLabel(secret, "quic ku", secret.size());
+    std::unique_ptr<PacketKeys> keys(new PacketKeys(nextSecret, headerKey));
+    secureWipe(nextSecret.data(), nextSecret.size());
+    return keys;
+}
+
+} // namespace quic
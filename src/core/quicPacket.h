@@ -0,0 +1,126 @@
+#pragma once
+import std;
+#include <openssl/evp.h>
+
+// QUIC version 1 building blocks (RFC 9000, RFC 9001): variable-length
+// integers, the TLS 1.3 key schedule for TLS_AES_128_GCM_SHA256, and packet
+// protection. Every packet number is sent in 4 bytes, so the header
+// protection sample always lies inside the packet.
+namespace quic {
+
+using Secret = std::vector<std::uint8_t>;
+
+constexpr std::uint32_t version1 = 0x00000001;
+constexpr std::size_t tagSize = 16;
+constexpr std::size_t packetNumberSize = 4;
+constexpr std::size_t maxConnectionIdSize = 20;
+// Datagrams carrying Initial packets, and path probes, are padded to this
+constexpr std::size_t minDatagramSize = 1200;
+
+// Packet number spaces; TLS encryption levels map onto them one to one
+enum class Space : std::uint8_t { Initial, Handshake, Application };
+constexpr std::size_t spaceCount = 3;
+
+enum class PacketType : std::uint8_t { Initial = 0, ZeroRtt = 1, Handshake = 2, Retry = 3 };
+
+std::size_t varintSize(std::uint64_t value);
+// Writes value in its shortest encoding, or in exactly size bytes if given
+std::uint8_t* writeVarint(std::uint8_t* out, std::uint64_t value, std::size_t size = 0);
+void appendVarint(std::vector<std::uint8_t>& out, std::uint64_t value);
+void appendBytes(std::vector<std::uint8_t>& out, std::span<const std::uint8_t> bytes);
+
+// Bounds-checked reading; once a read runs past the end every later read
+// returns zero or empty and ok() is false
+class Reader {
+public:
+    explicit Reader(std::span<const std::uint8_t> data) : data(data) {}
+
+    std::uint64_t varint();
+    std::uint8_t byte();
+    std::uint64_t fixed(std::size_t size);  // big endian
+    std::span<const std::uint8_t> bytes(std::size_t size);
+    std::span<const std::uint8_t> rest();
+
+    bool ok() const { return good; }
+    bool atEnd() const { return position >= data.size(); }
+    std::size_t offset() const { return position; }
+
+private:
+    std::span<const std::uint8_t> data;
+    std::size_t position = 0;
+    bool good = true;
+};
+
+// HKDF-Extract and HKDF-Expand-Label ("tls13 " labels) with SHA-256
+Secret hkdfExtract(std::span<const std::uint8_t> salt, std::span<const std::uint8_t> key);
+Secret expandLabel(std::span<const std::uint8_t> secret, std::string_view label, std::size_t length);
+
+// Client and server Initial secrets for the client's first destination connection ID
+std::pair<Secret, Secret> initialSecrets(std::span<const std::uint8_t> connectionId);
+
+// The Retry integrity tag (RFC 9001 section 5.8) of a whole Retry packet
+bool retryTagValid(std::span<const std::uint8_t> retryPacket, std::span<const std::uint8_t> originalConnectionId);
+
+// The full packet number closest to the next expected one (RFC 9000 A.3)
+std::uint64_t decodePacketNumber(std::optional<std::uint64_t> largestReceived, std::uint64_t truncated,
+                                 std::size_t size);
+
+// AES-128-GCM with a per-message counter XORed into the IV; the contexts are
+// keyed once
+class Aead {
+public:
+    Aead(std::span<const std::uint8_t> key, std::span<const std::uint8_t> iv);
+    ~Aead();
+
+    Aead(const Aead&) = delete;
+    Aead& operator=(const Aead&) = delete;
+
+    // Encrypts data[0, length) in place and writes the tag behind it
+    bool seal(std::uint64_t counter, std::span<const std::uint8_t> aad, std::uint8_t* data, std::size_t length);
+    // data[0, length) is ciphertext and tag; decrypts the ciphertext in place
+    bool open(std::uint64_t counter, std::span<const std::uint8_t> aad, std::uint8_t* data, std::size_t length);
+
+private:
+    std::array<std::uint8_t, 12> nonce(std::uint64_t counter) const;
+
+    EVP_CIPHER_CTX* encryptor = nullptr;
+    EVP_CIPHER_CTX* decryptor = nullptr;
+    std::array<std::uint8_t, 12> iv{};
+};
+
+// One direction of one packet number space: payload protection and header
+// protection derived from a traffic secret
+class PacketKeys {
+public:
+    // Throws std::runtime_error if OpenSSL lacks AES-128-GCM or AES-128-ECB
+    explicit PacketKeys(std::span<const std::uint8_t> secret);
+    ~PacketKeys();
+
+    PacketKeys(const PacketKeys&) = delete;
+    PacketKeys& operator=(const PacketKeys&) = delete;
+
+    // packet[0, headerLength) is the header ending in the 4-byte packet
+    // number, the payload follows it; encrypts the payload in place, writes
+    // the tag behind it and masks the header
+    bool protect(std::uint8_t* packet, std::size_t headerLength, std::size_t payloadLength, std::uint64_t packetNumber);
+    // Unmasks the first byte and the packet number at numberOffset; the
+    // packet must extend at least 20 bytes past numberOffset
+    void unmaskHeader(std::uint8_t* packet, std::size_t numberOffset) const;
+    // After unmaskHeader(): decrypts packet[headerLength, packetLength) in
+    // place, the tag included in packetLength
+    bool open(std::uint8_t* packet, std::size_t headerLength, std::size_t packetLength, std::uint64_t packetNumber);
+
+    // Keys of the next key phase (RFC 9001 section 6); header protection stays
+    std::unique_ptr<PacketKeys> next() const;
+
+private:
+    PacketKeys(std::span<const std::uint8_t> secret, std::span<const std::uint8_t> headerKey);
+    std::array<std::uint8_t, 5> mask(const std::uint8_t* sample) const;
+
+    Secret secret;
+    Secret headerKey;
+    std::unique_ptr<Aead> aead;
+    EVP_CIPHER_CTX* headerCipher = nullptr;
+};
+
+} // namespace quic
@@ -0,0 +1,284 @@
+import std;
+#include "quicTls.h"
+#include "secureMemory.h"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+
+constexpr unsigned int transportParametersExtension = 57;  // RFC 9001 section 8.2
+constexpr std::size_t maxRecordPlaintext = 16384;
+
+std::string opensslError() {
+    std::string text;
+    while (unsigned long code = ERR_get_error()) {
+        std::array<char, 256> buffer{};
+        ERR_error_string_n(code, buffer.data(), buffer.size());
+        if (!text.empty()) {
+            text += "; ";
+        }
+        text += buffer.data();
+    }
+    return text.empty() ? "unknown error" : text;
+}
+
+// Key log lines carrying the traffic secrets QUIC packet keys come from
+struct KeyLogLabel {
+    std::string_view label;
+    quic::Space level;
+    bool client;
+};
+constexpr std::array<KeyLogLabel, 4> keyLogLabels{{
+    {"CLIENT_HANDSHAKE_TRAFFIC_SECRET", quic::Space::Handshake, true},
+    {"SERVER_HANDSHAKE_TRAFFIC_SECRET", quic::Space::Handshake, false},
+    {"CLIENT_TRAFFIC_SECRET_0", quic::Space::Application, true},
+    {"SERVER_TRAFFIC_SECRET_0", quic::Space::Application, false},
+}};
+
+std::optional<quic::Secret> fromHex(std::string_view hex) {
+    if (hex.empty() || hex.size() % 2 != 0) {
+        return std::nullopt;
+    }
+    quic::Secret out(hex.size() / 2);
+    for (std::size_t i = 0; i < out.size(); ++i) {
+        auto [end, error] = std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, out[i], 16);
+        if (error != std::errc{} || end != hex.data() + 2 * i + 2) {
+            secureWipe(out.data(), out.size());
+            return std::nullopt;
+        }
+    }
+    return out;
+}
+
+// The encryption level a handshake message travels at, by message type
+quic::Space levelOf(std::uint8_t messageType) {
+    switch (messageType) {
+    case 1:   // client_hello
+    case 2:   // server_hello, hello_retry_request
+        return quic::Space::Initial;
+    case 4:   // new_session_ticket
+    case 24:  // key_update
+        return quic::Space::Application;
+    default:
+        return quic::Space::Handshake;
+    }
+}
+
+void appendRecordHeader(std::vector<std::uint8_t>& out, std::uint8_t type, std::size_t length) {
+    out.insert(out.end(), {type, 0x03, 0x03, static_cast<std::uint8_t>(length >> 8), static_cast<std::uint8_t>(length)});
+}
+
+} // namespace
+
+bool QuicTls::configure(SSL_CTX* ctx) {
+    return SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION) == 1 &&
+           SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION) == 1 &&
+           SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256") == 1 &&
+           (SSL_CTX_clear_options(ctx, SSL_OP_ENABLE_MIDDLEBOX_COMPAT), true) &&
+           (SSL_CTX_set_keylog_callback(ctx, &QuicTls::keyLogCallback), true) &&
+           SSL_CTX_add_custom_ext(ctx, transportParametersExtension,
+                                  SSL_EXT_CLIENT_HELLO | SSL_EXT_TLS1_3_ENCRYPTED_EXTENSIONS | SSL_EXT_TLS1_3_ONLY,
+                                  &QuicTls::addParameters, nullptr, nullptr, &QuicTls::parseParameters,
+                                  nullptr) == 1;
+}
+
+QuicTls::QuicTls(SSL_CTX* ctx, bool server, std::vector<std::uint8_t> transportParameters)
+    : server(server), localParameters(std::move(transportParameters)) {
+    ssl = SSL_new(ctx);
+    if (!ssl) {
+        throw std::runtime_error("Cannot create TLS session: " + opensslError());
+    }
+    SSL_set_app_data(ssl, this);
+    SSL_set_msg_callback(ssl, &QuicTls::messageCallback);
+    SSL_set_msg_callback_arg(ssl, this);
+
+    networkIn = BIO_new(BIO_s_mem());
+    networkOut = BIO_new(BIO_s_mem());
+    SSL_set_bio(ssl, networkIn, networkOut);
+    if (server) {
+        SSL_set_accept_state(ssl);
+    } else {
+        SSL_set_connect_state(ssl);
+    }
+}
+
+QuicTls::~QuicTls() {
+    SSL_free(ssl);  // also frees the memory BIOs
+    wipeSecrets();
+}
+
+SSL* QuicTls::handle() const {
+    return ssl;
+}
+
+void QuicTls::provide(quic::Space level, std::span<const std::uint8_t> data) {
+    auto& input = levels[static_cast<std::size_t>(level)].input;
+    input.insert(input.end(), data.begin(), data.end());
+}
+
+bool QuicTls::advance() {
+    if (failed) {
+        return false;
+    }
+    // Input at a level whose keys the next step derives waits for that step
+    feedRecords();
+    do {
+        ERR_clear_error();
+        int result = 0;
+        if (!SSL_is_init_finished(ssl)) {
+            result = SSL_do_handshake(ssl);
+        } else {
+            // Only post-handshake messages arrive; nothing is sent over TLS itself
+            std::array<std::uint8_t, 64> sink{};
+            result = SSL_read(ssl, sink.data(), static_cast<int>(sink.size()));
+        }
+        if (result <= 0) {
+            const int error = SSL_get_error(ssl, result);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                failed = true;
+                lastError = "TLS handshake failed: " + opensslError();
+                return false;
+            }
+        }
+        // The sealed records; their messages were taken by messageCallback
+        BIO_reset(networkOut);
+    } while (feedRecords());
+    return true;
+}
+
+bool QuicTls::complete() const {
+    return SSL_is_init_finished(ssl) == 1;
+}
+
+std::vector<std::uint8_t> QuicTls::takeOutput(quic::Space level) {
+    return std::exchange(levels[static_cast<std::size_t>(level)].output, {});
+}
+
+std::optional<quic::Secret> QuicTls::secret(quic::Space level, bool write) const {
+    const auto& entry = levels[static_cast<std::size_t>(level)];
+    return write ? entry.writeSecret : entry.readSecret;
+}
+
+const std::vector<std::uint8_t>& QuicTls::peerTransportParameters() const {
+    return peerParameters;
+}
+
+std::optional<std::uint8_t> QuicTls::alert() const {
+    return sentAlert;
+}
+
+std::string QuicTls::getLastError() const {
+    return lastError;
+}
+
+bool QuicTls::feedRecords() {
+    bool fed = false;
+    std::vector<std::uint8_t> records;
+    for (std::size_t index = 0; index < levels.size(); ++index) {
+        auto& level = levels[index];
+        if (level.input.empty()) {
+            continue;
+        }
+        const bool plaintext = index == static_cast<std::size_t>(quic::Space::Initial);
+        if (!plaintext && !level.readSecret) {
+            continue;
+        }
+        if (!plaintext && !level.recordKeys) {
+            quic::Secret key = quic::expandLabel(*level.readSecret, "key", 16);
+            quic::Secret iv = quic::expandLabel(*level.readSecret, "iv", 12);
+            level.recordKeys = std::make_unique<quic::Aead>(key, iv);
+            secureWipe(key.data(), key.size());
+            secureWipe(iv.data(), iv.size());
+        }
+
+        std::span<const std::uint8_t> rest(level.input);
+        while (!rest.empty()) {
+            const auto chunk = rest.first(std::min(rest.size(), maxRecordPlaintext));
+            rest = rest.subspan(chunk.size());
+            if (plaintext) {
+                appendRecordHeader(records, SSL3_RT_HANDSHAKE, chunk.size());
+                records.insert(records.end(), chunk.begin(), chunk.end());
+                continue;
+            }
+            // TLSInnerPlaintext: the message, then its real content type
+            const std::size_t sealedSize = chunk.size() + 1 + quic::tagSize;
+            appendRecordHeader(records, SSL3_RT_APPLICATION_DATA, sealedSize);
+            const std::size_t headerOffset = records.size() - 5;
+            records.insert(records.end(), chunk.begin(), chunk.end());
+            records.push_back(SSL3_RT_HANDSHAKE);
+            records.resize(records.size() + quic::tagSize);
+            std::array<std::uint8_t, 5> header{};
+            std::copy_n(records.begin() + static_cast<std::ptrdiff_t>(headerOffset), header.size(), header.begin());
+            level.recordKeys->seal(level.recordSequence++, header, records.data() + headerOffset + 5, chunk.size() + 1);
+        }
+        level.input.clear();
+        fed = true;
+    }
+    if (fed) {
+        BIO_write(networkIn, records.data(), static_cast<int>(records.size()));
+    }
+    return fed;
+}
+
+void QuicTls::wipeSecrets() {
+    for (auto& level : levels) {
+        for (auto* secret : {&level.readSecret, &level.writeSecret}) {
+            if (*secret) {
+                secureWipe((*secret)->data(), (*secret)->size());
+                secret->reset();
+            }
+        }
+    }
+}
+
+void QuicTls::keyLogCallback(const SSL* ssl, const char* line) {
+    auto* self = static_cast<QuicTls*>(SSL_get_app_data(ssl));
+    if (!self) {
+        return;
+    }
+    // "<LABEL> <client random> <secret>", all hex after the label
+    std::string_view text(line);
+    const auto firstSpace = text.find(' ');
+    const auto lastSpace = text.rfind(' ');
+    if (firstSpace == std::string_view::npos || lastSpace == firstSpace) {
+        return;
+    }
+    const auto label = std::find_if(keyLogLabels.begin(), keyLogLabels.end(),
+                                    [&](const auto& entry) { return entry.label == text.substr(0, firstSpace); });
+    if (label == keyLogLabels.end()) {
+        return;
+    }
+    auto& entry = self->levels[static_cast<std::size_t>(label->level)];
+    (label->client != self->server ? entry.writeSecret : entry.readSecret) = fromHex(text.substr(lastSpace + 1));
+}
+
+void QuicTls::messageCallback(int writing, int, int contentType, const void* buffer, std::size_t length, SSL*,
+                              void* arg) {
+    auto* self = static_cast<QuicTls*>(arg);
+    const auto* bytes = static_cast<const std::uint8_t*>(buffer);
+    if (!writing || length == 0) {
+        return;
+    }
+    if (contentType == SSL3_RT_HANDSHAKE) {
+        auto& output = self->levels[static_cast<std::size_t>(levelOf(bytes[0]))].output;
+        output.insert(output.end(), bytes, bytes + length);
+    } else if (contentType == SSL3_RT_ALERT && length == 2) {
+        self->sentAlert = bytes[1];
+    }
+}
+
+int QuicTls::addParameters(SSL* ssl, unsigned int, unsigned int, const unsigned char** out, std::size_t* length,
+                           X509*, std::size_t, int*, void*) {
+    auto* self = static_cast<QuicTls*>(SSL_get_app_data(ssl));
+    *out = self->localParameters.data();
+    *length = self->localParameters.size();
+    return 1;
+}
+
+int QuicTls::parseParameters(SSL* ssl, unsigned int, unsigned int, const unsigned char* in, std::size_t length,
+                             X509*, std::size_t, int*, void*) {
+    auto* self = static_cast<QuicTls*>(SSL_get_app_data(ssl));
+    self->peerParameters.assign(in, in + length);
+    return 1;
+}
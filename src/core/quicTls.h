@@ -0,0 +1,77 @@
+#pragma once
+import std;
+#include <openssl/ssl.h>
+#include "quicPacket.h"
+
+// The TLS 1.3 handshake of a QUIC connection on OpenSSL builds without a
+// QUIC API. QUIC carries bare handshake messages in CRYPTO frames, per
+// encryption level; OpenSSL speaks records. Outgoing messages are taken from
+// the message callback, which sees them in plaintext before they are
+// sealed, and sorted into levels by message type. Incoming messages are
+// sealed into the records OpenSSL expects with the peer's traffic secrets,
+// which the key log callback hands over as they are derived; the record
+// stream OpenSSL writes is discarded. Works for either role.
+class QuicTls {
+public:
+    // TLS 1.3 only with TLS_AES_128_GCM_SHA256, no middlebox compatibility
+    // records, and the quic_transport_parameters extension; applies to every
+    // QuicTls created from ctx
+    static bool configure(SSL_CTX* ctx);
+
+    // Throws std::runtime_error if the session cannot be created
+    QuicTls(SSL_CTX* ctx, bool server, std::vector<std::uint8_t> transportParameters);
+    ~QuicTls();
+
+    QuicTls(const QuicTls&) = delete;
+    QuicTls& operator=(const QuicTls&) = delete;
+
+    // For SNI, ALPN and verification settings before the first advance()
+    SSL* handle() const;
+
+    // CRYPTO frame data, in order, received at level
+    void provide(quic::Space level, std::span<const std::uint8_t> data);
+    // Runs the handshake on what was provided; false once it failed
+    bool advance();
+    bool complete() const;
+
+    // Handshake data to send at level since the last call
+    std::vector<std::uint8_t> takeOutput(quic::Space level);
+    // Traffic secret of level (Handshake or Application) once derived
+    std::optional<quic::Secret> secret(quic::Space level, bool write) const;
+    const std::vector<std::uint8_t>& peerTransportParameters() const;
+    // The alert sent when the handshake failed, for CONNECTION_CLOSE
+    std::optional<std::uint8_t> alert() const;
+    std::string getLastError() const;
+
+private:
+    struct Level {
+        std::vector<std::uint8_t> input;
+        std::vector<std::uint8_t> output;
+        std::optional<quic::Secret> readSecret;
+        std::optional<quic::Secret> writeSecret;
+        std::unique_ptr<quic::Aead> recordKeys;  // the peer's, seals input into records
+        std::uint64_t recordSequence = 0;
+    };
+
+    static void keyLogCallback(const SSL* ssl, const char* line);
+    static void messageCallback(int writing, int version, int contentType, const void* buffer, std::size_t length,
+                                SSL* ssl, void* arg);
+    static int addParameters(SSL* ssl, unsigned int type, unsigned int context, const unsigned char** out,
+                             std::size_t* length, X509* x509, std::size_t chainIndex, int* alert, void* arg);
+    static int parseParameters(SSL* ssl, unsigned int type, unsigned int context, const unsigned char* in,
+                               std::size_t length, X509* x509, std::size_t chainIndex, int* alert, void* arg);
+
+    bool feedRecords();
+    void wipeSecrets();
+
+    SSL* ssl = nullptr;
+    BIO* networkIn = nullptr;
+    BIO* networkOut = nullptr;
+    bool server = false;
+    bool failed = false;
+    std::array<Level, quic::spaceCount> levels;
+    std::vector<std::uint8_t> localParameters;
+    std::vector<std::uint8_t> peerParameters;
+    std::optional<std::uint8_t> sentAlert;
+    std::string lastError;
+};
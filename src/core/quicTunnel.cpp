@@ -0,0 +1,2063 @@
+import std;
+#include "quicTunnel.h"
+#include "quicTls.h"
+#include "secureMemory.h"
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <cerrno>
+#endif
+
+using quic::Space;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Bytes = std::vector<std::uint8_t>;
+
+constexpr std::size_t connectionIdSize = 8;
+constexpr std::size_t resetTokenSize = 16;
+constexpr std::size_t maxAckRanges = 4;         // per ACK frame, so one fits in the tailroom
+constexpr std::size_t maxTrackedRanges = 32;    // received packet number ranges remembered
+constexpr std::size_t maxCryptoFrame = 1000;
+constexpr std::size_t maxTrackedPackets = 8192; // sent and not yet acknowledged or lost
+constexpr std::size_t maxQueuedDatagrams = 1024;
+constexpr std::size_t maxSpareConnectionIds = 8;
+constexpr std::size_t packetThreshold = 3;
+constexpr std::uint64_t maxStreamGap = 256 * 1024;
+
+constexpr std::chrono::milliseconds initialRtt{333};
+constexpr std::chrono::milliseconds granularity{1};
+constexpr std::chrono::milliseconds localMaxAckDelay{25};
+constexpr std::chrono::seconds localIdleTimeout{30};
+constexpr std::chrono::seconds pathCheckInterval{1};
+constexpr std::chrono::seconds oldPathDrainTime{1};
+constexpr std::chrono::seconds migrationHoldoff{1};
+
+// Frame types (RFC 9000 section 19, RFC 9221)
+enum Frame : std::uint8_t {
+    Padding = 0x00,
+    Ping = 0x01,
+    Ack = 0x02,
+    AckEcn = 0x03,
+    ResetStream = 0x04,
+    StopSending = 0x05,
+    Crypto = 0x06,
+    NewToken = 0x07,
+    Stream = 0x08,  // through 0x0f: OFF 0x04, LEN 0x02, FIN 0x01
+    MaxData = 0x10,
+    MaxStreamData = 0x11,
+    MaxStreamsBidi = 0x12,
+    MaxStreamsUni = 0x13,
+    DataBlocked = 0x14,
+    StreamDataBlocked = 0x15,
+    StreamsBlockedBidi = 0x16,
+    StreamsBlockedUni = 0x17,
+    NewConnectionId = 0x18,
+    RetireConnectionId = 0x19,
+    PathChallenge = 0x1a,
+    PathResponse = 0x1b,
+    ConnectionClose = 0x1c,
+    ApplicationClose = 0x1d,
+    HandshakeDone = 0x1e,
+    Datagram = 0x30,
+    DatagramWithLength = 0x31,
+};
+
+// Transport parameters (RFC 9000 section 18.2, RFC 9221)
+enum Parameter : std::uint64_t {
+    OriginalDestinationConnectionId = 0x00,
+    MaxIdleTimeout = 0x01,
+    InitialMaxData = 0x04,
+    InitialMaxStreamDataBidiLocal = 0x05,
+    InitialMaxStreamDataUni = 0x07,
+    InitialMaxStreamsBidi = 0x08,
+    InitialMaxStreamsUni = 0x09,
+    AckDelayExponent = 0x0a,
+    MaxAckDelay = 0x0b,
+    DisableActiveMigration = 0x0c,
+    ActiveConnectionIdLimit = 0x0e,
+    InitialSourceConnectionId = 0x0f,
+    RetrySourceConnectionId = 0x10,
+    MaxDatagramFrameSize = 0x20,
+};
+
+// QUIC transport errors and HTTP/3 (RFC 9114) codes
+constexpr std::uint64_t protocolViolation = 0x0a;
+constexpr std::uint64_t cryptoErrorBase = 0x100;
+constexpr std::uint64_t h3NoError = 0x100;
+constexpr std::uint64_t h3ControlStream = 0x00;
+constexpr std::uint64_t h3HeadersFrame = 0x01;
+constexpr std::uint64_t h3SettingsFrame = 0x04;
+constexpr std::uint64_t h3GoawayFrame = 0x07;
+constexpr std::uint64_t settingsEnableConnectProtocol = 0x08;  // RFC 9220
+constexpr std::uint64_t settingsH3Datagram = 0x33;             // RFC 9297
+
+// The streams this client opens: the CONNECT-UDP request and its control stream
+constexpr std::uint64_t requestStream = 0;
+constexpr std::uint64_t controlStream = 2;
+
+Bytes randomBytes(std::size_t size) {
+    Bytes out(size);
+    if (RAND_bytes(out.data(), static_cast<int>(out.size())) != 1) {
+        throw std::runtime_error("No random bytes for QUIC connection IDs");
+    }
+    return out;
+}
+
+void appendParameter(Bytes& out, std::uint64_t id, std::span<const std::uint8_t> value) {
+    quic::appendVarint(out, id);
+    quic::appendVarint(out, value.size());
+    quic::appendBytes(out, value);
+}
+
+void appendIntegerParameter(Bytes& out, std::uint64_t id, std::uint64_t value) {
+    std::array<std::uint8_t, 8> encoded{};
+    auto* end = quic::writeVarint(encoded.data(), value);
+    appendParameter(out, id, std::span<const std::uint8_t>(encoded.data(), end));
+}
+
+// QPACK/HPACK prefixed integer: the low prefixBits of the first byte, then 7-bit groups
+void appendPrefixInt(Bytes& out, std::uint8_t pattern, int prefixBits, std::uint64_t value) {
+    const std::uint64_t limit = (1u << prefixBits) - 1;
+    if (value < limit) {
+        out.push_back(static_cast<std::uint8_t>(pattern | value));
+        return;
+    }
+    out.push_back(static_cast<std::uint8_t>(pattern | limit));
+    value -= limit;
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+std::optional<std::uint64_t> readPrefixInt(quic::Reader& reader, std::uint8_t first, int prefixBits) {
+    const std::uint64_t limit = (1u << prefixBits) - 1;
+    std::uint64_t value = first & limit;
+    if (value < limit) {
+        return value;
+    }
+    for (int shift = 0; shift < 56; shift += 7) {
+        const std::uint8_t next = reader.byte();
+        if (!reader.ok()) {
+            return std::nullopt;
+        }
+        value += static_cast<std::uint64_t>(next & 0x7f) << shift;
+        if (!(next & 0x80)) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+void appendString(Bytes& out, std::string_view text) {
+    appendPrefixInt(out, 0x00, 7, text.size());
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+// Status codes are digits, and the Huffman codes of digits are all 5 or 6
+// bits long (RFC 7541 appendix B), which is all a Huffman :status needs
+std::optional<std::string> huffmanDigits(std::span<const std::uint8_t> data) {
+    std::string out;
+    const std::size_t totalBits = data.size() * 8;
+    std::size_t bit = 0;
+    auto peek = [&](std::size_t count) {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            const std::size_t at = bit + i;
+            const std::uint32_t set = at < totalBits ? (data[at / 8] >> (7 - at % 8)) & 1 : 1;
+            value = (value << 1) | set;
+        }
+        return value;
+    };
+    while (totalBits - bit >= 5) {
+        if (const auto code = peek(5); code <= 2) {
+            out.push_back(static_cast<char>('0' + code));
+            bit += 5;
+        } else if (const auto wide = peek(6); totalBits - bit >= 6 && wide >= 0x19 && wide <= 0x1f) {
+            out.push_back(static_cast<char>('3' + wide - 0x19));
+            bit += 6;
+        } else {
+            break;
+        }
+    }
+    // Only padding (a prefix of EOS, all ones) may remain
+    if (totalBits - bit >= 8 || peek(totalBits - bit) != (1u << (totalBits - bit)) - 1) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+// :status values of the QPACK static table (RFC 9204 appendix A)
+std::optional<int> staticStatus(std::uint64_t index) {
+    static constexpr std::array<std::pair<std::uint8_t, int>, 14> statuses{{
+        {24, 103}, {25, 200}, {26, 304}, {27, 404}, {28, 503}, {63, 100}, {64, 204},
+        {65, 206}, {66, 302}, {67, 400}, {68, 403}, {69, 421}, {70, 425}, {71, 500},
+    }};
+    for (const auto& [entry, status] : statuses) {
+        if (entry == index) {
+            return status;
+        }
+    }
+    return std::nullopt;
+}
+
+// The RFC 9298 default URI template; IPv6 literals have their colons escaped
+std::string masquePath(const std::string& host, const std::string& port) {
+    std::string escaped;
+    for (char c : host) {
+        if (c == ':') {
+            escaped += "%3A";
+        } else if (c != '[' && c != ']') {
+            escaped += c;
+        }
+    }
+    return "/.well-known/masque/udp/" + escaped + "/" + port + "/";
+}
+
+bool isIpLiteral(const std::string& host) {
+    in6_addr address{};
+    return ::inet_pton(AF_INET, host.c_str(), &address) == 1 || ::inet_pton(AF_INET6, host.c_str(), &address) == 1;
+}
+
+bool sameHost(const sockaddr_storage& a, const sockaddr_storage& b) {
+    if (a.ss_family != b.ss_family) {
+        return false;
+    }
+    if (a.ss_family == AF_INET) {
+        return reinterpret_cast<const sockaddr_in&>(a).sin_addr.s_addr ==
+               reinterpret_cast<const sockaddr_in&>(b).sin_addr.s_addr;
+    }
+    return std::memcmp(&reinterpret_cast<const sockaddr_in6&>(a).sin6_addr,
+                       &reinterpret_cast<const sockaddr_in6&>(b).sin6_addr, sizeof(in6_addr)) == 0;
+}
+
+// Send errors that mean the socket's route is gone rather than a lost packet
+bool routeLost() {
+    #ifdef _WIN32
+    const int error = WSAGetLastError();
+    return error == WSAENETUNREACH || error == WSAEHOSTUNREACH || error == WSAEADDRNOTAVAIL || error == WSAENETDOWN;
+    #else
+    return errno == ENETUNREACH || errno == EHOSTUNREACH || errno == EADDRNOTAVAIL || errno == ENETDOWN;
+    #endif
+}
+
+// In-order data of one stream, assembled from frames at any offset
+struct StreamInput {
+    std::uint64_t received = 0;  // end of the in-order data
+    std::map<std::uint64_t, Bytes> ahead;
+    Bytes data;                  // in order, not consumed yet
+    std::optional<std::uint64_t> type;  // of a unidirectional stream, once read
+    bool finished = false;
+
+    // False if the data lies implausibly far ahead
+    bool add(std::uint64_t offset, std::span<const std::uint8_t> bytes) {
+        if (offset + bytes.size() <= received) {
+            return true;
+        }
+        if (offset > received) {
+            if (offset - received > maxStreamGap) {
+                return false;
+            }
+            auto& piece = ahead[offset];
+            if (bytes.size() > piece.size()) {
+                piece.assign(bytes.begin(), bytes.end());
+            }
+            return true;
+        }
+        data.insert(data.end(), bytes.begin() + static_cast<std::ptrdiff_t>(received - offset), bytes.end());
+        received = offset + bytes.size();
+        while (!ahead.empty() && ahead.begin()->first <= received) {
+            const auto& [start, piece] = *ahead.begin();
+            if (start + piece.size() > received) {
+                data.insert(data.end(), piece.begin() + static_cast<std::ptrdiff_t>(received - start), piece.end());
+                received = start + piece.size();
+            }
+            ahead.erase(ahead.begin());
+        }
+        return true;
+    }
+};
+
+struct SentPacket {
+    std::uint64_t number = 0;
+    Clock::time_point sentAt{};
+    bool ackEliciting = false;
+    bool settled = false;  // acknowledged or declared lost
+    std::vector<Bytes> frames;  // what a loss sends again
+};
+
+} // namespace
+
+class QuicTunnel::Connection {
+public:
+    Connection(const Settings& settings, Stats& stats) : settings(settings), stats(stats) {}
+
+    ~Connection() {
+        closeSockets();
+        tls.reset();
+        SSL_CTX_free(sslContext);
+    }
+
+    bool open(const std::string& host, const std::string& port, int family);
+    void close();
+    bool isOpen() const { return socket != socketUtil::invalidSocket && !closed; }
+    bool sendInPlace(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length);
+    std::optional<Bytes> receive(std::chrono::milliseconds timeout, std::span<const SocketHandle> wakeHandles);
+    bool migrate();
+    std::optional<sockaddr_storage> remoteAddress() const { return peerAddress; }
+    const std::string& error() const { return lastError; }
+
+private:
+    struct SpaceState {
+        std::unique_ptr<quic::PacketKeys> readKeys;
+        std::unique_ptr<quic::PacketKeys> writeKeys;
+        std::uint64_t nextPacketNumber = 0;
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> received;  // [low, high], highest first
+        Clock::time_point largestReceivedAt{};
+        bool ackPending = false;
+        std::size_t unacknowledgedEliciting = 0;
+        Clock::time_point ackDeadline{};
+        std::deque<Bytes> pending;  // retransmittable frames waiting for a packet
+        bool probe = false;         // send something ack-eliciting
+        std::deque<SentPacket> sent;
+        std::optional<std::uint64_t> largestAcked;
+        std::optional<Clock::time_point> lossTime;
+        Clock::time_point lastElicitingSent{};
+        std::size_t elicitingInFlight = 0;
+        std::uint64_t cryptoOffset = 0;
+        StreamInput crypto;
+    };
+
+    struct PeerConnectionId {
+        std::uint64_t sequence = 0;
+        Bytes id;
+    };
+
+    SpaceState& space(Space which) { return spaces[static_cast<std::size_t>(which)]; }
+    const SpaceState& space(Space which) const { return spaces[static_cast<std::size_t>(which)]; }
+
+    bool setupTls();
+    Bytes transportParameters() const;
+    bool checkPeerParameters();
+    void driveTls();
+    void installKeys(Space which);
+    void queueCrypto(Space which, std::span<const std::uint8_t> data);
+    void discardSpace(Space which);
+
+    std::optional<int> service(Clock::time_point until, std::span<const SocketHandle> wakeHandles);
+    void readSocket(SocketHandle handle);
+    void processDatagram(std::span<std::uint8_t> datagram);
+    std::size_t processLongPacket(std::span<std::uint8_t> packet);
+    void processShortPacket(std::span<std::uint8_t> packet);
+    void handleRetry(std::span<const std::uint8_t> packet, std::span<const std::uint8_t> sourceId);
+    void onPacket(Space which, std::uint64_t number, std::span<const std::uint8_t> payload);
+    bool processFrames(Space which, std::span<const std::uint8_t> payload, bool& ackEliciting);
+    void onAck(Space which, std::uint64_t largest, std::uint64_t ackDelay,
+               const std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges);
+    void detectLoss(Space which, Clock::time_point now);
+    void settle(SpaceState& state, SentPacket& packet);
+    void onNewConnectionId(std::uint64_t sequence, std::uint64_t retirePriorTo, std::span<const std::uint8_t> id);
+    void retirePeerId(std::uint64_t sequence);
+    bool onStreamData(std::uint64_t id, std::uint64_t offset, std::span<const std::uint8_t> data, bool fin);
+    void processResponse();
+    void processControlStream(StreamInput& stream);
+    void sendRequest();
+
+    void flush();
+    Bytes buildPayload(Space which, std::size_t room, SentPacket& record, Clock::time_point now);
+    void appendAck(Space which, Bytes& out, Clock::time_point now);
+    std::size_t packetOverhead(Space which) const;
+    void appendPacket(Space which, Bytes& datagram, const Bytes& payload, SentPacket record);
+    bool sendDatagram(std::span<const std::uint8_t> datagram);
+
+    std::optional<Clock::time_point> lossDetectionDeadline(Space& which) const;
+    Clock::time_point nextDeadline() const;
+    void onTimers(Clock::time_point now);
+    std::chrono::microseconds probeTimeout(Space which) const;
+    std::chrono::milliseconds idleTimeout() const;
+    void checkPath(Clock::time_point now);
+    SocketHandle connectSocket(std::string* error) const;
+    void rememberLocalAddress();
+
+    void fail(const std::string& message, std::optional<std::uint64_t> transportError = std::nullopt);
+    void closeSockets();
+
+    Settings settings;
+    Stats& stats;
+    std::string lastError;
+    bool closed = false;
+
+    SocketHandle socket = socketUtil::invalidSocket;
+    SocketHandle oldSocket = socketUtil::invalidSocket;  // drained after a migration
+    Clock::time_point oldSocketDeadline{};
+    sockaddr_storage peerAddress{};
+    std::optional<sockaddr_storage> localAddress;
+    Clock::time_point nextPathCheck{};
+    Clock::time_point lastMigration{};
+    std::optional<std::array<std::uint8_t, 8>> pathChallenge;
+    std::vector<Bytes> immediateFrames;  // PATH_CHALLENGE / PATH_RESPONSE, not retransmitted
+
+    Bytes localId;
+    Bytes spareLocalId;  // issued with NEW_CONNECTION_ID once the handshake is done
+    Bytes originalDestinationId;
+    Bytes peerId;
+    std::uint64_t peerIdSequence = 0;
+    std::vector<PeerConnectionId> sparePeerIds;
+    Bytes retryToken;
+    std::optional<Bytes> retrySourceId;
+    std::optional<Bytes> serverSourceId;
+    bool receivedAny = false;
+
+    SSL_CTX* sslContext = nullptr;
+    std::unique_ptr<QuicTls> tls;
+    std::array<SpaceState, quic::spaceCount> spaces;
+    std::unique_ptr<quic::PacketKeys> nextReadKeys;      // for the peer's next key phase
+    std::unique_ptr<quic::PacketKeys> previousReadKeys;  // for packets reordered across an update
+    std::uint64_t keyPhaseStart = 0;                     // first packet number of the current phase
+    bool keyPhase = false;
+    bool handshakeComplete = false;
+    bool handshakeConfirmed = false;
+
+    // Peer transport parameters
+    std::uint64_t peerMaxDatagramFrame = 0;
+    std::uint64_t peerAckDelayExponent = 3;
+    std::chrono::milliseconds peerMaxAckDelay{25};
+    std::chrono::milliseconds peerIdleTimeout{0};
+    bool peerDisablesMigration = false;
+
+    // Recovery (RFC 9002 section 5)
+    std::optional<std::chrono::microseconds> smoothedRtt;
+    std::chrono::microseconds rttVariance{0};
+    std::chrono::microseconds latestRtt{0};
+    std::chrono::microseconds minRtt{0};
+    unsigned ptoCount = 0;
+    Clock::time_point lastReceived{};
+    Clock::time_point lastElicitingSent{};
+
+    // HTTP/3
+    std::map<std::uint64_t, StreamInput> peerStreams;
+    StreamInput response;
+    bool peerSettings = false;
+    bool requestSent = false;
+    std::optional<int> responseStatus;
+    bool established = false;
+
+    Bytes receiveBuffer = Bytes(65536);
+    std::deque<Bytes> incoming;
+};
+
+bool QuicTunnel::Connection::open(const std::string& host, const std::string& port, int family) {
+    std::vector<sockaddr_storage> addresses;
+    try {
+        addresses = socketUtil::resolve(host, port, SOCK_DGRAM, family);
+        localId = randomBytes(connectionIdSize);
+        spareLocalId = randomBytes(connectionIdSize);
+        originalDestinationId = randomBytes(connectionIdSize);
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return false;
+    }
+    if (addresses.empty()) {
+        lastError = "No address for " + host;
+        return false;
+    }
+    peerAddress = addresses.front();
+    peerId = originalDestinationId;
+
+    std::string socketError;
+    socket = connectSocket(&socketError);
+    if (socket == socketUtil::invalidSocket) {
+        lastError = "Cannot reach QUIC proxy " + host + ":" + port + ": " + socketError;
+        return false;
+    }
+    rememberLocalAddress();
+    if (!setupTls()) {
+        return false;
+    }
+
+    auto [clientSecret, serverSecret] = quic::initialSecrets(originalDestinationId);
+    space(Space::Initial).writeKeys = std::make_unique<quic::PacketKeys>(clientSecret);
+    space(Space::Initial).readKeys = std::make_unique<quic::PacketKeys>(serverSecret);
+    secureWipe(clientSecret.data(), clientSecret.size());
+    secureWipe(serverSecret.data(), serverSecret.size());
+
+    const auto start = Clock::now();
+    lastReceived = start;
+    nextPathCheck = start + pathCheckInterval;
+    driveTls();
+    flush();
+
+    const auto deadline = start + settings.handshakeTimeout;
+    while (!established && !closed) {
+        if (Clock::now() >= deadline) {
+            fail("QUIC handshake with " + host + ":" + port + " timed out");
+            break;
+        }
+        service(deadline, {});
+    }
+    return established && !closed;
+}
+
+bool QuicTunnel::Connection::setupTls() {
+    sslContext = SSL_CTX_new(TLS_client_method());
+    if (!sslContext || !QuicTls::configure(sslContext)) {
+        lastError = "Cannot set up TLS for QUIC";
+        return false;
+    }
+    SSL_CTX_set_verify(sslContext, SSL_VERIFY_PEER, nullptr);
+    SSL_CTX_set_default_verify_paths(sslContext);
+    if (!settings.caPem.empty()) {
+        X509_STORE* store = SSL_CTX_get_cert_store(sslContext);
+        BIO* bio = BIO_new_mem_buf(settings.caPem.data(), static_cast<int>(settings.caPem.size()));
+        while (X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+            X509_STORE_add_cert(store, cert);
+            X509_free(cert);
+        }
+        BIO_free(bio);
+        ERR_clear_error();
+    }
+
+    try {
+        tls = std::make_unique<QuicTls>(sslContext, false, transportParameters());
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return false;
+    }
+    SSL* ssl = tls->handle();
+    static constexpr std::array<unsigned char, 3> alpn{2, 'h', '3'};
+    SSL_set_alpn_protos(ssl, alpn.data(), alpn.size());
+    const std::string& name = settings.proxyHost;
+    if (isIpLiteral(name)) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), name.c_str());
+    } else {
+        SSL_set_tlsext_host_name(ssl, name.c_str());
+        SSL_set1_host(ssl, name.c_str());
+    }
+    return true;
+}
+
+Bytes QuicTunnel::Connection::transportParameters() const {
+    Bytes out;
+    appendIntegerParameter(out, MaxIdleTimeout,
+                           std::chrono::duration_cast<std::chrono::milliseconds>(localIdleTimeout).count());
+    appendIntegerParameter(out, InitialMaxData, 1 << 20);
+    appendIntegerParameter(out, InitialMaxStreamDataBidiLocal, 256 * 1024);
+    appendIntegerParameter(out, InitialMaxStreamDataUni, 64 * 1024);
+    appendIntegerParameter(out, InitialMaxStreamsUni, 16);
+    appendIntegerParameter(out, ActiveConnectionIdLimit, 4);
+    appendIntegerParameter(out, MaxDatagramFrameSize, 65535);
+    appendParameter(out, InitialSourceConnectionId, localId);
+    return out;
+}
+
+bool QuicTunnel::Connection::checkPeerParameters() {
+    quic::Reader reader(tls->peerTransportParameters());
+    std::optional<Bytes> original;
+    std::optional<Bytes> initialSource;
+    std::optional<Bytes> retrySource;
+    bool datagrams = false;
+    while (reader.ok() && !reader.atEnd()) {
+        const auto id = reader.varint();
+        const auto value = reader.bytes(reader.varint());
+        quic::Reader field(value);
+        switch (id) {
+        case OriginalDestinationConnectionId:
+            original.emplace(value.begin(), value.end());
+            break;
+        case InitialSourceConnectionId:
+            initialSource.emplace(value.begin(), value.end());
+            break;
+        case RetrySourceConnectionId:
+            retrySource.emplace(value.begin(), value.end());
+            break;
+        case MaxIdleTimeout:
+            peerIdleTimeout = std::chrono::milliseconds(field.varint());
+            break;
+        case AckDelayExponent:
+            peerAckDelayExponent = std::min<std::uint64_t>(field.varint(), 20);
+            break;
+        case MaxAckDelay:
+            peerMaxAckDelay = std::chrono::milliseconds(std::min<std::uint64_t>(field.varint(), 1 << 14));
+            break;
+        case DisableActiveMigration:
+            peerDisablesMigration = true;
+            break;
+        case MaxDatagramFrameSize:
+            peerMaxDatagramFrame = field.varint();
+            datagrams = true;
+            break;
+        default:
+            break;
+        }
+    }
+    if (!reader.ok()) {
+        fail("Malformed transport parameters from the QUIC proxy", protocolViolation);
+        return false;
+    }
+    // Authenticates the connection IDs of the handshake (RFC 9000 section 7.3)
+    if (original != originalDestinationId || initialSource != serverSourceId || retrySource != retrySourceId) {
+        fail("QUIC proxy connection IDs do not match its transport parameters", protocolViolation);
+        return false;
+    }
+    if (!datagrams) {
+        fail("QUIC proxy does not support DATAGRAM frames");
+        return false;
+    }
+    return true;
+}
+
+void QuicTunnel::Connection::driveTls() {
+    if (!tls->advance()) {
+        const auto alert = tls->alert();
+        fail(tls->getLastError(), cryptoErrorBase + alert.value_or(80));  // internal_error
+        return;
+    }
+    installKeys(Space::Handshake);
+    installKeys(Space::Application);
+    for (auto which : {Space::Initial, Space::Handshake, Space::Application}) {
+        queueCrypto(which, tls->takeOutput(which));
+    }
+
+    if (!handshakeComplete && tls->complete()) {
+        handshakeComplete = true;
+        const unsigned char* selected = nullptr;
+        unsigned int selectedLength = 0;
+        SSL_get0_alpn_selected(tls->handle(), &selected, &selectedLength);
+        if (std::string_view(reinterpret_cast<const char*>(selected), selectedLength) != "h3") {
+            fail("QUIC proxy did not agree on HTTP/3", cryptoErrorBase + 120);  // no_application_protocol
+            return;
+        }
+        if (!checkPeerParameters()) {
+            return;
+        }
+
+        // The control stream and its SETTINGS; the request waits for the proxy's
+        Bytes control{h3ControlStream, h3SettingsFrame};
+        Bytes settingsPayload;
+        quic::appendVarint(settingsPayload, settingsH3Datagram);
+        quic::appendVarint(settingsPayload, 1);
+        quic::appendVarint(control, settingsPayload.size());
+        quic::appendBytes(control, settingsPayload);
+        Bytes frame{static_cast<std::uint8_t>(Stream | 0x02)};
+        quic::appendVarint(frame, controlStream);
+        quic::appendVarint(frame, control.size());
+        quic::appendBytes(frame, control);
+        space(Space::Application).pending.push_back(std::move(frame));
+
+        // A second connection ID, so the proxy has one to switch to when we migrate
+        Bytes issue{NewConnectionId, 1, 0, static_cast<std::uint8_t>(spareLocalId.size())};
+        quic::appendBytes(issue, spareLocalId);
+        quic::appendBytes(issue, randomBytes(resetTokenSize));
+        space(Space::Application).pending.push_back(std::move(issue));
+    }
+}
+
+void QuicTunnel::Connection::installKeys(Space which) {
+    auto& state = space(which);
+    if (!state.writeKeys) {
+        if (auto secret = tls->secret(which, true)) {
+            state.writeKeys = std::make_unique<quic::PacketKeys>(*secret);
+            secureWipe(secret->data(), secret->size());
+        }
+    }
+    if (!state.readKeys) {
+        if (auto secret = tls->secret(which, false)) {
+            state.readKeys = std::make_unique<quic::PacketKeys>(*secret);
+            secureWipe(secret->data(), secret->size());
+            if (which == Space::Application) {
+                nextReadKeys = state.readKeys->next();
+            }
+        }
+    }
+}
+
+void QuicTunnel::Connection::queueCrypto(Space which, std::span<const std::uint8_t> data) {
+    auto& state = space(which);
+    while (!data.empty()) {
+        const auto chunk = data.first(std::min(data.size(), maxCryptoFrame));
+        data = data.subspan(chunk.size());
+        Bytes frame{Crypto};
+        quic::appendVarint(frame, state.cryptoOffset);
+        quic::appendVarint(frame, chunk.size());
+        quic::appendBytes(frame, chunk);
+        state.cryptoOffset += chunk.size();
+        state.pending.push_back(std::move(frame));
+    }
+}
+
+void QuicTunnel::Connection::discardSpace(Space which) {
+    auto& state = space(which);
+    state.readKeys.reset();
+    state.writeKeys.reset();
+    state.pending.clear();
+    state.sent.clear();
+    state.elicitingInFlight = 0;
+    state.lossTime.reset();
+    state.ackPending = false;
+    state.probe = false;
+    ptoCount = 0;
+}
+
+std::optional<int> QuicTunnel::Connection::service(Clock::time_point until, std::span<const SocketHandle> wakeHandles) {
+    std::vector<SocketHandle> handles{socket};
+    if (oldSocket != socketUtil::invalidSocket) {
+        handles.push_back(oldSocket);
+    }
+    const std::size_t sockets = handles.size();
+    handles.insert(handles.end(), wakeHandles.begin(), wakeHandles.end());
+
+    const auto now = Clock::now();
+    const auto wakeAt = std::min(until, nextDeadline());
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(std::max(wakeAt - now, Clock::duration{}));
+    const int ready = socketUtil::waitAnyReadable(handles, wait);
+    std::optional<int> woken;
+    if (ready >= 0 && static_cast<std::size_t>(ready) < sockets) {
+        // Whatever is queued on either path; the old one only until it drains
+        readSocket(socket);
+        if (oldSocket != socketUtil::invalidSocket) {
+            readSocket(oldSocket);
+        }
+    } else if (ready >= 0) {
+        woken = ready - static_cast<int>(sockets);
+    }
+    if (!closed) {
+        onTimers(Clock::now());
+    }
+    if (!closed) {
+        flush();
+    }
+    return woken;
+}
+
+void QuicTunnel::Connection::readSocket(SocketHandle handle) {
+    // Bounded so a flood cannot starve the timers
+    for (int i = 0; i < 256 && !closed; ++i) {
+        const auto received = ::recv(handle, reinterpret_cast<char*>(receiveBuffer.data()),
+                                     static_cast<int>(receiveBuffer.size()), 0);
+        if (received <= 0) {
+            return;  // drained; ICMP errors on UDP are not fatal either
+        }
+        processDatagram(std::span(receiveBuffer.data(), static_cast<std::size_t>(received)));
+    }
+}
+
+void QuicTunnel::Connection::processDatagram(std::span<std::uint8_t> datagram) {
+    // Several long header packets may share a datagram; a short header one ends it
+    std::size_t offset = 0;
+    while (offset < datagram.size() && !closed) {
+        auto packet = datagram.subspan(offset);
+        if (!(packet[0] & 0x80)) {
+            processShortPacket(packet);
+            break;
+        }
+        const std::size_t consumed = processLongPacket(packet);
+        if (consumed == 0) {
+            break;
+        }
+        offset += consumed;
+    }
+    if (!closed && tls && !handshakeConfirmed) {
+        driveTls();
+    }
+}
+
+std::size_t QuicTunnel::Connection::processLongPacket(std::span<std::uint8_t> packet) {
+    quic::Reader reader(packet);
+    reader.byte();
+    const auto version = static_cast<std::uint32_t>(reader.fixed(4));
+    const auto destinationId = reader.bytes(reader.byte());
+    const auto sourceId = reader.bytes(reader.byte());
+    if (!reader.ok() || !std::ranges::equal(destinationId, localId)) {
+        return 0;
+    }
+    if (version == 0) {
+        if (!receivedAny) {
+            fail("QUIC proxy does not support QUIC version 1");
+        }
+        return 0;
+    }
+    if (version != quic::version1) {
+        return 0;
+    }
+
+    const auto type = static_cast<quic::PacketType>((packet[0] >> 4) & 0x03);
+    if (type == quic::PacketType::Retry) {
+        handleRetry(packet, sourceId);
+        return 0;
+    }
+    if (type == quic::PacketType::Initial) {
+        reader.bytes(reader.varint());  // token, always empty from a server
+    }
+    const auto length = reader.varint();
+    const std::size_t numberOffset = reader.offset();
+    if (!reader.ok() || length > packet.size() - numberOffset) {
+        return 0;
+    }
+    const std::size_t end = numberOffset + length;
+    if (type == quic::PacketType::ZeroRtt) {
+        return end;
+    }
+
+    const Space which = type == quic::PacketType::Initial ? Space::Initial : Space::Handshake;
+    auto& state = space(which);
+    // The header protection sample needs 20 bytes past the packet number offset
+    if (!state.readKeys || length < quic::packetNumberSize + quic::tagSize) {
+        return end;
+    }
+    state.readKeys->unmaskHeader(packet.data(), numberOffset);
+    const std::size_t numberSize = (packet[0] & 0x03) + 1;
+    std::uint64_t truncated = 0;
+    for (std::size_t i = 0; i < numberSize; ++i) {
+        truncated = (truncated << 8) | packet[numberOffset + i];
+    }
+    const std::optional<std::uint64_t> largest =
+        state.received.empty() ? std::nullopt : std::optional(state.received.front().second);
+    const auto number = quic::decodePacketNumber(largest, truncated, numberSize);
+    const std::size_t headerLength = numberOffset + numberSize;
+    if (!state.readKeys->open(packet.data(), headerLength, end, number)) {
+        return end;
+    }
+    if (which == Space::Initial && !serverSourceId) {
+        // The proxy picks the connection ID we address from here on
+        serverSourceId.emplace(sourceId.begin(), sourceId.end());
+        peerId = *serverSourceId;
+    }
+    receivedAny = true;
+    onPacket(which, number, packet.subspan(headerLength, end - headerLength - quic::tagSize));
+    return end;
+}
+
+void QuicTunnel::Connection::processShortPacket(std::span<std::uint8_t> packet) {
+    auto& state = space(Space::Application);
+    const std::size_t numberOffset = 1 + connectionIdSize;
+    if (!state.readKeys || packet.size() < numberOffset + quic::packetNumberSize + quic::tagSize) {
+        return;
+    }
+    const auto destinationId = packet.subspan(1, connectionIdSize);
+    if (!std::ranges::equal(destinationId, localId) && !std::ranges::equal(destinationId, spareLocalId)) {
+        return;
+    }
+    state.readKeys->unmaskHeader(packet.data(), numberOffset);
+    const std::size_t numberSize = (packet[0] & 0x03) + 1;
+    std::uint64_t truncated = 0;
+    for (std::size_t i = 0; i < numberSize; ++i) {
+        truncated = (truncated << 8) | packet[numberOffset + i];
+    }
+    const std::optional<std::uint64_t> largest =
+        state.received.empty() ? std::nullopt : std::optional(state.received.front().second);
+    const auto number = quic::decodePacketNumber(largest, truncated, numberSize);
+    const std::size_t headerLength = numberOffset + numberSize;
+
+    // A flipped key phase bit is the peer's key update (RFC 9001 section 6),
+    // unless the packet predates the current phase and was only delayed
+    const bool phase = (packet[0] & 0x04) != 0;
+    const bool late = phase != keyPhase && previousReadKeys && number < keyPhaseStart;
+    const bool update = phase != keyPhase && !late;
+    auto& keys = late ? *previousReadKeys : update ? *nextReadKeys : *state.readKeys;
+    if (!keys.open(packet.data(), headerLength, packet.size(), number)) {
+        return;
+    }
+    if (update) {
+        previousReadKeys = std::move(state.readKeys);
+        state.readKeys = std::move(nextReadKeys);
+        nextReadKeys = state.readKeys->next();
+        state.writeKeys = state.writeKeys->next();
+        keyPhase = phase;
+        keyPhaseStart = number;
+        ++stats.keyUpdates;
+    }
+    onPacket(Space::Application, number, packet.subspan(headerLength, packet.size() - headerLength - quic::tagSize));
+}
+
+void QuicTunnel::Connection::handleRetry(std::span<const std::uint8_t> packet, std::span<const std::uint8_t> sourceId) {
+    // One Retry, before anything else from the proxy, with a valid tag
+    if (receivedAny || retrySourceId || packet.size() < 7 + localId.size() + sourceId.size() + quic::tagSize ||
+        !quic::retryTagValid(packet, originalDestinationId)) {
+        return;
+    }
+    const std::size_t tokenOffset = 7 + localId.size() + sourceId.size();
+    retryToken.assign(packet.begin() + static_cast<std::ptrdiff_t>(tokenOffset), packet.end() - quic::tagSize);
+    retrySourceId.emplace(sourceId.begin(), sourceId.end());
+    peerId = *retrySourceId;
+
+    // New Initial keys for the new destination ID; everything sent is sent again
+    auto [clientSecret, serverSecret] = quic::initialSecrets(peerId);
+    auto& initial = space(Space::Initial);
+    initial.writeKeys = std::make_unique<quic::PacketKeys>(clientSecret);
+    initial.readKeys = std::make_unique<quic::PacketKeys>(serverSecret);
+    secureWipe(clientSecret.data(), clientSecret.size());
+    secureWipe(serverSecret.data(), serverSecret.size());
+    std::deque<Bytes> resend;
+    for (auto& sent : initial.sent) {
+        for (auto& frame : sent.frames) {
+            resend.push_back(std::move(frame));
+        }
+    }
+    resend.insert(resend.end(), initial.pending.begin(), initial.pending.end());
+    initial.pending = std::move(resend);
+    initial.sent.clear();
+    initial.elicitingInFlight = 0;
+}
+
+void QuicTunnel::Connection::onPacket(Space which, std::uint64_t number, std::span<const std::uint8_t> payload) {
+    auto& state = space(which);
+    for (const auto& [low, high] : state.received) {
+        if (number >= low && number <= high) {
+            return;  // duplicate
+        }
+    }
+    if (state.received.size() == maxTrackedRanges && number < state.received.back().first) {
+        return;  // too old to tell
+    }
+
+    bool ackEliciting = false;
+    if (!processFrames(which, payload, ackEliciting)) {
+        if (!closed) {
+            fail("Malformed frame from the QUIC proxy", protocolViolation);
+        }
+        return;
+    }
+    const auto now = Clock::now();
+    lastReceived = now;
+    ++stats.packetsReceived;
+
+    // Insert into the ranges, highest first, merging neighbours
+    auto& ranges = state.received;
+    auto it = std::find_if(ranges.begin(), ranges.end(), [number](const auto& range) { return range.first <= number; });
+    if (it != ranges.end() && it->second + 1 == number) {
+        it->second = number;
+    } else {
+        it = ranges.insert(it, {number, number});
+    }
+    if (it != ranges.begin() && std::prev(it)->first == number + 1) {
+        std::prev(it)->first = it->first;
+        ranges.erase(it);
+    }
+    if (ranges.size() > maxTrackedRanges) {
+        ranges.pop_back();
+    }
+    if (number == ranges.front().second) {
+        state.largestReceivedAt = now;
+    }
+
+    if (ackEliciting) {
+        if (!state.ackPending) {
+            state.ackDeadline = now + localMaxAckDelay;
+        }
+        state.ackPending = true;
+        ++state.unacknowledgedEliciting;
+    }
+}
+
+bool QuicTunnel::Connection::processFrames(Space which, std::span<const std::uint8_t> payload, bool& ackEliciting) {
+    quic::Reader reader(payload);
+    while (reader.ok() && !reader.atEnd()) {
+        const auto type = reader.varint();
+        if (type != Padding && type != Ack && type != AckEcn && type != ConnectionClose && type != ApplicationClose) {
+            ackEliciting = true;
+        }
+        // Outside 1-RTT only these may appear (RFC 9000 section 12.4)
+        if (which != Space::Application && type != Padding && type != Ping && type != Ack && type != AckEcn &&
+            type != Crypto && type != ConnectionClose) {
+            return false;
+        }
+
+        switch (type) {
+        case Padding:
+        case Ping:
+            break;
+        case Ack:
+        case AckEcn: {
+            const auto largest = reader.varint();
+            const auto delay = reader.varint();
+            const auto rangeCount = reader.varint();
+            const auto firstRange = reader.varint();
+            if (!reader.ok() || firstRange > largest) {
+                return false;
+            }
+            std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges{{largest - firstRange, largest}};
+            for (std::uint64_t i = 0; i < rangeCount && reader.ok(); ++i) {
+                const auto gap = reader.varint();
+                const auto length = reader.varint();
+                const auto previousLow = ranges.back().first;
+                if (previousLow < gap + 2 || previousLow - gap - 2 < length) {
+                    return false;
+                }
+                const auto high = previousLow - gap - 2;
+                ranges.emplace_back(high - length, high);
+            }
+            if (type == AckEcn) {
+                reader.varint();
+                reader.varint();
+                reader.varint();
+            }
+            if (!reader.ok()) {
+                return false;
+            }
+            onAck(which, largest, delay, ranges);
+            break;
+        }
+        case ResetStream:
+        case StopSending: {
+            const auto id = reader.varint();
+            reader.varint();
+            if (type == ResetStream) {
+                reader.varint();
+            }
+            if (reader.ok() && id == requestStream) {
+                fail("QUIC proxy reset the tunnel stream");
+                return true;
+            }
+            break;
+        }
+        case Crypto: {
+            const auto offset = reader.varint();
+            const auto data = reader.bytes(reader.varint());
+            if (!reader.ok() || !space(which).crypto.add(offset, data)) {
+                return false;
+            }
+            auto& crypto = space(which).crypto;
+            if (!crypto.data.empty()) {
+                tls->provide(which, crypto.data);
+                crypto.data.clear();
+            }
+            break;
+        }
+        case NewToken:
+            reader.bytes(reader.varint());
+            break;
+        case MaxData:
+        case MaxStreamsBidi:
+        case MaxStreamsUni:
+        case DataBlocked:
+        case StreamsBlockedBidi:
+        case StreamsBlockedUni:
+            reader.varint();
+            break;
+        case MaxStreamData:
+        case StreamDataBlocked:
+            reader.varint();
+            reader.varint();
+            break;
+        case NewConnectionId: {
+            const auto sequence = reader.varint();
+            const auto retirePriorTo = reader.varint();
+            const auto id = reader.bytes(reader.byte());
+            reader.bytes(resetTokenSize);
+            if (!reader.ok() || id.empty() || id.size() > quic::maxConnectionIdSize || retirePriorTo > sequence) {
+                return false;
+            }
+            onNewConnectionId(sequence, retirePriorTo, id);
+            break;
+        }
+        case RetireConnectionId:
+            reader.varint();
+            break;
+        case PathChallenge: {
+            const auto data = reader.bytes(8);
+            Bytes frame{PathResponse};
+            quic::appendBytes(frame, data);
+            immediateFrames.push_back(std::move(frame));
+            break;
+        }
+        case PathResponse: {
+            const auto data = reader.bytes(8);
+            if (reader.ok() && pathChallenge && std::ranges::equal(data, *pathChallenge)) {
+                pathChallenge.reset();
+            }
+            break;
+        }
+        case ConnectionClose:
+        case ApplicationClose: {
+            const auto code = reader.varint();
+            if (type == ConnectionClose) {
+                reader.varint();
+            }
+            const auto reason = reader.bytes(reader.varint());
+            std::string message = "QUIC proxy closed the connection (code " + std::to_string(code) + ")";
+            if (!reason.empty()) {
+                message += ": " + std::string(reason.begin(), reason.end());
+            }
+            lastError = message;
+            closed = true;  // draining: nothing more is sent
+            return true;
+        }
+        case HandshakeDone:
+            if (!handshakeConfirmed) {
+                handshakeConfirmed = true;
+                discardSpace(Space::Handshake);
+            }
+            break;
+        case Datagram:
+        case DatagramWithLength: {
+            const auto data = type == Datagram ? reader.rest() : reader.bytes(reader.varint());
+            if (!reader.ok()) {
+                return false;
+            }
+            // Quarter stream ID of the request, then context ID 0: a UDP payload
+            quic::Reader http(data);
+            const auto quarterStream = http.varint();
+            const auto context = http.varint();
+            if (http.ok() && quarterStream == requestStream / 4 && context == 0 && requestSent) {
+                if (incoming.size() < maxQueuedDatagrams) {
+                    const auto packet = http.rest();
+                    incoming.emplace_back(packet.begin(), packet.end());
+                    ++stats.datagramsReceived;
+                } else {
+                    ++stats.datagramsDropped;
+                }
+            }
+            break;
+        }
+        default:
+            if (type >= Stream && type <= (Stream | 0x07)) {
+                const auto id = reader.varint();
+                const auto offset = (type & 0x04) ? reader.varint() : 0;
+                const auto data = (type & 0x02) ? reader.bytes(reader.varint()) : reader.rest();
+                if (!reader.ok() || !onStreamData(id, offset, data, (type & 0x01) != 0)) {
+                    return false;
+                }
+                break;
+            }
+            return false;
+        }
+    }
+    return reader.ok();
+}
+
+void QuicTunnel::Connection::onAck(Space which, std::uint64_t largest, std::uint64_t ackDelay,
+                                   const std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges) {
+    auto& state = space(which);
+    if (largest >= state.nextPacketNumber) {
+        fail("QUIC proxy acknowledged a packet never sent", protocolViolation);
+        return;
+    }
+    const auto now = Clock::now();
+    bool rttSample = false;
+    // The deque holds consecutive packet numbers, so a range maps to an index span
+    for (const auto& [low, high] : ranges) {
+        if (state.sent.empty()) {
+            break;
+        }
+        const auto first = state.sent.front().number;
+        const auto last = state.sent.back().number;
+        if (high < first || low > last) {
+            continue;
+        }
+        for (auto number = std::max(low, first); number <= std::min(high, last); ++number) {
+            auto& packet = state.sent[static_cast<std::size_t>(number - first)];
+            if (packet.settled) {
+                continue;
+            }
+            if (number == largest && packet.ackEliciting) {
+                latestRtt = std::chrono::duration_cast<std::chrono::microseconds>(now - packet.sentAt);
+                rttSample = true;
+            }
+            settle(state, packet);
+        }
+    }
+    if (!state.largestAcked || largest > *state.largestAcked) {
+        state.largestAcked = largest;
+    }
+
+    if (rttSample) {
+        // RFC 9002 section 5.3
+        if (!smoothedRtt) {
+            minRtt = latestRtt;
+            smoothedRtt = latestRtt;
+            rttVariance = latestRtt / 2;
+        } else {
+            minRtt = std::min(minRtt, latestRtt);
+            auto delay = which == Space::Application
+                             ? std::chrono::microseconds(ackDelay << peerAckDelayExponent)
+                             : std::chrono::microseconds{0};
+            delay = std::min<std::chrono::microseconds>(delay, peerMaxAckDelay);
+            auto adjusted = latestRtt >= minRtt + delay ? latestRtt - delay : latestRtt;
+            const auto deviation = *smoothedRtt > adjusted ? *smoothedRtt - adjusted : adjusted - *smoothedRtt;
+            rttVariance = (3 * rttVariance + deviation) / 4;
+            smoothedRtt = (7 * *smoothedRtt + adjusted) / 8;
+        }
+        stats.smoothedRtt = *smoothedRtt;
+    }
+    ptoCount = 0;
+    detectLoss(which, now);
+}
+
+void QuicTunnel::Connection::detectLoss(Space which, Clock::time_point now) {
+    auto& state = space(which);
+    state.lossTime.reset();
+    if (!state.largestAcked) {
+        return;
+    }
+    const auto rtt = std::max(latestRtt, smoothedRtt.value_or(initialRtt));
+    const auto lossDelay = std::max<std::chrono::microseconds>(rtt * 9 / 8, granularity);
+    for (auto& packet : state.sent) {
+        if (packet.number > *state.largestAcked) {
+            break;
+        }
+        if (packet.settled) {
+            continue;
+        }
+        if (*state.largestAcked - packet.number >= packetThreshold || packet.sentAt + lossDelay <= now) {
+            ++stats.packetsLost;
+            stats.retransmittedFrames += packet.frames.size();
+            for (auto& frame : packet.frames) {
+                state.pending.push_back(std::move(frame));
+            }
+            settle(state, packet);
+        } else {
+            const auto at = packet.sentAt + lossDelay;
+            state.lossTime = state.lossTime ? std::min(*state.lossTime, at) : at;
+        }
+    }
+    while (!state.sent.empty() && state.sent.front().settled) {
+        state.sent.pop_front();
+    }
+}
+
+void QuicTunnel::Connection::settle(SpaceState& state, SentPacket& packet) {
+    packet.settled = true;
+    packet.frames.clear();
+    if (packet.ackEliciting) {
+        --state.elicitingInFlight;
+    }
+}
+
+void QuicTunnel::Connection::onNewConnectionId(std::uint64_t sequence, std::uint64_t retirePriorTo,
+                                               std::span<const std::uint8_t> id) {
+    const bool known = sequence <= peerIdSequence ||
+                       std::ranges::any_of(sparePeerIds, [sequence](const auto& entry) { return entry.sequence == sequence; });
+    if (!known && sparePeerIds.size() < maxSpareConnectionIds) {
+        sparePeerIds.push_back({sequence, Bytes(id.begin(), id.end())});
+    }
+    // Everything below retirePriorTo goes, possibly the ID in use
+    std::erase_if(sparePeerIds, [&](const auto& entry) {
+        if (entry.sequence >= retirePriorTo) {
+            return false;
+        }
+        retirePeerId(entry.sequence);
+        return true;
+    });
+    if (peerIdSequence < retirePriorTo && !sparePeerIds.empty()) {
+        retirePeerId(peerIdSequence);
+        peerIdSequence = sparePeerIds.front().sequence;
+        peerId = std::move(sparePeerIds.front().id);
+        sparePeerIds.erase(sparePeerIds.begin());
+    }
+}
+
+void QuicTunnel::Connection::retirePeerId(std::uint64_t sequence) {
+    Bytes frame{RetireConnectionId};
+    quic::appendVarint(frame, sequence);
+    space(Space::Application).pending.push_back(std::move(frame));
+}
+
+bool QuicTunnel::Connection::onStreamData(std::uint64_t id, std::uint64_t offset, std::span<const std::uint8_t> data,
+                                          bool fin) {
+    if (id == requestStream) {
+        if (!response.add(offset, data)) {
+            return false;
+        }
+        processResponse();
+        if (fin && !closed) {
+            fail("QUIC proxy ended the tunnel stream");
+        }
+        return true;
+    }
+    if ((id & 0x03) != 0x03) {
+        return true;  // no other streams of ours carry anything back
+    }
+    auto& stream = peerStreams[id];
+    if (!stream.add(offset, data)) {
+        return false;
+    }
+    if (!stream.type && !stream.data.empty()) {
+        quic::Reader reader(stream.data);
+        const auto type = reader.varint();
+        if (reader.ok()) {
+            stream.type = type;
+            stream.data.erase(stream.data.begin(), stream.data.begin() + static_cast<std::ptrdiff_t>(reader.offset()));
+        }
+    }
+    if (stream.type == h3ControlStream) {
+        processControlStream(stream);
+    } else if (stream.type) {
+        stream.data.clear();  // QPACK encoder/decoder streams, or unknown ones
+    }
+    return true;
+}
+
+void QuicTunnel::Connection::processControlStream(StreamInput& stream) {
+    while (!closed) {
+        quic::Reader reader(stream.data);
+        const auto type = reader.varint();
+        const auto payload = reader.bytes(reader.varint());
+        if (!reader.ok()) {
+            return;  // frame incomplete
+        }
+        if (type == h3SettingsFrame) {
+            bool datagrams = false;
+            bool extendedConnect = false;
+            quic::Reader settingsReader(payload);
+            while (settingsReader.ok() && !settingsReader.atEnd()) {
+                const auto setting = settingsReader.varint();
+                const auto value = settingsReader.varint();
+                datagrams |= setting == settingsH3Datagram && value == 1;
+                extendedConnect |= setting == settingsEnableConnectProtocol && value == 1;
+            }
+            peerSettings = true;
+            if (!datagrams || !extendedConnect) {
+                fail(std::string("QUIC proxy does not support ") +
+                     (!datagrams ? "HTTP datagrams" : "extended CONNECT"));
+                return;
+            }
+            sendRequest();
+        } else if (type == h3GoawayFrame) {
+            fail("QUIC proxy is going away");
+            return;
+        }
+        stream.data.erase(stream.data.begin(), stream.data.begin() + static_cast<std::ptrdiff_t>(reader.offset()));
+    }
+}
+
+void QuicTunnel::Connection::sendRequest() {
+    if (requestSent) {
+        return;
+    }
+    // QPACK without the dynamic table: required insert count and base are 0
+    Bytes block{0x00, 0x00};
+    block.push_back(0xc0 | 15);  // :method CONNECT
+    appendPrefixInt(block, 0x20, 3, 9);
+    for (char c : std::string_view(":protocol")) {
+        block.push_back(static_cast<std::uint8_t>(c));
+    }
+    appendString(block, "connect-udp");
+    block.push_back(0xc0 | 23);  // :scheme https
+    block.push_back(0x50 | 0);   // :authority, literal value
+    appendString(block, settings.proxyHost + ":" + settings.proxyPort);
+    block.push_back(0x50 | 1);   // :path, literal value
+    appendString(block, masquePath(settings.targetHost, settings.targetPort));
+    appendPrefixInt(block, 0x20, 3, 16);
+    for (char c : std::string_view("capsule-protocol")) {
+        block.push_back(static_cast<std::uint8_t>(c));
+    }
+    appendString(block, "?1");
+
+    Bytes headers{static_cast<std::uint8_t>(h3HeadersFrame)};
+    quic::appendVarint(headers, block.size());
+    quic::appendBytes(headers, block);
+    Bytes frame{static_cast<std::uint8_t>(Stream | 0x02)};
+    quic::appendVarint(frame, requestStream);
+    quic::appendVarint(frame, headers.size());
+    quic::appendBytes(frame, headers);
+    space(Space::Application).pending.push_back(std::move(frame));
+    requestSent = true;
+}
+
+void QuicTunnel::Connection::processResponse() {
+    while (!closed) {
+        quic::Reader reader(response.data);
+        const auto type = reader.varint();
+        const auto payload = reader.bytes(reader.varint());
+        if (!reader.ok()) {
+            return;
+        }
+        if (type == h3HeadersFrame && !responseStatus) {
+            quic::Reader fields(payload);
+            fields.byte();
+            fields.byte();
+            while (fields.ok() && !fields.atEnd() && !responseStatus) {
+                const std::uint8_t first = fields.byte();
+                if (first & 0x80) {
+                    // Indexed field line; only the static table exists here
+                    const auto index = readPrefixInt(fields, first, 6);
+                    if (!(first & 0x40) || !index) {
+                        break;
+                    }
+                    responseStatus = staticStatus(*index);
+                } else if (first & 0x40) {
+                    // Literal value with a name reference
+                    const auto index = readPrefixInt(fields, first, 4);
+                    const std::uint8_t lengthByte = fields.byte();
+                    const auto length = readPrefixInt(fields, lengthByte, 7);
+                    if (!index || !length) {
+                        break;
+                    }
+                    const auto value = fields.bytes(*length);
+                    if ((first & 0x10) && staticStatus(*index)) {
+                        auto text = (lengthByte & 0x80) ? huffmanDigits(value)
+                                                        : std::optional(std::string(value.begin(), value.end()));
+                        int status = 0;
+                        if (text && std::from_chars(text->data(), text->data() + text->size(), status).ec == std::errc{}) {
+                            responseStatus = status;
+                        }
+                    }
+                } else if (first & 0x20) {
+                    // Literal name and value
+                    const auto nameLength = readPrefixInt(fields, first, 3);
+                    if (!nameLength) {
+                        break;
+                    }
+                    fields.bytes(*nameLength);
+                    const auto valueLength = readPrefixInt(fields, fields.byte(), 7);
+                    if (!valueLength) {
+                        break;
+                    }
+                    fields.bytes(*valueLength);
+                } else {
+                    break;  // post-base references need a dynamic table we never allowed
+                }
+            }
+            if (!responseStatus) {
+                fail("QUIC proxy sent a response without a usable :status");
+                return;
+            }
+            if (*responseStatus < 200 || *responseStatus > 299) {
+                fail("QUIC proxy refused CONNECT-UDP with status " + std::to_string(*responseStatus));
+                return;
+            }
+            established = true;
+        }
+        // DATA frames carry capsules, none of which this tunnel needs
+        response.data.erase(response.data.begin(), response.data.begin() + static_cast<std::ptrdiff_t>(reader.offset()));
+    }
+}
+
+void QuicTunnel::Connection::flush() {
+    while (!closed) {
+        const auto now = Clock::now();
+        std::array<Bytes, quic::spaceCount> payloads;
+        std::array<SentPacket, quic::spaceCount> records;
+        std::size_t room = quic::minDatagramSize;
+        for (auto which : {Space::Initial, Space::Handshake, Space::Application}) {
+            const auto index = static_cast<std::size_t>(which);
+            if (!space(which).writeKeys || room <= packetOverhead(which) + 16) {
+                continue;
+            }
+            payloads[index] = buildPayload(which, room - packetOverhead(which), records[index], now);
+            if (!payloads[index].empty()) {
+                room -= packetOverhead(which) + payloads[index].size();
+            }
+        }
+        const auto last = std::find_if(payloads.rbegin(), payloads.rend(), [](const Bytes& p) { return !p.empty(); });
+        if (last == payloads.rend()) {
+            return;
+        }
+        // A datagram with an Initial packet is padded to 1200 bytes (RFC 9000 section 14.1)
+        if (!payloads[0].empty()) {
+            last->resize(last->size() + room, Padding);
+        }
+
+        Bytes datagram;
+        for (auto which : {Space::Initial, Space::Handshake, Space::Application}) {
+            const auto index = static_cast<std::size_t>(which);
+            if (!payloads[index].empty()) {
+                appendPacket(which, datagram, payloads[index], std::move(records[index]));
+            }
+        }
+        sendDatagram(datagram);
+        // The client drops Initial keys once it sends a Handshake packet (RFC 9001 section 4.9.1)
+        if (!payloads[1].empty() && space(Space::Initial).writeKeys) {
+            discardSpace(Space::Initial);
+        }
+    }
+}
+
+Bytes QuicTunnel::Connection::buildPayload(Space which, std::size_t room, SentPacket& record, Clock::time_point now) {
+    auto& state = space(which);
+    Bytes payload;
+    const bool application = which == Space::Application;
+    const bool ackDue = state.ackPending &&
+                        (!application || state.unacknowledgedEliciting >= 2 || now >= state.ackDeadline);
+    const bool sending = !state.pending.empty() || state.probe || (application && !immediateFrames.empty());
+    if (ackDue || (state.ackPending && sending)) {
+        appendAck(which, payload, now);
+    }
+    while (!state.pending.empty() && payload.size() + state.pending.front().size() <= room) {
+        payload.insert(payload.end(), state.pending.front().begin(), state.pending.front().end());
+        record.frames.push_back(std::move(state.pending.front()));
+        state.pending.pop_front();
+        record.ackEliciting = true;
+    }
+    if (application) {
+        for (auto it = immediateFrames.begin(); it != immediateFrames.end();) {
+            if (payload.size() + it->size() > room) {
+                break;
+            }
+            payload.insert(payload.end(), it->begin(), it->end());
+            it = immediateFrames.erase(it);
+            record.ackEliciting = true;
+        }
+    }
+    if (state.probe) {
+        if (!record.ackEliciting) {
+            payload.push_back(Ping);
+            record.ackEliciting = true;
+        }
+        state.probe = false;
+    }
+    return payload;
+}
+
+void QuicTunnel::Connection::appendAck(Space which, Bytes& out, Clock::time_point now) {
+    auto& state = space(which);
+    const auto& ranges = state.received;
+    if (ranges.empty()) {
+        return;
+    }
+    out.push_back(Ack);
+    quic::appendVarint(out, ranges.front().second);
+    const auto delay = which == Space::Application
+                           ? std::chrono::duration_cast<std::chrono::microseconds>(now - state.largestReceivedAt).count() >> 3
+                           : 0;
+    quic::appendVarint(out, static_cast<std::uint64_t>(std::max<std::int64_t>(delay, 0)));
+    const std::size_t count = std::min(ranges.size(), maxAckRanges);
+    quic::appendVarint(out, count - 1);
+    quic::appendVarint(out, ranges.front().second - ranges.front().first);
+    for (std::size_t i = 1; i < count; ++i) {
+        quic::appendVarint(out, ranges[i - 1].first - ranges[i].second - 2);
+        quic::appendVarint(out, ranges[i].second - ranges[i].first);
+    }
+    state.ackPending = false;
+    state.unacknowledgedEliciting = 0;
+}
+
+std::size_t QuicTunnel::Connection::packetOverhead(Space which) const {
+    if (which == Space::Application) {
+        return 1 + peerId.size() + quic::packetNumberSize + quic::tagSize;
+    }
+    std::size_t size = 1 + 4 + 1 + peerId.size() + 1 + localId.size() + 2 + quic::packetNumberSize + quic::tagSize;
+    if (which == Space::Initial) {
+        size += quic::varintSize(retryToken.size()) + retryToken.size();
+    }
+    return size;
+}
+
+void QuicTunnel::Connection::appendPacket(Space which, Bytes& datagram, const Bytes& payload, SentPacket record) {
+    auto& state = space(which);
+    const std::uint64_t number = state.nextPacketNumber++;
+    const std::size_t start = datagram.size();
+    if (which == Space::Application) {
+        datagram.push_back(static_cast<std::uint8_t>(0x43 | (keyPhase ? 0x04 : 0)));
+        quic::appendBytes(datagram, peerId);
+    } else {
+        const auto type = which == Space::Initial ? quic::PacketType::Initial : quic::PacketType::Handshake;
+        datagram.push_back(static_cast<std::uint8_t>(0xc3 | (static_cast<std::uint8_t>(type) << 4)));
+        datagram.insert(datagram.end(), {0, 0, 0, 1});
+        datagram.push_back(static_cast<std::uint8_t>(peerId.size()));
+        quic::appendBytes(datagram, peerId);
+        datagram.push_back(static_cast<std::uint8_t>(localId.size()));
+        quic::appendBytes(datagram, localId);
+        if (which == Space::Initial) {
+            quic::appendVarint(datagram, retryToken.size());
+            quic::appendBytes(datagram, retryToken);
+        }
+        datagram.resize(datagram.size() + 2);
+        quic::writeVarint(&datagram[datagram.size() - 2], quic::packetNumberSize + payload.size() + quic::tagSize, 2);
+    }
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        datagram.push_back(static_cast<std::uint8_t>(number >> shift));
+    }
+    const std::size_t headerLength = datagram.size() - start;
+    quic::appendBytes(datagram, payload);
+    datagram.resize(datagram.size() + quic::tagSize);
+    state.writeKeys->protect(datagram.data() + start, headerLength, payload.size(), number);
+
+    const auto now = Clock::now();
+    record.number = number;
+    record.sentAt = now;
+    if (record.ackEliciting) {
+        ++state.elicitingInFlight;
+        state.lastElicitingSent = now;
+        lastElicitingSent = now;
+    }
+    state.sent.push_back(std::move(record));
+    if (state.sent.size() > maxTrackedPackets) {
+        // The proxy stopped acknowledging; forget the oldest as lost
+        auto& oldest = state.sent.front();
+        if (!oldest.settled) {
+            ++stats.packetsLost;
+            for (auto& frame : oldest.frames) {
+                state.pending.push_back(std::move(frame));
+            }
+            settle(state, oldest);
+        }
+        state.sent.pop_front();
+    }
+    ++stats.packetsSent;
+}
+
+bool QuicTunnel::Connection::sendDatagram(std::span<const std::uint8_t> datagram) {
+    const auto sent = ::send(socket, reinterpret_cast<const char*>(datagram.data()), static_cast<int>(datagram.size()), 0);
+    if (sent >= 0) {
+        return true;
+    }
+    const bool gone = routeLost();
+    lastError = "Send failed: " + socketUtil::lastErrorText();
+    // The packet counts as lost; the new path carries its retransmission
+    if (gone && handshakeConfirmed && Clock::now() - lastMigration >= migrationHoldoff) {
+        migrate();
+    }
+    return false;
+}
+
+bool QuicTunnel::Connection::sendInPlace(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length) {
+    if (!established || closed) {
+        lastError = closed ? lastError : "QUIC tunnel is not established";
+        return false;
+    }
+    // DATAGRAM frame with length, quarter stream ID, context ID, payload
+    const std::size_t frameHeader = 1 + 2 + 2;
+    if (length + 2 > 16383 || length + frameHeader > peerMaxDatagramFrame) {
+        ++stats.datagramsDropped;
+        return true;  // like a packet too large for the path
+    }
+    const std::size_t headerLength = 1 + peerId.size() + quic::packetNumberSize;
+    if (offset < headerLength + frameHeader || buffer.size() - offset - length < tailroom) {
+        lastError = "No room around the packet for QUIC framing";
+        return false;
+    }
+
+    auto& state = space(Space::Application);
+    const auto now = Clock::now();
+    const std::size_t start = offset - headerLength - frameHeader;
+    std::uint8_t* packet = buffer.data() + start;
+    const std::uint64_t number = state.nextPacketNumber++;
+    packet[0] = static_cast<std::uint8_t>(0x43 | (keyPhase ? 0x04 : 0));
+    std::copy(peerId.begin(), peerId.end(), packet + 1);
+    for (std::size_t i = 0; i < quic::packetNumberSize; ++i) {
+        packet[1 + peerId.size() + i] = static_cast<std::uint8_t>(number >> (8 * (quic::packetNumberSize - 1 - i)));
+    }
+    std::uint8_t* frame = packet + headerLength;
+    frame[0] = DatagramWithLength;
+    quic::writeVarint(frame + 1, length + 2, 2);
+    frame[3] = 0;  // quarter stream ID of the request stream
+    frame[4] = 0;  // context ID 0: UDP payload
+    std::size_t payloadLength = frameHeader + length;
+
+    // An acknowledgement that is pending anyway rides along
+    if (state.ackPending) {
+        Bytes ack;
+        appendAck(Space::Application, ack, now);
+        std::copy(ack.begin(), ack.end(), packet + headerLength + payloadLength);
+        payloadLength += ack.size();
+    }
+    state.writeKeys->protect(packet, headerLength, payloadLength, number);
+
+    state.sent.push_back({number, now, true, false, {}});
+    ++state.elicitingInFlight;
+    state.lastElicitingSent = now;
+    lastElicitingSent = now;
+    if (state.sent.size() > maxTrackedPackets) {
+        auto& oldest = state.sent.front();
+        if (!oldest.settled) {
+            for (auto& lost : oldest.frames) {
+                state.pending.push_back(std::move(lost));
+            }
+            settle(state, oldest);
+        }
+        state.sent.pop_front();
+    }
+    ++stats.packetsSent;
+    ++stats.datagramsSent;
+    return sendDatagram(std::span(packet, headerLength + payloadLength + quic::tagSize));
+}
+
+std::optional<Bytes> QuicTunnel::Connection::receive(std::chrono::milliseconds timeout,
+                                                     std::span<const SocketHandle> wakeHandles) {
+    const auto deadline = Clock::now() + timeout;
+    while (true) {
+        if (!incoming.empty()) {
+            Bytes packet = std::move(incoming.front());
+            incoming.pop_front();
+            return packet;
+        }
+        if (closed) {
+            return std::nullopt;
+        }
+        if (service(deadline, wakeHandles)) {
+            return std::nullopt;
+        }
+        if (incoming.empty() && Clock::now() >= deadline) {
+            return std::nullopt;
+        }
+    }
+}
+
+std::optional<Clock::time_point> QuicTunnel::Connection::lossDetectionDeadline(Space& which) const {
+    // Time threshold loss first, then the probe timeout (RFC 9002 section 6.2)
+    std::optional<Clock::time_point> earliest;
+    for (auto candidate : {Space::Initial, Space::Handshake, Space::Application}) {
+        const auto& state = spaces[static_cast<std::size_t>(candidate)];
+        if (state.lossTime && (!earliest || *state.lossTime < *earliest)) {
+            earliest = state.lossTime;
+            which = candidate;
+        }
+    }
+    if (earliest) {
+        return earliest;
+    }
+    for (auto candidate : {Space::Initial, Space::Handshake, Space::Application}) {
+        const auto& state = spaces[static_cast<std::size_t>(candidate)];
+        if (state.elicitingInFlight == 0 || !state.writeKeys) {
+            continue;
+        }
+        const auto at = state.lastElicitingSent + probeTimeout(candidate) * (1u << std::min(ptoCount, 10u));
+        if (!earliest || at < *earliest) {
+            earliest = at;
+            which = candidate;
+        }
+    }
+    if (!earliest && !handshakeComplete) {
+        // Nothing in flight yet the handshake is stuck: the proxy may be
+        // waiting on the client to prove its address (anti-deadlock)
+        which = space(Space::Handshake).writeKeys ? Space::Handshake : Space::Initial;
+        earliest = lastElicitingSent + probeTimeout(which) * (1u << std::min(ptoCount, 10u));
+    }
+    return earliest;
+}
+
+Clock::time_point QuicTunnel::Connection::nextDeadline() const {
+    Space which = Space::Application;
+    auto deadline = std::min(lastReceived + idleTimeout(), nextPathCheck);
+    if (auto loss = lossDetectionDeadline(which)) {
+        deadline = std::min(deadline, *loss);
+    }
+    const auto& application = spaces[static_cast<std::size_t>(Space::Application)];
+    if (application.ackPending) {
+        deadline = std::min(deadline, application.ackDeadline);
+    }
+    if (handshakeConfirmed) {
+        deadline = std::min(deadline, lastElicitingSent + idleTimeout() / 2);
+    }
+    if (oldSocket != socketUtil::invalidSocket) {
+        deadline = std::min(deadline, oldSocketDeadline);
+    }
+    return deadline;
+}
+
+void QuicTunnel::Connection::onTimers(Clock::time_point now) {
+    if (now - lastReceived >= idleTimeout()) {
+        lastError = "QUIC connection to the proxy timed out";
+        closed = true;  // idle timeout closes silently
+        return;
+    }
+
+    Space which = Space::Application;
+    if (auto deadline = lossDetectionDeadline(which); deadline && now >= *deadline) {
+        auto& state = space(which);
+        if (state.lossTime) {
+            detectLoss(which, now);
+        } else {
+            // Probe: resend the oldest outstanding frames, or just ask for an ACK
+            ++ptoCount;
+            auto oldest = std::find_if(state.sent.begin(), state.sent.end(),
+                                       [](const SentPacket& packet) { return !packet.settled && !packet.frames.empty(); });
+            if (oldest != state.sent.end()) {
+                for (const auto& frame : oldest->frames) {
+                    state.pending.push_back(frame);
+                }
+                stats.retransmittedFrames += oldest->frames.size();
+            }
+            state.probe = true;
+            lastElicitingSent = now;
+        }
+    }
+
+    if (handshakeConfirmed && now - lastElicitingSent >= idleTimeout() / 2) {
+        space(Space::Application).probe = true;  // keep the proxy's and any NAT's state alive
+    }
+    if (oldSocket != socketUtil::invalidSocket && now >= oldSocketDeadline) {
+        socketUtil::closeSocket(oldSocket);
+        oldSocket = socketUtil::invalidSocket;
+    }
+    if (now >= nextPathCheck) {
+        checkPath(now);
+    }
+}
+
+std::chrono::microseconds QuicTunnel::Connection::probeTimeout(Space which) const {
+    const auto rtt = smoothedRtt.value_or(initialRtt);
+    const auto variance = smoothedRtt ? rttVariance : std::chrono::microseconds(initialRtt) / 2;
+    auto timeout = rtt + std::max<std::chrono::microseconds>(4 * variance, granularity);
+    if (which == Space::Application) {
+        timeout += peerMaxAckDelay;
+    }
+    return timeout;
+}
+
+std::chrono::milliseconds QuicTunnel::Connection::idleTimeout() const {
+    const auto local = std::chrono::duration_cast<std::chrono::milliseconds>(localIdleTimeout);
+    return peerIdleTimeout.count() > 0 ? std::min(local, peerIdleTimeout) : local;
+}
+
+void QuicTunnel::Connection::checkPath(Clock::time_point now) {
+    nextPathCheck = now + pathCheckInterval;
+    if (!handshakeConfirmed || !localAddress) {
+        return;
+    }
+    // Where would a new socket to the proxy be sent from now? A connected
+    // UDP socket answers that from the routing table without any traffic.
+    SocketHandle probe = connectSocket(nullptr);
+    if (probe == socketUtil::invalidSocket) {
+        return;
+    }
+    sockaddr_storage current{};
+    socklen_t length = sizeof(current);
+    const bool known = ::getsockname(probe, reinterpret_cast<sockaddr*>(&current), &length) == 0;
+    socketUtil::closeSocket(probe);
+    if (known && !sameHost(current, *localAddress) && now - lastMigration >= migrationHoldoff) {
+        migrate();
+    }
+}
+
+void QuicTunnel::Connection::rememberLocalAddress() {
+    // What checkPath() compares the current route against
+    sockaddr_storage local{};
+    socklen_t length = sizeof(local);
+    if (::getsockname(socket, reinterpret_cast<sockaddr*>(&local), &length) == 0) {
+        localAddress = local;
+    }
+}
+
+QuicTunnel::SocketHandle QuicTunnel::Connection::connectSocket(std::string* error) const {
+    SocketHandle handle = ::socket(peerAddress.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (handle == socketUtil::invalidSocket) {
+        if (error) {
+            *error = socketUtil::lastErrorText();
+        }
+        return handle;
+    }
+    if (::connect(handle, reinterpret_cast<const sockaddr*>(&peerAddress), socketUtil::addressLength(peerAddress)) != 0 ||
+        !socketUtil::setNonBlocking(handle)) {
+        if (error) {
+            *error = socketUtil::lastErrorText();
+        }
+        socketUtil::closeSocket(handle);
+        return socketUtil::invalidSocket;
+    }
+    return handle;
+}
+
+bool QuicTunnel::Connection::migrate() {
+    if (!handshakeConfirmed || closed) {
+        lastError = "QUIC connection cannot migrate before the handshake is confirmed";
+        return false;
+    }
+    if (peerDisablesMigration) {
+        lastError = "QUIC proxy does not allow migration";
+        return false;
+    }
+    std::string socketError;
+    SocketHandle fresh = connectSocket(&socketError);
+    if (fresh == socketUtil::invalidSocket) {
+        lastError = "Cannot open a new path to the QUIC proxy: " + socketError;
+        return false;
+    }
+    lastMigration = Clock::now();
+
+    // Keep reading the old path briefly for packets already under way
+    if (oldSocket != socketUtil::invalidSocket) {
+        socketUtil::closeSocket(oldSocket);
+    }
+    oldSocket = socket;
+    oldSocketDeadline = lastMigration + oldPathDrainTime;
+    socket = fresh;
+    rememberLocalAddress();
+
+    // A fresh connection ID keeps the paths unlinkable to observers (RFC 9000 section 9.5)
+    if (!sparePeerIds.empty()) {
+        retirePeerId(peerIdSequence);
+        peerIdSequence = sparePeerIds.front().sequence;
+        peerId = std::move(sparePeerIds.front().id);
+        sparePeerIds.erase(sparePeerIds.begin());
+    }
+
+    // Validate the new path with a full-size probe (RFC 9000 section 8.2)
+    std::array<std::uint8_t, 8> challenge{};
+    RAND_bytes(challenge.data(), static_cast<int>(challenge.size()));
+    pathChallenge = challenge;
+    Bytes payload{PathChallenge};
+    quic::appendBytes(payload, challenge);
+    const std::size_t target = quic::minDatagramSize - packetOverhead(Space::Application);
+    payload.resize(std::max(payload.size(), target), Padding);
+    Bytes datagram;
+    appendPacket(Space::Application, datagram, payload, SentPacket{0, {}, true, false, {}});
+    sendDatagram(datagram);
+    ++stats.migrations;
+    return true;
+}
+
+void QuicTunnel::Connection::fail(const std::string& message, std::optional<std::uint64_t> transportError) {
+    lastError = message;
+    if (closed) {
+        return;
+    }
+    // Tell the proxy, in the best keys available; no retransmission
+    Space which = Space::Initial;
+    for (auto candidate : {Space::Application, Space::Handshake, Space::Initial}) {
+        if (space(candidate).writeKeys) {
+            which = candidate;
+            break;
+        }
+    }
+    if (socket != socketUtil::invalidSocket && space(which).writeKeys) {
+        Bytes payload;
+        if (which == Space::Application && !transportError) {
+            payload.push_back(ApplicationClose);
+            quic::appendVarint(payload, 0x101);  // H3_GENERAL_PROTOCOL_ERROR
+        } else {
+            payload.push_back(ConnectionClose);
+            quic::appendVarint(payload, transportError.value_or(protocolViolation));
+            quic::appendVarint(payload, 0);
+        }
+        quic::appendVarint(payload, 0);
+        if (which == Space::Initial) {
+            payload.resize(quic::minDatagramSize - packetOverhead(which), Padding);
+        }
+        Bytes datagram;
+        appendPacket(which, datagram, payload, {});
+        ::send(socket, reinterpret_cast<const char*>(datagram.data()), static_cast<int>(datagram.size()), 0);
+    }
+    closed = true;
+}
+
+void QuicTunnel::Connection::close() {
+    if (!closed && socket != socketUtil::invalidSocket && space(Space::Application).writeKeys) {
+        Bytes payload{ApplicationClose};
+        quic::appendVarint(payload, h3NoError);
+        quic::appendVarint(payload, 0);
+        Bytes datagram;
+        appendPacket(Space::Application, datagram, payload, {});
+        ::send(socket, reinterpret_cast<const char*>(datagram.data()), static_cast<int>(datagram.size()), 0);
+    }
+    closed = true;
+    closeSockets();
+}
+
+void QuicTunnel::Connection::closeSockets() {
+    for (auto* handle : {&socket, &oldSocket}) {
+        if (*handle != socketUtil::invalidSocket) {
+            socketUtil::closeSocket(*handle);
+            *handle = socketUtil::invalidSocket;
+        }
+    }
+}
+
+QuicTunnel::Settings QuicTunnel::settingsFromProfile(const OvpnProfile& profile, const OvpnProfile::Remote& remote) {
+    Settings settings;
+    settings.targetHost = remote.host;
+    settings.targetPort = remote.port;
+    settings.proxyHost = remote.host;
+    settings.proxyPort = defaultProxyPort;
+    if (std::string proxy = profile.environment(proxyVariable); !proxy.empty()) {
+        // host, host:port, or [v6]:port
+        const auto colon = proxy.rfind(':');
+        const bool bareV6 = proxy.find(':') != colon && !proxy.starts_with('[');
+        if (colon != std::string::npos && !bareV6) {
+            settings.proxyPort = proxy.substr(colon + 1);
+            proxy.resize(colon);
+        }
+        if (proxy.starts_with('[') && proxy.ends_with(']')) {
+            proxy = proxy.substr(1, proxy.size() - 2);
+        }
+        settings.proxyHost = proxy;
+    }
+    settings.caPem = profile.inlineBlock("ca");
+    return settings;
+}
+
+QuicTunnel::QuicTunnel() {
+    socketUtil::ensureInitialized();
+}
+
+QuicTunnel::~QuicTunnel() {
+    close();
+}
+
+bool QuicTunnel::open(const std::string& host, const std::string& port, int family, const Settings& settings) {
+    close();
+    statistics = {};
+    connection = std::make_unique<Connection>(settings, statistics);
+    if (!connection->open(host, port, family)) {
+        lastError = connection->error();
+        connection.reset();
+        return false;
+    }
+    return true;
+}
+
+void QuicTunnel::close() {
+    if (connection) {
+        connection->close();
+        connection.reset();
+    }
+}
+
+bool QuicTunnel::isOpen() const {
+    return connection && connection->isOpen();
+}
+
+bool QuicTunnel::send(std::span<const std::uint8_t> packet) {
+    std::vector<std::uint8_t> buffer(headroom + packet.size() + tailroom);
+    std::copy(packet.begin(), packet.end(), buffer.begin() + headroom);
+    return sendInPlace(buffer, headroom, packet.size());
+}
+
+bool QuicTunnel::sendInPlace(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length) {
+    if (!connection) {
+        lastError = "QUIC tunnel is not open";
+        return false;
+    }
+    if (!connection->sendInPlace(buffer, offset, length)) {
+        lastError = connection->error();
+        return false;
+    }
+    return true;
+}
+
+std::optional<std::vector<std::uint8_t>> QuicTunnel::receive(std::chrono::milliseconds timeout,
+                                                             std::span<const SocketHandle> wakeHandles) {
+    if (!connection) {
+        lastError = "QUIC tunnel is not open";
+        return std::nullopt;
+    }
+    auto packet = connection->receive(timeout, wakeHandles);
+    if (!packet && !connection->isOpen()) {
+        lastError = connection->error();
+    }
+    return packet;
+}
+
+bool QuicTunnel::migrate() {
+    if (!connection) {
+        lastError = "QUIC tunnel is not open";
+        return false;
+    }
+    if (!connection->migrate()) {
+        lastError = connection->error();
+        return false;
+    }
+    return true;
+}
+
+QuicTunnel::Stats QuicTunnel::stats() const {
+    return statistics;
+}
+
+std::optional<sockaddr_storage> QuicTunnel::remoteAddress() const {
+    return connection ? connection->remoteAddress() : std::nullopt;
+}
+
+std::string QuicTunnel::getLastError() const {
+    return lastError;
+}
@@ -0,0 +1,98 @@
+#pragma once
+import std;
+#include "ovpnProfile.h"
+#include "quicPacket.h"
+#include "socketUtil.h"
+
+// UDP through an HTTP/3 proxy (MASQUE CONNECT-UDP, RFC 9298) for networks
+// that only let QUIC or HTTPS out: one QUIC connection to the proxy, one
+// CONNECT-UDP request naming the VPN server, and every tunnel packet as an
+// unreliable DATAGRAM frame (RFC 9221), so a lost packet is not
+// retransmitted under the tunnel the way TCP mode does.
+//
+// The connection carries CRYPTO and stream data reliably, acknowledges and
+// detects loss as in RFC 9002 and updates keys when the proxy does. It has
+// no congestion controller: datagrams go out as the tunnel produces them,
+// as with plain UDP. Headers use the static QPACK table only.
+//
+// When the route to the proxy changes (a new local address, or the network
+// reported unreachable) the connection migrates: it moves to a new socket,
+// and a new connection ID if the proxy issued one, and validates the path
+// while datagrams keep flowing.
+class QuicTunnel {
+public:
+    using SocketHandle = socketUtil::SocketHandle;
+
+    struct Settings {
+        std::string proxyHost;   // also the TLS server name
+        std::string proxyPort;
+        std::string targetHost;  // the UDP server the proxy forwards to
+        std::string targetPort;
+        std::string caPem;       // trusted besides the system roots
+        std::chrono::seconds handshakeTimeout{10};
+    };
+
+    struct Stats {
+        std::uint64_t packetsSent = 0;
+        std::uint64_t packetsReceived = 0;
+        std::uint64_t packetsLost = 0;
+        std::uint64_t datagramsSent = 0;
+        std::uint64_t datagramsReceived = 0;
+        std::uint64_t datagramsDropped = 0;  // too large for the proxy, or no room to queue
+        std::uint64_t retransmittedFrames = 0;
+        std::uint64_t keyUpdates = 0;
+        std::uint64_t migrations = 0;
+        std::chrono::microseconds smoothedRtt{0};
+    };
+
+    static constexpr const char* proxyVariable = "SIAVPN_MASQUE_PROXY";
+    static constexpr const char* defaultProxyPort = "443";
+    // In front of a tunnel packet: short header, DATAGRAM frame type and
+    // length, and the HTTP datagram's stream and context IDs
+    static constexpr std::size_t headroom = 1 + quic::maxConnectionIdSize + quic::packetNumberSize + 3 + 2;
+    // Behind it: an acknowledgement riding along, and the AEAD tag
+    static constexpr std::size_t maxAckSize = 74;
+    static constexpr std::size_t tailroom = maxAckSize + quic::tagSize;
+
+    // The remote is the target; the proxy is "setenv SIAVPN_MASQUE_PROXY
+    // host[:port]", or port 443 on the remote's host
+    static Settings settingsFromProfile(const OvpnProfile& profile, const OvpnProfile::Remote& remote);
+
+    QuicTunnel();
+    ~QuicTunnel();
+
+    QuicTunnel(const QuicTunnel&) = delete;
+    QuicTunnel& operator=(const QuicTunnel&) = delete;
+
+    // Connects to the proxy at host:port (settings.proxyHost unless a local
+    // relay sits in between) and waits until the proxy accepted the tunnel
+    bool open(const std::string& host, const std::string& port, int family, const Settings& settings);
+    // Closes the connection with H3_NO_ERROR
+    void close();
+    bool isOpen() const;
+
+    bool send(std::span<const std::uint8_t> packet);
+    // The packet is buffer[offset, offset + length), with headroom free in
+    // front of it and tailroom behind it; it is sealed there and sent
+    bool sendInPlace(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length);
+    // The next tunnel packet. Acknowledgements, retransmissions and path
+    // checks are served while waiting; the wait ends early, without a
+    // packet, once one of wakeHandles is readable.
+    std::optional<std::vector<std::uint8_t>> receive(std::chrono::milliseconds timeout,
+                                                     std::span<const SocketHandle> wakeHandles = {});
+
+    // Moves the connection to a new socket, as on a network change
+    bool migrate();
+
+    Stats stats() const;
+    std::optional<sockaddr_storage> remoteAddress() const;
+    std::string getLastError() const;
+
+    // Defined with the connection state machine in the source file
+    class Connection;
+
+private:
+    std::unique_ptr<Connection> connection;
+    Stats statistics;  // updated by the connection
+    std::string lastError;
+};
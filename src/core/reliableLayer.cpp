@@ -0,0 +1,238 @@
+import std;
+#include "reliableLayer.h"
+
+void RttEstimator::addSample(Duration sample) {
+    // RFC 6298: alpha = 1/8, beta = 1/4
+    if (!sampled) {
+        srtt = sample;
+        rttvar = sample / 2;
+        sampled = true;
+    } else {
+        const auto delta = srtt > sample ? srtt - sample : sample - srtt;
+        rttvar = (rttvar * 3 + delta) / 4;
+        srtt = (srtt * 7 + sample) / 8;
+    }
+
+    baseRto = std::clamp(srtt + std::max(Duration(std::chrono::milliseconds(1)), rttvar * 4), minRto, maxRto);
+    backoffShift = 0;
+}
+
+void RttEstimator::seed(Duration smoothed, Duration variance) {
+    srtt = smoothed;
+    rttvar = variance;
+    sampled = true;
+    baseRto = std::clamp(srtt + std::max(Duration(std::chrono::milliseconds(1)), rttvar * 4), minRto, maxRto);
+    backoffShift = 0;
+}
+
+void RttEstimator::backoff() {
+    if (baseRto * (1 << (backoffShift + 1)) <= maxRto) {
+        ++backoffShift;
+    } else {
+        backoffShift = 0;
+        baseRto = maxRto;
+    }
+}
+
+RttEstimator::Duration RttEstimator::rto() const {
+    return std::min(baseRto * (1 << backoffShift), maxRto);
+}
+
+RttEstimator::Duration RttEstimator::smoothedRtt() const {
+    return srtt;
+}
+
+RttEstimator::Duration RttEstimator::rttVariance() const {
+    return rttvar;
+}
+
+bool RttEstimator::hasSample() const {
+    return sampled;
+}
+
+ReliableSendWindow::ReliableSendWindow(std::size_t windowSize)
+    : windowSize(windowSize) {
+}
+
+std::uint32_t ReliableSendWindow::enqueue(std::uint8_t opcode, std::vector<std::uint8_t> payload) {
+    Entry entry;
+    entry.packetId = nextPacketId++;
+    entry.opcode = opcode;
+    entry.payload = std::move(payload);
+    backlog.push_back(std::move(entry));
+    return backlog.back().packetId;
+}
+
+void ReliableSendWindow::acknowledge(std::span<const std::uint32_t> packetIds, Clock::time_point now) {
+    for (auto packetId : packetIds) {
+        auto it = std::find_if(inFlight.begin(), inFlight.end(),
+                               [packetId](const Entry& entry) { return entry.packetId == packetId; });
+        if (it == inFlight.end() || it->acknowledged) {
+            continue;
+        }
+
+        it->acknowledged = true;
+
+        // Karn's rule: an ACK for a retransmitted packet is ambiguous
+        if (it->transmissions == 1) {
+            estimator.addSample(std::chrono::duration_cast<RttEstimator::Duration>(now - it->lastSent));
+        }
+
+        // Every unacknowledged packet below a selectively acknowledged one is a hole
+        for (auto hole = inFlight.begin(); hole != it; ++hole) {
+            if (!hole->acknowledged) {
+                ++hole->ackedAbove;
+            }
+        }
+    }
+
+    slide();
+}
+
+void ReliableSendWindow::transmitDue(Clock::time_point now, const std::function<void(const Entry&)>& transmit) {
+    slide();
+
+    const auto rto = estimator.rto();
+    bool timedOut = false;
+
+    for (auto& entry : inFlight) {
+        if (entry.acknowledged) {
+            continue;
+        }
+
+        const bool expired = now - entry.lastSent >= rto;
+        const bool fastRetransmit = entry.ackedAbove >= fastRetransmitThreshold && entry.transmissions == 1;
+        if (!expired && !fastRetransmit) {
+            continue;
+        }
+
+        timedOut = timedOut || expired;
+        entry.ackedAbove = 0;
+        entry.lastSent = now;
+        ++entry.transmissions;
+        ++retransmissions;
+        transmit(entry);
+    }
+
+    // One backoff step per timeout event, not per packet
+    if (timedOut) {
+        estimator.backoff();
+    }
+
+    while (!backlog.empty() && inFlight.size() < windowSize) {
+        inFlight.push_back(std::move(backlog.front()));
+        backlog.pop_front();
+
+        auto& entry = inFlight.back();
+        entry.lastSent = now;
+        entry.transmissions = 1;
+        transmit(entry);
+    }
+}
+
+ReliableSendWindow::Clock::time_point ReliableSendWindow::nextTimeout() const {
+    // A default time point is always in the past: something can go out now
+    auto timeout = Clock::time_point::max();
+    if (!backlog.empty() && inFlight.size() < windowSize) {
+        return Clock::time_point{};
+    }
+
+    const auto rto = std::chrono::duration_cast<Clock::duration>(estimator.rto());
+    for (const auto& entry : inFlight) {
+        if (entry.acknowledged) {
+            continue;
+        }
+        if (entry.ackedAbove >= fastRetransmitThreshold && entry.transmissions == 1) {
+            return Clock::time_point{};
+        }
+        timeout = std::min(timeout, entry.lastSent + rto);
+    }
+    return timeout;
+}
+
+bool ReliableSendWindow::hasUnacknowledged() const {
+    return !backlog.empty() ||
+           std::any_of(inFlight.begin(), inFlight.end(), [](const Entry& entry) { return !entry.acknowledged; });
+}
+
+std::uint64_t ReliableSendWindow::retransmissionCount() const {
+    return retransmissions;
+}
+
+const RttEstimator& ReliableSendWindow::rtt() const {
+    return estimator;
+}
+
+RttEstimator& ReliableSendWindow::rtt() {
+    return estimator;
+}
+
+void ReliableSendWindow::slide() {
+    while (!inFlight.empty() && inFlight.front().acknowledged) {
+        inFlight.pop_front();
+    }
+}
+
+ReliableReceiveWindow::ReliableReceiveWindow(std::size_t windowSize)
+    : windowSize(windowSize) {
+}
+
+bool ReliableReceiveWindow::accept(std::uint32_t packetId, std::span<const std::uint8_t> payload) {
+    if (packetId >= nextExpected + windowSize) {
+        return false;
+    }
+
+    // Duplicates are re-acknowledged: the earlier ACK was probably lost
+    if (std::find(pendingAcks.begin(), pendingAcks.end(), packetId) == pendingAcks.end()) {
+        pendingAcks.push_back(packetId);
+    }
+
+    if (packetId >= nextExpected) {
+        reorderBuffer.try_emplace(packetId, payload.begin(), payload.end());
+    }
+    return true;
+}
+
+void ReliableReceiveWindow::deliver(std::vector<std::uint8_t>& out) {
+    for (auto it = reorderBuffer.find(nextExpected); it != reorderBuffer.end();
+         it = reorderBuffer.find(nextExpected)) {
+        out.insert(out.end(), it->second.begin(), it->second.end());
+        reorderBuffer.erase(it);
+        ++nextExpected;
+    }
+}
+
+std::vector<std::uint32_t> ReliableReceiveWindow::takeAcks(std::size_t maxCount) {
+    std::vector<std::uint32_t> acks;
+    while (!pendingAcks.empty() && acks.size() < maxCount) {
+        acks.push_back(pendingAcks.front());
+        pendingAcks.pop_front();
+    }
+
+    // Fill spare slots with recent ACKs so a single lost ACK costs no retransmit
+    for (auto recent : recentAcks) {
+        if (acks.size() >= maxCount) {
+            break;
+        }
+        if (std::find(acks.begin(), acks.end(), recent) == acks.end()) {
+            acks.push_back(recent);
+        }
+    }
+
+    for (auto ack : acks) {
+        auto existing = std::find(recentAcks.begin(), recentAcks.end(), ack);
+        if (existing != recentAcks.end()) {
+            recentAcks.erase(existing);
+        }
+        recentAcks.push_front(ack);
+    }
+    while (recentAcks.size() > recentAckHistory) {
+        recentAcks.pop_back();
+    }
+
+    return acks;
+}
+
+bool ReliableReceiveWindow::hasPendingAcks() const {
+    return !pendingAcks.empty();
+}
@@ -0,0 +1,99 @@
+#pragma once
+import std;
+
+// Jacobson/Karels RTT estimator with Karn's rule and exponential backoff
+class RttEstimator {
+public:
+    using Duration = std::chrono::microseconds;
+
+    static constexpr Duration initialRto = std::chrono::milliseconds(1000);
+    static constexpr Duration minRto = std::chrono::milliseconds(200);
+    static constexpr Duration maxRto = std::chrono::seconds(16);
+
+    // Only feed samples from packets that were transmitted exactly once
+    void addSample(Duration sample);
+    // Starts from a previous session's estimate instead of the 1s default
+    void seed(Duration smoothed, Duration variance);
+    void backoff();
+
+    Duration rto() const;
+    Duration smoothedRtt() const;
+    Duration rttVariance() const;
+    bool hasSample() const;
+
+private:
+    Duration srtt{0};
+    Duration rttvar{0};
+    Duration baseRto = initialRto;
+    int backoffShift = 0;
+    bool sampled = false;
+};
+
+// Sending half of the reliability layer: a sliding window of packet-ids
+// with per-packet timers, RTT-based RTO and SACK-driven fast retransmit.
+class ReliableSendWindow {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::uint32_t packetId = 0;
+        std::uint8_t opcode = 0;
+        std::vector<std::uint8_t> payload;
+        Clock::time_point lastSent{};
+        int transmissions = 0;
+        int ackedAbove = 0;
+        bool acknowledged = false;
+    };
+
+    // Later packets acknowledged before a hole is retransmitted early
+    static constexpr int fastRetransmitThreshold = 2;
+
+    explicit ReliableSendWindow(std::size_t windowSize);
+
+    std::uint32_t enqueue(std::uint8_t opcode, std::vector<std::uint8_t> payload);
+    void acknowledge(std::span<const std::uint32_t> packetIds, Clock::time_point now);
+
+    // Calls transmit for every packet that is new, expired or fast-retransmittable
+    void transmitDue(Clock::time_point now, const std::function<void(const Entry&)>& transmit);
+
+    Clock::time_point nextTimeout() const;
+    bool hasUnacknowledged() const;
+    std::uint64_t retransmissionCount() const;
+    const RttEstimator& rtt() const;
+    RttEstimator& rtt();
+
+private:
+    void slide();
+
+    std::size_t windowSize;
+    std::uint32_t nextPacketId = 0;
+    std::deque<Entry> inFlight;
+    std::deque<Entry> backlog;
+    RttEstimator estimator;
+    std::uint64_t retransmissions = 0;
+};
+
+// Receiving half: reorder buffer plus the ACK set piggybacked on outgoing packets
+class ReliableReceiveWindow {
+public:
+    // Recently acknowledged ids are repeated in spare ACK slots in case an ACK was lost
+    static constexpr std::size_t recentAckHistory = 8;
+
+    explicit ReliableReceiveWindow(std::size_t windowSize);
+
+    // Returns false for packets outside the window (those are dropped unacknowledged)
+    bool accept(std::uint32_t packetId, std::span<const std::uint8_t> payload);
+
+    // Moves the contiguous in-order prefix into out
+    void deliver(std::vector<std::uint8_t>& out);
+
+    std::vector<std::uint32_t> takeAcks(std::size_t maxCount);
+    bool hasPendingAcks() const;
+
+private:
+    std::size_t windowSize;
+    std::uint32_t nextExpected = 0;
+    std::map<std::uint32_t, std::vector<std::uint8_t>> reorderBuffer;
+    std::deque<std::uint32_t> pendingAcks;
+    std::deque<std::uint32_t> recentAcks;
+};
@@ -0,0 +1,207 @@
+import std;
+#include "secureMemory.h"
+
+#include <openssl/crypto.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void secureWipe(void* data, std::size_t size) {
+    if (data && size > 0) {
+        OPENSSL_cleanse(data, size);
+    }
+}
+
+std::optional<SecureString> readSecretFile(const std::string& path) {
+    std::ifstream file;
+    file.rdbuf()->pubsetbuf(nullptr, 0);
+    file.open(path, std::ios::binary);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+
+    file.seekg(0, std::ios::end);
+    const auto length = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if (length < 0) {
+        return std::nullopt;
+    }
+
+    std::vector<char, SecureAllocator<char>> buffer(static_cast<std::size_t>(length));
+    if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+        return std::nullopt;
+    }
+    return SecureString(std::string_view(buffer.data(), buffer.size()));
+}
+
+SecureArena& SecureArena::instance() {
+    // Never destroyed: secrets held by other statics may be released during exit
+    static SecureArena* arena = new SecureArena();
+    return *arena;
+}
+
+SecureArena::SecureArena() {
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    pageSize = info.dwPageSize;
+    #else
+    if (long size = ::sysconf(_SC_PAGESIZE); size > 0) {
+        pageSize = static_cast<std::size_t>(size);
+    }
+    #endif
+}
+
+std::size_t SecureArena::sizeClass(std::size_t size) {
+    // 16 -> 0, 32 -> 1, ..., 65536 -> 12
+    return static_cast<std::size_t>(std::bit_width(std::max(size, minBlockSize) - 1)) - 4;
+}
+
+SecureArena::Region SecureArena::mapRegion(std::size_t size) {
+    // [guard page][usable, page rounded][guard page]
+    Region region;
+    region.size = (size + pageSize - 1) / pageSize * pageSize;
+    const std::size_t total = region.size + 2 * pageSize;
+
+    #ifdef _WIN32
+    auto* base = static_cast<std::byte*>(VirtualAlloc(nullptr, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    DWORD oldProtection = 0;
+    VirtualProtect(base, pageSize, PAGE_NOACCESS, &oldProtection);
+    VirtualProtect(base + pageSize + region.size, pageSize, PAGE_NOACCESS, &oldProtection);
+    region.usable = base + pageSize;
+    region.locked = VirtualLock(region.usable, region.size) != 0;
+    #else
+    void* mapped = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto* base = static_cast<std::byte*>(mapped);
+    ::mprotect(base, pageSize, PROT_NONE);
+    ::mprotect(base + pageSize + region.size, pageSize, PROT_NONE);
+    region.usable = base + pageSize;
+    region.locked = ::mlock(region.usable, region.size) == 0;
+    #ifdef MADV_DONTDUMP
+    ::madvise(region.usable, region.size, MADV_DONTDUMP);
+    #elif defined(MADV_NOCORE)
+    ::madvise(region.usable, region.size, MADV_NOCORE);
+    #endif
+    #endif
+
+    if (!region.locked && arenaStats.lockingAvailable) {
+        // Typically RLIMIT_MEMLOCK; keep going, the memory is still wiped and guarded
+        arenaStats.lockingAvailable = false;
+        std::cerr << "[SECURITY] Cannot lock secure memory in RAM; secrets may be swapped\n";
+    }
+
+    arenaStats.reservedBytes += region.size;
+    if (region.locked) {
+        arenaStats.lockedBytes += region.size;
+    }
+    return region;
+}
+
+void SecureArena::unmapRegion(const Region& region) noexcept {
+    std::byte* base = region.usable - pageSize;
+    #ifdef _WIN32
+    if (region.locked) {
+        VirtualUnlock(region.usable, region.size);
+    }
+    VirtualFree(base, 0, MEM_RELEASE);
+    #else
+    if (region.locked) {
+        ::munlock(region.usable, region.size);
+    }
+    ::munmap(base, region.size + 2 * pageSize);
+    #endif
+
+    arenaStats.reservedBytes -= region.size;
+    if (region.locked) {
+        arenaStats.lockedBytes -= region.size;
+    }
+}
+
+void* SecureArena::allocate(std::size_t size) {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    ++arenaStats.allocations;
+
+    // Anything bigger than a size class gets a guarded mapping of its own
+    if (size > maxBlockSize) {
+        Region region = mapRegion(size);
+        arenaStats.inUseBytes += region.size;
+        largeRegions.emplace(region.usable, region);
+        return region.usable;
+    }
+
+    const std::size_t index = sizeClass(size);
+    const std::size_t blockSize = minBlockSize << index;
+
+    if (void* block = freeLists[index]) {
+        // The link is the only non-zero word of a free block
+        std::memcpy(&freeLists[index], block, sizeof(void*));
+        secureWipe(block, sizeof(void*));
+        arenaStats.inUseBytes += blockSize;
+        return block;
+    }
+
+    if (static_cast<std::size_t>(slabEnd - slabCursor) < blockSize) {
+        // Hand the tail of the old slab to the smaller free lists instead of wasting it
+        while (slabEnd - slabCursor >= static_cast<std::ptrdiff_t>(minBlockSize)) {
+            const std::size_t remaining = static_cast<std::size_t>(slabEnd - slabCursor);
+            const std::size_t pieceIndex = static_cast<std::size_t>(std::bit_width(remaining)) - 5;
+            std::memcpy(slabCursor, &freeLists[pieceIndex], sizeof(void*));
+            freeLists[pieceIndex] = slabCursor;
+            slabCursor += minBlockSize << pieceIndex;
+        }
+
+        Region slab = mapRegion(slabSize);
+        slabCursor = slab.usable;
+        slabEnd = slab.usable + slab.size;
+    }
+
+    void* block = slabCursor;
+    slabCursor += blockSize;
+    arenaStats.inUseBytes += blockSize;
+    return block;
+}
+
+void SecureArena::deallocate(void* block, std::size_t size) noexcept {
+    if (!block) {
+        return;
+    }
+
+    if (size > maxBlockSize) {
+        secureWipe(block, size);
+        std::lock_guard<std::mutex> lock(arenaMutex);
+        if (auto it = largeRegions.find(block); it != largeRegions.end()) {
+            arenaStats.inUseBytes -= it->second.size;
+            unmapRegion(it->second);
+            largeRegions.erase(it);
+        }
+        return;
+    }
+
+    // Wipe the whole block, not just the bytes the caller used
+    const std::size_t index = sizeClass(size);
+    const std::size_t blockSize = minBlockSize << index;
+    secureWipe(block, blockSize);
+
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    std::memcpy(block, &freeLists[index], sizeof(void*));
+    freeLists[index] = block;
+    arenaStats.inUseBytes -= blockSize;
+}
+
+SecureArena::Stats SecureArena::stats() const {
+    std::lock_guard<std::mutex> lock(arenaMutex);
+    return arenaStats;
+}
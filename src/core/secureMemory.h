@@ -0,0 +1,135 @@
+#pragma once
+import std;
+
+// Zeroes memory with stores the compiler may not elide
+void secureWipe(void* data, std::size_t size);
+
+// Process-wide arena for keys, passwords and private-key material.
+// Memory comes from slabs that are locked in RAM (never swapped), fenced by
+// inaccessible guard pages and excluded from core dumps. Blocks are wiped on
+// free. Blocks up to 64 KiB (keys, certificate chains, whole profiles) use
+// power-of-two size classes with free lists, so an allocation is a pointer
+// pop under a short lock, per-session data-channel keys can live here without
+// slowing down rekeys, and copies of a profile reuse the slabs already locked
+// instead of locking pages of their own against RLIMIT_MEMLOCK. Only larger
+// blocks get a guarded mapping each.
+class SecureArena {
+public:
+    struct Stats {
+        std::size_t reservedBytes = 0;   // usable bytes mapped, guard pages excluded
+        std::size_t lockedBytes = 0;     // part of the reservation locked in RAM
+        std::size_t inUseBytes = 0;      // size-class rounded
+        std::uint64_t allocations = 0;
+        bool lockingAvailable = true;    // false once the OS refused to lock a slab
+    };
+
+    static SecureArena& instance();
+
+    void* allocate(std::size_t size);
+    void deallocate(void* block, std::size_t size) noexcept;
+    Stats stats() const;
+
+    SecureArena(const SecureArena&) = delete;
+    SecureArena& operator=(const SecureArena&) = delete;
+
+private:
+    struct Region {
+        std::byte* usable = nullptr;
+        std::size_t size = 0;
+        bool locked = false;
+    };
+
+    static constexpr std::size_t minBlockSize = 16;
+    static constexpr std::size_t maxBlockSize = 64 * 1024;
+    static constexpr std::size_t sizeClassCount = 13;  // 16 .. 65536
+    static constexpr std::size_t slabSize = 256 * 1024;
+
+    SecureArena();
+
+    static std::size_t sizeClass(std::size_t size);
+    Region mapRegion(std::size_t size);
+    void unmapRegion(const Region& region) noexcept;
+
+    std::array<void*, sizeClassCount> freeLists{};
+    std::byte* slabCursor = nullptr;
+    std::byte* slabEnd = nullptr;
+    std::unordered_map<void*, Region> largeRegions;
+    std::size_t pageSize = 4096;
+    Stats arenaStats;
+    mutable std::mutex arenaMutex;
+};
+
+// Standard allocator over SecureArena for containers holding secrets
+template <typename T>
+class SecureAllocator {
+public:
+    using value_type = T;
+
+    SecureAllocator() noexcept = default;
+    template <typename U>
+    SecureAllocator(const SecureAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(SecureArena::instance().allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, std::size_t count) noexcept {
+        SecureArena::instance().deallocate(block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const SecureAllocator<U>&) const noexcept { return true; }
+};
+
+using SecureBytes = std::vector<std::uint8_t, SecureAllocator<std::uint8_t>>;
+
+// NUL-terminated text in the secure arena. Unlike std::basic_string there is
+// no small-string buffer, so short passwords never sit in the object itself.
+class SecureString {
+public:
+    SecureString() = default;
+    explicit SecureString(std::string_view text) { assign(text); }
+    ~SecureString() = default;
+
+    SecureString(const SecureString&) = default;
+    SecureString(SecureString&&) noexcept = default;
+    SecureString& operator=(const SecureString&) = default;
+    SecureString& operator=(SecureString&&) noexcept = default;
+
+    void assign(std::string_view text) {
+        clear();
+        storage.reserve(text.size() + 1);
+        storage.assign(text.begin(), text.end());
+        storage.push_back('\0');
+    }
+
+    void reserve(std::size_t size) { storage.reserve(size + 1); }
+
+    // Outgrown buffers go back to the arena, which wipes them
+    void append(std::string_view text) {
+        if (!storage.empty()) {
+            storage.pop_back();
+        }
+        storage.insert(storage.end(), text.begin(), text.end());
+        storage.push_back('\0');
+    }
+
+    void clear() noexcept {
+        // Freeing the buffer wipes it; swap so capacity is released too
+        std::vector<char, SecureAllocator<char>>().swap(storage);
+    }
+
+    std::string_view view() const noexcept {
+        return storage.empty() ? std::string_view() : std::string_view(storage.data(), size());
+    }
+    const char* c_str() const noexcept { return storage.empty() ? "" : storage.data(); }
+    std::size_t size() const noexcept { return storage.empty() ? 0 : storage.size() - 1; }
+    bool empty() const noexcept { return size() == 0; }
+
+private:
+    std::vector<char, SecureAllocator<char>> storage;
+};
+
+// Reads a whole file (key, auth-user-pass, askpass) straight into the arena,
+// bypassing stream buffers that would leave a copy on the ordinary heap
+std::optional<SecureString> readSecretFile(const std::string& path);
@@ -0,0 +1,326 @@
+import std;
+#include "serverProber.h"
+#include "controlChannel.h"
+#include "vpnTransport.h"
+#include "workerPool.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+// getaddrinfo blocks, so lookups fan out to a few threads before probing starts
+constexpr std::size_t resolverThreads = 16;
+
+#ifdef _WIN32
+using PollEntry = WSAPOLLFD;
+constexpr short readEvents = POLLRDNORM;
+constexpr short writeEvents = POLLWRNORM;
+
+int pollSockets(std::vector<PollEntry>& entries, int timeoutMs) {
+    return WSAPoll(entries.data(), static_cast<ULONG>(entries.size()), timeoutMs);
+}
+#else
+using PollEntry = pollfd;
+constexpr short readEvents = POLLIN;
+constexpr short writeEvents = POLLOUT;
+
+int pollSockets(std::vector<PollEntry>& entries, int timeoutMs) {
+    return ::poll(entries.data(), entries.size(), timeoutMs);
+}
+#endif
+
+} // namespace
+
+ServerProber::ServerProber()
+    : ServerProber(Settings{}) {
+}
+
+ServerProber::ServerProber(Settings settings)
+    : settings(settings) {
+}
+
+std::vector<ServerProber::Score> ServerProber::probe(const std::vector<Target>& targets, const std::atomic<bool>* stop) {
+    socketUtil::ensureInitialized();
+    const auto runStart = Clock::now();
+
+    // One probe plan per distinct remote; profiles sharing a server share its probes
+    struct Plan {
+        std::string key;
+        OvpnProfile::Remote remote;
+        std::optional<ControlWrap::Key> wrapKey;
+        std::optional<sockaddr_storage> address;
+        int remaining = 0;
+        Clock::time_point nextSend{};
+    };
+    std::vector<Plan> plans;
+    {
+        std::set<std::string> planned;
+        std::lock_guard<std::mutex> lock(historyMutex);
+        for (const auto& target : targets) {
+            std::string key = keyOf(target.remote);
+            auto it = history.find(key);
+            const bool fresh = it != history.end() && it->second.sent > 0 &&
+                               runStart - it->second.lastProbed < settings.minReprobeInterval;
+            if (!fresh && planned.insert(key).second) {
+                plans.push_back({std::move(key), target.remote, target.wrapKey, std::nullopt, settings.probesPerTarget,
+                                 runStart});
+            }
+        }
+    }
+
+    {
+        WorkerPool resolver(std::min(resolverThreads, std::max<std::size_t>(1, plans.size())));
+        std::vector<std::future<void>> lookups;
+        for (auto& plan : plans) {
+            lookups.push_back(resolver.submit([&plan]() {
+                try {
+                    const bool stream = VpnTransport::protocolFromString(plan.remote.proto) == VpnTransport::Protocol::Tcp;
+                    auto addresses = socketUtil::resolve(plan.remote.host, plan.remote.port, stream ? SOCK_STREAM : SOCK_DGRAM,
+                                                         VpnTransport::familyFromString(plan.remote.proto));
+                    if (!addresses.empty()) {
+                        plan.address = addresses.front();
+                    }
+                } catch (const std::exception& e) {
+                    // Unresolvable servers simply lose every probe
+                }
+            }));
+        }
+        for (auto& lookup : lookups) {
+            lookup.get();
+        }
+    }
+    for (auto& plan : plans) {
+        if (!plan.address) {
+            for (int i = 0; i < plan.remaining; ++i) {
+                record(plan.key, std::nullopt);
+            }
+            plan.remaining = 0;
+        }
+    }
+
+    struct Probe {
+        std::size_t plan = 0;
+        socketUtil::SocketHandle socket = socketUtil::invalidSocket;
+        bool stream = false;
+        Clock::time_point sentAt{};
+        std::unique_ptr<ControlChannel> channel;  // UDP only: builds the reset, validates the reply
+    };
+    // Parallel arrays: entries[i] is the poll slot of inFlight[i]
+    std::vector<Probe> inFlight;
+    std::vector<PollEntry> entries;
+
+    auto finish = [&](std::size_t index, std::optional<Clock::duration> rtt) {
+        record(plans[inFlight[index].plan].key, rtt);
+        socketUtil::closeSocket(inFlight[index].socket);
+        inFlight[index] = std::move(inFlight.back());
+        inFlight.pop_back();
+        entries[index] = entries.back();
+        entries.pop_back();
+    };
+
+    // Token bucket for the start rate; a full second's worth may burst
+    const double tokensPerMicro = static_cast<double>(settings.probesPerSecond) / 1e6;
+    double tokens = static_cast<double>(settings.probesPerSecond);
+    auto lastRefill = runStart;
+    std::size_t nextPlan = 0;
+    std::size_t plansLeft = std::count_if(plans.begin(), plans.end(), [](const Plan& plan) { return plan.remaining > 0; });
+
+    while ((plansLeft > 0 || !inFlight.empty()) && !(stop && *stop)) {
+        auto now = Clock::now();
+        tokens = std::min<double>(static_cast<double>(settings.probesPerSecond),
+                                  tokens + tokensPerMicro * std::chrono::duration<double, std::micro>(now - lastRefill).count());
+        lastRefill = now;
+
+        // Start whatever the rate limit, the in-flight cap and per-server spacing allow
+        Clock::time_point nextStart = Clock::time_point::max();
+        for (std::size_t scanned = 0; scanned < plans.size() && plansLeft > 0; ++scanned) {
+            if (inFlight.size() >= settings.maxInFlight || tokens < 1.0) {
+                break;
+            }
+            Plan& plan = plans[nextPlan];
+            const std::size_t planIndex = nextPlan;
+            nextPlan = (nextPlan + 1) % plans.size();
+            if (plan.remaining == 0) {
+                continue;
+            }
+            if (plan.nextSend > now) {
+                nextStart = std::min(nextStart, plan.nextSend);
+                continue;
+            }
+
+            tokens -= 1.0;
+            if (--plan.remaining == 0) {
+                --plansLeft;
+            }
+            plan.nextSend = now + settings.probeSpacing;
+
+            Probe probe;
+            probe.plan = planIndex;
+            probe.stream = VpnTransport::protocolFromString(plan.remote.proto) == VpnTransport::Protocol::Tcp;
+            probe.socket = ::socket(plan.address->ss_family, probe.stream ? SOCK_STREAM : SOCK_DGRAM, 0);
+            if (probe.socket == socketUtil::invalidSocket || !socketUtil::setNonBlocking(probe.socket)) {
+                socketUtil::closeSocket(probe.socket);
+                record(plan.key, std::nullopt);
+                continue;
+            }
+
+            probe.sentAt = Clock::now();
+            const auto* address = reinterpret_cast<const sockaddr*>(&*plan.address);
+            const bool connected = ::connect(probe.socket, address, socketUtil::addressLength(*plan.address)) == 0;
+            bool sent = probe.stream ? (connected || socketUtil::connectInProgress()) : connected;
+            if (sent && !probe.stream) {
+                const auto handle = probe.socket;
+                probe.channel = std::make_unique<ControlChannel>([handle](std::span<const std::uint8_t> packet) {
+                    return ::send(handle, reinterpret_cast<const char*>(packet.data()), static_cast<int>(packet.size()), 0) ==
+                           static_cast<int>(packet.size());
+                });
+                try {
+                    if (plan.wrapKey) {
+                        probe.channel->setWrap(std::make_unique<ControlWrap>(*plan.wrapKey));
+                    }
+                    probe.channel->startHardReset();
+                } catch (const std::exception& e) {
+                    // A key OpenSSL cannot set up (unknown digest) fails every probe
+                    sent = false;
+                }
+            }
+            if (!sent) {
+                socketUtil::closeSocket(probe.socket);
+                record(plan.key, std::nullopt);
+                continue;
+            }
+            entries.push_back({probe.socket, probe.stream ? writeEvents : readEvents, 0});
+            inFlight.push_back(std::move(probe));
+        }
+        if (tokens < 1.0) {
+            nextStart = std::min(nextStart, now + std::chrono::microseconds(
+                static_cast<std::int64_t>((1.0 - tokens) / tokensPerMicro) + 1));
+        }
+
+        // Wait for replies, the earliest timeout or the next start, whichever comes first
+        Clock::time_point wakeup = nextStart;
+        for (auto& entry : entries) {
+            entry.revents = 0;
+        }
+        for (const auto& probe : inFlight) {
+            wakeup = std::min(wakeup, probe.sentAt + settings.timeout);
+        }
+        now = Clock::now();
+        const auto waitMs = wakeup == Clock::time_point::max()
+            ? settings.timeout.count()
+            : std::max<std::int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wakeup - now).count());
+        if (entries.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+            continue;
+        }
+        // Short slices keep cancellation responsive
+        const int ready = pollSockets(entries, static_cast<int>(std::min<std::int64_t>(waitMs, 100)));
+        const auto polledAt = Clock::now();
+
+        // Walk backwards so finishing (swap with last) never skips an entry
+        for (std::size_t i = entries.size(); i-- > 0;) {
+            Probe& probe = inFlight[i];
+            if (ready > 0 && entries[i].revents != 0) {
+                if (probe.stream) {
+                    finish(i, socketUtil::connectSucceeded(probe.socket) ? std::optional(polledAt - probe.sentAt) : std::nullopt);
+                    continue;
+                }
+
+                std::array<std::uint8_t, 2048> reply{};
+                const auto length = ::recv(probe.socket, reinterpret_cast<char*>(reply.data()), static_cast<int>(reply.size()), 0);
+                if (length < 0) {
+                    // ICMP port unreachable surfaces here: the server is down, no need to wait
+                    finish(i, std::nullopt);
+                    continue;
+                }
+                if (probe.channel->processIncoming(std::span(reply.data(), static_cast<std::size_t>(length))) &&
+                    probe.channel->isEstablished()) {
+                    finish(i, polledAt - probe.sentAt);
+                    continue;
+                }
+            }
+            if (polledAt - probe.sentAt >= settings.timeout) {
+                finish(i, std::nullopt);
+            }
+        }
+    }
+
+    // Cancelled probes were never answered but should not count as loss
+    for (const auto& probe : inFlight) {
+        socketUtil::closeSocket(probe.socket);
+    }
+    return ranking(targets);
+}
+
+std::vector<ServerProber::Score> ServerProber::ranking(const std::vector<Target>& targets) const {
+    std::vector<Score> scores;
+    scores.reserve(targets.size());
+    for (const auto& target : targets) {
+        scores.push_back(scoreOf(target));
+    }
+    std::stable_sort(scores.begin(), scores.end(), [](const Score& a, const Score& b) {
+        if (a.reachable != b.reachable) {
+            return a.reachable;
+        }
+        return cost(a) < cost(b);
+    });
+    return scores;
+}
+
+void ServerProber::clear() {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    history.clear();
+}
+
+double ServerProber::cost(const Score& score) {
+    // Each lost packet costs about one more round trip; cap to keep lossy servers finite
+    return static_cast<double>(score.rtt.count()) / (1.0 - std::min(score.loss, 0.95));
+}
+
+std::string ServerProber::keyOf(const OvpnProfile::Remote& remote) {
+    return remote.host + "|" + remote.port + "|" + remote.proto;
+}
+
+void ServerProber::record(const std::string& key, std::optional<Clock::duration> rtt) {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    History& entry = history[key];
+    const double alpha = settings.smoothing;
+
+    if (entry.sent == 0) {
+        entry.loss = rtt ? 0.0 : 1.0;
+    } else {
+        entry.loss = alpha * (rtt ? 0.0 : 1.0) + (1.0 - alpha) * entry.loss;
+    }
+    ++entry.sent;
+    entry.lastProbed = Clock::now();
+
+    if (rtt) {
+        const double sample = std::chrono::duration<double, std::micro>(*rtt).count();
+        entry.rttMicros = entry.sampled ? alpha * sample + (1.0 - alpha) * entry.rttMicros : sample;
+        entry.sampled = true;
+        ++entry.received;
+    }
+}
+
+ServerProber::Score ServerProber::scoreOf(const Target& target) const {
+    Score score;
+    score.profileName = target.profileName;
+    score.remote = target.remote;
+
+    std::lock_guard<std::mutex> lock(historyMutex);
+    auto it = history.find(keyOf(target.remote));
+    if (it == history.end()) {
+        return score;
+    }
+    score.rtt = std::chrono::microseconds(static_cast<std::int64_t>(it->second.rttMicros));
+    score.loss = it->second.loss;
+    score.sent = it->second.sent;
+    score.received = it->second.received;
+    score.reachable = it->second.sampled;
+    return score;
+}
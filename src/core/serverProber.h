@@ -0,0 +1,75 @@
+#pragma once
+import std;
+#include "controlWrap.h"
+#include "ovpnProfile.h"
+#include "socketUtil.h"
+
+// Measures how fast VPN servers answer. UDP remotes get a
+// P_CONTROL_HARD_RESET_CLIENT_V2, wrapped with the profile's tls-auth or
+// tls-crypt key if it has one, and must reply with the server reset; TCP
+// remotes are timed by the connect handshake. All probes of a run share one
+// thread and one poll loop, so thousands can be in flight at once.
+// Results are smoothed (EWMA) across runs and ranked by RTT and loss.
+class ServerProber {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings {
+        std::chrono::milliseconds timeout{1000};            // per probe
+        int probesPerTarget = 3;
+        std::chrono::milliseconds probeSpacing{50};          // between probes to one server
+        std::size_t maxInFlight = 512;                       // also bounds open sockets
+        std::size_t probesPerSecond = 2000;                  // start rate across all servers
+        std::chrono::seconds minReprobeInterval{10};         // fresher results are reused
+        double smoothing = 0.3;                              // EWMA weight of a new sample
+    };
+
+    struct Target {
+        std::string profileName;
+        OvpnProfile::Remote remote;
+        // ControlWrap::keyFromProfile(); servers using one drop bare resets
+        std::optional<ControlWrap::Key> wrapKey;
+    };
+
+    struct Score {
+        std::string profileName;
+        OvpnProfile::Remote remote;
+        std::chrono::microseconds rtt{0};  // smoothed; meaningless unless reachable
+        double loss = 1.0;                 // smoothed fraction of unanswered probes
+        std::uint64_t sent = 0;
+        std::uint64_t received = 0;
+        bool reachable = false;
+    };
+
+    ServerProber();
+    explicit ServerProber(Settings settings);
+
+    // Probes the targets (skipping recently probed ones) and returns them best first.
+    // Blocks until every probe was answered or timed out; stop cancels early.
+    std::vector<Score> probe(const std::vector<Target>& targets, const std::atomic<bool>* stop = nullptr);
+
+    // Smoothed results of earlier runs, best first
+    std::vector<Score> ranking(const std::vector<Target>& targets) const;
+    void clear();
+
+    // Lower is better: RTT inflated by the retransmissions loss would cause
+    static double cost(const Score& score);
+
+private:
+    struct History {
+        double rttMicros = 0.0;
+        double loss = 1.0;
+        std::uint64_t sent = 0;
+        std::uint64_t received = 0;
+        bool sampled = false;
+        Clock::time_point lastProbed{};
+    };
+
+    static std::string keyOf(const OvpnProfile::Remote& remote);
+    void record(const std::string& key, std::optional<Clock::duration> rtt);
+    Score scoreOf(const Target& target) const;
+
+    Settings settings;
+    std::map<std::string, History> history;
+    mutable std::mutex historyMutex;
+};
@@ -0,0 +1,128 @@
+import std;
+#include "simulatedBackend.h"
+
+SimulatedBackend::SimulatedBackend(std::chrono::milliseconds connectDelay)
+    : connectDelay(connectDelay) {
+}
+
+SimulatedBackend::~SimulatedBackend() {
+    stop();
+}
+
+bool SimulatedBackend::start(const VpnConfigManager::ClientConfig& config) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running) {
+        lastError = "Connection already in progress";
+        return false;
+    }
+    if (config.content.empty()) {
+        lastError = "Configuration content is empty";
+        return false;
+    }
+
+    // A previous session may have ended on its own; reap its thread first
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+    lastError.clear();
+    running = true;
+    stopRequested = false;
+    pauseRequested = false;
+    restartRequested = false;
+    sessionThread = std::thread([this]() { run(); });
+    return true;
+}
+
+void SimulatedBackend::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!running) {
+            return;
+        }
+        stopRequested = true;
+    }
+    stateCv.notify_all();
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+    emitEvent("DISCONNECTED", "Connection stopped by user");
+}
+
+void SimulatedBackend::pause() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!running) {
+            return;
+        }
+        pauseRequested = true;
+    }
+    stateCv.notify_all();
+}
+
+void SimulatedBackend::resume() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!pauseRequested) {
+            return;
+        }
+        pauseRequested = false;
+    }
+    stateCv.notify_all();
+}
+
+void SimulatedBackend::reconnect() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!running) {
+            return;
+        }
+        restartRequested = true;
+        pauseRequested = false;
+    }
+    stateCv.notify_all();
+}
+
+std::string SimulatedBackend::getLastError() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return lastError;
+}
+
+bool SimulatedBackend::needsTunnelDevice() const {
+    return false;
+}
+
+void SimulatedBackend::run() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!stopRequested) {
+        restartRequested = false;
+        lock.unlock();
+        emitEvent("CONNECTING", "Simulating connection...");
+        lock.lock();
+        if (stateCv.wait_for(lock, connectDelay, [this] { return stopRequested || restartRequested; })) {
+            continue;
+        }
+
+        lock.unlock();
+        emitEvent("CONNECTED", "Simulated tunnel established");
+        emitLog(3, "Simulated backend connected; no traffic is carried");
+        lock.lock();
+
+        bool paused = false;
+        while (!stopRequested && !restartRequested) {
+            if (pauseRequested != paused) {
+                paused = pauseRequested;
+                lock.unlock();
+                emitEvent(paused ? "PAUSED" : "RESUMED", paused ? "Connection paused" : "Connection resumed");
+                lock.lock();
+                continue;
+            }
+            stateCv.wait(lock, [&] { return stopRequested || restartRequested || pauseRequested != paused; });
+        }
+        if (restartRequested && !stopRequested) {
+            lock.unlock();
+            emitEvent("RECONNECTING", "Attempting to reconnect");
+            lock.lock();
+        }
+    }
+    running = false;
+}
@@ -0,0 +1,33 @@
+#pragma once
+import std;
+#include "vpnBackend.h"
+
+// Backend without a network: walks through the connection events with a
+// short delay and then holds the "tunnel" until stopped. For UI work and for
+// measuring what the manager and security layer cost on their own.
+class SimulatedBackend : public VpnBackend {
+public:
+    explicit SimulatedBackend(std::chrono::milliseconds connectDelay = std::chrono::milliseconds(200));
+    ~SimulatedBackend() override;
+
+    bool start(const VpnConfigManager::ClientConfig& config) override;
+    void stop() override;
+    void pause() override;
+    void resume() override;
+    void reconnect() override;
+    std::string getLastError() const override;
+    bool needsTunnelDevice() const override;
+
+private:
+    void run();
+
+    std::chrono::milliseconds connectDelay;
+    std::thread sessionThread;
+    bool running = false;
+    bool stopRequested = false;
+    bool pauseRequested = false;
+    bool restartRequested = false;
+    std::string lastError;
+    mutable std::mutex stateMutex;
+    std::condition_variable stateCv;
+};
@@ -0,0 +1,187 @@
+import std;
+#include "socketUtil.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace socketUtil {
+
+void ensureInitialized() {
+    #ifdef _WIN32
+    static const bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    (void)initialized;
+    #endif
+}
+
+void closeSocket(SocketHandle handle) {
+    if (handle == invalidSocket) {
+        return;
+    }
+    #ifdef _WIN32
+    closesocket(handle);
+    #else
+    ::close(handle);
+    #endif
+}
+
+bool setNonBlocking(SocketHandle handle, bool enabled) {
+    #ifdef _WIN32
+    u_long mode = enabled ? 1 : 0;
+    return ioctlsocket(handle, FIONBIO, &mode) == 0;
+    #else
+    int flags = ::fcntl(handle, F_GETFL, 0);
+    return flags >= 0 && ::fcntl(handle, F_SETFL, enabled ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == 0;
+    #endif
+}
+
+std::string lastErrorText() {
+    #ifdef _WIN32
+    return "socket error " + std::to_string(WSAGetLastError());
+    #else
+    return std::strerror(errno);
+    #endif
+}
+
+bool connectInProgress() {
+    #ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+    #else
+    return errno == EINPROGRESS;
+    #endif
+}
+
+bool connectSucceeded(SocketHandle handle, std::string* error) {
+    int code = 0;
+    socklen_t length = sizeof(code);
+    if (getsockopt(handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&code), &length) != 0) {
+        if (error) {
+            *error = lastErrorText();
+        }
+        return false;
+    }
+    if (code != 0 && error) {
+        #ifdef _WIN32
+        *error = "socket error " + std::to_string(code);
+        #else
+        *error = std::strerror(code);
+        #endif
+    }
+    return code == 0;
+}
+
+bool waitReadable(SocketHandle handle, std::chrono::milliseconds timeout) {
+    return waitAnyReadable(std::span(&handle, 1), timeout) == 0;
+}
+
+namespace {
+
+int waitAny(std::span<const SocketHandle> handles, bool writable, std::chrono::milliseconds timeout) {
+    #ifdef _WIN32
+    std::vector<WSAPOLLFD> fds;
+    for (auto handle : handles) {
+        fds.push_back({handle, static_cast<SHORT>(writable ? POLLWRNORM : POLLRDNORM), 0});
+    }
+    int rc = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), static_cast<INT>(timeout.count()));
+    #else
+    std::vector<pollfd> fds;
+    for (auto handle : handles) {
+        fds.push_back({handle, static_cast<short>(writable ? POLLOUT : POLLIN), 0});
+    }
+    int rc = ::poll(fds.data(), fds.size(), static_cast<int>(timeout.count()));
+    #endif
+
+    if (rc <= 0) {
+        return -1;
+    }
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i].revents != 0) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+int waitAnyReadable(std::span<const SocketHandle> handles, std::chrono::milliseconds timeout) {
+    return waitAny(handles, false, timeout);
+}
+
+int waitAnyWritable(std::span<const SocketHandle> handles, std::chrono::milliseconds timeout) {
+    return waitAny(handles, true, timeout);
+}
+
+std::vector<sockaddr_storage> resolve(const std::string& host, const std::string& port, int socketType, int family) {
+    ensureInitialized();
+
+    addrinfo hints{};
+    hints.ai_family = family;
+    hints.ai_socktype = socketType;
+
+    addrinfo* results = nullptr;
+    if (int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &results); rc != 0) {
+        throw std::runtime_error("Cannot resolve " + host + ": " + gai_strerror(rc));
+    }
+
+    std::vector<sockaddr_storage> addresses;
+    for (addrinfo* addr = results; addr != nullptr; addr = addr->ai_next) {
+        sockaddr_storage storage{};
+        std::memcpy(&storage, addr->ai_addr, addr->ai_addrlen);
+        addresses.push_back(storage);
+    }
+    freeaddrinfo(results);
+    return addresses;
+}
+
+socklen_t addressLength(const sockaddr_storage& address) {
+    return address.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+std::string addressToString(const sockaddr_storage& address) {
+    std::array<char, INET6_ADDRSTRLEN> text{};
+    std::uint16_t port = 0;
+
+    if (address.ss_family == AF_INET6) {
+        const auto* v6 = reinterpret_cast<const sockaddr_in6*>(&address);
+        inet_ntop(AF_INET6, &v6->sin6_addr, text.data(), text.size());
+        port = ntohs(v6->sin6_port);
+        return "[" + std::string(text.data()) + "]:" + std::to_string(port);
+    }
+
+    const auto* v4 = reinterpret_cast<const sockaddr_in*>(&address);
+    inet_ntop(AF_INET, &v4->sin_addr, text.data(), text.size());
+    port = ntohs(v4->sin_port);
+    return std::string(text.data()) + ":" + std::to_string(port);
+}
+
+bool isInterfaceName(std::string_view name) {
+    constexpr std::size_t maxLength = 15;  // IFNAMSIZ - 1
+    if (name.empty() || name.size() > maxLength || name == "." || name == "..") {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '_' || c == '.' || c == '-';
+    });
+}
+
+bool interfaceExists(const std::string& name) {
+    #ifdef _WIN32
+    // Nothing binds to a device by name on Windows
+    (void)name;
+    return false;
+    #else
+    return isInterfaceName(name) && ::if_nametoindex(name.c_str()) != 0;
+    #endif
+}
+
+} // namespace socketUtil
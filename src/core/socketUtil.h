@@ -0,0 +1,60 @@
+#pragma once
+import std;
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+// Small portability layer shared by the socket-based components
+namespace socketUtil {
+
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+inline constexpr SocketHandle invalidSocket = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+inline constexpr SocketHandle invalidSocket = -1;
+#endif
+
+// WSAStartup on Windows, no-op elsewhere; safe to call repeatedly
+void ensureInitialized();
+
+void closeSocket(SocketHandle handle);
+bool setNonBlocking(SocketHandle handle, bool enabled = true);
+std::string lastErrorText();
+
+// After a non-blocking connect() failed: true if it is merely still under way
+bool connectInProgress();
+// Once a non-blocking connect is writable: true if it completed without error,
+// else the reason goes to error. Reading the result clears it.
+bool connectSucceeded(SocketHandle handle, std::string* error = nullptr);
+
+// Waits until the socket is readable; false on timeout or error
+bool waitReadable(SocketHandle handle, std::chrono::milliseconds timeout);
+
+// Index of the first readable socket, or -1 on timeout
+int waitAnyReadable(std::span<const SocketHandle> handles, std::chrono::milliseconds timeout);
+// Index of the first writable (or failed) socket, or -1 on timeout
+int waitAnyWritable(std::span<const SocketHandle> handles, std::chrono::milliseconds timeout);
+
+// getaddrinfo wrapper, in the resolver's preference order (RFC 6724); family is
+// AF_INET or AF_INET6 to restrict it. Throws std::runtime_error if the name does not resolve
+std::vector<sockaddr_storage> resolve(const std::string& host, const std::string& port, int socketType,
+                                      int family = AF_UNSPEC);
+
+socklen_t addressLength(const sockaddr_storage& address);
+std::string addressToString(const sockaddr_storage& address);
+
+// True if name is a valid Linux network interface name: 1-15 characters
+// (IFNAMSIZ) of [A-Za-z0-9_.-]. Names from profiles end up in ip/nft
+// arguments, so anything else is refused before it gets there.
+bool isInterfaceName(std::string_view name);
+// True if a network interface of that name exists right now (if_nametoindex)
+bool interfaceExists(const std::string& name);
+
+} // namespace socketUtil
@@ -0,0 +1,377 @@
+import std;
+#include "splitTunnel.h"
+#include "processUtil.h"
+#include "socketUtil.h"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#endif
+
+namespace {
+
+// Our cgroup relative to the cgroup2 root; nft resolves it when the ruleset loads
+constexpr std::string_view splitCgroup = "siavpn/split";
+constexpr int splitCgroupLevel = 2;
+constexpr std::string_view nftTable = "siavpn_split";
+
+// Rule priorities just above the tunnel table number, well before main (32766);
+// hostname rules are consulted first
+constexpr int tunnelRulePriority = SplitTunnel::routingTable;
+constexpr int suppressRulePriority = SplitTunnel::routingTable - 1;
+constexpr int forceTunnelRulePriority = SplitTunnel::routingTable - 2;
+constexpr int bypassRulePriority = SplitTunnel::routingTable - 3;
+
+// Loose reverse-path filtering for marked flows; host-wide, so restored on teardown
+const std::filesystem::path srcValidMark = "/proc/sys/net/ipv4/conf/all/src_valid_mark";
+
+std::optional<std::filesystem::path> findCgroup2Mount() {
+    // mountinfo: "<id> <parent> <dev> <root> <mount point> <options> ... - <fstype> <source> <options>"
+    std::ifstream mounts("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(mounts, line)) {
+        const auto separator = line.find(" - ");
+        if (separator == std::string::npos || !line.substr(separator + 3).starts_with("cgroup2 ")) {
+            continue;
+        }
+        std::istringstream fields(line.substr(0, separator));
+        std::string field;
+        for (int i = 0; i < 5 && fields >> field; ++i) {
+        }
+        if (!field.empty()) {
+            return std::filesystem::path(field);
+        }
+    }
+    return std::nullopt;
+}
+
+// The unified-hierarchy entry of /proc/<pid>/cgroup ("0::/user.slice/...")
+std::optional<std::string> cgroupOf(int pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.starts_with("0::")) {
+            return line.substr(3);
+        }
+    }
+    return std::nullopt;
+}
+
+bool writeProcs(const std::filesystem::path& cgroup, int pid) {
+    std::ofstream procs(cgroup / "cgroup.procs");
+    procs << pid;
+    procs.flush();
+    return procs.good();
+}
+
+} // namespace
+
+SplitTunnel::~SplitTunnel() {
+    reset();
+}
+
+bool SplitTunnel::isSupported() {
+    #ifdef __linux__
+    return findCgroup2Mount().has_value();
+    #else
+    return false;
+    #endif
+}
+
+bool SplitTunnel::addProcess(int pid) {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    if (!ensureCgroup()) {
+        return false;
+    }
+
+    // Remember where the process came from once, so removal restores it exactly
+    if (!originalCgroups.contains(pid)) {
+        auto current = cgroupOf(pid);
+        if (!current) {
+            lastError = "No such process: " + std::to_string(pid);
+            return false;
+        }
+        originalCgroups.emplace(pid, cgroupRoot / std::filesystem::path(*current).relative_path());
+    }
+
+    if (!writeProcs(cgroupPath, pid)) {
+        lastError = "Cannot move process " + std::to_string(pid) + " into " + cgroupPath.string();
+        originalCgroups.erase(pid);
+        return false;
+    }
+    return true;
+}
+
+bool SplitTunnel::removeProcess(int pid) {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    auto it = originalCgroups.find(pid);
+    if (it == originalCgroups.end()) {
+        return true;
+    }
+
+    // A process that already exited has nothing left to move
+    const bool alive = cgroupOf(pid).has_value();
+    if (alive && !writeProcs(it->second, pid)) {
+        lastError = "Cannot move process " + std::to_string(pid) + " back to " + it->second.string();
+        return false;
+    }
+    originalCgroups.erase(it);
+    return true;
+}
+
+std::vector<int> SplitTunnel::processes() const {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    std::vector<int> pids;
+    for (const auto& [pid, original] : originalCgroups) {
+        pids.push_back(pid);
+    }
+    std::sort(pids.begin(), pids.end());
+    return pids;
+}
+
+bool SplitTunnel::activate(Mode mode, const std::string& tunnelInterface) {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    removeRouting();
+    if (!socketUtil::isInterfaceName(tunnelInterface)) {
+        lastError = "Invalid tunnel interface name: " + tunnelInterface;
+        return false;
+    }
+    if (mode != Mode::Disabled && !ensureCgroup()) {
+        return false;
+    }
+
+    #ifdef __linux__
+    // Marks are applied in a route chain, which makes the kernel re-run the
+    // routing decision with the mark; the masquerades fix source addresses
+    // chosen before that second lookup. The first packet's mark is saved in
+    // conntrack and restored for the rest of the flow. Hostname rules come
+    // after the app rule so they override it.
+    std::string appRule;
+    if (mode != Mode::Disabled) {
+        appRule = std::format("        socket cgroupv2 level {} \"{}\" meta mark set {:#x}\n",
+                              splitCgroupLevel, splitCgroup, packetMark);
+    }
+    const std::string ruleset = std::format(
+        "table inet {0}\n"
+        "delete table inet {0}\n"
+        "table inet {0} {{\n"
+        "    set bypass4 {{ type ipv4_addr; flags timeout; }}\n"
+        "    set bypass6 {{ type ipv6_addr; flags timeout; }}\n"
+        "    set tunnel4 {{ type ipv4_addr; flags timeout; }}\n"
+        "    set tunnel6 {{ type ipv6_addr; flags timeout; }}\n"
+        "    chain output {{\n"
+        "        type route hook output priority mangle; policy accept;\n"
+        "        ct mark != 0 meta mark set ct mark accept\n"
+        "        meta mark {1:#x} ct mark set meta mark accept\n"
+        "{2}"
+        "        ip daddr @bypass4 meta mark set {3:#x}\n"
+        "        ip6 daddr @bypass6 meta mark set {3:#x}\n"
+        "        ip daddr @tunnel4 meta mark set {4:#x}\n"
+        "        ip6 daddr @tunnel6 meta mark set {4:#x}\n"
+        "        meta mark != 0 ct mark set meta mark\n"
+        "    }}\n"
+        "    chain postrouting {{\n"
+        "        type nat hook postrouting priority srcnat; policy accept;\n"
+        "        oifname \"{5}\" masquerade\n"
+        "        meta mark {3:#x} oifname != \"{5}\" masquerade\n"
+        "    }}\n"
+        "}}\n",
+        nftTable, dnsMark, appRule, bypassMark, tunnelMark, tunnelInterface);
+    if (!runCommand({"nft", "-f", "-"}, ruleset)) {
+        return false;
+    }
+    routingInstalled = true;
+    activeMode = mode;
+    activeInterface = tunnelInterface;
+
+    // Replies to rerouted flows arrive on the tunnel, which strict reverse-path
+    // filtering would reject without the mark
+    if (savedSrcValidMark.empty()) {
+        std::ifstream previous(srcValidMark);
+        std::getline(previous, savedSrcValidMark);
+    }
+    std::ofstream enable(srcValidMark);
+    enable << 1;
+    enable.flush();
+    if (!enable.good()) {
+        lastError = "Cannot enable " + srcValidMark.string();
+        removeRouting();
+        return false;
+    }
+
+    const std::string mark = std::format("{:#x}", packetMark);
+    const std::string table = std::to_string(routingTable);
+    for (const std::string family : {"-4", "-6"}) {
+        bool ok = runCommand({"ip", family, "route", "replace", "default", "dev", tunnelInterface, "table", table}) &&
+                  runCommand({"ip", family, "rule", "add", "fwmark", std::format("{:#x}", bypassMark),
+                              "lookup", "main", "priority", std::to_string(bypassRulePriority)}) &&
+                  runCommand({"ip", family, "rule", "add", "fwmark", std::format("{:#x}", tunnelMark),
+                              "lookup", table, "priority", std::to_string(forceTunnelRulePriority)});
+        if (mode == Mode::IncludeSelected) {
+            ok = ok && runCommand({"ip", family, "rule", "add", "fwmark", mark,
+                                   "lookup", table, "priority", std::to_string(tunnelRulePriority)});
+        } else if (mode == Mode::ExcludeSelected) {
+            // wg-quick style: unmarked traffic takes the tunnel table, but main's
+            // specific routes (LAN, the VPN server itself) still win over its default
+            ok = ok && runCommand({"ip", family, "rule", "add", "not", "fwmark", mark,
+                                   "lookup", table, "priority", std::to_string(tunnelRulePriority)}) &&
+                 runCommand({"ip", family, "rule", "add", "lookup", "main", "suppress_prefixlength", "0",
+                             "priority", std::to_string(suppressRulePriority)});
+        }
+        // A host without IPv6 still gets working IPv4 split tunneling
+        if (!ok && family == "-4") {
+            removeRouting();
+            return false;
+        }
+    }
+    return true;
+    #else
+    (void)tunnelInterface;
+    lastError = "Split tunneling requires Linux";
+    return false;
+    #endif
+}
+
+bool SplitTunnel::addResolvedAddresses(std::span<const ResolvedAddress> addresses) {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    if (!routingInstalled) {
+        lastError = "Split tunnel is not active";
+        return false;
+    }
+
+    #ifdef __linux__
+    // One element per address per set, keeping the longest timeout; nft
+    // rejects a batch naming the same element twice
+    std::map<std::pair<std::string, std::string>, std::chrono::seconds> elements;
+    for (const auto& address : addresses) {
+        std::array<char, INET6_ADDRSTRLEN> text{};
+        if (!::inet_ntop(address.v6 ? AF_INET6 : AF_INET, address.bytes.data(), text.data(), text.size())) {
+            continue;
+        }
+        std::string set = std::string(address.route == DomainRoute::Bypass ? "bypass" : "tunnel") + (address.v6 ? "6" : "4");
+        auto& timeout = elements[{std::move(set), std::string(text.data())}];
+        timeout = std::max(timeout, std::max(address.timeout, std::chrono::seconds(1)));
+    }
+    if (elements.empty()) {
+        return true;
+    }
+
+    // add + delete + add refreshes the timeout of elements that already exist
+    // while staying a single transaction
+    std::map<std::string, std::pair<std::string, std::string>> perSet;
+    for (const auto& [key, timeout] : elements) {
+        auto& [withTimeout, bare] = perSet[key.first];
+        withTimeout += (withTimeout.empty() ? "" : ", ") + key.second + " timeout " + std::to_string(timeout.count()) + "s";
+        bare += (bare.empty() ? "" : ", ") + key.second;
+    }
+    std::string script;
+    for (const auto& [set, lists] : perSet) {
+        script += std::format("add element inet {0} {1} {{ {2} }}\n"
+                              "delete element inet {0} {1} {{ {3} }}\n"
+                              "add element inet {0} {1} {{ {2} }}\n",
+                              nftTable, set, lists.first, lists.second);
+    }
+    return runCommand({"nft", "-f", "-"}, script);
+    #else
+    (void)addresses;
+    return false;
+    #endif
+}
+
+void SplitTunnel::deactivate() {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    removeRouting();
+}
+
+void SplitTunnel::reset() {
+    deactivate();
+
+    std::vector<int> pids;
+    {
+        std::lock_guard<std::mutex> lock(tunnelMutex);
+        for (const auto& [pid, original] : originalCgroups) {
+            pids.push_back(pid);
+        }
+    }
+    for (int pid : pids) {
+        removeProcess(pid);
+    }
+
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    if (!cgroupPath.empty() && originalCgroups.empty()) {
+        std::error_code ignored;
+        std::filesystem::remove(cgroupPath, ignored);
+        std::filesystem::remove(cgroupPath.parent_path(), ignored);
+        cgroupPath.clear();
+    }
+}
+
+bool SplitTunnel::isActive() const {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    return routingInstalled;
+}
+
+std::string SplitTunnel::getLastError() const {
+    std::lock_guard<std::mutex> lock(tunnelMutex);
+    return lastError;
+}
+
+bool SplitTunnel::ensureCgroup() {
+    if (!cgroupPath.empty()) {
+        return true;
+    }
+
+    auto root = findCgroup2Mount();
+    if (!root) {
+        lastError = "cgroup v2 is not mounted";
+        return false;
+    }
+
+    std::error_code error;
+    const auto path = *root / splitCgroup;
+    std::filesystem::create_directories(path, error);
+    if (error) {
+        lastError = "Cannot create " + path.string() + ": " + error.message();
+        return false;
+    }
+    cgroupRoot = *root;
+    cgroupPath = path;
+    return true;
+}
+
+bool SplitTunnel::runCommand(const std::vector<std::string>& argv, std::string_view input) {
+    return processUtil::run(argv, input, lastError);
+}
+
+void SplitTunnel::removeRouting() {
+    if (!routingInstalled) {
+        return;
+    }
+
+    // Best effort: every piece is removed even if another is already gone
+    const std::string savedError = lastError;
+    runCommand({"nft", "delete", "table", "inet", std::string(nftTable)});
+    for (const std::string family : {"-4", "-6"}) {
+        runCommand({"ip", family, "rule", "del", "priority", std::to_string(bypassRulePriority)});
+        runCommand({"ip", family, "rule", "del", "priority", std::to_string(forceTunnelRulePriority)});
+        if (activeMode != Mode::Disabled) {
+            runCommand({"ip", family, "rule", "del", "priority", std::to_string(tunnelRulePriority)});
+        }
+        if (activeMode == Mode::ExcludeSelected) {
+            runCommand({"ip", family, "rule", "del", "priority", std::to_string(suppressRulePriority)});
+        }
+        runCommand({"ip", family, "route", "flush", "table", std::to_string(routingTable)});
+    }
+    lastError = savedError;
+    if (!savedSrcValidMark.empty()) {
+        std::ofstream restore(srcValidMark);
+        restore << savedSrcValidMark;
+        restore.flush();
+        if (!restore.good()) {
+            std::cerr << "[SPLIT] Cannot restore " << srcValidMark.string() << " to " << savedSrcValidMark << '\n';
+        }
+        savedSrcValidMark.clear();
+    }
+    routingInstalled = false;
+    activeMode = Mode::Disabled;
+    activeInterface.clear();
+}
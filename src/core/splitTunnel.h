@@ -0,0 +1,83 @@
+#pragma once
+import std;
+
+// Per-application split tunneling. Selected processes are moved into a
+// dedicated cgroup (v2); an nftables "socket cgroupv2" rule marks their
+// packets and policy routing sends marked (or unmarked) traffic to the VPN
+// table. Adding or removing an app is a single cgroup.procs write: the
+// ruleset never changes with the app list.
+//
+// Hostname rules work on addresses instead: the DNS stub feeds the answers
+// for matching names into nft sets whose entries expire with the record TTL.
+// Each connection keeps the route chosen for its first packet (ct mark), so
+// expiring entries never move established flows.
+//
+// Linux only. Sockets keep the cgroup they were created in, so connections
+// an app opened before being moved stay on their original route.
+class SplitTunnel {
+public:
+    enum class Mode {
+        Disabled,
+        IncludeSelected,  // only selected apps use the tunnel
+        ExcludeSelected   // everything except selected apps uses the tunnel
+    };
+
+    enum class DomainRoute : std::uint32_t {
+        Bypass,  // addresses of matching names never use the tunnel
+        Tunnel   // addresses of matching names always use it
+    };
+
+    struct ResolvedAddress {
+        DomainRoute route = DomainRoute::Bypass;
+        bool v6 = false;
+        std::array<std::uint8_t, 16> bytes{};  // IPv4 uses the first four
+        std::chrono::seconds timeout{0};
+    };
+
+    static constexpr std::uint32_t packetMark = 0x5356;   // selected apps
+    static constexpr std::uint32_t bypassMark = 0x5357;   // DomainRoute::Bypass addresses
+    static constexpr std::uint32_t tunnelMark = 0x5358;   // DomainRoute::Tunnel addresses
+    static constexpr std::uint32_t dnsMark = 0x5359;      // the DNS forwarder's own upstream queries
+    static constexpr int routingTable = 1194;
+
+    SplitTunnel() = default;
+    ~SplitTunnel();
+
+    SplitTunnel(const SplitTunnel&) = delete;
+    SplitTunnel& operator=(const SplitTunnel&) = delete;
+
+    static bool isSupported();
+
+    // App membership; works whether or not routing is active
+    bool addProcess(int pid);
+    bool removeProcess(int pid);
+    std::vector<int> processes() const;
+
+    // Installs marking, NAT and routing for the tunnel interface; replaces an
+    // earlier activation. Disabled mode installs only the hostname rules.
+    bool activate(Mode mode, const std::string& tunnelInterface);
+    // Adds or refreshes hostname-rule addresses; needs an active tunnel
+    bool addResolvedAddresses(std::span<const ResolvedAddress> addresses);
+    // Removes the rules; selected apps stay in the cgroup for the next activation
+    void deactivate();
+    // Deactivates and moves every selected app back to where it came from
+    void reset();
+
+    bool isActive() const;
+    std::string getLastError() const;
+
+private:
+    bool ensureCgroup();
+    bool runCommand(const std::vector<std::string>& argv, std::string_view input = {});
+    void removeRouting();
+
+    std::filesystem::path cgroupRoot;  // cgroup2 mount point
+    std::filesystem::path cgroupPath;  // our split cgroup below it
+    std::unordered_map<int, std::filesystem::path> originalCgroups;
+    Mode activeMode = Mode::Disabled;
+    bool routingInstalled = false;
+    std::string activeInterface;
+    std::string savedSrcValidMark;  // the sysctl's value before activation
+    std::string lastError;
+    mutable std::mutex tunnelMutex;
+};
@@ -0,0 +1,243 @@
+#pragma once
+import std;
+#include "controlChannel.h"
+#include "networkImpairment.h"
+#include "testSupport.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Stand-in server for the MultipathBond tests. It answers every probe (a
+// client hard reset) with a server reset and echoes data packets. Packets
+// it sends to a client address go through that address's ImpairmentEngine,
+// so each uplink can get its own latency and loss. It can bind inside
+// another network namespace.
+namespace bondStandIn {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+constexpr std::uint8_t dataV2 = 9;
+
+// P_DATA_V2, key 0, peer-id 0, then the packet id and payload
+inline std::vector<std::uint8_t> dataPacket(std::uint32_t packetId, std::size_t payload = 64) {
+    std::vector<std::uint8_t> packet{static_cast<std::uint8_t>(dataV2 << 3), 0, 0, 0};
+    testSupport::appendU32(packet, packetId);
+    packet.resize(packet.size() + payload, static_cast<std::uint8_t>(packetId));
+    return packet;
+}
+
+inline std::optional<std::uint32_t> dataPacketId(std::span<const std::uint8_t> packet) {
+    if (packet.size() < 8 || (packet[0] >> 3) != dataV2) {
+        return std::nullopt;
+    }
+    return testSupport::readU32(packet, 4);
+}
+
+inline std::string addressOf(const sockaddr_in& address) {
+    char text[INET_ADDRSTRLEN] = {};
+    ::inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+    return text;
+}
+
+inline sockaddr_storage endpoint(const std::string& address, std::uint16_t port) {
+    sockaddr_storage storage{};
+    auto& in = reinterpret_cast<sockaddr_in&>(storage);
+    in.sin_family = AF_INET;
+    in.sin_port = htons(port);
+    ::inet_pton(AF_INET, address.c_str(), &in.sin_addr);
+    return storage;
+}
+
+class Server {
+public:
+    // Binds address:0, inside the named network namespace if netns is set
+    explicit Server(std::string address, std::string netns = {})
+        : thread([this, address = std::move(address), netns = std::move(netns)]() { run(address, netns); }) {
+        auto bound = started.get();
+        if (!bound) {
+            thread.join();
+            throw std::runtime_error("bond stand-in: " + startError);
+        }
+        boundPort = *bound;
+    }
+
+    ~Server() {
+        stopping = true;
+        thread.join();
+    }
+
+    std::uint16_t port() const { return boundPort; }
+
+    // Impairs what is sent to clientAddress from now on; a scenario of
+    // "loss 100%" makes the path look dead
+    void setLink(const std::string& clientAddress, std::string_view scenario) {
+        std::lock_guard lock(mutex);
+        auto& link = links[clientAddress];
+        link.scenario = std::make_unique<ImpairmentScenario>(ImpairmentScenario::parse(scenario));
+        link.engine = std::make_unique<ImpairmentEngine>(*link.scenario, 0x75, Clock::now());
+    }
+
+    void setEcho(bool enabled) { echo = enabled; }
+
+    // Data packets received per client "address:port", and per address
+    std::map<std::string, std::size_t> dataBySource() const {
+        std::lock_guard lock(mutex);
+        return bySource;
+    }
+
+    std::map<std::string, std::size_t> dataByAddress() const {
+        std::lock_guard lock(mutex);
+        std::map<std::string, std::size_t> counts;
+        for (const auto& [source, count] : bySource) {
+            counts[source.substr(0, source.rfind(':'))] += count;
+        }
+        return counts;
+    }
+
+    std::size_t dataReceived() const {
+        std::lock_guard lock(mutex);
+        std::size_t total = 0;
+        for (const auto& count : bySource | std::views::values) {
+            total += count;
+        }
+        return total;
+    }
+
+    // Sends packet to a source data came from (as in dataBySource)
+    void sendTo(const std::string& source, std::vector<std::uint8_t> packet) {
+        std::lock_guard lock(mutex);
+        outbox.emplace_back(source, std::move(packet));
+    }
+
+private:
+    struct Link {
+        std::unique_ptr<ImpairmentScenario> scenario;
+        std::unique_ptr<ImpairmentEngine> engine;
+    };
+
+    void run(const std::string& address, const std::string& netns) {
+        if (!netns.empty()) {
+            const int fd = ::open(("/var/run/netns/" + netns).c_str(), O_RDONLY | O_CLOEXEC);
+            const bool entered = fd >= 0 && ::setns(fd, CLONE_NEWNET) == 0;
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            if (!entered) {
+                startError = "cannot enter " + netns + ": " + socketUtil::lastErrorText();
+                ready.set_value(std::nullopt);
+                return;
+            }
+        }
+        socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+        auto local = endpoint(address, 0);
+        socklen_t length = sizeof(sockaddr_in);
+        if (socket < 0 || ::bind(socket, reinterpret_cast<const sockaddr*>(&local), length) != 0 ||
+            ::getsockname(socket, reinterpret_cast<sockaddr*>(&local), &length) != 0) {
+            startError = "cannot bind " + address + ": " + socketUtil::lastErrorText();
+            socketUtil::closeSocket(socket);
+            ready.set_value(std::nullopt);
+            return;
+        }
+        ready.set_value(ntohs(reinterpret_cast<const sockaddr_in&>(local).sin_port));
+
+        std::vector<std::uint8_t> buffer(2048);
+        while (!stopping) {
+            if (socketUtil::waitReadable(socket, 1ms)) {
+                sockaddr_in from{};
+                socklen_t fromLength = sizeof(from);
+                const auto received = ::recvfrom(socket, buffer.data(), buffer.size(), 0,
+                                                 reinterpret_cast<sockaddr*>(&from), &fromLength);
+                if (received > 0) {
+                    handle({buffer.data(), static_cast<std::size_t>(received)}, from);
+                }
+            }
+            flush();
+        }
+        socketUtil::closeSocket(socket);
+    }
+
+    void handle(std::span<const std::uint8_t> packet, const sockaddr_in& from) {
+        const auto source = addressOf(from) + ":" + std::to_string(ntohs(from.sin_port));
+        std::lock_guard lock(mutex);
+        peers[source] = from;
+        const auto opcode = static_cast<ControlChannel::Opcode>(packet[0] >> 3);
+        if (packet.size() >= 14 && opcode == ControlChannel::Opcode::HardResetClientV2) {
+            queue(from, serverReset(testSupport::readU64(packet, 1)));
+        } else if (dataPacketId(packet)) {
+            ++bySource[source];
+            if (echo) {
+                queue(from, {packet.begin(), packet.end()});
+            }
+        }
+    }
+
+    // Caller holds mutex
+    void queue(const sockaddr_in& to, std::vector<std::uint8_t> packet) {
+        const auto now = Clock::now();
+        std::vector<Clock::time_point> due{now};
+        if (auto link = links.find(addressOf(to)); link != links.end()) {
+            due = link->second.engine->schedule(packet.size(), now);
+        }
+        for (const auto at : due) {
+            scheduled.push_back({at, sequence++, to, packet});
+        }
+    }
+
+    void flush() {
+        std::lock_guard lock(mutex);
+        for (auto& [source, packet] : outbox) {
+            if (auto peer = peers.find(source); peer != peers.end()) {
+                queue(peer->second, std::move(packet));
+            }
+        }
+        outbox.clear();
+        // In due order, so equal delays keep the order packets were queued in
+        std::ranges::sort(scheduled, {}, [](const Scheduled& entry) { return std::pair(entry.due, entry.sequence); });
+        const auto now = Clock::now();
+        while (!scheduled.empty() && scheduled.front().due <= now) {
+            const auto& entry = scheduled.front();
+            ::sendto(socket, entry.packet.data(), entry.packet.size(), 0,
+                     reinterpret_cast<const sockaddr*>(&entry.to), sizeof(entry.to));
+            scheduled.erase(scheduled.begin());
+        }
+    }
+
+    static std::vector<std::uint8_t> serverReset(std::uint64_t clientSession) {
+        std::vector<std::uint8_t> wire;
+        wire.push_back(static_cast<std::uint8_t>(ControlChannel::Opcode::HardResetServerV2) << 3);
+        testSupport::appendU64(wire, 0x5356'5356'0000'0075);
+        wire.push_back(1);
+        testSupport::appendU32(wire, 0);  // acknowledges the client reset
+        testSupport::appendU64(wire, clientSession);
+        testSupport::appendU32(wire, 0);
+        return wire;
+    }
+
+    struct Scheduled {
+        Clock::time_point due;
+        std::uint64_t sequence;
+        sockaddr_in to;
+        std::vector<std::uint8_t> packet;
+    };
+
+    int socket = -1;
+    std::uint16_t boundPort = 0;
+    std::string startError;
+    std::promise<std::optional<std::uint16_t>> ready;
+    std::future<std::optional<std::uint16_t>> started = ready.get_future();
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> echo{true};
+
+    mutable std::mutex mutex;
+    std::map<std::string, Link> links;
+    std::map<std::string, sockaddr_in> peers;
+    std::map<std::string, std::size_t> bySource;
+    std::vector<std::pair<std::string, std::vector<std::uint8_t>>> outbox;
+    std::vector<Scheduled> scheduled;
+    std::uint64_t sequence = 0;
+    std::thread thread;
+};
+
+} // namespace bondStandIn
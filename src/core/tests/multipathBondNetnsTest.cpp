@@ -0,0 +1,257 @@
+import std;
+#include "bondStandIn.h"
+#include "multipathBond.h"
+#include "processUtil.h"
+#include "testSupport.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+// MultipathBond over two real uplinks: the test moves itself into a private
+// network namespace and connects it with two veth pairs to a second one,
+// where the stand-in server listens on 10.75.0.1, reachable over either
+// link. The server impairs each link on its own (ImpairmentEngine by client
+// address). Links are taken down and back up with ip. Needs root and
+// network namespaces; reported as skipped otherwise.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+const std::string serverAddress = "10.75.0.1";
+const std::string fastAddress = "10.75.1.1";  // on fastLink, 5ms
+const std::string slowAddress = "10.75.2.1";  // on slowLink, 25ms
+const std::string fastLink = "bond-a0";
+const std::string slowLink = "bond-a1";
+constexpr std::string_view fastScenario = "latency 5ms";
+constexpr std::string_view slowScenario = "latency 25ms";
+
+std::string serverNamespace;
+
+using Counts = std::map<std::string, std::size_t>;
+
+bool ip(std::vector<std::string> arguments) {
+    arguments.insert(arguments.begin(), "ip");
+    std::string error;
+    if (!processUtil::run(arguments, {}, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Server side in a named namespace so the server thread can setns() into
+// it; the client side is this process's own namespace and goes with it
+class Topology {
+public:
+    Topology() {
+        serverNamespace = "siavpn-bond-" + std::to_string(::getpid());
+        created = ip({"netns", "add", serverNamespace});
+        if (!created) {
+            return;
+        }
+        const auto& ns = serverNamespace;
+        usable = ip({"link", "set", "lo", "up"}) && ip({"-n", ns, "link", "set", "lo", "up"}) &&
+                 ip({"-n", ns, "addr", "add", serverAddress + "/32", "dev", "lo"}) &&
+                 connect(fastLink, "bond-b0", fastAddress, "10.75.1.2") &&
+                 connect(slowLink, "bond-b1", slowAddress, "10.75.2.2") &&
+                 restoreRoute(fastLink) && restoreRoute(slowLink);
+        // Replies from the server come in on either link whatever the routes prefer
+        for (const auto device : {"all", "default", "bond-a0", "bond-a1"}) {
+            std::ofstream(std::string("/proc/sys/net/ipv4/conf/") + device + "/rp_filter") << "0";
+        }
+    }
+
+    ~Topology() {
+        if (created) {
+            ip({"netns", "delete", serverNamespace});  // takes the veth pairs with it
+        }
+    }
+
+    bool ready() const { return usable; }
+
+    // The route to the server through link; the kernel drops it with the link
+    static bool restoreRoute(const std::string& link) {
+        const bool fast = link == fastLink;
+        return ip({"route", "replace", serverAddress + "/32", "via", fast ? "10.75.1.2" : "10.75.2.2", "dev", link,
+                   "metric", fast ? "10" : "20"});
+    }
+
+private:
+    static bool connect(const std::string& near, const std::string& far, const std::string& nearAddress,
+                        const std::string& farAddress) {
+        return ip({"link", "add", near, "type", "veth", "peer", "name", far, "netns", serverNamespace}) &&
+               ip({"addr", "add", nearAddress + "/24", "dev", near}) && ip({"link", "set", near, "up"}) &&
+               ip({"-n", serverNamespace, "addr", "add", farAddress + "/24", "dev", far}) &&
+               ip({"-n", serverNamespace, "link", "set", far, "up"});
+    }
+
+    bool created = false;
+    bool usable = false;
+};
+
+std::unique_ptr<bondStandIn::Server> impairedServer() {
+    auto server = std::make_unique<bondStandIn::Server>(serverAddress, serverNamespace);
+    server->setLink(fastAddress, fastScenario);
+    server->setLink(slowAddress, slowScenario);
+    return server;
+}
+
+MultipathBond::Settings bothLinks(MultipathBond::Scheduler scheduler) {
+    MultipathBond::Settings settings;
+    settings.uplinks = {{fastLink, 0}, {slowLink, 0}};
+    settings.scheduler = scheduler;
+    settings.probeInterval = 300ms;
+    settings.probesUntilDown = 2;
+    settings.maxReorderDelay = 100ms;
+    return settings;
+}
+
+// Serves the bond (probes included) until condition holds; false on timeout
+bool serveUntil(MultipathBond& bond, const std::function<bool()>& condition, std::chrono::milliseconds timeout = 3s) {
+    const auto deadline = Clock::now() + timeout;
+    while (!condition()) {
+        if (Clock::now() > deadline) {
+            return false;
+        }
+        bond.receive(10ms);
+    }
+    return true;
+}
+
+bool bothMeasured(const MultipathBond& bond) {
+    return std::ranges::all_of(bond.pathStats(), [](const auto& path) { return path.probesAnswered >= 2; });
+}
+
+void probesMeasureEachLink() {
+    auto server = impairedServer();
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint(serverAddress, server->port()), bothLinks(MultipathBond::Scheduler::MinRtt),
+                    {}, std::nullopt));
+    CHECK(serveUntil(bond, [&]() { return bothMeasured(bond); }));
+    const auto stats = bond.pathStats();
+    CHECK(stats[0].rtt >= 5ms && stats[0].rtt < 20ms);
+    CHECK(stats[1].rtt >= 25ms && stats[1].rtt < 60ms);
+
+    // MinRtt puts everything on the faster link
+    for (std::uint32_t id = 0; id < 50; ++id) {
+        CHECK(bond.send(bondStandIn::dataPacket(id), false));
+    }
+    CHECK(serveUntil(bond, [&]() { return server->dataReceived() == 50; }));
+    const Counts expected{{fastAddress, 50}};
+    CHECK(server->dataByAddress() == expected);
+}
+
+void reorderAcrossLinks() {
+    auto server = impairedServer();
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint(serverAddress, server->port()), bothLinks(MultipathBond::Scheduler::Weighted),
+                    {}, std::nullopt));
+    CHECK(serveUntil(bond, [&]() { return bothMeasured(bond); }));
+
+    // Alternate links; the echoes of the odd ids come back 20ms behind. The
+    // first two make both links count as ones the server sends on.
+    std::vector<std::uint32_t> ids;
+    const auto receiveUntil = [&](std::size_t count) {
+        const auto deadline = Clock::now() + 3s;
+        while (ids.size() < count && Clock::now() < deadline) {
+            if (auto packet = bond.receive(10ms)) {
+                ids.push_back(*bondStandIn::dataPacketId(*packet));
+            }
+        }
+    };
+    for (std::uint32_t id = 0; id < 200; ++id) {
+        CHECK(bond.send(bondStandIn::dataPacket(id), false));
+        if (id == 1) {
+            receiveUntil(2);
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    receiveUntil(200);
+    const Counts expected{{fastAddress, 100}, {slowAddress, 100}};
+    CHECK(server->dataByAddress() == expected);
+    CHECK(std::ranges::equal(ids, std::views::iota(0u, 200u)));
+    const auto reorder = bond.reorderStats();
+    CHECK(reorder.held >= 50);
+    CHECK(reorder.skipped == 0);
+    CHECK(reorder.late == 0);
+}
+
+void failoverWhenLinkGoesDown() {
+    auto server = impairedServer();
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint(serverAddress, server->port()), bothLinks(MultipathBond::Scheduler::MinRtt),
+                    {}, std::nullopt));
+    CHECK(serveUntil(bond, [&]() { return bothMeasured(bond); }));
+
+    // The first send on the downed link fails and moves to the other one at once
+    CHECK(ip({"link", "set", fastLink, "down"}));
+    for (std::uint32_t id = 0; id < 20; ++id) {
+        CHECK(bond.send(bondStandIn::dataPacket(id), false));
+    }
+    auto stats = bond.pathStats();
+    CHECK(!stats[0].up);
+    CHECK(stats[0].timesDown == 1);
+    CHECK(stats[0].sendErrors >= 1);
+    CHECK(stats[1].packetsSent == 20);
+    CHECK(serveUntil(bond, [&]() { return server->dataReceived() == 20; }));
+    const Counts expected{{slowAddress, 20}};
+    CHECK(server->dataByAddress() == expected);
+
+    // Probes keep going on the down link and bring it back once it answers
+    CHECK(ip({"link", "set", fastLink, "up"}));
+    CHECK(Topology::restoreRoute(fastLink));
+    CHECK(serveUntil(bond, [&]() { return bond.pathStats()[0].up; }));
+    CHECK(bond.send(bondStandIn::dataPacket(20), false));
+    CHECK(bond.pathStats()[0].packetsSent == 1);
+}
+
+void silentLinkGoesDown() {
+    auto server = impairedServer();
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint(serverAddress, server->port()), bothLinks(MultipathBond::Scheduler::Weighted),
+                    {}, std::nullopt));
+    CHECK(serveUntil(bond, [&]() { return bothMeasured(bond); }));
+
+    // The slow link still sends, but nothing comes back on it
+    server->setLink(slowAddress, "loss 100%");
+    CHECK(serveUntil(bond, [&]() { return !bond.pathStats()[1].up; }));
+    auto stats = bond.pathStats();
+    CHECK(stats[1].timesDown == 1);
+    CHECK(stats[1].sendErrors == 0);
+    CHECK(stats[0].up);
+
+    const auto before = stats[0].packetsSent;
+    for (std::uint32_t id = 0; id < 10; ++id) {
+        CHECK(bond.send(bondStandIn::dataPacket(id), false));
+    }
+    CHECK(bond.pathStats()[0].packetsSent == before + 10);
+
+    server->setLink(slowAddress, slowScenario);
+    CHECK(serveUntil(bond, [&]() { return bond.pathStats()[1].up; }));
+}
+
+} // namespace
+
+int main() {
+    if (::geteuid() != 0) {
+        std::cout << "needs root for network namespaces, skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    if (::unshare(CLONE_NEWNET) != 0) {
+        std::cout << "no network namespaces (" << socketUtil::lastErrorText() << "), skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    Topology topology;
+    if (!topology.ready()) {
+        std::cout << "cannot set up the veth links, skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    return testSupport::run({
+        {"probesMeasureEachLink", probesMeasureEachLink},
+        {"reorderAcrossLinks", reorderAcrossLinks},
+        {"failoverWhenLinkGoesDown", failoverWhenLinkGoesDown},
+        {"silentLinkGoesDown", silentLinkGoesDown},
+    });
+}
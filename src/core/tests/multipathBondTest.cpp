@@ -0,0 +1,163 @@
+import std;
+#include "bondStandIn.h"
+#include "multipathBond.h"
+#include "testSupport.h"
+
+// MultipathBond with two uplinks that are both "lo", against a stand-in
+// server on 127.0.0.1: the scheduler's split, the probes and the reorder
+// buffer, with no privileges needed. Per-path delays, link loss and
+// failover are covered by multipathBondNetnsTest.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+MultipathBond::Settings twoLoopbacks(MultipathBond::Scheduler scheduler, std::uint32_t first, std::uint32_t second) {
+    MultipathBond::Settings settings;
+    settings.uplinks = {{"lo", first}, {"lo", second}};
+    settings.scheduler = scheduler;
+    settings.probeInterval = 300ms;
+    settings.maxReorderDelay = 500ms;
+    return settings;
+}
+
+// Packet ids of what the bond delivers within timeout, until count arrived
+std::vector<std::uint32_t> receiveIds(MultipathBond& bond, std::size_t count, std::chrono::milliseconds timeout = 2s) {
+    std::vector<std::uint32_t> ids;
+    const auto deadline = Clock::now() + timeout;
+    while (ids.size() < count && Clock::now() < deadline) {
+        if (auto packet = bond.receive(20ms)) {
+            if (auto id = bondStandIn::dataPacketId(*packet)) {
+                ids.push_back(*id);
+            }
+        }
+    }
+    return ids;
+}
+
+bool waitFor(const std::function<bool()>& condition, std::chrono::milliseconds timeout = 2s) {
+    const auto deadline = Clock::now() + timeout;
+    while (!condition()) {
+        if (Clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(2ms);
+    }
+    return true;
+}
+
+void parsing() {
+    const auto plain = MultipathBond::parseUplink("wlan0");
+    CHECK(plain && plain->interface == "wlan0" && plain->capacityMbps == 0);
+    const auto rated = MultipathBond::parseUplink("wwan0=20");
+    CHECK(rated && rated->interface == "wwan0" && rated->capacityMbps == 20);
+    CHECK(!MultipathBond::parseUplink(""));
+    CHECK(!MultipathBond::parseUplink("wwan0="));
+    CHECK(!MultipathBond::parseUplink("wwan0=fast"));
+    CHECK(!MultipathBond::parseUplink("eth 0"));
+    CHECK(!MultipathBond::parseUplink("../eth0"));
+
+    CHECK(MultipathBond::schedulerFromString("min-rtt") == MultipathBond::Scheduler::MinRtt);
+    CHECK(MultipathBond::schedulerFromString("weighted") == MultipathBond::Scheduler::Weighted);
+    CHECK(!MultipathBond::schedulerFromString("round-robin"));
+}
+
+void probesAnswered() {
+    bondStandIn::Server server("127.0.0.1");
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint("127.0.0.1", server.port()),
+                    twoLoopbacks(MultipathBond::Scheduler::MinRtt, 0, 0), {}, std::nullopt));
+    // Probes are served while the bond waits for packets
+    const auto deadline = Clock::now() + 1s;
+    while (Clock::now() < deadline) {
+        bond.receive(20ms);
+        const auto stats = bond.pathStats();
+        if (std::ranges::all_of(stats, [](const auto& path) { return path.probesAnswered > 0; })) {
+            break;
+        }
+    }
+    for (const auto& path : bond.pathStats()) {
+        CHECK(path.up);
+        CHECK(path.probesAnswered > 0);
+        CHECK(path.rtt > 0us && path.rtt < 100ms);
+        CHECK(path.timesDown == 0);
+    }
+}
+
+void weightedSplit() {
+    bondStandIn::Server server("127.0.0.1");
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint("127.0.0.1", server.port()),
+                    twoLoopbacks(MultipathBond::Scheduler::Weighted, 30, 10), {}, std::nullopt));
+    for (std::uint32_t id = 0; id < 40; ++id) {
+        CHECK(bond.send(bondStandIn::dataPacket(id), false));
+    }
+    CHECK(waitFor([&]() { return server.dataReceived() == 40; }));
+
+    // Smooth weighted round-robin: exactly 3:1, on two separate sockets
+    const auto bySource = server.dataBySource();
+    CHECK(bySource.size() == 2);
+    std::vector<std::size_t> counts;
+    for (const auto& count : bySource | std::views::values) {
+        counts.push_back(count);
+    }
+    std::ranges::sort(counts);
+    CHECK(counts == std::vector<std::size_t>({10, 30}));
+    const auto stats = bond.pathStats();
+    CHECK(stats[0].packetsSent == 30 && stats[1].packetsSent == 10);
+
+    // The echoes come back over both paths and are delivered in order
+    const auto ids = receiveIds(bond, 40);
+    CHECK(ids.size() == 40);
+    CHECK(std::ranges::is_sorted(ids));
+    CHECK(bond.reorderStats().skipped == 0);
+}
+
+void gapOnEveryPathIsSkipped() {
+    bondStandIn::Server server("127.0.0.1");
+    server.setEcho(false);
+    MultipathBond bond;
+    CHECK(bond.open(bondStandIn::endpoint("127.0.0.1", server.port()),
+                    twoLoopbacks(MultipathBond::Scheduler::Weighted, 1, 1), {}, std::nullopt));
+    CHECK(bond.send(bondStandIn::dataPacket(0), false));
+    CHECK(bond.send(bondStandIn::dataPacket(1), false));
+    CHECK(waitFor([&]() { return server.dataBySource().size() == 2; }));
+    const auto sources = server.dataBySource();
+    const auto& first = sources.begin()->first;
+    const auto& second = std::next(sources.begin())->first;
+
+    // Ids 0 and 1 set the sequence and mark both paths as receiving
+    server.sendTo(first, bondStandIn::dataPacket(0));
+    CHECK(receiveIds(bond, 1) == std::vector<std::uint32_t>({0}));
+    server.sendTo(second, bondStandIn::dataPacket(1));
+    CHECK(receiveIds(bond, 1) == std::vector<std::uint32_t>({1}));
+
+    // 2 never comes, and both paths deliver past it: only jitter is waited
+    // for, not the 500ms reorder delay
+    const auto start = Clock::now();
+    server.sendTo(first, bondStandIn::dataPacket(3));
+    server.sendTo(second, bondStandIn::dataPacket(4));
+    const auto ids = receiveIds(bond, 2);
+    CHECK(ids == std::vector<std::uint32_t>({3, 4}));
+    CHECK(Clock::now() - start < 250ms);
+    const auto reorder = bond.reorderStats();
+    CHECK(reorder.skipped == 1);
+    CHECK(reorder.held >= 1);
+
+    // The stray 2 is late and handed on for the replay window to judge
+    server.sendTo(first, bondStandIn::dataPacket(2));
+    CHECK(receiveIds(bond, 1) == std::vector<std::uint32_t>({2}));
+    CHECK(bond.reorderStats().late == 1);
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"parsing", parsing},
+        {"probesAnswered", probesAnswered},
+        {"weightedSplit", weightedSplit},
+        {"gapOnEveryPathIsSkipped", gapOnEveryPathIsSkipped},
+    });
+}
@@ -0,0 +1,299 @@
+import std;
+#include "networkImpairment.h"
+#include "testSupport.h"
+
+// Scenario parsing, the seeded per-packet decisions and the loopback proxy
+// that the other tests use as their impaired link.
+
+namespace {
+
+using Clock = ImpairmentEngine::Clock;
+using namespace std::chrono_literals;
+
+void scenarioParsing() {
+    const auto scenario = ImpairmentScenario::parse(
+        "name handover   # trailing comment\n"
+        "seed 53\n"
+        "repeat no\n"
+        "latency 25ms\n"
+        "bandwidth 2mbit\n"
+        "phase good 2s\n"
+        "phase outage 500ms\n"
+        "loss 100%\n"
+        "phase lossy forever\n"
+        "loss 0.05\n"
+        "loss-burst 4\n"
+        "jitter 1500us\n");
+
+    CHECK(scenario.name == "handover");
+    CHECK(scenario.seed == 53);
+    CHECK(!scenario.repeat);
+    CHECK(scenario.phases.size() == 3);
+    if (scenario.phases.size() != 3) {
+        return;
+    }
+
+    // Settings before the first phase are every phase's defaults
+    CHECK(scenario.phases[0].duration == 2s);
+    CHECK(scenario.phases[0].profile.latency == 25ms);
+    CHECK(scenario.phases[0].profile.bandwidthBitsPerSecond == 2'000'000);
+    CHECK(scenario.phases[0].profile.loss == 0.0);
+    CHECK(scenario.phases[1].profile.loss == 1.0);
+    CHECK(scenario.phases[1].profile.latency == 25ms);
+    CHECK(scenario.phases[2].duration == 0ms);
+    CHECK(scenario.phases[2].profile.loss == 0.05);
+    CHECK(scenario.phases[2].profile.lossBurst == 4.0);
+    CHECK(scenario.phases[2].profile.jitter == 1500us);
+
+    CHECK(scenario.phaseAt(1s).name == "good");
+    CHECK(scenario.phaseAt(2200ms).name == "outage");
+    CHECK(scenario.phaseAt(10min).name == "lossy");
+
+    const auto looping = ImpairmentScenario::parse("phase a 1s\nphase b 1s\n");
+    CHECK(looping.repeat);
+    CHECK(looping.phaseAt(2500ms).name == "a");
+    CHECK(looping.phaseAt(3500ms).name == "b");
+
+    const auto plain = ImpairmentScenario::parse("latency 10\n");
+    CHECK(plain.phases.size() == 1);
+    CHECK(!plain.phases.empty() && plain.phases[0].profile.latency == 10ms);
+
+    auto rejects = [](std::string_view text, std::string_view expected) {
+        try {
+            ImpairmentScenario::parse(text);
+        } catch (const std::runtime_error& e) {
+            return std::string_view(e.what()).find(expected) != std::string_view::npos;
+        }
+        return false;
+    };
+    CHECK(rejects("latency 10ms\nloss 150%\n", "line 2"));
+    CHECK(rejects("latency 10parsecs\n", "Invalid duration unit"));
+    CHECK(rejects("bandwidth 10furlongs\n", "Invalid bandwidth unit"));
+    CHECK(rejects("wormhole yes\n", "Unknown impairment setting"));
+    CHECK(rejects("loss\n", "Missing value"));
+}
+
+std::vector<std::vector<Clock::time_point>> runEngine(const ImpairmentScenario& scenario, std::uint64_t salt,
+                                                      std::size_t packets) {
+    const auto start = Clock::time_point{} + 1h;
+    ImpairmentEngine engine(scenario, salt, start);
+    std::vector<std::vector<Clock::time_point>> fates;
+    for (std::size_t i = 0; i < packets; ++i) {
+        fates.push_back(engine.schedule(1200, start + i * 1ms));
+    }
+    return fates;
+}
+
+void engineIsDeterministic() {
+    const auto scenario = ImpairmentScenario::parse(
+        "seed 53\nlatency 20ms\njitter 5ms\nloss 10%\nreorder 2%\nreorder-delay 15ms\nduplicate 1%\n");
+
+    const auto first = runEngine(scenario, 1, 5000);
+    CHECK(first == runEngine(scenario, 1, 5000));
+    // The direction salt gives each direction its own sequence
+    CHECK(first != runEngine(scenario, 2, 5000));
+
+    auto reseeded = scenario;
+    reseeded.seed = 54;
+    CHECK(first != runEngine(reseeded, 1, 5000));
+}
+
+void engineRates() {
+    constexpr std::size_t packets = 50000;
+    const auto start = Clock::time_point{} + 1h;
+
+    auto lossRate = [&](std::string_view text) {
+        const auto scenario = ImpairmentScenario::parse(text);
+        ImpairmentEngine engine(scenario, 1, start);
+        for (std::size_t i = 0; i < packets; ++i) {
+            engine.schedule(1200, start + i * 1ms);
+        }
+        return static_cast<double>(engine.stats().dropped) / packets;
+    };
+
+    const double uniform = lossRate("seed 7\nloss 10%\n");
+    CHECK(uniform > 0.09 && uniform < 0.11);
+    // Bursty loss keeps the long-run rate
+    const double bursty = lossRate("seed 7\nloss 10%\nloss-burst 5\n");
+    CHECK(bursty > 0.08 && bursty < 0.12);
+    CHECK(lossRate("seed 7\nloss 100%\n") == 1.0);
+
+    // Latency plus jitter stays within bounds and never reorders by itself
+    {
+        const auto scenario = ImpairmentScenario::parse("seed 7\nlatency 20ms\njitter 5ms\n");
+        ImpairmentEngine engine(scenario, 1, start);
+        Clock::time_point previous{};
+        bool ordered = true;
+        bool bounded = true;
+        for (std::size_t i = 0; i < 1000; ++i) {
+            const auto now = start + i * 1ms;
+            const auto fate = engine.schedule(100, now);
+            bounded = bounded && fate.size() == 1 && fate[0] - now >= 15ms && fate[0] - now <= 25ms + 1ms;
+            ordered = ordered && !fate.empty() && fate[0] >= previous;
+            previous = fate.empty() ? previous : fate[0];
+        }
+        CHECK(bounded);
+        CHECK(ordered);
+    }
+
+    // 1 Mbit/s serializes 1250-byte packets 10ms apart and tail-drops past the queue
+    {
+        const auto scenario = ImpairmentScenario::parse("bandwidth 1mbit\nqueue 4\n");
+        ImpairmentEngine engine(scenario, 1, start);
+        std::vector<Clock::time_point> departures;
+        for (int i = 0; i < 6; ++i) {
+            const auto fate = engine.schedule(1250, start);
+            if (!fate.empty()) {
+                departures.push_back(fate[0]);
+            }
+        }
+        CHECK(departures.size() == 4);
+        CHECK(engine.stats().queueDrops == 2);
+        CHECK(!departures.empty() && departures[0] - start == 10ms);
+        CHECK(departures.size() == 4 && departures[3] - departures[2] == 10ms);
+    }
+
+    // Stream mode never loses or reorders, whatever the profile says
+    {
+        const auto scenario = ImpairmentScenario::parse("loss 50%\nreorder 50%\nreorder-delay 40ms\nduplicate 50%\n");
+        ImpairmentEngine engine(scenario, 1, start);
+        bool intact = true;
+        for (std::size_t i = 0; i < 1000; ++i) {
+            intact = intact && engine.schedule(100, start + i * 1ms, true).size() == 1;
+        }
+        CHECK(intact);
+        CHECK(engine.stats().dropped == 0);
+    }
+}
+
+// Datagrams through the proxy to a UDP echo: losses match the stats and
+// every survivor comes back no sooner than two one-way latencies
+void proxyOverUdp() {
+    testSupport::LoopbackUdp echo;
+    testSupport::LoopbackUdp client;
+
+    ImpairmentProxy proxy(ImpairmentScenario::parse("seed 53\nlatency 15ms\nloss 20%\n"));
+    const auto port = proxy.start("127.0.0.1", std::to_string(echo.port()), VpnTransport::Protocol::Udp);
+    CHECK(port.has_value());
+    if (!port) {
+        std::cerr << proxy.getLastError() << std::endl;
+        return;
+    }
+
+    std::atomic<bool> stopEcho{false};
+    std::thread echoThread([&]() {
+        while (!stopEcho) {
+            if (auto datagram = echo.receive(5ms)) {
+                echo.reply(*datagram);
+            }
+        }
+    });
+
+    constexpr std::uint32_t sent = 400;
+    std::map<std::uint32_t, Clock::time_point> sentAt;
+    for (std::uint32_t i = 0; i < sent; ++i) {
+        std::array<std::uint8_t, 64> datagram{};
+        std::memcpy(datagram.data(), &i, sizeof(i));
+        sentAt[i] = Clock::now();
+        client.sendTo(*port, datagram);
+        std::this_thread::sleep_for(500us);
+    }
+
+    std::set<std::uint32_t> returned;
+    auto fastest = Clock::duration::max();
+    while (auto datagram = client.receive(300ms)) {
+        std::uint32_t id = 0;
+        std::memcpy(&id, datagram->data(), sizeof(id));
+        returned.insert(id);
+        fastest = std::min(fastest, Clock::now() - sentAt[id]);
+    }
+
+    stopEcho = true;
+    echoThread.join();
+    const auto stats = proxy.stats();
+    proxy.stop();
+
+    CHECK(stats.upstream.packets == sent);
+    CHECK(stats.upstream.dropped > 0 && stats.downstream.dropped > 0);
+    CHECK(returned.size() == sent - stats.upstream.dropped - stats.downstream.dropped);
+    CHECK(returned.size() > sent / 2);
+    CHECK(fastest >= 30ms);
+}
+
+// TCP keeps every byte and its order; only latency applies
+void proxyOverTcp() {
+    const auto listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(local);
+    CHECK(::bind(listener, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) == 0);
+    CHECK(::listen(listener, 1) == 0);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&local), &length);
+
+    ImpairmentProxy proxy(ImpairmentScenario::parse("seed 53\nlatency 10ms\nloss 50%\nreorder 50%\n"));
+    const auto port = proxy.start("127.0.0.1", std::to_string(ntohs(local.sin_port)), VpnTransport::Protocol::Tcp);
+    CHECK(port.has_value());
+    if (!port) {
+        socketUtil::closeSocket(listener);
+        return;
+    }
+
+    std::vector<std::uint8_t> payload(256 * 1024);
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<std::uint8_t>(i * 7 + (i >> 10));
+    }
+
+    std::vector<std::uint8_t> arrived;
+    std::thread server([&]() {
+        if (!socketUtil::waitReadable(listener, 5s)) {
+            return;
+        }
+        const auto connection = ::accept(listener, nullptr, nullptr);
+        std::array<std::uint8_t, 16384> buffer{};
+        while (arrived.size() < payload.size() && socketUtil::waitReadable(connection, 5s)) {
+            const auto received = ::recv(connection, reinterpret_cast<char*>(buffer.data()),
+                                         static_cast<int>(buffer.size()), 0);
+            if (received <= 0) {
+                break;
+            }
+            arrived.insert(arrived.end(), buffer.begin(), buffer.begin() + received);
+        }
+        socketUtil::closeSocket(connection);
+    });
+
+    const auto client = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in target = local;
+    target.sin_port = htons(*port);
+    CHECK(::connect(client, reinterpret_cast<const sockaddr*>(&target), sizeof(target)) == 0);
+    std::size_t offset = 0;
+    while (offset < payload.size()) {
+        const auto sent = ::send(client, reinterpret_cast<const char*>(payload.data() + offset),
+                                 static_cast<int>(payload.size() - offset), 0);
+        if (sent <= 0) {
+            break;
+        }
+        offset += static_cast<std::size_t>(sent);
+    }
+
+    server.join();
+    socketUtil::closeSocket(client);
+    socketUtil::closeSocket(listener);
+    const auto stats = proxy.stats();
+    proxy.stop();
+
+    CHECK(arrived == payload);
+    CHECK(stats.upstream.dropped == 0 && stats.upstream.reordered == 0);
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"scenarioParsing", scenarioParsing},
+        {"engineIsDeterministic", engineIsDeterministic},
+        {"engineRates", engineRates},
+        {"proxyOverUdp", proxyOverUdp},
+        {"proxyOverTcp", proxyOverTcp},
+    });
+}
@@ -0,0 +1,102 @@
+import std;
+#include "ovpnProfile.h"
+#include "profileManifest.h"
+#include "testSupport.h"
+
+// ProfileManifest over a BlobStore in a scratch directory: shareable blocks
+// move to the store, secrets stay inline, and assemble() gives back the
+// profile byte for byte whatever its line endings and indentation.
+
+namespace {
+
+// Scratch blob directory, removed again with the fixture
+struct ScratchStore {
+    ScratchStore()
+        : directory(std::filesystem::temp_directory_path() /
+                    ("siavpn-manifest-" + std::to_string(std::random_device{}())))
+        , store(directory) {
+    }
+    ~ScratchStore() {
+        std::error_code ignored;
+        std::filesystem::remove_all(directory, ignored);
+    }
+
+    std::filesystem::path directory;
+    BlobStore store;
+};
+
+const std::string caBody(200, 'C');
+
+std::string profileWith(std::string_view eol, std::string_view indent) {
+    std::string text;
+    for (std::string_view line : {"client", "dev tun", "remote vpn.example.com 1194 udp"}) {
+        text.append(line).append(eol);
+    }
+    text.append(indent).append("<ca>").append(eol);
+    text.append(caBody).append(eol);
+    text.append(indent).append("</ca>").append(eol);
+    text.append("<key>").append(eol).append("SECRET").append(eol).append("</key>").append(eol);
+    return text;
+}
+
+void crlfRoundTrip() {
+    ScratchStore scratch;
+    const std::string original = profileWith("\r\n", "");
+    const SecureString manifest = ProfileManifest::build(original, scratch.store);
+
+    CHECK(ProfileManifest::isManifest(manifest.view()));
+    CHECK(manifest.view().find("<ca sha256=\"") != std::string_view::npos);
+    CHECK(manifest.view().find("\"/>\r\n</ca>\r\n") != std::string_view::npos);
+    CHECK(manifest.view().find(caBody) == std::string_view::npos);
+    CHECK(manifest.view().find("<key>\r\nSECRET\r\n</key>\r\n") != std::string_view::npos);
+
+    const ProfileManifest stored(std::string(manifest.view()), scratch.store);
+    CHECK(stored.referencedBlobs().size() == 1);
+    CHECK(stored.assemble() == original);
+    const auto ca = stored.block("ca");
+    CHECK(ca && *ca == caBody + "\r\n");
+}
+
+void indentedTagsRoundTrip() {
+    ScratchStore scratch;
+    const std::string original = profileWith("\n", "  \t");
+    const SecureString manifest = ProfileManifest::build(original, scratch.store);
+    CHECK(manifest.view().find("  \t<ca sha256=\"") != std::string_view::npos);
+    CHECK(ProfileManifest(std::string(manifest.view()), scratch.store).assemble() == original);
+
+    // Without a final newline the closing line is still kept as it was
+    std::string unterminated = original.substr(0, original.find("<key>"));
+    unterminated.pop_back();
+    CHECK(ProfileManifest(std::string(ProfileManifest::build(unterminated, scratch.store).view()), scratch.store)
+              .assemble() == unterminated);
+}
+
+// Manifests written before the closing line was kept assemble as they always did
+void olderReferencesStillAssemble() {
+    ScratchStore scratch;
+    const std::string hash = scratch.store.put(caBody + "\n");
+    const std::string manifest = "# siavpn-manifest 1\nclient\n<ca sha256=\"" + hash + "\"/>\nverb 3\n";
+    CHECK(ProfileManifest(manifest, scratch.store).assemble() == "client\n<ca>\n" + caBody + "\n</ca>\nverb 3\n");
+}
+
+// The closing tag line a reference keeps is not a directive
+void manifestParsesWithoutStrayDirectives() {
+    ScratchStore scratch;
+    const SecureString manifest = ProfileManifest::build(profileWith("\n", ""), scratch.store);
+    const auto profile = OvpnProfile::parse(manifest.view());
+    CHECK(!profile.hasDirective("</ca>"));
+    CHECK(profile.hasDirective("dev"));
+    CHECK(profile.remotes().size() == 1);
+    CHECK(profile.secretBlock("key").view() == "SECRET\n");
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"crlfRoundTrip", crlfRoundTrip},
+        {"indentedTagsRoundTrip", indentedTagsRoundTrip},
+        {"olderReferencesStillAssemble", olderReferencesStillAssemble},
+        {"manifestParsesWithoutStrayDirectives", manifestParsesWithoutStrayDirectives},
+    });
+}
@@ -0,0 +1,606 @@
+import std;
+#include "quicPacket.h"
+#include "quicTls.h"
+#include "quicTunnel.h"
+#include "testSupport.h"
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+// QuicTunnel against a stand-in MASQUE proxy on loopback. The stand-in is
+// the server half built from the same pieces (quicPacket, QuicTls in the
+// server role): it completes the handshake, answers the CONNECT-UDP
+// request and relays DATAGRAM frames to a UDP echo server. It assumes a
+// lossless link, so it never retransmits.
+
+namespace {
+
+using Bytes = std::vector<std::uint8_t>;
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+using quic::Space;
+
+constexpr std::size_t idSize = 8;
+
+// A self-signed certificate for 127.0.0.1; the client trusts it as its <ca>
+struct TestCertificate {
+    EVP_PKEY* key = nullptr;
+    X509* certificate = nullptr;
+    std::string pem;
+
+    TestCertificate() {
+        key = EVP_EC_gen("P-256");
+        certificate = X509_new();
+        X509_set_version(certificate, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(certificate), 74);
+        X509_gmtime_adj(X509_getm_notBefore(certificate), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+        X509_set_pubkey(certificate, key);
+        X509_NAME* name = X509_get_subject_name(certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("siavpn test proxy"),
+                                   -1, -1, 0);
+        X509_set_issuer_name(certificate, name);
+
+        X509V3_CTX context;
+        X509V3_set_ctx_nodb(&context);
+        X509V3_set_ctx(&context, certificate, certificate, nullptr, nullptr, 0);
+        for (const auto& [id, value] : {std::pair{NID_subject_alt_name, "IP:127.0.0.1"},
+                                        std::pair{NID_basic_constraints, "critical,CA:TRUE"}}) {
+            X509_EXTENSION* extension = X509V3_EXT_conf_nid(nullptr, &context, id, value);
+            X509_add_ext(certificate, extension, -1);
+            X509_EXTENSION_free(extension);
+        }
+        X509_sign(certificate, key, EVP_sha256());
+
+        BIO* bio = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(bio, certificate);
+        char* data = nullptr;
+        const long length = BIO_get_mem_data(bio, &data);
+        pem.assign(data, static_cast<std::size_t>(length));
+        BIO_free(bio);
+    }
+
+    ~TestCertificate() {
+        X509_free(certificate);
+        EVP_PKEY_free(key);
+    }
+};
+
+struct ProxyBehaviour {
+    bool datagramSetting = true;  // SETTINGS_H3_DATAGRAM in the server's SETTINGS
+    int status = 200;             // 200 or 403; the static table has both
+};
+
+class StandInProxy {
+public:
+    StandInProxy(const TestCertificate& certificate, std::uint16_t targetPort, ProxyBehaviour behaviour = {})
+        : behaviour(behaviour)
+        , targetPort(targetPort) {
+        context = SSL_CTX_new(TLS_server_method());
+        QuicTls::configure(context);
+        SSL_CTX_use_certificate(context, certificate.certificate);
+        SSL_CTX_use_PrivateKey(context, certificate.key);
+        SSL_CTX_set_num_tickets(context, 0);
+        SSL_CTX_set_alpn_select_cb(context, &StandInProxy::selectAlpn, nullptr);
+        serverId.resize(idSize);
+        for (std::size_t i = 0; i < idSize; ++i) {
+            serverId[i] = static_cast<std::uint8_t>(0x74 + i);
+        }
+        thread = std::thread([this]() { run(); });
+    }
+
+    ~StandInProxy() {
+        stopping = true;
+        thread.join();
+        tls.reset();
+        SSL_CTX_free(context);
+    }
+
+    std::uint16_t port() const { return socket.port(); }
+    bool handshakeDone() const { return handshakeComplete; }
+    std::string requestPath() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return path;
+    }
+    std::size_t relayed() const { return datagramsRelayed; }
+
+private:
+    struct SpaceState {
+        std::unique_ptr<quic::PacketKeys> readKeys;
+        std::unique_ptr<quic::PacketKeys> writeKeys;
+        std::uint64_t nextNumber = 0;
+        std::optional<std::uint64_t> largest;
+        std::uint64_t runStart = 0;  // lowest number of the contiguous run ending at largest
+        bool ackPending = false;
+        std::uint64_t cryptoReceived = 0;
+        std::uint64_t cryptoSent = 0;
+    };
+
+    static int selectAlpn(SSL*, const unsigned char** out, unsigned char* outLength, const unsigned char* in,
+                          unsigned int inLength, void*) {
+        static constexpr std::array<unsigned char, 3> h3{2, 'h', '3'};
+        unsigned char* selected = nullptr;
+        if (SSL_select_next_proto(&selected, outLength, h3.data(), h3.size(), in, inLength) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_ALERT_FATAL;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    SpaceState& space(Space which) { return spaces[static_cast<std::size_t>(which)]; }
+
+    void run() {
+        while (!stopping) {
+            const std::array<socketUtil::SocketHandle, 2> handles{socket.socket(), target.socket()};
+            const int ready = socketUtil::waitAnyReadable(handles, 5ms);
+            if (ready == 0) {
+                if (auto datagram = socket.receive(0ms)) {
+                    clientPort = socket.senderPort();
+                    processDatagram(*datagram);
+                }
+            } else if (ready == 1) {
+                if (auto reply = target.receive(0ms); reply && established) {
+                    Bytes frame{0x31};
+                    quic::appendVarint(frame, reply->size() + 2);
+                    frame.insert(frame.end(), {0x00, 0x00});  // request stream 0, context 0
+                    quic::appendBytes(frame, *reply);
+                    outgoing[static_cast<std::size_t>(Space::Application)].push_back(std::move(frame));
+                }
+            }
+            flush();
+        }
+    }
+
+    void processDatagram(std::span<std::uint8_t> datagram) {
+        std::size_t offset = 0;
+        while (offset < datagram.size()) {
+            auto packet = datagram.subspan(offset);
+            if (!(packet[0] & 0x80)) {
+                processPacket(Space::Application, packet, 1 + idSize, packet.size());
+                break;
+            }
+            quic::Reader reader(packet);
+            const auto first = reader.byte();
+            reader.fixed(4);
+            const auto destination = reader.bytes(reader.byte());
+            const auto source = reader.bytes(reader.byte());
+            const auto type = static_cast<quic::PacketType>((first >> 4) & 0x03);
+            if (type == quic::PacketType::Initial) {
+                reader.bytes(reader.varint());
+            }
+            const auto length = reader.varint();
+            if (!reader.ok() || length > packet.size() - reader.offset()) {
+                return;
+            }
+            const std::size_t numberOffset = reader.offset();
+            if (type == quic::PacketType::Initial && !tls) {
+                accept(destination, source);
+            }
+            processPacket(type == quic::PacketType::Initial ? Space::Initial : Space::Handshake, packet, numberOffset,
+                          numberOffset + length);
+            offset += numberOffset + length;
+        }
+    }
+
+    void accept(std::span<const std::uint8_t> originalId, std::span<const std::uint8_t> sourceId) {
+        clientId.assign(sourceId.begin(), sourceId.end());
+        auto [clientSecret, serverSecret] = quic::initialSecrets(originalId);
+        space(Space::Initial).readKeys = std::make_unique<quic::PacketKeys>(clientSecret);
+        space(Space::Initial).writeKeys = std::make_unique<quic::PacketKeys>(serverSecret);
+
+        Bytes parameters;
+        auto parameter = [&](std::uint64_t id, std::span<const std::uint8_t> value) {
+            quic::appendVarint(parameters, id);
+            quic::appendVarint(parameters, value.size());
+            quic::appendBytes(parameters, value);
+        };
+        auto integer = [&](std::uint64_t id, std::uint64_t value) {
+            Bytes encoded;
+            quic::appendVarint(encoded, value);
+            parameter(id, encoded);
+        };
+        parameter(0x00, originalId);  // original_destination_connection_id
+        parameter(0x0f, serverId);    // initial_source_connection_id
+        integer(0x01, 30000);         // max_idle_timeout
+        integer(0x04, 1 << 20);       // initial_max_data
+        integer(0x08, 16);            // initial_max_streams_bidi
+        integer(0x09, 16);            // initial_max_streams_uni
+        integer(0x20, 65535);         // max_datagram_frame_size
+        tls = std::make_unique<QuicTls>(context, true, parameters);
+    }
+
+    void processPacket(Space which, std::span<std::uint8_t> packet, std::size_t numberOffset, std::size_t end) {
+        auto& state = space(which);
+        if (!state.readKeys || end < numberOffset + quic::packetNumberSize + quic::tagSize) {
+            return;
+        }
+        state.readKeys->unmaskHeader(packet.data(), numberOffset);
+        const std::size_t numberSize = (packet[0] & 0x03) + 1;
+        std::uint64_t truncated = 0;
+        for (std::size_t i = 0; i < numberSize; ++i) {
+            truncated = (truncated << 8) | packet[numberOffset + i];
+        }
+        const auto number = quic::decodePacketNumber(state.largest, truncated, numberSize);
+        const std::size_t headerLength = numberOffset + numberSize;
+        if (!state.readKeys->open(packet.data(), headerLength, end, number)) {
+            return;
+        }
+
+        if (!state.largest || number == *state.largest + 1) {
+            state.runStart = state.largest ? state.runStart : number;
+        } else if (number > *state.largest) {
+            state.runStart = number;
+        }
+        state.largest = std::max(state.largest.value_or(0), number);
+        processFrames(which, packet.subspan(headerLength, end - headerLength - quic::tagSize));
+    }
+
+    void processFrames(Space which, std::span<const std::uint8_t> payload) {
+        quic::Reader reader(payload);
+        while (reader.ok() && !reader.atEnd()) {
+            const auto type = reader.varint();
+            if (type != 0x00 && type != 0x02 && type != 0x03 && type != 0x1c && type != 0x1d) {
+                space(which).ackPending = true;
+            }
+            if (type == 0x00 || type == 0x01) {
+                continue;
+            }
+            if (type == 0x02 || type == 0x03) {
+                reader.varint();
+                reader.varint();
+                const auto ranges = reader.varint();
+                reader.varint();
+                for (std::uint64_t i = 0; i < ranges * 2; ++i) {
+                    reader.varint();
+                }
+                if (type == 0x03) {
+                    reader.varint();
+                    reader.varint();
+                    reader.varint();
+                }
+            } else if (type == 0x06) {
+                const auto offset = reader.varint();
+                const auto data = reader.bytes(reader.varint());
+                auto& state = space(which);
+                if (reader.ok() && offset <= state.cryptoReceived && offset + data.size() > state.cryptoReceived) {
+                    tls->provide(which, data.subspan(static_cast<std::size_t>(state.cryptoReceived - offset)));
+                    state.cryptoReceived = offset + data.size();
+                    driveTls();
+                }
+            } else if (type >= 0x08 && type <= 0x0f) {
+                const auto id = reader.varint();
+                const auto offset = (type & 0x04) ? reader.varint() : 0;
+                const auto data = (type & 0x02) ? reader.bytes(reader.varint()) : reader.rest();
+                if (reader.ok() && id == 0) {
+                    onRequest(offset, data);
+                }
+            } else if (type == 0x18) {
+                reader.varint();
+                reader.varint();
+                reader.bytes(reader.byte());
+                reader.bytes(16);
+            } else if (type == 0x19) {
+                reader.varint();
+            } else if (type == 0x1c || type == 0x1d) {
+                reader.varint();
+                if (type == 0x1c) {
+                    reader.varint();
+                }
+                reader.bytes(reader.varint());
+            } else if (type == 0x30 || type == 0x31) {
+                const auto data = type == 0x30 ? reader.rest() : reader.bytes(reader.varint());
+                quic::Reader http(data);
+                http.varint();
+                http.varint();
+                if (reader.ok() && http.ok() && established) {
+                    const auto packet = http.rest();
+                    target.sendTo(targetPort, packet);
+                    ++datagramsRelayed;
+                }
+            } else {
+                return;  // nothing else is expected from this client
+            }
+        }
+    }
+
+    void driveTls() {
+        if (!tls->advance()) {
+            return;
+        }
+        for (auto which : {Space::Handshake, Space::Application}) {
+            auto& state = space(which);
+            if (!state.writeKeys) {
+                if (auto secret = tls->secret(which, true)) {
+                    state.writeKeys = std::make_unique<quic::PacketKeys>(*secret);
+                }
+            }
+            if (!state.readKeys) {
+                if (auto secret = tls->secret(which, false)) {
+                    state.readKeys = std::make_unique<quic::PacketKeys>(*secret);
+                }
+            }
+        }
+        for (auto which : {Space::Initial, Space::Handshake, Space::Application}) {
+            const auto data = tls->takeOutput(which);
+            if (data.empty()) {
+                continue;
+            }
+            auto& state = space(which);
+            Bytes frame{0x06};
+            quic::appendVarint(frame, state.cryptoSent);
+            quic::appendVarint(frame, data.size());
+            quic::appendBytes(frame, data);
+            state.cryptoSent += data.size();
+            outgoing[static_cast<std::size_t>(which)].push_back(std::move(frame));
+        }
+
+        if (!handshakeComplete && tls->complete()) {
+            handshakeComplete = true;
+            auto& application = outgoing[static_cast<std::size_t>(Space::Application)];
+            application.push_back({0x1e});  // HANDSHAKE_DONE
+
+            // Control stream 3: stream type 0, then SETTINGS
+            Bytes settings;
+            if (behaviour.datagramSetting) {
+                quic::appendVarint(settings, 0x33);  // SETTINGS_H3_DATAGRAM
+                quic::appendVarint(settings, 1);
+            }
+            quic::appendVarint(settings, 0x08);  // SETTINGS_ENABLE_CONNECT_PROTOCOL
+            quic::appendVarint(settings, 1);
+            Bytes control{0x00, 0x04};
+            quic::appendVarint(control, settings.size());
+            quic::appendBytes(control, settings);
+            application.push_back(streamFrame(3, 0, control));
+        }
+    }
+
+    void onRequest(std::uint64_t offset, std::span<const std::uint8_t> data) {
+        if (offset != request.size()) {
+            return;  // a retransmission of what is already here
+        }
+        request.insert(request.end(), data.begin(), data.end());
+        quic::Reader reader(request);
+        const auto type = reader.varint();
+        const auto headers = reader.bytes(reader.varint());
+        if (!reader.ok() || type != 0x01 || responded) {
+            return;
+        }
+        // The path is a literal after the :path name reference; find it by its prefix
+        const std::string_view text(reinterpret_cast<const char*>(headers.data()), headers.size());
+        if (const auto at = text.find("/.well-known/masque/udp/"); at != std::string_view::npos) {
+            const auto end = text.find('/', text.find('/', text.find('/', at + 24) + 1));
+            std::lock_guard<std::mutex> lock(mutex);
+            path = std::string(text.substr(at, end == std::string_view::npos ? end : end + 1 - at));
+        }
+
+        // :status from the QPACK static table: index 25 is 200, 68 is 403
+        Bytes fields{0x00, 0x00};
+        if (behaviour.status == 200) {
+            fields.push_back(0xc0 | 25);
+        } else {
+            fields.insert(fields.end(), {0xff, 68 - 63});
+        }
+        Bytes response{0x01};
+        quic::appendVarint(response, fields.size());
+        quic::appendBytes(response, fields);
+        outgoing[static_cast<std::size_t>(Space::Application)].push_back(streamFrame(0, 0, response));
+        responded = true;
+        established = behaviour.status == 200;
+    }
+
+    static Bytes streamFrame(std::uint64_t id, std::uint64_t offset, std::span<const std::uint8_t> data) {
+        Bytes frame{0x0e};  // STREAM with OFF and LEN
+        quic::appendVarint(frame, id);
+        quic::appendVarint(frame, offset);
+        quic::appendVarint(frame, data.size());
+        quic::appendBytes(frame, data);
+        return frame;
+    }
+
+    void flush() {
+        for (auto which : {Space::Initial, Space::Handshake, Space::Application}) {
+            auto& state = space(which);
+            auto& frames = outgoing[static_cast<std::size_t>(which)];
+            if (!state.writeKeys || (frames.empty() && !state.ackPending)) {
+                continue;
+            }
+            Bytes payload;
+            if (state.ackPending && state.largest) {
+                payload.push_back(0x02);
+                quic::appendVarint(payload, *state.largest);
+                quic::appendVarint(payload, 0);
+                quic::appendVarint(payload, 0);
+                quic::appendVarint(payload, *state.largest - state.runStart);
+                state.ackPending = false;
+            }
+            for (const auto& frame : frames) {
+                quic::appendBytes(payload, frame);
+            }
+            frames.clear();
+            if (!payload.empty()) {
+                send(which, payload);
+            }
+        }
+    }
+
+    void send(Space which, const Bytes& payload) {
+        auto& state = space(which);
+        const std::uint64_t number = state.nextNumber++;
+        Bytes packet;
+        if (which == Space::Application) {
+            packet.push_back(0x43);
+            quic::appendBytes(packet, clientId);
+        } else {
+            const auto type = which == Space::Initial ? quic::PacketType::Initial : quic::PacketType::Handshake;
+            packet.push_back(static_cast<std::uint8_t>(0xc3 | (static_cast<std::uint8_t>(type) << 4)));
+            packet.insert(packet.end(), {0, 0, 0, 1});
+            packet.push_back(static_cast<std::uint8_t>(clientId.size()));
+            quic::appendBytes(packet, clientId);
+            packet.push_back(static_cast<std::uint8_t>(serverId.size()));
+            quic::appendBytes(packet, serverId);
+            if (which == Space::Initial) {
+                packet.push_back(0);  // no token
+            }
+            packet.resize(packet.size() + 2);
+            quic::writeVarint(&packet[packet.size() - 2], quic::packetNumberSize + payload.size() + quic::tagSize, 2);
+        }
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            packet.push_back(static_cast<std::uint8_t>(number >> shift));
+        }
+        const std::size_t headerLength = packet.size();
+        quic::appendBytes(packet, payload);
+        packet.resize(packet.size() + quic::tagSize);
+        state.writeKeys->protect(packet.data(), headerLength, payload.size(), number);
+        socket.sendTo(clientPort, packet);
+    }
+
+    ProxyBehaviour behaviour;
+    std::uint16_t targetPort;
+    testSupport::LoopbackUdp socket;
+    testSupport::LoopbackUdp target;  // the proxy's side of the relay
+    std::uint16_t clientPort = 0;
+
+    SSL_CTX* context = nullptr;
+    std::unique_ptr<QuicTls> tls;
+    Bytes serverId;
+    Bytes clientId;
+    std::array<SpaceState, quic::spaceCount> spaces;
+    std::array<std::vector<Bytes>, quic::spaceCount> outgoing;
+    std::atomic<bool> handshakeComplete{false};
+    Bytes request;
+    bool responded = false;
+    bool established = false;
+    std::atomic<std::size_t> datagramsRelayed{0};
+
+    mutable std::mutex mutex;
+    std::string path;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+// The VPN server behind the proxy: echoes whatever arrives
+class EchoServer {
+public:
+    EchoServer() : thread([this]() {
+        while (!stopping) {
+            if (auto datagram = socket.receive(5ms)) {
+                socket.reply(*datagram);
+            }
+        }
+    }) {}
+
+    ~EchoServer() {
+        stopping = true;
+        thread.join();
+    }
+
+    std::uint16_t port() const { return socket.port(); }
+
+private:
+    testSupport::LoopbackUdp socket;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+QuicTunnel::Settings settingsFor(const StandInProxy& proxy, const EchoServer& echo, const std::string& caPem) {
+    QuicTunnel::Settings settings;
+    settings.proxyHost = "127.0.0.1";
+    settings.proxyPort = std::to_string(proxy.port());
+    settings.targetHost = "127.0.0.1";
+    settings.targetPort = std::to_string(echo.port());
+    settings.caPem = caPem;
+    settings.handshakeTimeout = 5s;
+    return settings;
+}
+
+void tunnelThroughStandInProxy() {
+    TestCertificate certificate;
+    EchoServer echo;
+    StandInProxy proxy(certificate, echo.port());
+
+    QuicTunnel tunnel;
+    const bool opened = tunnel.open("127.0.0.1", std::to_string(proxy.port()), AF_INET,
+                                    settingsFor(proxy, echo, certificate.pem));
+    CHECK(opened);
+    if (!opened) {
+        std::cerr << tunnel.getLastError() << std::endl;
+        return;
+    }
+    CHECK(proxy.handshakeDone());
+    CHECK(proxy.requestPath() == "/.well-known/masque/udp/127.0.0.1/" + std::to_string(echo.port()) + "/");
+
+    // Both send paths: the copying one and the in-place one with headroom and tailroom
+    std::size_t echoed = 0;
+    for (std::size_t i = 0; i < 64; ++i) {
+        Bytes packet(100 + i * 20);
+        for (std::size_t j = 0; j < packet.size(); ++j) {
+            packet[j] = static_cast<std::uint8_t>(i ^ j);
+        }
+        bool sent = false;
+        if (i % 2 == 0) {
+            sent = tunnel.send(packet);
+        } else {
+            Bytes buffer(QuicTunnel::headroom + packet.size() + QuicTunnel::tailroom);
+            std::copy(packet.begin(), packet.end(), buffer.begin() + QuicTunnel::headroom);
+            sent = tunnel.sendInPlace(buffer, QuicTunnel::headroom, packet.size());
+        }
+        CHECK(sent);
+        const auto reply = tunnel.receive(2s);
+        echoed += reply && *reply == packet ? 1 : 0;
+    }
+    CHECK(echoed == 64);
+
+    const auto stats = tunnel.stats();
+    CHECK(stats.datagramsSent == 64);
+    CHECK(stats.datagramsReceived == 64);
+    CHECK(stats.datagramsDropped == 0);
+    CHECK(stats.smoothedRtt > 0us);
+    CHECK(proxy.relayed() == 64);
+
+    tunnel.close();
+    CHECK(!tunnel.isOpen());
+}
+
+void untrustedProxyIsRefused() {
+    TestCertificate certificate;
+    TestCertificate other;
+    EchoServer echo;
+    StandInProxy proxy(certificate, echo.port());
+
+    QuicTunnel tunnel;
+    CHECK(!tunnel.open("127.0.0.1", std::to_string(proxy.port()), AF_INET, settingsFor(proxy, echo, other.pem)));
+    CHECK(tunnel.getLastError().find("TLS handshake failed") != std::string::npos);
+}
+
+void proxyWithoutDatagramsIsRefused() {
+    TestCertificate certificate;
+    EchoServer echo;
+    StandInProxy proxy(certificate, echo.port(), {.datagramSetting = false});
+
+    QuicTunnel tunnel;
+    CHECK(!tunnel.open("127.0.0.1", std::to_string(proxy.port()), AF_INET, settingsFor(proxy, echo, certificate.pem)));
+    CHECK(tunnel.getLastError().find("HTTP datagrams") != std::string::npos);
+}
+
+void refusedConnectUdp() {
+    TestCertificate certificate;
+    EchoServer echo;
+    StandInProxy proxy(certificate, echo.port(), {.status = 403});
+
+    QuicTunnel tunnel;
+    CHECK(!tunnel.open("127.0.0.1", std::to_string(proxy.port()), AF_INET, settingsFor(proxy, echo, certificate.pem)));
+    CHECK(tunnel.getLastError().find("status 403") != std::string::npos);
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"tunnelThroughStandInProxy", tunnelThroughStandInProxy},
+        {"untrustedProxyIsRefused", untrustedProxyIsRefused},
+        {"proxyWithoutDatagramsIsRefused", proxyWithoutDatagramsIsRefused},
+        {"refusedConnectUdp", refusedConnectUdp},
+    });
+}
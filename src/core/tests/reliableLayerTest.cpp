@@ -0,0 +1,255 @@
+import std;
+#include "controlChannel.h"
+#include "networkImpairment.h"
+#include "reliableLayer.h"
+#include "testSupport.h"
+
+// The reliability layer over a lossy, reordering link: everything queued
+// must arrive once and in order, with the holes filled by retransmissions.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+constexpr std::string_view lossyLink =
+    "seed 52\n"
+    "latency 20ms\n"
+    "jitter 5ms\n"
+    "loss 10%\n"
+    "reorder 5%\n"
+    "reorder-delay 30ms\n"
+    "duplicate 2%\n";
+
+std::vector<std::uint8_t> pattern(std::size_t size, std::uint8_t salt) {
+    std::vector<std::uint8_t> bytes(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<std::uint8_t>(i * 31 + salt + (i >> 8));
+    }
+    return bytes;
+}
+
+// Both windows on a simulated link; ImpairmentEngine decides each packet's fate
+void windowsOverLossyLink() {
+    const auto scenario = ImpairmentScenario::parse(lossyLink);
+    const auto start = Clock::time_point{} + 1h;
+    ImpairmentEngine forward(scenario, 1, start);
+    ImpairmentEngine backward(scenario, 2, start);
+
+    struct Packet {
+        bool toReceiver = true;
+        std::uint32_t packetId = 0;
+        std::vector<std::uint8_t> payload;
+        std::vector<std::uint32_t> acks;
+    };
+    std::multimap<Clock::time_point, Packet> link;
+
+    ReliableSendWindow sender(8);
+    ReliableReceiveWindow receiver(8);
+
+    constexpr std::size_t messages = 300;
+    std::vector<std::uint8_t> sent;
+    for (std::size_t i = 0; i < messages; ++i) {
+        auto payload = pattern(100 + i % 50, static_cast<std::uint8_t>(i));
+        sent.insert(sent.end(), payload.begin(), payload.end());
+        sender.enqueue(4, std::move(payload));
+    }
+
+    std::vector<std::uint8_t> received;
+    auto now = start;
+    const auto deadline = start + 120s;
+    while (now < deadline && (sender.hasUnacknowledged() || received.size() < sent.size())) {
+        sender.transmitDue(now, [&](const ReliableSendWindow::Entry& entry) {
+            for (auto due : forward.schedule(entry.payload.size(), now)) {
+                link.emplace(due, Packet{true, entry.packetId, entry.payload, {}});
+            }
+        });
+
+        while (!link.empty() && link.begin()->first <= now) {
+            auto packet = std::move(link.begin()->second);
+            link.erase(link.begin());
+
+            if (packet.toReceiver) {
+                if (receiver.accept(packet.packetId, packet.payload)) {
+                    receiver.deliver(received);
+                }
+                auto acks = receiver.takeAcks(8);
+                for (auto due : backward.schedule(acks.size() * 4, now)) {
+                    link.emplace(due, Packet{false, 0, {}, acks});
+                }
+            } else {
+                sender.acknowledge(packet.acks, now);
+            }
+        }
+        now += 1ms;
+    }
+
+    CHECK(received == sent);
+    CHECK(!sender.hasUnacknowledged());
+    CHECK(forward.stats().dropped > 0);
+    CHECK(sender.retransmissionCount() >= forward.stats().dropped);
+    CHECK(sender.rtt().hasSample());
+    CHECK(sender.rtt().smoothedRtt() >= 30ms && sender.rtt().smoothedRtt() <= 100ms);
+}
+
+// Server half of the control channel, built on the same windows: answers the
+// client reset with its own and echoes every control byte back
+class StandInServer {
+public:
+    static constexpr std::uint64_t session = 0x5356'5356'0000'0052;
+
+    explicit StandInServer(testSupport::LoopbackUdp& socket) : socket(socket) {}
+
+    void process(std::span<const std::uint8_t> packet) {
+        if (packet.size() < 10) {
+            return;
+        }
+        const auto opcode = static_cast<ControlChannel::Opcode>(packet[0] >> 3);
+        const auto peerSession = testSupport::readU64(packet, 1);
+        const std::size_t ackCount = packet[9];
+        std::size_t offset = 10;
+        if (packet.size() < offset + ackCount * 4 + (ackCount > 0 ? 8 : 0)) {
+            return;
+        }
+
+        std::vector<std::uint32_t> acks;
+        for (std::size_t i = 0; i < ackCount; ++i, offset += 4) {
+            acks.push_back(testSupport::readU32(packet, offset));
+        }
+        if (ackCount > 0) {
+            if (testSupport::readU64(packet, offset) != session) {
+                return;
+            }
+            offset += 8;
+        }
+
+        if (opcode == ControlChannel::Opcode::HardResetClientV2 && !clientSession) {
+            clientSession = peerSession;
+            sendWindow.enqueue(static_cast<std::uint8_t>(ControlChannel::Opcode::HardResetServerV2), {});
+        }
+        if (!clientSession || peerSession != *clientSession) {
+            return;
+        }
+
+        sendWindow.acknowledge(acks, Clock::now());
+        if (opcode == ControlChannel::Opcode::AckV1 || packet.size() < offset + 4) {
+            return;
+        }
+
+        const auto packetId = testSupport::readU32(packet, offset);
+        if (receiveWindow.accept(packetId, packet.subspan(offset + 4))) {
+            std::vector<std::uint8_t> delivered;
+            receiveWindow.deliver(delivered);
+            // The client's reset is packet 0 and carries no bytes, so this is pure echo
+            for (std::size_t chunk = 0; chunk < delivered.size(); chunk += ControlChannel::maxPayloadSize) {
+                const auto end = std::min(delivered.size(), chunk + ControlChannel::maxPayloadSize);
+                sendWindow.enqueue(static_cast<std::uint8_t>(ControlChannel::Opcode::ControlV1),
+                                   {delivered.begin() + chunk, delivered.begin() + end});
+            }
+        }
+    }
+
+    void service(Clock::time_point now) {
+        sendWindow.transmitDue(now, [this](const ReliableSendWindow::Entry& entry) {
+            send(static_cast<ControlChannel::Opcode>(entry.opcode), entry.packetId, entry.payload);
+        });
+        while (receiveWindow.hasPendingAcks()) {
+            send(ControlChannel::Opcode::AckV1, std::nullopt, {});
+        }
+    }
+
+private:
+    void send(ControlChannel::Opcode opcode, std::optional<std::uint32_t> packetId,
+              std::span<const std::uint8_t> payload) {
+        const auto acks = receiveWindow.takeAcks(ControlChannel::maxAcksPerPacket);
+        std::vector<std::uint8_t> wire;
+        wire.push_back(static_cast<std::uint8_t>(static_cast<std::uint8_t>(opcode) << 3));
+        testSupport::appendU64(wire, session);
+        wire.push_back(static_cast<std::uint8_t>(acks.size()));
+        for (auto ack : acks) {
+            testSupport::appendU32(wire, ack);
+        }
+        if (!acks.empty()) {
+            testSupport::appendU64(wire, *clientSession);
+        }
+        if (packetId) {
+            testSupport::appendU32(wire, *packetId);
+        }
+        wire.insert(wire.end(), payload.begin(), payload.end());
+        socket.reply(wire);
+    }
+
+    testSupport::LoopbackUdp& socket;
+    std::optional<std::uint64_t> clientSession;
+    ReliableSendWindow sendWindow{ControlChannel::sendWindowSize};
+    ReliableReceiveWindow receiveWindow{ControlChannel::receiveWindowSize};
+};
+
+// The real client channel against the stand-in server over UDP loopback,
+// with the impairment proxy dropping 10% of the datagrams each way
+void controlChannelThroughImpairmentProxy() {
+    testSupport::LoopbackUdp serverSocket;
+    testSupport::LoopbackUdp clientSocket;
+
+    ImpairmentProxy proxy(ImpairmentScenario::parse(lossyLink));
+    const auto proxyPort = proxy.start("127.0.0.1", std::to_string(serverSocket.port()), VpnTransport::Protocol::Udp);
+    CHECK(proxyPort.has_value());
+    if (!proxyPort) {
+        std::cerr << proxy.getLastError() << std::endl;
+        return;
+    }
+
+    std::atomic<bool> stopServer{false};
+    std::thread server([&]() {
+        StandInServer standIn(serverSocket);
+        while (!stopServer) {
+            if (auto packet = serverSocket.receive(5ms)) {
+                standIn.process(*packet);
+            }
+            standIn.service(Clock::now());
+        }
+    });
+
+    ControlChannel channel([&](std::span<const std::uint8_t> wire) {
+        return clientSocket.sendTo(*proxyPort, wire);
+    });
+
+    const auto message = pattern(24 * 1024, 0x52);
+    std::vector<std::uint8_t> echoed;
+    bool queued = false;
+
+    channel.startHardReset();
+    const auto deadline = Clock::now() + 60s;
+    while (Clock::now() < deadline && echoed.size() < message.size()) {
+        if (auto packet = clientSocket.receive(5ms)) {
+            channel.processIncoming(*packet);
+        }
+        if (channel.isEstablished() && !queued) {
+            channel.queueMessage(message);
+            queued = true;
+        }
+        channel.service(Clock::now());
+        const auto received = channel.takeReceived();
+        echoed.insert(echoed.end(), received.begin(), received.end());
+    }
+
+    stopServer = true;
+    server.join();
+    const auto stats = proxy.stats();
+    proxy.stop();
+
+    CHECK(channel.isEstablished());
+    CHECK(channel.remoteSessionId() == StandInServer::session);
+    CHECK(echoed == message);
+    CHECK(stats.upstream.dropped + stats.downstream.dropped > 0);
+    CHECK(channel.retransmissionCount() > 0 || stats.upstream.dropped == 0);
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"windowsOverLossyLink", windowsOverLossyLink},
+        {"controlChannelThroughImpairmentProxy", controlChannelThroughImpairmentProxy},
+    });
+}
@@ -0,0 +1,272 @@
+import std;
+#include "controlChannel.h"
+#include "serverProber.h"
+#include "testSupport.h"
+
+// ServerProber against stand-in servers on loopback: each answers the
+// client reset after an injected delay (or not at all), so the ranking
+// must follow the delays and the losses.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+// Answers P_CONTROL_HARD_RESET_CLIENT_V2 with the server reset after delay.
+// answer decides per probe (0, 1, 2, ...) whether to reply at all. With a
+// tls-auth key it ignores bare resets, as such servers do, and wraps its
+// reply; without a key-direction both ends use the same half of the key.
+class StandInServer {
+public:
+    StandInServer(std::chrono::milliseconds delay, std::function<bool(std::size_t)> answer = {},
+                  std::optional<ControlWrap::Key> wrapKey = {})
+        : delay(delay)
+        , answer(std::move(answer))
+        , wrap(wrapKey ? std::make_unique<ControlWrap>(*wrapKey) : nullptr)
+        , thread([this]() { run(); }) {
+    }
+
+    ~StandInServer() {
+        stopping = true;
+        thread.join();
+    }
+
+    std::uint16_t port() const { return socket.port(); }
+    std::size_t probesSeen() const { return seen; }
+
+private:
+    void run() {
+        std::vector<std::tuple<Clock::time_point, std::uint16_t, std::vector<std::uint8_t>>> scheduled;
+        while (!stopping) {
+            if (auto packet = socket.receive(1ms)) {
+                const bool reset = packet->size() >= bareResetSize &&
+                    static_cast<ControlChannel::Opcode>((*packet)[0] >> 3) == ControlChannel::Opcode::HardResetClientV2;
+                const bool wrapped = packet->size() > bareResetSize;
+                if (reset && wrapped == (wrap != nullptr) && (!answer || answer(seen))) {
+                    auto reply = serverReset(testSupport::readU64(*packet, 1));
+                    if (wrap) {
+                        std::vector<std::uint8_t> wire;
+                        wrap->wrap(reply, wire);
+                        reply = std::move(wire);
+                    }
+                    scheduled.emplace_back(Clock::now() + delay, socket.senderPort(), std::move(reply));
+                }
+                seen += reset ? 1 : 0;
+            }
+            const auto now = Clock::now();
+            std::erase_if(scheduled, [&](const auto& reply) {
+                if (std::get<0>(reply) > now) {
+                    return false;
+                }
+                socket.sendTo(std::get<1>(reply), std::get<2>(reply));
+                return true;
+            });
+        }
+    }
+
+    static std::vector<std::uint8_t> serverReset(std::uint64_t clientSession) {
+        std::vector<std::uint8_t> wire;
+        wire.push_back(static_cast<std::uint8_t>(ControlChannel::Opcode::HardResetServerV2) << 3);
+        testSupport::appendU64(wire, 0x5356'5356'0000'0060);
+        wire.push_back(1);
+        testSupport::appendU32(wire, 0);  // acknowledges the client reset
+        testSupport::appendU64(wire, clientSession);
+        testSupport::appendU32(wire, 0);
+        return wire;
+    }
+
+    static constexpr std::size_t bareResetSize = 14;  // opcode, session id, empty ack array, packet id
+
+    testSupport::LoopbackUdp socket;
+    std::chrono::milliseconds delay;
+    std::function<bool(std::size_t)> answer;
+    std::unique_ptr<ControlWrap> wrap;
+    std::atomic<bool> stopping{false};
+    std::atomic<std::size_t> seen{0};
+    std::thread thread;
+};
+
+ServerProber::Target udpTarget(std::string name, std::uint16_t port) {
+    return {std::move(name), {"127.0.0.1", std::to_string(port), "udp"}, std::nullopt};
+}
+
+ControlWrap::Key tlsAuthKey() {
+    ControlWrap::Key key;
+    key.mode = ControlWrap::Mode::TlsAuth;
+    for (std::size_t i = 0; i < ControlWrap::staticKeySize; ++i) {
+        key.staticKey.push_back(static_cast<std::uint8_t>(i * 7 + 3));
+    }
+    return key;
+}
+
+std::vector<std::string> order(const std::vector<ServerProber::Score>& scores) {
+    std::vector<std::string> names;
+    for (const auto& score : scores) {
+        names.push_back(score.profileName);
+    }
+    return names;
+}
+
+ServerProber::Settings fastSettings() {
+    ServerProber::Settings settings;
+    settings.timeout = 400ms;
+    settings.probeSpacing = 20ms;
+    return settings;
+}
+
+void rankingFollowsDelay() {
+    StandInServer slow(60ms);
+    StandInServer fast(5ms);
+    StandInServer medium(30ms);
+    StandInServer silent(0ms, [](std::size_t) { return false; });
+
+    // A port nobody listens on: ICMP port unreachable ends those probes early
+    std::uint16_t closedPort = 0;
+    {
+        testSupport::LoopbackUdp released;
+        closedPort = released.port();
+    }
+
+    ServerProber prober(fastSettings());
+    const std::vector<ServerProber::Target> targets{
+        udpTarget("slow", slow.port()),
+        udpTarget("silent", silent.port()),
+        udpTarget("fast", fast.port()),
+        udpTarget("closed", closedPort),
+        udpTarget("medium", medium.port()),
+    };
+
+    const auto started = Clock::now();
+    const auto scores = prober.probe(targets);
+    const auto took = Clock::now() - started;
+
+    CHECK(scores.size() == targets.size());
+    if (scores.size() != targets.size()) {
+        return;
+    }
+    const auto names = order(scores);
+    CHECK((std::vector<std::string>(names.begin(), names.begin() + 3) == std::vector<std::string>{"fast", "medium", "slow"}));
+    CHECK(!scores[3].reachable && !scores[4].reachable);
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        CHECK(scores[i].reachable);
+        CHECK(scores[i].sent == 3 && scores[i].received == 3);
+        CHECK(scores[i].loss == 0.0);
+    }
+    CHECK(scores[0].rtt >= 5ms && scores[1].rtt >= 30ms && scores[2].rtt >= 60ms);
+    CHECK(silent.probesSeen() == 3);
+    // Probes run in parallel: a few timeouts, not one per probe
+    CHECK(took < 2s);
+}
+
+// A low-RTT server that loses most probes ranks behind a slower clean one
+void lossOutweighsLatency() {
+    StandInServer lossy(20ms, [](std::size_t probe) { return probe == 0; });
+    StandInServer clean(30ms);
+
+    ServerProber prober(fastSettings());
+    const auto scores = prober.probe({udpTarget("lossy", lossy.port()), udpTarget("clean", clean.port())});
+
+    CHECK((order(scores) == std::vector<std::string>{"clean", "lossy"}));
+    CHECK(scores.size() == 2 && scores[1].reachable && scores[1].received == 1 && scores[1].loss > 0.4);
+}
+
+// Results younger than minReprobeInterval are reused without sending
+void freshResultsAreReused() {
+    StandInServer server(5ms);
+    ServerProber prober(fastSettings());
+    const std::vector<ServerProber::Target> targets{udpTarget("server", server.port()),
+                                                    udpTarget("same server", server.port())};
+
+    prober.probe(targets);
+    // Profiles sharing a remote share its probes
+    CHECK(server.probesSeen() == 3);
+
+    const auto again = prober.probe(targets);
+    CHECK(server.probesSeen() == 3);
+    CHECK(again.size() == 2 && again[0].reachable && again[0].rtt == again[1].rtt);
+
+    prober.clear();
+    prober.probe(targets);
+    CHECK(server.probesSeen() == 6);
+}
+
+// TCP remotes are timed by the connect handshake
+void tcpConnectProbes() {
+    const auto listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(local);
+    CHECK(::bind(listener, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) == 0);
+    CHECK(::listen(listener, 16) == 0);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&local), &length);
+
+    std::uint16_t closedPort = 0;
+    {
+        const auto released = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in bound = local;
+        bound.sin_port = 0;
+        ::bind(released, reinterpret_cast<const sockaddr*>(&bound), sizeof(bound));
+        ::getsockname(released, reinterpret_cast<sockaddr*>(&bound), &length);
+        closedPort = ntohs(bound.sin_port);
+        socketUtil::closeSocket(released);
+    }
+
+    ServerProber prober(fastSettings());
+    const auto scores = prober.probe({
+        {"refused", {"127.0.0.1", std::to_string(closedPort), "tcp"}},
+        {"listening", {"127.0.0.1", std::to_string(ntohs(local.sin_port)), "tcp"}},
+    });
+    socketUtil::closeSocket(listener);
+
+    CHECK((order(scores) == std::vector<std::string>{"listening", "refused"}));
+    CHECK(scores.size() == 2 && scores[0].reachable && scores[0].received == 3 && !scores[1].reachable);
+}
+
+// tls-auth servers only answer resets carrying the profile's HMAC
+void wrappedResetsReachTlsAuthServers() {
+    StandInServer server(5ms, {}, tlsAuthKey());
+    ServerProber prober(fastSettings());
+
+    auto bare = udpTarget("bare", server.port());
+    auto wrapped = udpTarget("wrapped", server.port());
+    wrapped.wrapKey = tlsAuthKey();
+    const auto unanswered = prober.probe({bare});
+    CHECK(unanswered.size() == 1 && !unanswered[0].reachable);
+
+    prober.clear();
+    const auto scores = prober.probe({wrapped});
+    CHECK(scores.size() == 1 && scores[0].reachable && scores[0].received == 3);
+}
+
+void stopCancelsTheRun() {
+    StandInServer silent(0ms, [](std::size_t) { return false; });
+    auto settings = fastSettings();
+    settings.timeout = 10s;
+
+    ServerProber prober(settings);
+    std::atomic<bool> stop{false};
+    std::thread canceller([&]() {
+        std::this_thread::sleep_for(100ms);
+        stop = true;
+    });
+    const auto started = Clock::now();
+    prober.probe({udpTarget("silent", silent.port())}, &stop);
+    canceller.join();
+
+    CHECK(Clock::now() - started < 2s);
+}
+
+} // namespace
+
+int main() {
+    return testSupport::run({
+        {"rankingFollowsDelay", rankingFollowsDelay},
+        {"lossOutweighsLatency", lossOutweighsLatency},
+        {"freshResultsAreReused", freshResultsAreReused},
+        {"tcpConnectProbes", tcpConnectProbes},
+        {"wrappedResetsReachTlsAuthServers", wrappedResetsReachTlsAuthServers},
+        {"stopCancelsTheRun", stopCancelsTheRun},
+    });
+}
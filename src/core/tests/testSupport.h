@@ -0,0 +1,142 @@
+#pragma once
+import std;
+#include "socketUtil.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+// Just enough harness for the engine tests: each test is its own executable
+// and CTest reads the exit code, so there is no framework to depend on.
+namespace testSupport {
+
+// Exit code CTest reports as skipped (SKIP_RETURN_CODE)
+inline constexpr int skipped = 77;
+
+inline int failures = 0;
+
+inline void check(bool passed, const char* expression,
+                  std::source_location where = std::source_location::current()) {
+    if (!passed) {
+        ++failures;
+        std::cerr << where.file_name() << ":" << where.line() << ": CHECK(" << expression << ") failed" << std::endl;
+    }
+}
+
+// Runs the named cases in order and returns the process exit code
+inline int run(std::initializer_list<std::pair<const char*, void (*)()>> cases) {
+    socketUtil::ensureInitialized();
+    for (const auto& [name, body] : cases) {
+        const int before = failures;
+        try {
+            body();
+        } catch (const std::exception& e) {
+            ++failures;
+            std::cerr << name << ": unexpected exception: " << e.what() << std::endl;
+        }
+        std::cout << (failures == before ? "[PASS] " : "[FAIL] ") << name << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Big-endian fields for hand-built protocol packets
+inline void appendU32(std::vector<std::uint8_t>& out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<std::uint8_t>(value >> shift));
+    }
+}
+
+inline void appendU64(std::vector<std::uint8_t>& out, std::uint64_t value) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<std::uint8_t>(value >> shift));
+    }
+}
+
+inline std::uint32_t readU32(std::span<const std::uint8_t> data, std::size_t offset) {
+    std::uint32_t value = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+        value = (value << 8) | data[offset + i];
+    }
+    return value;
+}
+
+inline std::uint64_t readU64(std::span<const std::uint8_t> data, std::size_t offset) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+        value = (value << 8) | data[offset + i];
+    }
+    return value;
+}
+
+// UDP socket on 127.0.0.1 with an ephemeral port, for stand-in servers and clients
+class LoopbackUdp {
+public:
+    using Datagram = std::vector<std::uint8_t>;
+
+    LoopbackUdp() {
+        handle = ::socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (handle == socketUtil::invalidSocket ||
+            ::bind(handle, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+            throw std::runtime_error("Cannot bind loopback UDP socket: " + socketUtil::lastErrorText());
+        }
+        socklen_t length = sizeof(local);
+        ::getsockname(handle, reinterpret_cast<sockaddr*>(&local), &length);
+        localPort = ntohs(local.sin_port);
+    }
+
+    ~LoopbackUdp() {
+        socketUtil::closeSocket(handle);
+    }
+
+    LoopbackUdp(const LoopbackUdp&) = delete;
+    LoopbackUdp& operator=(const LoopbackUdp&) = delete;
+
+    std::uint16_t port() const { return localPort; }
+    // Source port of the last datagram received
+    std::uint16_t senderPort() const { return lastSender; }
+    socketUtil::SocketHandle socket() const { return handle; }
+
+    bool sendTo(std::uint16_t port, std::span<const std::uint8_t> data) {
+        sockaddr_in peer{};
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        peer.sin_port = htons(port);
+        return ::sendto(handle, reinterpret_cast<const char*>(data.data()), static_cast<int>(data.size()), 0,
+                        reinterpret_cast<const sockaddr*>(&peer), sizeof(peer)) == static_cast<int>(data.size());
+    }
+
+    // Answers whoever sent the last datagram
+    bool reply(std::span<const std::uint8_t> data) {
+        return sendTo(lastSender, data);
+    }
+
+    std::optional<Datagram> receive(std::chrono::milliseconds timeout) {
+        if (!socketUtil::waitReadable(handle, timeout)) {
+            return std::nullopt;
+        }
+        Datagram buffer(65535);
+        sockaddr_in from{};
+        socklen_t length = sizeof(from);
+        const auto received = ::recvfrom(handle, reinterpret_cast<char*>(buffer.data()),
+                                         static_cast<int>(buffer.size()), 0,
+                                         reinterpret_cast<sockaddr*>(&from), &length);
+        if (received < 0) {
+            return std::nullopt;
+        }
+        lastSender = ntohs(from.sin_port);
+        buffer.resize(static_cast<std::size_t>(received));
+        return buffer;
+    }
+
+private:
+    socketUtil::SocketHandle handle = socketUtil::invalidSocket;
+    std::uint16_t localPort = 0;
+    std::uint16_t lastSender = 0;
+};
+
+} // namespace testSupport
+
+#define CHECK(condition) testSupport::check(static_cast<bool>(condition), #condition)
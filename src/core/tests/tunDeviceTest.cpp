@@ -0,0 +1,243 @@
+import std;
+#include "processUtil.h"
+#include "testSupport.h"
+#include "tunDevice.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+// TunDevice in a private network namespace: addresses and routes as ip
+// reports them, packets the system routes to the device come out of read(),
+// and packets written to it reach local sockets. A veth "uplink" with a
+// default route stands in for the real network, so taking over the default
+// route can be checked to leave the server on it. Needs root, network
+// namespaces and /dev/net/tun; reported as skipped otherwise.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+const std::string uplink = "uplink0";
+const std::string serverAddress = "198.51.100.7";
+
+std::string ip(std::vector<std::string> arguments) {
+    arguments.insert(arguments.begin(), "ip");
+    std::string output;
+    std::string error;
+    if (!processUtil::run(arguments, {}, output, error)) {
+        std::cerr << error << std::endl;
+    }
+    return output;
+}
+
+// Device "ip -o route get" picks for address
+std::string routeDevice(const std::string& address) {
+    std::istringstream words{ip({"-o", "route", "get", address})};
+    std::string word;
+    while (words >> word) {
+        if (word == "dev" && words >> word) {
+            return word;
+        }
+    }
+    return {};
+}
+
+sockaddr_storage server() {
+    sockaddr_storage address{};
+    auto* v4 = reinterpret_cast<sockaddr_in*>(&address);
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(1194);
+    ::inet_pton(AF_INET, serverAddress.c_str(), &v4->sin_addr);
+    return address;
+}
+
+// IPv4 header checksum over the 20 bytes at packet
+std::uint16_t headerChecksum(std::span<const std::uint8_t> header) {
+    std::uint32_t sum = 0;
+    for (std::size_t i = 0; i < header.size(); i += 2) {
+        sum += static_cast<std::uint32_t>(header[i] << 8 | header[i + 1]);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<std::uint16_t>(~sum);
+}
+
+// IPv4/UDP packet without a UDP checksum (allowed over IPv4)
+std::vector<std::uint8_t> udpPacket(std::array<std::uint8_t, 4> source, std::array<std::uint8_t, 4> destination,
+                                    std::uint16_t port, std::string_view payload) {
+    const std::size_t total = 20 + 8 + payload.size();
+    std::vector<std::uint8_t> packet{0x45, 0, static_cast<std::uint8_t>(total >> 8), static_cast<std::uint8_t>(total),
+                                     0, 0, 0x40, 0, 64, 17, 0, 0};
+    packet.insert(packet.end(), source.begin(), source.end());
+    packet.insert(packet.end(), destination.begin(), destination.end());
+    const auto checksum = headerChecksum(packet);
+    packet[10] = static_cast<std::uint8_t>(checksum >> 8);
+    packet[11] = static_cast<std::uint8_t>(checksum);
+    const std::size_t udpLength = 8 + payload.size();
+    packet.insert(packet.end(), {0x30, 0x39, static_cast<std::uint8_t>(port >> 8), static_cast<std::uint8_t>(port),
+                                 static_cast<std::uint8_t>(udpLength >> 8), static_cast<std::uint8_t>(udpLength), 0, 0});
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    return packet;
+}
+
+TunDevice::Settings subnetSettings() {
+    TunDevice::Settings settings;
+    settings.addresses = {{"10.91.0.2/24", {}}, {"fd00:91::2/64", {}}};
+    settings.routes = {"10.92.0.0/16", "fd00:92::/48"};
+    settings.mtu = 1400;
+    return settings;
+}
+
+void addressesAndRoutes() {
+    TunDevice tun;
+    CHECK(tun.open("tun"));
+    CHECK(tun.name().starts_with("tun"));
+    CHECK(tun.configure(subnetSettings()));
+    CHECK(socketUtil::interfaceExists(tun.name()));
+    const std::string addresses = ip({"-o", "addr", "show", "dev", tun.name()});
+    CHECK(addresses.find("10.91.0.2/24") != std::string::npos);
+    CHECK(addresses.find("fd00:91::2/64") != std::string::npos);
+    CHECK(ip({"-o", "link", "show", "dev", tun.name()}).find("mtu 1400") != std::string::npos);
+    CHECK(routeDevice("10.92.200.1") == tun.name());
+    CHECK(routeDevice("fd00:92::1") == tun.name());
+    CHECK(routeDevice("10.93.0.1") == uplink);
+
+    // Routes go with the device
+    const std::string name = tun.name();
+    tun.close();
+    CHECK(!socketUtil::interfaceExists(name));
+    CHECK(routeDevice("10.92.200.1") == uplink);
+}
+
+void pointToPointPeer() {
+    TunDevice tun;
+    TunDevice::Settings settings;
+    settings.addresses = {{"10.8.0.6/32", "10.8.0.5"}};
+    CHECK(tun.open("siavpn-test"));
+    CHECK(tun.name() == "siavpn-test");
+    CHECK(tun.configure(settings));
+    CHECK(ip({"-o", "addr", "show", "dev", tun.name()}).find("10.8.0.6 peer 10.8.0.5/32") != std::string::npos);
+    CHECK(routeDevice("10.8.0.5") == tun.name());
+}
+
+void readsWhatIsRoutedToIt() {
+    TunDevice tun;
+    CHECK(tun.open("tun"));
+    std::array<std::uint8_t, 2048> buffer{};
+    CHECK(tun.read(buffer) == std::optional<std::size_t>(0));  // down, so nothing waiting
+    CHECK(tun.configure(subnetSettings()));
+
+    const int sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in destination{};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(5353);
+    ::inet_pton(AF_INET, "10.92.1.1", &destination.sin_addr);
+    const std::string_view payload = "through the tunnel";
+    CHECK(::sendto(sender, payload.data(), payload.size(), 0, reinterpret_cast<const sockaddr*>(&destination),
+                   sizeof(destination)) == static_cast<ssize_t>(payload.size()));
+
+    // IPv6 router solicitations and the like may come first
+    std::optional<std::size_t> length;
+    std::span<const std::uint8_t> packet;
+    for (int attempt = 0; attempt < 50; ++attempt) {
+        length = socketUtil::waitReadable(tun.handle(), 100ms) ? tun.read(buffer) : std::optional<std::size_t>(0);
+        packet = std::span<const std::uint8_t>(buffer.data(), length.value_or(0));
+        if (!packet.empty() && packet[0] >> 4 == 4) {
+            break;
+        }
+    }
+    CHECK(packet.size() == 20 + 8 + payload.size());
+    if (packet.size() == 20 + 8 + payload.size()) {
+        const std::array<std::uint8_t, 4> target{10, 92, 1, 1};
+        CHECK(packet[9] == 17);
+        CHECK(std::ranges::equal(packet.subspan(16, 4), target));
+        CHECK(std::ranges::equal(packet.subspan(28), std::span(reinterpret_cast<const std::uint8_t*>(payload.data()),
+                                                               payload.size())));
+    }
+    CHECK(tun.stats().packetsRead >= 1);
+    ::close(sender);
+}
+
+void writtenPacketsReachSockets() {
+    TunDevice tun;
+    CHECK(tun.open("tun"));
+    CHECK(tun.configure(subnetSettings()));
+    std::ofstream("/proc/sys/net/ipv4/conf/" + tun.name() + "/rp_filter") << "0";
+
+    const int receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(4242);
+    ::inet_pton(AF_INET, "10.91.0.2", &local.sin_addr);
+    CHECK(::bind(receiver, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) == 0);
+
+    const std::string_view payload = "from the server side";
+    CHECK(tun.write(udpPacket({10, 92, 1, 1}, {10, 91, 0, 2}, 4242, payload)));
+    CHECK(socketUtil::waitReadable(receiver, 2s));
+    std::array<char, 256> received{};
+    const auto length = ::recv(receiver, received.data(), received.size(), MSG_DONTWAIT);
+    CHECK(std::string_view(received.data(), static_cast<std::size_t>(std::max<ssize_t>(length, 0))) == payload);
+    CHECK(tun.stats().packetsWritten == 1);
+    ::close(receiver);
+}
+
+void defaultRouteKeepsServerOnUplink() {
+    TunDevice tun;
+    TunDevice::Settings settings = subnetSettings();
+    settings.routes = {"0.0.0.0/0"};
+    settings.server = server();
+    CHECK(tun.open("tun"));
+    CHECK(tun.configure(settings));
+    CHECK(routeDevice("203.0.113.1") == tun.name());
+    CHECK(routeDevice("192.0.2.200") == uplink);  // more specific than a half
+    CHECK(routeDevice(serverAddress) == uplink);
+    CHECK(ip({"-o", "route", "show", serverAddress + "/32"}).find("via 192.0.2.1") != std::string::npos);
+
+    tun.close();
+    CHECK(ip({"-o", "route", "show", serverAddress + "/32"}).empty());
+    CHECK(routeDevice("203.0.113.1") == uplink);
+}
+
+void refusesBadNames() {
+    TunDevice tun;
+    CHECK(!tun.open("tun 0; reboot"));
+    CHECK(!tun.isOpen());
+    CHECK(!tun.getLastError().empty());
+}
+
+} // namespace
+
+int main() {
+    if (::geteuid() != 0) {
+        std::cout << "needs root for network namespaces, skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    if (::access("/dev/net/tun", R_OK | W_OK) != 0) {
+        std::cout << "no /dev/net/tun, skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    if (::unshare(CLONE_NEWNET) != 0) {
+        std::cout << "no network namespaces (" << socketUtil::lastErrorText() << "), skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    std::string error;
+    const bool ready = processUtil::run({"ip", "link", "set", "lo", "up"}, {}, error) &&
+                       processUtil::run({"ip", "link", "add", uplink, "type", "veth", "peer", "name", "uplink1"}, {}, error) &&
+                       processUtil::run({"ip", "addr", "add", "192.0.2.2/24", "dev", uplink}, {}, error) &&
+                       processUtil::run({"ip", "link", "set", "uplink1", "up"}, {}, error) &&
+                       processUtil::run({"ip", "link", "set", uplink, "up"}, {}, error) &&
+                       processUtil::run({"ip", "route", "add", "default", "via", "192.0.2.1", "dev", uplink}, {}, error);
+    if (!ready) {
+        std::cout << "cannot set up the uplink (" << error << "), skipped" << std::endl;
+        return testSupport::skipped;
+    }
+    return testSupport::run({
+        {"addressesAndRoutes", addressesAndRoutes},
+        {"pointToPointPeer", pointToPointPeer},
+        {"readsWhatIsRoutedToIt", readsWhatIsRoutedToIt},
+        {"writtenPacketsReachSockets", writtenPacketsReachSockets},
+        {"defaultRouteKeepsServerOnUplink", defaultRouteKeepsServerOnUplink},
+        {"refusesBadNames", refusesBadNames},
+    });
+}
@@ -0,0 +1,783 @@
+import std;
+#include "tlsHandshake.h"
+#include "dataChannel.h"
+
+#include <openssl/err.h>
+#include <openssl/kdf.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+namespace {
+
+constexpr std::chrono::milliseconds pollInterval{100};
+constexpr std::chrono::milliseconds verifyPollInterval{5};
+constexpr std::chrono::seconds pushRequestInterval{1};
+constexpr std::uint8_t keyMethod2 = 2;
+constexpr std::array<std::uint8_t, 13> pushRequest{'P', 'U', 'S', 'H', '_', 'R', 'E', 'Q', 'U', 'E', 'S', 'T', 0};
+
+std::string opensslError() {
+    std::string text;
+    while (unsigned long code = ERR_get_error()) {
+        std::array<char, 256> buffer{};
+        ERR_error_string_n(code, buffer.data(), buffer.size());
+        if (!text.empty()) {
+            text += "; ";
+        }
+        text += buffer.data();
+    }
+    return text.empty() ? "unknown error" : text;
+}
+
+// TLS 1.0 PRF (MD5 xor SHA-1), which OpenVPN's key-method 2 is built on
+void tls1Prf(std::span<const std::uint8_t> secret, std::string_view label, std::span<const std::uint8_t> seed,
+             std::span<std::uint8_t> out) {
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, nullptr),
+                                                                     EVP_PKEY_CTX_free);
+    std::size_t length = out.size();
+    if (!ctx || EVP_PKEY_derive_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_tls1_prf_md(ctx.get(), EVP_md5_sha1()) <= 0 ||
+        EVP_PKEY_CTX_set1_tls1_prf_secret(ctx.get(), secret.data(), static_cast<int>(secret.size())) <= 0 ||
+        EVP_PKEY_CTX_add1_tls1_prf_seed(ctx.get(), reinterpret_cast<const unsigned char*>(label.data()),
+                                        static_cast<int>(label.size())) <= 0 ||
+        EVP_PKEY_CTX_add1_tls1_prf_seed(ctx.get(), seed.data(), static_cast<int>(seed.size())) <= 0 ||
+        EVP_PKEY_derive(ctx.get(), out.data(), &length) <= 0) {
+        throw std::runtime_error("Key expansion failed: " + opensslError());
+    }
+}
+
+void appendSessionId(SecureBytes& out, std::uint64_t session) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<std::uint8_t>(session >> shift));
+    }
+}
+
+std::string readFileOrEmpty(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return {};
+    }
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+// Inline <tag> block, falling back to the file named by the directive
+std::string profileMaterial(const OvpnProfile& profile, const std::string& name) {
+    if (profile.hasInlineBlock(name)) {
+        return profile.inlineBlock(name);
+    }
+    auto args = profile.directiveArgs(name);
+    if (!args.empty() && args[0] != "[inline]") {
+        return readFileOrEmpty(args[0]);
+    }
+    return {};
+}
+
+// Key material goes straight into the secure arena
+SecureString secretMaterial(const OvpnProfile& profile, const std::string& name) {
+    if (profile.hasInlineBlock(name)) {
+        return profile.secretBlock(name);
+    }
+    auto args = profile.directiveArgs(name);
+    if (!args.empty() && args[0] != "[inline]") {
+        return readSecretFile(args[0]).value_or(SecureString());
+    }
+    return {};
+}
+
+void writeString(SecureBytes& out, std::string_view text) {
+    // OpenVPN strings are length-prefixed and NUL terminated; empty is length 0
+    if (text.empty()) {
+        out.push_back(0);
+        out.push_back(0);
+        return;
+    }
+    const auto length = text.size() + 1;
+    out.push_back(static_cast<std::uint8_t>(length >> 8));
+    out.push_back(static_cast<std::uint8_t>(length & 0xff));
+    out.insert(out.end(), text.begin(), text.end());
+    out.push_back(0);
+}
+
+std::string subjectText(X509* cert) {
+    BIO* bio = BIO_new(BIO_s_mem());
+    if (!bio) {
+        return {};
+    }
+    X509_NAME_print_ex(bio, X509_get_subject_name(cert), 0,
+                       XN_FLAG_SEP_CPLUS_SPC | XN_FLAG_FN_SN | ASN1_STRFLGS_UTF8_CONVERT | ASN1_STRFLGS_ESC_CTRL);
+    char* data = nullptr;
+    long length = BIO_get_mem_data(bio, &data);
+    std::string text(data, static_cast<std::size_t>(std::max(length, 0L)));
+    BIO_free(bio);
+    return text;
+}
+
+std::string commonName(X509* cert) {
+    std::array<char, 256> buffer{};
+    int length = X509_NAME_get_text_by_NID(X509_get_subject_name(cert), NID_commonName,
+                                           buffer.data(), static_cast<int>(buffer.size()));
+    return length > 0 ? std::string(buffer.data(), static_cast<std::size_t>(length)) : std::string();
+}
+
+double toMs(std::chrono::microseconds value) {
+    return static_cast<double>(value.count()) / 1000.0;
+}
+
+} // namespace
+
+std::string HandshakeTimings::summary() const {
+    return std::format("reset {:.1f}ms, tls {:.1f}ms (verify {:.1f}ms, stalled {:.1f}ms{}), "
+                       "key exchange {:.1f}ms, push {:.1f}ms, total {:.1f}ms, srtt {:.1f}ms, {} retransmits",
+                       toMs(reset), toMs(tls), toMs(verify), toMs(verifyStall),
+                       resumed ? ", resumed" : "", toMs(keyExchange), toMs(push), toMs(total),
+                       toMs(smoothedRtt), retransmissions);
+}
+
+TlsSessionCache::TlsSessionCache(std::chrono::seconds maxLifetime)
+    : maxLifetime(maxLifetime) {
+}
+
+TlsSessionCache::~TlsSessionCache() {
+    clear();
+}
+
+void TlsSessionCache::store(const std::string& serverKey, std::vector<std::uint8_t> session,
+                            std::chrono::seconds lifetime) {
+    if (lifetime <= std::chrono::seconds::zero() || lifetime > maxLifetime) {
+        lifetime = maxLifetime;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& entry = entries[serverKey];
+    wipe(entry);
+    entry.session = std::move(session);
+    entry.expiry = std::chrono::steady_clock::now() + lifetime;
+}
+
+std::optional<std::vector<std::uint8_t>> TlsSessionCache::lookup(const std::string& serverKey) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = entries.find(serverKey);
+    if (it == entries.end()) {
+        return std::nullopt;
+    }
+    if (std::chrono::steady_clock::now() >= it->second.expiry) {
+        wipe(it->second);
+        entries.erase(it);
+        return std::nullopt;
+    }
+    return it->second.session;
+}
+
+void TlsSessionCache::erase(const std::string& serverKey) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto it = entries.find(serverKey); it != entries.end()) {
+        wipe(it->second);
+        entries.erase(it);
+    }
+}
+
+void TlsSessionCache::clear() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (auto& [key, entry] : entries) {
+        wipe(entry);
+    }
+    entries.clear();
+}
+
+void TlsSessionCache::wipe(Entry& entry) {
+    // Serialized sessions carry the resumption secret
+    if (!entry.session.empty()) {
+        OPENSSL_cleanse(entry.session.data(), entry.session.size());
+    }
+    entry.session.clear();
+}
+
+TlsHandshake::Settings TlsHandshake::settingsFromProfile(const OvpnProfile& profile,
+                                                         const OvpnProfile::Remote& remote, int family) {
+    Settings settings;
+    settings.serverKey = remote.host + ":" + remote.port + "/" + remote.proto;
+    settings.caPem = profileMaterial(profile, "ca");
+    settings.certPem = profileMaterial(profile, "cert");
+    settings.keyPem = secretMaterial(profile, "key");
+    settings.crlPem = profileMaterial(profile, "crl-verify");
+
+    if (auto args = profile.directiveArgs("verify-x509-name"); !args.empty()) {
+        settings.verifyName = args[0];
+        const std::string type = args.size() > 1 ? args[1] : "subject";
+        settings.verifyNameMode = type == "name"        ? VerifyNameMode::CommonName
+                                : type == "name-prefix" ? VerifyNameMode::CommonNamePrefix
+                                                        : VerifyNameMode::Subject;
+    }
+
+    auto remoteCertTls = profile.directiveArgs("remote-cert-tls");
+    settings.requireServerCertUsage = !remoteCertTls.empty() && remoteCertTls[0] == "server";
+
+    // The cipher we would use before the server's push overrides it: the
+    // profile's cipher, else the first data-ciphers entry with a kernel
+    std::string cipher = "AES-256-GCM";
+    std::vector<std::string> candidates = profile.directiveArgs("cipher");
+    if (auto args = profile.directiveArgs("data-ciphers"); !args.empty()) {
+        for (const auto part : std::views::split(std::string_view(args[0]), ':')) {
+            candidates.emplace_back(part.begin(), part.end());
+        }
+    }
+    for (const auto& candidate : candidates) {
+        if (DataChannel::cipherFromName(candidate)) {
+            cipher = candidate;
+            std::transform(cipher.begin(), cipher.end(), cipher.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+            break;
+        }
+    }
+    const bool aes128 = DataChannel::cipherFromName(cipher) == DataChannel::Cipher::Aes128Gcm;
+
+    const bool tcp = VpnTransport::protocolFromString(remote.proto) == VpnTransport::Protocol::Tcp;
+    const std::string proto = std::string(tcp ? "TCP" : "UDP") + (family == AF_INET6 ? "v6" : "v4") +
+                              (tcp ? "_CLIENT" : "");
+    auto devArgs = profile.directiveArgs("dev");
+    const std::string devType = !devArgs.empty() && devArgs[0].starts_with("tap") ? "tap" : "tun";
+    settings.optionsString = "V4,dev-type " + devType + ",link-mtu 1559,tun-mtu 1500,proto " + proto +
+                             ",cipher " + cipher + ",auth [null-digest],keysize " + (aes128 ? "128" : "256") +
+                             ",key-method 2,tls-client";
+
+    #ifdef _WIN32
+    const std::string platform = "win";
+    #elif __APPLE__
+    const std::string platform = "mac";
+    #elif __ANDROID__
+    const std::string platform = "android";
+    #else
+    const std::string platform = "linux";
+    #endif
+    settings.peerInfo = "IV_VER=3.siavpn\nIV_PLAT=" + platform +
+                        "\nIV_PROTO=2\nIV_CIPHERS=AES-256-GCM:AES-128-GCM:CHACHA20-POLY1305\nIV_GUI_VER=SIAVPN\n";
+
+    return settings;
+}
+
+TlsHandshake::TlsHandshake(WorkerPool& verifyPool, TlsSessionCache& sessionCache)
+    : verifyPool(verifyPool)
+    , sessionCache(sessionCache) {
+}
+
+TlsHandshake::~TlsHandshake() {
+    releaseTls();
+    OPENSSL_cleanse(clientKeySource.data(), clientKeySource.size());
+    OPENSSL_cleanse(serverRandom.data(), serverRandom.size());
+    // The push reply may carry an auth token
+    OPENSSL_cleanse(pushReplyText.data(), pushReplyText.size());
+}
+
+bool TlsHandshake::run(VpnTransport& transport, ControlChannel& channel, const Settings& settings,
+                       const std::atomic<bool>& shouldStop, const StepCallback& onStep) {
+    const auto started = Clock::now();
+    const auto deadline = started + settings.timeout;
+    stepTimings = {};
+    activeSettings = settings;
+
+    try {
+        // Parse the CA bundle and CRL while the reset round trip is in flight
+        trustStore = verifyPool.submit([ca = settings.caPem, crl = settings.crlPem]() -> std::shared_ptr<X509_STORE> {
+            if (ca.empty()) {
+                return nullptr;
+            }
+
+            std::shared_ptr<X509_STORE> store(X509_STORE_new(), X509_STORE_free);
+            for (const auto* pem : {&ca, &crl}) {
+                if (pem->empty()) {
+                    continue;
+                }
+                BIO* bio = BIO_new_mem_buf(pem->data(), static_cast<int>(pem->size()));
+                STACK_OF(X509_INFO)* infos = PEM_X509_INFO_read_bio(bio, nullptr, nullptr, nullptr);
+                for (int i = 0; infos && i < sk_X509_INFO_num(infos); ++i) {
+                    X509_INFO* info = sk_X509_INFO_value(infos, i);
+                    if (info->x509) {
+                        X509_STORE_add_cert(store.get(), info->x509);
+                    }
+                    if (info->crl) {
+                        X509_STORE_add_crl(store.get(), info->crl);
+                    }
+                }
+                sk_X509_INFO_pop_free(infos, X509_INFO_free);
+                BIO_free(bio);
+            }
+
+            if (!crl.empty()) {
+                X509_STORE_set_flags(store.get(), X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+            }
+            return store;
+        }).share();
+
+        onStep("Performing TLS handshake...");
+
+        auto phaseStart = Clock::now();
+        channel.startHardReset();
+        runUntil(transport, channel, shouldStop, deadline, [&]() { return channel.isEstablished(); });
+        stepTimings.reset = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - phaseStart);
+
+        phaseStart = Clock::now();
+        setupTls(settings);
+        runUntil(transport, channel, shouldStop, deadline, [&]() {
+            int rc = SSL_do_handshake(ssl);
+            if (rc == 1) {
+                return true;
+            }
+            int error = SSL_get_error(ssl, rc);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ||
+                error == SSL_ERROR_WANT_RETRY_VERIFY) {
+                return false;
+            }
+            if (verifyResult && !verifyResult->ok) {
+                throw HandshakeError("CERT_VERIFY_FAIL", "Certificate verification failed: " + verifyResult->error);
+            }
+            throw HandshakeError("TLS_ERROR", "TLS handshake failed: " + opensslError());
+        });
+        stepTimings.tls = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - phaseStart);
+        stepTimings.resumed = SSL_session_reused(ssl) == 1;
+
+        onStep("Authenticating with server...");
+
+        phaseStart = Clock::now();
+        writePlaintext(buildKeyMethodMessage(settings));
+        runUntil(transport, channel, shouldStop, deadline, [&]() {
+            readPlaintext();
+            return parseKeyMethodReply();
+        });
+        stepTimings.keyExchange = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - phaseStart);
+
+        phaseStart = Clock::now();
+        auto lastRequest = Clock::now();
+        writePlaintext(pushRequest);
+        runUntil(transport, channel, shouldStop, deadline, [&]() {
+            readPlaintext();
+            while (auto message = takeMessage()) {
+                if (message->starts_with("AUTH_FAILED")) {
+                    throw HandshakeError("AUTH_FAILED", "Authentication failed: " + *message);
+                }
+                if (message->starts_with("PUSH_REPLY")) {
+                    pushReplyText += pushReplyText.empty() ? *message : message->substr(10);
+                    // Large replies are split; "push-continuation 2" means more follow
+                    if (message->find("push-continuation 2") == std::string::npos) {
+                        return true;
+                    }
+                }
+            }
+
+            // Servers may delay the reply (e.g. deferred auth); keep asking
+            if (Clock::now() - lastRequest >= pushRequestInterval) {
+                writePlaintext(pushRequest);
+                lastRequest = Clock::now();
+            }
+            return false;
+        });
+        stepTimings.push = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - phaseStart);
+
+    } catch (const HandshakeError& e) {
+        failure = e.event;
+        lastError = e.what();
+    } catch (const std::exception& e) {
+        failure = "TLS_ERROR";
+        lastError = "Handshake error: " + std::string(e.what());
+    }
+
+    stepTimings.total = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+    stepTimings.retransmissions = channel.retransmissionCount();
+    stepTimings.smoothedRtt = channel.smoothedRtt();
+    return failure.empty();
+}
+
+std::vector<std::string> TlsHandshake::pollMessages(ControlChannel& channel) {
+    std::vector<std::string> messages;
+    if (!ssl) {
+        return messages;
+    }
+
+    feedTls(channel);
+    readPlaintext();
+    flushTls(channel);
+
+    while (auto message = takeMessage()) {
+        messages.push_back(std::move(*message));
+    }
+    return messages;
+}
+
+void TlsHandshake::releaseBuffers() {
+    if (ssl) {
+        SSL_free_buffers(ssl);
+    }
+    receivedPackets.clear();
+    receivedPackets.shrink_to_fit();
+}
+
+const HandshakeTimings& TlsHandshake::timings() const {
+    return stepTimings;
+}
+
+std::string TlsHandshake::pushReply() const {
+    return pushReplyText;
+}
+
+SecureBytes TlsHandshake::dataChannelKeys(std::uint64_t clientSession, std::uint64_t serverSession) const {
+    // Client key source: pre-master (48), random1 (32), random2 (32); server: random1, random2
+    const std::span<const std::uint8_t> client(clientKeySource);
+    const std::span<const std::uint8_t> server(serverRandom);
+
+    SecureBytes seed(client.begin() + 48, client.begin() + 80);
+    seed.insert(seed.end(), server.begin(), server.begin() + 32);
+    SecureBytes master(48);
+    tls1Prf(client.first(48), "OpenVPN master secret", seed, master);
+
+    seed.assign(client.begin() + 80, client.end());
+    seed.insert(seed.end(), server.begin() + 32, server.end());
+    appendSessionId(seed, clientSession);
+    appendSessionId(seed, serverSession);
+    SecureBytes keys(256);
+    tls1Prf(master, "OpenVPN key expansion", seed, keys);
+    return keys;
+}
+
+std::string TlsHandshake::failureEvent() const {
+    return failure;
+}
+
+std::string TlsHandshake::getLastError() const {
+    return lastError;
+}
+
+int TlsHandshake::verifyCallback(X509_STORE_CTX* storeCtx, void* arg) {
+    auto* self = static_cast<TlsHandshake*>(arg);
+
+    try {
+        if (!self->verifyResult && !self->pendingVerify.valid()) {
+            X509* leaf = X509_STORE_CTX_get0_cert(storeCtx);
+            if (!leaf) {
+                return 0;
+            }
+            X509_up_ref(leaf);
+            STACK_OF(X509)* peerChain = X509_STORE_CTX_get0_untrusted(storeCtx);
+            STACK_OF(X509)* untrusted = peerChain ? X509_chain_up_ref(peerChain) : nullptr;
+
+            self->verifyRequested = Clock::now();
+            self->pendingVerify = self->verifyPool.submit(
+                [store = self->trustStore, leaf, untrusted, settings = self->activeSettings]() {
+                    return verifyChain(store, leaf, untrusted, settings);
+                });
+        }
+
+        if (!self->verifyResult) {
+            // Suspend the handshake; the event loop resumes it once the worker is done
+            if (self->pendingVerify.wait_for(std::chrono::seconds::zero()) != std::future_status::ready) {
+                auto* ssl = static_cast<SSL*>(X509_STORE_CTX_get_ex_data(storeCtx, SSL_get_ex_data_X509_STORE_CTX_idx()));
+                return SSL_set_retry_verify(ssl);
+            }
+            self->verifyResult = self->pendingVerify.get();
+            self->stepTimings.verify = self->verifyResult->duration;
+            self->stepTimings.verifyStall = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - self->verifyRequested);
+        }
+    } catch (const std::exception& e) {
+        self->verifyResult = VerifyResult{false, e.what(), {}};
+    }
+
+    if (!self->verifyResult->ok) {
+        X509_STORE_CTX_set_error(storeCtx, X509_V_ERR_APPLICATION_VERIFICATION);
+        return 0;
+    }
+    X509_STORE_CTX_set_error(storeCtx, X509_V_OK);
+    return 1;
+}
+
+int TlsHandshake::newSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    auto* self = static_cast<TlsHandshake*>(SSL_get_app_data(ssl));
+    if (!self || !SSL_SESSION_is_resumable(session)) {
+        return 0;
+    }
+
+    int length = i2d_SSL_SESSION(session, nullptr);
+    if (length <= 0) {
+        return 0;
+    }
+    std::vector<std::uint8_t> serialized(static_cast<std::size_t>(length));
+    unsigned char* out = serialized.data();
+    i2d_SSL_SESSION(session, &out);
+
+    self->sessionCache.store(self->activeSettings.serverKey, std::move(serialized),
+                             std::chrono::seconds(SSL_SESSION_get_timeout(session)));
+
+    // We keep our own serialized copy, OpenSSL keeps ownership of the session
+    return 0;
+}
+
+TlsHandshake::VerifyResult TlsHandshake::verifyChain(std::shared_future<std::shared_ptr<X509_STORE>> trustStore,
+                                                     X509* leaf, STACK_OF(X509)* untrusted,
+                                                     const Settings& settings) {
+    const auto started = Clock::now();
+    VerifyResult result;
+
+    auto store = trustStore.get();
+    if (!store) {
+        result.error = "No CA certificate configured";
+    } else if (X509_STORE_CTX* ctx = X509_STORE_CTX_new(); ctx) {
+        if (X509_STORE_CTX_init(ctx, store.get(), leaf, untrusted) == 1) {
+            if (settings.requireServerCertUsage) {
+                X509_STORE_CTX_set_purpose(ctx, X509_PURPOSE_SSL_SERVER);
+            }
+            if (X509_verify_cert(ctx) == 1) {
+                result.ok = true;
+            } else {
+                result.error = std::string(X509_verify_cert_error_string(X509_STORE_CTX_get_error(ctx))) +
+                               " at depth " + std::to_string(X509_STORE_CTX_get_error_depth(ctx));
+            }
+        } else {
+            result.error = "Cannot initialise verification: " + opensslError();
+        }
+        X509_STORE_CTX_free(ctx);
+    } else {
+        result.error = "Out of memory";
+    }
+
+    if (result.ok && !settings.verifyName.empty()) {
+        const std::string actual = settings.verifyNameMode == VerifyNameMode::Subject ? subjectText(leaf) : commonName(leaf);
+        const bool matches = settings.verifyNameMode == VerifyNameMode::CommonNamePrefix
+                                 ? actual.starts_with(settings.verifyName)
+                                 : actual == settings.verifyName;
+        if (!matches) {
+            result.ok = false;
+            result.error = "Server name '" + actual + "' does not match verify-x509-name";
+        }
+    }
+
+    X509_free(leaf);
+    if (untrusted) {
+        sk_X509_pop_free(untrusted, X509_free);
+    }
+
+    result.duration = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+    return result;
+}
+
+void TlsHandshake::setupTls(const Settings& settings) {
+    releaseTls();
+
+    sslContext = SSL_CTX_new(TLS_client_method());
+    if (!sslContext) {
+        throw HandshakeError("TLS_ERROR", "Cannot create TLS context: " + opensslError());
+    }
+    SSL_CTX_set_min_proto_version(sslContext, TLS1_2_VERSION);
+    SSL_CTX_set_verify(sslContext, SSL_VERIFY_PEER, nullptr);
+    SSL_CTX_set_cert_verify_callback(sslContext, &TlsHandshake::verifyCallback, this);
+    SSL_CTX_set_session_cache_mode(sslContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(sslContext, &TlsHandshake::newSessionCallback);
+
+    ssl = SSL_new(sslContext);
+    if (!ssl) {
+        throw HandshakeError("TLS_ERROR", "Cannot create TLS session: " + opensslError());
+    }
+    SSL_set_app_data(ssl, this);
+
+    networkIn = BIO_new(BIO_s_mem());
+    networkOut = BIO_new(BIO_s_mem());
+    SSL_set_bio(ssl, networkIn, networkOut);
+    SSL_set_connect_state(ssl);
+
+    if (!settings.certPem.empty() && !settings.keyPem.empty()) {
+        BIO* certBio = BIO_new_mem_buf(settings.certPem.data(), static_cast<int>(settings.certPem.size()));
+        X509* cert = PEM_read_bio_X509(certBio, nullptr, nullptr, nullptr);
+        bool certOk = cert && SSL_use_certificate(ssl, cert) == 1;
+        X509_free(cert);
+
+        // Anything after the leaf in <cert> is sent as the client chain
+        while (certOk) {
+            X509* extra = PEM_read_bio_X509(certBio, nullptr, nullptr, nullptr);
+            if (!extra) {
+                ERR_clear_error();
+                break;
+            }
+            SSL_add1_chain_cert(ssl, extra);
+            X509_free(extra);
+        }
+        BIO_free(certBio);
+
+        BIO* keyBio = BIO_new_mem_buf(settings.keyPem.c_str(), static_cast<int>(settings.keyPem.size()));
+        // With no callback OpenSSL takes the last argument as the passphrase
+        void* passphrase = settings.privateKeyPassword.empty()
+                               ? nullptr
+                               : const_cast<char*>(settings.privateKeyPassword.c_str());
+        EVP_PKEY* key = PEM_read_bio_PrivateKey(keyBio, nullptr, nullptr, passphrase);
+        bool keyOk = key && SSL_use_PrivateKey(ssl, key) == 1;
+        EVP_PKEY_free(key);
+        BIO_free(keyBio);
+
+        if (!certOk || !keyOk) {
+            throw HandshakeError("TLS_ERROR", "Invalid client certificate or key: " + opensslError());
+        }
+    }
+
+    // Offer a cached ticket; the server falls back to a full handshake if it rejects it
+    if (auto cached = sessionCache.lookup(settings.serverKey)) {
+        const unsigned char* in = cached->data();
+        if (SSL_SESSION* session = d2i_SSL_SESSION(nullptr, &in, static_cast<long>(cached->size()))) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+        }
+        OPENSSL_cleanse(cached->data(), cached->size());
+    }
+
+    pendingVerify = {};
+    verifyResult.reset();
+}
+
+void TlsHandshake::releaseTls() {
+    if (ssl) {
+        SSL_free(ssl);  // also frees the memory BIOs
+        ssl = nullptr;
+        networkIn = nullptr;
+        networkOut = nullptr;
+    }
+    if (sslContext) {
+        SSL_CTX_free(sslContext);
+        sslContext = nullptr;
+    }
+    if (!plaintext.empty()) {
+        OPENSSL_cleanse(plaintext.data(), plaintext.size());
+        plaintext.clear();
+    }
+}
+
+void TlsHandshake::runUntil(VpnTransport& transport, ControlChannel& channel, const std::atomic<bool>& shouldStop,
+                            Clock::time_point deadline, const std::function<bool()>& step) {
+    while (true) {
+        if (shouldStop) {
+            throw HandshakeError("DISCONNECTED", "Handshake cancelled");
+        }
+
+        feedTls(channel);
+        const bool done = step();
+        flushTls(channel);
+
+        auto now = Clock::now();
+        channel.service(now);
+        if (done) {
+            return;
+        }
+        if (now >= deadline) {
+            throw HandshakeError("CONNECTION_TIMEOUT", "TLS handshake timed out");
+        }
+
+        // Sleep until the next retransmit, but poll quickly while a verification is pending
+        auto wakeup = std::min(channel.nextWakeup(), deadline);
+        auto interval = pendingVerify.valid() && !verifyResult ? verifyPollInterval : pollInterval;
+        auto wait = std::clamp(std::chrono::duration_cast<std::chrono::milliseconds>(wakeup - now),
+                               std::chrono::milliseconds::zero(), interval);
+
+        const std::size_t received = transport.receiveBatch(receivedPackets, wait);
+        for (std::size_t i = 0; i < received; ++i) {
+            if (ControlChannel::isControlPacket(receivedPackets[i])) {
+                channel.processIncoming(receivedPackets[i]);
+            }
+        }
+        if (received == 0 && !transport.isOpen()) {
+            throw HandshakeError("CONNECTION_FAILED", transport.getLastError());
+        }
+    }
+}
+
+void TlsHandshake::feedTls(ControlChannel& channel) {
+    auto bytes = channel.takeReceived();
+    if (!bytes.empty() && networkIn) {
+        BIO_write(networkIn, bytes.data(), static_cast<int>(bytes.size()));
+    }
+}
+
+void TlsHandshake::flushTls(ControlChannel& channel) {
+    if (!networkOut) {
+        return;
+    }
+
+    std::array<std::uint8_t, ControlChannel::maxPayloadSize> buffer{};
+    while (BIO_ctrl_pending(networkOut) > 0) {
+        int length = BIO_read(networkOut, buffer.data(), static_cast<int>(buffer.size()));
+        if (length <= 0) {
+            break;
+        }
+        channel.queueMessage(std::span(buffer).first(static_cast<std::size_t>(length)));
+    }
+}
+
+void TlsHandshake::readPlaintext() {
+    std::array<std::uint8_t, 4096> buffer{};
+    while (true) {
+        int length = SSL_read(ssl, buffer.data(), static_cast<int>(buffer.size()));
+        if (length > 0) {
+            plaintext.insert(plaintext.end(), buffer.begin(), buffer.begin() + length);
+            continue;
+        }
+
+        int error = SSL_get_error(ssl, length);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            break;
+        }
+        if (error == SSL_ERROR_ZERO_RETURN) {
+            throw HandshakeError("CONNECTION_FAILED", "Server closed the TLS session");
+        }
+        throw HandshakeError("TLS_ERROR", "TLS read failed: " + opensslError());
+    }
+    OPENSSL_cleanse(buffer.data(), buffer.size());
+}
+
+void TlsHandshake::writePlaintext(std::span<const std::uint8_t> data) {
+    // Memory BIOs grow on demand, so a write never blocks
+    if (SSL_write(ssl, data.data(), static_cast<int>(data.size())) <= 0) {
+        throw HandshakeError("TLS_ERROR", "TLS write failed: " + opensslError());
+    }
+}
+
+std::optional<std::string> TlsHandshake::takeMessage() {
+    auto terminator = std::find(plaintext.begin(), plaintext.end(), std::uint8_t{0});
+    if (terminator == plaintext.end()) {
+        return std::nullopt;
+    }
+
+    std::string message(plaintext.begin(), terminator);
+    plaintext.erase(plaintext.begin(), terminator + 1);
+    return message;
+}
+
+SecureBytes TlsHandshake::buildKeyMethodMessage(const Settings& settings) {
+    if (RAND_bytes(clientKeySource.data(), static_cast<int>(clientKeySource.size())) != 1) {
+        throw HandshakeError("TLS_ERROR", "Cannot generate key material: " + opensslError());
+    }
+
+    SecureBytes message{0, 0, 0, 0, keyMethod2};
+    message.insert(message.end(), clientKeySource.begin(), clientKeySource.end());
+    writeString(message, settings.optionsString);
+    writeString(message, settings.username.view());
+    writeString(message, settings.password.view());
+    writeString(message, settings.peerInfo);
+    return message;
+}
+
+bool TlsHandshake::parseKeyMethodReply() {
+    // uint32 0, key method, server random1 + random2, options string
+    constexpr std::size_t fixedLength = 4 + 1 + 64 + 2;
+    if (plaintext.size() < fixedLength) {
+        return false;
+    }
+    if (plaintext[4] != keyMethod2) {
+        throw HandshakeError("TLS_ERROR", "Server uses unsupported key method " + std::to_string(plaintext[4]));
+    }
+
+    const std::size_t optionsLength = (static_cast<std::size_t>(plaintext[69]) << 8) | plaintext[70];
+    if (plaintext.size() < fixedLength + optionsLength) {
+        return false;
+    }
+
+    std::copy_n(plaintext.begin() + 5, serverRandom.size(), serverRandom.begin());
+
+    // The reply is one record; anything after the options is padding we don't use
+    OPENSSL_cleanse(plaintext.data(), plaintext.size());
+    plaintext.clear();
+    return true;
+}
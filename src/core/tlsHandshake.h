@@ -0,0 +1,159 @@
+#pragma once
+import std;
+#include <openssl/ssl.h>
+#include "controlChannel.h"
+#include "ovpnProfile.h"
+#include "secureMemory.h"
+#include "vpnTransport.h"
+#include "workerPool.h"
+
+// Latency contributed by each step of one control-channel handshake
+struct HandshakeTimings {
+    std::chrono::microseconds reset{0};        // hard reset round trip
+    std::chrono::microseconds tls{0};          // TLS handshake, including verification
+    std::chrono::microseconds verify{0};       // chain verification on the worker pool
+    std::chrono::microseconds verifyStall{0};  // time the handshake waited for verification
+    std::chrono::microseconds keyExchange{0};  // key-method 2 exchange
+    std::chrono::microseconds push{0};         // PUSH_REQUEST until PUSH_REPLY
+    std::chrono::microseconds total{0};
+    std::chrono::microseconds smoothedRtt{0};  // control-channel SRTT at the end
+    std::uint64_t retransmissions = 0;
+    bool resumed = false;
+
+    std::string summary() const;
+};
+
+// TLS sessions (tickets) per server, so reconnects skip the full handshake
+class TlsSessionCache {
+public:
+    explicit TlsSessionCache(std::chrono::seconds maxLifetime = std::chrono::hours(2));
+    ~TlsSessionCache();
+
+    void store(const std::string& serverKey, std::vector<std::uint8_t> session, std::chrono::seconds lifetime);
+    std::optional<std::vector<std::uint8_t>> lookup(const std::string& serverKey);
+    void erase(const std::string& serverKey);
+    void clear();
+
+private:
+    struct Entry {
+        std::vector<std::uint8_t> session;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    static void wipe(Entry& entry);
+
+    std::map<std::string, Entry> entries;
+    std::chrono::seconds maxLifetime;
+    mutable std::mutex cacheMutex;
+};
+
+// Drives reset, TLS, key-method 2 and PUSH_REQUEST over a ControlChannel.
+// Certificate chains are verified on a WorkerPool while the loop keeps
+// servicing ACKs and retransmits.
+class TlsHandshake {
+public:
+    enum class VerifyNameMode { Subject, CommonName, CommonNamePrefix };
+
+    struct Settings {
+        std::string serverKey;
+        std::string caPem;
+        std::string certPem;
+        SecureString keyPem;
+        SecureString privateKeyPassword;
+        std::string crlPem;
+        std::string verifyName;
+        VerifyNameMode verifyNameMode = VerifyNameMode::Subject;
+        bool requireServerCertUsage = false;
+        std::string optionsString;
+        std::string peerInfo;
+        SecureString username;
+        SecureString password;
+        std::chrono::seconds timeout{60};
+    };
+
+    using StepCallback = std::function<void(const std::string&)>;
+
+    // family: AF_INET or AF_INET6 of the connected transport, reported in the options string
+    static Settings settingsFromProfile(const OvpnProfile& profile, const OvpnProfile::Remote& remote,
+                                        int family = AF_INET);
+
+    TlsHandshake(WorkerPool& verifyPool, TlsSessionCache& sessionCache);
+    ~TlsHandshake();
+
+    TlsHandshake(const TlsHandshake&) = delete;
+    TlsHandshake& operator=(const TlsHandshake&) = delete;
+
+    bool run(VpnTransport& transport, ControlChannel& channel, const Settings& settings,
+             const std::atomic<bool>& shouldStop, const StepCallback& onStep);
+
+    // Control messages received after the handshake (RESTART, AUTH_FAILED, ...)
+    std::vector<std::string> pollMessages(ControlChannel& channel);
+    // Frees OpenSSL's record buffers and the receive batch while the session
+    // sits idle (paused); both come back on the next message
+    void releaseBuffers();
+
+    const HandshakeTimings& timings() const;
+    std::string pushReply() const;
+    // Key-method 2 expansion (TLS 1.0 PRF) of the exchanged randoms: two
+    // directions of 64-byte cipher and 64-byte HMAC keys, client-to-server first
+    SecureBytes dataChannelKeys(std::uint64_t clientSession, std::uint64_t serverSession) const;
+    std::string failureEvent() const;
+    std::string getLastError() const;
+
+private:
+    struct VerifyResult {
+        bool ok = false;
+        std::string error;
+        std::chrono::microseconds duration{0};
+    };
+
+    class HandshakeError : public std::runtime_error {
+    public:
+        HandshakeError(std::string event, const std::string& message)
+            : std::runtime_error(message), event(std::move(event)) {}
+        std::string event;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    static int verifyCallback(X509_STORE_CTX* storeCtx, void* arg);
+    static int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+    static VerifyResult verifyChain(std::shared_future<std::shared_ptr<X509_STORE>> trustStore,
+                                    X509* leaf, STACK_OF(X509)* untrusted, const Settings& settings);
+
+    void setupTls(const Settings& settings);
+    void releaseTls();
+    void runUntil(VpnTransport& transport, ControlChannel& channel, const std::atomic<bool>& shouldStop,
+                  Clock::time_point deadline, const std::function<bool()>& step);
+    void feedTls(ControlChannel& channel);
+    void flushTls(ControlChannel& channel);
+    void readPlaintext();
+    void writePlaintext(std::span<const std::uint8_t> data);
+    std::optional<std::string> takeMessage();
+    SecureBytes buildKeyMethodMessage(const Settings& settings);
+    bool parseKeyMethodReply();
+
+    WorkerPool& verifyPool;
+    TlsSessionCache& sessionCache;
+
+    SSL_CTX* sslContext = nullptr;
+    SSL* ssl = nullptr;
+    BIO* networkIn = nullptr;
+    BIO* networkOut = nullptr;
+
+    Settings activeSettings;
+    std::shared_future<std::shared_ptr<X509_STORE>> trustStore;
+    std::future<VerifyResult> pendingVerify;
+    std::optional<VerifyResult> verifyResult;
+    Clock::time_point verifyRequested{};
+
+    SecureBytes plaintext;
+    std::vector<std::vector<std::uint8_t>> receivedPackets;
+    std::array<std::uint8_t, 112> clientKeySource{};
+    std::array<std::uint8_t, 64> serverRandom{};
+
+    HandshakeTimings stepTimings;
+    std::string pushReplyText;
+    std::string failure;
+    std::string lastError;
+};
@@ -0,0 +1,351 @@
+import std;
+#include "transportLayers.h"
+
+namespace {
+
+// Each layer moves data back by headroom bytes at most when wrapping and
+// forward by as much when unwrapping; the XOR layers are their own inverse
+// apart from reverse's order, which the chain takes care of.
+
+// XOR with a repeating pattern whose period is a multiple of 8, a word at a time
+void xorPattern(std::uint8_t* data, std::size_t length, const std::uint8_t* pattern, std::size_t period) {
+    std::size_t offset = 0;
+    while (offset < length) {
+        const std::size_t chunk = std::min(period, length - offset);
+        std::uint8_t* out = data + offset;
+        std::size_t i = 0;
+        for (; i + 8 <= chunk; i += 8) {
+            std::uint64_t word;
+            std::uint64_t key;
+            std::memcpy(&word, out + i, 8);
+            std::memcpy(&key, pattern + i, 8);
+            word ^= key;
+            std::memcpy(out + i, &word, 8);
+        }
+        for (; i < chunk; ++i) {
+            out[i] ^= pattern[i];
+        }
+        offset += chunk;
+    }
+}
+
+struct XorMask {
+    static constexpr std::size_t headroom = 0;
+    static constexpr std::string_view name = "xormask";
+    // The mask repeated 8 times, so its period is a multiple of 8
+    std::vector<std::uint8_t> pattern;
+
+    explicit XorMask(std::string_view mask) {
+        for (int i = 0; i < 8; ++i) {
+            pattern.insert(pattern.end(), mask.begin(), mask.end());
+        }
+    }
+    void wrap(std::uint8_t*& data, std::size_t& length) const { xorPattern(data, length, pattern.data(), pattern.size()); }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const {
+        xorPattern(data, length, pattern.data(), pattern.size());
+        return true;
+    }
+};
+
+struct XorPtrPos {
+    static constexpr std::size_t headroom = 0;
+    static constexpr std::string_view name = "xorptrpos";
+    // Byte i is XORed with i + 1, truncated: the pattern repeats every 256 bytes
+    static constexpr std::array<std::uint8_t, 256> pattern = [] {
+        std::array<std::uint8_t, 256> positions{};
+        for (std::size_t i = 0; i < positions.size(); ++i) {
+            positions[i] = static_cast<std::uint8_t>(i + 1);
+        }
+        return positions;
+    }();
+
+    void wrap(std::uint8_t*& data, std::size_t& length) const { xorPattern(data, length, pattern.data(), pattern.size()); }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const {
+        xorPattern(data, length, pattern.data(), pattern.size());
+        return true;
+    }
+};
+
+// 'abcde' -> 'aedcb', as the Tunnelblick patch has it; words from both ends
+// are swapped byte-reversed until the middle is short
+struct Reverse {
+    static constexpr std::size_t headroom = 0;
+    static constexpr std::string_view name = "reverse";
+
+    static void apply(std::uint8_t* data, std::size_t length) {
+        if (length < 3) {
+            return;
+        }
+        std::uint8_t* low = data + 1;
+        std::uint8_t* high = data + length;
+        while (high - low >= 16) {
+            std::uint64_t front;
+            std::uint64_t back;
+            std::memcpy(&front, low, 8);
+            std::memcpy(&back, high - 8, 8);
+            front = std::byteswap(front);
+            back = std::byteswap(back);
+            std::memcpy(low, &back, 8);
+            std::memcpy(high - 8, &front, 8);
+            low += 8;
+            high -= 8;
+        }
+        std::reverse(low, high);
+    }
+    void wrap(std::uint8_t*& data, std::size_t& length) const { apply(data, length); }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const {
+        apply(data, length);
+        return true;
+    }
+};
+
+struct TlsRecord {
+    static constexpr std::size_t headroom = TransportChain::recordHeaderSize;
+    static constexpr std::string_view name = "tls-record";
+    // Application data, TLS 1.2; TLS 1.3 sends the same on the wire
+    static constexpr std::array<std::uint8_t, 3> prefix{0x17, 0x03, 0x03};
+    // Plaintext limit plus the expansion a record may have
+    static constexpr std::size_t maxRecord = (1 << 14) + 2048;
+
+    void wrap(std::uint8_t*& data, std::size_t& length) const {
+        data -= headroom;
+        std::copy(prefix.begin(), prefix.end(), data);
+        data[3] = static_cast<std::uint8_t>(length >> 8);
+        data[4] = static_cast<std::uint8_t>(length);
+        length += headroom;
+    }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const {
+        if (length < headroom || length - headroom > maxRecord || !std::equal(prefix.begin(), prefix.end(), data) ||
+            ((static_cast<std::size_t>(data[3]) << 8) | data[4]) != length - headroom) {
+            return false;
+        }
+        data += headroom;
+        length -= headroom;
+        return true;
+    }
+};
+
+using AnyLayer = std::variant<XorMask, XorPtrPos, Reverse, TlsRecord>;
+
+std::string_view layerName(const AnyLayer& layer) {
+    return std::visit([](const auto& l) { return std::decay_t<decltype(l)>::name; }, layer);
+}
+
+} // namespace
+
+class TransportChain::Chain {
+public:
+    virtual ~Chain() = default;
+    virtual bool wrap(std::uint8_t*& data, std::size_t& length) const = 0;
+    virtual bool unwrap(std::uint8_t*& data, std::size_t& length) const = 0;
+
+    std::string description;
+    std::size_t headroom = 0;
+    bool framesStream = false;
+};
+
+namespace {
+
+// A common chain with every layer inlined: one indirect call per packet
+template <typename... Layers>
+class CompiledChain final : public TransportChain::Chain {
+public:
+    explicit CompiledChain(std::tuple<Layers...> layers) : layers(std::move(layers)) {}
+
+    bool wrap(std::uint8_t*& data, std::size_t& length) const override {
+        std::apply([&](const auto&... layer) { (layer.wrap(data, length), ...); }, layers);
+        return true;
+    }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const override {
+        return unwrapFrom<sizeof...(Layers)>(data, length);
+    }
+
+private:
+    // Outermost layer first
+    template <std::size_t count>
+    bool unwrapFrom(std::uint8_t*& data, std::size_t& length) const {
+        if constexpr (count == 0) {
+            return true;
+        } else {
+            return std::get<count - 1>(layers).unwrap(data, length) && unwrapFrom<count - 1>(data, length);
+        }
+    }
+
+    std::tuple<Layers...> layers;
+};
+
+// Any other combination: a dispatch per layer and packet
+class RuntimeChain final : public TransportChain::Chain {
+public:
+    explicit RuntimeChain(std::vector<AnyLayer> layers) : layers(std::move(layers)) {}
+
+    bool wrap(std::uint8_t*& data, std::size_t& length) const override {
+        for (const auto& layer : layers) {
+            std::visit([&](const auto& l) { l.wrap(data, length); }, layer);
+        }
+        return true;
+    }
+    bool unwrap(std::uint8_t*& data, std::size_t& length) const override {
+        for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+            if (!std::visit([&](const auto& l) { return l.unwrap(data, length); }, *it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<AnyLayer> layers;
+};
+
+// The compiled chain for layers if they are exactly Layers..., else nullptr
+template <typename... Layers>
+std::shared_ptr<TransportChain::Chain> compiled(const std::vector<AnyLayer>& layers) {
+    if (layers.size() != sizeof...(Layers)) {
+        return nullptr;
+    }
+    return [&]<std::size_t... index>(std::index_sequence<index...>) -> std::shared_ptr<TransportChain::Chain> {
+        if (!(std::holds_alternative<Layers>(layers[index]) && ...)) {
+            return nullptr;
+        }
+        return std::make_shared<CompiledChain<Layers...>>(std::tuple<Layers...>(std::get<Layers>(layers[index])...));
+    }(std::index_sequence_for<Layers...>{});
+}
+
+std::shared_ptr<TransportChain::Chain> build(const std::vector<AnyLayer>& layers, bool compiledChains) {
+    // Every scramble mode, alone and under a TLS record
+    std::shared_ptr<TransportChain::Chain> chain;
+    for (auto attempt : {compiled<XorMask>, compiled<XorPtrPos>, compiled<Reverse>,
+                         compiled<XorPtrPos, Reverse, XorPtrPos, XorMask>, compiled<TlsRecord>,
+                         compiled<XorMask, TlsRecord>, compiled<XorPtrPos, TlsRecord>, compiled<Reverse, TlsRecord>,
+                         compiled<XorPtrPos, Reverse, XorPtrPos, XorMask, TlsRecord>}) {
+        if (!compiledChains || (chain = attempt(layers))) {
+            break;
+        }
+    }
+    const bool isCompiled = chain != nullptr;
+    if (!chain) {
+        chain = std::make_shared<RuntimeChain>(layers);
+    }
+
+    for (const auto& layer : layers) {
+        if (!chain->description.empty()) {
+            chain->description += " + ";
+        }
+        chain->description += layerName(layer);
+        chain->headroom += std::visit([](const auto& l) { return std::decay_t<decltype(l)>::headroom; }, layer);
+    }
+    chain->description += isCompiled ? " (compiled)" : " (runtime)";
+    chain->framesStream = std::holds_alternative<TlsRecord>(layers.back());
+    return chain;
+}
+
+void appendLayer(std::vector<AnyLayer>& layers, std::string_view name, std::string_view argument) {
+    if (name == XorMask::name) {
+        if (argument.empty()) {
+            throw std::runtime_error("Transport layer xormask needs a mask");
+        }
+        layers.emplace_back(XorMask(argument));
+    } else if (name == XorPtrPos::name) {
+        layers.emplace_back(XorPtrPos{});
+    } else if (name == Reverse::name) {
+        layers.emplace_back(Reverse{});
+    } else if (name == TlsRecord::name) {
+        layers.emplace_back(TlsRecord{});
+    } else {
+        throw std::runtime_error("Unknown transport layer '" + std::string(name) + "'");
+    }
+}
+
+} // namespace
+
+TransportChain TransportChain::parse(std::string_view spec, bool compiledChains) {
+    std::vector<AnyLayer> layers;
+    std::size_t pos = 0;
+    while (pos < spec.size()) {
+        auto end = spec.find(',', pos);
+        if (end == std::string_view::npos) {
+            end = spec.size();
+        }
+        const auto item = spec.substr(pos, end - pos);
+        const auto equals = item.find('=');
+        appendLayer(layers, item.substr(0, equals), equals == std::string_view::npos ? std::string_view() : item.substr(equals + 1));
+        pos = end + 1;
+    }
+
+    TransportChain result;
+    if (layers.empty()) {
+        return result;
+    }
+    for (std::size_t i = 0; i + 1 < layers.size(); ++i) {
+        if (std::holds_alternative<TlsRecord>(layers[i])) {
+            throw std::runtime_error("Transport layer tls-record must come last");
+        }
+    }
+    result.chain = build(layers, compiledChains);
+    return result;
+}
+
+TransportChain TransportChain::fromProfile(const OvpnProfile& profile) {
+    // "scramble obfuscate <mask>" is xorptrpos, reverse, xorptrpos, xormask when sending
+    std::string spec;
+    if (auto args = profile.directiveArgs("scramble"); !args.empty()) {
+        const std::string mask = args.size() > 1 ? args[1] : std::string();
+        if (args[0] == "xormask") {
+            spec = "xormask=" + mask;
+        } else if (args[0] == "xorptrpos" || args[0] == "reverse") {
+            spec = args[0];
+        } else if (args[0] == "obfuscate") {
+            spec = "xorptrpos,reverse,xorptrpos,xormask=" + mask;
+        } else {
+            throw std::runtime_error("Unknown scramble mode '" + args[0] + "'");
+        }
+    }
+    if (std::string extra = profile.environment(profileVariable); !extra.empty()) {
+        spec += spec.empty() ? extra : "," + extra;
+    }
+    return parse(spec);
+}
+
+bool TransportChain::empty() const {
+    return !chain;
+}
+
+std::string TransportChain::describe() const {
+    return chain ? chain->description : std::string("none");
+}
+
+std::size_t TransportChain::headroom() const {
+    return chain ? chain->headroom : 0;
+}
+
+bool TransportChain::framesStream() const {
+    return chain && chain->framesStream;
+}
+
+std::span<std::uint8_t> TransportChain::wrap(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length) const {
+    if (offset + length > buffer.size() || offset < headroom()) {
+        return {};
+    }
+    std::uint8_t* data = buffer.data() + offset;
+    if (chain && !chain->wrap(data, length)) {
+        return {};
+    }
+    return {data, length};
+}
+
+std::vector<std::uint8_t> TransportChain::wrap(std::span<const std::uint8_t> packet) const {
+    std::vector<std::uint8_t> buffer(headroom() + packet.size());
+    std::copy(packet.begin(), packet.end(), buffer.begin() + static_cast<std::ptrdiff_t>(headroom()));
+    auto wrapped = wrap(buffer, headroom(), packet.size());
+    return {wrapped.begin(), wrapped.end()};
+}
+
+std::optional<std::span<std::uint8_t>> TransportChain::unwrap(std::span<std::uint8_t> packet) const {
+    std::uint8_t* data = packet.data();
+    std::size_t length = packet.size();
+    if (chain && !chain->unwrap(data, length)) {
+        return std::nullopt;
+    }
+    return std::span<std::uint8_t>(data, length);
+}
@@ -0,0 +1,63 @@
+#pragma once
+import std;
+#include "ovpnProfile.h"
+
+// Obfuscation layers between OpenVPN packets and the socket, for networks
+// that block or throttle traffic they recognise as VPN. Every layer rewrites
+// the packet where it lies; one that adds a header writes it into the
+// headroom in front of the packet, so a data packet sealed in a pooled
+// buffer is wrapped and sent from that same buffer.
+//
+//   xormask=<mask>  XOR with the repeated mask     (Tunnelblick "scramble xormask")
+//   xorptrpos       XOR each byte with its position (Tunnelblick "scramble xorptrpos")
+//   reverse         reverse all but the first byte (Tunnelblick "scramble reverse")
+//   tls-record      TLS 1.2 application data record header; frames TCP streams
+//                   in place of OpenVPN's length prefix, so a TCP 443 session
+//                   carries well-formed records (the handshake is not imitated)
+//
+// The common chains (each scramble mode, alone or under tls-record) are
+// template instantiations with every layer inlined; other combinations run
+// through a list of layers. Copies share the chain; it is immutable.
+class TransportChain {
+public:
+    static constexpr const char* profileVariable = "SIAVPN_TRANSPORT_LAYERS";
+    static constexpr std::size_t recordHeaderSize = 5;
+    // Most a chain writes in front of a packet
+    static constexpr std::size_t maxHeadroom = recordHeaderSize;
+
+    // Packets pass unchanged
+    TransportChain() = default;
+
+    // "xormask=secret,reverse,tls-record": layers in the order they apply to
+    // outgoing packets. Throws std::runtime_error for unknown layers, a
+    // missing mask, or tls-record anywhere but last. Without compiledChains
+    // even the common chains run through the list of layers, for comparing the two.
+    static TransportChain parse(std::string_view spec, bool compiledChains = true);
+    // The profile's "scramble" directive, then the layers of
+    // "setenv SIAVPN_TRANSPORT_LAYERS <spec>"; throws like parse()
+    static TransportChain fromProfile(const OvpnProfile& profile);
+
+    bool empty() const;
+    // "xorptrpos + reverse + xorptrpos + xormask (compiled)"
+    std::string describe() const;
+    // Bytes wrap() writes in front of the packet
+    std::size_t headroom() const;
+    // The chain ends in tls-record, whose header carries the length on TCP
+    bool framesStream() const;
+
+    // The packet is at buffer[offset, offset + length) and is transformed
+    // there; the wrapped packet is the returned part of buffer, empty if
+    // offset is smaller than headroom()
+    std::span<std::uint8_t> wrap(std::span<std::uint8_t> buffer, std::size_t offset, std::size_t length) const;
+    // Copying form for control packets
+    std::vector<std::uint8_t> wrap(std::span<const std::uint8_t> packet) const;
+    // Undoes the layers in place; the inner packet is the returned part of
+    // packet, nullopt if a layer finds it malformed
+    std::optional<std::span<std::uint8_t>> unwrap(std::span<std::uint8_t> packet) const;
+
+    // Defined with the compiled and runtime chains that implement it
+    class Chain;
+
+private:
+    std::shared_ptr<const Chain> chain;
+};
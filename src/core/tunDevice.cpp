@@ -0,0 +1,232 @@
+import std;
+#include "tunDevice.h"
+#include "processUtil.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool isIpv6(std::string_view prefix) {
+    return prefix.find(':') != std::string_view::npos;
+}
+
+// Word after key in "ip -o route get" output ("... via 192.0.2.1 dev eth0 src ...")
+std::string fieldAfter(std::string_view output, std::string_view key) {
+    std::istringstream words{std::string(output)};
+    std::string word;
+    while (words >> word) {
+        if (word == key && words >> word) {
+            return word;
+        }
+    }
+    return {};
+}
+
+} // namespace
+
+TunDevice::~TunDevice() {
+    close();
+}
+
+bool TunDevice::open(const std::string& name) {
+    close();
+    #ifdef __linux__
+    // "tun" alone asks for the first free unit, like OpenVPN's "dev tun"
+    const std::string requested = name == "tun" ? "tun%d" : name;
+    if (requested != "tun%d" && !socketUtil::isInterfaceName(requested)) {
+        lastError = "Invalid tunnel device name: " + name;
+        return false;
+    }
+    const int handle = ::open("/dev/net/tun", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (handle < 0) {
+        lastError = "Cannot open /dev/net/tun: " + socketUtil::lastErrorText();
+        return false;
+    }
+    ifreq request{};
+    request.ifr_flags = IFF_TUN | IFF_NO_PI;
+    requested.copy(request.ifr_name, IFNAMSIZ - 1);
+    if (::ioctl(handle, TUNSETIFF, &request) != 0) {
+        lastError = "Cannot create tunnel device " + name + ": " + socketUtil::lastErrorText();
+        ::close(handle);
+        return false;
+    }
+    fd = handle;
+    deviceName = request.ifr_name;
+    counters = {};
+    return true;
+    #else
+    lastError = "Tunnel devices are only available on Linux; cannot create " + name;
+    return false;
+    #endif
+}
+
+bool TunDevice::configure(const Settings& settings) {
+    if (!isOpen()) {
+        lastError = "No tunnel device to configure";
+        return false;
+    }
+    if (!ip({"link", "set", "dev", deviceName, "mtu", std::to_string(settings.mtu), "up"})) {
+        return false;
+    }
+    deviceMtu = settings.mtu;
+    for (const auto& address : settings.addresses) {
+        std::vector<std::string> command{isIpv6(address.local) ? "-6" : "-4", "addr", "add", address.local};
+        if (!address.peer.empty()) {
+            command.insert(command.end(), {"peer", address.peer});
+        }
+        command.insert(command.end(), {"dev", deviceName});
+        if (!ip(std::move(command))) {
+            return false;
+        }
+    }
+
+    bool serverPinned = false;
+    for (const auto& route : settings.routes) {
+        const bool v6 = isIpv6(route);
+        std::vector<std::string> prefixes{route};
+        if (route == "0.0.0.0/0" || route == "::/0") {
+            // The halves win over the system's default route without replacing it
+            prefixes = v6 ? std::vector<std::string>{"::/1", "8000::/1"}
+                          : std::vector<std::string>{"0.0.0.0/1", "128.0.0.0/1"};
+            const int family = v6 ? AF_INET6 : AF_INET;
+            if (settings.server && settings.server->ss_family == family && !serverPinned) {
+                if (!pinServer(*settings.server)) {
+                    return false;
+                }
+                serverPinned = true;
+            }
+        }
+        for (const auto& prefix : prefixes) {
+            if (!ip({v6 ? "-6" : "-4", "route", "replace", prefix, "dev", deviceName})) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TunDevice::pinServer(const sockaddr_storage& server) {
+    std::string address = socketUtil::addressToString(server);
+    // addressToString appends the port: "192.0.2.1:1194", "[2001:db8::1]:1194"
+    if (server.ss_family == AF_INET6) {
+        address = address.substr(1, address.find(']') - 1);
+    } else {
+        address = address.substr(0, address.rfind(':'));
+    }
+    const std::string family = server.ss_family == AF_INET6 ? "-6" : "-4";
+    std::string output;
+    if (!processUtil::run({"ip", "-o", family, "route", "get", address}, {}, output, lastError)) {
+        return false;
+    }
+    // Local addresses (an impairment proxy on loopback) never take the default route
+    if (output.starts_with("local ")) {
+        return true;
+    }
+    const std::string gateway = fieldAfter(output, "via");
+    const std::string device = fieldAfter(output, "dev");
+    if (device.empty() || !socketUtil::isInterfaceName(device)) {
+        lastError = "No route to the server " + address + " to keep outside the tunnel";
+        return false;
+    }
+    std::vector<std::string> route{family, "route", "replace", address + (family == "-6" ? "/128" : "/32")};
+    if (!gateway.empty()) {
+        route.insert(route.end(), {"via", gateway});
+    }
+    route.insert(route.end(), {"dev", device});
+    if (!ip(route)) {
+        return false;
+    }
+    route[2] = "del";
+    cleanup.push_back(std::move(route));
+    return true;
+}
+
+void TunDevice::close() {
+    for (auto& command : cleanup) {
+        ip(std::move(command));
+    }
+    cleanup.clear();
+    #ifdef __linux__
+    if (fd != socketUtil::invalidSocket) {
+        ::close(fd);
+    }
+    #endif
+    fd = socketUtil::invalidSocket;
+    deviceName.clear();
+}
+
+bool TunDevice::isOpen() const {
+    return fd != socketUtil::invalidSocket;
+}
+
+const std::string& TunDevice::name() const {
+    return deviceName;
+}
+
+int TunDevice::mtu() const {
+    return deviceMtu;
+}
+
+TunDevice::SocketHandle TunDevice::handle() const {
+    return fd;
+}
+
+std::optional<std::size_t> TunDevice::read(std::span<std::uint8_t> buffer) {
+    #ifdef __linux__
+    while (true) {
+        const ssize_t length = ::read(fd, buffer.data(), buffer.size());
+        if (length >= 0) {
+            ++counters.packetsRead;
+            return static_cast<std::size_t>(length);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        lastError = "Tunnel device read: " + socketUtil::lastErrorText();
+        return std::nullopt;
+    }
+    #else
+    (void)buffer;
+    return std::nullopt;
+    #endif
+}
+
+bool TunDevice::write(std::span<const std::uint8_t> packet) {
+    #ifdef __linux__
+    ssize_t written = -1;
+    do {
+        written = ::write(fd, packet.data(), packet.size());
+    } while (written < 0 && errno == EINTR);
+    if (written == static_cast<ssize_t>(packet.size())) {
+        ++counters.packetsWritten;
+        return true;
+    }
+    #else
+    (void)packet;
+    #endif
+    ++counters.writeErrors;
+    return false;
+}
+
+TunDevice::Stats TunDevice::stats() const {
+    return counters;
+}
+
+std::string TunDevice::getLastError() const {
+    return lastError;
+}
+
+bool TunDevice::ip(std::vector<std::string> arguments) {
+    arguments.insert(arguments.begin(), "ip");
+    return processUtil::run(arguments, {}, lastError);
+}
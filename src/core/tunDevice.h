@@ -0,0 +1,82 @@
+#pragma once
+import std;
+#include "socketUtil.h"
+
+// Layer 3 tunnel device of the built-in engines. Packets the system routes
+// to it are read here (at the caller's offset, so they can be sealed where
+// they lie) and opened payloads are written back. Addresses, MTU and routes
+// are applied with ip, like the split tunnel rules; routes through the
+// device go away with it when it is closed.
+//
+// A default route (0.0.0.0/0, ::/0) is installed as its two halves, so the
+// system's own default route stays for the server: the server keeps a host
+// route through the path it was reached on, which close() removes again.
+//
+// Linux only (/dev/net/tun). Owned by one connection thread; not synchronized.
+class TunDevice {
+public:
+    using SocketHandle = socketUtil::SocketHandle;
+
+    struct Address {
+        std::string local;  // with its prefix length: "10.8.0.2/24", "fd00::2/64"
+        std::string peer;   // the other end of a point-to-point link (OpenVPN net30/p2p); empty otherwise
+    };
+
+    struct Settings {
+        std::vector<Address> addresses;
+        std::vector<std::string> routes;  // "10.10.0.0/16", "2001:db8::/32", "0.0.0.0/0"
+        int mtu = 1500;
+        // Needed when routes take over the default route
+        std::optional<sockaddr_storage> server;
+    };
+
+    struct Stats {
+        std::uint64_t packetsRead = 0;
+        std::uint64_t packetsWritten = 0;
+        std::uint64_t writeErrors = 0;  // dropped on the way in
+    };
+
+    TunDevice() = default;
+    ~TunDevice();
+
+    TunDevice(const TunDevice&) = delete;
+    TunDevice& operator=(const TunDevice&) = delete;
+
+    // Creates the device: "tun" lets the kernel pick the first free tunN,
+    // anything else is taken as the name. False, with getLastError(), without
+    // /dev/net/tun or CAP_NET_ADMIN.
+    bool open(const std::string& name);
+    // Link up with the MTU, then addresses and routes; false at the first
+    // command that fails
+    bool configure(const Settings& settings);
+    // Removes the server's host route; the device takes its own routes along
+    void close();
+    bool isOpen() const;
+
+    // The name the kernel gave the device
+    const std::string& name() const;
+    int mtu() const;
+    // Readable while packets wait; for the connection thread's poll
+    SocketHandle handle() const;
+
+    // One packet into buffer: its length, 0 if none is waiting, nullopt on
+    // error. buffer should hold mtu() bytes; the kernel cuts longer packets.
+    std::optional<std::size_t> read(std::span<std::uint8_t> buffer);
+    // One packet to the system; false (and counted) if it is dropped
+    bool write(std::span<const std::uint8_t> packet);
+
+    Stats stats() const;
+    std::string getLastError() const;
+
+private:
+    bool ip(std::vector<std::string> arguments);
+    // Host route for the server through the path it is reached on now
+    bool pinServer(const sockaddr_storage& server);
+
+    SocketHandle fd = socketUtil::invalidSocket;
+    std::string deviceName;
+    int deviceMtu = 1500;
+    std::vector<std::vector<std::string>> cleanup;  // ip commands close() runs
+    Stats counters;
+    std::string lastError;
+};
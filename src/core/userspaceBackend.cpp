@@ -0,0 +1,103 @@
+import std;
+#include "userspaceBackend.h"
+
+UserspaceBackend::UserspaceBackend() {
+    client.setEventHandler([this](const std::string& eventName, const std::string& info) {
+        emitEvent(eventName, info);
+    });
+    client.setLogHandler([this](int level, const std::string& message) {
+        emitLog(level, message);
+    });
+}
+
+bool UserspaceBackend::start(const VpnConfigManager::ClientConfig& config) {
+    client.setCredentials(config.username, config.password, config.privateKeyPassword);
+    if (!config.server_override.empty()) {
+        OvpnProfile::Remote remote{config.server_override, config.port_override, config.proto_override};
+        if (remote.port.empty()) {
+            remote.port = "1194";
+        }
+        if (remote.proto.empty()) {
+            remote.proto = "udp";
+        }
+        client.setPreferredRemote(std::move(remote));
+        client.setProtoOverride("");
+    } else {
+        // A protocol alone, e.g. "quic" where UDP is blocked, applies to every remote
+        client.setPreferredRemote(std::nullopt);
+        client.setProtoOverride(config.proto_override);
+    }
+    client.setAuthCachePolicy(config.autologinSessions, std::chrono::seconds(config.authCacheLifetime));
+    client.setZeroCopySend(config.zeroCopySend);
+    client.setIdleCoalescing(config.idleCoalescing);
+    std::optional<MultipathBond::Settings> multipath;
+    if (!config.multipathUplinks.empty()) {
+        // validateConfig() reports entries that do not parse
+        multipath.emplace();
+        multipath->scheduler = MultipathBond::schedulerFromString(config.multipathScheduler)
+                                   .value_or(MultipathBond::Scheduler::MinRtt);
+        for (const auto& entry : config.multipathUplinks) {
+            if (auto uplink = MultipathBond::parseUplink(entry)) {
+                multipath->uplinks.push_back(std::move(*uplink));
+            }
+        }
+    }
+    client.setMultipath(std::move(multipath));
+    return client.startConnection(config.content.view());
+}
+
+void UserspaceBackend::stop() {
+    client.stopConnection();
+}
+
+void UserspaceBackend::pause() {
+    client.pauseConnection();
+}
+
+void UserspaceBackend::resume() {
+    client.resumeConnection();
+}
+
+void UserspaceBackend::reconnect() {
+    client.reconnectConnection();
+}
+
+std::string UserspaceBackend::getLastError() const {
+    return client.getLastError();
+}
+
+std::vector<std::string> UserspaceBackend::getPushedDnsServers() const {
+    return client.getPushedDnsServers();
+}
+
+std::optional<sockaddr_storage> UserspaceBackend::getServerAddress() const {
+    return client.getServerAddress();
+}
+
+bool UserspaceBackend::tunnelCarriesIpv6() const {
+    return client.tunnelCarriesIpv6();
+}
+
+std::string UserspaceBackend::tunnelInterface() const {
+    return client.getTunnelInterface();
+}
+
+double UserspaceBackend::getWakeupsPerMinute() const {
+    return client.getWakeupsPerMinute();
+}
+
+std::vector<MultipathBond::PathStats> UserspaceBackend::getPathStats() const {
+    return client.getPathStats();
+}
+
+void UserspaceBackend::clearSensitiveData() {
+    client.clearSensitiveData();
+}
+
+void UserspaceBackend::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    client.setMemoryBudget(std::move(budget));
+}
+
+void UserspaceBackend::setImpairmentScenario(std::optional<ImpairmentScenario> scenario) {
+    client.setImpairmentScenario(std::move(scenario));
+}
@@ -0,0 +1,33 @@
+#pragma once
+import std;
+#include "openVpnClient.h"
+#include "vpnBackend.h"
+
+// The built-in engine: OpenVpnClient's control channel, TLS and data channel
+// running in this process, with a TUN device it creates itself
+class UserspaceBackend : public VpnBackend {
+public:
+    UserspaceBackend();
+
+    bool start(const VpnConfigManager::ClientConfig& config) override;
+    void stop() override;
+    void pause() override;
+    void resume() override;
+    void reconnect() override;
+    std::string getLastError() const override;
+
+    std::vector<std::string> getPushedDnsServers() const override;
+    std::optional<sockaddr_storage> getServerAddress() const override;
+    bool tunnelCarriesIpv6() const override;
+    // The TUN device the client created, once it has
+    std::string tunnelInterface() const override;
+    double getWakeupsPerMinute() const override;
+    std::vector<MultipathBond::PathStats> getPathStats() const override;
+
+    void clearSensitiveData() override;
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget) override;
+    void setImpairmentScenario(std::optional<ImpairmentScenario> scenario) override;
+
+private:
+    OpenVpnClient client;
+};
@@ -0,0 +1,144 @@
+import std;
+#include "vpnBackend.h"
+#include "simulatedBackend.h"
+#include "userspaceBackend.h"
+#include "wireGuardBackend.h"
+#ifdef SIAVPN_HAVE_OPENVPN3
+#include "openVpn3Backend.h"
+#endif
+
+std::vector<std::string> VpnBackend::getPushedDnsServers() const {
+    return {};
+}
+
+std::optional<sockaddr_storage> VpnBackend::getServerAddress() const {
+    return std::nullopt;
+}
+
+bool VpnBackend::tunnelCarriesIpv6() const {
+    return false;
+}
+
+double VpnBackend::getWakeupsPerMinute() const {
+    return 0.0;
+}
+
+std::vector<MultipathBond::PathStats> VpnBackend::getPathStats() const {
+    return {};
+}
+
+std::string VpnBackend::tunnelInterface() const {
+    return {};
+}
+
+bool VpnBackend::needsTunnelDevice() const {
+    return true;
+}
+
+void VpnBackend::clearSensitiveData() {
+}
+
+void VpnBackend::setMemoryBudget(std::shared_ptr<MemoryBudget>) {
+}
+
+void VpnBackend::setImpairmentScenario(std::optional<ImpairmentScenario> scenario) {
+    if (scenario) {
+        emitLog(2, "This backend has no network to impair; scenario '" + scenario->name + "' ignored");
+    }
+}
+
+void VpnBackend::setEventHandler(EventHandler handler) {
+    eventHandler = std::move(handler);
+}
+
+void VpnBackend::setLogHandler(LogHandler handler) {
+    logHandler = std::move(handler);
+}
+
+void VpnBackend::emitEvent(const std::string& eventName, const std::string& info) {
+    if (eventHandler) {
+        eventHandler(eventName, info);
+    }
+}
+
+void VpnBackend::emitLog(int level, const std::string& message) {
+    if (logHandler) {
+        logHandler(level, message);
+    }
+}
+
+VpnBackendRegistry::VpnBackendRegistry() {
+    add({"simulated", "No network; walks through the connection events (UI work, overhead baseline)",
+         []() { return std::make_unique<SimulatedBackend>(); }, {}});
+    add({"userspace", "Built-in engine: control and data channel in this process",
+         []() { return std::make_unique<UserspaceBackend>(); }, {}});
+    add({"wireguard", "Built-in WireGuard engine for wg-quick style profiles",
+         []() { return std::make_unique<WireGuardBackend>(); }, {}});
+
+    #ifdef SIAVPN_HAVE_OPENVPN3
+    add({"openvpn3", "openvpn3 client library",
+         []() { return std::make_unique<OpenVpn3Backend>(false); }, {}});
+    add({"dco", "openvpn3 client library with the data channel in the ovpn-dco kernel module",
+         []() { return std::make_unique<OpenVpn3Backend>(true); },
+         []() { return OpenVpn3Backend::kernelOffloadUnavailableReason(); }});
+    #else
+    auto notBuilt = []() { return std::string("this build does not include the openvpn3 library"); };
+    add({"openvpn3", "openvpn3 client library", {}, notBuilt});
+    add({"dco", "openvpn3 client library with the data channel in the ovpn-dco kernel module", {}, notBuilt});
+    #endif
+}
+
+void VpnBackendRegistry::add(Entry entry) {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.name == entry.name; });
+    if (it != entries.end()) {
+        *it = std::move(entry);
+    } else {
+        entries.push_back(std::move(entry));
+    }
+}
+
+std::unique_ptr<VpnBackend> VpnBackendRegistry::create(const std::string& name) const {
+    auto entry = find(name);
+    if (!entry) {
+        throw std::runtime_error("Unknown VPN backend '" + name + "'");
+    }
+    if (entry->unavailableReason) {
+        if (std::string reason = entry->unavailableReason(); !reason.empty()) {
+            throw std::runtime_error("VPN backend '" + name + "' is not available: " + reason);
+        }
+    }
+    if (!entry->create) {
+        throw std::runtime_error("VPN backend '" + name + "' is not available");
+    }
+    return entry->create();
+}
+
+bool VpnBackendRegistry::isAvailable(const std::string& name) const {
+    auto entry = find(name);
+    return entry && entry->create && (!entry->unavailableReason || entry->unavailableReason().empty());
+}
+
+std::vector<std::string> VpnBackendRegistry::names() const {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    std::vector<std::string> result;
+    result.reserve(entries.size());
+    for (const auto& entry : entries) {
+        result.push_back(entry.name);
+    }
+    return result;
+}
+
+std::string VpnBackendRegistry::description(const std::string& name) const {
+    auto entry = find(name);
+    return entry ? entry->description : std::string();
+}
+
+std::optional<VpnBackendRegistry::Entry> VpnBackendRegistry::find(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.name == name; });
+    if (it == entries.end()) {
+        return std::nullopt;
+    }
+    return *it;
+}
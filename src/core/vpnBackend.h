@@ -0,0 +1,97 @@
+#pragma once
+import std;
+#include "memoryBudget.h"
+#include "multipathBond.h"
+#include "networkImpairment.h"
+#include "socketUtil.h"
+#include "vpnConfigManager.h"
+
+// Engine that carries a connection for VpnConnectionManager. Every backend
+// reports progress with the events OpenVpnClient raises (CONNECTING,
+// CONNECTED, PAUSED, RESUMED, RECONNECTING, DISCONNECTED, AUTH_FAILED,
+// TLS_ERROR, CONNECTION_FAILED, ...), so the manager maps them to VpnStatus
+// the same way whichever engine runs.
+class VpnBackend {
+public:
+    using EventHandler = std::function<void(const std::string&, const std::string&)>;
+    using LogHandler = std::function<void(int, const std::string&)>;
+
+    virtual ~VpnBackend() = default;
+
+    // Starts connecting in the background with the profile and settings of
+    // config; false, with getLastError() set, if it cannot start
+    virtual bool start(const VpnConfigManager::ClientConfig& config) = 0;
+    virtual void stop() = 0;
+    virtual void pause() = 0;
+    virtual void resume() = 0;
+    virtual void reconnect() = 0;
+
+    virtual std::string getLastError() const = 0;
+    // Resolvers pushed by the server for the current session
+    virtual std::vector<std::string> getPushedDnsServers() const;
+    virtual std::optional<sockaddr_storage> getServerAddress() const;
+    virtual bool tunnelCarriesIpv6() const;
+    // Wakeups of the connection thread over the last minute, where the engine counts them
+    virtual double getWakeupsPerMinute() const;
+    // Per-uplink counters when the engine bonds several uplinks; empty otherwise
+    virtual std::vector<MultipathBond::PathStats> getPathStats() const;
+    // Name of the tunnel device the engine uses; empty leaves it to the profile's "dev"
+    virtual std::string tunnelInterface() const;
+    // False for engines that never carry traffic and so need no tunnel device;
+    // the manager reports the others Connected only once their device exists
+    virtual bool needsTunnelDevice() const;
+
+    // Wipes credentials and session secrets the engine holds
+    virtual void clearSensitiveData();
+    virtual void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+    // Engines that own their sockets may ignore it; they log that they do
+    virtual void setImpairmentScenario(std::optional<ImpairmentScenario> scenario);
+
+    void setEventHandler(EventHandler handler);
+    void setLogHandler(LogHandler handler);
+
+protected:
+    void emitEvent(const std::string& eventName, const std::string& info);
+    void emitLog(int level, const std::string& message);
+
+private:
+    EventHandler eventHandler;
+    LogHandler logHandler;
+};
+
+// Backends by name. A profile picks one with "setenv SIAVPN_BACKEND <name>"
+// (OpenVPN itself ignores the variable); profiles without it get
+// defaultBackend. The built-in engines are registered on construction and
+// more can be added, so two engines can be compared on the same build.
+class VpnBackendRegistry {
+public:
+    using Factory = std::function<std::unique_ptr<VpnBackend>()>;
+
+    struct Entry {
+        std::string name;
+        std::string description;
+        Factory create;
+        // Why the backend cannot run on this system, or empty when it can
+        std::function<std::string()> unavailableReason;
+    };
+
+    static constexpr const char* defaultBackend = "userspace";
+    static constexpr const char* profileVariable = "SIAVPN_BACKEND";
+
+    VpnBackendRegistry();
+
+    // Replaces an entry of the same name
+    void add(Entry entry);
+    // Throws std::runtime_error for unknown or unavailable backends
+    std::unique_ptr<VpnBackend> create(const std::string& name) const;
+    bool isAvailable(const std::string& name) const;
+    // Names of all registered backends, available or not, in registration order
+    std::vector<std::string> names() const;
+    std::string description(const std::string& name) const;
+
+private:
+    std::optional<Entry> find(const std::string& name) const;
+
+    std::vector<Entry> entries;
+    mutable std::mutex entriesMutex;
+};
@@ -1,9 +1,19 @@
 import std;
 #include "vpnConfigManager.h"
+#include "fileSync.h"
+#include "multipathBond.h"
+#include "ovpnProfile.h"
+#include "profileManifest.h"
+#include "transportLayers.h"
+#include "vpnBackend.h"
+#include "wireGuardProfile.h"
+#include "workerPool.h"
 
 VpnConfigManager::VpnConfigManager() {
     profilesDirectory = "vpn_profiles";
     ensureProfilesDirectory();
+    removeStagedFiles();
+    blobStore = std::make_unique<BlobStore>(std::filesystem::path(profilesDirectory) / "blobs");
 }
 
 VpnConfigManager::~VpnConfigManager() = default;
@@ -32,7 +42,7 @@ VpnConfigManager::ClientConfig VpnConfigManager::createConfig(const std::string&
     ClientConfig config;
     
     // Set the configuration content (inline style as required by OpenVPN 3)
-    config.content = configContent;
+    config.content.assign(configContent);
     
     // Configure connection parameters following OpenVPN 3 best practices
     config.compressionMode = "adaptive";  // Use adaptive compression
@@ -40,14 +50,27 @@ VpnConfigManager::ClientConfig VpnConfigManager::createConfig(const std::string&
     config.server_override = "";          // No server override
     config.port_override = "";            // No port override  
     config.proto_override = "";           // No protocol override
+    // WireGuard profiles always run on the WireGuard engine
+    const bool wireGuard = WireGuardProfile::isWireGuard(configContent);
+    config.backend = wireGuard ? "wireguard"
+                               : OvpnProfile::parseDirectives(configContent).environment(VpnBackendRegistry::profileVariable);
     config.allowLocalLan = false;         // Security: don't allow local LAN access
     config.tunPersist = false;            // Don't persist tunnel
-    config.autologinSessions = false;     // Disable auto-login for security
+    config.autologinSessions = true;      // Reconnect with server-issued auth tokens (kept in secure memory)
+    config.authCacheLifetime = 8 * 60 * 60;
+    config.zeroCopySend = false;          // Only pays off for large packets on fast links
+    config.memoryBudget = defaultMemoryBudget;
+    config.idleCoalescing = true;         // Keepalives and stats share wakeups once idle
+    config.multipathUplinks.clear();      // Default route only
+    config.multipathScheduler = "min-rtt";
     
     // Security settings
     config.disableClientCert = false;    // Require client certificates
     config.sslDebugLevel = 0;             // No SSL debug in production
     
+    if (!wireGuard) {
+        loadCredentials(config);
+    }
     return config;
 }
 
@@ -55,24 +78,41 @@ VpnConfigManager::ConfigValidation VpnConfigManager::validateConfig(const Client
     ConfigValidation result;
     result.isValid = true;
     result.warnings.clear();
+    const std::string_view content = config.content.view();
+
+    if (WireGuardProfile::isWireGuard(content)) {
+        try {
+            const WireGuardProfile profile = WireGuardProfile::parse(content);
+            if (profile.addresses.empty()) {
+                result.warnings.push_back("Warning: No tunnel Address assigned");
+            }
+            for (const auto& key : profile.ignoredKeys) {
+                result.warnings.push_back("Warning: " + key + " is not supported and will be ignored");
+            }
+        } catch (const std::exception& e) {
+            result.isValid = false;
+            result.errorMessage = e.what();
+        }
+        return result;
+    }
     
     // Basic validation checks for OpenVPN config
-    if (config.content.find("remote ") == std::string::npos) {
+    if (content.find("remote ") == std::string_view::npos) {
         result.isValid = false;
         result.errorMessage = "Configuration missing remote server specification";
         return result;
     }
     
-    if (config.content.find("client") == std::string::npos) {
+    if (content.find("client") == std::string_view::npos) {
         result.isValid = false;
         result.errorMessage = "Configuration not set for client mode";
         return result;
     }
     
     // Check for required certificates/keys
-    bool hasAuth = (config.content.find("cert ") != std::string::npos ||
-                   config.content.find("<cert>") != std::string::npos ||
-                   config.content.find("auth-user-pass") != std::string::npos);
+    bool hasAuth = (content.find("cert ") != std::string_view::npos ||
+                   content.find("<cert>") != std::string_view::npos ||
+                   content.find("auth-user-pass") != std::string_view::npos);
     
     if (!hasAuth) {
         result.isValid = false;
@@ -81,44 +121,202 @@ VpnConfigManager::ConfigValidation VpnConfigManager::validateConfig(const Client
     }
     
     // Check for security warnings
-    if (config.content.find("cipher none") != std::string::npos) {
+    if (content.find("cipher none") != std::string_view::npos) {
         result.warnings.push_back("Warning: No encryption cipher specified");
     }
     
-    if (config.content.find("auth none") != std::string::npos) {
+    if (content.find("auth none") != std::string_view::npos) {
         result.warnings.push_back("Warning: No authentication algorithm specified");
     }
     
-    if (config.content.find("verify-x509-name") == std::string::npos) {
+    if (content.find("verify-x509-name") == std::string_view::npos) {
         result.warnings.push_back("Warning: X.509 name verification not enabled");
     }
+
+    try {
+        const TransportChain layers = TransportChain::fromProfile(OvpnProfile::parseDirectives(content));
+        if (!layers.empty() && config.proto_override.starts_with("quic")) {
+            result.isValid = false;
+            result.errorMessage = "Transport layers cannot be used over QUIC";
+        }
+    } catch (const std::exception& e) {
+        result.isValid = false;
+        result.errorMessage = e.what();
+    }
+
+    if (!config.multipathUplinks.empty()) {
+        for (const auto& uplink : config.multipathUplinks) {
+            if (!MultipathBond::parseUplink(uplink)) {
+                result.isValid = false;
+                result.errorMessage = "Invalid multipath uplink: " + uplink;
+            }
+        }
+        if (!MultipathBond::schedulerFromString(config.multipathScheduler)) {
+            result.isValid = false;
+            result.errorMessage = "Unknown multipath scheduler: " + config.multipathScheduler;
+        }
+        if (config.proto_override.starts_with("tcp") || config.proto_override.starts_with("quic")) {
+            result.warnings.push_back("Warning: Multipath uplinks only apply to UDP remotes");
+        }
+    }
     
     return result;
 }
 
 void VpnConfigManager::saveProfile(const std::string& name, const std::string& configContent) {
     std::string sanitizedName = sanitizeProfileName(name);
-    std::string profilePath = profilesDirectory + "/" + sanitizedName + ".ovpn";
     
     try {
-        std::ofstream profileFile(profilePath, std::ios::binary);
-        if (!profileFile.is_open()) {
-            throw std::runtime_error("Cannot create profile file: " + profilePath);
+        std::string error;
+        std::lock_guard<std::mutex> lock(writeBatchMutex);
+        
+        const SecureString stored = storedForm(configContent, sharedBlockStorage);
+        
+        // Group commit: stage now, flush and rename once in commitWriteBatch
+        if (writeBatchActive) {
+            if (!fileSync::writeFile(stagingPath(sanitizedName), stored.view(), false, error)) {
+                throw std::runtime_error(error);
+            }
+            if (std::find(writeBatch.begin(), writeBatch.end(), sanitizedName) == writeBatch.end()) {
+                writeBatch.push_back(sanitizedName);
+            }
+            if (searchIndexReady) {
+                writeBatchEntries[sanitizedName] = ProfileSearchIndex::describe(sanitizedName, configContent);
+            }
+            return;
         }
         
-        profileFile << configContent;
-        profileFile.close();
+        // Write-ahead to a temp file, flush it, then rename over the profile, so a
+        // crash leaves either the old or the new version, never a truncated one
+        // (blobs the manifest references are flushed first)
+        if (!blobStore->sync() ||
+            !fileSync::writeFile(stagingPath(sanitizedName), stored.view(), true, error) ||
+            !fileSync::replaceFile(stagingPath(sanitizedName), profilePath(sanitizedName), error)) {
+            std::error_code ignored;
+            std::filesystem::remove(stagingPath(sanitizedName), ignored);
+            throw std::runtime_error(error.empty() ? "Cannot flush shared blocks to disk" : error);
+        }
+        removeOtherFormat(sanitizedName);
+        fileSync::syncDirectory(profilesDirectory);
+        if (searchIndexReady) {
+            searchIndex.update(ProfileSearchIndex::describe(sanitizedName, configContent));
+        }
         
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to save profile: " + std::string(e.what()));
     }
 }
 
+void VpnConfigManager::beginWriteBatch() {
+    std::lock_guard<std::mutex> lock(writeBatchMutex);
+    writeBatchActive = true;
+}
+
+void VpnConfigManager::commitWriteBatch() {
+    std::vector<std::string> names;
+    std::vector<std::string> errors;
+    {
+        std::lock_guard<std::mutex> lock(writeBatchMutex);
+        writeBatchActive = false;
+        names.swap(writeBatch);
+        errors = publishStagedProfiles(names);
+        
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            auto entry = writeBatchEntries.find(names[i]);
+            if (errors[i].empty() && entry != writeBatchEntries.end()) {
+                searchIndex.update(std::move(entry->second));
+            }
+        }
+        writeBatchEntries.clear();
+    }
+    
+    std::string failed;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (!errors[i].empty()) {
+            failed += (failed.empty() ? "" : "; ") + errors[i];
+        }
+    }
+    if (!failed.empty()) {
+        throw std::runtime_error("Failed to save profiles: " + failed);
+    }
+}
+
 std::string VpnConfigManager::loadProfile(const std::string& name) {
+    return openProfile(name).assemble();
+}
+
+ProfileManifest VpnConfigManager::openProfile(const std::string& name) {
     std::string sanitizedName = sanitizeProfileName(name);
-    std::string profilePath = profilesDirectory + "/" + sanitizedName + ".ovpn";
     
-    return loadConfigFromFile(profilePath);
+    // A manifest wins over a plain copy left by a crash between rename and cleanup
+    const std::string manifestPath = profilesDirectory + "/" + sanitizedName + manifestExtension;
+    if (std::filesystem::exists(manifestPath)) {
+        return ProfileManifest(loadConfigFromFile(manifestPath), *blobStore);
+    }
+    return ProfileManifest(loadConfigFromFile(profilesDirectory + "/" + sanitizedName + plainExtension), *blobStore);
+}
+
+void VpnConfigManager::setSharedBlockStorage(bool enabled) {
+    std::lock_guard<std::mutex> lock(writeBatchMutex);
+    sharedBlockStorage = enabled;
+}
+
+std::size_t VpnConfigManager::collectUnusedBlobs() {
+    // Saves and imports wait, and profiles staged in an open batch keep their blobs
+    std::unique_lock<std::shared_mutex> staging(stagingMutex);
+    std::lock_guard<std::mutex> lock(writeBatchMutex);
+    std::set<std::string> referenced;
+    try {
+        for (const auto& name : listProfiles()) {
+            referenced.merge(openProfile(name).referencedBlobs());
+        }
+        for (const auto& name : writeBatch) {
+            referenced.merge(ProfileManifest(loadConfigFromFile(stagingPath(name)), *blobStore).referencedBlobs());
+        }
+    } catch (const std::exception& e) {
+        // An unreadable manifest must not cost other profiles their blobs
+        return 0;
+    }
+    return blobStore->collectGarbage(referenced);
+}
+
+std::vector<std::string> VpnConfigManager::searchProfiles(const std::string& query, std::size_t limit) {
+    ensureSearchIndex();
+    return searchIndex.search(query, limit);
+}
+
+std::optional<ProfileSearchIndex::Entry> VpnConfigManager::profileInfo(const std::string& name) {
+    ensureSearchIndex();
+    return searchIndex.find(name);
+}
+
+std::vector<ProfileSearchIndex::Entry> VpnConfigManager::searchProfileEntries(const std::string& query,
+                                                                              std::size_t limit) {
+    ensureSearchIndex();
+    return searchIndex.searchEntries(query, limit);
+}
+
+void VpnConfigManager::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    blobStore->setMemoryBudget(std::move(budget));
+}
+
+void VpnConfigManager::ensureSearchIndex() {
+    if (searchIndexReady) {
+        return;
+    }
+    // Saves wait for the initial scan, so none of them can slip past it
+    std::lock_guard<std::mutex> lock(writeBatchMutex);
+    if (searchIndexReady) {
+        return;
+    }
+    for (const auto& name : listProfiles()) {
+        try {
+            searchIndex.update(ProfileSearchIndex::describe(name, openProfile(name).text()));
+        } catch (const std::exception& e) {
+            // Unreadable profiles stay out of search results
+        }
+    }
+    searchIndexReady = true;
 }
 
 std::vector<std::string> VpnConfigManager::listProfiles() {
@@ -128,13 +326,15 @@ std::vector<std::string> VpnConfigManager::listProfiles() {
         std::filesystem::directory_iterator dirIter(profilesDirectory);
         
         for (const auto& entry : dirIter) {
-            if (entry.is_regular_file() && entry.path().extension() == ".ovpn") {
+            const auto extension = entry.path().extension();
+            if (entry.is_regular_file() && (extension == plainExtension || extension == manifestExtension)) {
                 std::string filename = entry.path().stem().string();
                 profiles.push_back(filename);
             }
         }
         
         std::sort(profiles.begin(), profiles.end());
+        profiles.erase(std::unique(profiles.begin(), profiles.end()), profiles.end());
         
     } catch (const std::exception& e) {
         // Directory might not exist or be accessible
@@ -146,37 +346,306 @@ std::vector<std::string> VpnConfigManager::listProfiles() {
 
 void VpnConfigManager::deleteProfile(const std::string& name) {
     std::string sanitizedName = sanitizeProfileName(name);
-    std::string profilePath = profilesDirectory + "/" + sanitizedName + ".ovpn";
     
     try {
-        if (std::filesystem::exists(profilePath)) {
-            std::filesystem::remove(profilePath);
-        } else {
+        // Shared blobs stay until collectUnusedBlobs; other profiles may use them
+        bool removed = std::filesystem::remove(profilesDirectory + "/" + sanitizedName + plainExtension);
+        removed = std::filesystem::remove(profilesDirectory + "/" + sanitizedName + manifestExtension) || removed;
+        if (!removed) {
             throw std::runtime_error("Profile does not exist: " + name);
         }
+        std::lock_guard<std::mutex> lock(writeBatchMutex);
+        searchIndex.remove(sanitizedName);
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to delete profile: " + std::string(e.what()));
     }
 }
 
+void VpnConfigManager::loadCredentials(ClientConfig& config) {
+    const OvpnProfile profile = OvpnProfile::parse(config.content.view());
+
+    // auth-user-pass: username on the first line, password on the second
+    std::optional<SecureString> userPass;
+    if (profile.hasInlineBlock("auth-user-pass")) {
+        userPass = profile.secretBlock("auth-user-pass");
+    } else if (auto args = profile.directiveArgs("auth-user-pass"); !args.empty()) {
+        userPass = readSecretFile(args[0]);
+    }
+    if (userPass) {
+        std::string_view text = userPass->view();
+        const auto newline = text.find('\n');
+        std::string_view user = text.substr(0, newline);
+        std::string_view pass = newline == std::string_view::npos ? std::string_view() : text.substr(newline + 1);
+        pass = pass.substr(0, pass.find('\n'));
+        if (user.ends_with('\r')) {
+            user.remove_suffix(1);
+        }
+        if (pass.ends_with('\r')) {
+            pass.remove_suffix(1);
+        }
+        config.username.assign(user);
+        config.password.assign(pass);
+    }
+
+    // askpass <file> unlocks an encrypted private key
+    if (auto args = profile.directiveArgs("askpass"); !args.empty()) {
+        if (auto passphrase = readSecretFile(args[0])) {
+            std::string_view text = passphrase->view();
+            text = text.substr(0, text.find_first_of("\r\n"));
+            config.privateKeyPassword.assign(text);
+        }
+    }
+}
+
+std::vector<VpnConfigManager::ImportResult> VpnConfigManager::importProfiles(
+    const std::vector<std::string>& configPaths, ImportProgressCallback progress) {
+    ensureProfilesDirectory();
+    const std::size_t total = configPaths.size();
+    std::vector<ImportResult> results(total);
+
+    // Names are assigned up front so two sources that sanitize alike never share a file
+    std::set<std::string> takenNames;
+    for (std::size_t i = 0; i < total; ++i) {
+        results[i].sourcePath = configPaths[i];
+        const std::string base = sanitizeProfileName(std::filesystem::path(configPaths[i]).stem().string());
+        std::string name = base;
+        for (int suffix = 2; !takenNames.insert(name).second; ++suffix) {
+            name = sanitizeProfileName(base.substr(0, 40) + "_" + std::to_string(suffix));
+        }
+        results[i].profileName = name;
+    }
+
+    // Blob collection waits until the staged manifests are published; saves
+    // and batches only wait for the publish itself. Staging files of their
+    // own keep this import apart from saves and imports of the same names.
+    std::shared_lock<std::shared_mutex> staging(stagingMutex);
+    const std::uint64_t importId = ++importCount;
+    bool shared = true;
+    {
+        std::lock_guard<std::mutex> lock(writeBatchMutex);
+        shared = sharedBlockStorage;
+    }
+
+    // Phase 1: read, normalize, validate and stage every profile in parallel
+    WorkerPool pool;
+    std::vector<std::future<void>> staged;
+    std::vector<ProfileSearchIndex::Entry> indexEntries(total);
+    staged.reserve(total);
+    for (std::size_t i = 0; i < total; ++i) {
+        staged.push_back(pool.submit([this, shared, importId, &result = results[i], &indexEntry = indexEntries[i]]() {
+            try {
+                ClientConfig config;
+                std::string source = loadConfigFromFile(result.sourcePath);
+                std::string normalized = normalizeProfile(source);
+                config.content.assign(normalized);
+                secureWipe(source.data(), source.size());
+                secureWipe(normalized.data(), normalized.size());
+                auto validation = validateConfig(config);
+                if (!validation.isValid) {
+                    result.errorMessage = validation.errorMessage;
+                    return;
+                }
+                result.warnings = std::move(validation.warnings);
+                result.success = fileSync::writeFile(importStagingPath(result.profileName, importId),
+                                                     storedForm(config.content.view(), shared).view(), false,
+                                                     result.errorMessage);
+                indexEntry = ProfileSearchIndex::describe(result.profileName, config.content.view());
+            } catch (const std::exception& e) {
+                result.errorMessage = e.what();
+            }
+        }));
+    }
+    for (std::size_t i = 0; i < total; ++i) {
+        staged[i].get();
+        if (progress) {
+            progress(i + 1, total);
+        }
+    }
+
+    // Renames onto the shared staging names are cheap; flushes come with the publish
+    std::lock_guard<std::mutex> lock(writeBatchMutex);
+    for (auto& result : results) {
+        if (result.success) {
+            std::error_code renameError;
+            std::filesystem::rename(importStagingPath(result.profileName, importId), stagingPath(result.profileName),
+                                    renameError);
+            if (renameError) {
+                result.success = false;
+                result.errorMessage = "Cannot stage profile: " + renameError.message();
+            }
+        } else {
+            std::error_code ignored;
+            std::filesystem::remove(importStagingPath(result.profileName, importId), ignored);
+        }
+    }
+
+    // An open write batch takes the staged profiles along and publishes them on commit
+    if (writeBatchActive) {
+        for (std::size_t i = 0; i < total; ++i) {
+            if (!results[i].success) {
+                continue;
+            }
+            const auto& name = results[i].profileName;
+            if (std::find(writeBatch.begin(), writeBatch.end(), name) == writeBatch.end()) {
+                writeBatch.push_back(name);
+            }
+            if (searchIndexReady) {
+                writeBatchEntries[name] = std::move(indexEntries[i]);
+            }
+        }
+        return results;
+    }
+
+    // Phase 2: publish everything with one batched flush
+    std::vector<std::string> stagedNames;
+    std::vector<ImportResult*> stagedResults;
+    for (auto& result : results) {
+        if (result.success) {
+            stagedNames.push_back(result.profileName);
+            stagedResults.push_back(&result);
+        }
+    }
+    auto errors = publishStagedProfiles(stagedNames);
+    for (std::size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            stagedResults[i]->success = false;
+            stagedResults[i]->errorMessage = std::move(errors[i]);
+        }
+    }
+
+    if (searchIndexReady) {
+        for (std::size_t i = 0; i < total; ++i) {
+            if (results[i].success) {
+                searchIndex.update(std::move(indexEntries[i]));
+            }
+        }
+    }
+
+    return results;
+}
+
+std::vector<std::string> VpnConfigManager::publishStagedProfiles(const std::vector<std::string>& names) {
+    std::vector<std::string> errors(names.size());
+    if (names.empty()) {
+        return errors;
+    }
+
+    // One flush for the whole batch instead of an fsync per profile
+    const bool blobsSynced = blobStore->sync();
+    if (!fileSync::syncFilesystem(profilesDirectory)) {
+        WorkerPool pool;
+        std::vector<std::future<void>> flushes;
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            flushes.push_back(pool.submit([this, &names, &errors, i]() {
+                if (!fileSync::syncFile(stagingPath(names[i]))) {
+                    errors[i] = "Cannot flush profile to disk: " + names[i];
+                }
+            }));
+        }
+        for (auto& flush : flushes) {
+            flush.get();
+        }
+    }
+
+    // Data is durable, so each rename flips a profile from old to new with nothing in between
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        const auto staging = stagingPath(names[i]);
+        if (errors[i].empty() && !blobsSynced) {
+            errors[i] = "Cannot flush shared blocks to disk";
+        }
+        if (errors[i].empty() && fileSync::replaceFile(staging, profilePath(names[i]), errors[i])) {
+            removeOtherFormat(names[i]);
+        }
+        if (!errors[i].empty()) {
+            std::error_code ignored;
+            std::filesystem::remove(staging, ignored);
+        }
+    }
+    fileSync::syncDirectory(profilesDirectory);
+    return errors;
+}
+
+std::string VpnConfigManager::normalizeProfile(std::string_view content) {
+    // UTF-8 BOM, CRLF line endings and trailing blanks are common in provider bundles
+    if (content.starts_with("\xEF\xBB\xBF")) {
+        content.remove_prefix(3);
+    }
+
+    std::string normalized;
+    normalized.reserve(content.size() + 1);
+    std::size_t lineStart = 0;
+    while (lineStart < content.size()) {
+        auto lineEnd = content.find('\n', lineStart);
+        auto line = content.substr(lineStart, lineEnd == std::string_view::npos ? std::string_view::npos
+                                                                                : lineEnd - lineStart);
+        const auto last = line.find_last_not_of(" \t\r");
+        normalized.append(line.substr(0, last == std::string_view::npos ? 0 : last + 1));
+        normalized.push_back('\n');
+        if (lineEnd == std::string_view::npos) {
+            break;
+        }
+        lineStart = lineEnd + 1;
+    }
+    return normalized;
+}
+
+std::string VpnConfigManager::profilePath(const std::string& sanitizedName) const {
+    return profilesDirectory + "/" + sanitizedName + (sharedBlockStorage ? manifestExtension : plainExtension);
+}
+
+void VpnConfigManager::removeOtherFormat(const std::string& sanitizedName) {
+    std::error_code ignored;
+    std::filesystem::remove(profilesDirectory + "/" + sanitizedName +
+                            (sharedBlockStorage ? plainExtension : manifestExtension), ignored);
+}
+
+SecureString VpnConfigManager::storedForm(std::string_view content, bool shared) {
+    return shared ? ProfileManifest::build(content, *blobStore) : SecureString(content);
+}
+
+std::string VpnConfigManager::stagingPath(const std::string& sanitizedName) const {
+    // Hidden and without the .ovpn extension, so listProfiles never sees it
+    return profilesDirectory + "/." + sanitizedName + ".ovpn.tmp";
+}
+
+std::string VpnConfigManager::importStagingPath(const std::string& sanitizedName, std::uint64_t importId) const {
+    // Same pattern, so removeStagedFiles cleans up after an interrupted import too
+    return profilesDirectory + "/." + sanitizedName + "." + std::to_string(importId) + ".ovpn.tmp";
+}
+
 void VpnConfigManager::ensureProfilesDirectory() {
     try {
         if (!std::filesystem::exists(profilesDirectory)) {
             std::filesystem::create_directories(profilesDirectory);
         }
+
     } catch (const std::exception& e) {
         // If we can't create the directory, profiles won't work
         // but the rest of the functionality should still work
     }
 }
 
+void VpnConfigManager::removeStagedFiles() {
+    // Staged writes that were never renamed belong to an interrupted save
+    try {
+        for (const auto& entry : std::filesystem::directory_iterator(profilesDirectory)) {
+            const std::string filename = entry.path().filename().string();
+            if (filename.starts_with(".") && filename.ends_with(".ovpn.tmp")) {
+                std::filesystem::remove(entry.path());
+            }
+        }
+    } catch (const std::exception& e) {
+        // Leftovers are harmless; they never show up as profiles
+    }
+}
+
 std::string VpnConfigManager::sanitizeProfileName(const std::string& name) {
     std::string sanitized = name;
     
     // Remove or replace invalid filename characters
     const std::string invalidChars = "<>:\"/\\|?*";
     for (char& c : sanitized) {
-        if (invalidChars.find(c) != std::string::npos) {
+        if (invalidChars.find(c) != std::string_view::npos) {
             c = '_';
         }
     }
@@ -1,5 +1,9 @@
 #pragma once
 import std;
+#include "blobStore.h"
+#include "profileManifest.h"
+#include "profileSearchIndex.h"
+#include "secureMemory.h"
 
 class VpnConfigManager {
 public:
@@ -9,21 +13,61 @@ public:
         std::vector<std::string> warnings;
     };
 
+    // Memory budget ClientConfig starts from: SIAVPN_MEMORY_BUDGET_MB (set by
+    // CMake for Android and iOS builds), otherwise unbounded
+    #ifdef SIAVPN_MEMORY_BUDGET_MB
+    static constexpr std::size_t defaultMemoryBudget = std::size_t{SIAVPN_MEMORY_BUDGET_MB} * 1024 * 1024;
+    #else
+    static constexpr std::size_t defaultMemoryBudget = 0;
+    #endif
+
     // Configuration structure without OpenVPN dependencies
     struct ClientConfig {
-        std::string content;
+        SecureString content;  // the profile, inline keys included
         std::string compressionMode = "adaptive";
         int tcpQueueLimit = 64;
         std::string server_override;
         std::string port_override;
         std::string proto_override;
+        std::string backend;                  // VpnBackendRegistry name; empty for the default engine
         bool allowLocalLan = false;
         bool tunPersist = false;
         bool autologinSessions = false;
+        int authCacheLifetime = 8 * 60 * 60;  // seconds credentials and auth tokens stay cached
+        bool zeroCopySend = false;            // MSG_ZEROCOPY for data channel sends (Linux, UDP)
+        bool idleCoalescing = true;           // fewer wakeups while the tunnel is idle
+        // Uplinks bonded for UDP remotes, "wlan0" or "wwan0=20" (Mbit/s); empty uses the default route
+        std::vector<std::string> multipathUplinks;
+        std::string multipathScheduler = "min-rtt";  // or "weighted", by capacity
+        // Bytes shared by packet buffers, DNS queues and cache, the log ring and
+        // profile cache (see MemoryBudget); 0 leaves them unbounded
+        std::size_t memoryBudget = defaultMemoryBudget;
         bool disableClientCert = false;
         int sslDebugLevel = 0;
+
+        // Credentials live in the locked secure arena and are wiped when released
+        SecureString username;
+        SecureString password;
+        SecureString privateKeyPassword;
     };
 
+    // Outcome of importing one profile in a bulk import
+    struct ImportResult {
+        std::string sourcePath;
+        std::string profileName;
+        bool success = false;
+        std::string errorMessage;
+        std::vector<std::string> warnings;
+    };
+
+    // Called on the importing thread as profiles complete, in input order.
+    // Blob collection waits for the import meanwhile, so it must not call
+    // collectUnusedBlobs().
+    using ImportProgressCallback = std::function<void(std::size_t completed, std::size_t total)>;
+
+    VpnConfigManager();
+    ~VpnConfigManager();
+
     // Configuration operations
     std::string loadConfigFromFile(const std::string& configPath);
     ClientConfig createConfig(const std::string& configContent);
@@ -32,11 +76,73 @@ public:
     // Profile management
     void saveProfile(const std::string& name, const std::string& configContent);
     std::string loadProfile(const std::string& name);
+    // Lazy view of a stored profile; shared blocks load on first use and are borrowed, not copied
+    ProfileManifest openProfile(const std::string& name);
     std::vector<std::string> listProfiles();
     void deleteProfile(const std::string& name);
+    
+    // Group commit for bulk saves: between begin and commit, saveProfile only
+    // stages files; commit flushes them all at once and renames them into
+    // place. Until then loadProfile returns the previous version.
+    void beginWriteBatch();
+    void commitWriteBatch();
+    
+    // Shared block storage (default) saves profiles as small manifests whose
+    // inline blocks (<ca>, <tls-crypt>, ...) live once in a content-addressed
+    // store. Affects profiles saved afterwards; both formats always load.
+    void setSharedBlockStorage(bool enabled);
+    // Deletes stored blocks no profile references any more; returns the count
+    std::size_t collectUnusedBlobs();
+    
+    // Validates, normalizes and writes many .ovpn files in parallel. Profiles are
+    // named after their file stem; each is replaced atomically, with one batched
+    // flush for the whole import. Invalid profiles are reported and skipped.
+    // Inside a write batch the profiles are only staged and published on commit.
+    std::vector<ImportResult> importProfiles(const std::vector<std::string>& configPaths,
+                                             ImportProgressCallback progress = {});
+    
+    // Profile search by name, remote host, port, protocol or country. The index
+    // is built from disk on first use and then kept current by save, delete
+    // and import. See ProfileSearchIndex for the query syntax. Once built,
+    // searches only take the index's own lock, never the one saves and
+    // imports hold.
+    std::vector<std::string> searchProfiles(const std::string& query, std::size_t limit = 0);
+    std::optional<ProfileSearchIndex::Entry> profileInfo(const std::string& name);
+    // Matches with their metadata, from one snapshot of the index
+    std::vector<ProfileSearchIndex::Entry> searchProfileEntries(const std::string& query, std::size_t limit = 0);
+
+    // Bounds the blocks kept loaded between profile opens (MemoryBudget::Subsystem::ProfileCache)
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
 
 private:
+    static constexpr const char* plainExtension = ".ovpn";
+    static constexpr const char* manifestExtension = ".ovpnm";
+    
     std::string profilesDirectory;
+    std::unique_ptr<BlobStore> blobStore;
+    bool sharedBlockStorage = true;
+    bool writeBatchActive = false;
+    std::vector<std::string> writeBatch;
+    std::map<std::string, ProfileSearchIndex::Entry> writeBatchEntries;
+    std::mutex writeBatchMutex;
+    // Imports stage under a shared lock and blob collection takes it alone,
+    // so no blob is collected while a staged manifest waits to reference it.
+    // Taken before writeBatchMutex.
+    std::shared_mutex stagingMutex;
+    std::atomic<std::uint64_t> importCount{0};  // keeps concurrent imports' staging files apart
+    ProfileSearchIndex searchIndex;
+    std::atomic<bool> searchIndexReady{false};  // set under writeBatchMutex, read without it
     void ensureProfilesDirectory();
+    void removeStagedFiles();
     std::string sanitizeProfileName(const std::string& name);
+    std::string profilePath(const std::string& sanitizedName) const;
+    std::string stagingPath(const std::string& sanitizedName) const;
+    std::string importStagingPath(const std::string& sanitizedName, std::uint64_t importId) const;
+    void removeOtherFormat(const std::string& sanitizedName);
+    // The file content for a profile: a manifest with shared storage, else the text
+    SecureString storedForm(std::string_view content, bool shared);
+    std::vector<std::string> publishStagedProfiles(const std::vector<std::string>& names);
+    static std::string normalizeProfile(std::string_view content);
+    void ensureSearchIndex();
+    void loadCredentials(ClientConfig& config);
 };
\ No newline at end of file
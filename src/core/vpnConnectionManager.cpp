@@ -1,21 +1,17 @@
 import std;
 #include "vpnConnectionManager.h"
+#include "ovpnProfile.h"
+#include "socketUtil.h"
 
 VpnConnectionManager::VpnConnectionManager() 
-    : vpnClient(std::make_unique<OpenVpnClient>())
+    : budget(std::make_shared<MemoryBudget>(VpnConfigManager::defaultMemoryBudget))
     , configManager(std::make_unique<VpnConfigManager>())
     , currentStatus(VpnStatus::Disconnected)
     , shouldStop(false)
     , connectionInProgress(false) {
     
-    // Set up event handlers
-    vpnClient->setEventHandler([this](const std::string& eventName, const std::string& info) {
-        handleConnectionEvent(eventName, info);
-    });
-    
-    vpnClient->setLogHandler([this](int level, const std::string& message) {
-        handleLogMessage(level, message);
-    });
+    configManager->setMemoryBudget(budget);
+    selectBackend(VpnBackendRegistry::defaultBackend);
 }
 
 VpnConnectionManager::~VpnConnectionManager() {
@@ -23,6 +19,15 @@ VpnConnectionManager::~VpnConnectionManager() {
     if (connectionThread.joinable()) {
         connectionThread.join();
     }
+    if (teardownThread.joinable()) {
+        teardownThread.join();
+    }
+    // Whatever the engine reports while shutting down still reaches a live manager
+    std::shared_ptr<VpnBackend> engine;
+    {
+        std::lock_guard<std::mutex> lock(backendMutex);
+        engine = std::move(backend);
+    }
 }
 
 std::future<bool> VpnConnectionManager::connect(const std::string& configPath) {
@@ -41,8 +46,25 @@ std::future<bool> VpnConnectionManager::connect(const std::string& configPath) {
     });
 }
 
+std::future<bool> VpnConnectionManager::connectFastest(const std::vector<std::string>& profileNames) {
+    if (connectionInProgress) {
+        return std::async(std::launch::deferred, []() { return false; });
+    }
+    
+    updateStatus(VpnStatus::Connecting, "Probing servers...");
+    connectionInProgress = true;
+    shouldStop = false;
+
+    return std::async(std::launch::async, [this, profileNames]() {
+        bool result = performFastestConnection(profileNames);
+        connectionInProgress = false;
+        return result;
+    });
+}
+
 void VpnConnectionManager::disconnect() {
     if (currentStatus == VpnStatus::Disconnected) {
+        clearSensitiveData();
         return;
     }
 
@@ -51,13 +73,16 @@ void VpnConnectionManager::disconnect() {
 
     try {
         // Signal VPN client to stop
-        vpnClient->stopConnection();
+        currentBackend()->stop();
         
         // Wait for worker thread to complete
         if (connectionThread.joinable()) {
             connectionThread.join();
         }
         
+        // Cached passwords and auth tokens don't outlive an explicit disconnect
+        clearSensitiveData();
+        
         updateStatus(VpnStatus::Disconnected, "Disconnected successfully");
         
     } catch (const std::exception& e) {
@@ -67,8 +92,8 @@ void VpnConnectionManager::disconnect() {
 
 void VpnConnectionManager::pause() {
     try {
-        vpnClient->pauseConnection();
-        updateStatus(VpnStatus::Disconnected, "Connection paused");
+        // The status follows the client's PAUSED event once its thread has parked
+        currentBackend()->pause();
     } catch (const std::exception& e) {
         updateStatus(VpnStatus::Error, "Failed to pause: " + std::string(e.what()));
     }
@@ -76,8 +101,7 @@ void VpnConnectionManager::pause() {
 
 void VpnConnectionManager::resume() {
     try {
-        vpnClient->resumeConnection();
-        updateStatus(VpnStatus::Connecting, "Resuming connection...");
+        currentBackend()->resume();
     } catch (const std::exception& e) {
         updateStatus(VpnStatus::Error, "Failed to resume: " + std::string(e.what()));
     }
@@ -85,7 +109,7 @@ void VpnConnectionManager::resume() {
 
 void VpnConnectionManager::reconnect() {
     try {
-        vpnClient->reconnectConnection();
+        currentBackend()->reconnect();
         updateStatus(VpnStatus::Connecting, "Reconnecting...");
     } catch (const std::exception& e) {
         updateStatus(VpnStatus::Error, "Failed to reconnect: " + std::string(e.what()));
@@ -101,6 +125,71 @@ std::string VpnConnectionManager::getLastError() const {
     return lastError;
 }
 
+std::string VpnConnectionManager::tunnelInterface() const {
+    std::string name = currentBackend()->tunnelInterface();
+    if (name.empty()) {
+        const auto args = OvpnProfile::parseDirectives(currentConfig.content.view()).directiveArgs("dev");
+        const std::string dev = args.empty() ? "tun" : args[0];
+        // A bare device type asks for the first free unit
+        name = dev == "tun" || dev == "tap" ? dev + "0" : dev;
+    }
+    // The name comes from an imported profile and ends up in ip/nft arguments
+    if (!socketUtil::isInterfaceName(name)) {
+        std::cerr << "[VPN] Ignoring invalid tunnel device name: " << name << '\n';
+        return {};
+    }
+    return name;
+}
+
+bool VpnConnectionManager::tunnelDeviceReady() const {
+    return !currentBackend()->needsTunnelDevice() || socketUtil::interfaceExists(tunnelInterface());
+}
+
+std::vector<std::string> VpnConnectionManager::pushedDnsServers() const {
+    return currentBackend()->getPushedDnsServers();
+}
+
+std::optional<sockaddr_storage> VpnConnectionManager::serverAddress() const {
+    return currentBackend()->getServerAddress();
+}
+
+bool VpnConnectionManager::tunnelCarriesIpv6() const {
+    return currentBackend()->tunnelCarriesIpv6();
+}
+
+std::vector<ServerProber::Score> VpnConnectionManager::serverRanking(const std::vector<std::string>& profileNames) {
+    return serverProber.ranking(probeTargets(profileNames));
+}
+
+void VpnConnectionManager::clearSensitiveData() {
+    currentConfig.username.clear();
+    currentConfig.password.clear();
+    currentConfig.privateKeyPassword.clear();
+    currentBackend()->clearSensitiveData();
+}
+
+void VpnConnectionManager::setImpairmentScenario(const std::string& scenarioPath) {
+    if (scenarioPath.empty()) {
+        impairmentScenario.reset();
+        currentBackend()->setImpairmentScenario(std::nullopt);
+        return;
+    }
+    
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    try {
+        auto scenario = ImpairmentScenario::load(scenarioPath);
+        handleLogMessage(2, "Network impairment scenario '" + scenario.name + "' enabled");
+        // Kept for engines swapped in later
+        impairmentScenario = scenario;
+        currentBackend()->setImpairmentScenario(std::move(scenario));
+    } catch (const std::exception& e) {
+        handleLogMessage(1, "Failed to load impairment scenario: " + std::string(e.what()));
+    }
+    #else
+    handleLogMessage(1, "Impairment scenario ignored: built without SIAVPN_WITH_IMPAIRMENT");
+    #endif
+}
+
 void VpnConnectionManager::setStatusCallback(std::function<void(VpnStatus, const std::string&)> callback) {
     statusCallback = std::move(callback);
 }
@@ -126,6 +215,69 @@ bool VpnConnectionManager::performConnection(const std::string& configPath) {
     }
 }
 
+bool VpnConnectionManager::performFastestConnection(const std::vector<std::string>& profileNames) {
+    try {
+        // Phase 1: Probe every remote and pick the best
+        const auto targets = probeTargets(profileNames);
+        if (targets.empty()) {
+            handleConnectionComplete(false, "No stored profile has a remote server");
+            return false;
+        }
+        const auto ranking = serverProber.probe(targets, &shouldStop);
+        if (shouldStop) {
+            handleConnectionComplete(false, "Connection cancelled by user");
+            return false;
+        }
+        if (ranking.empty() || !ranking.front().reachable) {
+            handleConnectionComplete(false, "No server answered the latency probes");
+            return false;
+        }
+        const auto& best = ranking.front();
+        handleLogMessage(3, "Fastest server: " + best.profileName + " (" + best.remote.host + ":" + best.remote.port +
+                            "/" + best.remote.proto + ", " + std::to_string(best.rtt.count() / 1000) + " ms, " +
+                            std::to_string(static_cast<int>(best.loss * 100)) + "% loss)");
+
+        // Phase 2: Load the chosen profile pinned to the measured remote
+        updateStatus(VpnStatus::Connecting, "Loading profile " + best.profileName + "...");
+        if (!applyConfiguration(configManager->loadProfile(best.profileName))) {
+            return false;
+        }
+        currentConfig.server_override = best.remote.host;
+        currentConfig.port_override = best.remote.port;
+        currentConfig.proto_override = best.remote.proto;
+
+        // Phase 3: Connect as usual
+        if (!initiateConnection()) {
+            return false;
+        }
+        return waitForConnectionCompletion();
+
+    } catch (const std::exception& e) {
+        handleConnectionComplete(false, "Connection error: " + std::string(e.what()));
+        return false;
+    }
+}
+
+std::vector<ServerProber::Target> VpnConnectionManager::probeTargets(const std::vector<std::string>& profileNames) {
+    std::vector<ServerProber::Target> targets;
+    for (const auto& name : profileNames.empty() ? configManager->listProfiles() : profileNames) {
+        try {
+            // Parsed in full: the tls-auth / tls-crypt key is an inline block,
+            // which the stored manifest may keep in the blob store
+            std::string text = configManager->openProfile(name).assemble();
+            const auto profile = OvpnProfile::parse(text);
+            secureWipe(text.data(), text.size());
+            const auto wrapKey = ControlWrap::keyFromProfile(profile);
+            for (const auto& remote : profile.remotes()) {
+                targets.push_back({name, remote, wrapKey});
+            }
+        } catch (const std::exception& e) {
+            handleLogMessage(2, "Skipping profile " + name + ": " + e.what());
+        }
+    }
+    return targets;
+}
+
 bool VpnConnectionManager::prepareConfiguration(const std::string& configPath) {
     try {
         updateStatus(VpnStatus::Connecting, "Loading configuration...");
@@ -137,8 +289,19 @@ bool VpnConnectionManager::prepareConfiguration(const std::string& configPath) {
             return false;
         }
 
+        return applyConfiguration(configContent);
+
+    } catch (const std::exception& e) {
+        handleConnectionComplete(false, "Configuration preparation failed: " + std::string(e.what()));
+        return false;
+    }
+}
+
+bool VpnConnectionManager::applyConfiguration(const std::string& configContent) {
+    try {
         // Create configuration object
         currentConfig = configManager->createConfig(configContent);
+        budget->setTotal(currentConfig.memoryBudget);
         
         // Validate configuration
         auto validation = configManager->validateConfig(currentConfig);
@@ -165,10 +328,17 @@ bool VpnConnectionManager::initiateConnection() {
     try {
         updateStatus(VpnStatus::Connecting, "Establishing connection...");
 
-        // Start connection using the VPN client
-        bool started = vpnClient->startConnection(currentConfig.content);
+        // An engine stopped after a failed tunnel setup must be idle before it starts again
+        if (teardownThread.joinable()) {
+            teardownThread.join();
+        }
+
+        // Start connection using the engine the profile asks for
+        selectBackend(currentConfig.backend.empty() ? VpnBackendRegistry::defaultBackend : currentConfig.backend);
+        const auto engine = currentBackend();
+        bool started = engine->start(currentConfig);
         if (!started) {
-            std::string error = vpnClient->getLastError();
+            std::string error = engine->getLastError();
             handleConnectionComplete(false, "Failed to start connection: " + error);
             return false;
         }
@@ -184,16 +354,22 @@ bool VpnConnectionManager::initiateConnection() {
 
 bool VpnConnectionManager::waitForConnectionCompletion() {
     try {
-        std::unique_lock<std::mutex> lock(statusMutex);
         auto timeout = std::chrono::seconds(30);
         
+        // updateStatus takes statusMutex itself, so it is called without holding it
         updateStatus(VpnStatus::Connecting, "Waiting for connection establishment...");
         
-        bool completed = statusCv.wait_for(lock, timeout, [this]() {
-            return currentStatus == VpnStatus::Connected || 
-                   currentStatus == VpnStatus::Error ||
-                   shouldStop;
-        });
+        bool completed = false;
+        VpnStatus reached = VpnStatus::Connecting;
+        {
+            std::unique_lock<std::mutex> lock(statusMutex);
+            completed = statusCv.wait_for(lock, timeout, [this]() {
+                return currentStatus == VpnStatus::Connected || 
+                       currentStatus == VpnStatus::Error ||
+                       shouldStop;
+            });
+            reached = currentStatus;
+        }
 
         if (shouldStop) {
             handleConnectionComplete(false, "Connection cancelled by user");
@@ -205,12 +381,12 @@ bool VpnConnectionManager::waitForConnectionCompletion() {
             return false;
         }
 
-        if (currentStatus == VpnStatus::Error) {
+        if (reached == VpnStatus::Error) {
             // Error details should already be set
             return false;
         }
         
-        return currentStatus == VpnStatus::Connected;
+        return reached == VpnStatus::Connected;
 
     } catch (const std::exception& e) {
         handleConnectionComplete(false, "Error waiting for connection: " + std::string(e.what()));
@@ -219,9 +395,29 @@ bool VpnConnectionManager::waitForConnectionCompletion() {
 }
 
 void VpnConnectionManager::handleConnectionEvent(const std::string& eventName, const std::string& info) {
-    if (eventName == "CONNECTED") {
+    if ((eventName == "CONNECTED" || eventName == "RESUMED") && !tunnelDeviceReady()) {
+        // The session is up but nothing carries traffic through it (the device
+        // was never created, or went away while paused). The engine is stopped
+        // so the next connect() finds it idle; this is its own thread, which
+        // stop() joins, so that happens on another one.
+        handleConnectionComplete(false, "Session established, but tunnel device '" + tunnelInterface() +
+                                        "' does not exist: traffic is not tunneled");
+        if (teardownThread.joinable()) {
+            teardownThread.join();
+        }
+        tearingDown = true;
+        teardownThread = std::thread([this, engine = currentBackend()]() {
+            engine->stop();
+            tearingDown = false;
+        });
+        
+    } else if (eventName == "CONNECTED") {
         updateStatus(VpnStatus::Connected, "VPN connection established");
         
+    } else if (eventName == "DISCONNECTED" && tearingDown) {
+        // The error that made us stop the engine stays the status
+        handleLogMessage(3, "Engine stopped: " + (info.empty() ? eventName : info));
+        
     } else if (eventName == "DISCONNECTED") {
         updateStatus(VpnStatus::Disconnected, info.empty() ? "Disconnected" : info);
         
@@ -232,10 +428,18 @@ void VpnConnectionManager::handleConnectionEvent(const std::string& eventName, c
         updateStatus(VpnStatus::Connecting, info);
         
     } else if (eventName == "PAUSED") {
-        updateStatus(VpnStatus::Disconnected, "Connection paused");
+        updateStatus(VpnStatus::Paused, "Connection paused");
         
     } else if (eventName == "RESUMED") {
-        updateStatus(VpnStatus::Connecting, "Connection resumed");
+        updateStatus(VpnStatus::Connected, "Connection resumed");
+        
+    } else if (eventName == "CLIENT_RESTART") {
+        updateStatus(VpnStatus::Connecting, "Client restarting...");
+        
+    } else if (eventName == "AUTH_FAILED" || eventName == "CERT_VERIFY_FAIL" ||
+               eventName == "TLS_ERROR" || eventName == "CONNECTION_FAILED" ||
+               eventName == "CONNECTION_TIMEOUT") {
+        updateStatus(VpnStatus::Error, info.empty() ? eventName : info);
         
     } else {
         // Log other events for debugging
@@ -271,6 +475,100 @@ void VpnConnectionManager::handleLogMessage(int level, const std::string& messag
             #endif
             break;
     }
+    
+    if (level <= 3) {
+        recordLog(prefix + message);
+    }
+}
+
+// Oldest lines make way when the ring is full or the Log share is used up
+void VpnConnectionManager::recordLog(std::string line) {
+    auto charge = [](const std::string& entry) { return sizeof(std::string) + entry.capacity(); };
+    line.shrink_to_fit();
+    std::lock_guard<std::mutex> lock(logMutex);
+    auto dropOldest = [&]() {
+        budget->release(MemoryBudget::Subsystem::Log, charge(logRing.front()));
+        logRing.pop_front();
+    };
+    if (logRing.size() >= logRingEntries) {
+        dropOldest();
+    }
+    while (!budget->tryReserve(MemoryBudget::Subsystem::Log, charge(line))) {
+        if (logRing.empty()) {
+            return;
+        }
+        dropOldest();
+    }
+    logRing.push_back(std::move(line));
+}
+
+double VpnConnectionManager::wakeupsPerMinute() const {
+    return currentBackend()->getWakeupsPerMinute();
+}
+
+std::vector<MultipathBond::PathStats> VpnConnectionManager::pathStats() const {
+    return currentBackend()->getPathStats();
+}
+
+std::string VpnConnectionManager::activeBackend() const {
+    std::lock_guard<std::mutex> lock(backendMutex);
+    return backendName;
+}
+
+VpnBackendRegistry& VpnConnectionManager::backendRegistry() {
+    return backends;
+}
+
+VpnConfigManager& VpnConnectionManager::profileStore() {
+    return *configManager;
+}
+
+void VpnConnectionManager::selectBackend(const std::string& name) {
+    {
+        std::lock_guard<std::mutex> lock(backendMutex);
+        if (backend && backendName == name) {
+            return;
+        }
+    }
+    
+    std::shared_ptr<VpnBackend> engine = backends.create(name);
+    engine->setMemoryBudget(budget);
+    engine->setImpairmentScenario(impairmentScenario);
+    engine->setEventHandler([this](const std::string& eventName, const std::string& info) {
+        handleConnectionEvent(eventName, info);
+    });
+    engine->setLogHandler([this](int level, const std::string& message) {
+        handleLogMessage(level, message);
+    });
+    
+    std::shared_ptr<VpnBackend> previous;
+    {
+        std::lock_guard<std::mutex> lock(backendMutex);
+        previous = std::exchange(backend, std::move(engine));
+        backendName = name;
+    }
+    if (previous) {
+        previous->stop();
+        handleLogMessage(3, "VPN backend: " + name);
+    }
+}
+
+std::shared_ptr<VpnBackend> VpnConnectionManager::currentBackend() const {
+    std::lock_guard<std::mutex> lock(backendMutex);
+    return backend;
+}
+
+std::shared_ptr<MemoryBudget> VpnConnectionManager::memoryBudget() const {
+    return budget;
+}
+
+std::vector<MemoryBudget::Usage> VpnConnectionManager::memoryUsage() const {
+    return budget->usage();
+}
+
+std::vector<std::string> VpnConnectionManager::recentLog() const {
+    std::lock_guard<std::mutex> lock(logMutex);
+    return {logRing.begin(), logRing.end()};
 }
 
 void VpnConnectionManager::updateStatus(VpnStatus newStatus, const std::string& message) {
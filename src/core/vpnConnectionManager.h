@@ -1,6 +1,8 @@
 #pragma once
 import std;
-#include "openVpnClient.h"
+#include "memoryBudget.h"
+#include "serverProber.h"
+#include "vpnBackend.h"
 #include "vpnConfigManager.h"
 #include "vpnProtocol.h"
 
@@ -11,6 +13,9 @@ public:
 
     // Connection management
     std::future<bool> connect(const std::string& configPath);
+    // Probes the remotes of the given stored profiles (all profiles when empty)
+    // and connects to the best-ranked one, trying its fastest remote first
+    std::future<bool> connectFastest(const std::vector<std::string>& profileNames = {});
     void disconnect();
     void pause();
     void resume();
@@ -19,23 +24,75 @@ public:
     // Status monitoring
     VpnStatus getCurrentStatus() const;
     std::string getLastError() const;
+    // Name of the tunnel device the current profile brings up ("dev tun" -> "tun0");
+    // empty if the profile names something that is not a valid interface name
+    std::string tunnelInterface() const;
+    // True once that device exists, or if the backend never needs one
+    bool tunnelDeviceReady() const;
+    // Resolvers the server pushed for the current session
+    std::vector<std::string> pushedDnsServers() const;
+    // Server address of the current session and whether its tunnel carries IPv6
+    std::optional<sockaddr_storage> serverAddress() const;
+    bool tunnelCarriesIpv6() const;
+    // Wakeups of the connection thread over the last minute
+    double wakeupsPerMinute() const;
+    // Per-uplink counters while several uplinks are bonded
+    std::vector<MultipathBond::PathStats> pathStats() const;
+    // Engine of the current (or last) connection; see VpnBackendRegistry
+    std::string activeBackend() const;
+    // Registered engines; a profile selects one with "setenv SIAVPN_BACKEND <name>"
+    VpnBackendRegistry& backendRegistry();
+    // Stored profiles; the same store connect() and connectFastest() read
+    VpnConfigManager& profileStore();
+    // Smoothed probe results for the given stored profiles (all when empty), best first
+    std::vector<ServerProber::Score> serverRanking(const std::vector<std::string>& profileNames = {});
     
+    // Memory budget shared by the client, the profile store and whoever else
+    // is handed it (the DNS forwarder); its total follows ClientConfig::memoryBudget
+    std::shared_ptr<MemoryBudget> memoryBudget() const;
+    // Current use and cap per subsystem
+    std::vector<MemoryBudget::Usage> memoryUsage() const;
+    // Most recent log lines, oldest first; bounded by logRingEntries and the budget's Log share
+    std::vector<std::string> recentLog() const;
+    static constexpr std::size_t logRingEntries = 500;
+    
+    // Wipes credentials held for the current profile
+    void clearSensitiveData();
+    
+    // Network impairment for benchmarking; an empty path disables it. Only
+    // builds configured with SIAVPN_WITH_IMPAIRMENT can load a scenario.
+    void setImpairmentScenario(const std::string& scenarioPath);
+
     // Event subscription
     void setStatusCallback(std::function<void(VpnStatus, const std::string&)> callback);
 
 private:
     // Connection phases
     bool performConnection(const std::string& configPath);
+    bool performFastestConnection(const std::vector<std::string>& profileNames);
     bool prepareConfiguration(const std::string& configPath);
+    bool applyConfiguration(const std::string& configContent);
+    std::vector<ServerProber::Target> probeTargets(const std::vector<std::string>& profileNames);
     bool initiateConnection();
     bool waitForConnectionCompletion();
     void handleConnectionEvent(const std::string& eventName, const std::string& info);
     void handleLogMessage(int level, const std::string& message);
+    void recordLog(std::string line);
     void updateStatus(VpnStatus newStatus, const std::string& message = "");
     void handleConnectionComplete(bool success, const std::string& error = "");
+    // Swaps in the named engine unless it already runs; throws std::runtime_error if it can't
+    void selectBackend(const std::string& name);
+    std::shared_ptr<VpnBackend> currentBackend() const;
 
-    std::unique_ptr<OpenVpnClient> vpnClient;
+    std::shared_ptr<MemoryBudget> budget;
+    VpnBackendRegistry backends;
+    // Replaced between connections; callers hold their own reference while they use it
+    std::shared_ptr<VpnBackend> backend;
+    std::string backendName;
+    mutable std::mutex backendMutex;
+    std::optional<ImpairmentScenario> impairmentScenario;
     std::unique_ptr<VpnConfigManager> configManager;
+    ServerProber serverProber;
     
     VpnStatus currentStatus = VpnStatus::Disconnected;
     std::string lastError;
@@ -45,9 +102,15 @@ private:
     mutable std::mutex statusMutex;
     std::condition_variable statusCv;
     std::thread connectionThread;
+    // Stops an engine whose session came up without its tunnel device
+    std::thread teardownThread;
+    std::atomic<bool> tearingDown{false};
     
     // Configuration cache
     VpnConfigManager::ClientConfig currentConfig;
     
     std::function<void(VpnStatus, const std::string&)> statusCallback;
+    
+    std::deque<std::string> logRing;
+    mutable std::mutex logMutex;
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 import std;
 
-enum class VpnStatus { Disconnected, Connecting, Connected, Error };
+enum class VpnStatus { Disconnected, Connecting, Connected, Paused, Error };
 
 class VpnProtocol {
 public:
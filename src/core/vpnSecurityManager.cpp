@@ -1,16 +1,30 @@
 import std;
 #include "vpnSecurityManager.h"
+#include "processUtil.h"
+#include "secureMemory.h"
+#include "socketUtil.h"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
 
 VpnSecurityManager::VpnSecurityManager() 
     : communicationBlocked(true)
     , killSwitchEnabled(false) {
     // Initialize with communication blocked for security
+    dnsProxy.setAddressSink([this](std::span<const SplitTunnel::ResolvedAddress> addresses) {
+        return splitTunnel.addResolvedAddresses(addresses);
+    });
 }
 
 VpnSecurityManager::~VpnSecurityManager() {
     // Clean shutdown - remove any firewall rules
     disableKillSwitch();
     unblockCommunication();
+    disableDnsForwarding();
+    removeIpv6LeakGuard();
+    splitTunnel.reset();
 }
 
 void VpnSecurityManager::blockCommunication() {
@@ -52,17 +66,241 @@ void VpnSecurityManager::secureCleanup() {
 }
 
 void VpnSecurityManager::clearSensitiveData() {
-    // In a real implementation, this would:
-    // - Clear authentication tokens
-    // - Zero out password memory
-    // - Clear certificate data
-    // - Clear connection logs with sensitive info
+    // Owners wipe their credentials, keys and cached sessions; freed arena
+    // blocks are zeroed on release
+    for (const auto& handler : sensitiveDataHandlers) {
+        try {
+            handler();
+        } catch (const std::exception& e) {
+            std::cerr << "[SECURITY] Failed to clear sensitive data: " << e.what() << '\n';
+        }
+    }
     
-    std::cout << "[SECURITY] Sensitive data cleared\n";
+    const auto arena = SecureArena::instance().stats();
+    std::cout << "[SECURITY] Sensitive data cleared (" << arena.inUseBytes
+              << " bytes still held in secure memory)\n";
+}
+
+void VpnSecurityManager::addSensitiveDataHandler(std::function<void()> handler) {
+    sensitiveDataHandlers.push_back(std::move(handler));
+}
+
+void VpnSecurityManager::setSplitTunnelMode(SplitTunnel::Mode mode) {
+    splitMode = mode;
+
+    #ifdef __linux__
+    // When selected apps bypass the VPN everything else goes through it, this
+    // process included; its transport socket must stay outside or it would
+    // route into its own tunnel. Sockets opened from now on inherit this.
+    const int self = static_cast<int>(::getpid());
+    if (mode == SplitTunnel::Mode::ExcludeSelected) {
+        if (!splitTunnel.addProcess(self)) {
+            std::cerr << "[SECURITY] Split tunnel: " << splitTunnel.getLastError() << '\n';
+        }
+    } else {
+        splitTunnel.removeProcess(self);
+    }
+    #endif
+    refreshIpv6Guard();
+}
+
+SplitTunnel::Mode VpnSecurityManager::splitTunnelMode() const {
+    return splitMode;
+}
+
+bool VpnSecurityManager::addSplitTunnelApp(int pid) {
+    if (!splitTunnel.addProcess(pid)) {
+        std::cerr << "[SECURITY] Split tunnel: " << splitTunnel.getLastError() << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool VpnSecurityManager::removeSplitTunnelApp(int pid) {
+    if (!splitTunnel.removeProcess(pid)) {
+        std::cerr << "[SECURITY] Split tunnel: " << splitTunnel.getLastError() << '\n';
+        return false;
+    }
+    return true;
+}
+
+std::vector<int> VpnSecurityManager::splitTunnelApps() const {
+    return splitTunnel.processes();
+}
+
+bool VpnSecurityManager::addSplitTunnelDomain(const std::string& pattern, SplitTunnel::DomainRoute route) {
+    // Validate before storing so one bad pattern cannot break the rule set
+    DomainMatcher probe;
+    if (!probe.add(pattern, static_cast<std::uint32_t>(route))) {
+        std::cerr << "[SECURITY] Invalid split tunnel domain: " << pattern << '\n';
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(splitDomainsMutex);
+        splitDomains[pattern] = route;
+    }
+    rebuildDomainRules();
+    return true;
+}
+
+void VpnSecurityManager::removeSplitTunnelDomain(const std::string& pattern) {
+    {
+        std::lock_guard<std::mutex> lock(splitDomainsMutex);
+        splitDomains.erase(pattern);
+    }
+    rebuildDomainRules();
+}
+
+void VpnSecurityManager::rebuildDomainRules() {
+    // The stub keeps matching against the old rules until the swap
+    auto rules = std::make_shared<DomainMatcher>();
+    {
+        std::lock_guard<std::mutex> lock(splitDomainsMutex);
+        for (const auto& [pattern, route] : splitDomains) {
+            rules->add(pattern, static_cast<std::uint32_t>(route));
+        }
+    }
+    dnsProxy.setRules(std::move(rules));
+}
+
+bool VpnSecurityManager::applySplitTunnel(const std::string& tunnelInterface) {
+    const auto mode = splitMode.load();
+    bool domainRules = false;
+    {
+        std::lock_guard<std::mutex> lock(splitDomainsMutex);
+        domainRules = !splitDomains.empty();
+    }
+    if (mode == SplitTunnel::Mode::Disabled && !domainRules) {
+        removeSplitTunnel();
+        return true;
+    }
+
+    if (!splitTunnel.activate(mode, tunnelInterface)) {
+        std::cerr << "[SECURITY] Split tunnel not applied: " << splitTunnel.getLastError() << '\n';
+        return false;
+    }
+    // Hostname rules need every lookup to pass through the forwarder, and the
+    // freshly created sets need answers it may already have cached
+    refreshDns();
+    dnsProxy.clearCache();
+    std::cout << "[SECURITY] Split tunnel active on " << tunnelInterface << '\n';
+    return true;
+}
+
+void VpnSecurityManager::removeSplitTunnel() {
+    splitTunnel.deactivate();
+}
+
+void VpnSecurityManager::enableDnsForwarding(const std::vector<std::string>& resolvers, const std::string& tunnelInterface) {
+    // The name is bound to sockets and placed into the nft ruleset
+    if (!socketUtil::isInterfaceName(tunnelInterface)) {
+        std::cerr << "[SECURITY] DNS forwarding not enabled, invalid tunnel interface: " << tunnelInterface << '\n';
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(dnsMutex);
+        dnsResolvers = resolvers;
+        dnsInterface = tunnelInterface;
+    }
+    refreshDns();
+}
+
+void VpnSecurityManager::disableDnsForwarding() {
+    if (dnsProxy.isRunning()) {
+        const auto stats = dnsProxy.stats();
+        std::cout << std::format("[SECURITY] DNS forwarder: {} queries, {:.1f}% cache hits, median lookup {} us, "
+                                 "{} prefetched, {} over TCP, {} shed over the memory budget\n",
+                                 stats.queries, stats.hitRate() * 100.0, stats.medianLatency.count(),
+                                 stats.prefetches, stats.tcpFallbacks, stats.shed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(dnsMutex);
+        dnsResolvers.clear();
+        dnsInterface.clear();
+    }
+    refreshDns();
+}
+
+DnsProxy::Stats VpnSecurityManager::dnsStats() const {
+    return dnsProxy.stats();
+}
+
+void VpnSecurityManager::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    std::lock_guard<std::mutex> lock(dnsMutex);
+    dnsBudget = std::move(budget);
+}
+
+void VpnSecurityManager::applyIpv6LeakGuard(const std::string& tunnelInterface, bool tunnelIpv6,
+                                            const std::optional<sockaddr_storage>& server) {
+    {
+        std::lock_guard<std::mutex> lock(ipv6GuardMutex);
+        if (tunnelIpv6) {
+            ipv6Guard.reset();
+        } else {
+            ipv6Guard = Ipv6Guard{tunnelInterface, server};
+        }
+    }
+    refreshIpv6Guard();
+}
+
+void VpnSecurityManager::removeIpv6LeakGuard() {
+    {
+        std::lock_guard<std::mutex> lock(ipv6GuardMutex);
+        ipv6Guard.reset();
+    }
+    refreshIpv6Guard();
+}
+
+void VpnSecurityManager::refreshIpv6Guard() {
+    std::lock_guard<std::mutex> lock(ipv6GuardMutex);
+    if (ipv6Guard) {
+        applyIpv6Rules(*ipv6Guard, splitMode.load());
+    } else {
+        removeIpv6Rules();
+    }
+}
+
+void VpnSecurityManager::refreshDns() {
+    std::lock_guard<std::mutex> lock(dnsMutex);
+    bool domainRules = false;
+    {
+        std::lock_guard<std::mutex> domainsLock(splitDomainsMutex);
+        domainRules = !splitDomains.empty();
+    }
+    const bool tunnelUp = !dnsInterface.empty();
+    const bool forwarding = tunnelUp && !dnsResolvers.empty();
+    const bool needed = tunnelUp && (forwarding || domainRules);
+
+    // Without pushed resolvers (hostname rules only) lookups go to the system's, unpinned
+    DnsProxy::Settings wanted = dnsProxy.currentSettings();
+    wanted.upstreams = forwarding ? dnsResolvers : std::vector<std::string>{};
+    wanted.upstreamInterface = forwarding ? dnsInterface : std::string();
+    wanted.memoryBudget = dnsBudget;
+    const auto& current = dnsProxy.currentSettings();
+    if (dnsProxy.isRunning() &&
+        (!needed || current.upstreams != wanted.upstreams || current.upstreamInterface != wanted.upstreamInterface)) {
+        dnsProxy.stop();
+    }
+    if (needed && !dnsProxy.isRunning()) {
+        dnsProxy.configure(std::move(wanted));
+        if (!dnsProxy.start()) {
+            std::cerr << "[SECURITY] DNS forwarder not started: " << dnsProxy.getLastError() << '\n';
+        }
+    }
+
+    if (dnsProxy.isRunning()) {
+        applyDnsRules(dnsProxy.port(), forwarding || killSwitchEnabled);
+    } else if (killSwitchEnabled) {
+        // No forwarder to answer: with the kill switch on, lookups fail rather than leak
+        applyDnsRules(0, true);
+    } else {
+        removeDnsRules();
+    }
 }
 
 void VpnSecurityManager::enableKillSwitch() {
     killSwitchEnabled = true;
+    refreshDns();
     
     if (communicationBlocked) {
         blockAllTraffic();
@@ -73,6 +311,7 @@ void VpnSecurityManager::enableKillSwitch() {
 
 void VpnSecurityManager::disableKillSwitch() {
     killSwitchEnabled = false;
+    refreshDns();
     
     if (!communicationBlocked) {
         removeFirewallRules();
@@ -161,6 +400,62 @@ void VpnSecurityManager::allowVpnTraffic() {
     }
 }
 
+void VpnSecurityManager::applyDnsRules(std::uint16_t redirectPort, bool blockLeaks) {
+    try {
+        #ifdef _WIN32
+        applyDnsRulesWindows(redirectPort, blockLeaks);
+        #elif __linux__
+        applyDnsRulesLinux(redirectPort, blockLeaks);
+        #elif __APPLE__
+        applyDnsRulesMac(redirectPort, blockLeaks);
+        #endif
+    } catch (const std::exception& e) {
+        std::cerr << "[SECURITY] Failed to apply DNS rules: " << e.what() << '\n';
+    }
+}
+
+void VpnSecurityManager::removeDnsRules() {
+    try {
+        #ifdef _WIN32
+        removeDnsRulesWindows();
+        #elif __linux__
+        removeDnsRulesLinux();
+        #elif __APPLE__
+        removeDnsRulesMac();
+        #endif
+    } catch (const std::exception& e) {
+        std::cerr << "[SECURITY] Failed to remove DNS rules: " << e.what() << '\n';
+    }
+}
+
+void VpnSecurityManager::applyIpv6Rules(const Ipv6Guard& guard, SplitTunnel::Mode mode) {
+    try {
+        #ifdef _WIN32
+        applyIpv6RulesWindows(guard, mode);
+        #elif __linux__
+        applyIpv6RulesLinux(guard, mode);
+        #elif __APPLE__
+        applyIpv6RulesMac(guard, mode);
+        #endif
+    } catch (const std::exception& e) {
+        std::cerr << "[SECURITY] Failed to apply IPv6 leak protection: " << e.what() << '\n';
+    }
+}
+
+void VpnSecurityManager::removeIpv6Rules() {
+    try {
+        #ifdef _WIN32
+        removeIpv6RulesWindows();
+        #elif __linux__
+        removeIpv6RulesLinux();
+        #elif __APPLE__
+        removeIpv6RulesMac();
+        #endif
+    } catch (const std::exception& e) {
+        std::cerr << "[SECURITY] Failed to remove IPv6 leak protection: " << e.what() << '\n';
+    }
+}
+
 #ifdef _WIN32
 void VpnSecurityManager::setupWindowsFirewallRules() {
     // Windows implementation using Windows Filtering Platform
@@ -179,6 +474,26 @@ void VpnSecurityManager::blockAllTrafficWindows() {
 void VpnSecurityManager::allowVpnTrafficWindows() {
     std::cout << "[SECURITY] Allowing VPN traffic on Windows (placeholder)\n";
 }
+
+void VpnSecurityManager::applyDnsRulesWindows(std::uint16_t redirectPort, bool blockLeaks) {
+    // WFP would permit port 53 only to the forwarder and block it elsewhere
+    std::cout << "[SECURITY] DNS rules on Windows (placeholder), forwarder port " << redirectPort
+              << (blockLeaks ? ", leaks blocked\n" : "\n");
+}
+
+void VpnSecurityManager::removeDnsRulesWindows() {
+    std::cout << "[SECURITY] Removing DNS rules on Windows (placeholder)\n";
+}
+
+void VpnSecurityManager::applyIpv6RulesWindows(const Ipv6Guard& guard, SplitTunnel::Mode mode) {
+    // WFP would block FWP_IP_VERSION_V6 outside the tunnel adapter
+    (void)mode;
+    std::cout << "[SECURITY] IPv6 leak protection on Windows (placeholder), tunnel " << guard.tunnelInterface << '\n';
+}
+
+void VpnSecurityManager::removeIpv6RulesWindows() {
+    std::cout << "[SECURITY] Removing IPv6 leak protection on Windows (placeholder)\n";
+}
 #endif
 
 #ifdef __linux__
@@ -199,6 +514,111 @@ void VpnSecurityManager::blockAllTrafficLinux() {
 void VpnSecurityManager::allowVpnTrafficLinux() {
     std::cout << "[SECURITY] Allowing VPN traffic on Linux (placeholder)\n";
 }
+
+void VpnSecurityManager::applyDnsRulesLinux(std::uint16_t redirectPort, bool blockLeaks) {
+    // Plain DNS of the whole host goes to the forwarder; its own (marked) upstream
+    // queries may leave only through the tunnel, any other port 53 traffic is dropped
+    std::string chains;
+    if (redirectPort != 0) {
+        chains += std::format(
+            "    chain redirect {{\n"
+            "        type nat hook output priority dstnat; policy accept;\n"
+            "        meta mark != {0:#x} meta nfproto ipv4 udp dport 53 redirect to :{1}\n"
+            "        meta mark != {0:#x} meta nfproto ipv4 tcp dport 53 redirect to :{1}\n"
+            "    }}\n",
+            SplitTunnel::dnsMark, redirectPort);
+    }
+    if (blockLeaks) {
+        chains += "    chain leaks {\n"
+                  "        type filter hook output priority filter; policy accept;\n"
+                  "        oifname \"lo\" accept\n";
+        if (socketUtil::isInterfaceName(dnsInterface)) {
+            chains += std::format("        meta mark {:#x} oifname \"{}\" accept\n", SplitTunnel::dnsMark, dnsInterface);
+        }
+        chains += "        udp dport 53 drop\n"
+                  "        tcp dport 53 drop\n"
+                  "    }\n";
+    }
+    const std::string ruleset = std::format(
+        "table inet siavpn_dns\n"
+        "delete table inet siavpn_dns\n"
+        "table inet siavpn_dns {{\n"
+        "{}"
+        "}}\n",
+        chains);
+
+    std::string error;
+    if (!processUtil::run({"nft", "-f", "-"}, ruleset, error)) {
+        throw std::runtime_error(error);
+    }
+    std::cout << "[SECURITY] DNS " << (redirectPort ? "redirected to local forwarder" : "not redirected")
+              << (blockLeaks ? ", port 53 leaks blocked\n" : "\n");
+}
+
+void VpnSecurityManager::removeDnsRulesLinux() {
+    std::string error;
+    processUtil::run({"nft", "delete", "table", "inet", "siavpn_dns"}, {}, error);
+}
+
+void VpnSecurityManager::applyIpv6RulesLinux(const Ipv6Guard& guard, SplitTunnel::Mode mode) {
+    // The name comes from the profile; without a valid one only loopback is let
+    // through, so the guard still fails closed
+    const std::string outputs = socketUtil::isInterfaceName(guard.tunnelInterface)
+                                    ? std::format("\"lo\", \"{}\"", guard.tunnelInterface)
+                                    : std::string("\"lo\"");
+    std::string accepts = std::format(
+        "        oifname {{ {} }} accept\n"
+        "        ip6 daddr {{ fe80::/10, ff02::/16 }} accept\n"
+        "        meta mark {:#x} accept\n",
+        outputs, SplitTunnel::bypassMark);
+    if (guard.server && guard.server->ss_family == AF_INET6) {
+        // The transport itself, when the race picked the server's IPv6 address
+        const auto* server = reinterpret_cast<const sockaddr_in6*>(&*guard.server);
+        std::array<char, INET6_ADDRSTRLEN> text{};
+        ::inet_ntop(AF_INET6, &server->sin6_addr, text.data(), text.size());
+        accepts += std::format("        ip6 daddr {} meta l4proto {{ tcp, udp }} th dport {} accept\n",
+                               text.data(), ntohs(server->sin6_port));
+    }
+
+    // Only traffic meant for the tunnel is refused: with IncludeSelected
+    // that is the selected apps, otherwise everything but them
+    std::string refuse;
+    switch (mode) {
+        case SplitTunnel::Mode::Disabled:
+            refuse = "        meta nfproto ipv6 reject with icmpv6 type admin-prohibited\n";
+            break;
+        case SplitTunnel::Mode::IncludeSelected:
+            refuse = std::format("        meta nfproto ipv6 meta mark {:#x} reject with icmpv6 type admin-prohibited\n",
+                                 SplitTunnel::packetMark);
+            break;
+        case SplitTunnel::Mode::ExcludeSelected:
+            refuse = std::format("        meta mark {:#x} accept\n"
+                                 "        meta nfproto ipv6 reject with icmpv6 type admin-prohibited\n", SplitTunnel::packetMark);
+            break;
+    }
+
+    const std::string ruleset = std::format(
+        "table inet siavpn_ipv6\n"
+        "delete table inet siavpn_ipv6\n"
+        "table inet siavpn_ipv6 {{\n"
+        "    chain output {{\n"
+        "        type filter hook output priority filter; policy accept;\n"
+        "{}{}"
+        "    }}\n"
+        "}}\n",
+        accepts, refuse);
+
+    std::string error;
+    if (!processUtil::run({"nft", "-f", "-"}, ruleset, error)) {
+        throw std::runtime_error(error);
+    }
+    std::cout << "[SECURITY] Tunnel " << guard.tunnelInterface << " has no IPv6, IPv6 traffic outside it refused\n";
+}
+
+void VpnSecurityManager::removeIpv6RulesLinux() {
+    std::string error;
+    processUtil::run({"nft", "delete", "table", "inet", "siavpn_ipv6"}, {}, error);
+}
 #endif
 
 #ifdef __APPLE__
@@ -218,4 +638,24 @@ void VpnSecurityManager::blockAllTrafficMac() {
 void VpnSecurityManager::allowVpnTrafficMac() {
     std::cout << "[SECURITY] Allowing VPN traffic on macOS (placeholder)\n";
 }
+
+void VpnSecurityManager::applyDnsRulesMac(std::uint16_t redirectPort, bool blockLeaks) {
+    // pf would rdr port 53 to the forwarder and block it elsewhere
+    std::cout << "[SECURITY] DNS rules on macOS (placeholder), forwarder port " << redirectPort
+              << (blockLeaks ? ", leaks blocked\n" : "\n");
+}
+
+void VpnSecurityManager::removeDnsRulesMac() {
+    std::cout << "[SECURITY] Removing DNS rules on macOS (placeholder)\n";
+}
+
+void VpnSecurityManager::applyIpv6RulesMac(const Ipv6Guard& guard, SplitTunnel::Mode mode) {
+    // pf would "block return out inet6" except on lo0 and the utun device
+    (void)mode;
+    std::cout << "[SECURITY] IPv6 leak protection on macOS (placeholder), tunnel " << guard.tunnelInterface << '\n';
+}
+
+void VpnSecurityManager::removeIpv6RulesMac() {
+    std::cout << "[SECURITY] Removing IPv6 leak protection on macOS (placeholder)\n";
+}
 #endif
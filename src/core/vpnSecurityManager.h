@@ -1,5 +1,7 @@
 #pragma once
 import std;
+#include "dnsProxy.h"
+#include "splitTunnel.h"
 
 class VpnSecurityManager {
 public:
@@ -15,15 +17,72 @@ public:
     // Security operations
     void secureCleanup();
     void clearSensitiveData();
+    // Components holding secrets register a wipe routine run by clearSensitiveData
+    void addSensitiveDataHandler(std::function<void()> handler);
     
     // Kill switch functionality
     void enableKillSwitch();
     void disableKillSwitch();
     bool isKillSwitchEnabled() const;
 
+    // Per-application split tunneling; apps can be added or removed at any time
+    void setSplitTunnelMode(SplitTunnel::Mode mode);
+    SplitTunnel::Mode splitTunnelMode() const;
+    bool addSplitTunnelApp(int pid);
+    bool removeSplitTunnelApp(int pid);
+    std::vector<int> splitTunnelApps() const;
+    // Hostname rules ("corp.example", "*.corp.example", ".corp.example"),
+    // enforced through the DNS forwarder; false for malformed patterns
+    bool addSplitTunnelDomain(const std::string& pattern, SplitTunnel::DomainRoute route);
+    void removeSplitTunnelDomain(const std::string& pattern);
+    // Routes selected apps once the tunnel interface is up
+    bool applySplitTunnel(const std::string& tunnelInterface);
+    void removeSplitTunnel();
+
+    // Local caching DNS forwarder: while connected every lookup of the host is
+    // answered by it, from cache or by the pushed resolvers through the tunnel,
+    // and port 53 traffic bypassing it is dropped
+    void enableDnsForwarding(const std::vector<std::string>& resolvers, const std::string& tunnelInterface);
+    void disableDnsForwarding();
+    DnsProxy::Stats dnsStats() const;
+    // Bounds the forwarder's lookups in flight and cache from the next start on
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+
+    // IPv6 leak protection. A tunnel without IPv6 would leave the host's IPv6
+    // traffic on the physical network, so while connected over one that
+    // traffic is refused (apps fall back to IPv4 at once) except on loopback,
+    // link-local, towards the VPN server and where split tunneling bypasses
+    void applyIpv6LeakGuard(const std::string& tunnelInterface, bool tunnelIpv6,
+                            const std::optional<sockaddr_storage>& server);
+    void removeIpv6LeakGuard();
+
 private:
     std::atomic<bool> communicationBlocked{true};
     std::atomic<bool> killSwitchEnabled{false};
+    std::vector<std::function<void()>> sensitiveDataHandlers;
+    SplitTunnel splitTunnel;
+    std::atomic<SplitTunnel::Mode> splitMode{SplitTunnel::Mode::Disabled};
+    std::map<std::string, SplitTunnel::DomainRoute> splitDomains;
+    mutable std::mutex splitDomainsMutex;
+    DnsProxy dnsProxy;
+
+    std::vector<std::string> dnsResolvers;
+    std::string dnsInterface;  // tunnel the forwarder serves; empty while disconnected
+    std::shared_ptr<MemoryBudget> dnsBudget;
+    std::mutex dnsMutex;
+
+    struct Ipv6Guard {
+        std::string tunnelInterface;
+        std::optional<sockaddr_storage> server;
+    };
+    std::optional<Ipv6Guard> ipv6Guard;  // set while the guard should be installed
+    std::mutex ipv6GuardMutex;
+
+    void rebuildDomainRules();
+    // Starts, restarts or stops the forwarder and matches the port 53 rules to it
+    void refreshDns();
+    // Reinstalls the IPv6 guard for the current split tunnel mode
+    void refreshIpv6Guard();
     
     void setupBasicFirewallRules();
     void removeFirewallRules();
@@ -31,11 +90,21 @@ private:
     void allowVpnTraffic();
     
     // Platform-specific implementations
+    // DNS redirect to the forwarder (port 0: none) and port 53 leak blocking
+    void applyDnsRules(std::uint16_t redirectPort, bool blockLeaks);
+    void removeDnsRules();
+    void applyIpv6Rules(const Ipv6Guard& guard, SplitTunnel::Mode mode);
+    void removeIpv6Rules();
+    
     #ifdef _WIN32
     void setupWindowsFirewallRules();
     void removeWindowsFirewallRules();
     void blockAllTrafficWindows();
     void allowVpnTrafficWindows();
+    void applyDnsRulesWindows(std::uint16_t redirectPort, bool blockLeaks);
+    void removeDnsRulesWindows();
+    void applyIpv6RulesWindows(const Ipv6Guard& guard, SplitTunnel::Mode mode);
+    void removeIpv6RulesWindows();
     #endif
     
     #ifdef __linux__
@@ -43,6 +112,10 @@ private:
     void removeLinuxFirewallRules();
     void blockAllTrafficLinux();
     void allowVpnTrafficLinux();
+    void applyDnsRulesLinux(std::uint16_t redirectPort, bool blockLeaks);
+    void removeDnsRulesLinux();
+    void applyIpv6RulesLinux(const Ipv6Guard& guard, SplitTunnel::Mode mode);
+    void removeIpv6RulesLinux();
     #endif
     
     #ifdef __APPLE__
@@ -50,5 +123,9 @@ private:
     void removeMacFirewallRules();
     void blockAllTrafficMac();
     void allowVpnTrafficMac();
+    void applyDnsRulesMac(std::uint16_t redirectPort, bool blockLeaks);
+    void removeDnsRulesMac();
+    void applyIpv6RulesMac(const Ipv6Guard& guard, SplitTunnel::Mode mode);
+    void removeIpv6RulesMac();
     #endif
 };
\ No newline at end of file
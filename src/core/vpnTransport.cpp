@@ -0,0 +1,847 @@
+import std;
+#include "vpnTransport.h"
+#include "controlChannel.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/errqueue.h>
+#endif
+
+namespace {
+
+constexpr std::size_t maxPacketSize = 65535;
+// Batched reads after the first packet; a larger datagram is dropped as truncated
+constexpr std::size_t batchSlotSize = 4096;
+
+// Sealed data packets: a tun-mtu 1500 payload plus DataChannel headroom fits
+constexpr std::size_t sendPoolBuffers = 256;
+constexpr std::size_t sendPoolBufferSize = 2048;
+constexpr std::size_t sendPoolFloor = 16;
+
+// RFC 8305 recommends 250 ms between connection attempts
+constexpr std::chrono::milliseconds connectionAttemptDelay{250};
+constexpr std::chrono::seconds tcpRaceTimeout{10};
+// UDP has no handshake, so an attempt completes when the server answers a
+// hard reset; if none does in time the first usable address is kept and the
+// TLS handshake reports the failure as before
+constexpr std::chrono::seconds udpRaceTimeout{3};
+
+// Alternates address families, starting with the resolver's preferred one
+std::vector<sockaddr_storage> interleaveFamilies(const std::vector<sockaddr_storage>& addresses) {
+    std::vector<sockaddr_storage> preferred;
+    std::vector<sockaddr_storage> other;
+    for (const auto& address : addresses) {
+        (address.ss_family == addresses.front().ss_family ? preferred : other).push_back(address);
+    }
+
+    std::vector<sockaddr_storage> ordered;
+    ordered.reserve(addresses.size());
+    for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+        if (i < preferred.size()) {
+            ordered.push_back(preferred[i]);
+        }
+        if (i < other.size()) {
+            ordered.push_back(other[i]);
+        }
+    }
+    return ordered;
+}
+
+} // namespace
+
+VpnTransport::VpnTransport()
+    : sendPool(sendPoolBuffers, sendPoolBufferSize) {
+    socketUtil::ensureInitialized();
+}
+
+VpnTransport::~VpnTransport() {
+    close();
+    releaseBatchSlots();
+}
+
+VpnTransport::Protocol VpnTransport::protocolFromString(const std::string& proto) {
+    // OpenVPN spells TCP as "tcp", "tcp-client", "tcp4", "tcp6-client", ...
+    if (proto.starts_with("quic")) {
+        return Protocol::Quic;
+    }
+    return proto.starts_with("tcp") ? Protocol::Tcp : Protocol::Udp;
+}
+
+int VpnTransport::familyFromString(const std::string& proto) {
+    const std::string_view name(proto);
+    const std::string_view kind = name.substr(0, name.starts_with("quic") ? 5 : 4);
+    if (kind == "udp4" || kind == "tcp4" || kind == "quic4") {
+        return AF_INET;
+    }
+    if (kind == "udp6" || kind == "tcp6" || kind == "quic6") {
+        return AF_INET6;
+    }
+    return AF_UNSPEC;
+}
+
+void VpnTransport::setControlWrap(std::optional<ControlWrap::Key> key) {
+    wrapKey = std::move(key);
+}
+
+void VpnTransport::setUdpProbe(bool enabled) {
+    udpProbe = enabled;
+}
+
+void VpnTransport::setLayers(TransportChain chain) {
+    layers = std::move(chain);
+}
+
+void VpnTransport::setQuicSettings(QuicTunnel::Settings settings) {
+    quicSettings = std::move(settings);
+}
+
+void VpnTransport::setMultipath(std::optional<MultipathBond::Settings> settings) {
+    multipathSettings = std::move(settings);
+}
+
+std::size_t VpnTransport::sendHeadroom() const {
+    if (activeProtocol == Protocol::Quic) {
+        return QuicTunnel::headroom;
+    }
+    return layers.empty() ? 0 : layers.headroom() + 2;
+}
+
+std::size_t VpnTransport::sendTailroom() const {
+    return activeProtocol == Protocol::Quic ? QuicTunnel::tailroom : 0;
+}
+
+bool VpnTransport::open(const std::string& host, const std::string& port, Protocol protocol, int family) {
+    close();
+    activeProtocol = protocol;
+    if (protocol == Protocol::Udp && layers.framesStream()) {
+        lastError = "Transport layer tls-record needs a TCP remote";
+        return false;
+    }
+    if (protocol == Protocol::Quic) {
+        // QUIC encrypts everything already, and its packets must stay recognisable to the proxy
+        if (!layers.empty()) {
+            lastError = "Transport layers cannot be used over QUIC";
+            return false;
+        }
+        if (!quicSettings) {
+            lastError = "No QUIC proxy configured";
+            return false;
+        }
+        if (!quic.open(host, port, family, *quicSettings)) {
+            lastError = quic.getLastError();
+            return false;
+        }
+        connectedAddress = quic.remoteAddress();
+        return true;
+    }
+
+    std::vector<sockaddr_storage> addresses;
+    try {
+        addresses = socketUtil::resolve(host, port, protocol == Protocol::Tcp ? SOCK_STREAM : SOCK_DGRAM, family);
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return false;
+    }
+    if (addresses.empty()) {
+        lastError = "No address for " + host;
+        return false;
+    }
+
+    socketHandle = race(interleaveFamilies(addresses), protocol);
+    if (socketHandle == invalidSocket) {
+        lastError = "Cannot connect to " + host + ":" + port + ": " + lastError;
+        return false;
+    }
+    if (protocol == Protocol::Udp && multipathSettings) {
+        // The race found the server; the uplinks' own sockets carry the session
+        socketUtil::closeSocket(socketHandle);
+        socketHandle = invalidSocket;
+        if (!bond.open(*connectedAddress, *multipathSettings, layers, wrapKey)) {
+            lastError = bond.getLastError();
+            connectedAddress.reset();
+            return false;
+        }
+        lastError = bond.getLastError();  // the uplinks left out, if any
+    }
+    return true;
+}
+
+VpnTransport::SocketHandle VpnTransport::race(const std::vector<sockaddr_storage>& candidates, Protocol protocol) {
+    using Clock = std::chrono::steady_clock;
+    const bool stream = protocol == Protocol::Tcp;
+
+    struct Attempt {
+        sockaddr_storage address{};
+        SocketHandle socket = invalidSocket;
+        std::unique_ptr<ControlChannel> probe;  // UDP only
+    };
+    std::vector<Attempt> attempts;
+    std::optional<sockaddr_storage> winner;
+    SocketHandle winnerSocket = invalidSocket;
+
+    const auto deadline = Clock::now() + (stream ? Clock::duration(tcpRaceTimeout) : Clock::duration(udpRaceTimeout));
+    std::size_t next = 0;
+    auto nextAttemptAt = Clock::now();
+
+    while (!winner) {
+        const auto now = Clock::now();
+        if (now >= deadline) {
+            lastError = "timed out";
+            break;
+        }
+
+        // A new attempt when the delay has passed or nothing is pending
+        if (next < candidates.size() && (attempts.empty() || now >= nextAttemptAt)) {
+            Attempt attempt;
+            attempt.address = candidates[next++];
+            attempt.socket = ::socket(attempt.address.ss_family, stream ? SOCK_STREAM : SOCK_DGRAM, 0);
+            if (attempt.socket == invalidSocket || !socketUtil::setNonBlocking(attempt.socket)) {
+                lastError = "Cannot create socket: " + socketUtil::lastErrorText();
+                socketUtil::closeSocket(attempt.socket);
+                continue;
+            }
+            const auto* address = reinterpret_cast<const sockaddr*>(&attempt.address);
+            const bool connected = ::connect(attempt.socket, address, socketUtil::addressLength(attempt.address)) == 0;
+            if (!connected && !(stream && socketUtil::connectInProgress())) {
+                // No route for this family and the like: move on without waiting
+                lastError = socketUtil::lastErrorText();
+                socketUtil::closeSocket(attempt.socket);
+                continue;
+            }
+            if (!stream && !udpProbe) {
+                winner = attempt.address;  // nothing to ask the server
+            } else if (!stream) {
+                const auto handle = attempt.socket;
+                attempt.probe = std::make_unique<ControlChannel>([handle, chain = layers](std::span<const std::uint8_t> packet) {
+                    const auto wire = chain.wrap(packet);
+                    return ::send(handle, reinterpret_cast<const char*>(wire.data()), static_cast<int>(wire.size()), 0) ==
+                           static_cast<int>(wire.size());
+                });
+                if (wrapKey) {
+                    attempt.probe->setWrap(std::make_unique<ControlWrap>(*wrapKey));
+                }
+                attempt.probe->startHardReset();
+            }
+            attempts.push_back(std::move(attempt));
+            nextAttemptAt = now + connectionAttemptDelay;
+            continue;
+        }
+        if (attempts.empty()) {
+            break;  // every address failed outright
+        }
+
+        auto wakeup = next < candidates.size() ? std::min(deadline, nextAttemptAt) : deadline;
+        std::vector<SocketHandle> handles;
+        for (const auto& attempt : attempts) {
+            handles.push_back(attempt.socket);
+            if (attempt.probe) {
+                wakeup = std::min(wakeup, attempt.probe->nextWakeup());
+            }
+        }
+        const auto wait = std::max(std::chrono::ceil<std::chrono::milliseconds>(wakeup - Clock::now()),
+                                   std::chrono::milliseconds(0));
+        const int ready = stream ? socketUtil::waitAnyWritable(handles, wait) : socketUtil::waitAnyReadable(handles, wait);
+
+        if (ready >= 0) {
+            auto& attempt = attempts[static_cast<std::size_t>(ready)];
+            bool failed = false;
+            if (stream) {
+                if (socketUtil::connectSucceeded(attempt.socket, &lastError)) {
+                    winner = attempt.address;
+                    winnerSocket = std::exchange(attempt.socket, invalidSocket);
+                } else {
+                    failed = true;
+                }
+            } else {
+                std::array<std::uint8_t, 2048> reply{};
+                const auto length = ::recv(attempt.socket, reinterpret_cast<char*>(reply.data()), static_cast<int>(reply.size()), 0);
+                const auto inner = length < 0 ? std::nullopt : layers.unwrap(std::span(reply.data(), static_cast<std::size_t>(length)));
+                if (length < 0) {
+                    lastError = socketUtil::lastErrorText();
+                    failed = true;  // ICMP unreachable
+                } else if (inner && attempt.probe->processIncoming(*inner) && attempt.probe->isEstablished()) {
+                    winner = attempt.address;
+                }
+            }
+            if (failed) {
+                socketUtil::closeSocket(attempt.socket);
+                attempts.erase(attempts.begin() + ready);
+                nextAttemptAt = Clock::now();  // the next candidate need not wait
+            }
+        }
+        for (auto& attempt : attempts) {
+            if (attempt.probe) {
+                attempt.probe->service(Clock::now());
+            }
+        }
+    }
+
+    if (!stream && !winner && !attempts.empty()) {
+        winner = attempts.front().address;  // unanswered but not refused
+    }
+    for (auto& attempt : attempts) {
+        socketUtil::closeSocket(attempt.socket);
+    }
+
+    if (!stream) {
+        // The probe socket carries a half-open server session; the real one
+        // starts from a fresh socket so its replies cannot be confused with it
+        if (winner) {
+            winnerSocket = ::socket(winner->ss_family, SOCK_DGRAM, 0);
+            if (winnerSocket != invalidSocket &&
+                ::connect(winnerSocket, reinterpret_cast<const sockaddr*>(&*winner), socketUtil::addressLength(*winner)) != 0) {
+                lastError = socketUtil::lastErrorText();
+                socketUtil::closeSocket(winnerSocket);
+                winnerSocket = invalidSocket;
+            }
+        }
+    } else if (winnerSocket != invalidSocket && !socketUtil::setNonBlocking(winnerSocket, false)) {
+        lastError = socketUtil::lastErrorText();
+        socketUtil::closeSocket(winnerSocket);
+        winnerSocket = invalidSocket;
+    }
+
+    if (winnerSocket != invalidSocket) {
+        connectedAddress = winner;
+    }
+    return winnerSocket;
+}
+
+void VpnTransport::close() {
+    quic.close();
+    bond.close();
+    if (socketHandle != invalidSocket) {
+        socketUtil::closeSocket(socketHandle);
+        socketHandle = invalidSocket;
+    }
+    connectedAddress.reset();
+    streamBuffer.clear();
+
+    // Completions of the closed socket never arrive; nothing reads the buffers any more
+    zeroCopy = false;
+    nextZeroCopyId = 0;
+    zeroCopyInFlight.clear();
+    sendPool.reset();
+}
+
+bool VpnTransport::isOpen() const {
+    return activeProtocol == Protocol::Quic ? quic.isOpen() : socketHandle != invalidSocket || bond.isOpen();
+}
+
+bool VpnTransport::send(std::span<const std::uint8_t> packet) {
+    if (activeProtocol == Protocol::Quic) {
+        return sendWire(packet);
+    }
+    if (socketHandle == invalidSocket && !bond.isOpen()) {
+        lastError = "Transport is not open";
+        return false;
+    }
+
+    // Told apart before the layers hide the opcode
+    const bool control = ControlChannel::isControlPacket(packet);
+    std::vector<std::uint8_t> wrapped;
+    if (!layers.empty()) {
+        if (packet.size() > maxPacketSize - layers.headroom()) {
+            lastError = "Packet too large for the transport layers";
+            return false;
+        }
+        wrapped = layers.wrap(packet);
+        packet = wrapped;
+    }
+
+    std::vector<std::uint8_t> framed;
+    std::span<const std::uint8_t> wire = packet;
+
+    if (activeProtocol == Protocol::Tcp && !layers.framesStream()) {
+        if (packet.size() > maxPacketSize) {
+            lastError = "Packet too large for TCP framing";
+            return false;
+        }
+        framed.reserve(packet.size() + 2);
+        framed.push_back(static_cast<std::uint8_t>(packet.size() >> 8));
+        framed.push_back(static_cast<std::uint8_t>(packet.size() & 0xff));
+        framed.insert(framed.end(), packet.begin(), packet.end());
+        wire = framed;
+    }
+    return bond.isOpen() ? sendBonded(wire, control) : sendWire(wire);
+}
+
+bool VpnTransport::sendBonded(std::span<const std::uint8_t> wire, bool control) {
+    if (!bond.send(wire, control)) {
+        lastError = bond.getLastError();
+        return false;
+    }
+    return true;
+}
+
+bool VpnTransport::sendWire(std::span<const std::uint8_t> wire) {
+    if (activeProtocol == Protocol::Quic) {
+        if (!quic.send(wire)) {
+            lastError = quic.getLastError();
+            return false;
+        }
+        return true;
+    }
+    if (bond.isOpen()) {
+        return sendBonded(wire, ControlChannel::isControlPacket(wire));
+    }
+    if (socketHandle == invalidSocket) {
+        lastError = "Transport is not open";
+        return false;
+    }
+
+    std::size_t offset = 0;
+    while (offset < wire.size()) {
+        auto sent = ::send(socketHandle, reinterpret_cast<const char*>(wire.data() + offset),
+                           static_cast<int>(wire.size() - offset), 0);
+        if (sent < 0) {
+            lastError = "Send failed: " + socketUtil::lastErrorText();
+            return false;
+        }
+        offset += static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+std::optional<std::vector<std::uint8_t>> VpnTransport::receive(std::chrono::milliseconds timeout,
+                                                               std::span<const SocketHandle> wakeHandles) {
+    if (activeProtocol == Protocol::Quic) {
+        auto packet = quic.receive(timeout, wakeHandles);
+        if (!packet && !quic.isOpen()) {
+            lastError = quic.getLastError();
+        }
+        return packet;
+    }
+    if (bond.isOpen()) {
+        // Unwrapped and back in order already
+        return bond.receive(timeout, wakeHandles);
+    }
+    if (socketHandle == invalidSocket) {
+        lastError = "Transport is not open";
+        return std::nullopt;
+    }
+
+    if (activeProtocol == Protocol::Tcp) {
+        if (auto packet = takeFramedPacket()) {
+            return packet;
+        }
+        if (socketHandle == invalidSocket) {
+            return std::nullopt;  // the stream was malformed
+        }
+    }
+
+    std::vector<SocketHandle> waitHandles{socketHandle};
+    waitHandles.insert(waitHandles.end(), wakeHandles.begin(), wakeHandles.end());
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (socketUtil::waitAnyReadable(waitHandles, std::max(remaining, std::chrono::milliseconds(0))) != 0) {
+            return std::nullopt;
+        }
+
+        #ifdef __linux__
+        // Zero-copy completions wake poll() as errors but are not packets
+        int flags = 0;
+        if (zeroCopy) {
+            reapCompletions();
+            flags = MSG_DONTWAIT;
+        }
+        #else
+        const int flags = 0;
+        #endif
+
+        std::vector<std::uint8_t> buffer(maxPacketSize);
+        auto received = ::recv(socketHandle, reinterpret_cast<char*>(buffer.data()),
+                               static_cast<int>(buffer.size()), flags);
+        #ifdef __linux__
+        if (received < 0 && flags != 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        #endif
+        if (received < 0) {
+            lastError = "Receive failed: " + socketUtil::lastErrorText();
+            return std::nullopt;
+        }
+
+        if (activeProtocol == Protocol::Udp) {
+            buffer.resize(static_cast<std::size_t>(received));
+            if (unwrapLayers(buffer)) {
+                return buffer;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        if (received == 0) {
+            lastError = "Connection closed by server";
+            close();
+            return std::nullopt;
+        }
+
+        streamBuffer.insert(streamBuffer.end(), buffer.begin(), buffer.begin() + received);
+        if (auto packet = takeFramedPacket()) {
+            return packet;
+        }
+        if (socketHandle == invalidSocket) {
+            return std::nullopt;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return std::nullopt;
+        }
+    }
+}
+
+std::size_t VpnTransport::receiveBatch(std::vector<std::vector<std::uint8_t>>& packets, std::chrono::milliseconds timeout,
+                                       std::span<const SocketHandle> wakeHandles) {
+    auto first = receive(timeout, wakeHandles);
+    if (!first) {
+        return 0;
+    }
+    if (packets.empty()) {
+        packets.resize(1);
+    }
+    packets[0] = std::move(*first);
+    std::size_t count = 1;
+
+    auto slot = [&packets](std::size_t index) -> std::vector<std::uint8_t>& {
+        if (index >= packets.size()) {
+            packets.resize(index + 1);
+        }
+        return packets[index];
+    };
+
+    const std::size_t batchLimit = 1 + reserveBatchSlots();
+    if (activeProtocol == Protocol::Quic || bond.isOpen()) {
+        // The connection, or the bond, read every datagram its sockets held while waiting
+        while (count < batchLimit) {
+            auto packet = activeProtocol == Protocol::Quic ? quic.receive(std::chrono::milliseconds(0))
+                                                           : bond.receive(std::chrono::milliseconds(0));
+            if (!packet) {
+                break;
+            }
+            slot(count++) = std::move(*packet);
+        }
+        return count;
+    }
+    if (activeProtocol == Protocol::Tcp) {
+        while (count < batchLimit) {
+            auto packet = takeFramedPacket();
+            if (!packet) {
+                break;
+            }
+            slot(count++) = std::move(*packet);
+        }
+        return count;
+    }
+
+    #ifdef __linux__
+    // One system call for everything a burst left in the socket buffer
+    const std::size_t slots = batchLimit - 1;
+    if (slots == 0) {
+        return count;
+    }
+    batchBuffer.resize(slots * batchSlotSize);
+    std::array<iovec, receiveBatchSize - 1> vectors{};
+    std::array<mmsghdr, receiveBatchSize - 1> messages{};
+    for (std::size_t i = 0; i < slots; ++i) {
+        vectors[i] = {batchBuffer.data() + i * batchSlotSize, batchSlotSize};
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int received = ::recvmmsg(socketHandle, messages.data(), static_cast<unsigned int>(slots), MSG_DONTWAIT, nullptr);
+    for (int i = 0; i < received; ++i) {
+        if (messages[static_cast<std::size_t>(i)].msg_hdr.msg_flags & MSG_TRUNC) {
+            continue;
+        }
+        // Unwrapped where it was received, copied once
+        auto inner = layers.unwrap(std::span(batchBuffer.data() + static_cast<std::size_t>(i) * batchSlotSize,
+                                             messages[static_cast<std::size_t>(i)].msg_len));
+        if (inner) {
+            slot(count++).assign(inner->begin(), inner->end());
+        }
+    }
+    #else
+    while (count < batchLimit && socketUtil::waitReadable(socketHandle, std::chrono::milliseconds(0))) {
+        auto packet = receive(std::chrono::milliseconds(0));
+        if (!packet) {
+            break;
+        }
+        slot(count++) = std::move(*packet);
+    }
+    #endif
+    return count;
+}
+
+bool VpnTransport::enableZeroCopy() {
+    #ifdef __linux__
+    if (socketHandle == invalidSocket || activeProtocol != Protocol::Udp) {
+        lastError = "Zero-copy sends need an open UDP transport";
+        return false;
+    }
+    int enabled = 1;
+    if (::setsockopt(socketHandle, SOL_SOCKET, SO_ZEROCOPY, &enabled, sizeof(enabled)) != 0) {
+        lastError = "SO_ZEROCOPY: " + socketUtil::lastErrorText();
+        return false;
+    }
+    zeroCopy = true;
+    return true;
+    #else
+    lastError = "Zero-copy sends are only available on Linux";
+    return false;
+    #endif
+}
+
+bool VpnTransport::zeroCopyEnabled() const {
+    return zeroCopy;
+}
+
+std::optional<std::uint32_t> VpnTransport::acquireBuffer() {
+    auto index = sendPool.acquire();
+    if (!index && zeroCopy) {
+        reapCompletions();
+        index = sendPool.acquire();
+    }
+    if (!index) {
+        ++dataStats.poolExhausted;
+    }
+    return index;
+}
+
+std::span<std::uint8_t> VpnTransport::pooledBuffer(std::uint32_t index) {
+    return sendPool.buffer(index);
+}
+
+void VpnTransport::releaseBuffer(std::uint32_t index) {
+    sendPool.release(index);
+}
+
+void VpnTransport::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    releaseBatchSlots();
+    memoryBudget = budget;
+    sendPool.setBudget(std::move(budget));
+}
+
+void VpnTransport::trimBuffers() {
+    if (zeroCopy) {
+        reapCompletions();
+    }
+    releaseBatchSlots();
+    batchBuffer.clear();
+    batchBuffer.shrink_to_fit();
+    streamBuffer.shrink_to_fit();
+    sendPool.trim(sendPoolFloor);
+}
+
+// Receive slots after the first; retried each batch until the full size is reserved
+std::size_t VpnTransport::reserveBatchSlots() {
+    constexpr std::size_t wanted = receiveBatchSize - 1;
+    if (!memoryBudget) {
+        return wanted;
+    }
+    if (batchSlots < wanted) {
+        batchSlots += memoryBudget->reserveUpTo(MemoryBudget::Subsystem::ReceiveBuffers, wanted - batchSlots,
+                                                batchSlotSize, 0);
+    }
+    return batchSlots;
+}
+
+void VpnTransport::releaseBatchSlots() {
+    if (memoryBudget) {
+        memoryBudget->release(MemoryBudget::Subsystem::ReceiveBuffers, batchSlots * batchSlotSize);
+    }
+    batchSlots = 0;
+}
+
+std::size_t VpnTransport::bufferedBytes() const {
+    return batchBuffer.capacity() + streamBuffer.capacity() + sendPool.allocatedBytes();
+}
+
+bool VpnTransport::sendPooled(std::uint32_t index, std::span<const std::uint8_t> wire) {
+    if (activeProtocol == Protocol::Quic) {
+        // Framed and sealed around the packet, in the same buffer
+        const auto buffer = sendPool.buffer(index);
+        const auto offset = static_cast<std::size_t>(wire.data() - buffer.data());
+        const bool sent = quic.sendInPlace(buffer, offset, wire.size());
+        if (sent) {
+            ++dataStats.pooledSends;
+        } else {
+            lastError = quic.getLastError();
+        }
+        sendPool.release(index);
+        return sent;
+    }
+    if (!layers.empty()) {
+        // Wrapped and framed in front of the packet, in the same buffer
+        const auto buffer = sendPool.buffer(index);
+        const auto offset = static_cast<std::size_t>(wire.data() - buffer.data());
+        auto wrapped = layers.wrap(buffer, offset, wire.size());
+        const bool prefixed = activeProtocol == Protocol::Tcp && !layers.framesStream();
+        if (wrapped.empty() || (prefixed && wrapped.data() - buffer.data() < 2)) {
+            lastError = "No headroom for the transport layers";
+            sendPool.release(index);
+            return false;
+        }
+        if (prefixed) {
+            wrapped = std::span(wrapped.data() - 2, wrapped.size() + 2);
+            wrapped[0] = static_cast<std::uint8_t>((wrapped.size() - 2) >> 8);
+            wrapped[1] = static_cast<std::uint8_t>(wrapped.size() - 2);
+        }
+        wire = wrapped;
+    }
+    if (bond.isOpen()) {
+        const bool sent = sendBonded(wire, false);
+        sendPool.release(index);
+        if (sent) {
+            ++dataStats.pooledSends;
+        }
+        return sent;
+    }
+
+    #ifdef __linux__
+    if (zeroCopy && socketHandle != invalidSocket) {
+        reapCompletions();
+        const auto sent = ::send(socketHandle, wire.data(), wire.size(), MSG_ZEROCOPY);
+        if (sent == static_cast<ssize_t>(wire.size())) {
+            // The kernel numbers zero-copy sends; the buffer is busy until its number completes
+            zeroCopyInFlight.emplace_back(nextZeroCopyId++, index);
+            ++dataStats.pooledSends;
+            ++dataStats.zeroCopySends;
+            return true;
+        }
+        // ENOBUFS: no room for more notifications right now, an ordinary send still works
+        if (sent >= 0 || errno != ENOBUFS) {
+            lastError = "Send failed: " + socketUtil::lastErrorText();
+            sendPool.release(index);
+            return false;
+        }
+    }
+    #endif
+    const bool sent = sendWire(wire);
+    sendPool.release(index);
+    if (sent) {
+        ++dataStats.pooledSends;
+    }
+    return sent;
+}
+
+VpnTransport::DataPathStats VpnTransport::dataPathStats() const {
+    return dataStats;
+}
+
+void VpnTransport::reapCompletions() {
+    #ifdef __linux__
+    // Each notification covers a range of sends, [ee_info, ee_data]
+    while (true) {
+        std::array<char, 128> control{};
+        msghdr message{};
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        if (::recvmsg(socketHandle, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            const bool recvErr = (header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) ||
+                                 (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) {
+                continue;
+            }
+            sock_extended_err error{};
+            std::memcpy(&error, CMSG_DATA(header), sizeof(error));
+            if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            const std::uint32_t first = error.ee_info;
+            const std::uint32_t span = error.ee_data - first;  // ids wrap, so compare offsets
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                dataStats.kernelCopied += span + 1;
+            }
+            std::erase_if(zeroCopyInFlight, [&](const auto& entry) {
+                if (entry.first - first > span) {
+                    return false;
+                }
+                sendPool.release(entry.second);
+                return true;
+            });
+        }
+    }
+    #endif
+}
+
+VpnTransport::Protocol VpnTransport::protocol() const {
+    return activeProtocol;
+}
+
+std::optional<QuicTunnel::Stats> VpnTransport::quicStats() const {
+    if (activeProtocol != Protocol::Quic) {
+        return std::nullopt;
+    }
+    return quic.stats();
+}
+
+std::vector<MultipathBond::PathStats> VpnTransport::pathStats() const {
+    return bond.pathStats();
+}
+
+std::optional<MultipathBond::ReorderStats> VpnTransport::reorderStats() const {
+    if (!bond.isOpen()) {
+        return std::nullopt;
+    }
+    return bond.reorderStats();
+}
+
+std::optional<sockaddr_storage> VpnTransport::remoteAddress() const {
+    return connectedAddress;
+}
+
+std::string VpnTransport::getLastError() const {
+    return lastError;
+}
+
+std::optional<std::vector<std::uint8_t>> VpnTransport::takeFramedPacket() {
+    // A TLS record header carries the length in its last two bytes and is
+    // part of what the layers unwrap; OpenVPN's prefix is not
+    const bool records = layers.framesStream();
+    const std::size_t header = records ? TransportChain::recordHeaderSize : 2;
+    if (streamBuffer.size() < header) {
+        return std::nullopt;
+    }
+
+    const std::size_t length = (static_cast<std::size_t>(streamBuffer[header - 2]) << 8) | streamBuffer[header - 1];
+    if (streamBuffer.size() < length + header) {
+        return std::nullopt;
+    }
+
+    const std::size_t start = records ? 0 : header;
+    auto inner = layers.unwrap(std::span(streamBuffer.data() + start, length + header - start));
+    if (!inner) {
+        // Nothing after a bad record can be trusted to start a new one
+        lastError = "Malformed record from server";
+        close();
+        return std::nullopt;
+    }
+    std::vector<std::uint8_t> packet(inner->begin(), inner->end());
+    streamBuffer.erase(streamBuffer.begin(), streamBuffer.begin() + static_cast<std::ptrdiff_t>(length + header));
+    return packet;
+}
+
+bool VpnTransport::unwrapLayers(std::vector<std::uint8_t>& packet) const {
+    if (layers.empty()) {
+        return true;
+    }
+    auto inner = layers.unwrap(packet);
+    if (!inner) {
+        return false;
+    }
+    const auto offset = inner->data() - packet.data();
+    const auto length = inner->size();
+    packet.erase(packet.begin(), packet.begin() + offset);
+    packet.resize(length);
+    return true;
+}
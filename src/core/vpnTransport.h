@@ -0,0 +1,157 @@
+#pragma once
+import std;
+#include "controlWrap.h"
+#include "multipathBond.h"
+#include "packetPool.h"
+#include "quicTunnel.h"
+#include "socketUtil.h"
+#include "transportLayers.h"
+
+// Connected UDP or TCP socket to a VPN server. TCP packets use the
+// OpenVPN 16-bit length prefix so callers always see whole packets.
+// A server with both IPv6 and IPv4 addresses is raced (Happy Eyeballs,
+// RFC 8305): attempts alternate families, a new one starts every 250 ms
+// while earlier ones are pending, and whichever completes first is kept.
+//
+// Data channel packets can be sent from pooled buffers they were sealed in,
+// optionally with MSG_ZEROCOPY so the kernel transmits straight from them.
+//
+// A TransportChain of obfuscation layers, if set, wraps every packet below
+// the framing and is undone on receipt; data packets are wrapped in their
+// pooled buffer, in the headroom left in front of them.
+//
+// QUIC carries the UDP packets as DATAGRAM frames through an HTTP/3 proxy
+// (see QuicTunnel) for networks that block plain UDP; the address opened is
+// the proxy's, and packets keep UDP framing.
+//
+// With multipath settings, UDP goes out over several uplinks at once (see
+// MultipathBond) to the server address the race picked.
+class VpnTransport {
+public:
+    enum class Protocol { Udp, Tcp, Quic };
+
+    struct DataPathStats {
+        std::uint64_t pooledSends = 0;    // sent from the buffer they were sealed in
+        std::uint64_t zeroCopySends = 0;  // of those, handed to the kernel with MSG_ZEROCOPY
+        std::uint64_t kernelCopied = 0;   // zero-copy sends the kernel completed by copying after all
+        std::uint64_t poolExhausted = 0;  // no free buffer: the caller had to copy
+    };
+
+    using SocketHandle = socketUtil::SocketHandle;
+    static constexpr SocketHandle invalidSocket = socketUtil::invalidSocket;
+
+    VpnTransport();
+    ~VpnTransport();
+
+    VpnTransport(const VpnTransport&) = delete;
+    VpnTransport& operator=(const VpnTransport&) = delete;
+
+    static Protocol protocolFromString(const std::string& proto);
+    // "udp4", "tcp6-client", "quic4", ... pin the address family; AF_UNSPEC otherwise
+    static int familyFromString(const std::string& proto);
+
+    // UDP race probes send their hard resets wrapped with this key, so
+    // servers that drop unauthenticated packets still answer them
+    void setControlWrap(std::optional<ControlWrap::Key> key);
+    // On by default; protocols other than OpenVPN turn it off, and UDP then
+    // takes the first address that connects instead of racing them
+    void setUdpProbe(bool enabled);
+    // Applies from the next open(); a chain ending in tls-record takes over
+    // TCP framing and cannot be used over UDP
+    void setLayers(TransportChain chain);
+    // The proxy and CONNECT-UDP target a Quic open() uses
+    void setQuicSettings(QuicTunnel::Settings settings);
+    // The uplinks a Udp open() bonds; nullopt for the default route alone
+    void setMultipath(std::optional<MultipathBond::Settings> settings);
+    // What sendPooled() needs free in front of a packet: the layers' headroom
+    // and the TCP length prefix, or QUIC's headers; 0 otherwise
+    std::size_t sendHeadroom() const;
+    // ... and behind it: QUIC's acknowledgement and tag
+    std::size_t sendTailroom() const;
+
+    bool open(const std::string& host, const std::string& port, Protocol protocol, int family = AF_UNSPEC);
+    void close();
+    bool isOpen() const;
+
+    bool send(std::span<const std::uint8_t> packet);
+    // Sends bytes that already carry the TCP length prefix (DataChannel::seal
+    // output) as they are; the layers are not applied. Over QUIC a datagram.
+    bool sendWire(std::span<const std::uint8_t> wire);
+    // The wait also ends early, without a packet, once one of wakeHandles is readable
+    std::optional<std::vector<std::uint8_t>> receive(std::chrono::milliseconds timeout,
+                                                     std::span<const SocketHandle> wakeHandles = {});
+    // Waits like receive() for the first packet, then takes whatever else is
+    // already queued (recvmmsg on Linux) up to receiveBatchSize. Returns how
+    // many of packets were filled; their buffers are reused between calls.
+    std::size_t receiveBatch(std::vector<std::vector<std::uint8_t>>& packets, std::chrono::milliseconds timeout,
+                             std::span<const SocketHandle> wakeHandles = {});
+    static constexpr std::size_t receiveBatchSize = 32;
+
+    // MSG_ZEROCOPY for sendPooled() on an open UDP transport (Linux 5.0+);
+    // false if unavailable, and pooled sends keep copying in the kernel.
+    // Cleared by close().
+    bool enableZeroCopy();
+    bool zeroCopyEnabled() const;
+
+    // Data path buffers: acquire one, seal the packet inside it
+    // (DataChannel::sealInPlace) and pass it to sendPooled(), which releases
+    // it right away or, with zero copy, once the kernel reports it is done
+    // with the pages. nullopt when every buffer is still in flight.
+    std::optional<std::uint32_t> acquireBuffer();
+    std::span<std::uint8_t> pooledBuffer(std::uint32_t index);
+    void releaseBuffer(std::uint32_t index);
+    // Without layers, wire already carries the framing; with them it is the
+    // bare packet (DataChannel UDP framing) with sendHeadroom() free in front
+    // of it, where it is wrapped and framed; QUIC frames and seals it there too
+    bool sendPooled(std::uint32_t index, std::span<const std::uint8_t> wire);
+    DataPathStats dataPathStats() const;
+    // Charges receive batches and send buffers to budget; under its caps
+    // batches get smaller and pooled sends fall back to copying
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget);
+    // Gives receive and send buffers back down to a small floor, e.g. while
+    // the connection is paused; they grow again with traffic
+    void trimBuffers();
+    std::size_t bufferedBytes() const;
+
+    Protocol protocol() const;
+    // Recovery, key update and migration counters of the last QUIC connection
+    std::optional<QuicTunnel::Stats> quicStats() const;
+    // Per-uplink counters of a multipath connection; empty otherwise
+    std::vector<MultipathBond::PathStats> pathStats() const;
+    std::optional<MultipathBond::ReorderStats> reorderStats() const;
+    // The server address the race picked
+    std::optional<sockaddr_storage> remoteAddress() const;
+    std::string getLastError() const;
+
+private:
+    SocketHandle race(const std::vector<sockaddr_storage>& candidates, Protocol protocol);
+    std::optional<std::vector<std::uint8_t>> takeFramedPacket();
+    // Undoes the layers on a received packet; false if it is to be dropped
+    bool unwrapLayers(std::vector<std::uint8_t>& packet) const;
+    bool sendBonded(std::span<const std::uint8_t> wire, bool control);
+    void reapCompletions();
+    std::size_t reserveBatchSlots();
+    void releaseBatchSlots();
+
+    SocketHandle socketHandle = invalidSocket;
+    Protocol activeProtocol = Protocol::Udp;
+    std::optional<sockaddr_storage> connectedAddress;
+    std::vector<std::uint8_t> streamBuffer;
+    std::vector<std::uint8_t> batchBuffer;
+    std::shared_ptr<MemoryBudget> memoryBudget;
+    std::size_t batchSlots = 0;  // receive slots beyond the first, as reserved
+    std::optional<ControlWrap::Key> wrapKey;
+    bool udpProbe = true;
+    TransportChain layers;
+    std::optional<QuicTunnel::Settings> quicSettings;
+    QuicTunnel quic;
+    std::optional<MultipathBond::Settings> multipathSettings;
+    MultipathBond bond;
+
+    PacketPool sendPool;
+    bool zeroCopy = false;
+    std::uint32_t nextZeroCopyId = 0;
+    std::deque<std::pair<std::uint32_t, std::uint32_t>> zeroCopyInFlight;  // notification id, buffer
+    DataPathStats dataStats;
+    std::string lastError;
+};
@@ -0,0 +1,161 @@
+import std;
+#include "wakeupScheduler.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Longest sleep without anything armed; keeps a stuck timer from parking the loop forever
+constexpr std::chrono::minutes maxWait{5};
+#ifndef __linux__
+constexpr std::chrono::seconds uninterruptibleWait{1};
+#endif
+
+#ifdef __linux__
+constexpr unsigned long activeTimerSlackNs = 50'000;     // the kernel default
+constexpr unsigned long idleTimerSlackNs = 50'000'000;
+#endif
+
+} // namespace
+
+WakeupScheduler::WakeupScheduler() {
+    #ifdef __linux__
+    interruptFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (interruptFd >= 0) {
+        handles.push_back(interruptFd);
+    }
+    clockWatchFd = ::timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (clockWatchFd >= 0) {
+        armClockWatch();
+        handles.push_back(clockWatchFd);
+    }
+    #endif
+}
+
+WakeupScheduler::~WakeupScheduler() {
+    #ifdef __linux__
+    for (int fd : {interruptFd, clockWatchFd}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    #endif
+}
+
+void WakeupScheduler::arm(Timer timer, Clock::time_point due, Clock::duration early, Clock::duration late) {
+    windows[static_cast<std::size_t>(timer)] = {true, due - early, due + late};
+}
+
+void WakeupScheduler::disarm(Timer timer) {
+    windows[static_cast<std::size_t>(timer)].armed = false;
+}
+
+bool WakeupScheduler::fire(Timer timer, Clock::time_point now) {
+    Window& window = windows[static_cast<std::size_t>(timer)];
+    if (!window.armed || now < window.opens) {
+        return false;
+    }
+    window.armed = false;
+    return true;
+}
+
+std::chrono::milliseconds WakeupScheduler::waitTime(Clock::time_point now) const {
+    auto wakeup = now + maxWait;
+    for (const auto& window : windows) {
+        if (window.armed) {
+            wakeup = std::min(wakeup, window.closes);
+        }
+    }
+    // Rounded up: waking a hair early would only mean a second wakeup
+    auto wait = std::chrono::ceil<std::chrono::milliseconds>(std::max(wakeup - now, Clock::duration::zero()));
+    #ifndef __linux__
+    wait = std::min<std::chrono::milliseconds>(wait, uninterruptibleWait);
+    #endif
+    return wait;
+}
+
+std::span<const socketUtil::SocketHandle> WakeupScheduler::wakeHandles() const {
+    return handles;
+}
+
+void WakeupScheduler::interrupt() {
+    #ifdef __linux__
+    if (interruptFd >= 0) {
+        const std::uint64_t one = 1;
+        [[maybe_unused]] auto written = ::write(interruptFd, &one, sizeof(one));
+    }
+    #endif
+}
+
+bool WakeupScheduler::consumeWakeEvents() {
+    #ifdef __linux__
+    std::uint64_t value = 0;
+    if (interruptFd >= 0) {
+        [[maybe_unused]] auto drained = ::read(interruptFd, &value, sizeof(value));
+    }
+    // A cancelled absolute timer fails its read with ECANCELED
+    if (clockWatchFd >= 0 && ::read(clockWatchFd, &value, sizeof(value)) < 0 && errno == ECANCELED) {
+        armClockWatch();
+        return true;
+    }
+    #endif
+    return false;
+}
+
+void WakeupScheduler::setThreadIdle(bool idle) {
+    #ifdef __linux__
+    ::prctl(PR_SET_TIMERSLACK, idle ? idleTimerSlackNs : activeTimerSlackNs);
+    #else
+    (void)idle;
+    #endif
+}
+
+// Armed a year ahead so it never expires; it only exists to be cancelled
+void WakeupScheduler::armClockWatch() {
+    #ifdef __linux__
+    itimerspec spec{};
+    ::clock_gettime(CLOCK_REALTIME, &spec.it_value);
+    spec.it_value.tv_sec += 365 * 24 * 60 * 60;
+    ::timerfd_settime(clockWatchFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr);
+    #endif
+}
+
+void WakeupScheduler::recordWakeup(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(rateMutex);
+    advance(now);
+    ++perSecond[static_cast<std::size_t>(currentSecond % 60)];
+}
+
+void WakeupScheduler::restartMeasurement(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(rateMutex);
+    perSecond.fill(0);
+    currentSecond = 0;
+    measuredSince = now;
+}
+
+double WakeupScheduler::wakeupsPerMinute(Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(rateMutex);
+    advance(now);
+    const double count = std::accumulate(perSecond.begin(), perSecond.end(), 0.0);
+    const double measured = std::chrono::duration<double>(now - measuredSince).count();
+    return measured >= 60.0 ? count : count * 60.0 / std::max(measured, 1.0);
+}
+
+// Clears the seconds that went by without a wakeup
+void WakeupScheduler::advance(Clock::time_point now) const {
+    const auto second = std::chrono::duration_cast<std::chrono::seconds>(now - measuredSince).count();
+    if (second - currentSecond >= 60) {
+        perSecond.fill(0);
+        currentSecond = second;
+        return;
+    }
+    while (currentSecond < second) {
+        ++currentSecond;
+        perSecond[static_cast<std::size_t>(currentSecond % 60)] = 0;
+    }
+}
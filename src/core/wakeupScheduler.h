@@ -0,0 +1,75 @@
+#pragma once
+import std;
+#include "socketUtil.h"
+
+// Timers of the connected loop (keepalives, control retransmits, stats
+// sampling) coalesced into as few wakeups as possible. Every timer may fire
+// anywhere in a window around its due time; the loop sleeps until the first
+// window closes and then fires every timer whose window has opened, so a
+// stats sample rides along with the next keepalive instead of waking the
+// thread by itself.
+//
+// On Linux the wait also ends on interrupt() (an eventfd) and when the wall
+// clock is set (a timerfd with TFD_TIMER_CANCEL_ON_SET), which usually
+// follows a resume from suspend. Elsewhere there is nothing to poll and
+// waits are capped at a second.
+class WakeupScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Timer : std::uint8_t { Keepalive, Control, StatsSample };
+    static constexpr std::size_t timerCount = 3;
+
+    WakeupScheduler();
+    ~WakeupScheduler();
+
+    WakeupScheduler(const WakeupScheduler&) = delete;
+    WakeupScheduler& operator=(const WakeupScheduler&) = delete;
+
+    // The timer fires anywhere in [due - early, due + late]
+    void arm(Timer timer, Clock::time_point due, Clock::duration early = {}, Clock::duration late = {});
+    void disarm(Timer timer);
+    // True once the timer's window has opened; the timer is disarmed then
+    bool fire(Timer timer, Clock::time_point now);
+
+    // How long the loop may sleep: until the first window closes
+    std::chrono::milliseconds waitTime(Clock::time_point now) const;
+    // Poll these along with the socket; readable after interrupt() or a clock change
+    std::span<const socketUtil::SocketHandle> wakeHandles() const;
+    // Ends the current wait; safe from any thread
+    void interrupt();
+    // After a wait: clears interrupts and re-arms the clock watch; true if
+    // the wall clock was set since the last call
+    bool consumeWakeEvents();
+
+    // Timer slack of the calling thread (Linux): coarse while idle, so the
+    // kernel may serve the wakeup together with other processes' timers
+    static void setThreadIdle(bool idle);
+
+    // Every return from a wait counts as a wakeup; the rate covers the last
+    // minute (extrapolated until a minute has been measured). Thread-safe.
+    void recordWakeup(Clock::time_point now);
+    void restartMeasurement(Clock::time_point now);
+    double wakeupsPerMinute(Clock::time_point now) const;
+
+private:
+    struct Window {
+        bool armed = false;
+        Clock::time_point opens;
+        Clock::time_point closes;
+    };
+
+    void advance(Clock::time_point now) const;
+    void armClockWatch();
+
+    std::array<Window, timerCount> windows;
+
+    std::vector<socketUtil::SocketHandle> handles;
+    int interruptFd = -1;    // eventfd
+    int clockWatchFd = -1;   // timerfd on CLOCK_REALTIME
+
+    mutable std::mutex rateMutex;
+    mutable std::array<std::uint32_t, 60> perSecond{};  // ring of the last minute
+    mutable std::int64_t currentSecond = 0;
+    Clock::time_point measuredSince = Clock::now();
+};
@@ -0,0 +1,537 @@
+import std;
+#include "wireGuardBackend.h"
+#include "networkImpairment.h"
+#include "tunDevice.h"
+#include "vpnTransport.h"
+#include "wireGuardProfile.h"
+#include "wireGuardSession.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::chrono::seconds statsSampleInterval{60};
+constexpr std::chrono::seconds statsSampleSlack{30};
+constexpr std::chrono::milliseconds handshakeTimerSlack{20};
+constexpr std::size_t maxPayload = 65535;
+constexpr int defaultMtu = 1420;  // wg-quick's for IPv4 and IPv6 endpoints alike
+constexpr std::size_t tunReadBatch = VpnTransport::receiveBatchSize;  // packets per wakeup
+
+// Handshake retransmits are spread by up to a third of a second (WireGuard's REKEY_TIMEOUT_JITTER)
+Clock::duration retransmitDelay() {
+    static thread_local std::mt19937 generator{std::random_device{}()};
+    return WireGuardSession::rekeyTimeout + std::chrono::milliseconds(std::uniform_int_distribution<int>(0, 333)(generator));
+}
+
+} // namespace
+
+WireGuardBackend::WireGuardBackend() = default;
+
+WireGuardBackend::~WireGuardBackend() {
+    stop();
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+}
+
+bool WireGuardBackend::start(const VpnConfigManager::ClientConfig& config) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running) {
+        lastError = "Connection already in progress";
+        return false;
+    }
+    // A broken profile fails here rather than from the session thread
+    WireGuardProfile profile;
+    try {
+        profile = WireGuardProfile::parse(config.content.view());
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return false;
+    }
+
+    // A previous session may have ended on its own; reap its thread first
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+    profileText = config.content;
+    serverOverride = config.server_override;
+    portOverride = config.port_override;
+    zeroCopySend = config.zeroCopySend;
+    idleCoalescing = config.idleCoalescing;
+    dnsServers = profile.dnsServers;
+    carriesIpv6 = std::any_of(profile.addresses.begin(), profile.addresses.end(),
+                              [](const std::string& address) { return address.find(':') != std::string::npos; });
+    serverAddress.reset();
+    lastError.clear();
+    stopRequested = false;
+    pauseRequested = false;
+    restartRequested = false;
+    running = true;
+
+    sessionThread = std::thread([this]() {
+        while (runSession() && !stopRequested) {
+        }
+    });
+    emitLog(3, "WireGuard client started");
+    return true;
+}
+
+void WireGuardBackend::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!running) {
+            return;
+        }
+        stopRequested = true;
+        running = false;
+        pauseRequested = false;
+    }
+    pauseCv.notify_all();
+    wakeups.interrupt();
+    if (sessionThread.joinable()) {
+        sessionThread.join();
+    }
+    emitEvent("DISCONNECTED", "Connection stopped by user");
+    emitLog(3, "WireGuard client disconnected");
+}
+
+// Like the OpenVPN engine: the session thread parks once connected; a pause
+// requested during the handshake takes effect when it completes
+void WireGuardBackend::pause() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (running) {
+        pauseRequested = true;
+        wakeups.interrupt();
+    }
+}
+
+void WireGuardBackend::resume() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!pauseRequested) {
+            return;
+        }
+        pauseRequested = false;
+    }
+    pauseCv.notify_all();
+}
+
+// A new session on the same thread: fresh socket, endpoint lookup and handshake
+void WireGuardBackend::reconnect() {
+    if (!running) {
+        return;
+    }
+    emitEvent("RECONNECTING", "Attempting to reconnect");
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        restartRequested = true;
+        pauseRequested = false;
+    }
+    pauseCv.notify_all();
+    wakeups.interrupt();
+}
+
+std::string WireGuardBackend::getLastError() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return lastError;
+}
+
+std::vector<std::string> WireGuardBackend::getPushedDnsServers() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return dnsServers;
+}
+
+std::optional<sockaddr_storage> WireGuardBackend::getServerAddress() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return serverAddress;
+}
+
+bool WireGuardBackend::tunnelCarriesIpv6() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return carriesIpv6;
+}
+
+double WireGuardBackend::getWakeupsPerMinute() const {
+    return wakeups.wakeupsPerMinute(Clock::now());
+}
+
+std::string WireGuardBackend::tunnelInterface() const {
+    return "wg0";
+}
+
+void WireGuardBackend::clearSensitiveData() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (!running) {
+        profileText.clear();
+    }
+}
+
+void WireGuardBackend::setMemoryBudget(std::shared_ptr<MemoryBudget> budget) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    memoryBudget = std::move(budget);
+}
+
+void WireGuardBackend::setImpairmentScenario(std::optional<ImpairmentScenario> scenario) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    impairmentScenario = std::move(scenario);
+}
+
+bool WireGuardBackend::runSession() {
+    WakeupScheduler::setThreadIdle(false);
+    restartRequested = false;
+    emitEvent("CONNECTING", "Resolving server address...");
+
+    std::optional<WireGuardProfile> profile;
+    std::string host;
+    std::string port;
+    std::optional<ImpairmentScenario> scenario;
+    std::shared_ptr<MemoryBudget> budget;
+    bool zeroCopy = false;
+    bool coalesce = true;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        profile = WireGuardProfile::parse(profileText.view());  // checked by start()
+        host = serverOverride.empty() ? profile->server().host : serverOverride;
+        port = portOverride.empty() ? profile->server().port : portOverride;
+        scenario = impairmentScenario;
+        budget = memoryBudget;
+        zeroCopy = zeroCopySend;
+        coalesce = idleCoalescing;
+    }
+    const WireGuardProfile::Peer& peer = profile->server();
+
+    std::unique_ptr<WireGuardSession> session;
+    try {
+        session = std::make_unique<WireGuardSession>(profile->privateKey, peer.publicKey, peer.presharedKey);
+    } catch (const std::exception& e) {
+        failConnection("CONNECTION_FAILED", e.what());
+        return false;
+    }
+
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    // Declared before the transport so the proxy outlives it
+    std::unique_ptr<ImpairmentProxy> impairmentProxy;
+    #endif
+    VpnTransport transport;
+    transport.setMemoryBudget(std::move(budget));
+    transport.setUdpProbe(false);
+    std::string connectHost = host;
+    std::string connectPort = port;
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    if (scenario) {
+        impairmentProxy = std::make_unique<ImpairmentProxy>(*scenario);
+        auto localPort = impairmentProxy->start(host, port, VpnTransport::Protocol::Udp);
+        if (!localPort) {
+            failConnection("CONNECTION_FAILED", "Impairment proxy failed: " + impairmentProxy->getLastError());
+            return false;
+        }
+        connectHost = "127.0.0.1";
+        connectPort = std::to_string(*localPort);
+        emitLog(2, "Routing " + host + ":" + port + " through impairment scenario '" + scenario->name + "' on port " +
+                       connectPort);
+    }
+    #endif
+    if (!transport.open(connectHost, connectPort, VpnTransport::Protocol::Udp)) {
+        failConnection("CONNECTION_FAILED", "Server unreachable: " + transport.getLastError());
+        return false;
+    }
+    if (auto address = transport.remoteAddress()) {
+        emitLog(3, "Endpoint " + socketUtil::addressToString(*address));
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        serverAddress = transport.remoteAddress();
+    }
+    if (zeroCopy && !transport.enableZeroCopy()) {
+        emitLog(2, "Zero-copy sends unavailable: " + transport.getLastError());
+    }
+
+    std::vector<std::vector<std::uint8_t>> packets;
+    std::vector<std::uint8_t> payload(maxPayload);
+    // For device packets when no pooled buffer is free or big enough
+    std::vector<std::uint8_t> sendBuffer(WireGuardSession::headroom + maxPayload + WireGuardSession::tailroom);
+    auto lastSent = Clock::now();
+    std::optional<Clock::time_point> dataReceived;  // payload since our last send, for the passive keepalive
+    std::optional<Clock::time_point> handshakeStarted;
+    Clock::time_point nextRetransmit;
+
+    auto sendInitiation = [&](Clock::time_point now) {
+        const auto message = session->createInitiation();
+        transport.send(message);
+        lastSent = now;
+        nextRetransmit = now + retransmitDelay();
+    };
+    // A worn or expired keypair starts a handshake before anything is sent;
+    // the current one keeps sending until its replacement arrives
+    auto readyToSend = [&](Clock::time_point now) {
+        if ((session->wantsRekey(now) || !session->canSend(now)) && !handshakeStarted) {
+            emitLog(4, "Renegotiating WireGuard keys");
+            handshakeStarted = now;
+            sendInitiation(now);
+        }
+        return session->canSend(now);
+    };
+    // Keepalives go out from a pooled buffer, sealed where they lie
+    auto sendKeepalive = [&](Clock::time_point now) {
+        if (!readyToSend(now)) {
+            return false;
+        }
+        bool sent = false;
+        if (auto index = transport.acquireBuffer()) {
+            if (auto wire = session->sealInPlace(transport.pooledBuffer(*index), 0, now); !wire.empty()) {
+                sent = transport.sendPooled(*index, wire);
+            } else {
+                transport.releaseBuffer(*index);
+            }
+        }
+        lastSent = now;
+        dataReceived.reset();
+        return sent;
+    };
+
+    // Handshake: initiations every REKEY_TIMEOUT until REKEY_ATTEMPT_TIME is up
+    emitEvent("CONNECTING", "Performing WireGuard handshake...");
+    const auto handshakeDeadline = Clock::now() + WireGuardSession::rekeyAttemptTime;
+    sendInitiation(Clock::now());
+    while (!session->canSend(Clock::now())) {
+        if (stopRequested || restartRequested) {
+            return restartRequested.load();
+        }
+        auto now = Clock::now();
+        if (now >= handshakeDeadline) {
+            failConnection("CONNECTION_TIMEOUT", "No WireGuard handshake response from " + host + ":" + port);
+            return false;
+        }
+        if (now >= nextRetransmit) {
+            emitLog(3, "Handshake did not complete; retrying");
+            sendInitiation(now);
+        }
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(std::min(nextRetransmit, handshakeDeadline) - now);
+        const std::size_t received = transport.receiveBatch(packets, std::max(wait, std::chrono::milliseconds(0)),
+                                                            wakeups.wakeHandles());
+        wakeups.consumeWakeEvents();
+        now = Clock::now();
+        for (std::size_t i = 0; i < received; ++i) {
+            const auto type = WireGuardSession::messageType(packets[i]);
+            if (type == WireGuardSession::MessageType::Response) {
+                session->consumeResponse(packets[i], now);
+            } else if (type == WireGuardSession::MessageType::CookieReply && session->consumeCookieReply(packets[i], now)) {
+                emitLog(3, "Server is under load; the next handshake carries its cookie");
+            }
+        }
+    }
+    // The device is up with the profile's addresses, and routes for the
+    // server's AllowedIPs, before the session is reported connected
+    emitEvent("CONNECTING", "Configuring tunnel interface...");
+    TunDevice tun;
+    {
+        TunDevice::Settings settings;
+        for (const auto& address : profile->addresses) {
+            const bool v6 = address.find(':') != std::string::npos;
+            settings.addresses.push_back(
+                {address.find('/') == std::string::npos ? address + (v6 ? "/128" : "/32") : address, {}});
+        }
+        settings.routes = peer.allowedIps;
+        settings.mtu = profile->mtu.value_or(defaultMtu);
+        settings.server = transport.remoteAddress();
+        if (!tun.open(tunnelInterface()) || !tun.configure(settings)) {
+            failConnection("CONNECTION_FAILED", "Tunnel device: " + tun.getLastError());
+            return false;
+        }
+        emitLog(3, "Tunnel device " + tun.name() + " (mtu " + std::to_string(tun.mtu()) + ") up");
+    }
+
+    // The responder only uses the new keys once it has heard from us on them
+    sendKeepalive(Clock::now());
+    emitEvent("CONNECTED", "WireGuard tunnel to " + host + ":" + port);
+    emitLog(3, "WireGuard handshake complete");
+
+    const auto persistentKeepalive = peer.persistentKeepalive;
+    auto armTimers = [&]() {
+        // Persistent keepalives hold NAT mappings open; the passive one tells
+        // the server its packets arrived when we have nothing else to send
+        std::optional<Clock::time_point> due;
+        if (persistentKeepalive.count() > 0) {
+            due = lastSent + persistentKeepalive;
+        }
+        if (dataReceived) {
+            due = std::min(due.value_or(Clock::time_point::max()), *dataReceived + WireGuardSession::keepaliveTimeout);
+        }
+        if (due) {
+            wakeups.arm(WakeupScheduler::Timer::Keepalive, *due);
+        } else {
+            wakeups.disarm(WakeupScheduler::Timer::Keepalive);
+        }
+        if (handshakeStarted) {
+            wakeups.arm(WakeupScheduler::Timer::Control, nextRetransmit, {},
+                        coalesce ? handshakeTimerSlack : Clock::duration{});
+        } else {
+            wakeups.disarm(WakeupScheduler::Timer::Control);
+        }
+    };
+    auto armStatsSample = [&](Clock::time_point now) {
+        wakeups.arm(WakeupScheduler::Timer::StatsSample, now + statsSampleInterval, {},
+                    coalesce ? statsSampleSlack : Clock::duration{});
+    };
+    armStatsSample(Clock::now());
+    wakeups.restartMeasurement(Clock::now());
+    // The wait also ends when the system routes a packet into the tunnel
+    std::vector<socketUtil::SocketHandle> waitHandles(wakeups.wakeHandles().begin(), wakeups.wakeHandles().end());
+    waitHandles.push_back(tun.handle());
+
+    while (!stopRequested && !restartRequested) {
+        if (pauseRequested) {
+            // No timers and no traffic while paused. The keypair stays; if
+            // it has expired by the time we resume, the next keepalive
+            // starts a handshake.
+            const auto pausedAt = Clock::now();
+            wakeups.restartMeasurement(pausedAt);
+            packets.clear();
+            packets.shrink_to_fit();
+            transport.trimBuffers();
+            emitEvent("PAUSED", "Connection paused");
+            emitLog(3, std::format("WireGuard client paused, {} bytes of transport buffers kept", transport.bufferedBytes()));
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                pauseCv.wait(lock, [this] { return !pauseRequested || stopRequested || restartRequested; });
+            }
+            if (stopRequested || restartRequested) {
+                break;
+            }
+            const auto resumedAt = Clock::now();
+            handshakeStarted.reset();
+            sendKeepalive(resumedAt);
+            armStatsSample(resumedAt);
+            wakeups.restartMeasurement(resumedAt);
+            emitEvent("RESUMED", "Connection resumed");
+            emitLog(3, "WireGuard client resumed");
+            continue;
+        }
+
+        auto now = Clock::now();
+        if (wakeups.fire(WakeupScheduler::Timer::Keepalive, now)) {
+            sendKeepalive(now);
+        }
+        if (wakeups.fire(WakeupScheduler::Timer::Control, now) && handshakeStarted && session->handshakeInFlight()) {
+            if (now - *handshakeStarted >= WireGuardSession::rekeyAttemptTime) {
+                handshakeStarted.reset();
+                if (!session->canSend(now)) {
+                    emitEvent("RECONNECTING", "Server stopped answering handshakes");
+                    emitLog(2, "WireGuard keys expired without a new handshake; starting over");
+                    return true;
+                }
+            } else {
+                sendInitiation(now);
+            }
+        }
+        if (wakeups.fire(WakeupScheduler::Timer::StatsSample, now)) {
+            const auto stats = session->stats();
+            emitLog(4, std::format("{:.1f} wakeups/min, {} sent, {} received, {} handshakes",
+                                   wakeups.wakeupsPerMinute(now), stats.sealed, stats.opened, stats.handshakes));
+            armStatsSample(now);
+        }
+        armTimers();
+
+        const std::size_t received = transport.receiveBatch(packets, wakeups.waitTime(now), waitHandles);
+        now = Clock::now();
+        wakeups.recordWakeup(now);
+        if (wakeups.consumeWakeEvents()) {
+            // Mostly a resume from suspend: NAT bindings may be gone
+            emitLog(3, "System clock changed; sending a keepalive");
+            sendKeepalive(now);
+        }
+        for (std::size_t i = 0; i < received; ++i) {
+            const auto type = WireGuardSession::messageType(packets[i]);
+            if (type == WireGuardSession::MessageType::Transport) {
+                // Empty payloads are keepalives; the rest goes to the system
+                if (auto length = session->open(packets[i], payload, now); length && *length > 0) {
+                    tun.write(std::span(payload.data(), *length));
+                    dataReceived = dataReceived.value_or(now);
+                }
+            } else if (type == WireGuardSession::MessageType::Response && session->consumeResponse(packets[i], now)) {
+                handshakeStarted.reset();
+                emitLog(4, "WireGuard keys renegotiated");
+                sendKeepalive(now);
+            } else if (type == WireGuardSession::MessageType::CookieReply) {
+                session->consumeCookieReply(packets[i], now);
+            }
+        }
+        // Outbound packets, read into a send buffer at WireGuardSession::headroom
+        // and sealed there; a batch per wakeup, the next wait returns at once
+        // for the rest. Without keys they are read all the same and dropped.
+        for (std::size_t i = 0; i < tunReadBatch; ++i) {
+            auto index = transport.acquireBuffer();
+            std::span<std::uint8_t> buffer(sendBuffer);
+            if (index) {
+                const auto pooled = transport.pooledBuffer(*index);
+                if (pooled.size() >= WireGuardSession::headroom + static_cast<std::size_t>(tun.mtu()) +
+                                         WireGuardSession::tailroom) {
+                    buffer = pooled;
+                } else {
+                    transport.releaseBuffer(*index);
+                    index.reset();
+                }
+            }
+            const auto length = tun.read(
+                buffer.subspan(WireGuardSession::headroom,
+                               buffer.size() - WireGuardSession::headroom - WireGuardSession::tailroom));
+            std::span<std::uint8_t> wire;
+            if (length && *length > 0 && readyToSend(now)) {
+                wire = session->sealInPlace(buffer, *length, now);
+            }
+            if (index && !wire.empty()) {
+                transport.sendPooled(*index, wire);
+            } else if (index) {
+                transport.releaseBuffer(*index);
+            } else if (!wire.empty()) {
+                transport.send(wire);
+            }
+            if (!wire.empty()) {
+                lastSent = now;
+                dataReceived.reset();
+            }
+            if (!length) {
+                failConnection("CONNECTION_FAILED", tun.getLastError());
+                return false;
+            }
+            if (*length == 0) {
+                break;
+            }
+        }
+        if (received == 0 && !transport.isOpen()) {
+            failConnection("CONNECTION_FAILED", "Transport closed: " + transport.getLastError());
+            return false;
+        }
+    }
+
+    const auto stats = session->stats();
+    emitLog(3, std::format("WireGuard: {} sent, {} received, {} failed authentication, {} replayed, {} handshakes",
+                           stats.sealed, stats.opened, stats.authFailures, stats.replays, stats.handshakes));
+    const auto tunStats = tun.stats();
+    emitLog(3, std::format("Tunnel device {}: {} packets read, {} written, {} refused by the system", tun.name(),
+                           tunStats.packetsRead, tunStats.packetsWritten, tunStats.writeErrors));
+    if (const auto dataStats = transport.dataPathStats(); dataStats.pooledSends > 0) {
+        emitLog(3, std::format("Data path: {} sent in place ({} zero-copy, {} copied by the kernel)",
+                               dataStats.pooledSends, dataStats.zeroCopySends, dataStats.kernelCopied));
+    }
+    #ifdef SIAVPN_HAVE_IMPAIRMENT
+    if (impairmentProxy) {
+        const auto impairment = impairmentProxy->stats();
+        emitLog(3, std::format("Impairment up: {} packets, {} dropped; down: {} packets, {} dropped",
+                               impairment.upstream.packets, impairment.upstream.dropped + impairment.upstream.queueDrops,
+                               impairment.downstream.packets,
+                               impairment.downstream.dropped + impairment.downstream.queueDrops));
+    }
+    #endif
+    return restartRequested.load();
+}
+
+void WireGuardBackend::failConnection(const std::string& eventName, const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        lastError = error;
+        running = false;
+    }
+    emitEvent(eventName, error);
+    emitLog(1, "WireGuard connection failed: " + error);
+}
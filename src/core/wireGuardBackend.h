@@ -0,0 +1,67 @@
+#pragma once
+import std;
+#include "secureMemory.h"
+#include "vpnBackend.h"
+#include "wakeupScheduler.h"
+
+// WireGuard in this process: WireGuardSession on a VpnTransport UDP socket,
+// with the same send buffer pool, memory budget, impairment proxy and
+// coalesced timers as the OpenVPN engine. The profile is a wg-quick style
+// configuration (WireGuardProfile); server_override and port_override
+// replace the first peer's endpoint. Traffic goes through a TunDevice named
+// wg0 with the profile's Address and MTU, routed for the peer's AllowedIPs.
+//
+// Keys are renegotiated the way the protocol has the initiator do it: when
+// something is about to be sent on a keypair past its rekey time, so an idle
+// tunnel without PersistentKeepalive does not wake up at all.
+class WireGuardBackend : public VpnBackend {
+public:
+    WireGuardBackend();
+    ~WireGuardBackend() override;
+
+    bool start(const VpnConfigManager::ClientConfig& config) override;
+    void stop() override;
+    void pause() override;
+    void resume() override;
+    void reconnect() override;
+    std::string getLastError() const override;
+
+    // The profile's DNS = entries
+    std::vector<std::string> getPushedDnsServers() const override;
+    std::optional<sockaddr_storage> getServerAddress() const override;
+    // True if the profile assigns an IPv6 Address
+    bool tunnelCarriesIpv6() const override;
+    double getWakeupsPerMinute() const override;
+    std::string tunnelInterface() const override;
+
+    void clearSensitiveData() override;
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> budget) override;
+    void setImpairmentScenario(std::optional<ImpairmentScenario> scenario) override;
+
+private:
+    // One session from handshake to stop; true asks for an immediate new one
+    bool runSession();
+    void failConnection(const std::string& eventName, const std::string& error);
+
+    std::thread sessionThread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopRequested{false};
+    std::atomic<bool> pauseRequested{false};
+    std::atomic<bool> restartRequested{false};
+    std::condition_variable pauseCv;  // the paused session thread waits here
+    WakeupScheduler wakeups;          // interrupted by pause, reconnect and stop
+
+    SecureString profileText;  // holds the private key
+    std::string serverOverride;
+    std::string portOverride;
+    bool zeroCopySend = false;
+    bool idleCoalescing = true;
+    std::shared_ptr<MemoryBudget> memoryBudget;
+    std::optional<ImpairmentScenario> impairmentScenario;
+
+    std::vector<std::string> dnsServers;
+    bool carriesIpv6 = false;
+    std::optional<sockaddr_storage> serverAddress;
+    std::string lastError;
+    mutable std::mutex stateMutex;
+};
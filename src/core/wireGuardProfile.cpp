@@ -0,0 +1,214 @@
+import std;
+#include "wireGuardProfile.h"
+#include "socketUtil.h"
+#include <openssl/evp.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+    const auto first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    const auto last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+std::string lower(std::string_view text) {
+    std::string result(text);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return result;
+}
+
+// "a, b,c" -> {"a", "b", "c"}
+std::vector<std::string> splitList(std::string_view value) {
+    std::vector<std::string> items;
+    std::size_t pos = 0;
+    while (pos <= value.size()) {
+        auto end = value.find(',', pos);
+        auto item = trim(value.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+        if (!item.empty()) {
+            items.emplace_back(item);
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        pos = end + 1;
+    }
+    return items;
+}
+
+// WireGuard keys are 32 bytes in base64 (44 characters with one '=')
+std::optional<WireGuardProfile::Key> decodeKey(std::string_view encoded) {
+    if (encoded.size() != 44 || encoded.back() != '=') {
+        return std::nullopt;
+    }
+    std::array<std::uint8_t, 33> decoded{};
+    if (EVP_DecodeBlock(decoded.data(), reinterpret_cast<const unsigned char*>(encoded.data()),
+                        static_cast<int>(encoded.size())) != 33) {
+        return std::nullopt;
+    }
+    WireGuardProfile::Key key{};
+    std::copy_n(decoded.begin(), key.size(), key.begin());
+    secureWipe(decoded.data(), decoded.size());
+    return key;
+}
+
+bool isAddress(const std::string& text) {
+    std::array<std::uint8_t, 16> ignored{};
+    return inet_pton(AF_INET, text.c_str(), ignored.data()) == 1 || inet_pton(AF_INET6, text.c_str(), ignored.data()) == 1;
+}
+
+} // namespace
+
+bool WireGuardProfile::isWireGuard(std::string_view content) {
+    std::size_t lineStart = 0;
+    while (lineStart < content.size()) {
+        auto lineEnd = content.find('\n', lineStart);
+        auto line = trim(content.substr(lineStart, lineEnd == std::string_view::npos ? std::string_view::npos
+                                                                                      : lineEnd - lineStart));
+        if (line.size() == 11 && lower(line) == "[interface]") {
+            return true;
+        }
+        if (lineEnd == std::string_view::npos) {
+            break;
+        }
+        lineStart = lineEnd + 1;
+    }
+    return false;
+}
+
+WireGuardProfile WireGuardProfile::parse(std::string_view content) {
+    WireGuardProfile profile;
+    enum class Section { None, Interface, Peer } section = Section::None;
+
+    std::size_t lineStart = 0;
+    int lineNumber = 0;
+    while (lineStart < content.size()) {
+        auto lineEnd = content.find('\n', lineStart);
+        auto line = content.substr(lineStart, lineEnd == std::string_view::npos ? std::string_view::npos
+                                                                                 : lineEnd - lineStart);
+        lineStart = lineEnd == std::string_view::npos ? content.size() : lineEnd + 1;
+        ++lineNumber;
+
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        auto fail = [lineNumber](const std::string& message) {
+            return std::runtime_error("WireGuard profile line " + std::to_string(lineNumber) + ": " + message);
+        };
+
+        if (line.front() == '[') {
+            const std::string name = lower(line);
+            if (name == "[interface]") {
+                section = Section::Interface;
+            } else if (name == "[peer]") {
+                section = Section::Peer;
+                profile.peers.emplace_back();
+            } else {
+                throw fail("unknown section " + std::string(line));
+            }
+            continue;
+        }
+
+        const auto equals = line.find('=');
+        if (equals == std::string_view::npos || section == Section::None) {
+            throw fail("expected \"Key = Value\" inside a section");
+        }
+        const std::string key = lower(trim(line.substr(0, equals)));
+        const std::string_view value = trim(line.substr(equals + 1));
+
+        if (section == Section::Interface) {
+            if (key == "privatekey") {
+                auto decoded = decodeKey(value);
+                if (!decoded) {
+                    throw fail("PrivateKey is not a base64 WireGuard key");
+                }
+                profile.privateKey.assign(decoded->begin(), decoded->end());
+                secureWipe(decoded->data(), decoded->size());
+            } else if (key == "address") {
+                auto addresses = splitList(value);
+                profile.addresses.insert(profile.addresses.end(), addresses.begin(), addresses.end());
+            } else if (key == "dns") {
+                for (auto& entry : splitList(value)) {
+                    if (isAddress(entry)) {
+                        profile.dnsServers.push_back(std::move(entry));
+                    }
+                }
+            } else if (key == "mtu") {
+                int mtu = 0;
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), mtu);
+                if (error != std::errc() || end != value.data() + value.size() || mtu < 576 || mtu > 65535) {
+                    throw fail("MTU must be a number between 576 and 65535");
+                }
+                profile.mtu = mtu;
+            } else if (key != "listenport" && key != "fwmark") {
+                profile.ignoredKeys.emplace_back(trim(line.substr(0, equals)));
+            }
+            continue;
+        }
+
+        Peer& peer = profile.peers.back();
+        if (key == "publickey" || key == "presharedkey") {
+            auto decoded = decodeKey(value);
+            if (!decoded) {
+                throw fail(std::string(key == "publickey" ? "PublicKey" : "PresharedKey") + " is not a base64 WireGuard key");
+            }
+            if (key == "publickey") {
+                peer.publicKey = *decoded;
+            } else {
+                peer.presharedKey = *decoded;
+            }
+            secureWipe(decoded->data(), decoded->size());
+        } else if (key == "endpoint") {
+            // "host:port" or "[2001:db8::1]:port"
+            const auto colon = value.rfind(':');
+            if (colon == std::string_view::npos || colon + 1 == value.size()) {
+                throw fail("Endpoint needs a port");
+            }
+            std::string_view host = value.substr(0, colon);
+            if (host.starts_with('[') && host.ends_with(']')) {
+                host = host.substr(1, host.size() - 2);
+            }
+            peer.host = host;
+            peer.port = value.substr(colon + 1);
+        } else if (key == "allowedips") {
+            auto ranges = splitList(value);
+            peer.allowedIps.insert(peer.allowedIps.end(), ranges.begin(), ranges.end());
+        } else if (key == "persistentkeepalive") {
+            int seconds = 0;
+            if (value != "off") {
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+                if (error != std::errc() || end != value.data() + value.size() || seconds < 0 || seconds > 65535) {
+                    throw fail("PersistentKeepalive must be \"off\" or a number of seconds");
+                }
+            }
+            peer.persistentKeepalive = std::chrono::seconds(seconds);
+        } else {
+            profile.ignoredKeys.emplace_back(trim(line.substr(0, equals)));
+        }
+    }
+
+    if (profile.privateKey.size() != 32) {
+        throw std::runtime_error("WireGuard profile has no PrivateKey");
+    }
+    const Key none{};
+    for (const auto& peer : profile.peers) {
+        if (peer.publicKey == none) {
+            throw std::runtime_error("WireGuard profile has a [Peer] without PublicKey");
+        }
+    }
+    if (std::none_of(profile.peers.begin(), profile.peers.end(), [](const Peer& peer) { return !peer.host.empty(); })) {
+        throw std::runtime_error("WireGuard profile has no [Peer] with an Endpoint");
+    }
+    return profile;
+}
+
+const WireGuardProfile::Peer& WireGuardProfile::server() const {
+    return *std::find_if(peers.begin(), peers.end(), [](const Peer& peer) { return !peer.host.empty(); });
+}
@@ -0,0 +1,36 @@
+#pragma once
+import std;
+#include "secureMemory.h"
+
+// wg-quick style WireGuard configuration: an [Interface] section with the
+// client's key and addresses and one [Peer] per server. Stored next to the
+// .ovpn profiles; VpnConfigManager tells them apart with isWireGuard().
+class WireGuardProfile {
+public:
+    using Key = std::array<std::uint8_t, 32>;
+
+    struct Peer {
+        Key publicKey{};
+        std::optional<Key> presharedKey;
+        std::string host;  // Endpoint, empty if the peer has none
+        std::string port = "51820";
+        std::vector<std::string> allowedIps;
+        std::chrono::seconds persistentKeepalive{0};
+    };
+
+    // True if the text has an [Interface] section
+    static bool isWireGuard(std::string_view content);
+    // Throws std::runtime_error naming the line for malformed keys or values,
+    // and if the private key or a peer with an endpoint is missing
+    static WireGuardProfile parse(std::string_view content);
+
+    // The peer the client connects to: the first one with an endpoint
+    const Peer& server() const;
+
+    SecureBytes privateKey;
+    std::vector<std::string> addresses;   // "10.0.0.2/32", "fd00::2/128"
+    std::vector<std::string> dnsServers;  // addresses only; search domains are dropped
+    std::optional<int> mtu;
+    std::vector<Peer> peers;
+    std::vector<std::string> ignoredKeys; // wg-quick options the client does not act on (PostUp, Table, ...)
+};
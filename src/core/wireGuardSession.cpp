@@ -0,0 +1,577 @@
+import std;
+#include "wireGuardSession.h"
+#include "secureMemory.h"
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+namespace {
+
+using Key = WireGuardSession::Key;
+using Bytes = std::span<const std::uint8_t>;
+
+constexpr std::string_view construction = "Noise_IKpsk2_25519_ChaChaPoly_BLAKE2s";
+constexpr std::string_view identifier = "WireGuard v1 zx2c4 Jason@zx2c4.com";
+constexpr std::string_view labelMac1 = "mac1----";
+constexpr std::string_view labelCookie = "cookie--";
+
+constexpr std::size_t macSize = 16;
+constexpr std::size_t transportHeaderSize = 16;  // type, receiver index, counter
+// Blocks of the replay bitmap; the window is one block short of all of them
+constexpr std::size_t replayBlocks = 32;
+constexpr std::uint64_t replayWindow = (replayBlocks - 1) * 64;
+
+Bytes bytes(std::string_view text) {
+    return {reinterpret_cast<const std::uint8_t*>(text.data()), text.size()};
+}
+
+void writeLe32(std::uint8_t* out, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<std::uint8_t>(value >> (8 * i));
+    }
+}
+
+std::uint32_t readLe32(const std::uint8_t* in) {
+    return static_cast<std::uint32_t>(in[0]) | (static_cast<std::uint32_t>(in[1]) << 8) |
+           (static_cast<std::uint32_t>(in[2]) << 16) | (static_cast<std::uint32_t>(in[3]) << 24);
+}
+
+void writeLe64(std::uint8_t* out, std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<std::uint8_t>(value >> (8 * i));
+    }
+}
+
+std::uint64_t readLe64(const std::uint8_t* in) {
+    std::uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// HASH(parts...): BLAKE2s-256
+Key hash(std::initializer_list<Bytes> parts) {
+    Key out{};
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx && EVP_DigestInit_ex(ctx, EVP_blake2s256(), nullptr) == 1;
+    for (const auto& part : parts) {
+        ok = ok && EVP_DigestUpdate(ctx, part.data(), part.size()) == 1;
+    }
+    ok = ok && EVP_DigestFinal_ex(ctx, out.data(), nullptr) == 1;
+    EVP_MD_CTX_free(ctx);
+    if (!ok) {
+        throw std::runtime_error("BLAKE2s is not available");
+    }
+    return out;
+}
+
+// HMAC-BLAKE2s, the building block of the handshake's KDF
+Key hmac(Bytes key, std::initializer_list<Bytes> parts) {
+    Key out{};
+    EVP_MAC* mac = EVP_MAC_fetch(nullptr, OSSL_MAC_NAME_HMAC, nullptr);
+    EVP_MAC_CTX* ctx = mac ? EVP_MAC_CTX_new(mac) : nullptr;
+    char digest[] = "BLAKE2S-256";
+    const std::array<OSSL_PARAM, 2> params{OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+                                           OSSL_PARAM_construct_end()};
+    bool ok = ctx && EVP_MAC_init(ctx, key.data(), key.size(), params.data()) == 1;
+    for (const auto& part : parts) {
+        ok = ok && EVP_MAC_update(ctx, part.data(), part.size()) == 1;
+    }
+    std::size_t written = 0;
+    ok = ok && EVP_MAC_final(ctx, out.data(), &written, out.size()) == 1 && written == out.size();
+    EVP_MAC_CTX_free(ctx);
+    EVP_MAC_free(mac);
+    if (!ok) {
+        throw std::runtime_error("HMAC-BLAKE2s is not available");
+    }
+    return out;
+}
+
+// KDFn(key, input): the first n outputs of HKDF with HMAC-BLAKE2s
+template <std::size_t n>
+std::array<Key, n> kdf(const Key& key, Bytes input) {
+    Key secret = hmac(key, {input});
+    std::array<Key, n> out{};
+    const std::uint8_t one = 1;
+    out[0] = hmac(secret, {Bytes(&one, 1)});
+    for (std::size_t i = 1; i < n; ++i) {
+        const auto counter = static_cast<std::uint8_t>(i + 1);
+        out[i] = hmac(secret, {out[i - 1], Bytes(&counter, 1)});
+    }
+    secureWipe(secret.data(), secret.size());
+    return out;
+}
+
+// MAC(key, data): keyed BLAKE2s with a 16-byte output
+std::array<std::uint8_t, macSize> mac(Bytes key, Bytes data) {
+    std::array<std::uint8_t, macSize> out{};
+    EVP_MAC* blake = EVP_MAC_fetch(nullptr, "BLAKE2SMAC", nullptr);
+    EVP_MAC_CTX* ctx = blake ? EVP_MAC_CTX_new(blake) : nullptr;
+    std::size_t size = out.size();
+    const std::array<OSSL_PARAM, 2> params{OSSL_PARAM_construct_size_t(OSSL_MAC_PARAM_SIZE, &size),
+                                           OSSL_PARAM_construct_end()};
+    std::size_t written = 0;
+    const bool ok = ctx && EVP_MAC_init(ctx, key.data(), key.size(), params.data()) == 1 &&
+                    EVP_MAC_update(ctx, data.data(), data.size()) == 1 &&
+                    EVP_MAC_final(ctx, out.data(), &written, out.size()) == 1 && written == out.size();
+    EVP_MAC_CTX_free(ctx);
+    EVP_MAC_free(blake);
+    if (!ok) {
+        throw std::runtime_error("keyed BLAKE2s is not available");
+    }
+    return out;
+}
+
+Key publicKey(EVP_PKEY* key) {
+    Key out{};
+    std::size_t length = out.size();
+    if (EVP_PKEY_get_raw_public_key(key, out.data(), &length) != 1 || length != out.size()) {
+        throw std::runtime_error("Cannot derive the X25519 public key");
+    }
+    return out;
+}
+
+// DH(private, public) with X25519; nullopt for low-order points (all-zero result)
+std::optional<Key> dh(EVP_PKEY* privateKey, const Key& peer) {
+    EVP_PKEY* peerKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, peer.data(), peer.size());
+    EVP_PKEY_CTX* ctx = peerKey ? EVP_PKEY_CTX_new(privateKey, nullptr) : nullptr;
+    Key shared{};
+    std::size_t length = shared.size();
+    const bool ok = ctx && EVP_PKEY_derive_init(ctx) == 1 && EVP_PKEY_derive_set_peer(ctx, peerKey) == 1 &&
+                    EVP_PKEY_derive(ctx, shared.data(), &length) == 1 && length == shared.size();
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peerKey);
+    if (!ok) {
+        return std::nullopt;
+    }
+    return shared;
+}
+
+// ChaCha20-Poly1305 with the counter as nonce; out may be in. Encrypting
+// appends the tag to out, decrypting expects it at the end of in.
+bool aead(bool encrypt, Bytes key, std::span<const std::uint8_t, 12> nonce, Bytes in, std::uint8_t* out, Bytes aad) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    const std::size_t length = encrypt ? in.size() : in.size() - WireGuardSession::tagSize;
+    int written = 0;
+    bool ok = ctx && (encrypt ? EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data())
+                              : EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nonce.data())) == 1;
+    if (ok && !encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(WireGuardSession::tagSize),
+                                 const_cast<std::uint8_t*>(in.data() + length)) == 1;
+    }
+    if (encrypt) {
+        ok = ok && EVP_EncryptUpdate(ctx, nullptr, &written, aad.data(), static_cast<int>(aad.size())) == 1 &&
+             (length == 0 || EVP_EncryptUpdate(ctx, out, &written, in.data(), static_cast<int>(length)) == 1) &&
+             EVP_EncryptFinal_ex(ctx, nullptr, &written) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(WireGuardSession::tagSize), out + length) == 1;
+    } else {
+        ok = ok && EVP_DecryptUpdate(ctx, nullptr, &written, aad.data(), static_cast<int>(aad.size())) == 1 &&
+             (length == 0 || EVP_DecryptUpdate(ctx, out, &written, in.data(), static_cast<int>(length)) == 1) &&
+             EVP_DecryptFinal_ex(ctx, nullptr, &written) == 1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+std::array<std::uint8_t, 12> counterNonce(std::uint64_t counter) {
+    std::array<std::uint8_t, 12> nonce{};
+    writeLe64(nonce.data() + 4, counter);
+    return nonce;
+}
+
+// HChaCha20: derives the XChaCha20 subkey from the key and the first 16 nonce bytes
+Key hchacha20(Bytes key, Bytes nonce) {
+    std::array<std::uint32_t, 16> s{0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (std::size_t i = 0; i < 8; ++i) {
+        s[4 + i] = readLe32(key.data() + 4 * i);
+    }
+    for (std::size_t i = 0; i < 4; ++i) {
+        s[12 + i] = readLe32(nonce.data() + 4 * i);
+    }
+    auto quarterRound = [&s](std::size_t a, std::size_t b, std::size_t c, std::size_t d) {
+        s[a] += s[b]; s[d] = std::rotl(s[d] ^ s[a], 16);
+        s[c] += s[d]; s[b] = std::rotl(s[b] ^ s[c], 12);
+        s[a] += s[b]; s[d] = std::rotl(s[d] ^ s[a], 8);
+        s[c] += s[d]; s[b] = std::rotl(s[b] ^ s[c], 7);
+    };
+    for (int round = 0; round < 10; ++round) {
+        quarterRound(0, 4, 8, 12);
+        quarterRound(1, 5, 9, 13);
+        quarterRound(2, 6, 10, 14);
+        quarterRound(3, 7, 11, 15);
+        quarterRound(0, 5, 10, 15);
+        quarterRound(1, 6, 11, 12);
+        quarterRound(2, 7, 8, 13);
+        quarterRound(3, 4, 9, 14);
+    }
+    Key out{};
+    for (std::size_t i = 0; i < 4; ++i) {
+        writeLe32(out.data() + 4 * i, s[i]);
+        writeLe32(out.data() + 16 + 4 * i, s[12 + i]);
+    }
+    secureWipe(s.data(), sizeof(s));
+    return out;
+}
+
+// TAI64N of the wall clock, big-endian as the protocol wants it
+std::array<std::uint8_t, 12> timestamp() {
+    const auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch);
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch - seconds);
+    const std::uint64_t tai = 0x400000000000000aULL + static_cast<std::uint64_t>(seconds.count());
+    const auto nanos = static_cast<std::uint32_t>(nanoseconds.count());
+    std::array<std::uint8_t, 12> out{};
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<std::uint8_t>(tai >> (56 - 8 * i));
+    }
+    for (int i = 0; i < 4; ++i) {
+        out[8 + i] = static_cast<std::uint8_t>(nanos >> (24 - 8 * i));
+    }
+    return out;
+}
+
+std::uint32_t randomIndex() {
+    std::uint32_t index = 0;
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(&index), sizeof(index)) != 1) {
+        throw std::runtime_error("No randomness for a session index");
+    }
+    return index;
+}
+
+EVP_CIPHER_CTX* transportCipher(bool encrypt, const Key& key) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    const bool ok = ctx && (encrypt ? EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nullptr)
+                                    : EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), nullptr, key.data(), nullptr)) == 1;
+    if (!ok) {
+        EVP_CIPHER_CTX_free(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+} // namespace
+
+std::optional<WireGuardSession::MessageType> WireGuardSession::messageType(std::span<const std::uint8_t> packet) {
+    if (packet.size() < 4 || packet[1] != 0 || packet[2] != 0 || packet[3] != 0) {
+        return std::nullopt;
+    }
+    switch (packet[0]) {
+        case 1:
+            return packet.size() == initiationSize ? std::optional(MessageType::Initiation) : std::nullopt;
+        case 2:
+            return packet.size() == responseSize ? std::optional(MessageType::Response) : std::nullopt;
+        case 3:
+            return packet.size() == cookieReplySize ? std::optional(MessageType::CookieReply) : std::nullopt;
+        case 4:
+            return packet.size() >= transportHeaderSize + tagSize ? std::optional(MessageType::Transport) : std::nullopt;
+        default:
+            return std::nullopt;
+    }
+}
+
+WireGuardSession::WireGuardSession(std::span<const std::uint8_t> privateKey, const Key& peerPublicKey,
+                                   const std::optional<Key>& presharedKey)
+    : peerPublic(peerPublicKey), presharedKey(presharedKey.value_or(Key{})) {
+    if (privateKey.size() != 32) {
+        throw std::runtime_error("WireGuard private keys are 32 bytes");
+    }
+    staticKey = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, nullptr, privateKey.data(), privateKey.size());
+    if (!staticKey) {
+        throw std::runtime_error("X25519 is not available");
+    }
+    localPublic = publicKey(staticKey);
+    auto shared = dh(staticKey, peerPublic);
+    if (!shared) {
+        EVP_PKEY_free(staticKey);
+        throw std::runtime_error("The peer's public key is not a usable X25519 key");
+    }
+    staticShared = *shared;
+
+    initialChainingKey = hash({bytes(construction)});
+    initialHash = hash({hash({initialChainingKey, bytes(identifier)}), peerPublic});
+    peerMac1Key = hash({bytes(labelMac1), peerPublic});
+    localMac1Key = hash({bytes(labelMac1), localPublic});
+    cookieKey = hash({bytes(labelCookie), peerPublic});
+}
+
+WireGuardSession::~WireGuardSession() {
+    clearHandshake();
+    freeKeypair(current);
+    freeKeypair(previous);
+    EVP_PKEY_free(staticKey);
+    secureWipe(presharedKey.data(), presharedKey.size());
+    secureWipe(staticShared.data(), staticShared.size());
+}
+
+void WireGuardSession::freeKeypair(std::unique_ptr<Keypair>& keypair) {
+    if (keypair) {
+        EVP_CIPHER_CTX_free(keypair->send);
+        EVP_CIPHER_CTX_free(keypair->receive);
+        keypair.reset();
+    }
+}
+
+void WireGuardSession::clearHandshake() {
+    EVP_PKEY_free(handshake.ephemeral);
+    secureWipe(handshake.chainingKey.data(), handshake.chainingKey.size());
+    handshake = Handshake{};
+    inFlight = false;
+}
+
+std::vector<std::uint8_t> WireGuardSession::createInitiation() {
+    clearHandshake();
+    handshake.ephemeral = EVP_PKEY_Q_keygen(nullptr, nullptr, "X25519");
+    if (!handshake.ephemeral) {
+        throw std::runtime_error("Cannot generate an X25519 key");
+    }
+    handshake.localIndex = randomIndex();
+    const Key ephemeralPublic = publicKey(handshake.ephemeral);
+
+    std::vector<std::uint8_t> message(initiationSize, 0);
+    message[0] = static_cast<std::uint8_t>(MessageType::Initiation);
+    writeLe32(message.data() + 4, handshake.localIndex);
+    std::copy(ephemeralPublic.begin(), ephemeralPublic.end(), message.begin() + 8);
+
+    Key chainingKey = kdf<1>(initialChainingKey, ephemeralPublic)[0];
+    Key h = hash({initialHash, ephemeralPublic});
+
+    auto ephemeralShared = dh(handshake.ephemeral, peerPublic);
+    if (!ephemeralShared) {
+        throw std::runtime_error("The peer's public key is not a usable X25519 key");
+    }
+    auto keys = kdf<2>(chainingKey, *ephemeralShared);
+    secureWipe(ephemeralShared->data(), ephemeralShared->size());
+    chainingKey = keys[0];
+    Key key = keys[1];
+    const auto zeroNonce = counterNonce(0);
+    aead(true, key, zeroNonce, localPublic, message.data() + 40, h);
+    h = hash({h, Bytes(message.data() + 40, 48)});
+
+    keys = kdf<2>(chainingKey, staticShared);
+    chainingKey = keys[0];
+    key = keys[1];
+    secureWipe(keys.data(), sizeof(keys));
+    // Initiations must carry increasing timestamps or the peer drops them
+    auto now = timestamp();
+    if (std::lexicographical_compare(now.begin(), now.end(), lastTimestamp.begin(), lastTimestamp.end()) ||
+        now == lastTimestamp) {
+        now = lastTimestamp;
+        for (auto it = now.rbegin(); it != now.rend() && ++*it == 0; ++it) {
+        }
+    }
+    lastTimestamp = now;
+    aead(true, key, zeroNonce, now, message.data() + 88, h);
+    h = hash({h, Bytes(message.data() + 88, 28)});
+    secureWipe(key.data(), key.size());
+
+    handshake.mac1 = mac(peerMac1Key, Bytes(message.data(), 116));
+    std::copy(handshake.mac1.begin(), handshake.mac1.end(), message.begin() + 116);
+    if (cookieReceived && Clock::now() - *cookieReceived < cookieLifetime) {
+        const auto mac2 = mac(cookie, Bytes(message.data(), 132));
+        std::copy(mac2.begin(), mac2.end(), message.begin() + 132);
+    }
+
+    handshake.chainingKey = chainingKey;
+    handshake.hash = h;
+    secureWipe(chainingKey.data(), chainingKey.size());
+    inFlight = true;
+    return message;
+}
+
+bool WireGuardSession::handshakeInFlight() const {
+    return inFlight;
+}
+
+bool WireGuardSession::consumeResponse(std::span<const std::uint8_t> packet, Clock::time_point now) {
+    if (!inFlight || messageType(packet) != MessageType::Response || readLe32(packet.data() + 8) != handshake.localIndex) {
+        return false;
+    }
+    const auto expectedMac1 = mac(localMac1Key, packet.first(60));
+    if (CRYPTO_memcmp(expectedMac1.data(), packet.data() + 60, macSize) != 0) {
+        ++counters.authFailures;
+        return false;
+    }
+
+    Key responderEphemeral{};
+    std::copy_n(packet.begin() + 12, responderEphemeral.size(), responderEphemeral.begin());
+    Key chainingKey = kdf<1>(handshake.chainingKey, responderEphemeral)[0];
+    Key h = hash({handshake.hash, responderEphemeral});
+
+    auto ephemeralShared = dh(handshake.ephemeral, responderEphemeral);
+    auto staticEphemeral = dh(staticKey, responderEphemeral);
+    if (!ephemeralShared || !staticEphemeral) {
+        ++counters.authFailures;
+        return false;
+    }
+    chainingKey = kdf<1>(chainingKey, *ephemeralShared)[0];
+    chainingKey = kdf<1>(chainingKey, *staticEphemeral)[0];
+    secureWipe(ephemeralShared->data(), ephemeralShared->size());
+    secureWipe(staticEphemeral->data(), staticEphemeral->size());
+
+    auto [nextKey, tau, key] = kdf<3>(chainingKey, presharedKey);
+    chainingKey = nextKey;
+    h = hash({h, tau});
+    std::array<std::uint8_t, 1> ignored{};
+    const bool authentic = aead(false, key, counterNonce(0), packet.subspan(44, tagSize), ignored.data(), h);
+    secureWipe(key.data(), key.size());
+    secureWipe(tau.data(), tau.size());
+    if (!authentic) {
+        secureWipe(chainingKey.data(), chainingKey.size());
+        ++counters.authFailures;
+        return false;
+    }
+
+    auto [sendKey, receiveKey] = kdf<2>(chainingKey, {});
+    secureWipe(chainingKey.data(), chainingKey.size());
+    auto keypair = std::make_unique<Keypair>();
+    keypair->send = transportCipher(true, sendKey);
+    keypair->receive = transportCipher(false, receiveKey);
+    secureWipe(sendKey.data(), sendKey.size());
+    secureWipe(receiveKey.data(), receiveKey.size());
+    if (!keypair->send || !keypair->receive) {
+        freeKeypair(keypair);
+        return false;
+    }
+    keypair->localIndex = handshake.localIndex;
+    keypair->remoteIndex = readLe32(packet.data() + 4);
+    keypair->created = now;
+
+    clearHandshake();
+    freeKeypair(previous);
+    previous = std::move(current);
+    current = std::move(keypair);
+    ++counters.handshakes;
+    return true;
+}
+
+bool WireGuardSession::consumeCookieReply(std::span<const std::uint8_t> packet, Clock::time_point now) {
+    if (!inFlight || messageType(packet) != MessageType::CookieReply || readLe32(packet.data() + 4) != handshake.localIndex) {
+        return false;
+    }
+    // XChaCha20-Poly1305: HChaCha20 subkey, then the last 8 nonce bytes
+    Key subkey = hchacha20(cookieKey, packet.subspan(8, 16));
+    std::array<std::uint8_t, 12> nonce{};
+    std::copy_n(packet.begin() + 24, 8, nonce.begin() + 4);
+    std::array<std::uint8_t, 16> opened{};
+    const bool ok = aead(false, subkey, nonce, packet.subspan(32, 32), opened.data(), handshake.mac1);
+    secureWipe(subkey.data(), subkey.size());
+    if (!ok) {
+        ++counters.authFailures;
+        return false;
+    }
+    cookie = opened;
+    cookieReceived = now;
+    return true;
+}
+
+bool WireGuardSession::canSend(Clock::time_point now) const {
+    return current && now - current->created < rejectAfterTime && current->sendCounter < rejectAfterMessages;
+}
+
+bool WireGuardSession::wantsRekey(Clock::time_point now) const {
+    return current && (now - current->created >= rekeyAfterTime || current->sendCounter >= rekeyAfterMessages);
+}
+
+std::optional<WireGuardSession::Clock::time_point> WireGuardSession::keypairCreated() const {
+    return current ? std::optional(current->created) : std::nullopt;
+}
+
+std::span<std::uint8_t> WireGuardSession::sealInPlace(std::span<std::uint8_t> buffer, std::size_t length,
+                                                      Clock::time_point now) {
+    const std::size_t padded = (length + 15) / 16 * 16;
+    if (!canSend(now) || headroom + padded + tagSize > buffer.size()) {
+        return {};
+    }
+    std::uint8_t* header = buffer.data();
+    std::uint8_t* body = header + headroom;
+    std::fill(body + length, body + padded, std::uint8_t{0});
+
+    const std::uint64_t counter = current->sendCounter++;
+    const auto nonce = counterNonce(counter);
+    EVP_CIPHER_CTX* ctx = current->send;
+    int ignored = 0;
+    if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce.data()) != 1 ||
+        (padded > 0 && EVP_EncryptUpdate(ctx, body, &ignored, body, static_cast<int>(padded)) != 1) ||
+        EVP_EncryptFinal_ex(ctx, nullptr, &ignored) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(tagSize), body + padded) != 1) {
+        return {};
+    }
+    header[0] = static_cast<std::uint8_t>(MessageType::Transport);
+    header[1] = header[2] = header[3] = 0;
+    writeLe32(header + 4, current->remoteIndex);
+    writeLe64(header + 8, counter);
+    ++counters.sealed;
+    return buffer.first(transportHeaderSize + padded + tagSize);
+}
+
+std::optional<std::size_t> WireGuardSession::open(std::span<const std::uint8_t> packet, std::span<std::uint8_t> out,
+                                                  Clock::time_point now) {
+    if (messageType(packet) != MessageType::Transport) {
+        return std::nullopt;
+    }
+    const std::uint32_t receiver = readLe32(packet.data() + 4);
+    Keypair* keypair = current && current->localIndex == receiver     ? current.get()
+                       : previous && previous->localIndex == receiver ? previous.get()
+                                                                      : nullptr;
+    const std::size_t length = packet.size() - transportHeaderSize - tagSize;
+    if (!keypair || now - keypair->created >= rejectAfterTime || length > out.size()) {
+        ++counters.authFailures;
+        return std::nullopt;
+    }
+
+    const std::uint64_t counter = readLe64(packet.data() + 8);
+    const auto nonce = counterNonce(counter);
+    const std::uint8_t* body = packet.data() + transportHeaderSize;
+    EVP_CIPHER_CTX* ctx = keypair->receive;
+    int ignored = 0;
+    const bool ok = EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce.data()) == 1 &&
+                    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(tagSize),
+                                        const_cast<std::uint8_t*>(body + length)) == 1 &&
+                    (length == 0 || EVP_DecryptUpdate(ctx, out.data(), &ignored, body, static_cast<int>(length)) == 1) &&
+                    EVP_DecryptFinal_ex(ctx, nullptr, &ignored) == 1;
+    if (!ok) {
+        ++counters.authFailures;
+        return std::nullopt;
+    }
+    // Only authentic packets move the window, so forgeries cannot push it ahead
+    if (!acceptCounter(*keypair, counter)) {
+        ++counters.replays;
+        return std::nullopt;
+    }
+    ++counters.opened;
+    return length;
+}
+
+bool WireGuardSession::acceptCounter(Keypair& keypair, std::uint64_t counter) {
+    if (counter >= rejectAfterMessages) {
+        return false;
+    }
+    const std::uint64_t block = counter / 64;
+    if (!keypair.receivedAny) {
+        keypair.highestReceived = counter;
+        keypair.receivedAny = true;
+    } else if (counter > keypair.highestReceived) {
+        // Blocks the window slides over are reused for the new counters
+        const std::uint64_t newest = keypair.highestReceived / 64;
+        const std::uint64_t advance = std::min<std::uint64_t>(block - newest, replayBlocks);
+        for (std::uint64_t i = 1; i <= advance; ++i) {
+            keypair.receivedBlocks[(newest + i) % replayBlocks] = 0;
+        }
+        keypair.highestReceived = counter;
+    } else if (keypair.highestReceived - counter >= replayWindow) {
+        return false;
+    }
+    std::uint64_t& bits = keypair.receivedBlocks[block % replayBlocks];
+    const std::uint64_t bit = std::uint64_t{1} << (counter % 64);
+    if (bits & bit) {
+        return false;
+    }
+    bits |= bit;
+    return true;
+}
+
+WireGuardSession::Stats WireGuardSession::stats() const {
+    return counters;
+}
@@ -0,0 +1,128 @@
+#pragma once
+import std;
+#include <openssl/evp.h>
+
+// WireGuard as the initiator of a session with one peer: the
+// Noise_IKpsk2_25519_ChaChaPoly_BLAKE2s handshake, cookie replies, and the
+// transport keypairs it yields. Like DataChannel, each keypair keys its
+// ChaCha20-Poly1305 contexts once and packets only set the nonce; payloads
+// are sealed in place inside pooled buffers. The previous keypair keeps
+// decrypting after a rekey until the peer has switched over.
+class WireGuardSession {
+public:
+    using Key = std::array<std::uint8_t, 32>;
+    using Clock = std::chrono::steady_clock;
+
+    enum class MessageType : std::uint8_t { Initiation = 1, Response = 2, CookieReply = 3, Transport = 4 };
+
+    struct Stats {
+        std::uint64_t sealed = 0;
+        std::uint64_t opened = 0;        // keepalives included
+        std::uint64_t authFailures = 0;  // forged, corrupted or for an unknown keypair
+        std::uint64_t replays = 0;
+        std::uint64_t handshakes = 0;
+    };
+
+    static constexpr std::size_t initiationSize = 148;
+    static constexpr std::size_t responseSize = 92;
+    static constexpr std::size_t cookieReplySize = 64;
+    static constexpr std::size_t tagSize = 16;
+    // Room sealInPlace() needs around the payload: the transport header in
+    // front, padding to 16 bytes and the tag behind
+    static constexpr std::size_t headroom = 16;
+    static constexpr std::size_t tailroom = 15 + tagSize;
+
+    // Protocol timers and limits (WireGuard paper, section 6)
+    static constexpr std::chrono::seconds rekeyAfterTime{120};
+    static constexpr std::chrono::seconds rejectAfterTime{180};
+    static constexpr std::chrono::seconds rekeyAttemptTime{90};
+    static constexpr std::chrono::seconds rekeyTimeout{5};
+    static constexpr std::chrono::seconds keepaliveTimeout{10};
+    static constexpr std::chrono::seconds cookieLifetime{120};
+    static constexpr std::uint64_t rekeyAfterMessages = std::uint64_t{1} << 60;
+    static constexpr std::uint64_t rejectAfterMessages = ~std::uint64_t{0} - (std::uint64_t{1} << 13);
+
+    static std::optional<MessageType> messageType(std::span<const std::uint8_t> packet);
+
+    // Throws std::runtime_error if a key is unusable or a primitive is missing from OpenSSL
+    WireGuardSession(std::span<const std::uint8_t> privateKey, const Key& peerPublicKey,
+                     const std::optional<Key>& presharedKey);
+    ~WireGuardSession();
+
+    WireGuardSession(const WireGuardSession&) = delete;
+    WireGuardSession& operator=(const WireGuardSession&) = delete;
+
+    // A handshake initiation to send; replaces the one in flight, if any
+    std::vector<std::uint8_t> createInitiation();
+    bool handshakeInFlight() const;
+    // Completes the handshake in flight; true once its keypair is current
+    bool consumeResponse(std::span<const std::uint8_t> packet, Clock::time_point now);
+    // Keeps the cookie the peer sent under load for the next initiation's mac2
+    bool consumeCookieReply(std::span<const std::uint8_t> packet, Clock::time_point now);
+
+    // A current keypair that may still send
+    bool canSend(Clock::time_point now) const;
+    // The sending keypair is old or worn enough that the initiator should rekey
+    bool wantsRekey(Clock::time_point now) const;
+    // When the current keypair was made; nullopt without one
+    std::optional<Clock::time_point> keypairCreated() const;
+
+    // Pads and encrypts the payload at buffer[headroom, headroom + length)
+    // where it lies and writes the transport header in front of it; the wire
+    // packet is the returned part of buffer. Empty without a usable keypair
+    // or if buffer is too small. A zero length makes a keepalive.
+    std::span<std::uint8_t> sealInPlace(std::span<std::uint8_t> buffer, std::size_t length, Clock::time_point now);
+    // Payload of a transport message in out, padding included (the inner IP
+    // header has the length); 0 for keepalives. nullopt if forged, replayed,
+    // expired or not for one of our keypairs.
+    std::optional<std::size_t> open(std::span<const std::uint8_t> packet, std::span<std::uint8_t> out, Clock::time_point now);
+
+    Stats stats() const;
+
+private:
+    struct Keypair {
+        EVP_CIPHER_CTX* send = nullptr;
+        EVP_CIPHER_CTX* receive = nullptr;
+        std::uint32_t localIndex = 0;
+        std::uint32_t remoteIndex = 0;
+        Clock::time_point created;
+        std::uint64_t sendCounter = 0;
+        // Replay window (RFC 6479): the newest counter and a ring of bitmap blocks behind it
+        std::uint64_t highestReceived = 0;
+        std::array<std::uint64_t, 32> receivedBlocks{};
+        bool receivedAny = false;
+    };
+
+    struct Handshake {
+        EVP_PKEY* ephemeral = nullptr;
+        Key chainingKey{};
+        Key hash{};
+        std::uint32_t localIndex = 0;
+        std::array<std::uint8_t, 16> mac1{};  // of the initiation, the cookie reply's additional data
+    };
+
+    static void freeKeypair(std::unique_ptr<Keypair>& keypair);
+    void clearHandshake();
+    bool acceptCounter(Keypair& keypair, std::uint64_t counter);
+
+    EVP_PKEY* staticKey = nullptr;
+    Key localPublic{};
+    Key peerPublic{};
+    Key presharedKey{};
+    Key staticShared{};   // DH(our static key, peer's static key), the same for every handshake
+    Key initialChainingKey{};
+    Key initialHash{};    // includes the peer's public key
+    Key peerMac1Key{};    // HASH("mac1----" || peer public), for initiations
+    Key localMac1Key{};   // HASH("mac1----" || our public), for responses
+    Key cookieKey{};      // HASH("cookie--" || peer public), opens cookie replies
+
+    Handshake handshake;
+    bool inFlight = false;
+    std::array<std::uint8_t, 12> lastTimestamp{};
+    std::array<std::uint8_t, 16> cookie{};
+    std::optional<Clock::time_point> cookieReceived;
+
+    std::unique_ptr<Keypair> current;
+    std::unique_ptr<Keypair> previous;
+    Stats counters;
+};
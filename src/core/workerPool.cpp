@@ -0,0 +1,66 @@
+import std;
+#include "workerPool.h"
+
+WorkerPool::WorkerPool(std::size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    workers.reserve(threadCount);
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        stopping = true;
+    }
+    jobsCv.notify_all();
+
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+std::size_t WorkerPool::size() const {
+    return workers.size();
+}
+
+std::size_t WorkerPool::pendingTasks() const {
+    std::lock_guard<std::mutex> lock(jobsMutex);
+    return jobs.size();
+}
+
+void WorkerPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        if (stopping) {
+            throw std::runtime_error("Worker pool is shutting down");
+        }
+        jobs.push_back(std::move(job));
+    }
+    jobsCv.notify_one();
+}
+
+void WorkerPool::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(jobsMutex);
+            jobsCv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+            // Drain remaining jobs before exiting so no future is left broken
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+    }
+}
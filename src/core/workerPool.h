@@ -0,0 +1,35 @@
+#pragma once
+import std;
+
+// Fixed-size thread pool for CPU-bound work that must not run on a
+// connection's event loop (certificate verification, profile parsing, ...).
+class WorkerPool {
+public:
+    explicit WorkerPool(std::size_t threadCount = std::max(2u, std::thread::hardware_concurrency()));
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    template <typename Func>
+    auto submit(Func&& func) -> std::future<std::invoke_result_t<std::decay_t<Func>>> {
+        using Result = std::invoke_result_t<std::decay_t<Func>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        auto future = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+    std::size_t size() const;
+    std::size_t pendingTasks() const;
+
+private:
+    void enqueue(std::function<void()> job);
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    mutable std::mutex jobsMutex;
+    std::condition_variable jobsCv;
+    bool stopping = false;
+};
@@ -3,14 +3,17 @@ import std;
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include "ui/vpnController.h"
+#include "ui/profileFilterModel.h"
 
 int main(int argc, char *argv[]) {
     QGuiApplication app(argc, argv);
 
     VpnController vpnController;
+    ProfileFilterModel profileFilter(vpnController.profileStore());
 
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextProperty("vpnController", &vpnController);
+    engine.rootContext()->setContextProperty("profileFilter", &profileFilter);
     engine.load(QUrl(QStringLiteral("qrc:/ui/main.qml")));
 
     if (engine.rootObjects().isEmpty())
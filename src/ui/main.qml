@@ -4,7 +4,7 @@ import QtQuick.Controls 2.15
 ApplicationWindow {
     visible: true
     width: 400
-    height: 300
+    height: 560
     title: "VPN Client"
 
     Column {
@@ -32,5 +32,27 @@ ApplicationWindow {
             text: "Allow communication without vpn"
             onClicked: vpnController.allowCommunicationWithoutVpn()
         }
+
+        TextField {
+            width: 360
+            placeholderText: "Search profiles (name, host, protocol, country)"
+            onTextChanged: profileFilter.query = text
+        }
+
+        Text {
+            text: profileFilter.count + " profiles"
+        }
+
+        ListView {
+            width: 360
+            height: 220
+            clip: true
+            model: profileFilter
+            delegate: Text {
+                width: ListView.view.width
+                elide: Text.ElideRight
+                text: name + "  " + host + " (" + protocol + (country ? ", " + country : "") + ")"
+            }
+        }
     }
 }
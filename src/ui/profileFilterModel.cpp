@@ -0,0 +1,63 @@
+import std;
+#include "profileFilterModel.h"
+
+ProfileFilterModel::ProfileFilterModel(VpnConfigManager& configManager, QObject* parent)
+    : QAbstractListModel(parent)
+    , configManager(configManager) {
+    refresh();
+}
+
+int ProfileFilterModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(rows.size());
+}
+
+QVariant ProfileFilterModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= static_cast<int>(rows.size())) {
+        return {};
+    }
+    const auto& info = rows[static_cast<std::size_t>(index.row())];
+    switch (role) {
+        case Qt::DisplayRole:
+        case NameRole:     return QString::fromStdString(info.name);
+        case HostRole:     return info.hosts.empty() ? QString() : QString::fromStdString(info.hosts.front());
+        case ProtocolRole: return info.protocols.empty() ? QString() : QString::fromStdString(info.protocols.front());
+        case CountryRole:  return QString::fromStdString(info.country).toUpper();
+    }
+    return {};
+}
+
+QHash<int, QByteArray> ProfileFilterModel::roleNames() const {
+    return {
+        {NameRole, "name"},
+        {HostRole, "host"},
+        {ProtocolRole, "protocol"},
+        {CountryRole, "country"}
+    };
+}
+
+QString ProfileFilterModel::query() const {
+    return currentQuery;
+}
+
+void ProfileFilterModel::setQuery(const QString& query) {
+    if (query == currentQuery) {
+        return;
+    }
+    currentQuery = query;
+    emit queryChanged();
+    refresh();
+}
+
+int ProfileFilterModel::count() const {
+    return static_cast<int>(rows.size());
+}
+
+void ProfileFilterModel::refresh() {
+    const int previousCount = count();
+    beginResetModel();
+    rows = configManager.searchProfileEntries(currentQuery.toStdString());
+    endResetModel();
+    if (count() != previousCount) {
+        emit countChanged();
+    }
+}
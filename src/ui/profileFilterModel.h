@@ -0,0 +1,43 @@
+#pragma once
+import std;
+#include <QAbstractListModel>
+#include "../core/vpnConfigManager.h"
+
+// Stored profiles matching the current search query, best matches first.
+// Set query from QML as the user types; rows are a snapshot of the profile
+// search index taken by refresh(), so painting never goes back to the store.
+class ProfileFilterModel : public QAbstractListModel {
+    Q_OBJECT
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Roles {
+        NameRole = Qt::UserRole + 1,
+        HostRole,
+        ProtocolRole,
+        CountryRole
+    };
+
+    explicit ProfileFilterModel(VpnConfigManager& configManager, QObject* parent = nullptr);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    QString query() const;
+    void setQuery(const QString& query);
+    int count() const;
+
+    // Re-runs the query, e.g. after profiles were imported
+    Q_INVOKABLE void refresh();
+
+signals:
+    void queryChanged();
+    void countChanged();
+
+private:
+    VpnConfigManager& configManager;
+    QString currentQuery;
+    std::vector<ProfileSearchIndex::Entry> rows;
+};
@@ -20,11 +20,16 @@ void VpnController::allowCommunicationWithoutVpn() {
     emit statusChanged();
 }
 
+VpnConfigManager& VpnController::profileStore() {
+    return vpn.profileStore();
+}
+
 QString VpnController::status() const {
     switch (vpn.status()) {
         case VpnStatus::Disconnected: return "Disconnected";
         case VpnStatus::Connecting:   return "Connecting...";
         case VpnStatus::Connected:    return "Connected";
+        case VpnStatus::Paused:       return "Paused";
         case VpnStatus::Error:        return "Error";
     }
     return "Unknown";
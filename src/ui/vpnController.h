@@ -14,6 +14,8 @@ public:
     Q_INVOKABLE void disconnectVpn();
     Q_INVOKABLE void allowCommunicationWithoutVpn();
     QString status() const;
+    // The connection's profile store, for models over the stored profiles
+    VpnConfigManager& profileStore();
 
 signals:
     void statusChanged();